@@ -116,6 +116,8 @@ static int support_dynamic = 0;
 static uint32_t block_mode = COAP_BLOCK_USE_LIBCOAP;
 static int echo_back = 0;
 static uint32_t csm_max_message_size = 0;
+static size_t cache_max_entries = 0;
+static size_t cache_max_bytes = 0;
 
 static coap_dtls_pki_t *
 setup_pki(coap_context_t *ctx, coap_dtls_role_t role, char *sni);
@@ -525,6 +527,7 @@ hnd_put_example_data(coap_resource_t *resource,
           data_so_far = NULL;
         }
         coap_cache_set_app_data(cache_entry, NULL, NULL);
+        coap_cache_set_app_data_size(cache_entry, 0);
       }
     }
     if (!cache_entry) {
@@ -546,11 +549,14 @@ hnd_put_example_data(coap_resource_t *resource,
                                           offset, total);
       /* Yes, data_so_far can be NULL if error */
       coap_cache_set_app_data(cache_entry, data_so_far, cache_free_app_data);
+      coap_cache_set_app_data_size(cache_entry,
+                                   data_so_far ? data_so_far->length : 0);
     }
     if (offset + size == total) {
       /* All the data is now in */
       data_so_far = coap_cache_get_app_data(cache_entry);
       coap_cache_set_app_data(cache_entry, NULL, NULL);
+      coap_cache_set_app_data_size(cache_entry, 0);
     }
     else {
       /* Give us the next block response */
@@ -663,8 +669,15 @@ typedef struct proxy_list_t {
   coap_string_t *query;     /* Incoming query */
   coap_pdu_code_t req_code; /* Incoming request code */
   coap_pdu_type_t req_type; /* Incoming request type */
+  coap_pdu_t *cache_req;    /* Incoming request if response is cacheable */
 } proxy_list_t;
 
+/* Upstream response held in a proxy cache entry */
+typedef struct proxy_cache_t {
+  coap_pdu_t *response;     /* Copy of the upstream response */
+  coap_tick_t expires;      /* When the Max-Age of the response runs out */
+} proxy_cache_t;
+
 static proxy_list_t *proxy_list = NULL;
 static size_t proxy_list_count = 0;
 static coap_resource_t *proxy_resource = NULL;
@@ -835,6 +848,7 @@ get_proxy_session(coap_session_t *session, coap_pdu_t *response,
     proxy_list[i].query = NULL;
 
   proxy_list[i].ongoing = NULL;
+  proxy_list[i].cache_req = NULL;
   proxy_list[i].req_code = req_code;
   proxy_list[i].req_type = req_type;
   proxy_list_count++;
@@ -883,6 +897,7 @@ remove_proxy_association(coap_session_t *session, int send_failure) {
   if (i != proxy_list_count) {
     coap_delete_binary(proxy_list[i].token);
     coap_delete_string(proxy_list[i].query);
+    coap_delete_pdu(proxy_list[i].cache_req);
     if (proxy_list_count-i > 1) {
        memmove (&proxy_list[i],
                 &proxy_list[i+1],
@@ -999,6 +1014,190 @@ release_proxy_body_data(coap_session_t *session COAP_UNUSED,
   coap_delete_binary(app_ptr);
 }
 
+/*
+ * Copies the options and body of the upstream response across to the
+ * response pdu for the incoming session.  If maxage is not -1, it
+ * replaces the Max-Age of the upstream response.
+ */
+static void
+proxy_copy_response(coap_session_t *incoming, const coap_pdu_t *request,
+                    const coap_string_t *query, const coap_pdu_t *received,
+                    coap_pdu_t *pdu, int maxage) {
+  size_t size;
+  const uint8_t *data;
+  size_t offset;
+  size_t total;
+  coap_optlist_t *optlist = NULL;
+  coap_opt_t *option;
+  coap_opt_iterator_t opt_iter;
+  uint16_t media_type = COAP_MEDIATYPE_TEXT_PLAIN;
+  uint64_t etag = 0;
+  coap_binary_t *body_data = NULL;
+
+  if (coap_get_data_large(received, &size, &data, &offset, &total)) {
+    /* COAP_BLOCK_SINGLE_BODY is set, so single body should be given */
+    assert(size == total);
+    body_data = coap_new_binary(total);
+    if (!body_data) {
+      coap_log(LOG_DEBUG, "body build memory error\n");
+      return;
+    }
+    memcpy(body_data->s, data, size);
+    data = body_data->s;
+  }
+  else {
+    size = 0;
+  }
+
+  /*
+   * Copy the options across, skipping those needed for
+   * coap_add_data_response_large()
+   */
+  coap_option_iterator_init(received, &opt_iter, COAP_OPT_ALL);
+  while ((option = coap_option_next(&opt_iter))) {
+    switch (opt_iter.number) {
+    case COAP_OPTION_CONTENT_FORMAT:
+      media_type = coap_decode_var_bytes(coap_opt_value (option),
+                                         coap_opt_length (option));
+      break;
+    case COAP_OPTION_MAXAGE:
+      if (maxage == -1)
+        maxage = coap_decode_var_bytes(coap_opt_value (option),
+                                       coap_opt_length (option));
+      break;
+    case COAP_OPTION_ETAG:
+      etag = coap_decode_var_bytes8(coap_opt_value (option),
+                                    coap_opt_length (option));
+      break;
+    case COAP_OPTION_BLOCK2:
+    case COAP_OPTION_SIZE2:
+      break;
+    default:
+      coap_insert_optlist(&optlist,
+                  coap_new_optlist(opt_iter.number,
+                  coap_opt_length(option),
+                  coap_opt_value(option)));
+      break;
+    }
+  }
+  coap_add_optlist_pdu(pdu, &optlist);
+  coap_delete_optlist(optlist);
+
+  if (size > 0) {
+    coap_add_data_large_response(proxy_resource, incoming, request, pdu,
+                                 query, media_type, maxage, etag, size, data,
+                                 release_proxy_body_data,
+                                 body_data);
+  }
+}
+
+static void
+proxy_cache_free_app_data(void *data) {
+  proxy_cache_t *cached = (proxy_cache_t *)data;
+
+  coap_delete_pdu(cached->response);
+  free(cached);
+}
+
+/*
+ * Keeps a copy of a 2.05 upstream response to request from incoming for
+ * the Max-Age of the response.
+ */
+static void
+proxy_cache_add(coap_session_t *incoming, const coap_pdu_t *request,
+                const coap_pdu_t *received) {
+  coap_cache_entry_t *cache_entry;
+  proxy_cache_t *cached;
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *option;
+  unsigned int maxage = COAP_DEFAULT_MAX_AGE;
+  size_t size;
+  const uint8_t *data;
+  size_t offset;
+  size_t total;
+  size_t cache_size;
+
+  option = coap_check_option(received, COAP_OPTION_MAXAGE, &opt_iter);
+  if (option)
+    maxage = coap_decode_var_bytes(coap_opt_value(option),
+                                   coap_opt_length(option));
+  if (maxage == 0)
+    return;
+
+  cached = malloc(sizeof(proxy_cache_t));
+  if (!cached)
+    return;
+  /* No maximum size, as the body may be larger than a PDU */
+  cached->response = coap_pdu_init(COAP_MESSAGE_NON,
+                                   coap_pdu_get_code(received), 0, 0);
+  if (!cached->response) {
+    free(cached);
+    return;
+  }
+  cache_size = sizeof(proxy_cache_t);
+  coap_option_iterator_init(received, &opt_iter, COAP_OPT_ALL);
+  while ((option = coap_option_next(&opt_iter))) {
+    if (opt_iter.number == COAP_OPTION_BLOCK2 ||
+        opt_iter.number == COAP_OPTION_SIZE2)
+      continue;
+    coap_add_option(cached->response, opt_iter.number,
+                    coap_opt_length(option), coap_opt_value(option));
+    cache_size += coap_opt_size(option);
+  }
+  if (coap_get_data_large(received, &size, &data, &offset, &total)) {
+    coap_add_data(cached->response, size, data);
+    cache_size += size;
+  }
+  coap_ticks(&cached->expires);
+  cached->expires += maxage * COAP_TICKS_PER_SECOND;
+
+  /* Any previous entry for the request has been found to be stale */
+  cache_entry = coap_new_cache_entry(incoming, request,
+                                     COAP_CACHE_NOT_RECORD_PDU,
+                                     COAP_CACHE_NOT_SESSION_BASED, maxage);
+  if (!cache_entry) {
+    proxy_cache_free_app_data(cached);
+    return;
+  }
+  coap_cache_set_app_data(cache_entry, cached, proxy_cache_free_app_data);
+  coap_cache_set_app_data_size(cache_entry, cache_size);
+}
+
+/*
+ * Responds to a GET request from a fresh cached upstream response, if
+ * there is one.
+ *
+ * Returns 1 if response has been filled in, else 0.
+ */
+static int
+proxy_cache_get(coap_session_t *session, const coap_pdu_t *request,
+                const coap_string_t *query, coap_pdu_t *response) {
+  coap_cache_entry_t *cache_entry;
+  proxy_cache_t *cached;
+  coap_opt_iterator_t opt_iter;
+  coap_tick_t now;
+
+  if (coap_pdu_get_code(request) != COAP_REQUEST_CODE_GET ||
+      coap_check_option(request, COAP_OPTION_OBSERVE, &opt_iter))
+    return 0;
+  cache_entry = coap_cache_get_by_pdu(session, request,
+                                      COAP_CACHE_NOT_SESSION_BASED);
+  if (!cache_entry)
+    return 0;
+  cached = coap_cache_get_app_data(cache_entry);
+  coap_ticks(&now);
+  if (!cached || cached->expires <= now) {
+    coap_delete_cache_entry(coap_session_get_context(session), cache_entry);
+    return 0;
+  }
+  coap_log(LOG_DEBUG, "Proxy response from cache\n");
+  coap_pdu_set_code(response, coap_pdu_get_code(cached->response));
+  /* Max-Age is what is left of the upstream Max-Age */
+  proxy_copy_response(session, request, query, cached->response, response,
+                      (int)((cached->expires - now) / COAP_TICKS_PER_SECOND));
+  return 1;
+}
+
 static void
 hnd_proxy_uri(coap_resource_t *resource COAP_UNUSED,
                 coap_session_t *session,
@@ -1085,6 +1284,10 @@ hnd_proxy_uri(coap_resource_t *resource COAP_UNUSED,
       uri.scheme == COAP_URI_SCHEME_COAPS_TCP) {
     coap_pdu_code_t req_code = coap_pdu_get_code(request);
     coap_pdu_type_t req_type = coap_pdu_get_type(request);
+    proxy_list_t *proxy_entry;
+
+    if (proxy_cache_get(session, request, query, response))
+      goto cleanup;
 
     if (!get_proxy_session(session, response, &token, query, req_code, req_type))
       goto cleanup;
@@ -1220,6 +1423,19 @@ add_in:
     if (coap_get_log_level() < LOG_DEBUG)
       coap_show_pdu(LOG_INFO, pdu);
 
+    /* Remember a GET request so that the response can be cached */
+    proxy_entry = get_proxy_session(session, response, &token, query,
+                                    req_code, req_type);
+    if (proxy_entry) {
+      coap_delete_pdu(proxy_entry->cache_req);
+      proxy_entry->cache_req = NULL;
+      if (req_code == COAP_REQUEST_CODE_GET &&
+          !coap_check_option(request, COAP_OPTION_OBSERVE, &opt_iter))
+        proxy_entry->cache_req = coap_pdu_duplicate(request, session,
+                                                    token.length, token.s,
+                                                    NULL);
+    }
+
     coap_send(ongoing, pdu);
     /*
      * Do not update with response code (hence empty ACK) as will be sending
@@ -1461,6 +1677,7 @@ hnd_put_post(coap_resource_t *resource,
           data_so_far = NULL;
         }
         coap_cache_set_app_data(cache_entry, NULL, NULL);
+        coap_cache_set_app_data_size(cache_entry, 0);
       }
     }
     if (!cache_entry) {
@@ -1499,11 +1716,14 @@ hnd_put_post(coap_resource_t *resource,
       }
       /* Yes, data_so_far can be NULL */
       coap_cache_set_app_data(cache_entry, data_so_far, cache_free_app_data);
+      coap_cache_set_app_data_size(cache_entry,
+                                   data_so_far ? data_so_far->length : 0);
     }
     if (offset + size == total) {
       /* All the data is now in */
       data_so_far = coap_cache_get_app_data(cache_entry);
       coap_cache_set_app_data(cache_entry, NULL, NULL);
+      coap_cache_set_app_data_size(cache_entry, 0);
     }
     else {
     coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTINUE);
@@ -1658,22 +1878,12 @@ proxy_response_handler(coap_session_t *session,
                 const coap_mid_t id COAP_UNUSED) {
 
   coap_pdu_t *pdu = NULL;
+  coap_pdu_t *dummy_pdu;
   coap_session_t *incoming = NULL;
   size_t i;
-  size_t size;
-  const uint8_t *data;
-  coap_optlist_t *optlist = NULL;
-  coap_opt_t *option;
-  coap_opt_iterator_t opt_iter;
-  size_t offset;
-  size_t total;
   proxy_list_t *proxy_entry = NULL;
-  uint16_t media_type = COAP_MEDIATYPE_TEXT_PLAIN;
-  int maxage = -1;
-  uint64_t etag = 0;
   coap_pdu_code_t rcv_code = coap_pdu_get_code(received);
   coap_bin_const_t rcv_token = coap_pdu_get_token(received);
-  coap_binary_t *body_data = NULL;
 
   for (i = 0; i < proxy_list_count; i++) {
     if (proxy_list[i].ongoing == session) {
@@ -1692,16 +1902,11 @@ proxy_response_handler(coap_session_t *session,
   if (coap_get_log_level() < LOG_DEBUG)
     coap_show_pdu(LOG_INFO, received);
 
-  if (coap_get_data_large(received, &size, &data, &offset, &total)) {
-    /* COAP_BLOCK_SINGLE_BODY is set, so single body should be given */
-    assert(size == total);
-    body_data = coap_new_binary(total);
-    if (!body_data) {
-      coap_log(LOG_DEBUG, "body build memory error\n");
-      return COAP_RESPONSE_OK;
-    }
-    memcpy(body_data->s, data, size);
-    data = body_data->s;
+  if (proxy_entry->cache_req) {
+    if (rcv_code == COAP_RESPONSE_CODE_CONTENT)
+      proxy_cache_add(incoming, proxy_entry->cache_req, received);
+    coap_delete_pdu(proxy_entry->cache_req);
+    proxy_entry->cache_req = NULL;
   }
 
   /*
@@ -1720,51 +1925,11 @@ proxy_response_handler(coap_session_t *session,
     coap_log(LOG_DEBUG, "cannot add token to ongoing proxy response PDU\n");
   }
 
-  /*
-   * Copy the options across, skipping those needed for
-   * coap_add_data_response_large()
-   */
-  coap_option_iterator_init(received, &opt_iter, COAP_OPT_ALL);
-  while ((option = coap_option_next(&opt_iter))) {
-    switch (opt_iter.number) {
-    case COAP_OPTION_CONTENT_FORMAT:
-      media_type = coap_decode_var_bytes(coap_opt_value (option),
-                                         coap_opt_length (option));
-      break;
-    case COAP_OPTION_MAXAGE:
-      maxage = coap_decode_var_bytes(coap_opt_value (option),
-                                     coap_opt_length (option));
-      break;
-    case COAP_OPTION_ETAG:
-      etag = coap_decode_var_bytes8(coap_opt_value (option),
-                                    coap_opt_length (option));
-      break;
-    case COAP_OPTION_BLOCK2:
-    case COAP_OPTION_SIZE2:
-      break;
-    default:
-      coap_insert_optlist(&optlist,
-                  coap_new_optlist(opt_iter.number,
-                  coap_opt_length(option),
-                  coap_opt_value(option)));
-      break;
-    }
-  }
-  coap_add_optlist_pdu(pdu, &optlist);
-  coap_delete_optlist(optlist);
-
-  if (size > 0) {
-    coap_pdu_t *dummy_pdu = coap_pdu_init(proxy_entry->req_type,
-                                          proxy_entry->req_code, 0,
-                                          coap_session_max_pdu_size(incoming));
-
-    coap_add_data_large_response(proxy_resource, incoming, dummy_pdu, pdu,
-                                 proxy_entry->query,
-                                 media_type, maxage, etag, size, data,
-                                 release_proxy_body_data,
-                                 body_data);
-    coap_delete_pdu(dummy_pdu);
-  }
+  dummy_pdu = coap_pdu_init(proxy_entry->req_type, proxy_entry->req_code, 0,
+                            coap_session_max_pdu_size(incoming));
+  proxy_copy_response(incoming, dummy_pdu, proxy_entry->query, received, pdu,
+                      -1);
+  coap_delete_pdu(dummy_pdu);
 
   if (coap_get_log_level() < LOG_DEBUG)
     coap_show_pdu(LOG_INFO, pdu);
@@ -2191,7 +2356,7 @@ usage( const char *program, const char *version) {
   fprintf(stderr, "%s\n", coap_string_tls_support(buffer, sizeof(buffer)));
   fprintf(stderr, "\n"
      "Usage: %s [-d max] [-e] [-g group] [-G group_if] [-l loss] [-p port]\n"
-     "\t\t[-r] [-v num] [-A address] [-L value] [-N]\n"
+     "\t\t[-r] [-v num] [-z entries[,bytes]] [-A address] [-L value] [-N]\n"
      "\t\t[-P scheme://address[:port],[name1[,name2..]]] [-X size]\n"
      "\t\t[[-h hint] [-i match_identity_file] [-k key]\n"
      "\t\t[-s match_psk_sni_file] [-u user]]\n"
@@ -2224,6 +2389,11 @@ usage( const char *program, const char *version) {
      "\t-v num \t\tVerbosity level (default 3, maximum is 9). Above 7,\n"
      "\t       \t\tthere is increased verbosity in GnuTLS and OpenSSL\n"
      "\t       \t\tlogging\n"
+     "\t-z entries[,bytes]\n"
+     "\t       \t\tLimit the cache of proxied responses (and of\n"
+     "\t       \t\tpartially received large PUT bodies) to the given\n"
+     "\t       \t\tnumber of entries and optionally bytes, dropping the\n"
+     "\t       \t\tleast recently used entries first. Default is no limit\n"
      "\t-A address\tInterface address to bind to\n"
      "\t-L value\tSum of one or more COAP_BLOCK_* flag valuess for block\n"
      "\t       \t\thandling methods. Default is 1 (COAP_BLOCK_USE_LIBCOAP)\n"
@@ -2669,7 +2839,7 @@ main(int argc, char **argv) {
 
   clock_offset = time(NULL);
 
-  while ((opt = getopt(argc, argv, "c:d:eg:G:h:i:j:J:k:l:mnp:rs:u:v:A:C:L:M:NP:R:S:X:")) != -1) {
+  while ((opt = getopt(argc, argv, "c:d:eg:G:h:i:j:J:k:l:mnp:rs:u:v:z:A:C:L:M:NP:R:S:X:")) != -1) {
     switch (opt) {
     case 'A' :
       strncpy(addr_str, optarg, NI_MAXHOST-1);
@@ -2793,6 +2963,15 @@ main(int argc, char **argv) {
     case 'X':
       csm_max_message_size = strtol(optarg, NULL, 10);
       break;
+    case 'z':
+      {
+        char *sep;
+
+        cache_max_entries = strtoul(optarg, &sep, 10);
+        if (*sep == ',')
+          cache_max_bytes = strtoul(sep + 1, NULL, 10);
+      }
+      break;
     default:
       usage( argv[0], LIBCOAP_PACKAGE_VERSION );
       exit( 1 );
@@ -2831,6 +3010,7 @@ main(int argc, char **argv) {
   /* Define the options to ignore when setting up cache-keys */
   coap_cache_ignore_options(ctx, cache_ignore_options,
              sizeof(cache_ignore_options)/sizeof(cache_ignore_options[0]));
+  coap_cache_set_limits(ctx, cache_max_entries, cache_max_bytes);
   /* join multicast group if requested at command line */
   if (group)
     coap_join_mcast_group_intf(ctx, group, group_if);
@@ -2959,10 +3139,21 @@ main(int argc, char **argv) {
   }
   free(dynamic_entry);
   release_resource_data(NULL, example_data_value);
+  {
+    coap_cache_stats_t cache_stats;
+
+    coap_cache_get_stats(ctx, &cache_stats);
+    coap_log(LOG_INFO, "Cache: %lu hits, %lu misses, %lu evicted, "
+             "%lu expired\n", (unsigned long)cache_stats.hits,
+             (unsigned long)cache_stats.misses,
+             (unsigned long)cache_stats.evictions,
+             (unsigned long)cache_stats.expirations);
+  }
 #if SERVER_CAN_PROXY
   for (i = 0; i < proxy_list_count; i++) {
     coap_delete_binary(proxy_list[i].token);
     coap_delete_string(proxy_list[i].query);
+    coap_delete_pdu(proxy_list[i].cache_req);
   }
   free(proxy_list);
   proxy_list = NULL;
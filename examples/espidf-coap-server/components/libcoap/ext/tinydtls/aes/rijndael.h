@@ -42,12 +42,18 @@ typedef uint8_t		aes_u8;
 typedef uint16_t	aes_u16;
 typedef uint32_t	aes_u32;
 
+/* AES implementations that rijndael_encrypt() can use */
+#define RIJNDAEL_ACCEL_NONE	0	/* portable T-table code */
+#define RIJNDAEL_ACCEL_AESNI	1	/* x86-64 AES-NI */
+#define RIJNDAEL_ACCEL_ARMV8	2	/* ARMv8 Crypto Extensions */
+
 /*  The structure for key information */
 typedef struct {
 #ifdef WITH_AES_DECRYPT
 	int	enc_only;		/* context contains only encrypt schedule */
 #endif
 	int	Nr;			/* key-length-dependent number of rounds */
+	int	accel;			/* RIJNDAEL_ACCEL_* that ek is laid out for */
 	aes_u32	ek[4*(AES_MAXROUNDS + 1)];	/* encrypt key schedule */
 #ifdef WITH_AES_DECRYPT
 	aes_u32	dk[4*(AES_MAXROUNDS + 1)];	/* decrypt key schedule */
@@ -58,6 +64,21 @@ int	 rijndael_set_key(rijndael_ctx *, const u_char *, int);
 int	 rijndael_set_key_enc_only(rijndael_ctx *, const u_char *, int);
 void	 rijndael_decrypt(rijndael_ctx *, const u_char *, u_char *);
 void	 rijndael_encrypt(rijndael_ctx *, const u_char *, u_char *);
+void	 rijndael_encrypt_pair(rijndael_ctx *, const u_char *, u_char *,
+	    const u_char *, u_char *);
+
+/*
+ * Returns the fastest RIJNDAEL_ACCEL_* implementation that this
+ * build can use on this CPU.
+ */
+int	 rijndael_accel_supported(void);
+
+/*
+ * Selects the implementation for keys set up from now on, which by
+ * default is the one from rijndael_accel_supported().  Returns -1 if
+ * accel cannot be used here.
+ */
+int	 rijndael_set_accel(int accel);
 
 int	rijndaelKeySetupEnc(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], int keyBits);
 int	rijndaelKeySetupDec(aes_u32 rk[/*4*(Nr + 1)*/], const aes_u8 cipherKey[], int keyBits);
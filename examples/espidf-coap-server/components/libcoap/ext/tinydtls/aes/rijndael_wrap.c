@@ -12,12 +12,101 @@
  * Contributors:
  *    Olaf Bergmann  - initial API and implementation
  *    Jon Shallow    - split out wrapper code to support external rijndael code
+ *    Olaf Bergmann  - AES-NI and ARMv8 Crypto Extensions, chosen at runtime
  *
  *
  *******************************************************************************/
 
 #include "rijndael.h"
 
+/*
+ * The AES instructions are only used in the functions marked with
+ * their target, so the rest of the library still runs on CPUs
+ * without them.  rijndael_accel_supported() tells which can be used.
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RIJNDAEL_AESNI
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+#if defined(__aarch64__) && \
+    (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO) || \
+     (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6))
+#define RIJNDAEL_ARMV8
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#if defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO)
+#define ARMV8_TARGET
+#else
+#define ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+static int rijndael_accel = -1;	/* -1 for rijndael_accel_supported() */
+
+int
+rijndael_accel_supported(void)
+{
+	static int supported = -1;
+
+	if (supported >= 0)
+		return supported;
+	supported = RIJNDAEL_ACCEL_NONE;
+#ifdef RIJNDAEL_AESNI
+	{
+		unsigned int a, b, c, d;
+
+		if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES))
+			supported = RIJNDAEL_ACCEL_AESNI;
+	}
+#endif
+#ifdef RIJNDAEL_ARMV8
+#if defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO) || \
+    defined(__APPLE__)
+	supported = RIJNDAEL_ACCEL_ARMV8;
+#elif defined(__linux__) && defined(HWCAP_AES)
+	if (getauxval(AT_HWCAP) & HWCAP_AES)
+		supported = RIJNDAEL_ACCEL_ARMV8;
+#endif
+#endif
+	return supported;
+}
+
+int
+rijndael_set_accel(int accel)
+{
+	if (accel != RIJNDAEL_ACCEL_NONE && accel != rijndael_accel_supported())
+		return -1;
+	rijndael_accel = accel;
+	return 0;
+}
+
+/*
+ * The AES instructions take the round keys as the bytes that the
+ * words of ek stand for, in big-endian order.
+ */
+static void
+rijndael_key_to_bytes(rijndael_ctx *ctx)
+{
+	aes_u8 *p = (aes_u8 *)ctx->ek;
+	int i;
+
+	for (i = 0; i < 4 * (ctx->Nr + 1); i++) {
+		aes_u32 w = ctx->ek[i];
+
+		p[4 * i] = (aes_u8)(w >> 24);
+		p[4 * i + 1] = (aes_u8)(w >> 16);
+		p[4 * i + 2] = (aes_u8)(w >> 8);
+		p[4 * i + 3] = (aes_u8)w;
+	}
+}
+
 /* setup key context for encryption only */
 int
 rijndael_set_key_enc_only(rijndael_ctx *ctx, const u_char *key, int bits)
@@ -32,6 +121,10 @@ rijndael_set_key_enc_only(rijndael_ctx *ctx, const u_char *key, int bits)
 #ifdef WITH_AES_DECRYPT
 	ctx->enc_only = 1;
 #endif
+	ctx->accel = rijndael_accel < 0 ? rijndael_accel_supported() :
+	    rijndael_accel;
+	if (ctx->accel != RIJNDAEL_ACCEL_NONE)
+		rijndael_key_to_bytes(ctx);
 
 	return 0;
 }
@@ -51,6 +144,10 @@ rijndael_set_key(rijndael_ctx *ctx, const u_char *key, int bits)
 
 	ctx->Nr = rounds;
 	ctx->enc_only = 0;
+	ctx->accel = rijndael_accel < 0 ? rijndael_accel_supported() :
+	    rijndael_accel;
+	if (ctx->accel != RIJNDAEL_ACCEL_NONE)
+		rijndael_key_to_bytes(ctx);
 
 	return 0;
 }
@@ -62,8 +159,125 @@ rijndael_decrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 }
 #endif
 
+#ifdef RIJNDAEL_AESNI
+static AESNI_TARGET void
+aesni_encrypt(const aes_u32 *ek, int Nr, const u_char *src, u_char *dst)
+{
+	const __m128i *rk = (const __m128i *)ek;
+	__m128i s;
+	int r;
+
+	s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)src),
+	    _mm_loadu_si128(rk));
+	for (r = 1; r < Nr; r++)
+		s = _mm_aesenc_si128(s, _mm_loadu_si128(rk + r));
+	s = _mm_aesenclast_si128(s, _mm_loadu_si128(rk + Nr));
+	_mm_storeu_si128((__m128i *)dst, s);
+}
+
+/* both blocks go through each round together */
+static AESNI_TARGET void
+aesni_encrypt_pair(const aes_u32 *ek, int Nr,
+    const u_char *src1, u_char *dst1, const u_char *src2, u_char *dst2)
+{
+	const __m128i *rk = (const __m128i *)ek;
+	__m128i k = _mm_loadu_si128(rk);
+	__m128i s1, s2;
+	int r;
+
+	s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)src1), k);
+	s2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)src2), k);
+	for (r = 1; r < Nr; r++) {
+		k = _mm_loadu_si128(rk + r);
+		s1 = _mm_aesenc_si128(s1, k);
+		s2 = _mm_aesenc_si128(s2, k);
+	}
+	k = _mm_loadu_si128(rk + Nr);
+	_mm_storeu_si128((__m128i *)dst1, _mm_aesenclast_si128(s1, k));
+	_mm_storeu_si128((__m128i *)dst2, _mm_aesenclast_si128(s2, k));
+}
+#endif /* RIJNDAEL_AESNI */
+
+#ifdef RIJNDAEL_ARMV8
+/* AESE adds the round key before SubBytes, so the last key is added apart */
+static ARMV8_TARGET void
+armv8_encrypt(const aes_u32 *ek, int Nr, const u_char *src, u_char *dst)
+{
+	const aes_u8 *rk = (const aes_u8 *)ek;
+	uint8x16_t s = vld1q_u8(src);
+	int r;
+
+	for (r = 0; r < Nr - 1; r++)
+		s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(rk + 16 * r)));
+	s = vaeseq_u8(s, vld1q_u8(rk + 16 * (Nr - 1)));
+	vst1q_u8(dst, veorq_u8(s, vld1q_u8(rk + 16 * Nr)));
+}
+
+static ARMV8_TARGET void
+armv8_encrypt_pair(const aes_u32 *ek, int Nr,
+    const u_char *src1, u_char *dst1, const u_char *src2, u_char *dst2)
+{
+	const aes_u8 *rk = (const aes_u8 *)ek;
+	uint8x16_t s1 = vld1q_u8(src1);
+	uint8x16_t s2 = vld1q_u8(src2);
+	uint8x16_t k;
+	int r;
+
+	for (r = 0; r < Nr - 1; r++) {
+		k = vld1q_u8(rk + 16 * r);
+		s1 = vaesmcq_u8(vaeseq_u8(s1, k));
+		s2 = vaesmcq_u8(vaeseq_u8(s2, k));
+	}
+	k = vld1q_u8(rk + 16 * (Nr - 1));
+	s1 = vaeseq_u8(s1, k);
+	s2 = vaeseq_u8(s2, k);
+	k = vld1q_u8(rk + 16 * Nr);
+	vst1q_u8(dst1, veorq_u8(s1, k));
+	vst1q_u8(dst2, veorq_u8(s2, k));
+}
+#endif /* RIJNDAEL_ARMV8 */
+
 void
 rijndael_encrypt(rijndael_ctx *ctx, const u_char *src, u_char *dst)
 {
-	rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
+	switch (ctx->accel) {
+#ifdef RIJNDAEL_AESNI
+	case RIJNDAEL_ACCEL_AESNI:
+		aesni_encrypt(ctx->ek, ctx->Nr, src, dst);
+		return;
+#endif
+#ifdef RIJNDAEL_ARMV8
+	case RIJNDAEL_ACCEL_ARMV8:
+		armv8_encrypt(ctx->ek, ctx->Nr, src, dst);
+		return;
+#endif
+	default:
+		rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
+	}
+}
+
+/*
+ * Encrypts two independent blocks.  With the AES instructions, the
+ * second one costs next to nothing, as it fills the latency of the
+ * rounds of the first.
+ */
+void
+rijndael_encrypt_pair(rijndael_ctx *ctx, const u_char *src1, u_char *dst1,
+    const u_char *src2, u_char *dst2)
+{
+	switch (ctx->accel) {
+#ifdef RIJNDAEL_AESNI
+	case RIJNDAEL_ACCEL_AESNI:
+		aesni_encrypt_pair(ctx->ek, ctx->Nr, src1, dst1, src2, dst2);
+		return;
+#endif
+#ifdef RIJNDAEL_ARMV8
+	case RIJNDAEL_ACCEL_ARMV8:
+		armv8_encrypt_pair(ctx->ek, ctx->Nr, src1, dst1, src2, dst2);
+		return;
+#endif
+	default:
+		rijndaelEncrypt(ctx->ek, ctx->Nr, src1, dst1);
+		rijndaelEncrypt(ctx->ek, ctx->Nr, src2, dst2);
+	}
 }
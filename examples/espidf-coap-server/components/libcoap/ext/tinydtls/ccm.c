@@ -70,15 +70,20 @@ block0(size_t M,       /* number of auth bytes */
  *             authentication block.
  * \param X    The output buffer where the result of the CBC calculation
  *             is placed.
+ * \param A    The counter block \c A0, which is encrypted together with
+ *             \c B0.
+ * \param S0   The output buffer for the encrypted \p A.
  * \return     The result is written to \p X.
  */
 static void
 add_auth_data(rijndael_ctx *ctx, const unsigned char *msg, uint64_t la,
 	      unsigned char B[DTLS_CCM_BLOCKSIZE], 
-	      unsigned char X[DTLS_CCM_BLOCKSIZE]) {
+	      unsigned char X[DTLS_CCM_BLOCKSIZE],
+	      const unsigned char A[DTLS_CCM_BLOCKSIZE],
+	      unsigned char S0[DTLS_CCM_BLOCKSIZE]) {
   uint64_t i,j;
 
-  rijndael_encrypt(ctx, B, X);
+  rijndael_encrypt_pair(ctx, B, X, A, S0);
 
   memset(B, 0, DTLS_CCM_BLOCKSIZE);
 
@@ -137,93 +142,76 @@ add_auth_data(rijndael_ctx *ctx, const unsigned char *msg, uint64_t la,
   } 
 }
 
+/**
+ * Adds \p len bytes of \p msg to the CBC-MAC in \p X. The remainder
+ * of \p B is padded with zeroes, so B is made to contain X ^ msg for
+ * the first \p len bytes and X ^ 0 for the others. The caller then
+ * encrypts \p B into \p X.
+ */
 static inline void
-encrypt(rijndael_ctx *ctx, size_t L, unsigned long counter,
-	unsigned char *msg, size_t len,
-	unsigned char A[DTLS_CCM_BLOCKSIZE],
-	unsigned char S[DTLS_CCM_BLOCKSIZE]) {
-
-  static unsigned long counter_tmp;
-
-  SET_COUNTER(A, L, counter, counter_tmp);    
-  rijndael_encrypt(ctx, A, S);
-  memxor(msg, S, len);
-}
-
-static inline void
-mac(rijndael_ctx *ctx, 
-    unsigned char *msg, size_t len,
-    unsigned char B[DTLS_CCM_BLOCKSIZE],
-    unsigned char X[DTLS_CCM_BLOCKSIZE]) {
+mac_block(const unsigned char *msg, size_t len,
+	  unsigned char B[DTLS_CCM_BLOCKSIZE],
+	  const unsigned char X[DTLS_CCM_BLOCKSIZE]) {
   size_t i;
 
   for (i = 0; i < len; ++i)
     B[i] = X[i] ^ msg[i];
-
-  rijndael_encrypt(ctx, B, X);
-
+  memcpy(B + len, X + len, DTLS_CCM_BLOCKSIZE - len);
 }
 
+/*
+ * The CBC-MAC can only be calculated one block after the other, but
+ * the keystream blocks S_i for CTR do not depend on each other. Each
+ * MAC block is therefore encrypted together with a keystream block
+ * through rijndael_encrypt_pair(), which keeps two blocks in flight
+ * when the AES instructions are used.
+ */
+
 long int
 dtls_ccm_encrypt_message(rijndael_ctx *ctx, size_t M, size_t L, 
 			 const unsigned char nonce[DTLS_CCM_BLOCKSIZE],
 			 unsigned char *msg, size_t lm, 
 			 const unsigned char *aad, size_t la) {
-  size_t i, len;
+  size_t i, len, n;
   unsigned long counter_tmp;
   unsigned long counter = 1; /* \bug does not work correctly on ia32 when
 			             lm >= 2^16 */
   unsigned char A[DTLS_CCM_BLOCKSIZE]; /* A_i blocks for encryption input */
   unsigned char B[DTLS_CCM_BLOCKSIZE]; /* B_i blocks for CBC-MAC input */
   unsigned char S[DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
+  unsigned char S0[DTLS_CCM_BLOCKSIZE]; /* S_0 for the MAC */
   unsigned char X[DTLS_CCM_BLOCKSIZE]; /* X_i = encrypted B_i blocks */
 
   len = lm;			/* save original length */
-  /* create the initial authentication block B0 */
-  block0(M, L, la, lm, nonce, B);
-  add_auth_data(ctx, aad, la, B, X);
 
   /* initialize block template */
   A[0] = L-1;
 
   /* copy the nonce */
   memcpy(A + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
-  
-  while (lm >= DTLS_CCM_BLOCKSIZE) {
-    /* calculate MAC */
-    mac(ctx, msg, DTLS_CCM_BLOCKSIZE, B, X);
-
-    /* encrypt */
-    encrypt(ctx, L, counter, msg, DTLS_CCM_BLOCKSIZE, A, S);
+  SET_COUNTER(A, L, 0, counter_tmp);
 
-    /* update local pointers */
-    lm -= DTLS_CCM_BLOCKSIZE;
-    msg += DTLS_CCM_BLOCKSIZE;
-    counter++;
-  }
+  /* create the initial authentication block B0 */
+  block0(M, L, la, lm, nonce, B);
+  add_auth_data(ctx, aad, la, B, X, A, S0);
 
-  if (lm) {
-    /* Calculate MAC. The remainder of B must be padded with zeroes, so
-     * B is constructed to contain X ^ msg for the first lm bytes (done in
-     * mac() and X ^ 0 for the remaining DTLS_CCM_BLOCKSIZE - lm bytes
-     * (i.e., we can use memcpy() here).
-     */
-    memcpy(B + lm, X + lm, DTLS_CCM_BLOCKSIZE - lm);
-    mac(ctx, msg, lm, B, X);
+  while (lm) {
+    n = min(DTLS_CCM_BLOCKSIZE, lm);
 
-    /* encrypt */
-    encrypt(ctx, L, counter, msg, lm, A, S);
+    /* calculate MAC and encrypt */
+    mac_block(msg, n, B, X);
+    SET_COUNTER(A, L, counter, counter_tmp);
+    rijndael_encrypt_pair(ctx, B, X, A, S);
+    memxor(msg, S, n);
 
     /* update local pointers */
-    msg += lm;
+    lm -= n;
+    msg += n;
+    counter++;
   }
-  
-  /* calculate S_0 */  
-  SET_COUNTER(A, L, 0, counter_tmp);
-  rijndael_encrypt(ctx, A, S);
 
   for (i = 0; i < M; ++i)
-    *msg++ = X[i] ^ S[i];
+    *msg++ = X[i] ^ S0[i];
 
   return len + M;
 }
@@ -234,13 +222,14 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
 			 unsigned char *msg, size_t lm, 
 			 const unsigned char *aad, size_t la) {
   
-  size_t len;
+  size_t len, n;
   unsigned long counter_tmp;
   unsigned long counter = 1; /* \bug does not work correctly on ia32 when
 			             lm >= 2^16 */
   unsigned char A[DTLS_CCM_BLOCKSIZE]; /* A_i blocks for encryption input */
   unsigned char B[DTLS_CCM_BLOCKSIZE]; /* B_i blocks for CBC-MAC input */
   unsigned char S[DTLS_CCM_BLOCKSIZE]; /* S_i = encrypted A_i blocks */
+  unsigned char S0[DTLS_CCM_BLOCKSIZE]; /* S_0 for the MAC */
   unsigned char X[DTLS_CCM_BLOCKSIZE]; /* X_i = encrypted B_i blocks */
 
   if (lm < M)
@@ -249,50 +238,46 @@ dtls_ccm_decrypt_message(rijndael_ctx *ctx, size_t M, size_t L,
   len = lm;	      /* save original length */
   lm -= M;	      /* detract MAC size*/
 
-  /* create the initial authentication block B0 */
-  block0(M, L, la, lm, nonce, B);
-  add_auth_data(ctx, aad, la, B, X);
-
   /* initialize block template */
   A[0] = L-1;
 
   /* copy the nonce */
   memcpy(A + 1, nonce, DTLS_CCM_BLOCKSIZE - L - 1);
-  
-  while (lm >= DTLS_CCM_BLOCKSIZE) {
-    /* decrypt */
-    encrypt(ctx, L, counter, msg, DTLS_CCM_BLOCKSIZE, A, S);
-    
-    /* calculate MAC */
-    mac(ctx, msg, DTLS_CCM_BLOCKSIZE, B, X);
+  SET_COUNTER(A, L, 0, counter_tmp);
 
-    /* update local pointers */
-    lm -= DTLS_CCM_BLOCKSIZE;
-    msg += DTLS_CCM_BLOCKSIZE;
-    counter++;
-  }
+  /* create the initial authentication block B0 */
+  block0(M, L, la, lm, nonce, B);
+  add_auth_data(ctx, aad, la, B, X, A, S0);
 
+  /* The MAC is over the cleartext, so each keystream block is
+   * calculated together with the MAC of the block before. */
   if (lm) {
-    /* decrypt */
-    encrypt(ctx, L, counter, msg, lm, A, S);
+    SET_COUNTER(A, L, counter, counter_tmp);
+    rijndael_encrypt(ctx, A, S);
+  }
+
+  while (lm) {
+    n = min(DTLS_CCM_BLOCKSIZE, lm);
 
-    /* Calculate MAC. Note that msg ends in the MAC so we must
-     * construct B to contain X ^ msg for the first lm bytes (done in
-     * mac() and X ^ 0 for the remaining DTLS_CCM_BLOCKSIZE - lm bytes
-     * (i.e., we can use memcpy() here).
-     */
-    memcpy(B + lm, X + lm, DTLS_CCM_BLOCKSIZE - lm);
-    mac(ctx, msg, lm, B, X); 
+    /* decrypt */
+    memxor(msg, S, n);
+    mac_block(msg, n, B, X);
 
     /* update local pointers */
-    msg += lm;
+    lm -= n;
+    msg += n;
+    counter++;
+
+    /* calculate MAC, and the next keystream block if there is one */
+    if (lm) {
+      SET_COUNTER(A, L, counter, counter_tmp);
+      rijndael_encrypt_pair(ctx, B, X, A, S);
+    } else {
+      rijndael_encrypt(ctx, B, X);
+    }
   }
-  
-  /* calculate S_0 */  
-  SET_COUNTER(A, L, 0, counter_tmp);
-  rijndael_encrypt(ctx, A, S);
 
-  memxor(msg, S, M);
+  memxor(msg, S0, M);
 
   /* return length if MAC is valid, otherwise continue with error handling */
   if (equals(X, msg, M))
@@ -59,6 +59,9 @@ memarray_t security_storage;
 #define HMAC_UPDATE_SEED(Context,Seed,Length)		\
   if (Seed) dtls_hmac_update(Context, (Seed), (Length))
 
+/* Only used by dtls_encrypt_params() and dtls_decrypt_params(), which
+ * are given the key for each call.  Records are protected with the
+ * cipher contexts in their security parameters instead. */
 static struct dtls_cipher_context_t cipher_context;
 static dtls_mutex_t cipher_context_mutex = DTLS_MUTEX_INITIALIZER;
 
@@ -208,6 +211,7 @@ dtls_p_hash(dtls_hashfunc_t h,
 	    const unsigned char *random1, size_t random1len,
 	    const unsigned char *random2, size_t random2len,
 	    unsigned char *buf, size_t buflen) {
+  dtls_hmac_context_t keyed;		/* the key hashed once, for all rounds */
   dtls_hmac_context_t hmac;
 
   unsigned char A[DTLS_HMAC_DIGEST_SIZE];
@@ -216,7 +220,8 @@ dtls_p_hash(dtls_hashfunc_t h,
   size_t len = 0;			/* result length */
   (void)h;
 
-  dtls_hmac_init(&hmac, key, keylen);
+  dtls_hmac_init(&keyed, key, keylen);
+  dtls_hmac_clone(&hmac, &keyed);
 
   /* calculate A(1) from A(0) == seed */
   HMAC_UPDATE_SEED(&hmac, label, labellen);
@@ -226,7 +231,7 @@ dtls_p_hash(dtls_hashfunc_t h,
   dlen = dtls_hmac_finalize(&hmac, A);
 
   while (len < buflen) {
-    dtls_hmac_init(&hmac, key, keylen);
+    dtls_hmac_clone(&hmac, &keyed);
     dtls_hmac_update(&hmac, A, dlen);
 
     HMAC_UPDATE_SEED(&hmac, label, labellen);
@@ -245,12 +250,13 @@ dtls_p_hash(dtls_hashfunc_t h,
     }
 
     /* calculate A(i+1) */
-    dtls_hmac_init(&hmac, key, keylen);
+    dtls_hmac_clone(&hmac, &keyed);
     dtls_hmac_update(&hmac, A, dlen);
     dtls_hmac_finalize(&hmac, A);
   }
 
   /* prevent exposure of sensible data */
+  memset(&keyed, 0, sizeof(keyed));
   memset(&hmac, 0, sizeof(hmac));
   memset(tmp, 0, sizeof(tmp));
   memset(A, 0, sizeof(A));
@@ -292,44 +298,6 @@ dtls_mac(dtls_hmac_context_t *hmac_ctx,
   dtls_hmac_finalize(hmac_ctx, buf);
 }
 
-static size_t
-dtls_ccm_encrypt(aes128_ccm_t *ccm_ctx, const unsigned char *src, size_t srclen,
-		 unsigned char *buf, 
-		 const unsigned char *nonce,
-		 const unsigned char *aad, size_t la) {
-  long int len;
-  (void)src;
-
-  assert(ccm_ctx);
-
-  len = dtls_ccm_encrypt_message(&ccm_ctx->ctx,
-                                 ccm_ctx->tag_length /* M */,
-				 ccm_ctx->l /* L */,
-				 nonce,
-				 buf, srclen,
-				 aad, la);
-  return len;
-}
-
-static size_t
-dtls_ccm_decrypt(aes128_ccm_t *ccm_ctx, const unsigned char *src,
-		 size_t srclen, unsigned char *buf,
-		 const unsigned char *nonce,
-		 const unsigned char *aad, size_t la) {
-  long int len;
-  (void)src;
-
-  assert(ccm_ctx);
-
-  len = dtls_ccm_decrypt_message(&ccm_ctx->ctx,
-                                 ccm_ctx->tag_length /* M */,
-				 ccm_ctx->l /* L */,
-				 nonce,
-				 buf, srclen,
-				 aad, la);
-  return len;
-}
-
 #ifdef DTLS_PSK
 int
 dtls_psk_pre_master_secret(unsigned char *key, size_t keylen,
@@ -557,6 +525,52 @@ dtls_ecdsa_verify_sig(const unsigned char *pub_key_x,
 }
 #endif /* DTLS_ECC */
 
+int
+dtls_cipher_set_key(dtls_cipher_context_t *ctx,
+                    const unsigned char *key, size_t keylen) {
+  if (rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen) < 0) {
+    dtls_warn("cannot set rijndael key\n");
+    return -1;
+  }
+  return 0;
+}
+
+int
+dtls_cipher_encrypt(dtls_cipher_context_t *ctx,
+                    const dtls_ccm_params_t *params,
+                    const unsigned char *src, size_t length,
+                    unsigned char *buf,
+                    const unsigned char *aad, size_t la) {
+  assert(ctx);
+
+  if (src != buf)
+    memmove(buf, src, length);
+  return dtls_ccm_encrypt_message(&ctx->data.ctx,
+                                  params->tag_length /* M */,
+                                  params->l /* L */,
+                                  params->nonce,
+                                  buf, length,
+                                  aad, la);
+}
+
+int
+dtls_cipher_decrypt(dtls_cipher_context_t *ctx,
+                    const dtls_ccm_params_t *params,
+                    const unsigned char *src, size_t length,
+                    unsigned char *buf,
+                    const unsigned char *aad, size_t la) {
+  assert(ctx);
+
+  if (src != buf)
+    memmove(buf, src, length);
+  return dtls_ccm_decrypt_message(&ctx->data.ctx,
+                                  params->tag_length /* M */,
+                                  params->l /* L */,
+                                  params->nonce,
+                                  buf, length,
+                                  aad, la);
+}
+
 int
 dtls_encrypt_params(const dtls_ccm_params_t *params,
                     const unsigned char *src, size_t length,
@@ -565,21 +579,11 @@ dtls_encrypt_params(const dtls_ccm_params_t *params,
                     const unsigned char *aad, size_t la) {
   int ret;
   struct dtls_cipher_context_t *ctx = dtls_cipher_context_get();
-  ctx->data.tag_length = params->tag_length;
-  ctx->data.l = params->l;
 
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
-  if (ret < 0) {
-    /* cleanup everything in case the key has the wrong size */
-    dtls_warn("cannot set rijndael key\n");
-    goto error;
-  }
-
-  if (src != buf)
-    memmove(buf, src, length);
-  ret = dtls_ccm_encrypt(&ctx->data, src, length, buf, params->nonce, aad, la);
+  ret = dtls_cipher_set_key(ctx, key, keylen);
+  if (ret == 0)
+    ret = dtls_cipher_encrypt(ctx, params, src, length, buf, aad, la);
 
-error:
   dtls_cipher_context_release();
   return ret;
 }
@@ -607,21 +611,11 @@ dtls_decrypt_params(const dtls_ccm_params_t *params,
 {
   int ret;
   struct dtls_cipher_context_t *ctx = dtls_cipher_context_get();
-  ctx->data.tag_length = params->tag_length;
-  ctx->data.l = params->l;
 
-  ret = rijndael_set_key_enc_only(&ctx->data.ctx, key, 8 * keylen);
-  if (ret < 0) {
-    /* cleanup everything in case the key has the wrong size */
-    dtls_warn("cannot set rijndael key\n");
-    goto error;
-  }
-
-  if (src != buf)
-    memmove(buf, src, length);
-  ret = dtls_ccm_decrypt(&ctx->data, src, length, buf, params->nonce, aad, la);
+  ret = dtls_cipher_set_key(ctx, key, keylen);
+  if (ret == 0)
+    ret = dtls_cipher_decrypt(ctx, params, src, length, buf, aad, la);
 
-error:
   dtls_cipher_context_release();
   return ret;
 }
@@ -116,6 +116,15 @@ typedef struct {
    * access the components of the key block.
    */
   uint8 key_block[MAX_KEYBLOCK_LENGTH];
+
+  /**
+   * The AES key schedules expanded from the local and the remote
+   * write key in \c key_block when the key block is calculated.
+   * Records of this epoch are protected with these, without setting
+   * up the key again.
+   */
+  dtls_cipher_context_t write_cipher;
+  dtls_cipher_context_t read_cipher;
   
   seqnum_t cseq;        /**<sequence number of last record received*/
 } dtls_security_parameters_t;
@@ -287,6 +296,61 @@ int dtls_encrypt_params(const dtls_ccm_params_t *params,
                         const unsigned char *key, size_t keylen,
                         const unsigned char *aad, size_t aad_length);
 
+/**
+ * Expands the given AES \p key into the key schedule of \p ctx,
+ * for use with dtls_cipher_encrypt() and dtls_cipher_decrypt().
+ *
+ * \param ctx    The cipher context to set up.
+ * \param key    The AES key.
+ * \param keylen The length of \p key in bytes.
+ * \return 0 on success, less than zero if \p keylen is not
+ *         a valid AES key length.
+ */
+int dtls_cipher_set_key(dtls_cipher_context_t *ctx,
+                        const unsigned char *key, size_t keylen);
+
+/**
+ * Works like dtls_encrypt_params() but uses the key schedule that
+ * dtls_cipher_set_key() has set up in \p ctx. This takes no lock, as
+ * \p ctx is only read, so records can be protected concurrently with
+ * the same context.
+ *
+ * \param ctx    The cipher context holding the key schedule.
+ * \param params AEAD parameters: Nonce, M and L.
+ * \param src    The data to encrypt.
+ * \param length The actual size of of \p src.
+ * \param buf    The result buffer.
+ * \param aad    additional data for AEAD ciphers
+ * \param aad_length actual size of @p aad
+ * \return The number of encrypted bytes on success, less than zero
+ *         otherwise.
+ */
+int dtls_cipher_encrypt(dtls_cipher_context_t *ctx,
+                        const dtls_ccm_params_t *params,
+                        const unsigned char *src, size_t length,
+                        unsigned char *buf,
+                        const unsigned char *aad, size_t aad_length);
+
+/**
+ * Works like dtls_decrypt_params() but uses the key schedule that
+ * dtls_cipher_set_key() has set up in \p ctx. This takes no lock.
+ *
+ * \param ctx    The cipher context holding the key schedule.
+ * \param params AEAD parameters: Nonce, M and L.
+ * \param src     The buffer to decrypt.
+ * \param length  The length of the input buffer.
+ * \param buf     The result buffer.
+ * \param aad     additional authentication data for AEAD ciphers
+ * \param aad_length actual size of @p aad
+ * \return Less than zero on error, the number of decrypted bytes
+ *         otherwise.
+ */
+int dtls_cipher_decrypt(dtls_cipher_context_t *ctx,
+                        const dtls_ccm_params_t *params,
+                        const unsigned char *src, size_t length,
+                        unsigned char *buf,
+                        const unsigned char *aad, size_t aad_length);
+
 /** 
  * Encrypts the specified \p src of given \p length, writing the
  * result to \p buf. The cipher implementation may add more data to
@@ -354,7 +354,7 @@ dtls_get_cookie(uint8 *msg, size_t msglen, uint8 **cookie) {
 }
 
 static int
-dtls_create_cookie(dtls_context_t *ctx,
+dtls_create_cookie(const dtls_hmac_context_t *keyed,
 		   session_t *session,
 		   uint8 *msg, size_t msglen,
 		   uint8 *cookie, int *clen) {
@@ -375,7 +375,7 @@ dtls_create_cookie(dtls_context_t *ctx,
   /* Note that the buffer size must fit with the default hash algorithm. */
 
   dtls_hmac_context_t hmac_context;
-  dtls_hmac_init(&hmac_context, ctx->cookie_secret, DTLS_COOKIE_SECRET_LENGTH);
+  dtls_hmac_clone(&hmac_context, keyed);
 
   dtls_hmac_update(&hmac_context,
 		   (unsigned char *)&session->addr, session->size);
@@ -433,6 +433,27 @@ dtls_create_cookie(dtls_context_t *ctx,
   return 0;
 }
 
+/* Makes a new cookie secret when the current one is too old */
+static void
+dtls_update_cookie_secret(dtls_context_t *ctx) {
+  unsigned char secret[DTLS_COOKIE_SECRET_LENGTH];
+  dtls_tick_t now;
+
+  dtls_ticks(&now);
+  if (now - ctx->cookie_secret_age <
+      (dtls_tick_t)DTLS_COOKIE_SECRET_LIFETIME * DTLS_TICKS_PER_SECOND)
+    return;
+
+  /* keep the old secret if there is no new one */
+  if (!dtls_prng(secret, DTLS_COOKIE_SECRET_LENGTH))
+    return;
+  dtls_hmac_clone(&ctx->cookie_hmac_prev, &ctx->cookie_hmac);
+  memcpy(ctx->cookie_secret, secret, DTLS_COOKIE_SECRET_LENGTH);
+  dtls_hmac_init(&ctx->cookie_hmac, secret, DTLS_COOKIE_SECRET_LENGTH);
+  ctx->cookie_secret_age = now;
+  memset(secret, 0, sizeof(secret));
+}
+
 #ifdef DTLS_CHECK_CONTENTTYPE
 /* used to check if a received datagram contains a DTLS message */
 static char const content_types[] = {
@@ -855,6 +876,16 @@ calculate_key_block(dtls_context_t *ctx,
   memcpy(handshake->tmp.master_secret, master_secret, DTLS_MASTER_SECRET_LENGTH);
   dtls_debug_keyblock(security);
 
+  /* expand the write keys once, for all records of this epoch */
+  if (dtls_cipher_set_key(&security->write_cipher,
+			  dtls_kb_local_write_key(security, role),
+			  dtls_kb_key_size(security, role)) < 0 ||
+      dtls_cipher_set_key(&security->read_cipher,
+			  dtls_kb_remote_write_key(security, role),
+			  dtls_kb_key_size(security, role)) < 0) {
+    return dtls_alert_fatal_create(DTLS_ALERT_INTERNAL_ERROR);
+  }
+
   security->cipher = handshake->cipher;
   security->compression = handshake->compression;
   security->rseq = 0;
@@ -1440,7 +1471,7 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
 #define A_DATA_LEN 13
     unsigned char nonce[DTLS_CCM_BLOCKSIZE];
     unsigned char A_DATA[A_DATA_LEN];
-    /* For backwards-compatibility, dtls_encrypt_params is called with
+    /* For backwards-compatibility, dtls_cipher_encrypt is called with
      * M=<macLen> and L=3. */
     const dtls_ccm_params_t params = { nonce, 8, 3 };
 
@@ -1526,9 +1557,8 @@ dtls_prepare_record(dtls_peer_t *peer, dtls_security_parameters_t *security,
     memcpy(A_DATA + 8,  &DTLS_RECORD_HEADER(sendbuf)->content_type, 3); /* type and version */
     dtls_int_to_uint16(A_DATA + 11, res - 8); /* length */
 
-    res = dtls_encrypt_params(&params, start + 8, res - 8, start + 8,
-               dtls_kb_local_write_key(security, peer->role),
-               dtls_kb_key_size(security, peer->role),
+    res = dtls_cipher_encrypt(&security->write_cipher, &params,
+               start + 8, res - 8, start + 8,
                A_DATA, A_DATA_LEN);
 
     if (res < 0)
@@ -1945,8 +1975,10 @@ dtls_0_verify_peer(dtls_context_t *ctx,
 #undef mycookie
 #define mycookie (buf + DTLS_HV_LENGTH)
 
+  dtls_update_cookie_secret(ctx);
+
   /* Store cookie where we can reuse it for the HelloVerifyRequest. */
-  err = dtls_create_cookie(ctx, ephemeral_peer->session, data, data_length, mycookie, &len);
+  err = dtls_create_cookie(&ctx->cookie_hmac, ephemeral_peer->session, data, data_length, mycookie, &len);
   if (err < 0)
     return err;
 
@@ -1972,6 +2004,19 @@ dtls_0_verify_peer(dtls_context_t *ctx,
     return 0;
   }
 
+  /* the cookie may have been made just before the secret changed */
+  if (len == DTLS_COOKIE_LENGTH) {
+    uint8 oldcookie[DTLS_COOKIE_LENGTH];
+    int oldlen = DTLS_COOKIE_LENGTH;
+
+    if (dtls_create_cookie(&ctx->cookie_hmac_prev, ephemeral_peer->session,
+                           data, data_length, oldcookie, &oldlen) == 0 &&
+        memcmp(cookie, oldcookie, len) == 0) {
+      dtls_debug("found matching cookie of the previous secret\n");
+      return 0;
+    }
+  }
+
   if (len > 0) {
     dtls_debug_dump("invalid cookie", cookie, len);
   } else {
@@ -3432,7 +3477,7 @@ decrypt_verify(dtls_peer_t *peer, uint8 *packet, size_t length,
 #define A_DATA_LEN 13
     unsigned char nonce[DTLS_CCM_BLOCKSIZE];
     unsigned char A_DATA[A_DATA_LEN];
-    /* For backwards-compatibility, dtls_encrypt_params is called with
+    /* For backwards-compatibility, dtls_cipher_decrypt is called with
      * M=<macLen> and L=3. */
     const dtls_ccm_params_t params = { nonce, 8, 3 };
 
@@ -3463,9 +3508,8 @@ decrypt_verify(dtls_peer_t *peer, uint8 *packet, size_t length,
 
     dtls_int_to_uint16(A_DATA + 11, clen - 8); /* length without MAC */
 
-    clen = dtls_decrypt_params(&params, *cleartext, clen, *cleartext,
-               dtls_kb_remote_write_key(security, peer->role),
-               dtls_kb_key_size(security, peer->role),
+    clen = dtls_cipher_decrypt(&security->read_cipher, &params,
+               *cleartext, clen, *cleartext,
                A_DATA, A_DATA_LEN);
     if (clen < 0)
       dtls_warn("decryption failed\n");
@@ -3944,26 +3988,19 @@ handle_0_verified_client_hello(dtls_context_t *ctx, dtls_ephemeral_peer_t *ephem
 }
 
 /**
- * Process initial ClientHello of epoch 0.
- *
- * In order to protect against "denial of service" attacks, RFC6347
- * contains in https://datatracker.ietf.org/doc/html/rfc6347#section-4.2.1
- * the advice to process initial a ClientHello in a stateless fashion.
- * If a ClientHello doesn't provide a matching cookie, a HelloVerifyRequest
- * is sent back based on the record and handshake message sequence numbers
- * contained in the \p ephemeral_peer. If a matching cookie is provided,
- * the server starts the handshake, also based on the record and handshake
- * message sequence numbers contained in the \p ephemeral_peer. This function
- * returns the number of bytes that were sent, or \c -1 if an error occurred.
+ * Checks the cookie of a ClientHello in epoch 0, and sends a
+ * HelloVerifyRequest if it has no matching cookie. This function
+ * returns \c 0 if the cookie matches, greater than zero if the
+ * ClientHello was answered or ignored, and less than zero on error.
  *
  * \param ctx              The DTLS context to use.
  * \param ephemeral_peer   The ephemeral remote peer.
- * \param data             The data to send.
- * \param data_length      The actual length of \p buf.
- * \return Less than zero on error, the number of bytes written otherwise.
+ * \param data             The ClientHello handshake message.
+ * \param data_length      The actual length of \p data.
+ * \return \c 0 if the ClientHello can be handled, else non-zero.
  */
 static int
-handle_0_client_hello(dtls_context_t *ctx, dtls_ephemeral_peer_t *ephemeral_peer,
+verify_0_client_hello(dtls_context_t *ctx, dtls_ephemeral_peer_t *ephemeral_peer,
          uint8 *data, size_t data_length)
 {
   dtls_handshake_header_t *hs_header;
@@ -3974,18 +4011,16 @@ handle_0_client_hello(dtls_context_t *ctx, dtls_ephemeral_peer_t *ephemeral_peer
 
   hs_header = DTLS_HANDSHAKE_HEADER(data);
 
-  dtls_debug("received initial client hello\n");
-
   packet_length = dtls_uint24_to_int(hs_header->length);
   fragment_length = dtls_uint24_to_int(hs_header->fragment_length);
   fragment_offset = dtls_uint24_to_int(hs_header->fragment_offset);
   if (packet_length != fragment_length || fragment_offset != 0) {
     dtls_warn("No fragment support (yet)\n");
-    return 0;
+    return 1;
   }
   if (fragment_length + DTLS_HS_LENGTH != data_length) {
     dtls_warn("Fragment size does not match packet size\n");
-    return 0;
+    return 1;
   }
   ephemeral_peer->mseq = dtls_uint16_to_int(hs_header->message_seq);
   err = dtls_0_verify_peer(ctx, ephemeral_peer, data, data_length);
@@ -3996,8 +4031,40 @@ handle_0_client_hello(dtls_context_t *ctx, dtls_ephemeral_peer_t *ephemeral_peer
 
   if (err > 0) {
     dtls_debug("server hello verify was sent\n");
-    return err;
   }
+  return err;
+}
+
+/**
+ * Process initial ClientHello of epoch 0.
+ *
+ * In order to protect against "denial of service" attacks, RFC6347
+ * contains in https://datatracker.ietf.org/doc/html/rfc6347#section-4.2.1
+ * the advice to process initial a ClientHello in a stateless fashion.
+ * If a ClientHello doesn't provide a matching cookie, a HelloVerifyRequest
+ * is sent back based on the record and handshake message sequence numbers
+ * contained in the \p ephemeral_peer. If a matching cookie is provided,
+ * the server starts the handshake, also based on the record and handshake
+ * message sequence numbers contained in the \p ephemeral_peer. This function
+ * returns the number of bytes that were sent, or \c -1 if an error occurred.
+ *
+ * \param ctx              The DTLS context to use.
+ * \param ephemeral_peer   The ephemeral remote peer.
+ * \param data             The data to send.
+ * \param data_length      The actual length of \p buf.
+ * \return Less than zero on error, the number of bytes written otherwise.
+ */
+static int
+handle_0_client_hello(dtls_context_t *ctx, dtls_ephemeral_peer_t *ephemeral_peer,
+         uint8 *data, size_t data_length)
+{
+  int err;
+
+  dtls_debug("received initial client hello\n");
+
+  err = verify_0_client_hello(ctx, ephemeral_peer, data, data_length);
+  if (err != 0)
+    return err;
 
   err = handle_0_verified_client_hello(ctx, ephemeral_peer, data, data_length);
   if (err < 0) {
@@ -4503,6 +4570,39 @@ dtls_handle_message(dtls_context_t *ctx,
   return 0;
 }
 
+int
+dtls_verify_client_hello(dtls_context_t *ctx,
+			 session_t *session,
+			 uint8 *msg, int msglen) {
+  dtls_record_header_t *header;
+  dtls_handshake_header_t *hs_header;
+  unsigned int rlen;
+  uint8 *data;
+  size_t data_length;
+
+  if (!(rlen = is_record(msg, msglen)))
+    return 0;
+
+  header = DTLS_RECORD_HEADER(msg);
+  if (dtls_get_content_type(header) != DTLS_CT_HANDSHAKE ||
+      dtls_get_epoch(header) != 0)
+    return 0;
+
+  data = msg + DTLS_RH_LENGTH;
+  data_length = rlen - DTLS_RH_LENGTH;
+  if (data_length < DTLS_HS_LENGTH)
+    return 0;
+
+  hs_header = DTLS_HANDSHAKE_HEADER(data);
+  if (hs_header->msg_type != DTLS_HT_CLIENT_HELLO)
+    return 0;
+
+  {
+    dtls_ephemeral_peer_t ephemeral_peer = {session, dtls_uint48_to_int(header->sequence_number), 0};
+    return verify_0_client_hello(ctx, &ephemeral_peer, data, data_length) == 0;
+  }
+}
+
 dtls_context_t *
 dtls_new_context(void *app_data) {
   dtls_context_t *c;
@@ -4530,6 +4630,8 @@ dtls_new_context(void *app_data) {
     c->cookie_secret_age = now;
   else
     goto error;
+  dtls_hmac_init(&c->cookie_hmac, c->cookie_secret, DTLS_COOKIE_SECRET_LENGTH);
+  dtls_hmac_clone(&c->cookie_hmac_prev, &c->cookie_hmac);
 
   return c;
 
@@ -60,6 +60,14 @@ typedef struct dtls_ecdsa_key_t {
 /** Length of the secret that is used for generating Hello Verify cookies. */
 #define DTLS_COOKIE_SECRET_LENGTH 12
 
+/**
+ * Seconds after which a new cookie secret is made. Cookies made with
+ * the secret before are still accepted until the next change.
+ */
+#ifndef DTLS_COOKIE_SECRET_LIFETIME
+#define DTLS_COOKIE_SECRET_LIFETIME 300
+#endif
+
 struct dtls_context_t;
 
 /**
@@ -215,6 +223,8 @@ struct netq_t;
 typedef struct dtls_context_t {
   unsigned char cookie_secret[DTLS_COOKIE_SECRET_LENGTH];
   clock_time_t cookie_secret_age; /**< the time the secret has been generated */
+  dtls_hmac_context_t cookie_hmac; /**< HMAC keyed with cookie_secret */
+  dtls_hmac_context_t cookie_hmac_prev; /**< HMAC keyed with the secret before */
 
   dtls_peer_t *peers;		/**< peer hash map */
 #ifdef WITH_CONTIKI
@@ -405,6 +415,25 @@ int dtls_record_read(dtls_state_t *state, uint8 *msg, int msglen);
 int dtls_handle_message(dtls_context_t *ctx, session_t *session,
 			uint8 *msg, int msglen);
 
+/**
+ * Checks the cookie of a ClientHello in epoch 0 from a peer that has
+ * no state yet, without creating any. If there is no valid cookie, a
+ * HelloVerifyRequest is sent with the write callback, as
+ * dtls_handle_message() would do. This lets an application drop
+ * ClientHellos from unverified addresses before it keeps any state of
+ * its own for them.
+ *
+ * @param ctx     The dtls context to use.
+ * @param session The remote peer that sent @p msg.
+ * @param msg     The received data
+ * @param msglen  The actual length of @p msg.
+ * @return @c 1 if @p msg is a ClientHello with a valid cookie, that
+ *         must now be passed to dtls_handle_message(), @c 0 if a
+ *         HelloVerifyRequest was sent or @p msg was dropped.
+ */
+int dtls_verify_client_hello(dtls_context_t *ctx, session_t *session,
+			     uint8 *msg, int msglen);
+
 /**
  * Check if @p session is associated with a peer object in @p context.
  * This function returns a pointer to the peer if found, NULL otherwise.
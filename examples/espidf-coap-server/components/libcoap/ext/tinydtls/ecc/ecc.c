@@ -81,9 +81,11 @@ static const uint32_t ecc_prime_m[8] = {0xffffffff, 0xffffffff, 0xffffffff, 0x00
 					0x00000000, 0x00000000, 0x00000001, 0xffffffff};
 
 							
+#ifdef TEST_INCLUDE
 /* This is added after an static byte addition if the answer has a carry in MSB*/
 static const uint32_t ecc_prime_r[8] = {0x00000001, 0x00000000, 0x00000000, 0xffffffff,
 					0xffffffff, 0xffffffff, 0xfffffffe, 0x00000000};
+#endif /* TEST_INCLUDE */
 
 // ffffffff00000000ffffffffffffffffbce6faada7179e84f3b9cac2fc632551
 static const uint32_t ecc_order_m[9] = {0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD,
@@ -104,6 +106,141 @@ const uint32_t ecc_g_point_x[8] = { 0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D
 const uint32_t ecc_g_point_y[8] = { 0x37BF51F5, 0xCBB64068, 0x6B315ECE, 0x2BCE3357,
 				    0x7C0F9E16, 0x8EE7EB4A, 0xFE1A7F9B, 0x4FE342E2};
 
+/*
+ * Fixed-base comb for multiples of G, see ec_mult_base(): entry j - 1 is
+ * the sum of 2^(i * ECC_COMB_SPACING) * G over the bits i set in j.  Made
+ * with a separate program from G, in affine coordinates.
+ */
+#define ECC_COMB_TEETH 5
+#define ECC_COMB_SPACING 52
+
+static const uint32_t ecc_g_comb[(1 << ECC_COMB_TEETH) - 1][2][8] = {
+	{ { 0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D81,
+	    0x63A440F2, 0xF8BCE6E5, 0xE12C4247, 0x6B17D1F2 },
+	  { 0x37BF51F5, 0xCBB64068, 0x6B315ECE, 0x2BCE3357,
+	    0x7C0F9E16, 0x8EE7EB4A, 0xFE1A7F9B, 0x4FE342E2 } },
+	{ { 0x071E5C83, 0xEEA6BC92, 0x8542A0BE, 0x8BD27F19,
+	    0x2A58E5B1, 0x20A845B7, 0x5026D73F, 0x54CCC941 },
+	  { 0x140916A1, 0xCFD08EF7, 0x5D8EE496, 0x929E0BCC,
+	    0xDAD2BF22, 0x3A8F8715, 0xB4514532, 0x1C433F45 } },
+	{ { 0x04BAC870, 0xF7D24BB7, 0x3A23C6AB, 0x593A09A0,
+	    0xF94C9D1D, 0xDFCC2358, 0x297BED02, 0x3CFA0F87 },
+	  { 0x40F26940, 0xCE98A30B, 0x0248A8AF, 0x62121C0D,
+	    0x8309AF9B, 0xA758AA80, 0x70BE12C6, 0xE4E37694 } },
+	{ { 0x3ECCA7E0, 0xC739A5EA, 0x6743333E, 0xA7D2C98F,
+	    0x224D9428, 0x0FEF6335, 0x5C792A0C, 0x7EF2EE3C },
+	  { 0x552AC094, 0x302B22DD, 0xDFBD3D20, 0x81B21450,
+	    0xD5E609DB, 0xA4F67F51, 0x30ACC011, 0xAFB68627 } },
+	{ { 0x86EF7D7D, 0xDD37E3FF, 0x088B86DB, 0xF6D77C27,
+	    0x254C5491, 0x28FE9A4F, 0x6DF0FD5E, 0xD6690337 },
+	  { 0xADDAD596, 0x9FF04992, 0x9E4373F9, 0xF3D1A7AF,
+	    0xDF074167, 0xA13E9578, 0xE6D13D22, 0x20E2A53C } },
+	{ { 0xB0879605, 0xD7B86AEE, 0xBE3C7265, 0xA424EC2D,
+	    0x12F01E9E, 0x276203C2, 0xB77E46E9, 0xB666FAC5 },
+	  { 0x3BF0C52D, 0xF431BB1A, 0x726CD8B6, 0xEF46A44A,
+	    0xEE3DE5A9, 0xEB5ABC19, 0x90246904, 0x38AAA380 } },
+	{ { 0x525D6ABF, 0xAEBFD735, 0x96BEA25A, 0xC302F8F4,
+	    0x544920A4, 0xDB82B3EA, 0x02EADB2E, 0x621C75D1 },
+	  { 0x9EF485F0, 0x8939DC4C, 0x57C46D63, 0x225D03D8,
+	    0x522D7F70, 0x4FDAC96F, 0xB4FA649D, 0xD7C4A4FE } },
+	{ { 0x943E832A, 0x9C762EF1, 0x1786DF70, 0x07E50AB0,
+	    0x2589F18E, 0x90F573A8, 0xA7C2A51A, 0x0D2BF28B },
+	  { 0x5B20D37C, 0x48263AF1, 0x60551446, 0x27EC9DB9,
+	    0x94B4E7ED, 0x7087A10A, 0x13BD00AC, 0x0CAC3F43 } },
+	{ { 0xC0B9372A, 0x8BC659AA, 0xEDD9583F, 0xF7659958,
+	    0x8C267D88, 0x9F05F94A, 0xC99A739D, 0x00DC46E7 },
+	  { 0xDF55D0F2, 0x4AF50A00, 0x8156BF6A, 0xB5EB202D,
+	    0x5228C111, 0x40D1E3AB, 0x45793424, 0x0312A557 } },
+	{ { 0x9E6486E0, 0x9D90CDA8, 0x1C7522C0, 0xC8A820BD,
+	    0x08DCD7AB, 0x867C5580, 0x882A7892, 0x3C510CE2 },
+	  { 0x646D54C6, 0x0E283334, 0xEDA4E046, 0x33392776,
+	    0x5BA997B0, 0xC3A7FC08, 0x5ACF053F, 0xD35E620F } },
+	{ { 0x7EB8CFEE, 0x8D9692F7, 0x0D8C013D, 0x05E3F223,
+	    0x84E32E59, 0x76347A52, 0x15B0A1E5, 0x3C53E290 },
+	  { 0xFAE798D4, 0x538B7DA5, 0x00D23591, 0x1B9F1BD1,
+	    0x9A08693F, 0x11A9F072, 0x140EFEB3, 0xD30E7CDA } },
+	{ { 0x4DD6C004, 0x81DEC926, 0xDAD210D5, 0xBFED14FE,
+	    0xB96B9911, 0x39F9FF69, 0x29C2024D, 0x02FD7B73 },
+	  { 0x715D29FC, 0x50CFCEB8, 0x0C236311, 0xB682B999,
+	    0xC7797831, 0x00F34ADD, 0x59927DF3, 0x42EBD3CB } },
+	{ { 0xF8E8F683, 0x6DFCF787, 0x3F7FBE90, 0x13D72B7A,
+	    0x2DF232CF, 0xFD426D94, 0x5FE39AAD, 0xED84BB42 },
+	  { 0x732995FC, 0x023E67A1, 0x355430E3, 0x67DD0A8E,
+	    0x97A1D703, 0x0CF83B61, 0x583C33F2, 0xA3233455 } },
+	{ { 0x68142904, 0x27014AB4, 0x00CFA617, 0xFB500882,
+	    0x7009B958, 0x6745FF87, 0xD449242D, 0x9E9889BC },
+	  { 0x575616C8, 0x035B613B, 0x138E99E2, 0x00855156,
+	    0x292E6AA0, 0x94C0D24B, 0x7E79B3A2, 0xD9BA5B68 } },
+	{ { 0x5F165D99, 0xCEBBBC7B, 0x8A4EEE61, 0x50CC51C1,
+	    0x1B4D0D1F, 0xB31D2353, 0x66382ADA, 0x95E18452 },
+	  { 0x0A839B5B, 0xACAD4F81, 0x4142FF0F, 0xA0A2A96E,
+	    0x1F4FA12F, 0x3EAA8289, 0x6B0FB8F3, 0x68D68C8F } },
+	{ { 0x839BB85F, 0x320F09C3, 0xA050E62C, 0x0101FB06,
+	    0x9AD53458, 0x557582C9, 0x1666432B, 0x55D5398D },
+	  { 0x4FED936F, 0xF7F63118, 0x1833D9E1, 0xD90D6A7F,
+	    0x8EBAA72A, 0x059C6A9E, 0x49FF8E2D, 0x576E2290 } },
+	{ { 0x51BBB3F1, 0x9311A269, 0x8D0F4F65, 0xE80F26BD,
+	    0x6BECCBB9, 0x9D3DC334, 0x101E5DE4, 0x54E244D5 },
+	  { 0xF1B19E28, 0xB3AD4C6E, 0x58C2E3B7, 0x4334FBC0,
+	    0x35DF9C25, 0x19BD4107, 0xEC106EB6, 0xD6BBEC0E } },
+	{ { 0xE5046DC5, 0x788251C7, 0xF179327B, 0x12839B95,
+	    0x4A8CB46E, 0xF1C05D98, 0x3C00736B, 0x443737CD },
+	  { 0x12CD8FE5, 0xA760A456, 0x0817BDD9, 0x797489DE,
+	    0xF42C23E8, 0xC56EB80A, 0xE6FE7AF5, 0x83719DD7 } },
+	{ { 0x3FEFCFC8, 0xE8881A83, 0xB9B5290B, 0xAEA3C9E0,
+	    0x771E4688, 0x10B37ECD, 0xD4D021B6, 0xEE0816A3 },
+	  { 0xB3A8CAA1, 0x8E9929BF, 0xC105F2D1, 0x48915DCF,
+	    0xDB49019F, 0x3A5FDF82, 0xAD9006E1, 0xC4A438E3 } },
+	{ { 0x87DE4B29, 0x5DB9620F, 0xD91ECB2E, 0xD7420C18,
+	    0x32ACF105, 0x301BA1B2, 0x7853A937, 0xDB96BB0C },
+	  { 0xC359AC34, 0xD84BFEF6, 0x64852A1D, 0xAB80CEF0,
+	    0xB9DA1717, 0x3FBEE4D3, 0x7A13222C, 0xB325074E } },
+	{ { 0xE83AD2C9, 0x5D6DC503, 0xAED035BE, 0xCA9F7A1D,
+	    0xCBD21E33, 0x552788AC, 0xE09CB9F0, 0x8699DD31 },
+	  { 0x329BF961, 0x38584196, 0xB82A5AF9, 0x4CB20E96,
+	    0xC72C78C1, 0x24199908, 0xE92859B7, 0x16E65484 } },
+	{ { 0x052FDE29, 0x6A201C4B, 0x0031DBB4, 0x6C897123,
+	    0x16C1DA96, 0x4A759982, 0x2CC67214, 0xEEC0B975 },
+	  { 0x812C864E, 0xB908B9F1, 0x8439F6BA, 0x367FB66A,
+	    0xF966F329, 0x789D664B, 0xF7F1D283, 0xE02AF770 } },
+	{ { 0xDB3038DD, 0xA20A2C70, 0xE99D5C7C, 0x5F0B46D5,
+	    0x4B600B83, 0xC9B97D37, 0x3DF3245E, 0x186C7F79 },
+	  { 0x4F1CE57F, 0x2AF72460, 0x91E2D8ED, 0x9249897F,
+	    0x8D2EA797, 0x8139B36A, 0x9AB58913, 0x9C428DB8 } },
+	{ { 0x6471AAA0, 0xB4A196FB, 0x1B6B9730, 0xDCBAB650,
+	    0x295B57D2, 0x7AFCCC8A, 0x4E33A65D, 0xEE2280F4 },
+	  { 0x890FCD12, 0xC47A0803, 0x82604F6B, 0x4E98A98D,
+	    0xED5FBBD2, 0x0D598F06, 0xA6A1EB84, 0xCE46EC91 } },
+	{ { 0x4BE6458D, 0x1F1E4F3F, 0x595E6547, 0x5F72CC22,
+	    0x271A93F1, 0x5BC5341E, 0x58A5F263, 0xC62E155C },
+	  { 0x58BA7FF4, 0x5F6F845A, 0x7E36A6AD, 0x67E1F7DC,
+	    0xEEAA4D04, 0xD33A7657, 0x18267E4E, 0xFF9F2322 } },
+	{ { 0x4A53789F, 0xD369F11F, 0x3696B437, 0xC7876FB6,
+	    0x0BABA29A, 0xA0E8F0A7, 0x32F6E514, 0xA0318A5F },
+	  { 0x11775A08, 0x5C4A43D1, 0x362EEBB1, 0x418C507C,
+	    0x09A325AA, 0xFD08903F, 0xF0EEBB3A, 0xF320B8FC } },
+	{ { 0xC7644C1D, 0xE33F0255, 0xBB9002D8, 0x4030ECC3,
+	    0xF4646F9F, 0xA4486916, 0x959C44FA, 0x5E677D0C },
+	  { 0xD88B9144, 0xE2E7D7D0, 0x6248F91F, 0x5D93A86F,
+	    0x02993AEA, 0xE33D0BD5, 0x3100D31E, 0x449F0CE6 } },
+	{ { 0x73CF2678, 0x3FCD925A, 0xA6D0AFC7, 0x34CA923B,
+	    0x3067791F, 0x9011091D, 0x5A7941E4, 0x8C568874 },
+	  { 0xFC339800, 0x34D37180, 0x595C51F4, 0x7744316B,
+	    0xE88C6420, 0xF2DDB693, 0x5BAD14D2, 0xFB3A48B1 } },
+	{ { 0xFDAAB256, 0x52DF1588, 0x3127354C, 0x68C0CD44,
+	    0xA591F853, 0x2A849471, 0x93D0CB92, 0xE4DA88E9 },
+	  { 0x1639C624, 0x6D1EA35D, 0x263707BA, 0x60FE2A36,
+	    0xD0F3BC51, 0x97FC50DE, 0x10062E80, 0xF7FA4D15 } },
+	{ { 0x024C168D, 0xC429A113, 0x3FEAA272, 0xB6C935FB,
+	    0xE639EC09, 0xB58A6071, 0xF9C13DE7, 0x4B59253A },
+	  { 0xFBFB8955, 0x6D2D68F2, 0x50723FE2, 0xF0064C12,
+	    0x01F185F5, 0xE85D7820, 0x7FA79C93, 0xAA0307BF } },
+	{ { 0x5B696527, 0x2E75A266, 0x5A00169C, 0x1A2530B0,
+	    0x4286FB42, 0x76C4C180, 0x8E831D5B, 0x825F0194 },
+	  { 0xEF703739, 0xDBF0A11F, 0xCE5B106A, 0x106F9BC4,
+	    0x24111150, 0x61794C4F, 0xBC723A17, 0x435872FE } }
+};
+
 
 static void setZero(uint32_t *A, const int length){
 	memset(A, 0x0, length * sizeof(uint32_t));
@@ -134,6 +271,7 @@ static int isGreater(const uint32_t *A, const uint32_t *B, uint8_t length){
 }
 
 
+#ifdef TEST_INCLUDE
 static int fieldAdd(const uint32_t *x, const uint32_t *y, const uint32_t *reducer, uint32_t *result){
 	if(add(x, y, result, arrayLength)){ //add prime if carry is still set!
 		uint32_t tempas[8];
@@ -143,6 +281,7 @@ static int fieldAdd(const uint32_t *x, const uint32_t *y, const uint32_t *reduce
 	}
 	return 0;
 }
+#endif /* TEST_INCLUDE */
 
 static int fieldSub(const uint32_t *x, const uint32_t *y, const uint32_t *modulus, uint32_t *result){
 	if(sub(x, y, result, arrayLength)){ //add modulus if carry is set
@@ -175,6 +314,8 @@ static int fieldMult(const uint32_t *x, const uint32_t *y, uint32_t *result, uin
 	return 0;
 }
 
+#ifdef TEST_INCLUDE
+//only used by the tests, the point arithmetic reduces with fpReduce()
 //TODO: maximum:
 //fffffffe00000002fffffffe0000000100000001fffffffe00000001fffffffe00000001fffffffefffffffffffffffffffffffe000000000000000000000001_16
 static void fieldModP(uint32_t *A, const uint32_t *B)
@@ -250,6 +391,7 @@ static void fieldModP(uint32_t *A, const uint32_t *B)
 		copy(tempm, A, arrayLength);
 	}
 }
+#endif /* TEST_INCLUDE */
 
 /**
  * calculate the result = A mod n.
@@ -425,108 +567,407 @@ static void fieldInv(const uint32_t *A, const uint32_t *modulus, const uint32_t
 	}
 }
 
-static void ec_double(const uint32_t *px, const uint32_t *py, uint32_t *Dx, uint32_t *Dy){
-	uint32_t tempA[8];
-	uint32_t tempB[8];
-	uint32_t tempC[8];
-	uint32_t tempD[16];
+/*
+ * Arithmetic modulo p for the point operations below.  Unlike the field
+ * functions above, these always give fully reduced results, and neither
+ * branch nor index memory on the numbers they work on.
+ */
 
-	if(isZero(px) && isZero(py)){
-		copy(px, Dx,arrayLength);
-		copy(py, Dy,arrayLength);
-		return;
+//0xffffffff if v is 0, else 0
+static uint32_t zeroMask(uint32_t v){
+	return ((v | (0 - v)) >> 31) - 1;
+}
+
+static uint32_t isZeroMask(const uint32_t *A){
+	uint32_t bits = 0;
+	int i;
+	for (i = 0; i < arrayLength; i++)
+		bits |= A[i];
+	return zeroMask(bits);
+}
+
+//to = from where mask is 0xffffffff, left as it is where mask is 0
+static void moveIf(const uint32_t *from, uint32_t *to, uint32_t mask, uint8_t length){
+	uint8_t i;
+	for (i = 0; i < length; i++)
+		to[i] ^= (to[i] ^ from[i]) & mask;
+}
+
+static void swapIf(uint32_t *A, uint32_t *B, uint32_t mask, uint8_t length){
+	uint8_t i;
+	uint32_t t;
+	for (i = 0; i < length; i++) {
+		t = (A[i] ^ B[i]) & mask;
+		A[i] ^= t;
+		B[i] ^= t;
 	}
+}
 
-	fieldMult(px, px, tempD, arrayLength);
-	fieldModP(tempA, tempD);
-	setZero(tempB, 8);
-	tempB[0] = 0x00000001;
-	fieldSub(tempA, tempB, ecc_prime_m, tempC); //tempC = (qx^2-1)
-	tempB[0] = 0x00000003;
-	fieldMult(tempC, tempB, tempD, arrayLength);
-	fieldModP(tempA, tempD);//tempA = 3*(qx^2-1)
-	fieldAdd(py, py, ecc_prime_r, tempB); //tempB = 2*qy
-	fieldInv(tempB, ecc_prime_m, ecc_prime_r, tempC); //tempC = 1/(2*qy)
-	fieldMult(tempA, tempC, tempD, arrayLength); //tempB = lambda = (3*(qx^2-1))/(2*qy)
-	fieldModP(tempB, tempD);
-
-	fieldMult(tempB, tempB, tempD, arrayLength); //tempC = lambda^2
-	fieldModP(tempC, tempD);
-	fieldSub(tempC, px, ecc_prime_m, tempA); //lambda^2 - Px
-	fieldSub(tempA, px, ecc_prime_m, Dx); //lambda^2 - Px - Qx
-
-	fieldSub(px, Dx, ecc_prime_m, tempA); //tempA = qx-dx
-	fieldMult(tempB, tempA, tempD, arrayLength); //tempC = lambda * (qx-dx)
-	fieldModP(tempC, tempD);
-	fieldSub(tempC, py, ecc_prime_m, Dy); //Dy = lambda * (qx-dx) - px
-}
-
-static void ec_add(const uint32_t *px, const uint32_t *py, const uint32_t *qx, const uint32_t *qy, uint32_t *Sx, uint32_t *Sy){
-	uint32_t tempA[8];
-	uint32_t tempB[8];
-	uint32_t tempC[8];
-	uint32_t tempD[16];
-
-	if(isZero(px) && isZero(py)){
-		copy(qx, Sx,arrayLength);
-		copy(qy, Sy,arrayLength);
-		return;
-	} else if(isZero(qx) && isZero(qy)) {
-		copy(px, Sx,arrayLength);
-		copy(py, Sy,arrayLength);
-		return;
+static void fpAdd(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint32_t t[8];
+	uint32_t carry = add(x, y, result, arrayLength);
+	uint32_t borrow = sub(result, ecc_prime_m, t, arrayLength);
+	moveIf(t, result, 0 - (carry | (borrow ^ 1)), arrayLength); //x + y - p unless x + y < p
+}
+
+static void fpSub(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint32_t t[8];
+	uint32_t borrow = sub(x, y, result, arrayLength);
+	add(result, ecc_prime_m, t, arrayLength);
+	moveIf(t, result, 0 - borrow, arrayLength); //x - y + p if x < y
+}
+
+/*
+ * Reduces the 512 bit number c modulo p with the NIST fast reduction
+ * (FIPS 186-4, D.2.3), summing up all of its terms one word at a time.
+ */
+static void fpReduce(const uint32_t *c, uint32_t *result){
+	//2^256 = 2^224 - 2^192 - 2^96 + 1 (mod p)
+	static const int8_t fold[8] = { 1, 0, 0, -1, 0, 0, -1, 1 };
+	int64_t w[8];
+	int64_t carry = 0;
+	int64_t top;
+	uint32_t t[8];
+	int i, n;
+
+	w[0] = (int64_t)c[0] + c[8] + c[9] - c[11] - c[12] - c[13] - c[14];
+	w[1] = (int64_t)c[1] + c[9] + c[10] - c[12] - c[13] - c[14] - c[15];
+	w[2] = (int64_t)c[2] + c[10] + c[11] - c[13] - c[14] - c[15];
+	w[3] = (int64_t)c[3] + 2 * ((int64_t)c[11] + c[12]) + c[13] - c[15] - c[8] - c[9];
+	w[4] = (int64_t)c[4] + 2 * ((int64_t)c[12] + c[13]) + c[14] - c[9] - c[10];
+	w[5] = (int64_t)c[5] + 2 * ((int64_t)c[13] + c[14]) + c[15] - c[10] - c[11];
+	w[6] = (int64_t)c[6] + 3 * (int64_t)c[14] + 2 * (int64_t)c[15] + c[13] - c[8] - c[9];
+	w[7] = (int64_t)c[7] + 3 * (int64_t)c[15] + c[8] - c[10] - c[11] - c[12] - c[13];
+
+	//the sum is between -4 * 2^256 and 7 * 2^256
+	for (i = 0; i < arrayLength; i++) {
+		carry += w[i];
+		result[i] = (uint32_t)carry;
+		carry = (carry - result[i]) / ((int64_t)1 << 32);
+	}
+	//folding in what is above 2^256 twice leaves a number below 2^256
+	for (n = 0; n < 2; n++) {
+		top = carry;
+		carry = 0;
+		for (i = 0; i < arrayLength; i++) {
+			carry += (int64_t)result[i] + fold[i] * top;
+			result[i] = (uint32_t)carry;
+			carry = (carry - result[i]) / ((int64_t)1 << 32);
+		}
 	}
+	moveIf(t, result, sub(result, ecc_prime_m, t, arrayLength) - 1, arrayLength);
+}
 
-	if(isSame(px, qx, arrayLength)){
-		if(!isSame(py, qy, arrayLength)){
-			setZero(Sx, 8);
-			setZero(Sy, 8);
-			return;
-		} else {
-			ec_double(px, py, Sx, Sy);
-			return;
+//result = x * y mod p, result may be x or y
+static void fpMult(const uint32_t *x, const uint32_t *y, uint32_t *result){
+	uint32_t c[16];
+	uint64_t acc = 0;
+	uint32_t over = 0;
+	uint64_t product;
+	int i, k;
+
+	//column by column, into a 96 bit accumulator
+	for (k = 0; k < 2 * arrayLength - 1; k++) {
+		for (i = k < arrayLength ? 0 : k - arrayLength + 1; i <= k && i < arrayLength; i++) {
+			product = (uint64_t)x[i] * y[k - i];
+			acc += product;
+			over += acc < product;
 		}
+		c[k] = (uint32_t)acc;
+		acc = (acc >> 32) | ((uint64_t)over << 32);
+		over = 0;
 	}
+	c[15] = (uint32_t)acc;
+	fpReduce(c, result);
+}
 
-	fieldSub(py, qy, ecc_prime_m, tempA);
-	fieldSub(px, qx, ecc_prime_m, tempB);
-	fieldInv(tempB, ecc_prime_m, ecc_prime_r, tempB);
-	fieldMult(tempA, tempB, tempD, arrayLength); 
-	fieldModP(tempC, tempD); //tempC = lambda
+//result = x^(2^n)
+static void fpSquareN(const uint32_t *x, int n, uint32_t *result){
+	if (x != result)
+		copy(x, result, arrayLength);
+	while (n--)
+		fpMult(result, result, result);
+}
 
-	fieldMult(tempC, tempC, tempD, arrayLength); //tempA = lambda^2
-	fieldModP(tempA, tempD);
-	fieldSub(tempA, px, ecc_prime_m, tempB); //lambda^2 - Px
-	fieldSub(tempB, qx, ecc_prime_m, Sx); //lambda^2 - Px - Qx
+/*
+ * Inverse x and output to result, as x^(p-2) with 255 squarings and 13
+ * multiplications.  Gives 0 for x = 0.
+ * p-2 = ffffffff 00000001 00000000 00000000 00000000 ffffffff ffffffff fffffffd
+ */
+static void fpInv(const uint32_t *x, uint32_t *result){
+	uint32_t x2[8], x4[8], x8[8], x30[8], x32[8], t[8];
+
+	fpMult(x, x, t);
+	fpMult(t, x, x2);		//x^(2^2-1)
+	fpSquareN(x2, 2, t);
+	fpMult(t, x2, x4);		//x^(2^4-1)
+	fpSquareN(x4, 4, t);
+	fpMult(t, x4, x8);		//x^(2^8-1)
+	fpSquareN(x8, 8, t);
+	fpMult(t, x8, t);		//x^(2^16-1)
+	fpSquareN(t, 8, t);
+	fpMult(t, x8, t);		//x^(2^24-1)
+	fpSquareN(t, 4, t);
+	fpMult(t, x4, t);		//x^(2^28-1)
+	fpSquareN(t, 2, t);
+	fpMult(t, x2, x30);		//x^(2^30-1)
+	fpSquareN(x30, 2, t);
+	fpMult(t, x2, x32);		//x^(2^32-1)
+
+	fpSquareN(x32, 32, t);
+	fpMult(t, x, t);		//ffffffff 00000001
+	fpSquareN(t, 128, t);
+	fpMult(t, x32, t);		//... 00000000 00000000 00000000 ffffffff
+	fpSquareN(t, 32, t);
+	fpMult(t, x32, t);		//... ffffffff
+	fpSquareN(t, 30, t);
+	fpMult(t, x30, t);
+	fpSquareN(t, 2, t);
+	fpMult(t, x, result);		//... fffffffd
+}
 
-	fieldSub(qx, Sx, ecc_prime_m, tempB);
-	fieldMult(tempC, tempB, tempD, arrayLength);
-	fieldModP(tempC, tempD);
-	fieldSub(tempC, qy, ecc_prime_m, Sy);
+/*
+ * A point in Jacobian coordinates, which stands for the affine point
+ * (x / z^2, y / z^3).  The point at infinity has z = 0.  This way, adding
+ * and doubling points needs no inversion, just one at the end to get
+ * back to affine coordinates.
+ */
+typedef struct {
+	uint32_t x[8];
+	uint32_t y[8];
+	uint32_t z[8];
+} ec_point_t;
+
+static void ec_set_infinity(ec_point_t *P){
+	setZero(P->x, arrayLength);
+	setZero(P->y, arrayLength);
+	setZero(P->z, arrayLength);
 }
 
-void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
-	uint32_t Qx[8];
-	uint32_t Qy[8];
-	setZero(Qx, 8);
-	setZero(Qy, 8);
+//(0, 0) stands for the point at infinity, as it does in the affine API
+static void ec_from_affine(const uint32_t *x, const uint32_t *y, ec_point_t *P){
+	copy(x, P->x, arrayLength);
+	copy(y, P->y, arrayLength);
+	setZero(P->z, arrayLength);
+	P->z[0] = ~(isZeroMask(x) & isZeroMask(y)) & 1;
+}
 
-	uint32_t tempx[8];
-	uint32_t tempy[8];
+//gives (0, 0) for the point at infinity
+static void ec_to_affine(const ec_point_t *P, uint32_t *x, uint32_t *y){
+	uint32_t zi[8];
+	uint32_t zi2[8];
 
-	int i;
-	for (i = 256;i--;){
-		ec_double(Qx, Qy, tempx, tempy);
-		copy(tempx, Qx,arrayLength);
-		copy(tempy, Qy,arrayLength);
-		if (((secret[i / 32]) & ((uint32_t)1 << (i % 32)))) {
-			ec_add(Qx, Qy, px, py, tempx, tempy); //eccAdd
-			copy(tempx, Qx,arrayLength);
-			copy(tempy, Qy,arrayLength);
+	fpInv(P->z, zi);
+	fpMult(zi, zi, zi2);
+	fpMult(zi2, zi, zi);
+	fpMult(P->x, zi2, x);
+	fpMult(P->y, zi, y);
+}
+
+/*
+ * D = 2P, with the formulas for a = -3 (dbl-2001-b in the Explicit-Formulas
+ * Database).  D may be P.  Doubling the point at infinity gives z = 0.
+ */
+static void ec_double(const ec_point_t *P, ec_point_t *D){
+	uint32_t delta[8];
+	uint32_t gamma[8];
+	uint32_t beta[8];
+	uint32_t alpha[8];
+	uint32_t t[8];
+
+	fpMult(P->z, P->z, delta);
+	fpMult(P->y, P->y, gamma);
+	fpMult(P->x, gamma, beta);
+	fpSub(P->x, delta, t);
+	fpAdd(P->x, delta, alpha);
+	fpMult(t, alpha, alpha);
+	fpAdd(alpha, alpha, t);
+	fpAdd(alpha, t, alpha);		//alpha = 3 * (x - z^2) * (x + z^2)
+	fpAdd(P->y, P->z, t);
+	fpMult(t, t, t);
+	fpSub(t, gamma, t);
+	fpSub(t, delta, D->z);		//Dz = (y + z)^2 - y^2 - z^2
+
+	fpAdd(beta, beta, beta);
+	fpAdd(beta, beta, beta);	//beta = 4 * x * y^2
+	fpMult(alpha, alpha, t);
+	fpSub(t, beta, t);
+	fpSub(t, beta, D->x);		//Dx = alpha^2 - 8 * x * y^2
+
+	fpSub(beta, D->x, t);
+	fpMult(alpha, t, t);
+	fpMult(gamma, gamma, gamma);
+	fpAdd(gamma, gamma, gamma);
+	fpAdd(gamma, gamma, gamma);
+	fpAdd(gamma, gamma, gamma);
+	fpSub(t, gamma, D->y);		//Dy = alpha * (4 * x * y^2 - Dx) - 8 * y^4
+}
+
+/*
+ * S = P + Q (add-1998-cmo-2 in the Explicit-Formulas Database).  If
+ * qAffine is set, Q has z = 1 unless it is the point at infinity, which
+ * saves four multiplications.  S may be P or Q.  Adding P to -P gives
+ * z = 0 by itself; only P = Q takes another path, which cannot happen
+ * for the multiples added up in the scalar multiplications below unless
+ * the scalar is chosen for it.
+ */
+static void ec_add(const ec_point_t *P, const ec_point_t *Q, int qAffine, ec_point_t *S){
+	uint32_t u1[8];
+	uint32_t u2[8];
+	uint32_t s1[8];
+	uint32_t s2[8];
+	uint32_t h[8];
+	uint32_t r[8];
+	uint32_t t[8];
+	uint32_t z[8];
+	uint32_t pInf = isZeroMask(P->z);
+	uint32_t qInf = isZeroMask(Q->z);
+
+	fpMult(P->z, P->z, t);
+	fpMult(Q->x, t, u2);		//u2 = Qx * Pz^2
+	fpMult(t, P->z, t);
+	fpMult(Q->y, t, s2);		//s2 = Qy * Pz^3
+	if (qAffine) {
+		copy(P->x, u1, arrayLength);
+		copy(P->y, s1, arrayLength);
+		copy(P->z, z, arrayLength);
+	} else {
+		fpMult(Q->z, Q->z, t);
+		fpMult(P->x, t, u1);	//u1 = Px * Qz^2
+		fpMult(t, Q->z, t);
+		fpMult(P->y, t, s1);	//s1 = Py * Qz^3
+		fpMult(P->z, Q->z, z);
+	}
+	fpSub(u2, u1, h);
+	fpSub(s2, s1, r);
+	if (isZeroMask(h) & isZeroMask(r) & ~pInf & ~qInf) {
+		ec_double(P, S);
+		return;
+	}
+
+	fpMult(z, h, z);		//Sz = Pz * Qz * h
+	fpMult(h, h, t);
+	fpMult(u1, t, u1);		//u1 = u1 * h^2
+	fpMult(h, t, h);		//h = h^3
+	fpMult(r, r, t);
+	fpSub(t, h, t);
+	fpSub(t, u1, t);
+	fpSub(t, u1, t);		//Sx = r^2 - h^3 - 2 * u1 * h^2
+	fpSub(u1, t, u1);
+	fpMult(r, u1, r);
+	fpMult(s1, h, s1);
+	fpSub(r, s1, r);		//Sy = r * (u1 * h^2 - Sx) - s1 * h^3
+
+	//P + infinity = P, infinity + Q = Q
+	moveIf(P->x, t, qInf, arrayLength);
+	moveIf(P->y, r, qInf, arrayLength);
+	moveIf(P->z, z, qInf, arrayLength);
+	moveIf(Q->x, t, pInf, arrayLength);
+	moveIf(Q->y, r, pInf, arrayLength);
+	moveIf(Q->z, z, pInf, arrayLength);
+	copy(t, S->x, arrayLength);
+	copy(r, S->y, arrayLength);
+	copy(z, S->z, arrayLength);
+}
+
+static uint32_t secretBit(const uint32_t *secret, int i){
+	return (secret[i / 32] >> (i % 32)) & 1;
+}
+
+/*
+ * Q = secret * G with a fixed-base comb: bit i of the entry index taken
+ * in column c is bit c + i * ECC_COMB_SPACING of the secret, so 52
+ * doublings and 52 additions of entries of ecc_g_comb are enough.  Every
+ * entry is read for each column, and the addition is done even for
+ * index 0, so neither timing nor memory access depends on the secret.
+ */
+static void ec_mult_base(const uint32_t *secret, ec_point_t *Q){
+	ec_point_t T;
+	ec_point_t S;
+	uint32_t idx;
+	uint32_t j;
+	int col, i;
+
+	ec_set_infinity(Q);
+	ec_from_affine(ecc_g_comb[0][0], ecc_g_comb[0][1], &T);
+	for (col = ECC_COMB_SPACING; col--;) {
+		ec_double(Q, Q);
+		idx = 0;
+		for (i = 0; i < ECC_COMB_TEETH; i++) {
+			if (col + i * ECC_COMB_SPACING < 256)
+				idx |= secretBit(secret, col + i * ECC_COMB_SPACING) << i;
 		}
+		for (j = 1; j < (1 << ECC_COMB_TEETH); j++) {
+			moveIf(ecc_g_comb[j - 1][0], T.x, zeroMask(j ^ idx), arrayLength);
+			moveIf(ecc_g_comb[j - 1][1], T.y, zeroMask(j ^ idx), arrayLength);
+		}
+		ec_add(Q, &T, 1, &S);
+		moveIf(S.x, Q->x, ~zeroMask(idx), arrayLength);
+		moveIf(S.y, Q->y, ~zeroMask(idx), arrayLength);
+		moveIf(S.z, Q->z, ~zeroMask(idx), arrayLength);
+	}
+}
+
+/*
+ * R0 = secret * P with a Montgomery ladder, which keeps R1 = R0 + P and
+ * does one addition and one doubling for each of the 256 bits, whatever
+ * their value.
+ */
+static void ec_mult_ladder(const uint32_t *px, const uint32_t *py, const uint32_t *secret, ec_point_t *R0){
+	ec_point_t R1;
+	uint32_t mask;
+	int i;
+
+	ec_set_infinity(R0);
+	ec_from_affine(px, py, &R1);
+	for (i = 256; i--;) {
+		mask = 0 - secretBit(secret, i);
+		swapIf(R0->x, R1.x, mask, arrayLength);
+		swapIf(R0->y, R1.y, mask, arrayLength);
+		swapIf(R0->z, R1.z, mask, arrayLength);
+		ec_add(&R1, R0, 0, &R1);
+		ec_double(R0, R0);
+		swapIf(R0->x, R1.x, mask, arrayLength);
+		swapIf(R0->y, R1.y, mask, arrayLength);
+		swapIf(R0->z, R1.z, mask, arrayLength);
 	}
-	copy(Qx, resultx,arrayLength);
-	copy(Qy, resulty,arrayLength);
+}
+
+/*
+ * R = u1 * G + u2 * (qx, qy) with Shamir's trick: one run of doublings
+ * for both, adding G, Q or G + Q for each pair of bits.  Only used on
+ * public numbers, so this may branch on them.
+ */
+static void ec_mult_shamir(const uint32_t *u1, const uint32_t *u2, const uint32_t *qx, const uint32_t *qy, ec_point_t *R){
+	ec_point_t T[3];
+	uint32_t x[8];
+	uint32_t y[8];
+	uint32_t idx;
+	int i;
+
+	ec_from_affine(ecc_g_point_x, ecc_g_point_y, &T[0]);
+	ec_from_affine(qx, qy, &T[1]);
+	ec_add(&T[1], &T[0], 1, &T[2]);
+	ec_to_affine(&T[2], x, y);
+	ec_from_affine(x, y, &T[2]);
+
+	ec_set_infinity(R);
+	for (i = 256; i--;) {
+		ec_double(R, R);
+		idx = secretBit(u1, i) | secretBit(u2, i) << 1;
+		if (idx)
+			ec_add(R, &T[idx - 1], 1, R);
+	}
+}
+
+void ecc_ec_mult(const uint32_t *px, const uint32_t *py, const uint32_t *secret, uint32_t *resultx, uint32_t *resulty){
+	ec_point_t Q;
+
+	if (isSame(px, ecc_g_point_x, arrayLength) && isSame(py, ecc_g_point_y, arrayLength))
+		ec_mult_base(secret, &Q);
+	else
+		ec_mult_ladder(px, py, secret, &Q);
+	ec_to_affine(&Q, resultx, resulty);
 }
 
 /**
@@ -613,12 +1054,9 @@ int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e,
 	uint32_t tmp[16];
 	uint32_t u1[9];
 	uint32_t u2[9];
-	uint32_t tmp1_x[8];
-	uint32_t tmp1_y[8];
-	uint32_t tmp2_x[8];
-	uint32_t tmp2_y[8];
-	uint32_t tmp3_x[8];
-	uint32_t tmp3_y[8];
+	uint32_t tmp_x[8];
+	uint32_t tmp_y[8];
+	ec_point_t R;
 
 	if (isZero(r) || isZero(s))
 		return -1;
@@ -635,17 +1073,16 @@ int ecc_ecdsa_validate(const uint32_t *x, const uint32_t *y, const uint32_t *e,
 	fieldModO(tmp, u2, 16);
 
 	// 5. Calculate the curve point (x_1, y_1) = u_1 * G + u_2 * Q_A.
-	// tmp1 = u_1 * G
-	ecc_ec_mult(ecc_g_point_x, ecc_g_point_y, u1, tmp1_x, tmp1_y);
-
-	// tmp2 = u_2 * Q_A
-	ecc_ec_mult(x, y, u2, tmp2_x, tmp2_y);
+	ec_mult_shamir(u1, u2, x, y, &R);
+	if (isZeroMask(R.z))
+		return -1;
+	ec_to_affine(&R, tmp_x, tmp_y);
 
-	// tmp3 = tmp1 + tmp2
-	ec_add(tmp1_x, tmp1_y, tmp2_x, tmp2_y, tmp3_x, tmp3_y);
-	// TODO: this u_1 * G + u_2 * Q_A  could be optimiced with Straus's algorithm.
+	// 6. The signature is valid if r = x_1 \pmod{n}, x_1 < p < 2n
+	if (isGreater(tmp_x, ecc_order_m, arrayLength) >= 0)
+		sub(tmp_x, ecc_order_m, tmp_x, arrayLength);
 
-	return isSame(tmp3_x, r, arrayLength) ? 0 : -1;
+	return isSame(tmp_x, r, arrayLength) ? 0 : -1;
 }
 
 int ecc_is_valid_key(const uint32_t * priv_key)
@@ -717,11 +1154,20 @@ int ecc_isGreater(const uint32_t *A, const uint32_t *B, uint8_t length)
 
 void ecc_ec_add(const uint32_t *px, const uint32_t *py, const uint32_t *qx, const uint32_t *qy, uint32_t *Sx, uint32_t *Sy)
 {
-	ec_add(px, py, qx, qy, Sx, Sy);
+	ec_point_t P, Q;
+
+	ec_from_affine(px, py, &P);
+	ec_from_affine(qx, qy, &Q);
+	ec_add(&P, &Q, 1, &P);
+	ec_to_affine(&P, Sx, Sy);
 }
 void ecc_ec_double(const uint32_t *px, const uint32_t *py, uint32_t *Dx, uint32_t *Dy)
 {
-	ec_double(px, py, Dx, Dy);
+	ec_point_t P;
+
+	ec_from_affine(px, py, &P);
+	ec_double(&P, &P);
+	ec_to_affine(&P, Dx, Dy);
 }
 
 #endif /* TEST_INCLUDE */
@@ -19,6 +19,7 @@
 #define _DTLS_HMAC_H_
 
 #include <sys/types.h>
+#include <string.h>
 
 #include "tinydtls.h"
 #include "global.h"
@@ -107,11 +108,14 @@ typedef enum {
  * dtls_hmac_init() and must be passed to dtls_hmac_update() and
  * dtls_hmac_finalize(). Once, finalized, the component \c H is
  * invalid and must be initialized again with dtls_hmac_init() before
- * the structure can be used again. 
+ * the structure can be used again. The key is only hashed by
+ * dtls_hmac_init(): a context that has not been updated yet can be
+ * kept and copied with dtls_hmac_clone() for each message that is
+ * authenticated with the same key.
  */
 typedef struct {
-  unsigned char pad[DTLS_HMAC_BLOCKSIZE]; /**< ipad and opad storage */
-  dtls_hash_ctx data;		          /**< context for hash function */
+  dtls_hash_ctx outer;		/**< hash state after the opad block */
+  dtls_hash_ctx data;		/**< hash state after the ipad block */
 } dtls_hmac_context_t;
 
 /**
@@ -123,6 +127,19 @@ typedef struct {
  */
 void dtls_hmac_init(dtls_hmac_context_t *ctx, const unsigned char *key, size_t klen);
 
+/**
+ * Copies the HMAC context \p src to \p dst. When \p src has been
+ * initialized with dtls_hmac_init() and not updated, this is a cheap
+ * way to start another HMAC with the same key.
+ *
+ * @param dst The HMAC context to initialize.
+ * @param src The HMAC context to copy.
+ */
+static inline void
+dtls_hmac_clone(dtls_hmac_context_t *dst, const dtls_hmac_context_t *src) {
+  memcpy(dst, src, sizeof(dtls_hmac_context_t));
+}
+
 /**
  * Updates the HMAC context with data from \p input. 
  * 
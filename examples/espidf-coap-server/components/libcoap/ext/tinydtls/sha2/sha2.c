@@ -44,6 +44,39 @@
 #endif
 #include "sha2.h"
 
+#ifdef WITH_SHA256
+/*
+ * The SHA instructions are only used in the functions marked with
+ * their target, so the rest of the library still runs on CPUs
+ * without them.  dtls_sha256_accel_supported() tells which can be used.
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SHA2_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#ifndef bit_SHA
+#define bit_SHA	(1 << 29)
+#endif
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+#endif
+
+#if defined(__aarch64__) && \
+    (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO) || \
+     (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6))
+#define SHA2_ARMV8
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#if defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+#define ARMV8_TARGET
+#else
+#define ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+#endif /* WITH_SHA256 */
+
 /*
  * ASSERT NOTE:
  * Some sanity checking code is included using assert().  On my FreeBSD
@@ -579,6 +612,148 @@ void dtls_sha256_transform(dtls_sha256_ctx* context, const sha2_byte* data) {
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+static int sha256_accel = -1;	/* -1 for dtls_sha256_accel_supported() */
+
+int dtls_sha256_accel_supported(void) {
+	static int supported = -1;
+
+	if (supported >= 0)
+		return supported;
+	supported = DTLS_SHA256_ACCEL_NONE;
+#ifdef SHA2_SHANI
+	{
+		unsigned int a, b, c, d;
+
+		if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1) &&
+		    __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA))
+			supported = DTLS_SHA256_ACCEL_SHANI;
+	}
+#endif
+#ifdef SHA2_ARMV8
+#if defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO) || \
+    defined(__APPLE__)
+	supported = DTLS_SHA256_ACCEL_ARMV8;
+#elif defined(__linux__) && defined(HWCAP_SHA2)
+	if (getauxval(AT_HWCAP) & HWCAP_SHA2)
+		supported = DTLS_SHA256_ACCEL_ARMV8;
+#endif
+#endif
+	return supported;
+}
+
+int dtls_sha256_set_accel(int accel) {
+	if (accel != DTLS_SHA256_ACCEL_NONE && accel != dtls_sha256_accel_supported())
+		return -1;
+	sha256_accel = accel;
+	return 0;
+}
+
+#ifdef SHA2_SHANI
+/*
+ * Four rounds at a time.  The instructions keep the state as the
+ * words ABEF and CDGH, so it is rearranged before and after.
+ */
+SHANI_TARGET static void
+sha256_transform_shani(sha2_word32 state[8], const sha2_byte* data, size_t blocks) {
+	const __m128i	swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i		abef, cdgh, abef_save, cdgh_save, msg, tmp;
+	__m128i		w[4];
+	int		j;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+	while (blocks--) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+		for (j = 0; j < 16; j++) {
+			if (j < 4) {
+				w[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * j)), swap);
+			} else {
+				/* Message schedule for words 4j to 4j+3 */
+				tmp = _mm_alignr_epi8(w[(j - 1) & 3], w[(j - 2) & 3], 4);
+				w[j & 3] = _mm_sha256msg1_epu32(w[j & 3], w[(j - 3) & 3]);
+				w[j & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(w[j & 3], tmp), w[(j - 1) & 3]);
+			}
+			msg = _mm_add_epi32(w[j & 3], _mm_loadu_si128((const __m128i *)&K256[4 * j]));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+		}
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+		data += DTLS_SHA256_BLOCK_LENGTH;
+	}
+
+	tmp = _mm_shuffle_epi32(abef, 0x1B);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif /* SHA2_SHANI */
+
+#ifdef SHA2_ARMV8
+/* Four rounds at a time, on the state as the words ABCD and EFGH */
+ARMV8_TARGET static void
+sha256_transform_armv8(sha2_word32 state[8], const sha2_byte* data, size_t blocks) {
+	uint32x4_t	abcd, efgh, abcd_save, efgh_save, msg, prev;
+	uint32x4_t	w[4];
+	int		j;
+
+	abcd = vld1q_u32(&state[0]);
+	efgh = vld1q_u32(&state[4]);
+
+	while (blocks--) {
+		abcd_save = abcd;
+		efgh_save = efgh;
+		for (j = 0; j < 16; j++) {
+			if (j < 4) {
+				w[j] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * j)));
+			} else {
+				/* Message schedule for words 4j to 4j+3 */
+				w[j & 3] = vsha256su1q_u32(vsha256su0q_u32(w[j & 3], w[(j - 3) & 3]),
+							   w[(j - 2) & 3], w[(j - 1) & 3]);
+			}
+			msg = vaddq_u32(w[j & 3], vld1q_u32(&K256[4 * j]));
+			prev = abcd;
+			abcd = vsha256hq_u32(abcd, efgh, msg);
+			efgh = vsha256h2q_u32(efgh, prev, msg);
+		}
+		abcd = vaddq_u32(abcd, abcd_save);
+		efgh = vaddq_u32(efgh, efgh_save);
+		data += DTLS_SHA256_BLOCK_LENGTH;
+	}
+
+	vst1q_u32(&state[0], abcd);
+	vst1q_u32(&state[4], efgh);
+}
+#endif /* SHA2_ARMV8 */
+
+/* Runs the compression function over blocks whole blocks of data */
+static void sha256_blocks(dtls_sha256_ctx* context, const sha2_byte* data, size_t blocks) {
+	if (sha256_accel < 0)
+		sha256_accel = dtls_sha256_accel_supported();
+	switch (sha256_accel) {
+#ifdef SHA2_SHANI
+	case DTLS_SHA256_ACCEL_SHANI:
+		sha256_transform_shani(context->state, data, blocks);
+		return;
+#endif
+#ifdef SHA2_ARMV8
+	case DTLS_SHA256_ACCEL_ARMV8:
+		sha256_transform_armv8(context->state, data, blocks);
+		return;
+#endif
+	default:
+		break;
+	}
+	while (blocks--) {
+		dtls_sha256_transform(context, data);
+		data += DTLS_SHA256_BLOCK_LENGTH;
+	}
+}
+
 void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t len) {
 	unsigned int	freespace, usedspace;
 
@@ -601,7 +776,7 @@ void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t
 			context->bitcount += freespace << 3;
 			len -= freespace;
 			data += freespace;
-			dtls_sha256_transform(context, context->buffer);
+			sha256_blocks(context, context->buffer, 1);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -611,12 +786,14 @@ void dtls_sha256_update(dtls_sha256_ctx* context, const sha2_byte *data, size_t
 			return;
 		}
 	}
-	while (len >= DTLS_SHA256_BLOCK_LENGTH) {
+	if (len >= DTLS_SHA256_BLOCK_LENGTH) {
 		/* Process as many complete blocks as we can */
-		dtls_sha256_transform(context, data);
-		context->bitcount += DTLS_SHA256_BLOCK_LENGTH << 3;
-		len -= DTLS_SHA256_BLOCK_LENGTH;
-		data += DTLS_SHA256_BLOCK_LENGTH;
+		size_t	blocks = len / DTLS_SHA256_BLOCK_LENGTH;
+
+		sha256_blocks(context, data, blocks);
+		context->bitcount += (sha2_word64)blocks * DTLS_SHA256_BLOCK_LENGTH << 3;
+		len -= blocks * DTLS_SHA256_BLOCK_LENGTH;
+		data += blocks * DTLS_SHA256_BLOCK_LENGTH;
 	}
 	if (len > 0) {
 		/* There's left-overs, so save 'em */
@@ -653,7 +830,7 @@ void dtls_sha256_final(uint8_t digest[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ct
 					MEMSET_BZERO(&context->buffer[usedspace], DTLS_SHA256_BLOCK_LENGTH - usedspace);
 				}
 				/* Do second-to-last transform: */
-				dtls_sha256_transform(context, context->buffer);
+				sha256_blocks(context, context->buffer, 1);
 
 				/* And set-up for the last transform: */
 				MEMSET_BZERO(context->buffer, DTLS_SHA256_SHORT_BLOCK_LENGTH);
@@ -670,7 +847,7 @@ void dtls_sha256_final(uint8_t digest[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ct
 		MEMCPY_BCOPY(context->buffer+DTLS_SHA256_SHORT_BLOCK_LENGTH,
 					 (void *)&context->bitcount, sizeof(context->bitcount));
 		/* Final transform: */
-		dtls_sha256_transform(context, context->buffer);
+		sha256_blocks(context, context->buffer, 1);
 
 		{
 			/* Convert TO host byte order */
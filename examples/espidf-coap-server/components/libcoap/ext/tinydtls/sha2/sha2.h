@@ -66,6 +66,11 @@ extern "C" {
 #define DTLS_SHA512_DIGEST_LENGTH		64
 #define DTLS_SHA512_DIGEST_STRING_LENGTH	(DTLS_SHA512_DIGEST_LENGTH * 2 + 1)
 
+/* Implementations of the SHA-256 compression function */
+#define DTLS_SHA256_ACCEL_NONE	0	/* portable C */
+#define DTLS_SHA256_ACCEL_SHANI	1	/* x86 SHA extensions */
+#define DTLS_SHA256_ACCEL_ARMV8	2	/* ARMv8 SHA2 instructions */
+
 
 /*** SHA-256/384/512 Context Structures *******************************/
 /* NOTE: If your architecture does not define either u_intXX_t types or
@@ -134,6 +139,8 @@ void dtls_sha256_update(dtls_sha256_ctx*, const uint8_t*, size_t);
 void dtls_sha256_final(uint8_t[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ctx*);
 char* dtls_sha256_end(dtls_sha256_ctx*, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 char* dtls_sha256_data(const uint8_t*, size_t, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
+int dtls_sha256_accel_supported(void);
+int dtls_sha256_set_accel(int);
 #endif
 
 #ifdef WITH_SHA384
@@ -160,6 +167,8 @@ void dtls_sha256_update(dtls_sha256_ctx*, const u_int8_t*, size_t);
 void dtls_sha256_final(u_int8_t[DTLS_SHA256_DIGEST_LENGTH], dtls_sha256_ctx*);
 char* dtls_sha256_end(dtls_sha256_ctx*, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
 char* dtls_sha256_data(const u_int8_t*, size_t, char[DTLS_SHA256_DIGEST_STRING_LENGTH]);
+int dtls_sha256_accel_supported(void);
+int dtls_sha256_set_accel(int);
 #endif
 
 #ifdef WITH_SHA384
@@ -188,6 +197,8 @@ void dtls_sha256_update();
 void dtls_sha256_final();
 char* dtls_sha256_end();
 char* dtls_sha256_data();
+int dtls_sha256_accel_supported();
+int dtls_sha256_set_accel();
 #endif
 
 #ifdef WITH_SHA384
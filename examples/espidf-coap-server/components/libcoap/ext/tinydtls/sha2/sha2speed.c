@@ -32,45 +32,122 @@
  * $Id: sha2speed.c,v 1.1 2001/11/08 00:02:23 adg Exp adg $
  */
 
+/*
+ * Times SHA-256 over a large buffer with each implementation of the
+ * compression function that the CPU has, and HMAC-SHA256 over short
+ * messages of the size of a cookie computation, once with the key
+ * hashed for each message (dtls_hmac_init()) and once with a context
+ * keyed in advance and copied for each message (dtls_hmac_clone()).
+ * Checks that all implementations give the same digests.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
-#endif /* HAVE_SYS_TIME_H */
 
-#include "sha2.h"
+#include "tinydtls.h"
+#include "hmac.h"
 
 #define BUFSIZE	16384
+#define MSGSIZE	128	/* address and start of a ClientHello */
+
+static const char *backends[] = { "portable", "SHA-NI", "ARMv8" };
 
-void usage(char *prog) {
+static void usage(char *prog) {
 	fprintf(stderr, "Usage:\t%s [<num-of-bytes>] [<num-of-loops>] [<fill-byte>]\n", prog);
 	exit(-1);
 }
 
-void printspeed(char *caption, unsigned long bytes, double time) {
+static void printspeed(const char *caption, unsigned long bytes, double time) {
+	if (time <= 0) {
+		time = 1e-9;
+	}
 	if (bytes / 1073741824UL > 0) {
-                printf("%s %.4f sec (%.3f GBps)\n", caption, time, (double)bytes/1073741824UL/time);
-        } else if (bytes / 1048576 > 0) {
-                printf("%s %.4f (%.3f MBps)\n", caption, time, (double)bytes/1048576/time);
-        } else if (bytes / 1024 > 0) {
-                printf("%s %.4f (%.3f KBps)\n", caption, time, (double)bytes/1024/time);
-        } else {
-		printf("%s %.4f (%f Bps)\n", caption, time, (double)bytes/time);
+		printf("%s %.4f sec (%.3f GBps)\n", caption, time, (double)bytes/1073741824UL/time);
+	} else if (bytes / 1048576 > 0) {
+		printf("%s %.4f sec (%.3f MBps)\n", caption, time, (double)bytes/1048576/time);
+	} else if (bytes / 1024 > 0) {
+		printf("%s %.4f sec (%.3f KBps)\n", caption, time, (double)bytes/1024/time);
+	} else {
+		printf("%s %.4f sec (%f Bps)\n", caption, time, (double)bytes/time);
 	}
 }
 
+static double seconds(const struct timeval *start, const struct timeval *end) {
+	return ((end->tv_sec - start->tv_sec) * 1000000.0 + (end->tv_usec - start->tv_usec)) / 1000000.0;
+}
 
-int main(int argc, char **argv) {
+/* Hashes bytes bytes of buf rep times, and leaves the digest in md */
+static double sha256_speed(const unsigned char *buf, unsigned long bytes, int rep,
+			   char md[DTLS_SHA256_DIGEST_STRING_LENGTH]) {
 	dtls_sha256_ctx	c256;
-	dtls_sha384_ctx	c384;
-	dtls_sha512_ctx	c512;
-	char		buf[BUFSIZE];
-	char		md[DTLS_SHA512_DIGEST_STRING_LENGTH];
-	int		bytes, blocks, rep, i, j;
 	struct timeval	start, end;
-	double		t, ave256, ave384, ave512;
-	double		best256, best384, best512;
+	unsigned long	j;
+	double		t, ave = 0, best = 100000;
+	int		i;
+
+	for (i = 0; i < rep; i++) {
+		dtls_sha256_init(&c256);
+		gettimeofday(&start, (struct timezone*)0);
+		for (j = 0; j < bytes / BUFSIZE; j++) {
+			dtls_sha256_update(&c256, buf, BUFSIZE);
+		}
+		if (bytes % BUFSIZE) {
+			dtls_sha256_update(&c256, buf, bytes % BUFSIZE);
+		}
+		dtls_sha256_end(&c256, md);
+		gettimeofday(&end, (struct timezone*)0);
+		t = seconds(&start, &end);
+		ave += t;
+		if (t < best) {
+			best = t;
+		}
+	}
+	printspeed("SHA-256 average:", bytes, ave / rep);
+	printspeed("SHA-256 best:   ", bytes, best);
+	return best;
+}
+
+/* MACs count messages, and leaves the MAC of the last one in mac */
+static void hmac_speed(const unsigned char *key, size_t klen, const unsigned char *msg,
+		       unsigned long count, int prekeyed, unsigned char mac[DTLS_HMAC_MAX]) {
+	dtls_hmac_context_t	keyed, hmac;
+	struct timeval		start, end;
+	unsigned long		j;
+	double			t;
+
+	gettimeofday(&start, (struct timezone*)0);
+	if (prekeyed) {
+		dtls_hmac_init(&keyed, key, klen);
+	}
+	for (j = 0; j < count; j++) {
+		if (prekeyed) {
+			dtls_hmac_clone(&hmac, &keyed);
+		} else {
+			dtls_hmac_init(&hmac, key, klen);
+		}
+		dtls_hmac_update(&hmac, msg, MSGSIZE);
+		dtls_hmac_finalize(&hmac, mac);
+	}
+	gettimeofday(&end, (struct timezone*)0);
+	t = seconds(&start, &end);
+	if (t <= 0) {
+		t = 1e-9;
+	}
+	printf("HMAC-SHA256 %d bytes, %s: %.0f/s\n", MSGSIZE,
+	       prekeyed ? "key hashed once   " : "key hashed per MAC", count / t);
+}
+
+int main(int argc, char **argv) {
+	static unsigned char	buf[BUFSIZE];
+	unsigned char		key[32], msg[MSGSIZE];
+	unsigned char		mac[DTLS_HMAC_MAX], mac0[DTLS_HMAC_MAX], mac1[DTLS_HMAC_MAX];
+	char			md[DTLS_SHA256_DIGEST_STRING_LENGTH];
+	char			md0[DTLS_SHA256_DIGEST_STRING_LENGTH];
+	unsigned long		bytes, messages;
+	int			rep, accel, ok = 1;
+	size_t			i;
 
 	if (argc > 4) {
 		usage(argv[0]);
@@ -79,98 +156,59 @@ int main(int argc, char **argv) {
 	/* Default to 1024 16K blocks (16 MB) */
 	bytes = 1024 * 1024 * 16;
 	if (argc > 1) {
-		blocks = atoi(argv[1]);
+		bytes = strtoul(argv[1], NULL, 10);
 	}
-	blocks = bytes / BUFSIZE;
 
 	/* Default to 10 repetitions */
 	rep = 10;
 	if (argc > 2) {
 		rep = atoi(argv[2]);
 	}
+	if (rep < 1) {
+		rep = 1;
+	}
 
 	/* Set up the input data */
 	if (argc > 3) {
-		memset(buf, atoi(argv[2]), BUFSIZE);
+		memset(buf, atoi(argv[3]), BUFSIZE);
 	} else {
 		memset(buf, 0xb7, BUFSIZE);
 	}
-
-	ave256 = ave384 = ave512 = 0;
-	best256 = best384 = best512 = 100000;
-	for (i = 0; i < rep; i++) {
-		dtls_sha256_init(&c256);
-		dtls_sha384_init(&c384);
-		dtls_sha512_init(&c512);
-	
-		gettimeofday(&start, (struct timezone*)0);
-		for (j = 0; j < blocks; j++) {
-			dtls_sha256_update(&c256, (unsigned char*)buf, BUFSIZE);
-		}
-		if (bytes % BUFSIZE) {
-			dtls_sha256_update(&c256, (unsigned char*)buf, bytes % BUFSIZE);
-		}
-		dtls_sha256_end(&c256, md);
-		gettimeofday(&end, (struct timezone*)0);
-		t = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / 1000000.0;
-		ave256 += t;
-		if (t < best256) {
-			best256 = t;
-		}
-		printf("SHA-256[%d] (%.4f/%.4f/%.4f seconds) = 0x%s\n", i+1, t, ave256/(i+1), best256, md);
-
-		gettimeofday(&start, (struct timezone*)0);
-		for (j = 0; j < blocks; j++) {
-			dtls_sha384_update(&c384, (unsigned char*)buf, BUFSIZE);
-		}
-		if (bytes % BUFSIZE) {
-			dtls_sha384_update(&c384, (unsigned char*)buf, bytes % BUFSIZE);
-		}
-		dtls_sha384_end(&c384, md);
-		gettimeofday(&end, (struct timezone*)0);
-		t = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / 1000000.0;
-		ave384 += t;
-		if (t < best384) {
-			best384 = t;
-		}
-		printf("SHA-384[%d] (%.4f/%.4f/%.4f seconds) = 0x%s\n", i+1, t, ave384/(i+1), best384, md);
-
-		gettimeofday(&start, (struct timezone*)0);
-		for (j = 0; j < blocks; j++) {
-			dtls_sha512_update(&c512, (unsigned char*)buf, BUFSIZE);
-		}
-		if (bytes % BUFSIZE) {
-			dtls_sha512_update(&c512, (unsigned char*)buf, bytes % BUFSIZE);
+	for (i = 0; i < sizeof(key); i++) {
+		key[i] = (unsigned char)(i * 13);
+	}
+	for (i = 0; i < sizeof(msg); i++) {
+		msg[i] = (unsigned char)(i * 7);
+	}
+	/* about as long as hashing the buffer */
+	messages = bytes / (4 * DTLS_SHA256_BLOCK_LENGTH) * rep / 4 + 1;
+
+	printf("TEST REPETITIONS: %d\n", rep);
+	printf("TEST SET SIZE: %lu B, %lu HMAC messages\n", bytes, messages);
+	md0[0] = '\0';
+	for (accel = DTLS_SHA256_ACCEL_NONE; accel <= DTLS_SHA256_ACCEL_ARMV8; accel++) {
+		if (dtls_sha256_set_accel(accel) < 0) {
+			continue;
 		}
-		dtls_sha512_end(&c512, md);
-		gettimeofday(&end, (struct timezone*)0);
-		t = ((end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_usec - start.tv_usec)) / 1000000.0;
-		ave512 += t;
-		if (t < best512) {
-			best512 = t;
+		printf("\n%s:\n", backends[accel]);
+		sha256_speed(buf, bytes, rep, md);
+		printf("SHA-256 = 0x%s\n", md);
+		hmac_speed(key, sizeof(key), msg, messages, 0, mac0);
+		hmac_speed(key, sizeof(key), msg, messages, 1, mac1);
+
+		if (accel == DTLS_SHA256_ACCEL_NONE) {
+			memcpy(md0, md, sizeof(md0));
+			memcpy(mac, mac0, DTLS_HMAC_DIGEST_SIZE);
 		}
-		printf("SHA-512[%d] (%.4f/%.4f/%.4f seconds) = 0x%s\n", i+1, t, ave512/(i+1), best512, md);
+		ok = ok && strcmp(md, md0) == 0 &&
+		     memcmp(mac0, mac, DTLS_HMAC_DIGEST_SIZE) == 0 &&
+		     memcmp(mac1, mac, DTLS_HMAC_DIGEST_SIZE) == 0;
 	}
-	ave256 /= rep;
-	ave384 /= rep;
-	ave512 /= rep;
-	printf("\nTEST RESULTS SUMMARY:\nTEST REPETITIONS: %d\n", rep);
-	if (bytes / 1073741824UL > 0) {
-		printf("TEST SET SIZE: %.3f GB\n", (double)bytes/1073741824UL);
-	} else if (bytes / 1048576 > 0) {
-		printf("TEST SET SIZE: %.3f MB\n", (double)bytes/1048576);
-	} else if (bytes /1024 > 0) {
-		printf("TEST SET SIZE: %.3f KB\n", (double)bytes/1024);
-	} else {
-		printf("TEST SET SIZE: %d B\n", bytes);
+
+	if (!ok) {
+		printf("MISMATCH: digests differ\n");
+		return 1;
 	}
-	printspeed("SHA-256 average:", bytes, ave256);
-	printspeed("SHA-256 best:   ", bytes, best256);
-	printspeed("SHA-384 average:", bytes, ave384);
-	printspeed("SHA-384 best:   ", bytes, best384);
-	printspeed("SHA-512 average:", bytes, ave512);
-	printspeed("SHA-512 best:   ", bytes, best512);
-
-	return 1;
+	printf("\ndigests match\n");
+	return 0;
 }
-
@@ -0,0 +1,206 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2022 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ *******************************************************************************/
+
+/*
+ * Protects and unprotects records as TLS_PSK_WITH_AES_128_CCM_8 does
+ * (M=8, L=3, 13 bytes of additional data), with 100000 records (unless
+ * given) of 64 and of 1024 bytes in each of 1 and 4 threads (unless
+ * given), as a server does for its peers.  This is done with
+ * dtls_encrypt_params() and dtls_decrypt_params(), which set up the key
+ * for each record under a global lock, and with dtls_cipher_encrypt()
+ * and dtls_cipher_decrypt() on a cipher context that holds the key
+ * schedule of the epoch.  Both are run with the portable AES code and
+ * with the AES instructions of the CPU, if it has them.  Reports the
+ * records and MB per second over all threads, and checks that both
+ * ways give the same records.
+ *
+ * Usage: ccm-bench [records [threads]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tinydtls.h"
+#include "crypto.h"
+
+#define RECORD_MAX 1024
+#define A_DATA_LEN 13
+#define MAX_THREADS 64
+
+static const unsigned char key[DTLS_KEY_LENGTH] = {
+  0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7,
+  0xC8, 0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF
+};
+
+static unsigned char record[RECORD_MAX];
+static const char *backend;
+
+/* One peer, with its own epoch and buffers */
+typedef struct {
+  pthread_t thread;
+  int cached;                   /* use the cipher context */
+  size_t length;
+  unsigned long count;
+  int ok;
+  dtls_cipher_context_t ctx;
+  unsigned char nonce[DTLS_CCM_BLOCKSIZE];
+  unsigned char a_data[A_DATA_LEN];
+  unsigned char buf[RECORD_MAX + DTLS_CCM_MAX];
+  unsigned char sealed[RECORD_MAX + DTLS_CCM_MAX];
+} worker_t;
+
+static worker_t workers[MAX_THREADS];
+
+static double
+now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Sets the sequence number of the record into the nonce, as DTLS does */
+static void
+set_seq_num(worker_t *w, unsigned long n) {
+  dtls_int_to_uint48(w->nonce + DTLS_IV_LENGTH + 2, n);
+  memcpy(w->a_data, w->nonce + DTLS_IV_LENGTH, 8);
+}
+
+/* Protects count records, then unprotects the last one count times */
+static void *
+protect(void *arg) {
+  worker_t *w = (worker_t *)arg;
+  const dtls_ccm_params_t params = { w->nonce, 8, 3 };
+  unsigned long i;
+  int len = 0;
+  int clen = 0;
+
+  for (i = 0; i < w->count; i++) {
+    set_seq_num(w, i);
+    if (w->cached)
+      len = dtls_cipher_encrypt(&w->ctx, &params, record, w->length, w->buf,
+                                w->a_data, A_DATA_LEN);
+    else
+      len = dtls_encrypt_params(&params, record, w->length, w->buf,
+                                key, sizeof(key), w->a_data, A_DATA_LEN);
+  }
+  w->ok = len > 0 && memcmp(w->buf, w->sealed, len) == 0;
+
+  for (i = 0; i < w->count; i++) {
+    memcpy(w->buf, w->sealed, len);
+    if (w->cached)
+      clen = dtls_cipher_decrypt(&w->ctx, &params, w->buf, len, w->buf,
+                                 w->a_data, A_DATA_LEN);
+    else
+      clen = dtls_decrypt_params(&params, w->buf, len, w->buf,
+                                 key, sizeof(key), w->a_data, A_DATA_LEN);
+  }
+  w->ok = w->ok && clen == (int)w->length &&
+          memcmp(w->buf, record, w->length) == 0;
+  return NULL;
+}
+
+static int
+run(int cached, size_t length, unsigned long count, unsigned int threads) {
+  const dtls_ccm_params_t params = { NULL, 8, 3 };
+  dtls_ccm_params_t last = params;
+  unsigned int t;
+  double start, seconds;
+  int ok = 1;
+
+  for (t = 0; t < threads; t++) {
+    worker_t *w = &workers[t];
+
+    w->cached = cached;
+    w->length = length;
+    w->count = count;
+    memset(w->nonce, 0, sizeof(w->nonce));
+    memcpy(w->nonce, key, DTLS_IV_LENGTH);
+    dtls_int_to_uint16(w->a_data + 11, length);
+    /* done once for each epoch */
+    if (dtls_cipher_set_key(&w->ctx, key, sizeof(key)) < 0) {
+      printf("cannot set key\n");
+      return -1;
+    }
+    /* the last record, sealed with the key set up per record */
+    set_seq_num(w, count - 1);
+    last.nonce = w->nonce;
+    dtls_encrypt_params(&last, record, length, w->sealed,
+                        key, sizeof(key), w->a_data, A_DATA_LEN);
+  }
+
+  start = now();
+  for (t = 0; t < threads; t++)
+    pthread_create(&workers[t].thread, NULL, protect, &workers[t]);
+  for (t = 0; t < threads; t++) {
+    pthread_join(workers[t].thread, NULL);
+    ok = ok && workers[t].ok;
+  }
+  seconds = now() - start;
+
+  if (seconds <= 0)
+    seconds = 1e-9;
+  printf("%-8s %-22s %5zu bytes, %2u threads %10.0f records/s %8.1f MB/s\n",
+         backend, cached ? "cached key schedule" : "key set up per record",
+         length, threads, 2.0 * count * threads / seconds,
+         2.0 * count * threads * length / seconds / 1e6);
+  if (!ok) {
+    printf("MISMATCH: records differ\n");
+    return -1;
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long count = 100000;
+  unsigned int threads = 4;
+  int accel;
+  static const char *backends[] = { "portable", "AES-NI", "ARMv8" };
+  size_t i;
+  static const size_t lengths[] = { 64, RECORD_MAX };
+
+  if (argc > 1)
+    count = strtoul(argv[1], NULL, 10);
+  if (argc > 2)
+    threads = (unsigned int)strtoul(argv[2], NULL, 10);
+  if (count < 1)
+    count = 1;
+  if (threads < 1 || threads > MAX_THREADS)
+    threads = 4;
+
+  for (i = 0; i < sizeof(record); i++)
+    record[i] = (unsigned char)(i * 7);
+
+  printf("%lu records of each size encrypted and decrypted per thread\n",
+         count);
+  for (accel = RIJNDAEL_ACCEL_NONE; accel <= RIJNDAEL_ACCEL_ARMV8; accel++) {
+    if (rijndael_set_accel(accel) < 0)
+      continue;
+    backend = backends[accel];
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+      /* with one thread, the lock is never contended */
+      if (run(0, lengths[i], count, 1) < 0 || run(1, lengths[i], count, 1) < 0)
+        return 1;
+      if (threads > 1 &&
+          (run(0, lengths[i], count, threads) < 0 ||
+           run(1, lengths[i], count, threads) < 0))
+        return 1;
+    }
+  }
+  printf("records match\n");
+  return 0;
+}
@@ -43,6 +43,7 @@ int main(int argc, char **argv) {
 #endif /* WITH_CONTIKI */
   long int len;
   size_t n;
+  int accel;
 
   rijndael_ctx ctx;
 
@@ -50,36 +51,43 @@ int main(int argc, char **argv) {
   PROCESS_BEGIN();
 #endif /* WITH_CONTIKI */
 
-  for (n = 0; n < sizeof(data)/sizeof(struct test_vector); ++n) {
+  /* check the vectors with each AES implementation that can be used here */
+  for (accel = RIJNDAEL_ACCEL_NONE; accel <= RIJNDAEL_ACCEL_ARMV8; accel++) {
+    if (rijndael_set_accel(accel) < 0)
+      continue;
+    printf("AES implementation %d:\n", accel);
 
-    if (rijndael_set_key_enc_only(&ctx, data[n].key, 8*sizeof(data[n].key)) < 0) {
-      fprintf(stderr, "cannot set key\n");
-      return -1;
-    }
+    for (n = 0; n < sizeof(data)/sizeof(struct test_vector); ++n) {
+
+      if (rijndael_set_key_enc_only(&ctx, data[n].key, 8*sizeof(data[n].key)) < 0) {
+        fprintf(stderr, "cannot set key\n");
+        return -1;
+      }
 
-    len = dtls_ccm_encrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
-				   data[n].msg + data[n].la, 
-				   data[n].lm - data[n].la, 
-				   data[n].msg, data[n].la);
-    
-    len +=  + data[n].la;
-    printf("Packet Vector #%lu ", n+1);
-    if ((size_t)len != data[n].r_lm || memcmp(data[n].msg, data[n].result, len))
-      printf("FAILED, ");
-    else 
-      printf("OK, ");
-    
-    printf("result is (total length = %lu):\n\t", len);
-    dump(data[n].msg, len);
+      len = dtls_ccm_encrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
+				     data[n].msg + data[n].la, 
+				     data[n].lm - data[n].la, 
+				     data[n].msg, data[n].la);
+      
+      len +=  + data[n].la;
+      printf("Packet Vector #%lu ", n+1);
+      if ((size_t)len != data[n].r_lm || memcmp(data[n].msg, data[n].result, len))
+        printf("FAILED, ");
+      else 
+        printf("OK, ");
+      
+      printf("result is (total length = %lu):\n\t", len);
+      dump(data[n].msg, len);
 
-    len = dtls_ccm_decrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
-				   data[n].msg + data[n].la, len - data[n].la, 
-				   data[n].msg, data[n].la);
-    
-    if (len < 0)
-      printf("Packet Vector #%lu: cannot decrypt message\n", n+1);
-    else 
-      printf("\t*** MAC verified (total length = %lu) ***\n", len + data[n].la);
+      len = dtls_ccm_decrypt_message(&ctx, data[n].M, data[n].L, data[n].nonce, 
+				     data[n].msg + data[n].la, len - data[n].la, 
+				     data[n].msg, data[n].la);
+      
+      if (len < 0)
+        printf("Packet Vector #%lu: cannot decrypt message\n", n+1);
+      else 
+        printf("\t*** MAC verified (total length = %lu) ***\n", len + data[n].la);
+    }
   }
 
 #ifdef WITH_CONTIKI
@@ -0,0 +1,299 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2022 Olaf Bergmann (TZI) and others.
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v. 1.0 which accompanies this distribution.
+ *
+ * The Eclipse Public License is available at http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ * http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ *******************************************************************************/
+
+/*
+ * Times the secp256r1 operations that a TLS_ECDHE_ECDSA_WITH_AES_128_CCM_8
+ * handshake needs, 200 of each (unless given): making an ephemeral key,
+ * ECDH with the peer's key, and signing and verifying a hash.  Then has a
+ * client and a server context do 50 handshakes (unless given) with each
+ * other, with client authentication, passing the records in memory, and
+ * reports the handshakes per second.  Each side makes a key, does ECDH,
+ * signs once and verifies once per handshake.  Checks that all
+ * signatures verify, and that both sides agree on the premaster secret.
+ *
+ * Usage: ecc-bench [handshakes [operations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tinydtls.h"
+#include "dtls.h"
+#include "dtls_debug.h"
+#include "crypto.h"
+
+#define MAX_QUEUED 32
+
+static const unsigned char ecdsa_priv_key[] = {
+  0xD9, 0xE2, 0x70, 0x7A, 0x72, 0xDA, 0x6A, 0x05,
+  0x04, 0x99, 0x5C, 0x86, 0xED, 0xDB, 0xE3, 0xEF,
+  0xC7, 0xF1, 0xCD, 0x74, 0x83, 0x8F, 0x75, 0x70,
+  0xC8, 0x07, 0x2D, 0x0A, 0x76, 0x26, 0x1B, 0xD4
+};
+
+static const unsigned char ecdsa_pub_key_x[] = {
+  0xD0, 0x55, 0xEE, 0x14, 0x08, 0x4D, 0x6E, 0x06,
+  0x15, 0x59, 0x9D, 0xB5, 0x83, 0x91, 0x3E, 0x4A,
+  0x3E, 0x45, 0x26, 0xA2, 0x70, 0x4D, 0x61, 0xF2,
+  0x7A, 0x4C, 0xCF, 0xBA, 0x97, 0x58, 0xEF, 0x9A
+};
+
+static const unsigned char ecdsa_pub_key_y[] = {
+  0xB4, 0x18, 0xB6, 0x4A, 0xFE, 0x80, 0x30, 0xDA,
+  0x1D, 0xDC, 0xF4, 0xF4, 0x2E, 0x2F, 0x26, 0x31,
+  0xD0, 0x43, 0xB1, 0xFB, 0x03, 0xE2, 0x2F, 0x4D,
+  0x17, 0xDE, 0x43, 0xF9, 0xF9, 0xAD, 0xEE, 0x70
+};
+
+/* One side of the handshake, and where the other one sees it */
+typedef struct {
+  dtls_context_t *ctx;
+  session_t addr;
+} endpoint_t;
+
+typedef struct {
+  endpoint_t *to;
+  size_t length;
+  uint8 data[DTLS_MAX_BUF];
+} datagram_t;
+
+static endpoint_t client, server;
+static datagram_t queue[MAX_QUEUED];
+static unsigned int queued;
+static int connected;
+static int failed;
+
+static double
+now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *what, unsigned long count, double seconds) {
+  if (seconds <= 0)
+    seconds = 1e-9;
+  printf("%-30s %8.1f/s %10.3f ms each\n", what, count / seconds,
+         seconds * 1000 / count);
+}
+
+static int
+send_to_peer(struct dtls_context_t *ctx, session_t *session,
+             uint8 *data, size_t len) {
+  endpoint_t *self = (endpoint_t *)dtls_get_app_data(ctx);
+  datagram_t *d;
+
+  (void)session;
+  if (queued == MAX_QUEUED || len > sizeof(d->data))
+    return -1;
+  d = &queue[queued++];
+  d->to = self == &client ? &server : &client;
+  d->length = len;
+  memcpy(d->data, data, len);
+  return (int)len;
+}
+
+static int
+read_from_peer(struct dtls_context_t *ctx, session_t *session,
+               uint8 *data, size_t len) {
+  (void)ctx;
+  (void)session;
+  (void)data;
+  return (int)len;
+}
+
+static int
+handle_event(struct dtls_context_t *ctx, session_t *session,
+             dtls_alert_level_t level, unsigned short code) {
+  (void)session;
+  if (level == DTLS_ALERT_LEVEL_FATAL)
+    failed = 1;
+  else if (code == DTLS_EVENT_CONNECTED &&
+           dtls_get_app_data(ctx) == &client)
+    connected = 1;
+  return 0;
+}
+
+static int
+get_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+              const dtls_ecdsa_key_t **result) {
+  static const dtls_ecdsa_key_t ecdsa_key = {
+    .curve = DTLS_ECDH_CURVE_SECP256R1,
+    .priv_key = ecdsa_priv_key,
+    .pub_key_x = ecdsa_pub_key_x,
+    .pub_key_y = ecdsa_pub_key_y
+  };
+
+  (void)ctx;
+  (void)session;
+  *result = &ecdsa_key;
+  return 0;
+}
+
+static int
+verify_ecdsa_key(struct dtls_context_t *ctx, const session_t *session,
+                 const unsigned char *other_pub_x,
+                 const unsigned char *other_pub_y, size_t key_size) {
+  (void)ctx;
+  (void)session;
+  return key_size == sizeof(ecdsa_pub_key_x) &&
+         memcmp(other_pub_x, ecdsa_pub_key_x, key_size) == 0 &&
+         memcmp(other_pub_y, ecdsa_pub_key_y, key_size) == 0 ? 0 : -1;
+}
+
+static dtls_handler_t cb = {
+  .write = send_to_peer,
+  .read = read_from_peer,
+  .event = handle_event,
+  .get_ecdsa_key = get_ecdsa_key,
+  .verify_ecdsa_key = verify_ecdsa_key
+};
+
+static void
+init_endpoint(endpoint_t *ep, unsigned short port) {
+  dtls_session_init(&ep->addr);
+  ep->addr.size = sizeof(ep->addr.addr.sin6);
+  ep->addr.addr.sin6.sin6_family = AF_INET6;
+  ep->addr.addr.sin6.sin6_addr = in6addr_loopback;
+  ep->addr.addr.sin6.sin6_port = htons(port);
+  ep->ctx = dtls_new_context(ep);
+  if (!ep->ctx) {
+    printf("cannot create context\n");
+    exit(1);
+  }
+  dtls_set_handler(ep->ctx, &cb);
+}
+
+/* Runs a full handshake, then forgets the peers on both sides */
+static int
+handshake(void) {
+  unsigned int steps = 0;
+  datagram_t d;
+  endpoint_t *from;
+
+  connected = 0;
+  failed = 0;
+  queued = 0;
+  if (dtls_connect(client.ctx, &server.addr) < 0)
+    return -1;
+  while (!connected && !failed && queued && steps++ < 100) {
+    d = queue[0];
+    queued--;
+    memmove(queue, queue + 1, queued * sizeof(queue[0]));
+    from = d.to == &client ? &server : &client;
+    dtls_handle_message(d.to->ctx, &from->addr, d.data, (int)d.length);
+  }
+  dtls_reset_peer(client.ctx, dtls_get_peer(client.ctx, &server.addr));
+  dtls_reset_peer(server.ctx, dtls_get_peer(server.ctx, &client.addr));
+  queued = 0;
+  return connected ? 0 : -1;
+}
+
+/* r and s as they are in the handshake, 32 bytes in network byte order */
+static void
+to_bytes(const uint32_t *point, unsigned char *buf) {
+  int i;
+
+  for (i = 0; i < DTLS_EC_KEY_SIZE; i++)
+    buf[i] = (unsigned char)(point[7 - i / 4] >> (24 - 8 * (i % 4)));
+}
+
+static int
+operations(unsigned long count) {
+  unsigned char priv[2][DTLS_EC_KEY_SIZE];
+  unsigned char pub_x[2][DTLS_EC_KEY_SIZE];
+  unsigned char pub_y[2][DTLS_EC_KEY_SIZE];
+  unsigned char secret[2][DTLS_EC_KEY_SIZE];
+  unsigned char hash[DTLS_HMAC_DIGEST_SIZE];
+  unsigned char r[DTLS_EC_KEY_SIZE], s[DTLS_EC_KEY_SIZE];
+  uint32_t point_r[9], point_s[9];
+  unsigned long i;
+  double start;
+  int ok = 1;
+
+  start = now();
+  for (i = 0; i < count; i++)
+    dtls_ecdsa_generate_key(priv[i & 1], pub_x[i & 1], pub_y[i & 1],
+                            DTLS_EC_KEY_SIZE);
+  report("ephemeral key (k * G)", count, now() - start);
+
+  start = now();
+  for (i = 0; i < count; i++)
+    dtls_ecdh_pre_master_secret(priv[i & 1], pub_x[!(i & 1)],
+                                pub_y[!(i & 1)], DTLS_EC_KEY_SIZE,
+                                secret[i & 1], DTLS_EC_KEY_SIZE);
+  report("ECDH (k * Q)", count, now() - start);
+  ok = memcmp(secret[0], secret[1], DTLS_EC_KEY_SIZE) == 0;
+
+  memset(hash, 0x5a, sizeof(hash));
+  start = now();
+  for (i = 0; i < count; i++)
+    dtls_ecdsa_create_sig_hash(ecdsa_priv_key, DTLS_EC_KEY_SIZE,
+                               hash, sizeof(hash), point_r, point_s);
+  report("ECDSA sign", count, now() - start);
+
+  to_bytes(point_r, r);
+  to_bytes(point_s, s);
+  start = now();
+  for (i = 0; i < count; i++)
+    ok = ok && dtls_ecdsa_verify_sig_hash(ecdsa_pub_key_x, ecdsa_pub_key_y,
+                                          DTLS_EC_KEY_SIZE, hash,
+                                          sizeof(hash), r, s) == 0;
+  report("ECDSA verify", count, now() - start);
+  return ok ? 0 : -1;
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long handshakes = 50;
+  unsigned long count = 200;
+  unsigned long i, done = 0;
+  double start;
+
+  if (argc > 1)
+    handshakes = strtoul(argv[1], NULL, 10);
+  if (argc > 2)
+    count = strtoul(argv[2], NULL, 10);
+  if (count < 2)
+    count = 2;
+
+  dtls_init();
+  dtls_set_log_level(DTLS_LOG_EMERG);
+
+  printf("%lu of each operation, %lu handshakes\n", count, handshakes);
+  if (operations(count) < 0) {
+    printf("MISMATCH: secrets differ or a signature did not verify\n");
+    return 1;
+  }
+
+  init_endpoint(&client, 20221);
+  init_endpoint(&server, 20220);
+  start = now();
+  for (i = 0; i < handshakes; i++)
+    done += handshake() == 0;
+  if (handshakes)
+    report("handshakes, client auth", handshakes, now() - start);
+  dtls_free_context(client.ctx);
+  dtls_free_context(server.ctx);
+
+  if (done != handshakes) {
+    printf("FAILED: %lu of %lu handshakes\n", handshakes - done, handshakes);
+    return 1;
+  }
+  printf("all handshakes done\n");
+  return 0;
+}
@@ -68,6 +68,61 @@ t_test_decrypt_message(void) {
   }
 }
 
+static void
+t_test_message_accel(void) {
+  int accel;
+
+  /* the vectors must give the same with each AES implementation */
+  for (accel = RIJNDAEL_ACCEL_NONE; accel <= RIJNDAEL_ACCEL_ARMV8; accel++) {
+    if (rijndael_set_accel(accel) < 0)
+      continue;
+    t_test_encrypt_message();
+    t_test_decrypt_message();
+  }
+  CU_ASSERT(rijndael_set_accel(rijndael_accel_supported()) == 0);
+}
+
+static void
+t_test_message_lengths(void) {
+  static uint8_t msg[80];
+  static uint8_t soft[sizeof(msg) + DTLS_CCM_MAX];
+  size_t lm;
+  long int len;
+  rijndael_ctx ctx;
+
+  for (lm = 0; lm < sizeof(msg); lm++)
+    msg[lm] = (uint8_t)(lm * 13);
+
+  /* messages of all lengths, with partial last blocks and none */
+  for (lm = 0; lm <= sizeof(msg); lm++) {
+    CU_ASSERT(rijndael_set_accel(RIJNDAEL_ACCEL_NONE) == 0);
+    CU_ASSERT(rijndael_set_key_enc_only(&ctx, data[0].key, 8*sizeof(data[0].key)) == 0);
+    memcpy(soft, msg, lm);
+    len = dtls_ccm_encrypt_message(&ctx, 8, 3, data[0].nonce,
+				   soft, lm, data[0].msg, data[0].la);
+    CU_ASSERT((size_t)len == lm + 8);
+
+    CU_ASSERT(rijndael_set_accel(rijndael_accel_supported()) == 0);
+    CU_ASSERT(rijndael_set_key_enc_only(&ctx, data[0].key, 8*sizeof(data[0].key)) == 0);
+    memcpy(buf, msg, lm);
+    len = dtls_ccm_encrypt_message(&ctx, 8, 3, data[0].nonce,
+				   buf, lm, data[0].msg, data[0].la);
+    CU_ASSERT((size_t)len == lm + 8);
+    CU_ASSERT(memcmp(buf, soft, lm + 8) == 0);
+
+    len = dtls_ccm_decrypt_message(&ctx, 8, 3, data[0].nonce,
+				   buf, lm + 8, data[0].msg, data[0].la);
+    CU_ASSERT((size_t)len == lm);
+    CU_ASSERT(memcmp(buf, msg, lm) == 0);
+
+    /* a changed tag must not verify */
+    soft[lm] ^= 1;
+    len = dtls_ccm_decrypt_message(&ctx, 8, 3, data[0].nonce,
+				   soft, lm + 8, data[0].msg, data[0].la);
+    CU_ASSERT(len < 0);
+  }
+}
+
 static void
 t_test_dtls_encrypt_params(void) {
   size_t n;
@@ -122,6 +177,43 @@ t_test_dtls_decrypt_params(void) {
   }
 }
 
+static void
+t_test_dtls_cipher_context(void) {
+  size_t n;
+  int len;
+  int i;
+  dtls_cipher_context_t ctx;
+
+  for (n = 0; n < sizeof(data)/sizeof(struct test_vector); ++n) {
+    dtls_ccm_params_t params =
+      { .nonce = data[n].nonce,
+        .tag_length = data[n].M,
+        .l = data[n].L
+      };
+
+    CU_ASSERT(dtls_cipher_set_key(&ctx, data[n].key, sizeof(data[n].key)) == 0);
+
+    /* The key schedule must be usable for more than one record. */
+    for (i = 0; i < 2; i++) {
+      len = dtls_cipher_encrypt(&ctx, &params,
+                                data[n].msg + data[n].la,
+                                data[n].lm - data[n].la,
+                                buf,
+                                data[n].msg,
+                                data[n].la);
+
+      CU_ASSERT((size_t)len == data[n].r_lm - data[n].la);
+      CU_ASSERT(memcmp(data[n].result + data[n].la, buf, len) == 0);
+
+      len = dtls_cipher_decrypt(&ctx, &params, buf, len, buf,
+                                data[n].msg, data[n].la);
+
+      CU_ASSERT((size_t)len == data[n].lm - data[n].la);
+      CU_ASSERT(memcmp(data[n].msg + data[n].la, buf, len) == 0);
+    }
+  }
+}
+
 static void
 t_test_dtls_encrypt(void) {
   size_t n;
@@ -190,6 +282,16 @@ t_init_ccm_tests(void) {
             CU_get_error_msg());
   }
 
+  if (!CU_ADD_TEST(suite,t_test_message_accel)) {
+    fprintf(stderr, "W: cannot add t_test_message_accel (%s)\n",
+            CU_get_error_msg());
+  }
+
+  if (!CU_ADD_TEST(suite,t_test_message_lengths)) {
+    fprintf(stderr, "W: cannot add t_test_message_lengths (%s)\n",
+            CU_get_error_msg());
+  }
+
   if (!CU_ADD_TEST(suite,t_test_dtls_encrypt_params)) {
     fprintf(stderr, "W: cannot add t_dtls_encrypt_params (%s)\n",
             CU_get_error_msg());
@@ -200,6 +302,11 @@ t_init_ccm_tests(void) {
             CU_get_error_msg());
   }
 
+  if (!CU_ADD_TEST(suite,t_test_dtls_cipher_context)) {
+    fprintf(stderr, "W: cannot add t_dtls_cipher_context (%s)\n",
+            CU_get_error_msg());
+  }
+
   if (!CU_ADD_TEST(suite,t_test_dtls_encrypt)) {
     fprintf(stderr, "W: cannot add t_dtls_encrypt (%s)\n",
             CU_get_error_msg());
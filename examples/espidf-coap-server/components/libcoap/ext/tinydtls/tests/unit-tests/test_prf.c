@@ -252,6 +252,108 @@ t_test_prf5(void) {
   CU_ASSERT(memcmp(outbuf, result, bytes_written) == 0);
 }
 
+static void
+t_test_prf_accel(void) {
+  int accel;
+
+  /* the vectors must give the same with each SHA-256 implementation */
+  for (accel = DTLS_SHA256_ACCEL_NONE; accel <= DTLS_SHA256_ACCEL_ARMV8; accel++) {
+    if (dtls_sha256_set_accel(accel) < 0)
+      continue;
+    t_test_prf0();
+    t_test_prf1();
+    t_test_prf2();
+    t_test_prf3();
+    t_test_prf4();
+    t_test_prf5();
+  }
+  CU_ASSERT(dtls_sha256_set_accel(dtls_sha256_accel_supported()) == 0);
+}
+
+/* Check against HMAC-SHA256 test cases 2 and 6 from RFC 4231, with a
+ * context that is keyed once and cloned for each MAC.
+ */
+static void
+t_test_hmac_clone(void) {
+  static const char data2[] = "what do ya want for nothing?";
+  static const char data6[] =
+    "Test Using Larger Than Block-Size Key - Hash Key First";
+  const uint8_t result2[] = {
+    0x5b, 0xdc, 0xc1, 0x46, 0xbf, 0x60, 0x75, 0x4e,
+    0x6a, 0x04, 0x24, 0x26, 0x08, 0x95, 0x75, 0xc7,
+    0x5a, 0x00, 0x3f, 0x08, 0x9d, 0x27, 0x39, 0x83,
+    0x9d, 0xec, 0x58, 0xb9, 0x64, 0xec, 0x38, 0x43
+  };
+  const uint8_t result6[] = {
+    0x60, 0xe4, 0x31, 0x59, 0x1e, 0xe0, 0xb6, 0x7f,
+    0x0d, 0x8a, 0x26, 0xaa, 0xcb, 0xf5, 0xb7, 0x7f,
+    0x8e, 0x0b, 0xc6, 0x21, 0x37, 0x28, 0xc5, 0x14,
+    0x05, 0x46, 0x04, 0x0f, 0x0e, 0xe3, 0x7f, 0x54
+  };
+  uint8_t key6[131];
+  uint8_t outbuf[DTLS_HMAC_MAX];
+  dtls_hmac_context_t keyed, hmac;
+  int i;
+
+  dtls_hmac_init(&keyed, (const unsigned char *)"Jefe", 4);
+  for (i = 0; i < 2; i++) {
+    dtls_hmac_clone(&hmac, &keyed);
+    dtls_hmac_update(&hmac, (const unsigned char *)data2, sizeof(data2) - 1);
+    CU_ASSERT_EQUAL(dtls_hmac_finalize(&hmac, outbuf), sizeof(result2));
+    CU_ASSERT(memcmp(outbuf, result2, sizeof(result2)) == 0);
+  }
+
+  memset(key6, 0xaa, sizeof(key6));
+  dtls_hmac_init(&keyed, key6, sizeof(key6));
+  for (i = 0; i < 2; i++) {
+    dtls_hmac_clone(&hmac, &keyed);
+    dtls_hmac_update(&hmac, (const unsigned char *)data6, sizeof(data6) - 1);
+    CU_ASSERT_EQUAL(dtls_hmac_finalize(&hmac, outbuf), sizeof(result6));
+    CU_ASSERT(memcmp(outbuf, result6, sizeof(result6)) == 0);
+  }
+}
+
+/* Each SHA-256 implementation must give the same digests as the
+ * portable one, for messages of all lengths around the block size,
+ * given in one piece and in pieces of varying length.
+ */
+static void
+t_test_sha256_lengths(void) {
+  static uint8_t msg[3 * DTLS_SHA256_BLOCK_LENGTH + 1];
+  uint8_t soft[DTLS_SHA256_DIGEST_LENGTH];
+  uint8_t digest[DTLS_SHA256_DIGEST_LENGTH];
+  dtls_sha256_ctx ctx;
+  size_t lm, n, step;
+  int accel;
+
+  for (lm = 0; lm < sizeof(msg); lm++)
+    msg[lm] = (uint8_t)(lm * 31 + 7);
+
+  for (lm = 0; lm <= sizeof(msg); lm++) {
+    CU_ASSERT(dtls_sha256_set_accel(DTLS_SHA256_ACCEL_NONE) == 0);
+    dtls_sha256_init(&ctx);
+    dtls_sha256_update(&ctx, msg, lm);
+    dtls_sha256_final(soft, &ctx);
+
+    for (accel = DTLS_SHA256_ACCEL_NONE; accel <= DTLS_SHA256_ACCEL_ARMV8; accel++) {
+      if (dtls_sha256_set_accel(accel) < 0)
+        continue;
+      for (step = 1; step <= lm; step += 23) {
+        dtls_sha256_init(&ctx);
+        for (n = 0; n < lm; n += step)
+          dtls_sha256_update(&ctx, msg + n, lm - n < step ? lm - n : step);
+        dtls_sha256_final(digest, &ctx);
+        CU_ASSERT(memcmp(digest, soft, sizeof(soft)) == 0);
+      }
+      dtls_sha256_init(&ctx);
+      dtls_sha256_update(&ctx, msg, lm);
+      dtls_sha256_final(digest, &ctx);
+      CU_ASSERT(memcmp(digest, soft, sizeof(soft)) == 0);
+    }
+  }
+  CU_ASSERT(dtls_sha256_set_accel(dtls_sha256_accel_supported()) == 0);
+}
+
 CU_pSuite
 t_init_prf_tests(void) {
   CU_pSuite suite;
@@ -281,6 +383,9 @@ t_init_prf_tests(void) {
   PRF_TEST(suite, t_test_prf3);
   PRF_TEST(suite, t_test_prf4);
   PRF_TEST(suite, t_test_prf5);
+  PRF_TEST(suite, t_test_prf_accel);
+  PRF_TEST(suite, t_test_hmac_clone);
+  PRF_TEST(suite, t_test_sha256_lengths);
 
   return suite;
 }
@@ -60,6 +60,8 @@ typedef struct {
 
 #define COAP_BLOCK_USE_LIBCOAP  0x01 /* Use libcoap to do block requests */
 #define COAP_BLOCK_SINGLE_BODY  0x02 /* Deliver the data as a single body */
+#define COAP_BLOCK_TRY_Q_BLOCK  0x04 /* Probe for and, if supported, use
+                                        Q-Block1/Q-Block2 for NON bodies */
 
 /**
  * Returns the value of the least significant byte of a Block option @p opt.
@@ -276,6 +278,33 @@ coap_add_data_blocked_response(const coap_pdu_t *request,
 typedef void (*coap_release_large_data_t)(coap_session_t *session,
                                           void *app_ptr);
 
+/**
+ * Callback handler for getting a part of the data provided by the
+ * coap_add_data_large_*_cb() functions, as and when the block(s) holding it
+ * are transmitted.  This allows the data to be read from a file or
+ * scatter-gather list rather than having to be held in memory for the
+ * duration of the transfer.
+ *
+ * The same part of the data may be asked for more than once, for example if
+ * the peer asks for a block again, so it must not change until the data
+ * transfer has completed.
+ *
+ * @param session The session that this data is associated with.
+ * @param offset  The offset into the data of the part to get.
+ * @param length  The number of bytes to get.
+ * @param data    Where to copy the @p length bytes to.  This is the payload
+ *                of the PDU to be transmitted.
+ * @param app_ptr The application provided pointer provided to the
+ *                coap_add_data_large_*_cb() functions.
+ *
+ * @return @c 1 if the @p length bytes have been copied to @p data, else @c 0.
+ */
+typedef int (*coap_get_large_data_t)(coap_session_t *session,
+                                     size_t offset,
+                                     size_t length,
+                                     uint8_t *data,
+                                     void *app_ptr);
+
 /**
  * Associates given data with the @p pdu that is passed as second parameter.
  *
@@ -325,6 +354,33 @@ int coap_add_data_large_request(coap_session_t *session,
                                 coap_release_large_data_t release_func,
                                 void *app_ptr);
 
+/**
+ * Associates the data that is got a part at a time by @p get_func with the
+ * @p pdu that is passed as second parameter.
+ *
+ * This is the same as coap_add_data_large_request(), except that the data
+ * is not held in memory, but @p get_func is called for each block of the data
+ * as it is to be transmitted.  @p get_func copies the part of the data asked
+ * for directly into the PDU.
+ *
+ * @param session  The session to associate the data with.
+ * @param pdu      The PDU to associate the data with.
+ * @param length   The length of data to transmit.
+ * @param get_func The function to call to get each part of the data.
+ * @param release_func The function to call once the data is no longer needed
+ *                 or @c NULL if the function is not required.
+ * @param app_ptr  A Pointer that the application can provide for when
+ *                 get_func() and release_func() are called.
+ *
+ * @return @c 1 if addition is successful, else @c 0.
+ */
+int coap_add_data_large_request_cb(coap_session_t *session,
+                                   coap_pdu_t *pdu,
+                                   size_t length,
+                                   coap_get_large_data_t get_func,
+                                   coap_release_large_data_t release_func,
+                                   void *app_ptr);
+
 /**
  * Associates given data with the @p response pdu that is passed as fourth
  * parameter.
@@ -389,6 +445,49 @@ coap_add_data_large_response(coap_resource_t *resource,
                              coap_release_large_data_t release_func,
                              void *app_ptr);
 
+/**
+ * Associates the data that is got a part at a time by @p get_func with the
+ * @p response pdu that is passed as fourth parameter.
+ *
+ * This is the same as coap_add_data_large_response(), except that the data
+ * is not held in memory, but @p get_func is called for each block of the data
+ * as it is to be transmitted.  @p get_func copies the part of the data asked
+ * for directly into the PDU.  This allows, for example, a large firmware
+ * image to be served from a file to many peers at the same time, with only
+ * the block being transmitted held in memory for each.
+ *
+ * @param resource   The resource the data is associated with.
+ * @param session    The coap session.
+ * @param request    The requesting pdu.
+ * @param response   The response pdu.
+ * @param query      The query taken from the (original) requesting pdu.
+ * @param media_type The content format of the data.
+ * @param maxage     The maxmimum life of the data. If @c -1, then there
+ *                   is no maxage.
+ * @param etag       ETag to use if not 0.
+ * @param length     The total length of the data.
+ * @param get_func   The function to call to get each part of the data.
+ * @param release_func The function to call once the data is no longer needed
+ *                   or NULL if the function is not required.
+ * @param app_ptr    A Pointer that the application can provide for when
+ *                   get_func() and release_func() are called.
+ *
+ * @return @c 1 if addition is successful, else @c 0.
+ */
+int
+coap_add_data_large_response_cb(coap_resource_t *resource,
+                                coap_session_t *session,
+                                const coap_pdu_t *request,
+                                coap_pdu_t *response,
+                                const coap_string_t *query,
+                                uint16_t media_type,
+                                int maxage,
+                                uint64_t etag,
+                                size_t length,
+                                coap_get_large_data_t get_func,
+                                coap_release_large_data_t release_func,
+                                void *app_ptr);
+
 /**
  * Set the context level CoAP block handling bits for handling RFC7959.
  * These bits flow down to a session when a session is created and if the peer
@@ -410,6 +509,57 @@ coap_add_data_large_response(coap_resource_t *resource,
 void coap_context_set_block_mode(coap_context_t *context,
                                   uint8_t block_mode);
 
+/**
+ * Block data handler that is used as callback in coap_context_t to stream
+ * the body of a large transfer to the application.
+ *
+ * The data is passed in order and only once.  Blocks that arrive ahead of
+ * the data passed so far are held back until the gap has been filled, up to
+ * COAP_BLOCK_STREAM_WINDOW of them.
+ *
+ * @param session The session that the data was received on.
+ * @param pdu     The received PDU that allowed the data to be passed on,
+ *                which need not be the one that carried it.  For a server,
+ *                this is the Block1 request.  For a client, this is the
+ *                Block2 response with the token of the original request.
+ * @param offset  The offset of @p data into the body.
+ * @param data    The data.
+ * @param length  The length of @p data.
+ * @param total   The total size of the body as currently indicated by the
+ *                Size1 or Size2 option, or @c 0 if not known.
+ *
+ * @return @c 1 if the data has been consumed, or @c 0 to abandon the
+ *         transfer.
+ */
+typedef int (*coap_block_data_handler_t)(coap_session_t *session,
+                                         const coap_pdu_t *pdu,
+                                         size_t offset,
+                                         const uint8_t *data,
+                                         size_t length,
+                                         size_t total);
+
+/**
+ * Registers a handler that the body of every large transfer tracked by
+ * libcoap (COAP_BLOCK_USE_LIBCOAP) is streamed to as its blocks arrive, in
+ * place of re-assembling it in memory.  This is used instead of
+ * COAP_BLOCK_SINGLE_BODY, so only a few blocks are held for each transfer
+ * however large the body is.
+ *
+ * Once all of the body has been passed to @p handler, the request handler
+ * (server) or response handler (client) is called once with the final PDU
+ * of the transfer, but with no Block option and no data.
+ *
+ * If @p handler returns @c 0, the transfer is abandoned.  A server responds
+ * with 5.00 (Internal Server Error).
+ *
+ * @param context The context to register the handler for.
+ * @param handler The block data handler to register, or @c NULL to go back
+ *                to handling each block (or the single body) in the request
+ *                or response handler.
+ */
+void coap_register_block_data_handler(coap_context_t *context,
+                                      coap_block_data_handler_t handler);
+
 /**
  * Cancel an observe that is being tracked by the client large receive logic.
  * (coap_context_set_block_mode() has to be called)
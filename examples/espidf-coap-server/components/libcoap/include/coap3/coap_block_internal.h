@@ -30,27 +30,77 @@
  * @{
  */
 
+/*
+ * Session only block_mode bits, which coap_context_set_block_mode() does not
+ * allow to be set.  A client that is set up with COAP_BLOCK_TRY_Q_BLOCK sends
+ * a probe before its first request, and only uses Q-Block1 and Q-Block2 once
+ * the server has answered the probe without a 4.02 (Bad Option).
+ */
+#define COAP_BLOCK_PROBE_Q_BLOCK 0x40 /* Q-Block probe sent, no answer yet */
+#define COAP_BLOCK_HAS_Q_BLOCK   0x80 /* Server understands Q-Block options */
+
 typedef enum {
   COAP_RECURSE_OK,
   COAP_RECURSE_NO
 } coap_recurse_t;
 
-struct coap_lg_range {
-  uint32_t begin;
-  uint32_t end;
-};
+/**
+ * The furthest ahead of the first missing block that a block can be and
+ * still be tracked.  This bounds the bitmap to COAP_RBLOCK_MAX_SPAN / 8 bytes
+ * for each transfer.
+ */
+#ifndef COAP_RBLOCK_MAX_SPAN
+#define COAP_RBLOCK_MAX_SPAN 8192
+#endif /* COAP_RBLOCK_MAX_SPAN */
 
-#define COAP_RBLOCK_CNT 4
 /**
  * Structure to keep track of received blocks
+ *
+ * All the blocks before @p base have been received.  The blocks received
+ * from @p base onwards, if any, are held in a bitmap whose first bit is for
+ * block @p origin.  The bitmap is only allocated once a block arrives ahead
+ * of a missing one, and words of it are dropped as @p base moves past them,
+ * so a transfer that arrives in order needs no memory.
  */
 typedef struct coap_rblock_t {
-  uint32_t used;
+  uint32_t base;         /**< first missing block */
+  uint32_t highest;      /**< one more than the highest block received */
+  uint32_t origin;       /**< block of the first bit of the bitmap */
+  uint32_t first;        /**< index of the first word of the bitmap in use */
+  uint32_t used;         /**< number of words of the bitmap in use */
+  uint32_t size;         /**< number of words allocated for the bitmap */
+  uint32_t *bits;        /**< bitmap of received blocks from origin */
   uint32_t retry;
-  struct coap_lg_range range[COAP_RBLOCK_CNT];
   coap_tick_t last_seen;
 } coap_rblock_t;
 
+/**
+ * The most blocks that are held back for each large receive when they arrive
+ * ahead of the data streamed to the block data handler so far.
+ */
+#ifndef COAP_BLOCK_STREAM_WINDOW
+#define COAP_BLOCK_STREAM_WINDOW 8
+#endif /* COAP_BLOCK_STREAM_WINDOW */
+
+/**
+ * Structure to hold a copy of a block that has arrived ahead of the data
+ * streamed to the block data handler so far
+ */
+typedef struct coap_rblock_held_t {
+  size_t offset;         /**< offset of the data into the body */
+  size_t length;         /**< length of the data */
+  uint8_t *data;         /**< copy of the data */
+} coap_rblock_held_t;
+
+/**
+ * Structure to keep track of a body being streamed to the block data handler
+ */
+typedef struct coap_rblock_stream_t {
+  size_t next_offset;    /**< offset of the next data to pass on */
+  uint32_t held_count;   /**< number of entries used in held */
+  coap_rblock_held_t held[COAP_BLOCK_STREAM_WINDOW]; /**< blocks held back */
+} coap_rblock_stream_t;
+
 /**
  * Structure to keep track of block1 specific information
  * (Requests)
@@ -82,7 +132,8 @@ struct coap_lg_xmit_t {
   uint8_t blk_size;      /**< large block transmission size */
   uint16_t option;       /**< large block transmisson CoAP option */
   int last_block;        /**< last acknowledged block number */
-  const uint8_t *data;   /**< large data ptr */
+  const uint8_t *data;   /**< large data ptr, or NULL if got using
+                              get_func */
   size_t length;         /**< large data length */
   size_t offset;         /**< large data next offset to transmit */
   union {
@@ -94,6 +145,11 @@ struct coap_lg_xmit_t {
   coap_tick_t last_sent; /**< Last time any data sent */
   coap_tick_t last_all_sent; /**< Last time all data sent or 0 */
   coap_tick_t last_obs; /**< Last time used (Observe tracking) or 0 */
+  uint32_t q_next;       /**< Q-Block next block to send in a burst */
+  uint16_t q_retry;      /**< Q-Block sends not answered by the peer */
+  uint8_t q_token_length; /**< Q-Block2 length of q_token */
+  uint8_t q_token[8];    /**< Q-Block2 token of the last request */
+  coap_get_large_data_t get_func; /**< large data get function, or NULL */
   coap_release_large_data_t release_func; /**< large data de-alloc function */
   void *app_ptr;         /**< applicaton provided ptr for de-alloc function */
 };
@@ -118,12 +174,17 @@ struct coap_lg_crcv_t {
   uint16_t retry_counter; /**< Retry counter (part of state token) */
   size_t total_len;      /**< Length as indicated by SIZE2 option */
   coap_binary_t *body_data; /**< Used for re-assembling entire body */
+  coap_rblock_stream_t *stream; /**< Used for streaming the body instead */
   coap_binary_t *app_token; /**< app requesting PDU token */
   coap_binary_t *obs_token; /**< Initial Observe response PDU token */
   uint64_t state_token; /**< state token */
   coap_pdu_t pdu;        /**< skeletal PDU */
   coap_rblock_t rec_blocks; /** < list of received blocks */
   coap_tick_t last_used; /**< Last time all data sent or 0 */
+  uint32_t q_set_end;    /**< Q-Block2 block after the last complete burst */
+  uint32_t q_continue;   /**< Q-Block2 block last asked to continue from */
+  coap_tick_t q_missing; /**< Q-Block2 last time missing blocks asked for */
+  uint8_t q_done;        /**< Q-Block2 body has been passed to the app */
 };
 #endif /* COAP_CLIENT_SUPPORT */
 
@@ -144,6 +205,7 @@ struct coap_lg_srcv_t {
   uint8_t szx;           /**< size of individual blocks */
   size_t total_len;      /**< Length as indicated by SIZE1 option */
   coap_binary_t *body_data; /**< Used for re-assembling entire body */
+  coap_rblock_stream_t *stream; /**< Used for streaming the body instead */
   size_t amount_so_far;  /**< Amount of data seen so far */
   coap_resource_t *resource; /**< associated resource */
   coap_str_const_t *uri_path; /** set to uri_path if unknown resource */
@@ -153,6 +215,10 @@ struct coap_lg_srcv_t {
   coap_mid_t last_mid;   /**< Last received mid for this set of packets */
   coap_tick_t last_used; /**< Last time data sent or 0 */
   uint16_t block_option; /**< Block option in use */
+  uint32_t q_set_end;    /**< Q-Block1 block after the last complete burst */
+  uint32_t q_acked;      /**< Q-Block1 block that 2.31 last asked for */
+  coap_tick_t q_missing; /**< Q-Block1 last time missing blocks asked for */
+  coap_pdu_code_t q_done_code; /**< Q-Block1 response code once done or 0 */
 };
 #endif /* COAP_SERVER_SUPPORT */
 
@@ -203,6 +269,45 @@ int coap_handle_response_get_block(coap_context_t *context,
                                    coap_pdu_t *sent,
                                    coap_pdu_t *rcvd,
                                    coap_recurse_t recursive);
+
+/**
+ * Sends a probe to find out if the server understands the Q-Block1 and
+ * Q-Block2 options, if @p session is a client session set up with
+ * COAP_BLOCK_TRY_Q_BLOCK over UDP or DTLS that has not sent one yet.
+ * The probe is a CON GET of /.well-known/core with a Q-Block2 option.
+ *
+ * @param session The client session about to send a request.
+ *
+ * @return @c 1 if Q-Block options can be used in requests, else @c 0 (which
+ *         includes while the probe has not been answered).
+ */
+int coap_block_check_q_block_probe(coap_session_t *session);
+
+/**
+ * Records the outcome of the Q-Block probe, if @p pdu has the token of the
+ * probe that has not been answered yet.  If not @p supported, the session
+ * falls back to using Block1 and Block2.
+ *
+ * @param session   The client session.
+ * @param pdu       The response, or the request that was rejected or timed
+ *                  out.
+ * @param supported @c 1 if the server understands the Q-Block options.
+ *
+ * @return @c 1 if @p pdu was for the probe (so is not for the app), else
+ *         @c 0.
+ */
+int coap_block_q_block_probe_done(coap_session_t *session,
+                                  const coap_pdu_t *pdu, int supported);
+
+/**
+ * Returns the SZX to ask for in a Q-Block2 option, so that each block of the
+ * response fits into a PDU of the maximum size for @p session.
+ *
+ * @param session The client session.
+ *
+ * @return The SZX, 0 to 6.
+ */
+unsigned int coap_block_q_block2_szx(const coap_session_t *session);
 #endif /* COAP_CLIENT_SUPPORT */
 
 void coap_block_delete_lg_xmit(coap_session_t *session,
@@ -212,6 +317,72 @@ int coap_block_check_lg_xmit_timeouts(coap_session_t *session,
                                       coap_tick_t now,
                                       coap_tick_t *tim_rem);
 
+/**
+ * Sends the next burst of blocks of a Q-Block1 or Q-Block2 body, from block
+ * q_next up to the end of the body or the next multiple of MAX_PAYLOADS
+ * blocks, and starts the wait of NON_TIMEOUT before any further burst.
+ *
+ * @param session The session.
+ * @param lg_xmit The large body being sent.
+ *
+ * @return @c 1 if the blocks have been sent, else @c 0.
+ */
+int coap_block_send_q_set(coap_session_t *session, coap_lg_xmit_t *lg_xmit);
+
+/**
+ * Records that block @p block_num has been received.
+ *
+ * @param rec_blocks The received blocks.
+ * @param block_num  The number of the block received.
+ *
+ * @return @c 1 if recorded, or @c 0 if @p block_num is more than
+ *         COAP_RBLOCK_MAX_SPAN blocks after the first missing block, or
+ *         there is no memory.
+ */
+int coap_rblock_add(coap_rblock_t *rec_blocks, uint32_t block_num);
+
+/**
+ * Checks whether block @p block_num has been received.
+ *
+ * @param rec_blocks The received blocks.
+ * @param block_num  The number of the block.
+ *
+ * @return @c 1 if it has been received, else @c 0.
+ */
+int coap_rblock_has(const coap_rblock_t *rec_blocks, uint32_t block_num);
+
+/**
+ * Returns the first block at or after block @p block_num that has not been
+ * received.  All the blocks before the first missing block are skipped
+ * without being looked at.
+ *
+ * @param rec_blocks The received blocks.
+ * @param block_num  The number of the block to start from.
+ *
+ * @return The number of the missing block.
+ */
+uint32_t coap_rblock_next_missing(const coap_rblock_t *rec_blocks,
+                                  uint32_t block_num);
+
+/**
+ * Checks whether the blocks received are exactly those of a body of
+ * @p total_blocks blocks.
+ *
+ * @param rec_blocks   The received blocks.
+ * @param total_blocks The number of blocks in the body.
+ *
+ * @return @c 1 if all the blocks, and no others, have been received,
+ *         else @c 0.
+ */
+int coap_rblock_all_in(const coap_rblock_t *rec_blocks, size_t total_blocks);
+
+/**
+ * Forgets all the blocks received and releases the bitmap.
+ *
+ * @param rec_blocks The received blocks.
+ */
+void coap_rblock_clear(coap_rblock_t *rec_blocks);
+
 /**
  * The function checks that the code in a newly formed lg_xmit created by
  * coap_add_data_large_response() is updated.
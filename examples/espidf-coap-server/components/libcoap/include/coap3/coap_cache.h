@@ -44,6 +44,32 @@ typedef enum coap_cache_record_pdu_t {
   COAP_CACHE_RECORD_PDU
 } coap_cache_record_pdu_t;
 
+/**
+ * How cache-keys are derived, as set by coap_cache_set_key_mode().
+ */
+typedef enum coap_cache_key_mode_t {
+  COAP_CACHE_KEY_DIGEST, /**< SHA-256 (or the digest of the TLS library) of
+                              the cache-key options (the default) */
+  COAP_CACHE_KEY_FAST    /**< Seeded 128 bit SipHash-2-4 of the cache-key
+                              options, with cache-entries looked up by
+                              coap_cache_get_by_pdu() checked against the
+                              options */
+} coap_cache_key_mode_t;
+
+/**
+ * The cache statistics returned by coap_cache_get_stats().
+ */
+typedef struct coap_cache_stats_t {
+  size_t entries;       /**< Number of cache-entries held */
+  size_t bytes;         /**< Memory used by the cache-entries held */
+  uint64_t hits;        /**< Lookups that found a cache-entry */
+  uint64_t misses;      /**< Lookups that did not find a cache-entry */
+  uint64_t evictions;   /**< Cache-entries deleted to stay within the
+                             limits set by coap_cache_set_limits() */
+  uint64_t expirations; /**< Cache-entries deleted as idle for longer than
+                             their idle timeout */
+} coap_cache_stats_t;
+
 /**
  * Calculates a cache-key for the given CoAP PDU. See
  * https://tools.ietf.org/html/rfc7252#section-5.4.2
@@ -104,6 +130,30 @@ coap_cache_key_t *coap_cache_derive_key_w_ignore(const coap_session_t *session,
                                       const uint16_t *ignore_options,
                                       size_t ignore_count);
 
+/**
+ * Sets how cache-keys are derived for @p context.
+ *
+ * COAP_CACHE_KEY_DIGEST uses the SHA-256 digest (or the digest of the TLS
+ * library), which typically means a memory allocation per cache-key.
+ *
+ * COAP_CACHE_KEY_FAST uses a 128 bit SipHash-2-4 keyed with a random seed
+ * chosen for @p context, which needs no memory allocation.  The cache-key
+ * options of each cache-entry are kept, and compared in full against the
+ * request for a match by coap_cache_get_by_pdu().  As the cache-keys are only
+ * meaningful to @p context, they must not be stored or shared elsewhere.
+ *
+ * The mode can only be changed while there are no cache-entries, and should
+ * be set before any resources are observed as observers are identified by
+ * their cache-keys.
+ *
+ * @param context The context to use.
+ * @param mode    COAP_CACHE_KEY_DIGEST or COAP_CACHE_KEY_FAST.
+ *
+ * @return @c 1 if successful, else @c 0 if there are cache-entries.
+ */
+int coap_cache_set_key_mode(coap_context_t *context,
+                            coap_cache_key_mode_t mode);
+
 /**
  * Delete the cache-key.
  *
@@ -134,7 +184,10 @@ int coap_cache_ignore_options(coap_context_t *context,
  * If @p record_pdu is set, then the copied PDU will get freed off when
  * this cache-entry is deleted.
  *
- * The cache-entry is maintained on a context hash list.
+ * The cache-entry is maintained on a context hash list, replacing any
+ * cache-entry with the same cache-key.  Least recently used cache-entries
+ * are deleted to make room if the limits set by coap_cache_set_limits()
+ * would otherwise be exceeded.
  *
  * @param session   The session to use to derive the context from.
  * @param pdu       The pdu to use to generate the cache-key.
@@ -229,6 +282,45 @@ void coap_cache_set_app_data(coap_cache_entry_t *cache_entry, void *data,
  */
 void *coap_cache_get_app_data(const coap_cache_entry_t *cache_entry);
 
+/**
+ * Sets the number of bytes of memory used by the data stored with
+ * coap_cache_set_app_data(), so that it counts towards the @c max_bytes limit
+ * of coap_cache_set_limits().  The limits are enforced when the next
+ * cache-entry is created.
+ *
+ * @param cache_entry The CoAP cache entry.
+ * @param size        The number of bytes used by the app data.
+ */
+void coap_cache_set_app_data_size(coap_cache_entry_t *cache_entry,
+                                  size_t size);
+
+/**
+ * Limits the number of cache-entries, and the memory used by them, that are
+ * held by @p context.  When creating a new cache-entry would go over either of
+ * the limits, the least recently used cache-entries are deleted first.
+ *
+ * The memory used by a cache-entry is that of the cache-entry itself, the
+ * PDU if recorded and any app data size set by
+ * coap_cache_set_app_data_size().
+ *
+ * @param context     The context to use.
+ * @param max_entries The maximum number of cache-entries, or @c 0 for no
+ *                    limit (the default).
+ * @param max_bytes   The maximum memory used by the cache-entries, or @c 0
+ *                    for no limit (the default).
+ */
+void coap_cache_set_limits(coap_context_t *context, size_t max_entries,
+                           size_t max_bytes);
+
+/**
+ * Returns the current size of the cache of @p context and the counts of
+ * hits, misses, evictions and expirations since the context was created.
+ *
+ * @param context The context to use.
+ * @param stats   Updated with the cache statistics.
+ */
+void coap_cache_get_stats(coap_context_t *context, coap_cache_stats_t *stats);
+
 /** @} */
 
 #endif  /* COAP_CACHE_H */
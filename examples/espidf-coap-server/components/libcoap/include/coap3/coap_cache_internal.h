@@ -34,18 +34,42 @@ typedef struct coap_digest_t {
 } coap_digest_t;
 
 struct coap_cache_key_t {
-  uint8_t key[32];
+  uint8_t key[32];  /**< Digest, or 128 bit hash followed by zeros for
+                         COAP_CACHE_KEY_FAST */
 };
 
+/**
+ * Number of one second slots of the timer wheel used to expire idle
+ * cache-entries.  Cache-entries further into the future than this are looked
+ * at once per turn of the wheel until they are due.
+ */
+#ifndef COAP_CACHE_WHEEL_SLOTS
+#define COAP_CACHE_WHEEL_SLOTS 64
+#endif /* COAP_CACHE_WHEEL_SLOTS */
+
 struct coap_cache_entry_t {
   UT_hash_handle hh;
   coap_cache_key_t *cache_key;
-  coap_session_t *session;
+  coap_session_t *session;    /**< Owning session if session based, else
+                                   NULL */
+  coap_context_t *context;    /**< The context holding this entry */
   coap_pdu_t *pdu;
   void* app_data;
   coap_tick_t expire_ticks;
   unsigned int idle_timeout;
   coap_cache_app_data_free_callback_t callback;
+  size_t app_data_size;       /**< Size given by
+                                   coap_cache_set_app_data_size() */
+  size_t size;                /**< Memory counted against max_bytes */
+  uint8_t *key_data;          /**< The cache-key options for
+                                   COAP_CACHE_KEY_FAST, else NULL */
+  size_t key_data_len;        /**< Length of key_data */
+  struct coap_cache_entry_t *lru_prev; /**< Less recently used entry */
+  struct coap_cache_entry_t *lru_next; /**< More recently used entry */
+  struct coap_cache_entry_t *wheel_prev; /**< Previous in the wheel slot */
+  struct coap_cache_entry_t *wheel_next; /**< Next in the wheel slot */
+  unsigned int wheel_slot;    /**< Wheel slot this entry is on, if
+                                   idle_timeout is set */
 };
 
 /**
@@ -53,6 +77,10 @@ struct coap_cache_entry_t {
  *
  * Internal function.
  *
+ * Only the timer wheel slots for the seconds that have passed since the
+ * previous call are looked at, so an entry may be deleted up to a second
+ * after its idle timeout.
+ *
  * @param context The context holding the coap-entries to exire
  */
 void coap_expire_cache_entries(coap_context_t *context);
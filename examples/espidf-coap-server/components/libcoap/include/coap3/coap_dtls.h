@@ -47,6 +47,33 @@ typedef enum coap_dtls_role_t {
 
 #define COAP_DTLS_RPK_CERT_CN "RPK"
 
+#ifndef COAP_DTLS_SESSION_CACHE_SIZE
+/**
+ * The maximum number of (D)TLS sessions that a server keeps so that clients
+ * can resume them with an abbreviated handshake, if session_resumption is
+ * set in the PSK or PKI setup data.  The oldest are dropped first.
+ */
+#define COAP_DTLS_SESSION_CACHE_SIZE 1024
+#endif /* COAP_DTLS_SESSION_CACHE_SIZE */
+
+#ifndef COAP_DTLS_SESSION_LIFETIME
+/**
+ * The number of seconds that a (D)TLS session, or a session ticket, can be
+ * resumed for.
+ */
+#define COAP_DTLS_SESSION_LIFETIME 7200
+#endif /* COAP_DTLS_SESSION_LIFETIME */
+
+#ifndef COAP_DTLS_RESUME_CLIENT_MAX
+/**
+ * The maximum number of servers that a client keeps a (D)TLS session for, to
+ * resume with the next session to the same server.  The session is only
+ * resumed if set up with the same SNI and credentials, where the PEM files
+ * of COAP_PKI_KEY_PEM are compared by name, size and modification time.
+ */
+#define COAP_DTLS_RESUME_CLIENT_MAX 16
+#endif /* COAP_DTLS_RESUME_CLIENT_MAX */
+
 /**
  * Check whether DTLS is available.
  *
@@ -274,9 +301,12 @@ struct coap_dtls_pki_t {
   uint8_t is_rpk_not_cert;        /**< 1 is RPK instead of Public Certificate.
                                    *     If set, PKI key format type cannot be
                                    *     COAP_PKI_KEY_PEM */
-  uint8_t reserved[3];             /**< Reserved - must be set to 0 for
+  uint8_t session_resumption;     /**< 1 if (D)TLS sessions are to be
+                                   *     resumed. See
+                                   *     COAP_DTLS_SESSION_CACHE_SIZE */
+  uint8_t reserved[2];             /**< Reserved - must be set to 0 for
                                         future compatibility */
-                                   /* Size of 3 chosen to align to next
+                                   /* Size of 2 chosen to align to next
                                     * parameter, so if newly defined option
                                     * it can use one of the reserverd slot so
                                     * no need to change
@@ -352,9 +382,12 @@ typedef struct coap_dtls_cpsk_t {
                        to support this version of the struct */
 
   /* Options to enable different TLS functionality in libcoap */
-  uint8_t reserved[7];             /**< Reserved - must be set to 0 for
+  uint8_t session_resumption;      /**< 1 if (D)TLS sessions are to be
+                                    *     resumed. See
+                                    *     COAP_DTLS_SESSION_CACHE_SIZE */
+  uint8_t reserved[6];             /**< Reserved - must be set to 0 for
                                         future compatibility */
-                                   /* Size of 7 chosen to align to next
+                                   /* Size of 6 chosen to align to next
                                     * parameter, so if newly defined option
                                     * it can use one of the reserverd slot so
                                     * no need to change
@@ -439,9 +472,12 @@ typedef struct coap_dtls_spsk_t {
                        to support this version of the struct */
 
   /* Options to enable different TLS functionality in libcoap */
-  uint8_t reserved[7];             /**< Reserved - must be set to 0 for
+  uint8_t session_resumption;      /**< 1 if (D)TLS sessions are to be
+                                    *     resumed. See
+                                    *     COAP_DTLS_SESSION_CACHE_SIZE */
+  uint8_t reserved[6];             /**< Reserved - must be set to 0 for
                                         future compatibility */
-                                   /* Size of 7 chosen to align to next
+                                   /* Size of 6 chosen to align to next
                                     * parameter, so if newly defined option
                                     * it can use one of the reserverd slot so
                                     * no need to change
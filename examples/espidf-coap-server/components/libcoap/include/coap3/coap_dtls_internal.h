@@ -263,6 +263,29 @@ int coap_dtls_receive(coap_session_t *coap_session,
 int coap_dtls_hello(coap_session_t *coap_session,
                     const uint8_t *data,
                     size_t data_len);
+
+/**
+ * Checks a client HELLO that arrived on a DTLS endpoint from a peer that has
+ * no session yet, before any session is made for it. A backend that can
+ * check cookies statelessly sends the cookie verification message from here,
+ * so that HELLOs from addresses that have not been verified never get a
+ * session. This is done by TinyDTLS, OpenSSL and GnuTLS. Mbed TLS returns
+@c 1 and leaves this to coap_dtls_hello().
+ *
+ * @param endpoint  The endpoint the HELLO arrived on.
+ * @param addr_info The local and remote addresses of the HELLO.
+ * @param ifindex   The interface the HELLO arrived on.
+ * @param data      Encrypted datagram.
+ * @param data_len  Encrypted datagram size.
+ *
+ * @return @c 1 if a session should be made for the HELLO, @c 0 if a cookie
+ *         verification message has been sent or the HELLO was dropped.
+ */
+int coap_dtls_hello_filter(coap_endpoint_t *endpoint,
+                           const coap_addr_tuple_t *addr_info,
+                           int ifindex,
+                           const uint8_t *data,
+                           size_t data_len);
 #endif /* COAP_SERVER_SUPPORT */
 
 /**
@@ -403,6 +426,84 @@ void coap_dtls_shutdown(void);
 void *coap_dtls_get_tls(const coap_session_t *session,
                         coap_tls_library_t *tls_lib);
 
+#if COAP_CLIENT_SUPPORT
+/**
+ * A (D)TLS session that a client can resume with the next session to the
+ * same server, as serialized by the (D)TLS library.
+ */
+typedef struct coap_dtls_resume_t {
+  struct coap_dtls_resume_t *next;
+  coap_address_t remote;      /**< the server */
+  coap_proto_t proto;         /**< COAP_PROTO_DTLS or COAP_PROTO_TLS */
+  coap_bin_const_t *identity; /**< PSK identity the session was set up with,
+                                   or NULL if PKI */
+  uint64_t setup;             /**< hash of the SNI and credentials the
+                                   session was set up with */
+  coap_bin_const_t *state;    /**< serialized (D)TLS session */
+} coap_dtls_resume_t;
+
+/**
+ * Records a hash of the SNI and of the certificates and key (or names of
+ * them) set up for a PKI client session, so that only a session set up the
+ * same way resumes a (D)TLS session that it saved.
+ *
+ * @param session    The client session.
+ * @param setup_data The PKI setup of @p session.
+ */
+void coap_dtls_resume_setup_pki(coap_session_t *session,
+                                const coap_dtls_pki_t *setup_data);
+
+/**
+ * Records a hash of the SNI and of the pre-shared key set up for a PSK
+ * client session, as coap_dtls_resume_setup_pki() does for PKI.
+ *
+ * @param session    The client session.
+ * @param setup_data The PSK setup of @p session.
+ */
+void coap_dtls_resume_setup_psk(coap_session_t *session,
+                                const coap_dtls_cpsk_t *setup_data);
+
+/**
+ * Keeps the (D)TLS session state of a client session that has connected so
+ * that it can be resumed by the next client session to the same server.
+ * The oldest state is dropped once there are COAP_DTLS_RESUME_CLIENT_MAX
+ * servers.  Does nothing unless session_resumption was set up for
+ * @p session.
+ *
+ * @param session The client session.
+ * @param data    The serialized (D)TLS session.
+ * @param len     The length of @p data.
+ */
+void coap_dtls_resume_save(coap_session_t *session,
+                           const uint8_t *data, size_t len);
+
+/**
+ * Finds the (D)TLS session state that was kept for the server, PSK identity,
+ * SNI and credentials of @p session.
+ *
+ * @param session The client session about to do a handshake.
+ *
+ * @return The serialized (D)TLS session, or @c NULL if there is none or
+ *         session_resumption was not set up for @p session.
+ */
+const coap_bin_const_t *coap_dtls_resume_find(coap_session_t *session);
+
+/**
+ * Drops any (D)TLS session state kept for the server of @p session, such as
+ * when the handshake that tried to resume it failed.
+ *
+ * @param session The client session.
+ */
+void coap_dtls_resume_forget(coap_session_t *session);
+
+/**
+ * Drops all the (D)TLS session state kept by @p context.
+ *
+ * @param context The CoAP context.
+ */
+void coap_dtls_resume_free_all(coap_context_t *context);
+#endif /* COAP_CLIENT_SUPPORT */
+
 /** @} */
 
 #endif /* COAP_DTLS_INTERNAL_H */
@@ -76,5 +76,6 @@
 #include "coap_session_internal.h"
 #include "coap_subscribe_internal.h"
 #include "coap_tcp_internal.h"
+#include "coap_uri_internal.h"
 
 #endif /* COAP_INTERNAL_H_ */
@@ -29,6 +29,15 @@
 #define COAP_RXBUFFER_SIZE 1472
 #endif /* COAP_RXBUFFER_SIZE */
 
+/*
+ * The receive buffer of a TCP or TLS session starts at COAP_RXBUFFER_SIZE
+ * and grows to hold the largest PDU received.  Once it is empty, a buffer
+ * that has grown beyond this is freed rather than kept for the session.
+ */
+#ifndef COAP_RXBUFFER_KEEP_SIZE
+#define COAP_RXBUFFER_KEEP_SIZE (128 * 1024)
+#endif /* COAP_RXBUFFER_KEEP_SIZE */
+
 /*
  * It may may make sense to define this larger on busy systems
  * (lots of sessions, large number of which are active), by using
@@ -38,6 +47,29 @@
 #define COAP_MAX_EPOLL_EVENTS 10
 #endif /* COAP_MAX_EPOLL_EVENTS */
 
+/*
+ * The upper limit for the number of datagrams that can be drained from an
+ * endpoint per read event when batched reads are enabled with
+ * coap_context_set_max_read_batch().
+ */
+#ifndef COAP_MAX_READ_BATCH
+#define COAP_MAX_READ_BATCH 64
+#endif /* COAP_MAX_READ_BATCH */
+
+/*
+ * The upper limit for the number of datagrams that can be queued for sending
+ * when batched sends are enabled with coap_context_set_max_send_batch().
+ */
+#ifndef COAP_MAX_SEND_BATCH
+#define COAP_MAX_SEND_BATCH 64
+#endif /* COAP_MAX_SEND_BATCH */
+
+/*
+ * Number of power-of-two buckets in the read batch size histogram.
+ * Bucket n counts reads that returned between 2^n and 2^(n+1)-1 datagrams.
+ */
+#define COAP_READ_BATCH_HIST_BUCKETS 8
+
 #ifdef _WIN32
 typedef SOCKET coap_fd_t;
 #define coap_closesocket closesocket
@@ -26,6 +26,19 @@
 #include "net/gnrc.h"
 #endif /* RIOT_VERSION */
 
+#if !defined(WITH_LWIP) && !defined(WITH_CONTIKI) && !defined(RIOT_VERSION)
+#define COAP_READ_BATCH_SUPPORT 1
+#else /* WITH_LWIP || WITH_CONTIKI || RIOT_VERSION */
+#define COAP_READ_BATCH_SUPPORT 0
+#endif /* WITH_LWIP || WITH_CONTIKI || RIOT_VERSION */
+
+#if COAP_READ_BATCH_SUPPORT && defined(HAVE_STRUCT_CMSGHDR) && \
+    defined(HAVE_SENDMMSG)
+#define COAP_SEND_BATCH_SUPPORT 1
+#else /* ! COAP_READ_BATCH_SUPPORT || ! HAVE_STRUCT_CMSGHDR || ! HAVE_SENDMMSG */
+#define COAP_SEND_BATCH_SUPPORT 0
+#endif /* ! COAP_READ_BATCH_SUPPORT || ! HAVE_STRUCT_CMSGHDR || ! HAVE_SENDMMSG */
+
 struct coap_socket_t {
 #if defined(WITH_LWIP)
   struct udp_pcb *pcb;
@@ -59,6 +72,7 @@ struct coap_socket_t {
 #define COAP_SOCKET_CAN_ACCEPT   0x0400  /**< non blocking server socket can now accept without blocking */
 #define COAP_SOCKET_CAN_CONNECT  0x0800  /**< non blocking client socket can now connect without blocking */
 #define COAP_SOCKET_MULTICAST    0x1000  /**< socket is used for multicast communication */
+#define COAP_SOCKET_REUSE_PORT   0x2000  /**< socket is bound with SO_REUSEPORT */
 
 #if COAP_SERVER_SUPPORT
 coap_endpoint_t *coap_malloc_endpoint( void );
@@ -138,6 +152,53 @@ ssize_t coap_network_send( coap_socket_t *sock, const coap_session_t *session, c
  */
 ssize_t coap_network_read( coap_socket_t *sock, coap_packet_t *packet );
 
+#if COAP_READ_BATCH_SUPPORT
+/**
+ * Function interface for reading up to @p count datagrams from an unconnected
+ * socket in one go. Uses recvmmsg() if available, otherwise falls back to a
+ * single coap_network_read().
+ *
+ * @param sock    Socket to read data from
+ * @param packets Array of at least @p count packets. src and dst of each
+ *                packet should be preset as for coap_network_read().
+ * @param count   The maximum number of datagrams to read, which is capped
+ *                at COAP_MAX_READ_BATCH.
+ *
+ * @return        The number of packets filled in (0 if there was nothing to
+ *                read), or @c -1 on error.
+ */
+int coap_network_read_batch(coap_socket_t *sock, coap_packet_t *packets,
+                            size_t count);
+#endif /* COAP_READ_BATCH_SUPPORT */
+
+#if COAP_SEND_BATCH_SUPPORT
+/**
+ * A datagram queued by coap_network_send() for sending on an unconnected
+ * socket by coap_send_batch_flush().
+ */
+typedef struct coap_send_entry_t {
+  coap_socket_t *sock;         /**< the socket to send on */
+  coap_session_t *session;     /**< the session that queued the datagram */
+  int ifindex;                 /**< the interface index */
+  coap_addr_tuple_t addr_info; /**< local and remote addresses */
+  size_t length;               /**< length of data */
+  uint8_t data[COAP_RXBUFFER_SIZE]; /**< the datagram */
+} coap_send_entry_t;
+
+/**
+ * Sends all the datagrams queued for @p context, using sendmmsg() if
+ * available. Consecutive datagrams of the same size to the same peer are
+ * sent as a single UDP GSO (UDP_SEGMENT) datagram where supported.
+ * If a datagram cannot be sent, the error is kept on the session that queued
+ * it and returned by the next coap_socket_send() for that session.
+ *
+ * @param context The context to send the queued datagrams for.
+ */
+void coap_send_batch_flush(coap_context_t *context);
+#else /* ! COAP_SEND_BATCH_SUPPORT */
+#define coap_send_batch_flush(context) ((void)(context))
+#endif /* ! COAP_SEND_BATCH_SUPPORT */
+
 #ifndef coap_mcast_interface
 # define coap_mcast_interface(Local) 0
 #endif
@@ -79,4 +79,21 @@ typedef int coap_mutex_t;
 
 #endif /* COAP_CONSTRAINED_STACK */
 
+/*
+ * Static variables that are declared COAP_THREAD_LOCAL have a separate copy
+ * in each thread, so that contexts can be run in parallel by different
+ * threads (see coap_shard.h).  COAP_THREAD_LOCAL_SUPPORT is 0 if the compiler
+ * does not support thread local storage.
+ */
+#if defined(_MSC_VER)
+#define COAP_THREAD_LOCAL __declspec(thread)
+#define COAP_THREAD_LOCAL_SUPPORT 1
+#elif defined(__GNUC__) || defined(__clang__)
+#define COAP_THREAD_LOCAL __thread
+#define COAP_THREAD_LOCAL_SUPPORT 1
+#else
+#define COAP_THREAD_LOCAL
+#define COAP_THREAD_LOCAL_SUPPORT 0
+#endif
+
 #endif /* COAP_MUTEX_H_ */
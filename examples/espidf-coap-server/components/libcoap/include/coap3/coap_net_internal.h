@@ -29,10 +29,22 @@
 
 /**
  * Queue entry
+ *
+ * The retransmission queue (coap_context_t::sendqueue) is a pairing heap
+ * ordered by @c t, so that the next entry to expire is always at its root.
+ * Each entry is also hashed by message id into its session's
+ * coap_session_t::sendqueue so that it can be found and removed without
+ * searching the whole queue.
  */
 struct coap_queue_t {
-  struct coap_queue_t *next;
-  coap_tick_t t;                /**< when to send PDU for the next time */
+  struct coap_queue_t *next;    /**< used when on a delayqueue or other list */
+  struct coap_queue_t *child;   /**< sendqueue: leftmost child */
+  struct coap_queue_t *sibling; /**< sendqueue: next sibling */
+  struct coap_queue_t *prev;    /**< sendqueue: parent if leftmost child,
+                                 *   else previous sibling */
+  UT_hash_handle hh;            /**< session sendqueue entries by id */
+  coap_tick_t t;                /**< when to send PDU for the next time,
+                                 *   relative to sendqueue_basetime */
   unsigned char retransmit_cnt; /**< retransmission counter, will be removed
                                  *    when zero */
   uint8_t is_mcast;             /**< Set if this is a queued mcast response */
@@ -66,12 +78,15 @@ struct coap_context_t {
 #endif /* WITHOUT_ASYNC */
 
   /**
-   * The time stamp in the first element of the sendqeue is relative
+   * The time stamps of all the elements of the sendqeue are relative
    * to sendqueue_basetime. */
   coap_tick_t sendqueue_basetime;
-  coap_queue_t *sendqueue;
+  coap_queue_t *sendqueue;        /**< pairing heap of pending
+                                       retransmissions */
 #if COAP_SERVER_SUPPORT
   coap_endpoint_t *endpoint;      /**< the endpoints used for listening  */
+  coap_session_t *session_deadlines; /**< pairing heap of the server
+                                          sessions by next deadline */
 #endif /* COAP_SERVER_SUPPORT */
 #if COAP_CLIENT_SUPPORT
   coap_session_t *sessions;       /**< client sessions */
@@ -108,7 +123,21 @@ struct coap_context_t {
 
   ssize_t (*network_read)(coap_socket_t *sock, coap_packet_t *packet);
 
+#if COAP_SEND_BATCH_SUPPORT
+  unsigned int max_send_batch;     /**< Maximum number of datagrams to queue
+                                        before sending them in one go. 0 or 1
+                                        means send immediately */
+  coap_send_entry_t *send_batch;   /**< Datagrams queued for sending */
+  unsigned int send_batch_size;    /**< Number of entries in send_batch */
+  unsigned int send_batch_count;   /**< Number of queued datagrams */
+  uint8_t send_batch_no_gso;       /**< Set if UDP GSO is not usable */
+#endif /* COAP_SEND_BATCH_SUPPORT */
+
   void *dtls_context;
+#if COAP_CLIENT_SUPPORT
+  coap_dtls_resume_t *dtls_resume; /**< (D)TLS sessions to resume, most
+                                        recently used first */
+#endif /* COAP_CLIENT_SUPPORT */
 
 #if COAP_SERVER_SUPPORT
   coap_dtls_spsk_t spsk_setup_data;  /**< Contains the initial PSK server setup
@@ -138,6 +167,37 @@ struct coap_context_t {
                                         cache-key */
   size_t cache_ignore_count;       /**< The number of CoAP options to ignore
                                         when creating a cache-key */
+  coap_cache_entry_t *cache_lru;   /**< cache-entries, least recently used
+                                        first */
+  coap_cache_entry_t *cache_wheel[COAP_CACHE_WHEEL_SLOTS];
+                                   /**< cache-entries with an idle timeout,
+                                        by the second they are due to expire
+                                        in */
+  coap_tick_t cache_wheel_next;    /**< next second of cache_wheel to be
+                                        checked */
+  size_t cache_max_entries;        /**< Maximum number of cache-entries, 0
+                                        means no limit */
+  size_t cache_max_bytes;          /**< Maximum memory used by cache-entries,
+                                        0 means no limit */
+  coap_cache_stats_t cache_stats;  /**< Cache size and counters */
+  coap_cache_key_mode_t cache_key_mode; /**< How cache-keys are derived */
+  uint8_t cache_key_seed[16];      /**< Seed for COAP_CACHE_KEY_FAST */
+  unsigned int max_read_batch;     /**< Maximum number of datagrams to read
+                                        per endpoint read event. 0 or 1 means
+                                        read one at a time */
+  coap_packet_t *read_batch;       /**< Preallocated packets for batched
+                                        endpoint reads */
+  unsigned int read_batch_size;    /**< Number of packets in read_batch */
+  uint64_t read_batch_hist[COAP_READ_BATCH_HIST_BUCKETS];
+                                   /**< Histogram of datagrams returned per
+                                        endpoint read */
+  unsigned int max_dedup_entries;  /**< Maximum number of CON requests
+                                        remembered per session for
+                                        duplicate detection. 0 means
+                                        disabled */
+  coap_dedup_stats_t dedup_stats;  /**< Duplicate detection counters */
+  uint8_t reuse_port;              /**< Bind new endpoints with
+                                        SO_REUSEPORT */
 #endif /* COAP_SERVER_SUPPORT */
   void *app;                       /**< application-specific data */
 #ifdef COAP_EPOLL_SUPPORT
@@ -147,14 +207,25 @@ struct coap_context_t {
 #endif /* COAP_EPOLL_SUPPORT */
 #if COAP_SERVER_SUPPORT
   uint8_t observe_pending;         /**< Observe response pending */
+  coap_resource_t *dirty_resources; /**< resources with observers to be
+                                         notified by the next
+                                         coap_check_notify() */
+  coap_resource_t *notify_resources; /**< resources still to be looked at
+                                          by the running
+                                          coap_check_notify() */
   uint8_t mcast_per_resource;      /**< Mcast controlled on a per resource
                                         basis */
 #endif /* COAP_SERVER_SUPPORT */
   uint8_t block_mode;              /**< Zero or more COAP_BLOCK_ or'd options */
+  coap_block_data_handler_t block_data_handler; /**< Called with the body
+                                         of each large transfer in place of
+                                         re-assembling it */
 };
 
 /**
- * Adds @p node to given @p queue, ordered by variable t in @p node.
+ * Adds @p node to given @p queue, ordered by variable t in @p node. If
+ * @p node has a session, it can subsequently be found by
+ * coap_remove_from_queue(). This takes constant time.
  *
  * @param queue Queue to add to.
  * @param node Node entry to add to Queue.
@@ -164,7 +235,8 @@ struct coap_context_t {
 int coap_insert_node(coap_queue_t **queue, coap_queue_t *node);
 
 /**
- * Destroys specified @p node.
+ * Destroys specified @p node, removing it from its session's context
+ * sendqueue if it is still queued.
  *
  * @param node Node entry to remove.
  *
@@ -189,14 +261,15 @@ void coap_delete_all(coap_queue_t *queue);
 coap_queue_t *coap_new_node(void);
 
 /**
- * Set sendqueue_basetime in the given context object @p ctx to @p now. This
- * function returns the number of elements in the queue head that have timed
- * out.
+ * Set sendqueue_basetime in the given context object @p ctx to @p now,
+ * rebasing the time of every element of the sendqueue. This function returns
+ * the number of elements in the queue that have timed out.
  */
 unsigned int coap_adjust_basetime(coap_context_t *ctx, coap_tick_t now);
 
 /**
- * Returns the next pdu to send without removing from sendqeue.
+ * Returns the next pdu to send without removing from sendqeue. This takes
+ * constant time.
  */
 coap_queue_t *coap_peek_next( coap_context_t *context );
 
@@ -232,7 +305,9 @@ coap_mid_t coap_retransmit(coap_context_t *context, coap_queue_t *node);
 int coap_handle_dgram(coap_context_t *ctx, coap_session_t *session, uint8_t *data, size_t data_len);
 
 /**
- * This function removes the element with given @p id from the list given list.
+ * This function removes the element with given @p id from the given queue.
+ * The element is looked up by @p id in the queued elements of @p session,
+ * so the whole of @p queue is not searched.
  * If @p id was found, @p node is updated to point to the removed element. Note
  * that the storage allocated by @p node is @b not released. The caller must do
  * this manually using coap_delete_node(). This function returns @c 1 if the
@@ -81,6 +81,30 @@
 #define COAP_PDU_MAX_UDP_HEADER_SIZE 4
 #define COAP_PDU_MAX_TCP_HEADER_SIZE 6
 
+#ifndef COAP_PDU_OPT_INDEX_SIZE
+/**
+ * The number of different option numbers in a received PDU that are indexed
+ * by coap_pdu_parse_opt().  Looking up any other option walks the options
+ * following the last one indexed.
+ */
+#define COAP_PDU_OPT_INDEX_SIZE 16
+#endif /* COAP_PDU_OPT_INDEX_SIZE */
+
+/** The options of the PDU are not indexed */
+#define COAP_PDU_OPT_INDEX_NONE 0
+/** Every option number in the PDU is indexed */
+#define COAP_PDU_OPT_INDEX_FULL 1
+/** Only the lowest COAP_PDU_OPT_INDEX_SIZE option numbers are indexed */
+#define COAP_PDU_OPT_INDEX_PARTIAL 2
+
+/**
+ * Where the first option with a given number is in a PDU.
+ */
+typedef struct coap_opt_index_t {
+  uint16_t number;          /**< option number */
+  uint16_t offset;          /**< offset of the option from token */
+} coap_opt_index_t;
+
 /**
  * structure for CoAP PDUs
  *
@@ -139,6 +163,13 @@ struct coap_pdu_t {
   size_t body_total;        /**< Holds body data total size */
   coap_lg_xmit_t *lg_xmit;  /**< Holds ptr to lg_xmit if sending a set of
                                  blocks */
+  uint8_t opt_index_state;  /**< COAP_PDU_OPT_INDEX_NONE, _FULL or _PARTIAL */
+  uint8_t opt_index_count;  /**< number of entries used in opt_index */
+  uint8_t borrowed_buf;     /**< set if the buffer is not owned by the PDU,
+                                 see coap_pdu_init_in_place() */
+  coap_opt_index_t opt_index[COAP_PDU_OPT_INDEX_SIZE]; /**< first occurrence
+                                 of each option number, in ascending order,
+                                 built by coap_pdu_parse_opt() */
 };
 
 /**
@@ -223,6 +254,27 @@ int coap_pdu_parse_opt(coap_pdu_t *pdu);
  */
 void coap_pdu_clear(coap_pdu_t *pdu, size_t size);
 
+#if !COAP_DISABLE_TCP
+/**
+ * Creates a PDU for the reliable transport message of @p hdr_size header
+ * bytes and @p size bytes of token, options and payload that has been read
+ * into @p hdr, without copying the message. The buffer is still owned by the
+ * caller and must be kept until the PDU is deleted, and the
+ * COAP_PDU_MAX_TCP_HEADER_SIZE bytes before the token must be writable. If
+ * the PDU needs to grow, the message is first copied into a buffer of its
+ * own. The header is not parsed.
+ *
+ * @param hdr      The start of the message.
+ * @param hdr_size The size of the header of the message.
+ * @param size     The size of the rest of the message.
+ * @param max_size The largest that the PDU can grow to.
+ *
+ * @return The PDU or @c NULL on failure.
+ */
+coap_pdu_t *coap_pdu_init_in_place(uint8_t *hdr, size_t hdr_size,
+                                   size_t size, size_t max_size);
+#endif /* !COAP_DISABLE_TCP */
+
 /**
  * Adds option of given @p number to @p pdu that is passed as first
  * parameter.
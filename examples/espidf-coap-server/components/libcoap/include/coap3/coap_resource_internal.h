@@ -38,6 +38,17 @@ struct coap_attr_t {
   int flags;
 };
 
+/**
+ * @defgroup coap_resource_queued Resource notification lists
+ * Values of coap_resource_t::queued, the list of the context that a resource
+ * with observers to be notified is on.
+ * @{
+ */
+#define COAP_RESOURCE_NOT_QUEUED    0 /**< Not waiting for coap_check_notify() */
+#define COAP_RESOURCE_QUEUED_DIRTY  1 /**< On coap_context_t::dirty_resources */
+#define COAP_RESOURCE_QUEUED_NOTIFY 2 /**< On coap_context_t::notify_resources */
+/** @} */
+
 /**
 * Abstraction of resource that can be attached to coap_context_t.
 * The key is uri_path.
@@ -50,6 +61,8 @@ struct coap_resource_t {
   unsigned int cacheable:1;      /**< can be cached */
   unsigned int is_unknown:1;     /**< resource created for unknown handler */
   unsigned int is_proxy_uri:1;   /**< resource created for proxy URI handler */
+  unsigned int queued:2;         /**< COAP_RESOURCE_QUEUED_* list this resource
+                                  *   is on */
 
   /**
    * Used to store handlers for the seven coap methods @c GET, @c POST, @c PUT,
@@ -64,6 +77,10 @@ struct coap_resource_t {
 
   coap_attr_t *link_attr; /**< attributes to be included with the link format */
   coap_subscription_t *subscribers;  /**< list of observers for this resource */
+  struct coap_resource_t *dirty_prev; /**< previous in the context's list of
+                                           resources to notify */
+  struct coap_resource_t *dirty_next; /**< next in the context's list of
+                                           resources to notify */
 
   /**
    * Request URI Path for this resource. This field will point into static
@@ -80,6 +97,14 @@ struct coap_resource_t {
   */
   unsigned int observe;
 
+  /**
+   * The options and payload of the notification for Observe value
+   * @c notify_body_observe, shared by all the observers when
+   * COAP_RESOURCE_FLAGS_NOTIFY_SHARED is set.  NULL if not yet rendered.
+   */
+  coap_pdu_t *notify_body;
+  unsigned int notify_body_observe; /**< Observe value of notify_body */
+
   /**
    * Pointer back to the context that 'owns' this resource.
    */
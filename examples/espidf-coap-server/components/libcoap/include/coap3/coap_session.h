@@ -462,6 +462,49 @@ coap_session_t *coap_session_get_by_peer(const coap_context_t *ctx,
    */
 #define COAP_DEFAULT_MAX_LATENCY (100U)
 
+  /**
+   * Number of Q-Block1 or Q-Block2 payloads that can be sent in a burst
+   * before a delay has to kick in.
+   * RFC 9177, Section 6.2 Default value of MAX_PAYLOADS is 10
+   *
+   * Configurable using coap_session_set_max_payloads()
+   */
+#define COAP_DEFAULT_MAX_PAYLOADS (10U)
+
+  /**
+   * The highest MAX_PAYLOADS that coap_session_set_max_payloads() accepts.
+   */
+#define COAP_MAX_PAYLOADS_LIMIT (64U)
+
+  /**
+   * Number of seconds to wait before sending the next burst of Q-Block1 or
+   * Q-Block2 payloads, or re-sending a burst that has not been answered.
+   * RFC 9177, Section 6.2 Default value of NON_TIMEOUT is ACK_TIMEOUT
+   *
+   * Configurable using coap_session_set_non_timeout()
+   */
+#define COAP_DEFAULT_NON_TIMEOUT ((coap_fixed_point_t){2,0})
+
+  /**
+   * Number of seconds to wait for a missing Q-Block1 or Q-Block2 payload
+   * before asking for it again.
+   * RFC 9177, Section 6.2 Default value of NON_RECEIVE_TIMEOUT is
+   * 2 * NON_TIMEOUT
+   *
+   * Configurable using coap_session_set_non_receive_timeout()
+   */
+#define COAP_DEFAULT_NON_RECEIVE_TIMEOUT ((coap_fixed_point_t){4,0})
+
+  /**
+   * Number of times a missing Q-Block1 or Q-Block2 payload is asked for
+   * before the transfer is abandoned.
+   * RFC 9177, Section 6.2 Default value of NON_MAX_RETRANSMIT is
+   * MAX_RETRANSMIT
+   *
+   * Configurable using coap_session_set_non_max_retransmit()
+   */
+#define COAP_DEFAULT_NON_MAX_RETRANSMIT (4U)
+
 /**
 * Set the CoAP initial ack response timeout before the next re-transmit
 *
@@ -605,6 +648,89 @@ void coap_session_set_probing_rate(coap_session_t *session, uint32_t value);
 */
 uint32_t coap_session_get_probing_rate(const coap_session_t *session);
 
+/**
+* Set the number of Q-Block payloads sent in a burst
+* RFC9177 MAX_PAYLOADS
+*
+* @param session The CoAP session.
+* @param value The value to set to. The default is 10, and it must be between
+*              1 and COAP_MAX_PAYLOADS_LIMIT.
+*/
+void coap_session_set_max_payloads(coap_session_t *session, uint16_t value);
+
+/**
+* Get the number of Q-Block payloads sent in a burst
+* RFC9177 MAX_PAYLOADS
+*
+* @param session The CoAP session.
+*
+* @return Current max_payloads value
+*/
+uint16_t coap_session_get_max_payloads(const coap_session_t *session);
+
+/**
+* Set the time to wait before sending the next burst of Q-Block payloads
+* RFC9177 NON_TIMEOUT
+*
+* @param session The CoAP session.
+* @param value The value to set to. The default is 2.0 and should be the same
+*              as ACK_TIMEOUT unless the round trip time is known.
+*/
+void coap_session_set_non_timeout(coap_session_t *session,
+                                  coap_fixed_point_t value);
+
+/**
+* Get the time to wait before sending the next burst of Q-Block payloads
+* RFC9177 NON_TIMEOUT
+*
+* @param session The CoAP session.
+*
+* @return Current non_timeout value
+*/
+coap_fixed_point_t coap_session_get_non_timeout(const coap_session_t *session);
+
+/**
+* Set the time to wait for a missing Q-Block payload before asking for it
+* RFC9177 NON_RECEIVE_TIMEOUT
+*
+* @param session The CoAP session.
+* @param value The value to set to. The default is 4.0 and should be at least
+*              twice the NON_TIMEOUT.
+*/
+void coap_session_set_non_receive_timeout(coap_session_t *session,
+                                          coap_fixed_point_t value);
+
+/**
+* Get the time to wait for a missing Q-Block payload before asking for it
+* RFC9177 NON_RECEIVE_TIMEOUT
+*
+* @param session The CoAP session.
+*
+* @return Current non_receive_timeout value
+*/
+coap_fixed_point_t coap_session_get_non_receive_timeout(
+                                               const coap_session_t *session);
+
+/**
+* Set the number of times missing Q-Block payloads are asked for
+* RFC9177 NON_MAX_RETRANSMIT
+*
+* @param session The CoAP session.
+* @param value The value to set to. The default is 4.
+*/
+void coap_session_set_non_max_retransmit(coap_session_t *session,
+                                         uint16_t value);
+
+/**
+* Get the number of times missing Q-Block payloads are asked for
+* RFC9177 NON_MAX_RETRANSMIT
+*
+* @param session The CoAP session.
+*
+* @return Current non_max_retransmit value
+*/
+uint16_t coap_session_get_non_max_retransmit(const coap_session_t *session);
+
       /** @} */
 /**
  * Send a ping message for the session.
@@ -42,6 +42,46 @@ struct coap_addr_hash_t {
   coap_proto_t proto;          /**< CoAP protocol */
 };
 
+#if COAP_SERVER_SUPPORT
+/*
+ * The unused (ref == 0 and nothing delayed) sessions of a datagram endpoint
+ * are kept on two LRU lists, so that coap_endpoint_get_session() can apply
+ * max_idle_sessions and max_handshake_sessions without a scan.
+ */
+#define COAP_SESSION_LRU_IDLE 0 /**< idle server sessions */
+#define COAP_SESSION_LRU_HS   1 /**< sessions still in (D)TLS set up */
+#define COAP_SESSION_LRU_MAX  2
+
+/**
+ * Linkage of a session in one of its endpoint's LRU lists.
+ */
+typedef struct coap_session_lru_t {
+  struct coap_session_t *prev;  /**< previous session, or the tail if this
+                                     is the head. NULL if not listed */
+  struct coap_session_t *next;  /**< next session */
+  coap_tick_t last_rx_tx;       /**< the session's last_rx_tx when it was
+                                     filed, which orders the list */
+} coap_session_lru_t;
+
+/**
+ * A Confirmable request remembered by a session for duplicate detection,
+ * along with the ACK sent for it.  A session holds these in a ring of
+ * max_dedup_entries entries.
+ */
+typedef struct coap_dedup_entry_t {
+  coap_tick_t expires;          /**< when EXCHANGE_LIFETIME is up. 0 if the
+                                     entry is unused */
+  coap_tick_t span_ends;        /**< when MAX_TRANSMIT_SPAN is up, after
+                                     which the client no longer retransmits
+                                     the request */
+  coap_pdu_t *response;         /**< the encoded ACK or RST sent, or NULL if
+                                     none has been sent yet */
+  coap_mid_t mid;               /**< message id of the request */
+  uint8_t token_length;         /**< length of token */
+  uint8_t token[8];             /**< token of the request */
+} coap_dedup_entry_t;
+#endif /* COAP_SERVER_SUPPORT */
+
 /**
  * Abstraction of virtual session that can be attached to coap_context_t
  * (client) or coap_endpoint_t (server).
@@ -63,6 +103,14 @@ struct coap_session_t {
                                          any */
 #if COAP_SERVER_SUPPORT
   coap_endpoint_t *endpoint;        /**< session's endpoint */
+  coap_tick_t deadline;             /**< when the server session timeouts
+                                         next need checking */
+  struct coap_session_t *deadline_child;   /**< deadlines: leftmost child */
+  struct coap_session_t *deadline_sibling; /**< deadlines: next sibling */
+  struct coap_session_t *deadline_prev;    /**< deadlines: parent if leftmost
+                                                child, else previous
+                                                sibling */
+  coap_session_lru_t lru[COAP_SESSION_LRU_MAX]; /**< endpoint LRU lists */
 #endif /* COAP_SERVER_SUPPORT */
   coap_context_t *context;          /**< session's context */
   void *tls;                        /**< security parameters */
@@ -74,6 +122,9 @@ struct coap_session_t {
                                          used in this session */
   coap_queue_t *delayqueue;         /**< list of delayed messages waiting to
                                          be sent */
+  coap_queue_t *sendqueue;          /**< this session's entries in the
+                                         context sendqueue, hashed by
+                                         message id */
   coap_lg_xmit_t *lg_xmit;          /**< list of large transmissions */
 #if COAP_CLIENT_SUPPORT
   coap_lg_crcv_t *lg_crcv;       /**< Client list of expected large receives */
@@ -84,11 +135,14 @@ struct coap_session_t {
   size_t partial_write;             /**< if > 0 indicates number of bytes
                                          already written from the pdu at the
                                          head of sendqueue */
-  uint8_t read_header[8];           /**< storage space for header of incoming
-                                         message header */
-  size_t partial_read;              /**< if > 0 indicates number of bytes
-                                         already read for an incoming message */
-  coap_pdu_t *partial_pdu;          /**< incomplete incoming pdu */
+  uint8_t *rx_buf;                  /**< receive buffer of a reliable
+                                         session, from which the incoming
+                                         PDUs are framed in place */
+  size_t rx_size;                   /**< space for data in rx_buf, which
+                                         grows up to the largest PDU that
+                                         can be received */
+  size_t rx_len;                    /**< bytes read into rx_buf that are not
+                                         yet a complete PDU */
   coap_tick_t last_rx_tx;
   coap_tick_t last_tx_rst;
   coap_tick_t last_ping;
@@ -136,6 +190,14 @@ struct coap_session_t {
                                            (default 5.0 secs) */
   uint32_t probing_rate;            /**< Max transfer wait when remote is not
                                          respoding (default 1 byte/sec) */
+  uint16_t max_payloads;            /**< Q-Block payloads sent in a burst
+                                         (default 10) */
+  uint16_t non_max_retransmit;      /**< Q-Block missing payload re-requests
+                                         (default 4) */
+  coap_fixed_point_t non_timeout;   /**< Q-Block delay between bursts
+                                         (default 2.0 secs) */
+  coap_fixed_point_t non_receive_timeout; /**< Q-Block wait for missing
+                                               payloads (default 4.0 secs) */
   unsigned int dtls_timeout_count;      /**< dtls setup retry counter */
   int dtls_event;                       /**< Tracking any (D)TLS events on this
                                              sesison */
@@ -147,14 +209,34 @@ struct coap_session_t {
   uint8_t delay_recursive;        /**< Set if in coap_client_delay_first() */
   uint8_t no_observe_cancel;      /**< Set if do not cancel observe on session
                                        close */
+  uint8_t dtls_resume;            /**< Set if the (D)TLS session is to be
+                                       resumed with the next session */
+  uint8_t dtls_resumed;           /**< Set if the (D)TLS handshake resumed
+                                       an earlier session */
+#if COAP_SEND_BATCH_SUPPORT
+  int send_error;                 /**< errno of a queued datagram that could
+                                       not be sent, reported by the next
+                                       send */
+#endif /* COAP_SEND_BATCH_SUPPORT */
   uint32_t tx_rtag;               /**< Next Request-Tag number to use */
   uint64_t tx_token;              /**< Next token number to use */
+  uint64_t dtls_resume_setup;     /**< Hash of the client SNI and
+                                       credentials, so that only a session
+                                       set up the same way is resumed */
   coap_bin_const_t *last_token;   /** last token used to make a request */
+  coap_bin_const_t *q_block_probe; /**< token of the Q-Block probe that
+                                        has not been answered yet */
   coap_bin_const_t *echo;         /**< Echo value to send with next request */
   coap_mid_t last_ack_mid;        /**< The last ACK mid that has been
                                        been processed */
   coap_mid_t last_con_mid;        /**< The last CON mid that has been
                                        been processed */
+#if COAP_SERVER_SUPPORT
+  coap_dedup_entry_t *dedup;      /**< Ring of the CON requests received
+                                       recently, for duplicate detection */
+  uint16_t dedup_size;            /**< Number of entries in dedup */
+  uint16_t dedup_next;            /**< Next entry of dedup to be reused */
+#endif /* COAP_SERVER_SUPPORT */
 };
 
 #if COAP_SERVER_SUPPORT
@@ -171,6 +253,12 @@ struct coap_endpoint_t {
                                        any */
   coap_address_t bind_addr;       /**< local interface address */
   coap_session_t *sessions;       /**< hash table or list of active sessions */
+  coap_session_t *lru[COAP_SESSION_LRU_MAX]; /**< unused sessions, least
+                                                  recently active first */
+  unsigned int lru_count[COAP_SESSION_LRU_MAX]; /**< sessions on each of
+                                                     the lru lists */
+  coap_session_t *hello;          /**< cookie verification messages are sent
+                                       from this, if any */
 };
 #endif /* COAP_SERVER_SUPPORT */
 
@@ -240,6 +328,40 @@ coap_session_t *coap_new_server_session(
   coap_context_t *ctx,
   coap_endpoint_t *ep
 );
+
+/**
+ * Checks whether the Confirmable request @p pdu is a duplicate of one
+ * received by @p session within EXCHANGE_LIFETIME. If so, the ACK or RST
+ * sent for the original request is sent again. Otherwise @p pdu is
+ * remembered, replacing the oldest request if the session's ring is full.
+ *
+ * @param session The session the request was received on.
+ * @param pdu     The CON request.
+ *
+ * @return @c 1 if @p pdu is a duplicate that needs no further handling,
+ *         else @c 0.
+ */
+int coap_session_dedup_check(coap_session_t *session, const coap_pdu_t *pdu);
+
+/**
+ * Keeps the ACK or RST @p pdu that has just been sent by @p session as the
+ * response to resend for any duplicate of the request it is for.
+ *
+ * @param session The session @p pdu was sent on.
+ * @param pdu     The encoded ACK or RST.
+ *
+ * @return @c 1 if @p pdu is now held by @p session, else @c 0 and the
+ *         caller still needs to delete @p pdu.
+ */
+int coap_session_dedup_keep(coap_session_t *session, coap_pdu_t *pdu);
+
+/**
+ * Releases the requests and responses remembered by @p session for
+ * duplicate detection.
+ *
+ * @param session The session.
+ */
+void coap_session_dedup_free(coap_session_t *session);
 #endif /* COAP_SERVER_SUPPORT */
 
 /**
@@ -302,7 +424,74 @@ coap_session_delay_pdu(coap_session_t *session, coap_pdu_t *pdu,
  */
 coap_session_t *coap_endpoint_get_session(coap_endpoint_t *endpoint,
   const coap_packet_t *packet, coap_tick_t now);
-#endif /* COAP_SERVER_SUPPORT */
+
+/**
+ * Get a session that coap_dtls_hello_filter() can send a cookie verification
+ * message from to a peer that has no session.  The session belongs to the
+ * endpoint and is reset on each call, so it is only valid until the next one.
+ * It must only be passed to coap_socket_send(), never to coap_session_send().
+ *
+ * @param endpoint  The endpoint the HELLO arrived on.
+ * @param addr_info The local and remote addresses of the HELLO.
+ * @param ifindex   The interface the HELLO arrived on.
+ *
+ * @return The session, or @c NULL if it could not be allocated.
+ */
+coap_session_t *coap_endpoint_hello_session(coap_endpoint_t *endpoint,
+                                            const coap_addr_tuple_t *addr_info,
+                                            int ifindex);
+
+/**
+ * Server sessions are kept in a pairing heap (coap_context_t::session_deadlines)
+ * ordered by when their idle, (D)TLS handshake and large body timeouts next
+ * need checking, so that coap_io_prepare_io() only has to look at the
+ * sessions that are due.  The deadlines are allowed to be early: a session
+ * that turns out not to be due is re-evaluated and put back.  They must never
+ * be late, so anything that can bring a server session's timeouts forward
+ * calls coap_session_schedule().
+ */
+
+/**
+ * Make sure that the timeouts of server session @p session are checked no
+ * later than @p when.  This is a no-op for client sessions.
+ *
+ * @param session The CoAP session.
+ * @param when    The latest time in ticks the session is to be checked, or
+ *                @c 0 for the next call to coap_io_prepare_io().
+ */
+void coap_session_schedule(coap_session_t *session, coap_tick_t when);
+
+/**
+ * Set when the timeouts of server session @p session next need checking.
+ *
+ * @param session  The CoAP server session.
+ * @param deadline The time in ticks, or @c 0 if there is nothing to check
+ *                 until the session is scheduled again.
+ */
+void coap_session_set_deadline(coap_session_t *session, coap_tick_t deadline);
+
+/**
+ * Get the server session whose timeouts need checking first.
+ *
+ * @param context The CoAP context.
+ *
+ * @return The session with the earliest deadline, or @c NULL if none.
+ */
+coap_session_t *coap_session_next_deadline(const coap_context_t *context);
+
+/**
+ * Update the membership of @p session in its endpoint's idle and handshake
+ * LRU lists.  This must be called whenever the reference count, delayqueue,
+ * type or state of a server session may have changed it being unused or in
+ * a handshake.  This is a no-op for client sessions.
+ *
+ * @param session The CoAP session.
+ */
+void coap_session_update_lru(coap_session_t *session);
+#else /* ! COAP_SERVER_SUPPORT */
+#define coap_session_schedule(s,w) ((void)(s),(void)(w))
+#define coap_session_update_lru(s) ((void)(s))
+#endif /* ! COAP_SERVER_SUPPORT */
 
 /**
  * Get maximum acceptable receive PDU size
@@ -339,6 +528,32 @@ void coap_session_mfree(coap_session_t *session);
 #define COAP_DEFAULT_LEISURE(s) ((s)->default_leisure)
 #define COAP_PROBING_RATE(s) ((s)->probing_rate)
 
+/* RFC9177 */
+#define COAP_MAX_PAYLOADS(s) ((s)->max_payloads)
+#define COAP_NON_MAX_RETRANSMIT(s) ((s)->non_max_retransmit)
+#define COAP_NON_TIMEOUT(s) ((s)->non_timeout)
+#define COAP_NON_RECEIVE_TIMEOUT(s) ((s)->non_receive_timeout)
+
+  /**
+   * The NON_TIMEOUT definition for the session (s).
+   *
+   * RFC 9177, Section 6.2
+   * Initial value 2.0 seconds
+   */
+#define COAP_NON_TIMEOUT_TICKS(s) \
+     (COAP_NON_TIMEOUT(s).integer_part * COAP_TICKS_PER_SECOND + \
+      COAP_NON_TIMEOUT(s).fractional_part * COAP_TICKS_PER_SECOND / 1000)
+
+  /**
+   * The NON_RECEIVE_TIMEOUT definition for the session (s).
+   *
+   * RFC 9177, Section 6.2
+   * Initial value 4.0 seconds
+   */
+#define COAP_NON_RECEIVE_TIMEOUT_TICKS(s) \
+     (COAP_NON_RECEIVE_TIMEOUT(s).integer_part * COAP_TICKS_PER_SECOND + \
+      COAP_NON_RECEIVE_TIMEOUT(s).fractional_part * COAP_TICKS_PER_SECOND / 1000)
+
   /**
    * The DEFAULT_LEISURE definition for the session (s).
    *
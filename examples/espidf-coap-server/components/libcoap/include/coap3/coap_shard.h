@@ -0,0 +1,184 @@
+/*
+ * coap_shard.h -- multi-threaded servers sharded with SO_REUSEPORT
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see README for terms
+ * of use.
+ */
+
+/**
+ * @file coap_shard.h
+ * @brief Multi-threaded servers sharded with SO_REUSEPORT
+ */
+
+#ifndef COAP_SHARD_H_
+#define COAP_SHARD_H_
+
+#include "net.h"
+
+/**
+ * @ingroup application_api
+ * @defgroup coap_shard Sharded Servers
+ * @{
+ * API for running a server as a group of shards, each of which is a
+ * coap_context_t run by its own thread. The shards all bind their endpoints
+ * to the same address and port using SO_REUSEPORT, and the OS then hands the
+ * datagrams (or connections) of each remote peer to one of the shards, chosen
+ * by a hash of the peer's address and port. All the sessions, and so the
+ * (D)TLS state, observers and block-wise transfers, of a peer are therefore
+ * kept by a single shard and no locking is needed between them.
+ *
+ * A context must only be used by the thread of its shard once the group has
+ * been started. The resources of each shard are set up before the group is
+ * started by the @p setup handler passed to coap_new_shard_group(), and can
+ * be changed afterwards with coap_shard_group_call(). As the observers of a
+ * resource may be held by any of the shards, resource changes are announced
+ * with coap_shard_group_notify() rather than
+ * coap_resource_notify_observers().
+ *
+ * The (D)TLS library must be thread-safe for DTLS or TLS endpoints to be used
+ * by the shards.
+ */
+
+/**
+ * The maximum number of shards in a group.
+ */
+#ifndef COAP_MAX_SHARDS
+#define COAP_MAX_SHARDS 64
+#endif /* COAP_MAX_SHARDS */
+
+/**
+ * The number of coap_shard_group_notify() and coap_shard_group_call()
+ * requests that can be waiting for each shard.
+ */
+#ifndef COAP_SHARD_QUEUE_SIZE
+#define COAP_SHARD_QUEUE_SIZE 32
+#endif /* COAP_SHARD_QUEUE_SIZE */
+
+/**
+ * The longest Uri-Path that can be passed to coap_shard_group_notify().
+ */
+#ifndef COAP_SHARD_MAX_PATH
+#define COAP_SHARD_MAX_PATH 128
+#endif /* COAP_SHARD_MAX_PATH */
+
+typedef struct coap_shard_group_t coap_shard_group_t;
+
+/**
+ * Shard handler that is used as callback in coap_new_shard_group() and
+ * coap_shard_group_call().
+ *
+ * @param context The context of the shard.
+ * @param shard   The number of the shard, from 0 to one less than the number
+ *                of shards in the group.
+ * @param arg     The argument passed to coap_new_shard_group() or
+ *                coap_shard_group_call().
+ */
+typedef void (*coap_shard_handler_t)(coap_context_t *context,
+                                     unsigned int shard, void *arg);
+
+/**
+ * Returns @c 1 if libcoap was built with support for sharded servers,
+ * @c 0 otherwise.
+ */
+int coap_shard_is_supported(void);
+
+/**
+ * Creates a group of @p shards contexts, each with
+ * coap_context_set_reuse_port() set, and calls @p setup for each of them in
+ * turn. @p setup would typically set up the (D)TLS keys, create the
+ * endpoints with coap_new_endpoint() (all with the same address and port)
+ * and add the resources. The shards are not run until coap_shard_group_start()
+ * is called.
+ *
+ * @param shards The number of shards, up to COAP_MAX_SHARDS.
+ * @param setup  The handler called to set up each shard's context.
+ * @param arg    Passed to @p setup.
+ *
+ * @return The group of shards, or @c NULL on failure.
+ */
+coap_shard_group_t *coap_new_shard_group(unsigned int shards,
+                                         coap_shard_handler_t setup,
+                                         void *arg);
+
+/**
+ * Starts a thread for each shard of @p group that runs coap_io_process() on
+ * the shard's context until the group is freed.
+ *
+ * @param group The group of shards.
+ *
+ * @return @c 1 if the threads have been started, else @c 0.
+ */
+int coap_shard_group_start(coap_shard_group_t *group);
+
+/**
+ * Stops the threads of @p group, if started, and then frees the contexts of
+ * the shards with coap_free_context() and the group itself.
+ *
+ * @param group The group of shards.
+ */
+void coap_free_shard_group(coap_shard_group_t *group);
+
+/**
+ * Returns the number of shards in @p group.
+ *
+ * @param group The group of shards.
+ *
+ * @return The number of shards.
+ */
+unsigned int coap_shard_group_count(const coap_shard_group_t *group);
+
+/**
+ * Returns the context of shard number @p shard of @p group. Once the group
+ * has been started, the context must only be used by the shard's own thread.
+ *
+ * @param group The group of shards.
+ * @param shard The number of the shard.
+ *
+ * @return The context, or @c NULL if @p shard is out of range.
+ */
+coap_context_t *coap_shard_group_get_context(const coap_shard_group_t *group,
+                                             unsigned int shard);
+
+/**
+ * Asks each shard of @p group to call coap_resource_notify_observers() for
+ * its resource with the Uri-Path @p uri_path, so that the observers held by
+ * all the shards are told about the change. This can be called by any
+ * thread, including from a request handler of one of the shards, and returns
+ * without waiting for the shards. A notification for a resource that is
+ * still waiting to be handled by a shard is not queued again. If a shard's
+ * queue is full, that shard notifies the observers of all of its observable
+ * resources instead.
+ *
+ * @param group    The group of shards.
+ * @param uri_path The Uri-Path of the resource that has changed.
+ *
+ * @return @c 1 if the notification has been queued, else @c 0.
+ */
+int coap_shard_group_notify(coap_shard_group_t *group,
+                            const coap_str_const_t *uri_path);
+
+/**
+ * Asks each shard of @p group to call @p handler with its own context from
+ * its own thread, for example to add or delete a resource. This can be called
+ * by any thread and returns without waiting for the shards. If the group has
+ * not been started, @p handler is called for each shard before returning.
+ *
+ * @param group   The group of shards.
+ * @param handler The handler to call for each shard.
+ * @param arg     Passed to @p handler, which must not free it as it is used
+ *                by all the shards.
+ *
+ * @return @c 1 if @p handler has been queued (or called) for all the shards,
+ *         or @c 0 if the queue of any shard is full, in which case it has
+ *         not been queued for any of them.
+ */
+int coap_shard_group_call(coap_shard_group_t *group,
+                          coap_shard_handler_t handler, void *arg);
+
+/** @} */
+
+#endif /* COAP_SHARD_H_ */
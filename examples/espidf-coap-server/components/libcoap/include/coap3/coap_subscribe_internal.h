@@ -82,8 +82,10 @@ coap_handle_failed_notify(coap_context_t *context,
                           const coap_binary_t *token);
 
 /**
- * Checks all known resources to see if they are dirty and then notifies
- * subscribed observers.
+ * Notifies the subscribed observers of the resources that have changed, or
+ * that have observers still to be notified of an earlier change.  Only the
+ * resources queued by coap_resource_notify_observers() or by a failed
+ * notification are looked at, not all the known resources.
  *
  * @param context The context to check for dirty resources.
  */
@@ -0,0 +1,72 @@
+/*
+ * coap_uri_internal.h -- Structures, Enums & Functions that are not
+ * exposed to application programming
+ *
+ * Copyright (C) 2010-2022 Olaf Bergmann <bergmann@tzi.org>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see README for terms
+ * of use.
+ */
+
+/**
+ * @file coap_uri_internal.h
+ * @brief CoAP URI internal information
+ */
+
+#ifndef COAP_URI_INTERNAL_H_
+#define COAP_URI_INTERNAL_H_
+
+#include "coap_internal.h"
+
+/**
+ * @ingroup internal_api
+ * @defgroup uri_internal URI Handling
+ * Internal API for extracting URIs from PDUs
+ * @{
+ */
+
+#ifndef COAP_URI_BUF_SIZE
+/**
+ * The size of the buffers on the stack that the uri_path and query of a
+ * received request are built in.  Any that are longer are built in memory
+ * got from coap_new_string().
+ */
+#define COAP_URI_BUF_SIZE 128
+#endif /* COAP_URI_BUF_SIZE */
+
+/**
+ * Extracts the query string from @p request as coap_get_query() does, but
+ * builds it in @p buf, which has @p size bytes at buf->s, if it fits there.
+ *
+ * @param request Request PDU.
+ * @param buf     The string to build the query in, or @c NULL.
+ * @param size    The number of bytes available at buf->s.
+ *
+ * @return @p buf or a new coap_string_t holding the query, or @c NULL if
+ *         no query was contained in @p request.  A new coap_string_t must
+ *         be released with coap_delete_string().
+ */
+coap_string_t *coap_get_query_buf(const coap_pdu_t *request,
+                                  coap_string_t *buf, size_t size);
+
+/**
+ * Extracts the uri_path string from @p request as coap_get_uri_path() does,
+ * but builds it in @p buf, which has @p size bytes at buf->s, if it fits
+ * there.
+ *
+ * @param request Request PDU.
+ * @param buf     The string to build the uri_path in, or @c NULL.
+ * @param size    The number of bytes available at buf->s.
+ *
+ * @return @p buf or a new coap_string_t holding the uri_path, or @c NULL on
+ *         error.  A new coap_string_t must be released with
+ *         coap_delete_string().
+ */
+coap_string_t *coap_get_uri_path_buf(const coap_pdu_t *request,
+                                     coap_string_t *buf, size_t size);
+
+/** @} */
+
+#endif /* COAP_URI_INTERNAL_H_ */
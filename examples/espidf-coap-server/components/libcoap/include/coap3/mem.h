@@ -18,6 +18,7 @@
 #define COAP_MEM_H_
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifndef WITH_LWIP
 /**
@@ -97,6 +98,42 @@ void *coap_realloc_type(coap_memory_tag_t type, void *p, size_t size);
  */
 void coap_free_type(coap_memory_tag_t type, void *p);
 
+/**
+ * The use of the memory allocated by coap_malloc_type() for one type of
+ * object.
+ */
+typedef struct coap_memory_stats_t {
+  size_t in_use;        /**< The number allocated and not yet released */
+  size_t high_water;    /**< The highest in_use has been */
+  uint64_t allocs;      /**< The number of allocations made */
+  uint64_t reused;      /**< The number of allocations that reused memory
+                             released earlier instead of calling malloc() */
+} coap_memory_stats_t;
+
+/**
+ * Gets the use of the memory allocated by coap_malloc_type() for objects of
+ * @p type.  Where there are threads, these are for the memory allocated
+ * and released by the calling thread.
+ *
+ * @param type  The type of object.
+ * @param stats Updated with the use of the memory.
+ *
+ * @return @c 1 if @p stats has been updated, or @c 0 if @p type is not
+ *         known or memory use is not recorded on this platform.
+ */
+int coap_memory_get_stats(coap_memory_tag_t type, coap_memory_stats_t *stats);
+
+/**
+ * Releases the memory that has been kept by the calling thread so that it
+ * can be reused by coap_malloc_type().  This is done by coap_free_context()
+ * and coap_cleanup().  Memory is only kept if libcoap is built with
+ * ENABLE_MEMORY_POOL (CMake) or --enable-memory-pool (configure), and then
+ * at most COAP_MEMORY_POOL_LIST_BYTES for each object type and buffer size.
+ * An application thread that creates or frees PDUs, and that goes on
+ * running after it stops doing so, should call this to give the memory back.
+ */
+void coap_memory_release_cached(void);
+
 /**
  * Wrapper function to coap_malloc_type() for backwards compatibility.
  */
@@ -121,6 +158,9 @@ COAP_STATIC_INLINE void coap_free(void *object) {
  * completely initialized anyway by the time coap gets active)  */
 COAP_STATIC_INLINE void coap_memory_init(void) {}
 
+/* lwip keeps no memory for reuse outside of its pools */
+COAP_STATIC_INLINE void coap_memory_release_cached(void) {}
+
 /* It would be nice to check that size equals the size given at the memp
  * declaration, but i currently don't see a standard way to check that without
  * sourcing the custom memp pools and becoming dependent of its syntax
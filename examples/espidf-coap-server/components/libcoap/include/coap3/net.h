@@ -329,6 +329,177 @@ coap_context_set_csm_max_message_size(coap_context_t *context,
 uint32_t
 coap_context_get_csm_max_message_size(const coap_context_t *context);
 
+/**
+ * Set the maximum number of datagrams that are read from a UDP or DTLS
+ * server endpoint per read event. The datagrams are read using a single
+ * recvmmsg() call (if supported by the OS) into a set of preallocated
+ * packets and are then handled in order of arrival.
+ * 0 or 1 (the default) means read one datagram at a time. Values larger than
+ * COAP_MAX_READ_BATCH are capped.
+ *
+ * Note: This must not be called from within a request or response handler.
+ *
+ * @param context        The coap_context_t object.
+ * @param max_read_batch The maximum number of datagrams per read.
+ */
+void
+coap_context_set_max_read_batch(coap_context_t *context,
+                                unsigned int max_read_batch);
+
+/**
+ * Get the maximum number of datagrams read per server endpoint read event.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return The maximum number of datagrams per read.
+ */
+unsigned int
+coap_context_get_max_read_batch(const coap_context_t *context);
+
+/**
+ * Set the maximum number of datagrams that are queued for sending on
+ * unconnected (server endpoint) sockets before they are sent in one go.
+ * Queued datagrams are sent using sendmmsg() (if supported by the OS) at the
+ * end of each coap_io_process() iteration, or when the queue is full.
+ * Consecutive datagrams of the same size to the same peer, such as a burst of
+ * Block2 responses, are sent as a single UDP GSO datagram where supported.
+ * 0 or 1 (the default) means each datagram is sent immediately. Values larger
+ * than COAP_MAX_SEND_BATCH are capped.
+ *
+ * Note: Applications that send outside of coap_io_process() (or the
+ * coap_io_prepare_*() / coap_io_do_*() functions) need to call
+ * coap_io_process() for the queued datagrams to go out.
+ * A failure to send a queued datagram is reported by the next send for the
+ * same session, which then fails without being sent.
+ *
+ * @param context        The coap_context_t object.
+ * @param max_send_batch The maximum number of datagrams to queue.
+ */
+void
+coap_context_set_max_send_batch(coap_context_t *context,
+                                unsigned int max_send_batch);
+
+/**
+ * Get the maximum number of datagrams queued before sending.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return The maximum number of datagrams to queue.
+ */
+unsigned int
+coap_context_get_max_send_batch(const coap_context_t *context);
+
+/**
+ * Get the histogram of the number of datagrams returned by each server
+ * endpoint read. Entry n counts the reads that returned between 2^n and
+ * 2^(n+1)-1 datagrams, with the last entry also counting any larger reads.
+ *
+ * @param context   The coap_context_t object.
+ * @param histogram Updated with the COAP_READ_BATCH_HIST_BUCKETS counts.
+ */
+void
+coap_context_get_read_batch_histogram(const coap_context_t *context,
+                             uint64_t histogram[COAP_READ_BATCH_HIST_BUCKETS]);
+
+#ifndef COAP_DEFAULT_MAX_DEDUP_ENTRIES
+/**
+ * The default number of Confirmable requests remembered per UDP or DTLS
+ * session for duplicate detection. 0 means that applications have to turn
+ * it on with coap_context_set_max_dedup_entries().
+ */
+#define COAP_DEFAULT_MAX_DEDUP_ENTRIES 0
+#endif /* COAP_DEFAULT_MAX_DEDUP_ENTRIES */
+
+#ifndef COAP_MAX_DEDUP_ENTRIES
+/**
+ * The largest number of Confirmable requests that can be remembered per
+ * session for duplicate detection.
+ */
+#define COAP_MAX_DEDUP_ENTRIES 64
+#endif /* COAP_MAX_DEDUP_ENTRIES */
+
+/**
+ * The duplicate detection counters returned by
+ * coap_context_get_dedup_stats().
+ */
+typedef struct coap_dedup_stats_t {
+  uint64_t replayed;  /**< Duplicate requests answered by resending the
+                           response sent for the original */
+  uint64_t dropped;   /**< Duplicate requests dropped as no response had
+                           been sent for the original */
+  uint64_t evicted;   /**< Requests forgotten to make way for newer ones
+                           while still within their MAX_TRANSMIT_SPAN, so
+                           that a retransmission of them could still
+                           arrive */
+} coap_dedup_stats_t;
+
+/**
+ * Set the maximum number of Confirmable requests that each UDP or DTLS
+ * session remembers, along with the ACK (piggybacked response, empty ACK or
+ * RST) that was sent for them, for EXCHANGE_LIFETIME. A retransmission of
+ * one of these requests (same Message ID and Token) is then answered by
+ * resending that ACK, without the request handler being called again
+ * (RFC 7252 Section 4.5). The oldest request is forgotten to make way for a
+ * new one if the session already remembers @p max_entries requests.
+ * 0 disables duplicate detection. The default is
+ * COAP_DEFAULT_MAX_DEDUP_ENTRIES (0, off) and values larger than
+ * COAP_MAX_DEDUP_ENTRIES are capped.
+ *
+ * Each remembered request keeps a copy of the ACK that was sent for it until
+ * EXCHANGE_LIFETIME (247 seconds by default) is up, so a busy server session
+ * can hold up to @p max_entries response PDUs.
+ *
+ * @param context     The coap_context_t object.
+ * @param max_entries The maximum number of requests remembered per session.
+ */
+void
+coap_context_set_max_dedup_entries(coap_context_t *context,
+                                   unsigned int max_entries);
+
+/**
+ * Get the maximum number of Confirmable requests remembered per session for
+ * duplicate detection.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return The maximum number of requests remembered per session.
+ */
+unsigned int
+coap_context_get_max_dedup_entries(const coap_context_t *context);
+
+/**
+ * Get the duplicate detection counters of all the sessions of @p context.
+ *
+ * @param context The coap_context_t object.
+ * @param stats   Updated with the counters.
+ */
+void
+coap_context_get_dedup_stats(const coap_context_t *context,
+                             coap_dedup_stats_t *stats);
+
+/**
+ * Set whether the endpoints subsequently created by coap_new_endpoint() are
+ * bound with the SO_REUSEPORT socket option (if supported by the OS). This
+ * lets several contexts, typically each run by its own thread, listen on the
+ * same address and port, with the OS spreading the remote peers across them
+ * (see coap_new_shard_group()). The default is 0 (not set).
+ *
+ * @param context    The coap_context_t object.
+ * @param reuse_port 1 if SO_REUSEPORT is to be set, else 0.
+ */
+void
+coap_context_set_reuse_port(coap_context_t *context, int reuse_port);
+
+/**
+ * Get whether new endpoints are bound with the SO_REUSEPORT socket option.
+ *
+ * @param context The coap_context_t object.
+ *
+ * @return 1 if SO_REUSEPORT is set on new endpoints, else 0.
+ */
+int
+coap_context_get_reuse_port(const coap_context_t *context);
+
 /**
  * Set the maximum number of sessions in (D)TLS handshake value. If this number
  * is exceeded, the least recently used server session in handshake is
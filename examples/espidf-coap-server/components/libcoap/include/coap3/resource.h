@@ -133,6 +133,17 @@ typedef void (*coap_method_handler_t)
  */
 #define COAP_RESOURCE_FLAGS_LIB_DIS_MCAST_SUPPRESS_5_XX 0x100
 
+/**
+ * The representation sent in Observe notifications is the same for all
+ * observers, whatever their session, token or query.  The GET handler is
+ * then only called once for each change of the resource, and the resulting
+ * options and payload are copied into the notifications for all the other
+ * observers.  Observers that requested a block size, used FETCH or get a
+ * response that needs more than one block still have the handler called
+ * for them individually.
+ */
+#define COAP_RESOURCE_FLAGS_NOTIFY_SHARED 0x200
+
 #define COAP_RESOURCE_FLAGS_MCAST_LIST \
   (COAP_RESOURCE_FLAGS_HAS_MCAST_SUPPORT | \
    COAP_RESOURCE_FLAGS_LIB_DIS_MCAST_DELAYS | \
@@ -364,18 +364,128 @@ void
 coap_context_set_block_mode(coap_context_t *context,
                                   uint8_t block_mode) {
   context->block_mode = block_mode &= (COAP_BLOCK_USE_LIBCOAP |
-                                       COAP_BLOCK_SINGLE_BODY);
+                                       COAP_BLOCK_SINGLE_BODY |
+                                       COAP_BLOCK_TRY_Q_BLOCK);
   if (!(block_mode & COAP_BLOCK_USE_LIBCOAP))
     context->block_mode = 0;
 }
 
+void
+coap_register_block_data_handler(coap_context_t *context,
+                                 coap_block_data_handler_t handler) {
+  context->block_data_handler = handler;
+}
+
 COAP_STATIC_INLINE int
 full_match(const uint8_t *a, size_t alen,
   const uint8_t *b, size_t blen) {
   return alen == blen && (alen == 0 || memcmp(a, b, alen) == 0);
 }
 
+/*
+ * Q-Block1 and Q-Block2 (RFC9177) are only used over unreliable transports,
+ * and only if set up with COAP_BLOCK_TRY_Q_BLOCK
+ */
+COAP_STATIC_INLINE int
+q_block_usable(const coap_session_t *session) {
+  return (session->block_mode & COAP_BLOCK_TRY_Q_BLOCK) &&
+         COAP_PROTO_NOT_RELIABLE(session->proto);
+}
+
 #if COAP_CLIENT_SUPPORT
+/*
+ * Bytes of a response that are not available for a block of the body.  This
+ * allows for the header, a token of length 8, an Echo option, ETag,
+ * Content-Format, Max-Age, Size2 and Q-Block2 options and the payload marker.
+ */
+#define Q_BLOCK2_RESPONSE_OVERHEAD (4 + 8 + 42 + 9 + 3 + 5 + 5 + 4 + 1)
+
+unsigned int
+coap_block_q_block2_szx(const coap_session_t *session) {
+  size_t avail = coap_session_max_pdu_size(session);
+  int szx;
+
+  if (avail < Q_BLOCK2_RESPONSE_OVERHEAD + 16)
+    return 0;
+  avail -= Q_BLOCK2_RESPONSE_OVERHEAD;
+  szx = coap_flsll((long long)avail) - 4 - 1;
+  return szx > 6 ? 6 : (unsigned int)szx;
+}
+
+int
+coap_block_check_q_block_probe(coap_session_t *session) {
+  coap_pdu_t *pdu;
+  uint8_t token[8];
+  size_t token_len;
+  uint8_t buf[4];
+
+  if (!q_block_usable(session) || session->type != COAP_SESSION_TYPE_CLIENT)
+    return 0;
+  if (session->block_mode & (COAP_BLOCK_HAS_Q_BLOCK | COAP_BLOCK_PROBE_Q_BLOCK))
+    return (session->block_mode & COAP_BLOCK_HAS_Q_BLOCK) != 0;
+
+  /* An RFC7959 only server rejects the critical Q-Block2 with a 4.02 */
+  pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                      coap_new_message_id(session),
+                      coap_session_max_pdu_size(session));
+  if (!pdu)
+    return 0;
+  coap_session_new_token(session, &token_len, token);
+  if (!coap_add_token(pdu, token_len, token) ||
+      !coap_add_option_internal(pdu, COAP_OPTION_URI_PATH, 11,
+                                (const uint8_t *)".well-known") ||
+      !coap_add_option_internal(pdu, COAP_OPTION_URI_PATH, 4,
+                                (const uint8_t *)"core") ||
+      !coap_add_option_internal(pdu, COAP_OPTION_Q_BLOCK2,
+                                coap_encode_var_safe(buf, sizeof(buf),
+                                         coap_block_q_block2_szx(session)),
+                                buf)) {
+    coap_delete_pdu(pdu);
+    return 0;
+  }
+  coap_delete_bin_const(session->q_block_probe);
+  session->q_block_probe = coap_new_bin_const(token, token_len);
+  if (!session->q_block_probe) {
+    coap_delete_pdu(pdu);
+    return 0;
+  }
+  coap_log(LOG_DEBUG, "** %s: probing for Q-Block support\n",
+           coap_session_str(session));
+  session->block_mode |= COAP_BLOCK_PROBE_Q_BLOCK;
+  if (coap_send_internal(session, pdu) == COAP_INVALID_MID) {
+    /* Try again with the next request */
+    session->block_mode &= ~COAP_BLOCK_PROBE_Q_BLOCK;
+    coap_delete_bin_const(session->q_block_probe);
+    session->q_block_probe = NULL;
+  }
+  return 0;
+}
+
+int
+coap_block_q_block_probe_done(coap_session_t *session, const coap_pdu_t *pdu,
+                              int supported) {
+  if (!(session->block_mode & COAP_BLOCK_PROBE_Q_BLOCK) ||
+      !session->q_block_probe ||
+      !full_match(pdu->token, pdu->token_length, session->q_block_probe->s,
+                  session->q_block_probe->length))
+    return 0;
+
+  session->block_mode &= ~COAP_BLOCK_PROBE_Q_BLOCK;
+  coap_delete_bin_const(session->q_block_probe);
+  session->q_block_probe = NULL;
+  if (supported) {
+    session->block_mode |= COAP_BLOCK_HAS_Q_BLOCK;
+    coap_log(LOG_DEBUG, "** %s: server supports Q-Block\n",
+             coap_session_str(session));
+  }
+  else {
+    session->block_mode &= ~COAP_BLOCK_TRY_Q_BLOCK;
+    coap_log(LOG_DEBUG, "** %s: no Q-Block support, using Block1/Block2\n",
+             coap_session_str(session));
+  }
+  return 1;
+}
+
 int
 coap_cancel_observe(coap_session_t *session, coap_binary_t *token,
                     coap_pdu_type_t type) {
@@ -432,6 +542,61 @@ coap_cancel_observe(coap_session_t *session, coap_binary_t *token,
 }
 #endif /* COAP_CLIENT_SUPPORT */
 
+/*
+ * Adds @p len bytes of a large body from @p offset to @p pdu, either from
+ * @p data or by getting them from the application with @p get_func.
+ */
+static int
+coap_add_large_data(coap_session_t *session, coap_pdu_t *pdu,
+                    const uint8_t *data, coap_get_large_data_t get_func,
+                    void *app_ptr, size_t offset, size_t len) {
+  uint8_t *payload;
+
+  if (!get_func)
+    return coap_add_data(pdu, len, data + offset);
+  if (len == 0)
+    return 1;
+  payload = coap_add_data_after(pdu, len);
+  if (!payload)
+    return 0;
+  if (!get_func(session, offset, len, payload, app_ptr)) {
+    coap_log(LOG_WARNING, "coap_add_data_large: unable to get %zu bytes "
+             "at offset %zu\n", len, offset);
+    /* Take the payload back out again */
+    pdu->used_size = (size_t)(pdu->data - pdu->token) - 1;
+    pdu->data = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Same as coap_add_block_b_data(), but for the large body of @p lg_xmit
+ */
+static int
+coap_add_lg_xmit_block(coap_session_t *session, coap_pdu_t *pdu,
+                       coap_lg_xmit_t *lg_xmit, coap_block_b_t *block) {
+  size_t start = (size_t)block->num << (block->szx + 4);
+  size_t max_size;
+
+  if (!lg_xmit->get_func)
+    return coap_add_block_b_data(pdu, lg_xmit->length, lg_xmit->data, block);
+  if (lg_xmit->length <= start)
+    return 0;
+
+  if (block->bert) {
+    size_t token_options = pdu->data ? (size_t)(pdu->data - pdu->token) : pdu->used_size;
+    max_size = ((pdu->max_size - token_options) / 1024) * 1024;
+  } else {
+    max_size = (size_t)1 << (block->szx + 4);
+  }
+  block->chunk_size = (uint32_t)max_size;
+
+  return coap_add_large_data(session, pdu, NULL, lg_xmit->get_func,
+                             lg_xmit->app_ptr, start,
+                             min(lg_xmit->length - start, max_size));
+}
+
 static int
 coap_add_data_large_internal(coap_session_t *session,
                              coap_pdu_t *pdu,
@@ -441,6 +606,7 @@ coap_add_data_large_internal(coap_session_t *session,
                              uint64_t etag,
                              size_t length,
                              const uint8_t *data,
+                             coap_get_large_data_t get_func,
                              coap_release_large_data_t release_func,
                              void *app_ptr,
                              coap_pdu_code_t request_method) {
@@ -486,7 +652,13 @@ coap_add_data_large_internal(coap_session_t *session,
   if (COAP_PDU_IS_REQUEST(pdu)) {
     coap_lg_xmit_t *q;
 
-    option = COAP_OPTION_BLOCK1;
+    /* Bodies of NON requests can be sent in bursts once the server is known
+       to support Q-Block1 */
+    if (q_block_usable(session) && pdu->type == COAP_MESSAGE_NON &&
+        (session->block_mode & COAP_BLOCK_HAS_Q_BLOCK))
+      option = COAP_OPTION_Q_BLOCK1;
+    else
+      option = COAP_OPTION_BLOCK1;
 
     /* See if this token is already in use for large bodies (unlikely) */
     LL_FOREACH_SAFE(session->lg_xmit, lg_xmit, q) {
@@ -507,8 +679,14 @@ coap_add_data_large_internal(coap_session_t *session,
     coap_lg_xmit_t *q;
     coap_string_t empty = { 0, NULL};
 
+    coap_opt_iterator_t opt_iter;
+
     assert(resource);
-    option = COAP_OPTION_BLOCK2;
+    /* Set up by coap_add_data_large_response() if asked for */
+    if (coap_check_option(pdu, COAP_OPTION_Q_BLOCK2, &opt_iter))
+      option = COAP_OPTION_Q_BLOCK2;
+    else
+      option = COAP_OPTION_BLOCK2;
     /* Check if resource+query is already in use for large bodies (unlikely) */
     LL_FOREACH_SAFE(session->lg_xmit, lg_xmit, q) {
       if (resource == lg_xmit->b.b2.resource &&
@@ -558,7 +736,8 @@ coap_add_data_large_internal(coap_session_t *session,
       rem = chunk;
       if (chunk > length - block.num * chunk)
         rem = length - block.num * chunk;
-      if (!coap_add_data(pdu, rem, &data[block.num * chunk]))
+      if (!coap_add_large_data(session, pdu, data, get_func, app_ptr,
+                               block.num * chunk, rem))
         goto fail;
     }
     if (release_func)
@@ -589,6 +768,7 @@ coap_add_data_large_internal(coap_session_t *session,
     lg_xmit->last_block = 0;
     lg_xmit->data = data;
     lg_xmit->length = length;
+    lg_xmit->get_func = get_func;
     lg_xmit->release_func = release_func;
     lg_xmit->app_ptr = app_ptr;
     coap_ticks(&lg_xmit->last_obs);
@@ -715,13 +895,20 @@ coap_add_data_large_internal(coap_session_t *session,
     rem = block.chunk_size;
     if (rem > lg_xmit->length - block.num * chunk)
       rem = lg_xmit->length - block.num * chunk;
-    if (!coap_add_data(pdu, rem, &data[block.num * chunk]))
+    if (!coap_add_large_data(session, pdu, data, get_func, app_ptr,
+                             block.num * chunk, rem))
       goto fail;
 
     if (COAP_PDU_IS_REQUEST(pdu))
       lg_xmit->b.b1.bert_size = rem;
 
     lg_xmit->last_block = -1;
+    lg_xmit->q_next = block.num + 1;
+    if (lg_xmit->option == COAP_OPTION_Q_BLOCK2) {
+      /* The rest of the blocks go out with the token of the request */
+      lg_xmit->q_token_length = (uint8_t)pdu->token_length;
+      memcpy(lg_xmit->q_token, pdu->token, pdu->token_length);
+    }
 
     /* Link the new lg_xmit in */
     LL_PREPEND(session->lg_xmit,lg_xmit);
@@ -735,7 +922,7 @@ coap_add_data_large_internal(coap_session_t *session,
                      (0 << 4) | (0 << 3) | blk_size), buf);
     }
 add_data:
-    if (!coap_add_data(pdu, length, data))
+    if (!coap_add_large_data(session, pdu, data, get_func, app_ptr, 0, length))
       goto fail;
 
     if (release_func)
@@ -770,25 +957,47 @@ coap_add_data_large_request(coap_session_t *session,
     return 0;
   }
   return coap_add_data_large_internal(session, pdu, NULL, NULL, -1, 0, length,
-                                      data, release_func, app_ptr, 0);
+                                      data, NULL, release_func, app_ptr, 0);
+}
+
+int
+coap_add_data_large_request_cb(coap_session_t *session,
+                               coap_pdu_t *pdu,
+                               size_t length,
+                               coap_get_large_data_t get_func,
+                               coap_release_large_data_t release_func,
+                               void *app_ptr) {
+  assert(get_func);
+  /*
+   * Delay if session->doing_first is set.
+   * E.g. Reliable and CSM not in yet for checking block support
+   */
+  if (coap_client_delay_first(session) == 0) {
+    if (release_func)
+      release_func(session, app_ptr);
+    return 0;
+  }
+  return coap_add_data_large_internal(session, pdu, NULL, NULL, -1, 0, length,
+                                      NULL, get_func, release_func, app_ptr,
+                                      0);
 }
 #endif /* ! COAP_CLIENT_SUPPORT */
 
 #if COAP_SERVER_SUPPORT
-int
-coap_add_data_large_response(coap_resource_t *resource,
-                             coap_session_t *session,
-                             const coap_pdu_t *request,
-                             coap_pdu_t *response,
-                             const coap_string_t *query,
-                             uint16_t media_type,
-                             int maxage,
-                             uint64_t etag,
-                             size_t length,
-                             const uint8_t *data,
-                             coap_release_large_data_t release_func,
-                             void *app_ptr
-) {
+static int
+coap_add_data_large_response_internal(coap_resource_t *resource,
+                                      coap_session_t *session,
+                                      const coap_pdu_t *request,
+                                      coap_pdu_t *response,
+                                      const coap_string_t *query,
+                                      uint16_t media_type,
+                                      int maxage,
+                                      uint64_t etag,
+                                      size_t length,
+                                      const uint8_t *data,
+                                      coap_get_large_data_t get_func,
+                                      coap_release_large_data_t release_func,
+                                      void *app_ptr) {
   unsigned char buf[4];
   coap_block_b_t block;
   int block_requested = 0;
@@ -802,13 +1011,20 @@ coap_add_data_large_response(coap_resource_t *resource,
   if (request) {
     if (coap_get_block_b(session, request, COAP_OPTION_BLOCK2, &block)) {
       block_requested = 1;
-      if (block.num != 0 && length <= (block.num << (block.szx + 4))) {
-        coap_log(LOG_DEBUG, "Illegal block requested (%d > last = %zu)\n",
-                 block.num,
-                 length >> (block.szx + 4));
-        response->code = COAP_RESPONSE_CODE(400);
-        goto error;
-      }
+    }
+    else if (q_block_usable(session) &&
+             coap_get_block_b(session, request, COAP_OPTION_Q_BLOCK2,
+                              &block)) {
+      block_requested = 1;
+      block_opt = COAP_OPTION_Q_BLOCK2;
+    }
+    if (block_requested && block.num != 0 &&
+        length <= (block.num << (block.szx + 4))) {
+      coap_log(LOG_DEBUG, "Illegal block requested (%d > last = %zu)\n",
+               block.num,
+               length >> (block.szx + 4));
+      response->code = COAP_RESPONSE_CODE(400);
+      goto error;
     }
   }
 
@@ -848,7 +1064,7 @@ coap_add_data_large_response(coap_resource_t *resource,
   /* add data body */
   if (request &&
       !coap_add_data_large_internal(session, response, resource, query,
-                                    maxage, etag, length, data,
+                                    maxage, etag, length, data, get_func,
                                     release_func, app_ptr,
                                     request->code)) {
     response->code = COAP_RESPONSE_CODE(500);
@@ -868,8 +1084,188 @@ error_released:
 #endif /* COAP_ERROR_PHRASE_LENGTH > 0 */
   return 0;
 }
+
+int
+coap_add_data_large_response(coap_resource_t *resource,
+                             coap_session_t *session,
+                             const coap_pdu_t *request,
+                             coap_pdu_t *response,
+                             const coap_string_t *query,
+                             uint16_t media_type,
+                             int maxage,
+                             uint64_t etag,
+                             size_t length,
+                             const uint8_t *data,
+                             coap_release_large_data_t release_func,
+                             void *app_ptr
+) {
+  return coap_add_data_large_response_internal(resource, session, request,
+                                               response, query, media_type,
+                                               maxage, etag, length, data,
+                                               NULL, release_func, app_ptr);
+}
+
+int
+coap_add_data_large_response_cb(coap_resource_t *resource,
+                                coap_session_t *session,
+                                const coap_pdu_t *request,
+                                coap_pdu_t *response,
+                                const coap_string_t *query,
+                                uint16_t media_type,
+                                int maxage,
+                                uint64_t etag,
+                                size_t length,
+                                coap_get_large_data_t get_func,
+                                coap_release_large_data_t release_func,
+                                void *app_ptr) {
+  assert(get_func);
+  return coap_add_data_large_response_internal(resource, session, request,
+                                               response, query, media_type,
+                                               maxage, etag, length, NULL,
+                                               get_func, release_func,
+                                               app_ptr);
+}
 #endif /* ! COAP_SERVER_SUPPORT */
 
+/*
+ * Returns the number of blocks in the body of @p lg_xmit
+ */
+COAP_STATIC_INLINE uint32_t
+coap_lg_xmit_blocks(const coap_lg_xmit_t *lg_xmit) {
+  size_t chunk = (size_t)1 << (lg_xmit->blk_size + 4);
+
+  return (uint32_t)((lg_xmit->length + chunk - 1) / chunk);
+}
+
+/*
+ * Sends block @p num of the body of @p lg_xmit on its own, built from the
+ * skeletal PDU, as a NON Q-Block1 request or Q-Block2 response
+ */
+static int
+coap_block_send_q_block(coap_session_t *session, coap_lg_xmit_t *lg_xmit,
+                        uint32_t num) {
+  coap_pdu_t *pdu;
+  coap_block_b_t block;
+  size_t chunk = (size_t)1 << (lg_xmit->blk_size + 4);
+  uint8_t buf[8];
+
+  if (COAP_PDU_IS_REQUEST(&lg_xmit->pdu)) {
+    uint64_t token = STATE_TOKEN_FULL(lg_xmit->b.b1.state_token,
+                                      ++lg_xmit->b.b1.count);
+    size_t len = coap_encode_var_safe8(buf, sizeof(token), token);
+
+    pdu = coap_pdu_duplicate(&lg_xmit->pdu, session, len, buf, NULL);
+  }
+  else {
+    coap_opt_filter_t drop_options;
+
+    /* Observe is only sent with the first block */
+    memset(&drop_options, 0, sizeof(coap_opt_filter_t));
+    coap_option_filter_set(&drop_options, COAP_OPTION_OBSERVE);
+    pdu = coap_pdu_duplicate(&lg_xmit->pdu, session, lg_xmit->q_token_length,
+                             lg_xmit->q_token, &drop_options);
+  }
+  if (!pdu)
+    return 0;
+  pdu->type = COAP_MESSAGE_NON;
+
+  memset(&block, 0, sizeof(block));
+  block.num = num;
+  block.szx = block.aszx = lg_xmit->blk_size;
+  block.m = (num + 1) * chunk < lg_xmit->length;
+  coap_update_option(pdu, lg_xmit->option,
+                     coap_encode_var_safe(buf, sizeof(buf),
+                                          (block.num << 4) |
+                                          (block.m << 3) |
+                                          block.aszx),
+                     buf);
+  if (!coap_add_lg_xmit_block(session, pdu, lg_xmit, &block)) {
+    coap_delete_pdu(pdu);
+    return 0;
+  }
+  coap_ticks(&lg_xmit->last_sent);
+  if (!block.m && !COAP_PDU_IS_REQUEST(&lg_xmit->pdu))
+    lg_xmit->last_all_sent = lg_xmit->last_sent;
+  return coap_send_internal(session, pdu) != COAP_INVALID_MID;
+}
+
+int
+coap_block_send_q_set(coap_session_t *session, coap_lg_xmit_t *lg_xmit) {
+  uint32_t total = coap_lg_xmit_blocks(lg_xmit);
+  uint16_t max_payloads = COAP_MAX_PAYLOADS(session);
+  int ret = 1;
+
+  while (lg_xmit->q_next < total) {
+    if (!coap_block_send_q_block(session, lg_xmit, lg_xmit->q_next)) {
+      ret = 0;
+      break;
+    }
+    lg_xmit->q_next++;
+    if (lg_xmit->q_next % max_payloads == 0)
+      break;
+  }
+  coap_ticks(&lg_xmit->last_payload);
+  return ret;
+}
+
+/*
+ * Paces the bursts of blocks of a Q-Block1 or Q-Block2 body, sending the
+ * next burst if NON_TIMEOUT has passed without the peer asking for it.
+ *
+ * Returns -1 if @p lg_xmit has been given up on and deleted, 1 with
+ * @p tim_rem updated if the next burst is being waited for, or 0 if only the
+ * expiry of @p lg_xmit applies.
+ */
+static int
+coap_block_q_xmit_timeout(coap_session_t *session, coap_lg_xmit_t *lg_xmit,
+                          coap_tick_t now, coap_tick_t *tim_rem) {
+  coap_tick_t non_timeout = COAP_NON_TIMEOUT_TICKS(session);
+  uint32_t total = coap_lg_xmit_blocks(lg_xmit);
+
+  if (COAP_PDU_IS_REQUEST(&lg_xmit->pdu)) {
+    /* Q-Block1 carries on until the server has the whole body */
+    if (!lg_xmit->last_payload)
+      return 0;
+    if (lg_xmit->last_payload + non_timeout <= now) {
+      if (lg_xmit->q_next < total) {
+        /* Not hearing back between bursts is not a failure */
+        coap_block_send_q_set(session, lg_xmit);
+      }
+      else {
+        if (lg_xmit->q_retry >= COAP_NON_MAX_RETRANSMIT(session)) {
+          LL_DELETE(session->lg_xmit, lg_xmit);
+          coap_block_delete_lg_xmit(session, lg_xmit);
+          coap_handle_event(session->context, COAP_EVENT_XMIT_BLOCK_FAIL,
+                            session);
+          return -1;
+        }
+        /* All sent, so the server may not have the last one */
+        lg_xmit->q_retry++;
+        coap_block_send_q_block(session, lg_xmit, total - 1);
+        coap_ticks(&lg_xmit->last_payload);
+      }
+    }
+  }
+  else {
+    /* Q-Block2 sends the rest of the body unless the client has gone quiet */
+    if (lg_xmit->q_next >= total ||
+        lg_xmit->q_retry >= COAP_NON_MAX_RETRANSMIT(session))
+      return 0;
+    if (!lg_xmit->last_payload ||
+        lg_xmit->last_payload + non_timeout <= now) {
+      if (lg_xmit->last_payload)
+        lg_xmit->q_retry++;
+      coap_block_send_q_set(session, lg_xmit);
+      if (lg_xmit->q_next >= total ||
+          lg_xmit->q_retry >= COAP_NON_MAX_RETRANSMIT(session))
+        return 0;
+    }
+  }
+  if (*tim_rem > lg_xmit->last_payload + non_timeout - now)
+    *tim_rem = lg_xmit->last_payload + non_timeout - now;
+  return 1;
+}
+
 /*
  * return 1 if there is a future expire time, else 0.
  * update tim_rem with remaining value if return is 1.
@@ -881,21 +1277,39 @@ coap_block_check_lg_xmit_timeouts(coap_session_t *session, coap_tick_t now,
   coap_lg_xmit_t *q;
   coap_tick_t idle_timeout = 8 * COAP_TICKS_PER_SECOND;
   coap_tick_t partial_timeout = COAP_MAX_TRANSMIT_WAIT_TICKS(session);
+  /* Long enough for a Q-Block2 client to ask for all that it is missing */
+  coap_tick_t q_idle_timeout = (COAP_NON_MAX_RETRANSMIT(session) + 1) *
+                               COAP_NON_RECEIVE_TIMEOUT_TICKS(session);
   int ret = 0;
 
   *tim_rem = -1;
+  if (q_idle_timeout < idle_timeout)
+    q_idle_timeout = idle_timeout;
 
   LL_FOREACH_SAFE(session->lg_xmit, p, q) {
+    if (p->option == COAP_OPTION_Q_BLOCK1 ||
+        p->option == COAP_OPTION_Q_BLOCK2) {
+      int q_ret = coap_block_q_xmit_timeout(session, p, now, tim_rem);
+
+      if (q_ret) {
+        if (q_ret == 1)
+          ret = 1;
+        continue;
+      }
+    }
     if (p->last_all_sent) {
-      if (p->last_all_sent + idle_timeout <= now) {
+      coap_tick_t idle = p->option == COAP_OPTION_Q_BLOCK2 ?
+                         q_idle_timeout : idle_timeout;
+
+      if (p->last_all_sent + idle <= now) {
         /* Expire this entry */
         LL_DELETE(session->lg_xmit, p);
         coap_block_delete_lg_xmit(session, p);
       }
       else {
         /* Delay until the lg_xmit needs to expire */
-        if (*tim_rem > p->last_all_sent + idle_timeout - now) {
-          *tim_rem = p->last_all_sent + idle_timeout - now;
+        if (*tim_rem > p->last_all_sent + idle - now) {
+          *tim_rem = p->last_all_sent + idle - now;
           ret = 1;
         }
       }
@@ -920,6 +1334,77 @@ coap_block_check_lg_xmit_timeouts(coap_session_t *session, coap_tick_t now,
 }
 
 #if COAP_CLIENT_SUPPORT
+/*
+ * Sends a NON request for more of a Q-Block2 body, built from the skeletal
+ * PDU, with a Q-Block2 option for each of the @p count blocks in @p nums
+ * which have the M bit set to @p more
+ */
+static int
+coap_block_send_q_block2_request(coap_session_t *session,
+                                 coap_lg_crcv_t *lg_crcv,
+                                 const uint32_t *nums, uint32_t count,
+                                 int more) {
+  coap_pdu_t *pdu;
+  coap_opt_filter_t drop_options;
+  uint64_t token = STATE_TOKEN_FULL(lg_crcv->state_token,
+                                    ++lg_crcv->retry_counter);
+  uint8_t buf[8];
+  size_t len = coap_encode_var_safe8(buf, sizeof(token), token);
+  uint32_t i;
+
+  memset(&drop_options, 0, sizeof(coap_opt_filter_t));
+  coap_option_filter_set(&drop_options, COAP_OPTION_OBSERVE);
+  coap_option_filter_set(&drop_options, COAP_OPTION_Q_BLOCK2);
+  pdu = coap_pdu_duplicate(&lg_crcv->pdu, session, len, buf, &drop_options);
+  if (!pdu)
+    return 0;
+  pdu->type = COAP_MESSAGE_NON;
+  if (lg_crcv->etag_set &&
+      !coap_update_option(pdu, COAP_OPTION_ETAG, lg_crcv->etag_length,
+                          lg_crcv->etag))
+    goto fail;
+  for (i = 0; i < count; i++) {
+    if (!coap_insert_option(pdu, COAP_OPTION_Q_BLOCK2,
+                            coap_encode_var_safe(buf, sizeof(buf),
+                                                 (nums[i] << 4) |
+                                                 ((more ? 1 : 0) << 3) |
+                                                 lg_crcv->szx),
+                            buf))
+      goto fail;
+  }
+  return coap_send_internal(session, pdu) != COAP_INVALID_MID;
+
+fail:
+  coap_delete_pdu(pdu);
+  return 0;
+}
+
+/*
+ * Asks for up to MAX_PAYLOADS of the blocks of a Q-Block2 body that are
+ * missing
+ */
+static void
+coap_block_q_request_missing(coap_session_t *session,
+                             coap_lg_crcv_t *lg_crcv) {
+  uint32_t nums[COAP_MAX_PAYLOADS_LIMIT];
+  uint32_t count = 0;
+  size_t chunk = (size_t)1 << (lg_crcv->szx + 4);
+  uint32_t total = (uint32_t)((lg_crcv->total_len + chunk - 1) / chunk);
+  uint32_t num;
+
+  if (total < lg_crcv->rec_blocks.highest)
+    total = lg_crcv->rec_blocks.highest;
+  for (num = coap_rblock_next_missing(&lg_crcv->rec_blocks, 0);
+       num < total && count < COAP_MAX_PAYLOADS(session);
+       num = coap_rblock_next_missing(&lg_crcv->rec_blocks, num + 1)) {
+    nums[count++] = num;
+  }
+  lg_crcv->rec_blocks.retry++;
+  coap_ticks(&lg_crcv->q_missing);
+  if (count)
+    coap_block_send_q_block2_request(session, lg_crcv, nums, count, 0);
+}
+
 /*
  * return 1 if there is a future expire time, else 0.
  * update tim_rem with remaining value if return is 1.
@@ -930,11 +1415,35 @@ coap_block_check_lg_crcv_timeouts(coap_session_t *session, coap_tick_t now,
   coap_lg_crcv_t *p;
   coap_lg_crcv_t *q;
   coap_tick_t partial_timeout = COAP_MAX_TRANSMIT_WAIT_TICKS(session);
+  coap_tick_t receive_timeout = COAP_NON_RECEIVE_TIMEOUT_TICKS(session);
   int ret = 0;
 
   *tim_rem = -1;
 
   LL_FOREACH_SAFE(session->lg_crcv, p, q) {
+    if (p->block_option == COAP_OPTION_Q_BLOCK2 && !p->initial &&
+        !p->q_done) {
+      /* Ask for the missing blocks once they have stopped arriving */
+      coap_tick_t due = p->rec_blocks.last_seen > p->q_missing ?
+                        p->rec_blocks.last_seen : p->q_missing;
+
+      due += receive_timeout;
+      if (due <= now) {
+        if (p->rec_blocks.retry >= COAP_NON_MAX_RETRANSMIT(session)) {
+          LL_DELETE(session->lg_crcv, p);
+          coap_block_delete_lg_crcv(session, p);
+          coap_handle_event(session->context, COAP_EVENT_PARTIAL_BLOCK,
+                            session);
+          continue;
+        }
+        coap_block_q_request_missing(session, p);
+        due = p->q_missing + receive_timeout;
+      }
+      if (*tim_rem > due - now) {
+        *tim_rem = due - now;
+        ret = 1;
+      }
+    }
     if (!p->observe_set && p->last_used &&
         p->last_used + partial_timeout <= now) {
       /* Expire this entry */
@@ -953,38 +1462,376 @@ coap_block_check_lg_crcv_timeouts(coap_session_t *session, coap_tick_t now,
 }
 #endif /* COAP_CLIENT_SUPPORT */
 
+/* Returns the number of the lowest bit set in a non-zero word */
+COAP_STATIC_INLINE uint32_t
+coap_rblock_lowest_bit(uint32_t word) {
+#if defined(__GNUC__)
+  return (uint32_t)__builtin_ctz(word);
+#else /* ! __GNUC__ */
+  uint32_t bit = 0;
+
+  while (!(word & 1)) {
+    word >>= 1;
+    bit++;
+  }
+  return bit;
+#endif /* ! __GNUC__ */
+}
+
+int
+coap_rblock_has(const coap_rblock_t *rec_blocks, uint32_t block_num) {
+  uint32_t bit;
+
+  if (block_num < rec_blocks->base)
+    return 1;
+  if (block_num >= rec_blocks->highest)
+    return 0;
+  bit = block_num - rec_blocks->origin;
+  return (rec_blocks->bits[rec_blocks->first + bit / 32] >> (bit % 32)) & 1;
+}
+
+uint32_t
+coap_rblock_next_missing(const coap_rblock_t *rec_blocks,
+                         uint32_t block_num) {
+  uint32_t bit;
+  uint32_t word;
+
+  if (block_num < rec_blocks->base)
+    block_num = rec_blocks->base;
+  if (block_num >= rec_blocks->highest)
+    return block_num;
+  bit = block_num - rec_blocks->origin;
+  for (word = bit / 32; word < rec_blocks->used; word++) {
+    uint32_t missing = ~rec_blocks->bits[rec_blocks->first + word];
+
+    if (word == bit / 32)
+      missing &= ~0U << (bit % 32);
+    if (missing)
+      return rec_blocks->origin + word * 32 + coap_rblock_lowest_bit(missing);
+  }
+  return rec_blocks->origin + rec_blocks->used * 32;
+}
+
+int
+coap_rblock_all_in(const coap_rblock_t *rec_blocks, size_t total_blocks) {
+  /* Nothing beyond the first missing block if all are in */
+  return rec_blocks->base >= total_blocks &&
+         rec_blocks->highest == rec_blocks->base;
+}
+
+int
+coap_rblock_add(coap_rblock_t *rec_blocks, uint32_t block_num) {
+  uint32_t bit;
+  uint32_t word;
+
+  /* Reset as there is activity */
+  rec_blocks->retry = 0;
+  coap_ticks(&rec_blocks->last_seen);
+
+  if (block_num < rec_blocks->base)
+    return 1;
+  if (block_num == rec_blocks->base &&
+      rec_blocks->highest == rec_blocks->base) {
+    /* In order, so there is no need for the bitmap */
+    rec_blocks->base++;
+    rec_blocks->highest++;
+    return 1;
+  }
+  if (block_num - rec_blocks->base >= COAP_RBLOCK_MAX_SPAN)
+    /* Too many losses */
+    return 0;
+
+  if (rec_blocks->highest == rec_blocks->base) {
+    /* Start the bitmap at the word holding the first missing block */
+    rec_blocks->origin = rec_blocks->base & ~31U;
+    rec_blocks->first = 0;
+    rec_blocks->used = 0;
+  }
+  bit = block_num - rec_blocks->origin;
+  word = bit / 32;
+  if (word >= rec_blocks->used) {
+    if (rec_blocks->first + word >= rec_blocks->size) {
+      /* Move the words in use to the front before growing */
+      if (rec_blocks->first) {
+        memmove(rec_blocks->bits, &rec_blocks->bits[rec_blocks->first],
+                rec_blocks->used * sizeof(rec_blocks->bits[0]));
+        rec_blocks->first = 0;
+      }
+      if (word >= rec_blocks->size) {
+        uint32_t size = rec_blocks->size ? rec_blocks->size * 2 : 4;
+        uint32_t *bits;
+
+        if (size > COAP_RBLOCK_MAX_SPAN / 32 + 1)
+          size = COAP_RBLOCK_MAX_SPAN / 32 + 1;
+        if (size <= word)
+          size = word + 1;
+        bits = coap_realloc_type(COAP_STRING, rec_blocks->bits,
+                                 size * sizeof(rec_blocks->bits[0]));
+        if (bits == NULL)
+          return 0;
+        rec_blocks->bits = bits;
+        rec_blocks->size = size;
+      }
+    }
+    memset(&rec_blocks->bits[rec_blocks->first + rec_blocks->used], 0,
+           (word + 1 - rec_blocks->used) * sizeof(rec_blocks->bits[0]));
+    rec_blocks->used = word + 1;
+  }
+  if (rec_blocks->highest == rec_blocks->base) {
+    /* The blocks from origin up to the first missing one are in */
+    uint32_t in = rec_blocks->base - rec_blocks->origin;
+
+    if (in)
+      rec_blocks->bits[rec_blocks->first] = (1U << in) - 1;
+  }
+  rec_blocks->bits[rec_blocks->first + word] |= 1U << (bit % 32);
+  if (block_num >= rec_blocks->highest)
+    rec_blocks->highest = block_num + 1;
+
+  if (block_num == rec_blocks->base) {
+    uint32_t drop;
+
+    rec_blocks->base = coap_rblock_next_missing(rec_blocks, block_num);
+    if (rec_blocks->base >= rec_blocks->highest) {
+      /* No gaps left, so back to not needing the bitmap */
+      rec_blocks->base = rec_blocks->highest;
+      rec_blocks->used = 0;
+      rec_blocks->first = 0;
+      return 1;
+    }
+    /* Drop the words that are all before the first missing block */
+    drop = (rec_blocks->base - rec_blocks->origin) / 32;
+    rec_blocks->first += drop;
+    rec_blocks->used -= drop;
+    rec_blocks->origin += drop * 32;
+  }
+  return 1;
+}
+
+void
+coap_rblock_clear(coap_rblock_t *rec_blocks) {
+  coap_free_type(COAP_STRING, rec_blocks->bits);
+  memset(rec_blocks, 0, sizeof(*rec_blocks));
+}
+
+/*
+ * Allocates the tracking for streaming a body to the block data handler
+ */
+static coap_rblock_stream_t *
+coap_block_new_stream(void) {
+  coap_rblock_stream_t *stream = coap_malloc_type(COAP_STRING,
+                                                  sizeof(coap_rblock_stream_t));
+
+  if (stream)
+    memset(stream, 0, sizeof(coap_rblock_stream_t));
+  return stream;
+}
+
+/*
+ * Releases any blocks held back so that the body can be streamed again from
+ * the start
+ */
+static void
+coap_block_reset_stream(coap_rblock_stream_t *stream) {
+  uint32_t i;
+
+  if (stream == NULL)
+    return;
+  for (i = 0; i < stream->held_count; i++)
+    coap_free_type(COAP_STRING, stream->held[i].data);
+  stream->held_count = 0;
+  stream->next_offset = 0;
+}
+
+static void
+coap_block_delete_stream(coap_rblock_stream_t *stream) {
+  coap_block_reset_stream(stream);
+  coap_free_type(COAP_STRING, stream);
+}
+
+/*
+ * Check whether the block at offset can be taken by the stream, which it
+ * can be if it has already been passed on, follows on, is already held or
+ * there is space to hold it within the window.
+ */
 static int
-check_if_received_block(coap_rblock_t *rec_blocks, uint32_t block_num) {
+coap_block_stream_fits(const coap_rblock_stream_t *stream, size_t offset,
+                       size_t chunk) {
   uint32_t i;
 
-  for (i = 0; i < rec_blocks->used; i++) {
-    if (block_num < rec_blocks->range[i].begin)
-      return 0;
-    if (block_num <= rec_blocks->range[i].end)
+  if (offset <= stream->next_offset)
+    return 1;
+  for (i = 0; i < stream->held_count; i++) {
+    if (stream->held[i].offset == offset)
       return 1;
   }
-  return 0;
+  return stream->held_count < COAP_BLOCK_STREAM_WINDOW &&
+         (offset - stream->next_offset) / chunk < COAP_BLOCK_STREAM_WINDOW;
 }
 
+/*
+ * Pass the part of data that follows on from what has been passed so far
+ * to the block data handler
+ */
 static int
-check_all_blocks_in(coap_rblock_t *rec_blocks, size_t total_blocks) {
+coap_block_stream_pass(coap_session_t *session, const coap_pdu_t *pdu,
+                       coap_rblock_stream_t *stream, const uint8_t *data,
+                       size_t length, size_t offset, size_t total) {
+  size_t skip;
+
+  if (offset > stream->next_offset ||
+      offset + length <= stream->next_offset)
+    return 1;
+  skip = stream->next_offset - offset;
+  if (!session->context->block_data_handler(session, pdu, stream->next_offset,
+                                            data + skip, length - skip,
+                                            total))
+    return 0;
+  stream->next_offset = offset + length;
+  return 1;
+}
+
+/*
+ * Stream the data of a block to the block data handler, in place of
+ * coap_block_build_body().  Data ahead of what has been passed so far is
+ * copied and held back (coap_block_stream_fits() must have allowed it), and
+ * is passed on once the data before it has arrived.
+ *
+ * Returns 1 if the data has been passed on or held, 0 if the handler has
+ * failed or there is no memory to hold the data.
+ */
+static int
+coap_block_stream_body(coap_session_t *session, const coap_pdu_t *pdu,
+                       coap_rblock_stream_t *stream, const uint8_t *data,
+                       size_t length, size_t offset, size_t total) {
+  coap_rblock_held_t held;
   uint32_t i;
-  uint32_t block = 0;
+  int ret;
 
-  for (i = 0; i < rec_blocks->used; i++) {
-    if (block < rec_blocks->range[i].begin)
+  if (offset > stream->next_offset) {
+    for (i = 0; i < stream->held_count; i++) {
+      if (stream->held[i].offset == offset)
+        return 1;
+    }
+    if (stream->held_count == COAP_BLOCK_STREAM_WINDOW)
+      return 0;
+    held.data = coap_malloc_type(COAP_STRING, length ? length : 1);
+    if (held.data == NULL)
       return 0;
-    if (block < rec_blocks->range[i].end)
-      block = rec_blocks->range[i].end;
+    memcpy(held.data, data, length);
+    held.offset = offset;
+    held.length = length;
+    stream->held[stream->held_count++] = held;
+    return 1;
   }
-  /* total_blocks counts from 1 */
-  if (block + 1 < total_blocks)
+
+  if (!coap_block_stream_pass(session, pdu, stream, data, length, offset,
+                              total))
     return 0;
+  /* Pass on any held blocks that now follow on */
+  for (;;) {
+    for (i = 0; i < stream->held_count; i++) {
+      if (stream->held[i].offset <= stream->next_offset)
+        break;
+    }
+    if (i == stream->held_count)
+      return 1;
+    held = stream->held[i];
+    stream->held[i] = stream->held[--stream->held_count];
+    ret = coap_block_stream_pass(session, pdu, stream, held.data, held.length,
+                                 held.offset, total);
+    coap_free_type(COAP_STRING, held.data);
+    if (!ret)
+      return 0;
+  }
+}
 
-  return 1;
+/*
+ * Take the payload out of a PDU whose body has been streamed, so that the
+ * handler called at the end of the transfer does not see the last block
+ */
+static void
+coap_block_drop_payload(coap_pdu_t *pdu) {
+  if (pdu->data) {
+    pdu->used_size = pdu->data - pdu->token - 1;
+    pdu->data = NULL;
+  }
+  pdu->body_data = NULL;
+  pdu->body_length = 0;
+  pdu->body_offset = 0;
+  pdu->body_total = 0;
 }
 
 #if COAP_SERVER_SUPPORT
+/*
+ * Encodes @p value as a CBOR unsigned integer into @p buf (which must have
+ * space for 5 bytes), returning the number of bytes used
+ */
+static size_t
+coap_cbor_put_uint(uint8_t *buf, uint32_t value) {
+  if (value < 24) {
+    buf[0] = (uint8_t)value;
+    return 1;
+  }
+  if (value <= 0xff) {
+    buf[0] = 0x18;
+    buf[1] = (uint8_t)value;
+    return 2;
+  }
+  if (value <= 0xffff) {
+    buf[0] = 0x19;
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)value;
+    return 3;
+  }
+  buf[0] = 0x1a;
+  buf[1] = (uint8_t)(value >> 24);
+  buf[2] = (uint8_t)(value >> 16);
+  buf[3] = (uint8_t)(value >> 8);
+  buf[4] = (uint8_t)value;
+  return 5;
+}
+
+/*
+ * Tells the client which of the blocks of a Q-Block1 body up to the highest
+ * received are missing (up to MAX_PAYLOADS of them), with a 4.08 response
+ * carrying a CBOR sequence of their numbers
+ */
+static void
+coap_block_q_send_missing(coap_session_t *session, coap_lg_srcv_t *lg_srcv) {
+  uint8_t payload[COAP_MAX_PAYLOADS_LIMIT * 5];
+  uint8_t buf[4];
+  size_t length = 0;
+  uint32_t count = 0;
+  uint32_t num;
+  coap_pdu_t *pdu;
+
+  for (num = coap_rblock_next_missing(&lg_srcv->rec_blocks, 0);
+       num < lg_srcv->rec_blocks.highest && count < COAP_MAX_PAYLOADS(session);
+       num = coap_rblock_next_missing(&lg_srcv->rec_blocks, num + 1)) {
+    length += coap_cbor_put_uint(&payload[length], num);
+    count++;
+  }
+  lg_srcv->rec_blocks.retry++;
+  coap_ticks(&lg_srcv->q_missing);
+
+  pdu = coap_pdu_init(COAP_MESSAGE_NON, COAP_RESPONSE_CODE(408),
+                      coap_new_message_id(session),
+                      coap_session_max_pdu_size(session));
+  if (!pdu)
+    return;
+  if (!coap_add_token(pdu, lg_srcv->last_token_length, lg_srcv->last_token) ||
+      !coap_add_option_internal(pdu, COAP_OPTION_CONTENT_FORMAT,
+                          coap_encode_var_safe(buf, sizeof(buf),
+                                  COAP_MEDIATYPE_APPLICATION_MB_CBOR_SEQ),
+                          buf) ||
+      !coap_add_data(pdu, length, payload)) {
+    coap_delete_pdu(pdu);
+    return;
+  }
+  coap_send_internal(session, pdu);
+}
+
 /*
  * return 1 if there is a future expire time, else 0.
  * update tim_rem with remaining value if return is 1.
@@ -995,20 +1842,50 @@ coap_block_check_lg_srcv_timeouts(coap_session_t *session, coap_tick_t now,
   coap_lg_srcv_t *p;
   coap_lg_srcv_t *q;
   coap_tick_t partial_timeout = COAP_MAX_TRANSMIT_WAIT_TICKS(session);
+  coap_tick_t receive_timeout = COAP_NON_RECEIVE_TIMEOUT_TICKS(session);
+  /* Long enough for a Q-Block1 client to give up repeating the last block */
+  coap_tick_t done_timeout = (COAP_NON_MAX_RETRANSMIT(session) + 1) *
+                             COAP_NON_TIMEOUT_TICKS(session);
   int ret = 0;
 
   *tim_rem = -1;
 
   LL_FOREACH_SAFE(session->lg_srcv, p, q) {
-    if (p->last_used && p->last_used + partial_timeout <= now) {
+    coap_tick_t timeout = p->q_done_code ? done_timeout : partial_timeout;
+
+    if (p->block_option == COAP_OPTION_Q_BLOCK1 && !p->q_done_code &&
+        coap_rblock_next_missing(&p->rec_blocks, 0) <
+                                                   p->rec_blocks.highest) {
+      /* Ask for the missing blocks once they have stopped arriving */
+      coap_tick_t due = p->rec_blocks.last_seen > p->q_missing ?
+                        p->rec_blocks.last_seen : p->q_missing;
+
+      due += receive_timeout;
+      if (due <= now) {
+        if (p->rec_blocks.retry >= COAP_NON_MAX_RETRANSMIT(session)) {
+          LL_DELETE(session->lg_srcv, p);
+          coap_block_delete_lg_srcv(session, p);
+          coap_handle_event(session->context, COAP_EVENT_PARTIAL_BLOCK,
+                            session);
+          continue;
+        }
+        coap_block_q_send_missing(session, p);
+        due = p->q_missing + receive_timeout;
+      }
+      if (*tim_rem > due - now) {
+        *tim_rem = due - now;
+        ret = 1;
+      }
+    }
+    if (p->last_used && p->last_used + timeout <= now) {
       /* Expire this entry */
       LL_DELETE(session->lg_srcv, p);
       coap_block_delete_lg_srcv(session, p);
     }
     else if (p->last_used) {
       /* Delay until the lg_srcv needs to expire */
-      if (*tim_rem > p->last_used + partial_timeout - now) {
-        *tim_rem = p->last_used + partial_timeout - now;
+      if (*tim_rem > p->last_used + timeout - now) {
+        *tim_rem = p->last_used + timeout - now;
         ret = 1;
       }
     }
@@ -1065,6 +1942,7 @@ coap_block_new_lg_crcv(coap_session_t *session, coap_pdu_t *pdu) {
 
   /* In case it is there - must not be in continuing request PDUs */
   coap_remove_option(&lg_crcv->pdu, COAP_OPTION_BLOCK1);
+  coap_remove_option(&lg_crcv->pdu, COAP_OPTION_Q_BLOCK1);
 
   return lg_crcv;
 }
@@ -1078,6 +1956,8 @@ coap_block_delete_lg_crcv(coap_session_t *session,
   if (lg_crcv->pdu.token)
     coap_free_type(COAP_PDU_BUF, lg_crcv->pdu.token - lg_crcv->pdu.max_hdr_size);
   coap_free_type(COAP_STRING, lg_crcv->body_data);
+  coap_block_delete_stream(lg_crcv->stream);
+  coap_rblock_clear(&lg_crcv->rec_blocks);
   coap_log(LOG_DEBUG, "** %s: lg_crcv %p released\n",
            coap_session_str(session), (void*)lg_crcv);
   coap_delete_binary(lg_crcv->app_token);
@@ -1095,6 +1975,8 @@ coap_block_delete_lg_srcv(coap_session_t *session,
 
   coap_delete_str_const(lg_srcv->uri_path);
   coap_free_type(COAP_STRING, lg_srcv->body_data);
+  coap_block_delete_stream(lg_srcv->stream);
+  coap_rblock_clear(&lg_srcv->rec_blocks);
   coap_log(LOG_DEBUG, "** %s: lg_srcv %p released\n",
          coap_session_str(session), (void*)lg_srcv);
   coap_free_type(COAP_LG_SRCV, lg_srcv);
@@ -1129,23 +2011,20 @@ add_block_send(uint32_t num, uint32_t *out_blocks,
                           uint32_t *count, uint32_t max_count) {
   uint32_t i;
 
-  for (i = 0; i < *count && *count < max_count; i++) {
+  /* Keep out_blocks in order, without duplicates */
+  for (i = 0; i < *count; i++) {
     if (num == out_blocks[i])
       return 0;
-    else if (num < out_blocks[i]) {
-      if (*count - i > 1)
-        memmove(&out_blocks[i], &out_blocks[i+1], *count - i -1);
-      out_blocks[i] = num;
-      (*count)++;
-      return 1;
-    }
-  }
-  if (*count < max_count) {
-    out_blocks[i] = num;
-    (*count)++;
-    return 1;
+    if (num < out_blocks[i])
+      break;
   }
-  return 0;
+  if (*count >= max_count)
+    return 0;
+  memmove(&out_blocks[i + 1], &out_blocks[i],
+          (*count - i) * sizeof(out_blocks[0]));
+  out_blocks[i] = num;
+  (*count)++;
+  return 1;
 }
 
 /*
@@ -1160,6 +2039,10 @@ add_block_send(uint32_t num, uint32_t *out_blocks,
  *
  * Server is sending a large data response to GET / observe (Block2)
  *
+ * With Q-Block2, the request can ask for a number of missing blocks, or for
+ * the next set of blocks to be sent (a block with the M bit set), all of
+ * which are sent with the token of the request.
+ *
  * Return: 0 Call application handler
  *         1 Do not call application handler - just send the built response
  */
@@ -1172,19 +2055,25 @@ coap_handle_request_send_block(coap_session_t *session,
   coap_lg_xmit_t *p = NULL;
   coap_block_b_t block;
   uint16_t block_opt = 0;
-  uint32_t out_blocks[1];
+  uint32_t out_blocks[COAP_MAX_PAYLOADS_LIMIT];
   const char *error_phrase;
+  coap_opt_iterator_t opt_iter;
 
-  if (!coap_get_block_b(session, pdu, COAP_OPTION_BLOCK2, &block))
+  if (coap_get_block_b(session, pdu, COAP_OPTION_BLOCK2, &block))
+    block_opt = COAP_OPTION_BLOCK2;
+  else if (q_block_usable(session) &&
+           coap_get_block_b(session, pdu, COAP_OPTION_Q_BLOCK2, &block))
+    block_opt = COAP_OPTION_Q_BLOCK2;
+  else
     return 0;
-  if (block.num == 0) {
+  if (block.num == 0 && (block_opt == COAP_OPTION_BLOCK2 ||
+                         !coap_check_option(pdu, COAP_OPTION_ETAG,
+                                            &opt_iter))) {
     /* Get a fresh copy of the data */
     return 0;
   }
-  block_opt = COAP_OPTION_BLOCK2;
   LL_FOREACH(session->lg_xmit, p) {
     size_t chunk;
-    coap_opt_iterator_t opt_iter;
     coap_opt_iterator_t opt_b_iter;
     coap_opt_t *option;
     uint32_t request_cnt, i;
@@ -1192,7 +2081,8 @@ coap_handle_request_send_block(coap_session_t *session,
     coap_pdu_t *out_pdu = response;
     static coap_string_t empty = { 0, NULL};
 
-    if (COAP_PDU_IS_REQUEST(&p->pdu) || resource != p->b.b2.resource ||
+    if (COAP_PDU_IS_REQUEST(&p->pdu) || p->option != block_opt ||
+        resource != p->b.b2.resource ||
         pdu->code != p->b.b2.request_method ||
         !coap_string_equal(query ? query : &empty,
                            p->b.b2.query ? p->b.b2.query : &empty)) {
@@ -1201,7 +2091,20 @@ coap_handle_request_send_block(coap_session_t *session,
     }
     p->last_all_sent = 0;
     etag_opt = coap_check_option(pdu, COAP_OPTION_ETAG, &opt_iter);
-    if (etag_opt) {
+    if (etag_opt && block_opt == COAP_OPTION_Q_BLOCK2) {
+      /* Asking for more of the body that was sent with this ETag */
+      coap_opt_t *sent_etag = coap_check_option(&p->pdu, COAP_OPTION_ETAG,
+                                                &opt_iter);
+
+      if (!sent_etag ||
+          !full_match(coap_opt_value(etag_opt), coap_opt_length(etag_opt),
+                      coap_opt_value(sent_etag), coap_opt_length(sent_etag))) {
+        /* try out the next one */
+        continue;
+      }
+      out_pdu->code = p->pdu.code;
+    }
+    else if (etag_opt) {
       uint64_t etag = coap_decode_var_bytes8(coap_opt_value(etag_opt),
                                             coap_opt_length(etag_opt));
       if (etag != p->b.b2.etag) {
@@ -1230,7 +2133,8 @@ coap_handle_request_send_block(coap_session_t *session,
                  "found Block option, block size is %u, block nr. %u\n",
                  1 << (block.szx + 4), block.num);
       }
-      if (block.bert == 0 && block.szx != p->blk_size) {
+      if (block.bert == 0 && block.szx != p->blk_size &&
+          block_opt == COAP_OPTION_BLOCK2) {
         if ((p->offset + chunk) % ((size_t)1 << (block.szx + 4)) == 0) {
           /*
            * Recompute the block number of the previous packet given
@@ -1271,8 +2175,23 @@ coap_handle_request_send_block(coap_session_t *session,
         response->code = COAP_RESPONSE_CODE(400);
         return 1;
       }
-      add_block_send(num, out_blocks, &request_cnt, 1);
-      break;
+      if (block_opt == COAP_OPTION_BLOCK2) {
+        add_block_send(num, out_blocks, &request_cnt, 1);
+        break;
+      }
+      else {
+        uint32_t total = coap_lg_xmit_blocks(p);
+        uint16_t max_payloads = COAP_MAX_PAYLOADS(session);
+        /* M bit set asks for the rest of the set that num starts */
+        uint32_t last = COAP_OPT_BLOCK_MORE(option) ?
+                        (num / max_payloads + 1) * max_payloads - 1 : num;
+
+        for (; num <= last && num < total; num++) {
+          if (!add_block_send(num, out_blocks, &request_cnt, max_payloads) &&
+              request_cnt == max_payloads)
+            break;
+        }
+      }
     }
     if (request_cnt == 0) {
       /* Block2 not found - give them the first block */
@@ -1365,10 +2284,7 @@ coap_handle_request_send_block(coap_session_t *session,
         }
       }
 
-      if (!etag_opt && !coap_add_block_b_data(out_pdu,
-                                              p->length,
-                                              p->data,
-                                              &block)) {
+      if (!coap_add_lg_xmit_block(session, out_pdu, p, &block)) {
         goto internal_issue;
       }
       if (i + 1 < request_cnt) {
@@ -1376,6 +2292,14 @@ coap_handle_request_send_block(coap_session_t *session,
         coap_send_internal(session, out_pdu);
       }
     }
+    if (block_opt == COAP_OPTION_Q_BLOCK2) {
+      /* Any more sets follow on from here with the latest token */
+      if (p->q_next < out_blocks[request_cnt - 1] + 1)
+        p->q_next = out_blocks[request_cnt - 1] + 1;
+      p->q_token_length = (uint8_t)pdu->token_length;
+      memcpy(p->q_token, pdu->token, pdu->token_length);
+      p->q_retry = 0;
+    }
     coap_ticks(&p->last_payload);
     goto skip_app_handler;
 
@@ -1396,61 +2320,6 @@ skip_app_handler:
 }
 #endif /* COAP_SERVER_SUPPORT */
 
-static int
-update_received_blocks(coap_rblock_t *rec_blocks, uint32_t block_num) {
-  uint32_t i;
-
-  /* Reset as there is activity */
-  rec_blocks->retry = 0;
-
-  for (i = 0; i < rec_blocks->used; i++) {
-    if (block_num >= rec_blocks->range[i].begin &&
-        block_num <= rec_blocks->range[i].end)
-      break;
-
-    if (block_num < rec_blocks->range[i].begin) {
-      if (block_num + 1 == rec_blocks->range[i].begin) {
-        rec_blocks->range[i].begin = block_num;
-      }
-      else {
-        /* Need to insert a new range */
-        if (rec_blocks->used == COAP_RBLOCK_CNT -1)
-          /* Too many losses */
-          return 0;
-        memmove(&rec_blocks->range[i+1], &rec_blocks->range[i],
-                (rec_blocks->used - i) * sizeof (rec_blocks->range[0]));
-        rec_blocks->range[i].begin = rec_blocks->range[i].end = block_num;
-        rec_blocks->used++;
-      }
-      break;
-    }
-    if (block_num == rec_blocks->range[i].end + 1) {
-      rec_blocks->range[i].end = block_num;
-      if (i + 1 < rec_blocks->used) {
-        if (rec_blocks->range[i+1].begin == block_num + 1) {
-          /* Merge the 2 ranges */
-          rec_blocks->range[i].end = rec_blocks->range[i+1].end;
-          if (i+2 < rec_blocks->used) {
-            memmove (&rec_blocks->range[i+1], &rec_blocks->range[i+2],
-                   (rec_blocks->used - (i+2)) * sizeof (rec_blocks->range[0]));
-          }
-          rec_blocks->used--;
-        }
-      }
-      break;
-    }
-  }
-  if (i == rec_blocks->used) {
-    if (rec_blocks->used == COAP_RBLOCK_CNT -1)
-      /* Too many losses */
-      return 0;
-    rec_blocks->range[i].begin = rec_blocks->range[i].end = block_num;
-    rec_blocks->used++;
-  }
-  coap_ticks(&rec_blocks->last_seen);
-  return 1;
-}
-
 #if COAP_SERVER_SUPPORT
 /*
  * Need to check if this is a large PUT / POST using multiple blocks
@@ -1478,6 +2347,7 @@ coap_handle_request_put_block(coap_context_t *context,
   coap_block_b_t block;
   coap_opt_iterator_t opt_iter;
   uint16_t block_option = 0;
+  int q_block = 0;
 
   coap_get_data_large(pdu, &length, &data, &offset, &total);
   pdu->body_offset = 0;
@@ -1486,6 +2356,12 @@ coap_handle_request_put_block(coap_context_t *context,
   if (coap_get_block_b(session, pdu, COAP_OPTION_BLOCK1, &block)) {
     block_option = COAP_OPTION_BLOCK1;
   }
+  else if (q_block_usable(session) &&
+           coap_get_block_b(session, pdu, COAP_OPTION_Q_BLOCK1, &block)) {
+    /* Blocks of a Q-Block1 body can arrive in any order */
+    block_option = COAP_OPTION_Q_BLOCK1;
+    q_block = 1;
+  }
   if (block_option) {
     coap_lg_srcv_t *p;
     coap_opt_t *size_opt = coap_check_option(pdu,
@@ -1523,7 +2399,23 @@ coap_handle_request_put_block(coap_context_t *context,
           coap_string_equal(uri_path, p->uri_path))
         break;
     }
-    if (!p && block.num != 0) {
+    if (p && p->q_done_code) {
+      if (block.num == 0 && !rtag_opt) {
+        /* The start of a new body */
+        LL_DELETE(session->lg_srcv, p);
+        coap_block_delete_lg_srcv(session, p);
+        p = NULL;
+      }
+      else {
+        /*
+         * The whole body has been handled.  The client repeats the last
+         * block if it has not seen the final response.
+         */
+        response->code = block.m ? 0 : p->q_done_code;
+        goto skip_app_handler;
+      }
+    }
+    if (!p && block.num != 0 && !q_block) {
       /* random access - no need to track */
       pdu->body_data = data;
       pdu->body_length = length;
@@ -1576,16 +2468,45 @@ coap_handle_request_put_block(coap_context_t *context,
       p->last_type = pdu->type;
       memcpy(p->last_token, pdu->token, pdu->token_length);
       p->last_token_length = pdu->token_length;
-      if ((session->block_mode & COAP_BLOCK_SINGLE_BODY) || block.bert) {
+      if ((session->block_mode & COAP_BLOCK_SINGLE_BODY) || block.bert ||
+          context->block_data_handler || q_block) {
         size_t chunk = (size_t)1 << (block.szx + 4);
         int update_data = 0;
         unsigned int saved_num = block.num;
         size_t saved_offset = offset;
 
+        if (context->block_data_handler) {
+          if (!p->stream) {
+            p->stream = coap_block_new_stream();
+            if (!p->stream) {
+              coap_add_data(response, sizeof("Memory issue")-1,
+                            (const uint8_t *)"Memory issue");
+              response->code = COAP_RESPONSE_CODE(500);
+              goto free_lg_srcv;
+            }
+          }
+          if (!coap_block_stream_fits(p->stream, offset, chunk)) {
+            if (q_block) {
+              /* Dropped, to be asked for again once it fits */
+              response->code = 0;
+              goto skip_app_handler;
+            }
+            /* Too far ahead to hold back - not acknowledged */
+            coap_add_data(response, sizeof("Block out of window")-1,
+                          (const uint8_t *)"Block out of window");
+            response->code = COAP_RESPONSE_CODE(408);
+            goto skip_app_handler;
+          }
+        }
+        if (q_block) {
+          coap_ticks(&p->last_used);
+          if (!block.m)
+            p->total_len = saved_offset + length;
+        }
         while (offset < saved_offset + length) {
-          if (!check_if_received_block(&p->rec_blocks, block.num)) {
+          if (!coap_rblock_has(&p->rec_blocks, block.num)) {
             /* Update list of blocks received */
-            if (!update_received_blocks(&p->rec_blocks, block.num)) {
+            if (!coap_rblock_add(&p->rec_blocks, block.num)) {
               coap_handle_event(context, COAP_EVENT_PARTIAL_BLOCK, session);
               coap_add_data(response, sizeof("Too many missing blocks")-1,
                             (const uint8_t *)"Too many missing blocks");
@@ -1598,7 +2519,17 @@ coap_handle_request_put_block(coap_context_t *context,
           offset = block.num << (block.szx + 4);
         }
         block.num--;
-        if (update_data) {
+        if (update_data && context->block_data_handler) {
+          /* Stream the data to the application */
+          if (!coap_block_stream_body(session, pdu, p->stream, data, length,
+                                      saved_offset, p->total_len)) {
+            coap_add_data(response, sizeof("Block data not consumed")-1,
+                          (const uint8_t *)"Block data not consumed");
+            response->code = COAP_RESPONSE_CODE(500);
+            goto free_lg_srcv;
+          }
+        }
+        else if (update_data) {
           /* Update saved data */
           p->body_data = coap_block_build_body(p->body_data, length, data,
                                                saved_offset, p->total_len);
@@ -1606,10 +2537,37 @@ coap_handle_request_put_block(coap_context_t *context,
             goto call_app_handler;
 
         }
-        if (block.m ||
-            !check_all_blocks_in(&p->rec_blocks,
-                                (uint32_t)(p->total_len + chunk -1)/chunk)) {
+        if ((q_block ? p->total_len == 0 : block.m) ||
+            !coap_rblock_all_in(&p->rec_blocks,
+                                (uint32_t)(p->total_len + chunk -1)/chunk) ||
+            (p->stream && p->stream->held_count)) {
           /* Not all the payloads of the body have arrived */
+          if (q_block) {
+            uint8_t buf[4];
+
+            /* Track the end of the latest set of blocks sent */
+            if (!block.m ||
+                (saved_num + 1) % COAP_MAX_PAYLOADS(session) == 0) {
+              if (p->q_set_end < saved_num + 1)
+                p->q_set_end = saved_num + 1;
+            }
+            if (p->q_set_end > p->q_acked &&
+                coap_rblock_next_missing(&p->rec_blocks, 0) >= p->q_set_end) {
+              /* Ask for the next set of blocks */
+              coap_insert_option(response, block_option,
+                                 coap_encode_var_safe(buf, sizeof(buf),
+                                   ((p->q_set_end - 1) << 4) |
+                                   (1 << 3) |
+                                   block.aszx),
+                                 buf);
+              response->code = COAP_RESPONSE_CODE(231);
+              p->q_acked = p->q_set_end;
+            }
+            else {
+              response->code = 0;
+            }
+            goto skip_app_handler;
+          }
           if (block.m) {
             uint8_t buf[4];
 
@@ -1636,10 +2594,16 @@ coap_handle_request_put_block(coap_context_t *context,
                              p->observe_length, p->observe);
         }
         coap_remove_option(pdu, block_option);
-        pdu->body_data = p->body_data->s;
-        pdu->body_length = p->total_len;
-        pdu->body_offset = 0;
-        pdu->body_total = p->total_len;
+        if (context->block_data_handler) {
+          /* All the data has already been passed on */
+          coap_block_drop_payload(pdu);
+        }
+        else {
+          pdu->body_data = p->body_data->s;
+          pdu->body_length = p->total_len;
+          pdu->body_offset = 0;
+          pdu->body_total = p->total_len;
+        }
         coap_log(LOG_DEBUG, "Server app version of updated PDU\n");
         coap_show_pdu(LOG_DEBUG, pdu);
         coap_log(LOG_DEBUG, "call custom handler for resource '%*.*s'\n",
@@ -1654,6 +2618,16 @@ coap_handle_request_put_block(coap_context_t *context,
             coap_check_option(response, COAP_OPTION_ECHO, &opt_iter)) {
           /* Need to keep lg_srcv around for client's response */
           goto skip_app_handler;
+        } else if (q_block) {
+          /* Keep to answer any repeat of the last block */
+          p->q_done_code = response->code ? response->code :
+                                            COAP_RESPONSE_CODE(204);
+          coap_free_type(COAP_STRING, p->body_data);
+          p->body_data = NULL;
+          coap_block_delete_stream(p->stream);
+          p->stream = NULL;
+          coap_ticks(&p->last_used);
+          goto skip_app_handler;
         } else {
           /* Last chunk - lg_srcv no longer needed */
           goto free_lg_srcv;
@@ -1732,6 +2706,8 @@ check_freshness(coap_session_t *session, coap_pdu_t *rcvd, coap_pdu_t *sent,
       coap_mid_t mid;
       const uint8_t *data;
       size_t data_len;
+      size_t data_offset = 0;
+      coap_get_large_data_t get_func = NULL;
       int have_data = 0;
       uint8_t ltoken[8];
       size_t ltoken_len;
@@ -1746,7 +2722,9 @@ check_freshness(coap_session_t *session, coap_pdu_t *rcvd, coap_pdu_t *sent,
           size_t blk_size = (size_t)1 << (lg_xmit->blk_size + 4);
           size_t offset = (lg_xmit->last_block + 1) * blk_size;
           have_data = 1;
-          data = &lg_xmit->data[offset];
+          data = lg_xmit->data;
+          data_offset = offset;
+          get_func = lg_xmit->get_func;
           data_len = (lg_xmit->length - offset) > blk_size ? blk_size :
                                                    lg_xmit->length - offset;
         }
@@ -1770,7 +2748,9 @@ check_freshness(coap_session_t *session, coap_pdu_t *rcvd, coap_pdu_t *sent,
                               coap_opt_length(opt), coap_opt_value(opt)))
         goto not_sent;
       if (have_data) {
-        coap_add_data(echo_pdu, data_len, data);
+        coap_add_large_data(session, echo_pdu, data, get_func,
+                            get_func ? lg_xmit->app_ptr : NULL,
+                            data_offset, data_len);
       }
 
       mid = coap_send_internal(session, echo_pdu);
@@ -1801,6 +2781,103 @@ track_echo(coap_session_t *session, coap_pdu_t *rcvd)
   }
 }
 
+/*
+ * Decodes a CBOR unsigned integer from the front of @p data, moving @p data
+ * and @p length on past it.  Returns 0 if there is not one there.
+ */
+static int
+coap_cbor_get_uint(const uint8_t **data, size_t *length, uint32_t *value) {
+  size_t bytes;
+  size_t i;
+
+  if (*length == 0 || ((*data)[0] & 0xe0) != 0)
+    return 0;
+  switch ((*data)[0]) {
+  case 0x18:
+    bytes = 1;
+    break;
+  case 0x19:
+    bytes = 2;
+    break;
+  case 0x1a:
+    bytes = 4;
+    break;
+  default:
+    if ((*data)[0] >= 24)
+      return 0;
+    *value = (*data)[0];
+    (*data)++;
+    (*length)--;
+    return 1;
+  }
+  if (*length < bytes + 1)
+    return 0;
+  *value = 0;
+  for (i = 1; i <= bytes; i++)
+    *value = (*value << 8) | (*data)[i];
+  *data += bytes + 1;
+  *length -= bytes + 1;
+  return 1;
+}
+
+/*
+ * Returns 1 if @p pdu is a 4.08 response listing the blocks of a Q-Block1
+ * body that the server is missing
+ */
+static int
+coap_is_missing_blocks(const coap_pdu_t *pdu) {
+  coap_opt_iterator_t opt_iter;
+  coap_opt_t *fmt_opt;
+
+  if (pdu->code != COAP_RESPONSE_CODE(408))
+    return 0;
+  fmt_opt = coap_check_option(pdu, COAP_OPTION_CONTENT_FORMAT, &opt_iter);
+  return fmt_opt &&
+         coap_decode_var_bytes(coap_opt_value(fmt_opt),
+                               coap_opt_length(fmt_opt)) ==
+           COAP_MEDIATYPE_APPLICATION_MB_CBOR_SEQ;
+}
+
+/*
+ * Returns 1 if @p pdu is a 2.31 or 4.08 response pacing the sending of a
+ * Q-Block1 body, which are of no interest once the body has been sent
+ */
+static int
+coap_is_q_block1_control(const coap_session_t *session,
+                         const coap_pdu_t *pdu) {
+  coap_opt_iterator_t opt_iter;
+
+  if (!q_block_usable(session))
+    return 0;
+  return (pdu->code == COAP_RESPONSE_CODE(231) &&
+          coap_check_option(pdu, COAP_OPTION_Q_BLOCK1, &opt_iter)) ||
+         coap_is_missing_blocks(pdu);
+}
+
+/*
+ * Sends again the blocks of a Q-Block1 body that a 4.08 response says are
+ * missing
+ */
+static void
+coap_block_q_resend_missing(coap_session_t *session, coap_lg_xmit_t *lg_xmit,
+                            const coap_pdu_t *rcvd) {
+  uint32_t total = coap_lg_xmit_blocks(lg_xmit);
+  uint16_t max_payloads = COAP_MAX_PAYLOADS(session);
+  const uint8_t *data;
+  size_t length;
+  uint32_t num;
+  uint32_t count = 0;
+
+  if (!coap_get_data(rcvd, &length, &data))
+    return;
+  while (count < max_payloads && coap_cbor_get_uint(&data, &length, &num)) {
+    if (num < total && coap_block_send_q_block(session, lg_xmit, num))
+      count++;
+  }
+  lg_xmit->q_retry = 0;
+  coap_ticks(&lg_xmit->last_payload);
+}
+
 /*
  * Need to see if this is a response to a large body request transfer. If so,
  * need to initiate the request containing the next block and not trouble the
@@ -1837,6 +2914,23 @@ coap_handle_response_send_block(coap_session_t *session, coap_pdu_t *sent,
     size_t chunk = (size_t)1 << (p->blk_size + 4);
     coap_block_b_t block;
 
+    if (p->option == COAP_OPTION_Q_BLOCK1) {
+      if (rcvd->code == COAP_RESPONSE_CODE(231) &&
+          coap_get_block_b(session, rcvd, p->option, &block)) {
+        /* The server has all the blocks up to block.num */
+        track_echo(session, rcvd);
+        p->q_retry = 0;
+        if (p->last_block < (int)block.num)
+          p->last_block = block.num;
+        if (p->q_next <= block.num + 1 && p->q_next < coap_lg_xmit_blocks(p))
+          coap_block_send_q_set(session, p);
+        return 1;
+      }
+      if (coap_is_missing_blocks(rcvd)) {
+        coap_block_q_resend_missing(session, p, rcvd);
+        return 1;
+      }
+    }
     if (COAP_RESPONSE_CLASS(rcvd->code) == 2 &&
         coap_get_block_b(session, rcvd, p->option, &block)) {
 
@@ -1917,10 +3011,7 @@ coap_handle_response_send_block(coap_session_t *session, coap_pdu_t *sent,
                              block.aszx),
                            buf);
 
-        if (!coap_add_block_b_data(pdu,
-                                   p->length,
-                                   p->data,
-                                   &block))
+        if (!coap_add_lg_xmit_block(session, pdu, p, &block))
           goto fail_body;
         p->b.b1.bert_size = block.chunk_size;
         coap_ticks(&p->last_sent);
@@ -2032,6 +3123,7 @@ coap_handle_response_get_block(coap_context_t *context,
   int app_has_response = 0;
   coap_block_b_t block;
   int have_block = 0;
+  int q_block = 0;
   uint16_t block_opt = 0;
   size_t offset;
   uint64_t token_match = STATE_TOKEN_BASE(coap_decode_var_bytes8(rcvd->token,
@@ -2052,6 +3144,10 @@ coap_handle_response_get_block(coap_context_t *context,
 
     /* lg_crcv found */
 
+    if (coap_is_q_block1_control(session, rcvd)) {
+      /* Left over from sending a Q-Block1 body */
+      goto skip_app_handler;
+    }
     if (COAP_RESPONSE_CLASS(rcvd->code) == 2) {
       size_t length;
       const uint8_t *data;
@@ -2069,6 +3165,16 @@ coap_handle_response_get_block(coap_context_t *context,
         have_block = 1;
         block_opt = COAP_OPTION_BLOCK2;
       }
+      else if (q_block_usable(session) &&
+               coap_get_block_b(session, rcvd, COAP_OPTION_Q_BLOCK2, &block)) {
+        have_block = 1;
+        block_opt = COAP_OPTION_Q_BLOCK2;
+        q_block = 1;
+        if (p->q_done) {
+          /* A repeat of a block of a body already handled */
+          goto skip_app_handler;
+        }
+      }
       track_echo(session, rcvd);
       if (have_block && (block.m || length)) {
         coap_opt_t *fmt_opt = coap_check_option(rcvd,
@@ -2110,7 +3216,8 @@ coap_handle_response_get_block(coap_context_t *context,
           p->szx = block.szx;
           p->block_option = block_opt;
           p->last_type = rcvd->type;
-          p->rec_blocks.used = 0;
+          coap_rblock_clear(&p->rec_blocks);
+          coap_block_reset_stream(p->stream);
         }
         if (p->total_len < size2)
           p->total_len = size2;
@@ -2185,11 +3292,21 @@ coap_handle_response_get_block(coap_context_t *context,
             p->observe_set = 0;
           }
         }
+        if (context->block_data_handler) {
+          if (!p->stream) {
+            p->stream = coap_block_new_stream();
+            if (!p->stream)
+              goto fail_resp;
+          }
+          if (!coap_block_stream_fits(p->stream, offset, chunk))
+            /* Too far ahead to hold back */
+            goto skip_app_handler;
+        }
         updated_block = 0;
         while (offset < saved_offset + length) {
-          if (!check_if_received_block(&p->rec_blocks, block.num)) {
+          if (!coap_rblock_has(&p->rec_blocks, block.num)) {
             /* Update list of blocks received */
-            if (!update_received_blocks(&p->rec_blocks, block.num)) {
+            if (!coap_rblock_add(&p->rec_blocks, block.num)) {
               coap_handle_event(context, COAP_EVENT_PARTIAL_BLOCK, session);
               goto fail_resp;
             }
@@ -2202,7 +3319,18 @@ coap_handle_response_get_block(coap_context_t *context,
         }
         block.num--;
         if (updated_block) {
-          if ((session->block_mode & COAP_BLOCK_SINGLE_BODY) || block.bert) {
+          if (context->block_data_handler) {
+            /* Stream the data to the application with the original token */
+            coap_update_token(rcvd, p->app_token->length, p->app_token->s);
+            (void)coap_get_data(rcvd, &length, &data);
+            if (!coap_block_stream_body(session, rcvd, p->stream, data, length,
+                                        saved_offset, size2)) {
+              coap_handle_event(context, COAP_EVENT_PARTIAL_BLOCK, session);
+              goto expire_lg_crcv;
+            }
+          }
+          else if ((session->block_mode & COAP_BLOCK_SINGLE_BODY) ||
+                   block.bert || q_block) {
             p->body_data = coap_block_build_body(p->body_data, length, data,
                                                  saved_offset, size2);
             if (p->body_data == NULL) {
@@ -2211,14 +3339,38 @@ coap_handle_response_get_block(coap_context_t *context,
               goto block_mode;
             }
           }
-          if (block.m || !check_all_blocks_in(&p->rec_blocks,
-                                              (size2 + chunk -1) / chunk)) {
+          if ((!q_block && block.m) ||
+              !coap_rblock_all_in(&p->rec_blocks,
+                                  ((q_block ? p->total_len : size2) +
+                                   chunk -1) / chunk) ||
+              (p->stream && p->stream->held_count)) {
             /* Not all the payloads of the body have arrived */
             size_t len;
             coap_pdu_t *pdu;
             uint64_t token;
 
-            if (block.m) {
+            if (q_block) {
+              uint32_t total = (uint32_t)((p->total_len + chunk - 1) / chunk);
+              uint32_t next_set;
+
+              /* Track the end of the latest set of blocks sent */
+              if (!block.m ||
+                  (block.num + 1) % COAP_MAX_PAYLOADS(session) == 0) {
+                if (p->q_set_end < block.num + 1)
+                  p->q_set_end = block.num + 1;
+              }
+              if (p->q_set_end > p->q_continue && p->q_set_end < total &&
+                  coap_rblock_next_missing(&p->rec_blocks, 0) >=
+                                                            p->q_set_end) {
+                /* Ask for the next set of blocks */
+                next_set = p->q_set_end;
+                p->q_continue = next_set;
+                if (!coap_block_send_q_block2_request(session, p, &next_set,
+                                                      1, 1))
+                  goto fail_resp;
+              }
+            }
+            else if (block.m) {
               block.m = 0;
 
               /* Ask for the next block */
@@ -2243,7 +3395,8 @@ coap_handle_response_get_block(coap_context_t *context,
               if (coap_send_internal(session, pdu) == COAP_INVALID_MID)
                 goto fail_resp;
             }
-            if (session->block_mode & (COAP_BLOCK_SINGLE_BODY) || block.bert)
+            if (session->block_mode & (COAP_BLOCK_SINGLE_BODY) || block.bert ||
+                context->block_data_handler || q_block)
               goto skip_app_handler;
 
             /* need to put back original token into rcvd */
@@ -2254,17 +3407,28 @@ coap_handle_response_get_block(coap_context_t *context,
           }
           /* need to put back original token into rcvd */
           coap_update_token(rcvd, p->app_token->length, p->app_token->s);
-          if (session->block_mode & (COAP_BLOCK_SINGLE_BODY) || block.bert) {
+          if (session->block_mode & (COAP_BLOCK_SINGLE_BODY) || block.bert ||
+              context->block_data_handler || q_block) {
             /* Pretend that there is no block */
             coap_remove_option(rcvd, block_opt);
             if (p->observe_set) {
               coap_update_option(rcvd, COAP_OPTION_OBSERVE,
                                  p->observe_length, p->observe);
             }
-            rcvd->body_data = p->body_data->s;
-            rcvd->body_length = saved_offset + length;
-            rcvd->body_offset = 0;
-            rcvd->body_total = rcvd->body_length;
+            if (context->block_data_handler) {
+              /* All the data has already been passed on */
+              coap_block_drop_payload(rcvd);
+            }
+            else {
+              rcvd->body_data = p->body_data->s;
+              /* Q-Block2 blocks can complete the body in any order */
+              rcvd->body_length = q_block ? p->total_len :
+                                            saved_offset + length;
+              rcvd->body_offset = 0;
+              rcvd->body_total = rcvd->body_length;
+            }
+            if (q_block)
+              p->q_done = 1;
           }
           else {
             rcvd->body_offset = saved_offset;
@@ -2284,7 +3448,7 @@ coap_handle_response_get_block(coap_context_t *context,
             coap_free_type(COAP_STRING, p->body_data);
             p->body_data = NULL;
           }
-          else {
+          else if (!context->block_data_handler) {
             goto skip_app_handler;
           }
         }
@@ -2344,7 +3508,7 @@ block_mode:
       /* Not 2.xx or 4.01 - assume it is a failure of some sort */
       goto expire_lg_crcv;
     }
-    if (!block.m && !p->observe_set) {
+    if ((!block.m || p->q_done) && !p->observe_set) {
 fail_resp:
       /* lg_crcv no longer required - cache it for 1 sec */
       coap_ticks(&p->last_used);
@@ -2359,11 +3523,19 @@ fail_resp:
   /* Check if receiving a block response and if blocks can be set up */
   if (recursive == COAP_RECURSE_OK && !p) {
     if (!sent) {
+      coap_opt_iterator_t opt_iter;
+
       if (coap_get_block_b(session, rcvd, COAP_OPTION_BLOCK2, &block)) {
         coap_log(LOG_DEBUG, "** %s: large body receive internal issue\n",
                  coap_session_str(session));
         goto skip_app_handler;
       }
+      if (q_block_usable(session) &&
+          (coap_check_option(rcvd, COAP_OPTION_Q_BLOCK2, &opt_iter) ||
+           coap_is_q_block1_control(session, rcvd))) {
+        /* Left over from a Q-Block transfer that has completed */
+        goto skip_app_handler;
+      }
     }
     else if (COAP_RESPONSE_CLASS(rcvd->code) == 2) {
       if (coap_get_block_b(session, rcvd, COAP_OPTION_BLOCK2, &block)) {
@@ -70,42 +70,195 @@ coap_cache_ignore_options(coap_context_t *ctx,
   return 1;
 }
 
-coap_cache_key_t *
-coap_cache_derive_key_w_ignore(const coap_session_t *session,
-                               const coap_pdu_t *pdu,
-                               coap_cache_session_based_t session_based,
-                               const uint16_t *cache_ignore_options,
-                               size_t cache_ignore_count) {
+/*
+ * SipHash-2-4 with a 128 bit result, see
+ * https://github.com/veorq/SipHash, updated a chunk at a time.
+ */
+typedef struct coap_siphash_t {
+  uint64_t v0, v1, v2, v3;
+  uint64_t tail;          /* Bytes not yet making up a whole word */
+  size_t length;          /* Number of bytes hashed so far */
+} coap_siphash_t;
+
+#define SIP_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(s)                                                   \
+  do {                                                                 \
+    (s)->v0 += (s)->v1; (s)->v1 = SIP_ROTL((s)->v1, 13);               \
+    (s)->v1 ^= (s)->v0; (s)->v0 = SIP_ROTL((s)->v0, 32);               \
+    (s)->v2 += (s)->v3; (s)->v3 = SIP_ROTL((s)->v3, 16);               \
+    (s)->v3 ^= (s)->v2;                                                \
+    (s)->v0 += (s)->v3; (s)->v3 = SIP_ROTL((s)->v3, 21);               \
+    (s)->v3 ^= (s)->v0;                                                \
+    (s)->v2 += (s)->v1; (s)->v1 = SIP_ROTL((s)->v1, 17);               \
+    (s)->v1 ^= (s)->v2; (s)->v2 = SIP_ROTL((s)->v2, 32);               \
+  } while (0)
+
+static uint64_t
+coap_siphash_load(const uint8_t *p) {
+  return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+         (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+         (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static void
+coap_siphash_init(coap_siphash_t *s, const uint8_t seed[16]) {
+  uint64_t k0 = coap_siphash_load(seed);
+  uint64_t k1 = coap_siphash_load(seed + 8);
+
+  s->v0 = k0 ^ 0x736f6d6570736575ULL;
+  s->v1 = k1 ^ 0x646f72616e646f6dULL ^ 0xee;
+  s->v2 = k0 ^ 0x6c7967656e657261ULL;
+  s->v3 = k1 ^ 0x7465646279746573ULL;
+  s->tail = 0;
+  s->length = 0;
+}
+
+static void
+coap_siphash_compress(coap_siphash_t *s, uint64_t m) {
+  s->v3 ^= m;
+  SIP_ROUND(s);
+  SIP_ROUND(s);
+  s->v0 ^= m;
+}
+
+static void
+coap_siphash_update(coap_siphash_t *s, const uint8_t *data, size_t len) {
+  /* Fill up any partial word first */
+  while (len && (s->length & 7)) {
+    s->tail |= (uint64_t)*data++ << (8 * (s->length & 7));
+    s->length++;
+    len--;
+    if ((s->length & 7) == 0) {
+      coap_siphash_compress(s, s->tail);
+      s->tail = 0;
+    }
+  }
+  while (len >= 8) {
+    coap_siphash_compress(s, coap_siphash_load(data));
+    s->length += 8;
+    data += 8;
+    len -= 8;
+  }
+  while (len--) {
+    s->tail |= (uint64_t)*data++ << (8 * (s->length & 7));
+    s->length++;
+  }
+}
+
+static void
+coap_siphash_final(coap_siphash_t *s, uint8_t out[16]) {
+  uint64_t h;
+  int i;
+
+  coap_siphash_compress(s, s->tail | (uint64_t)s->length << 56);
+  s->v2 ^= 0xee;
+  for (i = 0; i < 4; i++)
+    SIP_ROUND(s);
+  h = s->v0 ^ s->v1 ^ s->v2 ^ s->v3;
+  for (i = 0; i < 8; i++)
+    out[i] = (uint8_t)(h >> (8 * i));
+  s->v1 ^= 0xdd;
+  for (i = 0; i < 4; i++)
+    SIP_ROUND(s);
+  h = s->v0 ^ s->v1 ^ s->v2 ^ s->v3;
+  for (i = 0; i < 8; i++)
+    out[8 + i] = (uint8_t)(h >> (8 * i));
+}
+
+/* Takes the next chunk of the cache-key, returning 0 to stop */
+typedef int (*coap_cache_key_emit_t)(void *arg, const uint8_t *data,
+                                     size_t len);
+
+/* Where the cache-key is copied to or compared against */
+typedef struct coap_cache_key_buf_t {
+  uint8_t *data;
+  size_t left;
+} coap_cache_key_buf_t;
+
+static int
+coap_cache_emit_digest(void *arg, const uint8_t *data, size_t len) {
+  return coap_digest_update((coap_digest_ctx_t *)arg, data, len);
+}
+
+static int
+coap_cache_emit_hash(void *arg, const uint8_t *data, size_t len) {
+  coap_siphash_update((coap_siphash_t *)arg, data, len);
+  return 1;
+}
+
+static int
+coap_cache_emit_copy(void *arg, const uint8_t *data, size_t len) {
+  coap_cache_key_buf_t *buf = (coap_cache_key_buf_t *)arg;
+
+  if (len > buf->left)
+    return 0;
+  memcpy(buf->data, data, len);
+  buf->data += len;
+  buf->left -= len;
+  return 1;
+}
+
+static int
+coap_cache_emit_compare(void *arg, const uint8_t *data, size_t len) {
+  coap_cache_key_buf_t *buf = (coap_cache_key_buf_t *)arg;
+
+  if (len > buf->left || memcmp(buf->data, data, len) != 0)
+    return 0;
+  buf->data += len;
+  buf->left -= len;
+  return 1;
+}
+
+/*
+ * Passes the session (if session based), the cache-key options and any
+ * FETCH body of @p pdu to @p emit.  If @p canonical is set, each part is
+ * tagged and its length given, so that different requests never give the
+ * same sequence of bytes.
+ *
+ * Returns 1 if all was passed to @p emit, else 0.
+ */
+static int
+coap_cache_key_walk(const coap_session_t *session,
+                    const coap_pdu_t *pdu,
+                    coap_cache_session_based_t session_based,
+                    const uint16_t *cache_ignore_options,
+                    size_t cache_ignore_count,
+                    int canonical,
+                    coap_cache_key_emit_t emit, void *arg) {
   coap_opt_t *option;
   coap_opt_iterator_t opt_iter;
-  coap_digest_ctx_t *dctx;
-  coap_digest_t digest;
-  coap_cache_key_t *cache_key;
+  uint32_t len;
 
   if (!coap_option_iterator_init(pdu, &opt_iter, COAP_OPT_ALL)) {
-    return NULL;
+    return 0;
   }
 
-  dctx = coap_digest_setup();
-  if (!dctx)
-    return NULL;
-
   if (session_based == COAP_CACHE_IS_SESSION_BASED) {
     /* Include the session ptr */
-    if (!coap_digest_update(dctx, (const uint8_t*)&session, sizeof(session))) {
-      goto update_fail;
+    if ((canonical && !emit(arg, (const uint8_t *)"s", 1)) ||
+        !emit(arg, (const uint8_t*)&session, sizeof(session))) {
+      return 0;
     }
   }
   while ((option = coap_option_next(&opt_iter))) {
     if (is_cache_key(opt_iter.number, cache_ignore_count,
                      cache_ignore_options)) {
-      if (!coap_digest_update(dctx, (const uint8_t *)&opt_iter.number,
-                              sizeof(opt_iter.number))) {
-        goto update_fail;
+      if (canonical) {
+        len = coap_opt_length(option);
+        if (!emit(arg, (const uint8_t *)"o", 1) ||
+            !emit(arg, (const uint8_t *)&opt_iter.number,
+                  sizeof(opt_iter.number)) ||
+            !emit(arg, (const uint8_t *)&len, sizeof(len))) {
+          return 0;
+        }
       }
-      if (!coap_digest_update(dctx, coap_opt_value(option),
-                              coap_opt_length(option))) {
-        goto update_fail;
+      else if (!emit(arg, (const uint8_t *)&opt_iter.number,
+                     sizeof(opt_iter.number))) {
+        return 0;
+      }
+      if (!emit(arg, coap_opt_value(option), coap_opt_length(option))) {
+        return 0;
       }
     }
   }
@@ -113,27 +266,100 @@ coap_cache_derive_key_w_ignore(const coap_session_t *session,
   /* The body of a FETCH payload is part of the cache key,
    * see https://tools.ietf.org/html/rfc8132#section-2 */
   if (pdu->code == COAP_REQUEST_CODE_FETCH) {
-    size_t len;
+    size_t data_len;
     const uint8_t *data;
-    if (coap_get_data(pdu, &len, &data)) {
-      if (!coap_digest_update(dctx, data, len)) {
-        goto update_fail;
+    if (coap_get_data(pdu, &data_len, &data)) {
+      if (canonical) {
+        len = (uint32_t)data_len;
+        if (!emit(arg, (const uint8_t *)"b", 1) ||
+            !emit(arg, (const uint8_t *)&len, sizeof(len))) {
+          return 0;
+        }
+      }
+      if (!emit(arg, data, data_len)) {
+        return 0;
       }
     }
   }
+  return 1;
+}
+
+static int
+coap_cache_key_fast(const coap_session_t *session) {
+  return session && session->context &&
+         session->context->cache_key_mode == COAP_CACHE_KEY_FAST;
+}
+
+/*
+ * Fills in @p cache_key for @p pdu without allocating it.  For
+ * COAP_CACHE_KEY_FAST, the length of the cache-key options is returned in
+ * @p key_data_len if not NULL.
+ *
+ * Returns 1 if successful, else 0.
+ */
+static int
+coap_cache_derive_key_buf(const coap_session_t *session,
+                          const coap_pdu_t *pdu,
+                          coap_cache_session_based_t session_based,
+                          const uint16_t *cache_ignore_options,
+                          size_t cache_ignore_count,
+                          coap_cache_key_t *cache_key,
+                          size_t *key_data_len) {
+  coap_digest_ctx_t *dctx;
+  coap_digest_t digest;
+
+  if (coap_cache_key_fast(session)) {
+    coap_siphash_t hash;
+
+    coap_siphash_init(&hash, session->context->cache_key_seed);
+    if (!coap_cache_key_walk(session, pdu, session_based,
+                             cache_ignore_options, cache_ignore_count, 1,
+                             coap_cache_emit_hash, &hash)) {
+      return 0;
+    }
+    if (key_data_len)
+      *key_data_len = hash.length;
+    memset(cache_key, 0, sizeof(*cache_key));
+    coap_siphash_final(&hash, cache_key->key);
+    return 1;
+  }
+
+  dctx = coap_digest_setup();
+  if (!dctx)
+    return 0;
+
+  if (!coap_cache_key_walk(session, pdu, session_based,
+                           cache_ignore_options, cache_ignore_count, 0,
+                           coap_cache_emit_digest, dctx)) {
+    coap_digest_free(dctx);
+    return 0;
+  }
 
   if (!coap_digest_final(dctx, &digest)) {
     /* coap_digest_final() is guaranteed to free off dctx no matter what */
-    return NULL;
+    return 0;
   }
+  memcpy(cache_key->key, digest.key, sizeof(cache_key->key));
+  return 1;
+}
+
+coap_cache_key_t *
+coap_cache_derive_key_w_ignore(const coap_session_t *session,
+                               const coap_pdu_t *pdu,
+                               coap_cache_session_based_t session_based,
+                               const uint16_t *cache_ignore_options,
+                               size_t cache_ignore_count) {
+  coap_cache_key_t *cache_key;
+
   cache_key = coap_malloc_type(COAP_CACHE_KEY, sizeof(coap_cache_key_t));
-  if (cache_key) {
-    memcpy(cache_key->key, digest.key, sizeof(cache_key->key));
+  if (cache_key &&
+      !coap_cache_derive_key_buf(session, pdu, session_based,
+                                 cache_ignore_options, cache_ignore_count,
+                                 cache_key, NULL)) {
+    coap_delete_cache_key(cache_key);
+    return NULL;
   }
   return cache_key;
-update_fail:
-  coap_digest_free(dctx);
-  return NULL;
 }
 
 coap_cache_key_t *
@@ -150,11 +376,71 @@ coap_delete_cache_key(coap_cache_key_t *cache_key) {
   coap_free_type(COAP_CACHE_KEY, cache_key);
 }
 
+int
+coap_cache_set_key_mode(coap_context_t *ctx, coap_cache_key_mode_t mode) {
+  if (ctx->cache) {
+    coap_log(LOG_WARNING,
+             "coap_cache_set_key_mode: cache-entries already present\n");
+    return 0;
+  }
+  if (mode == COAP_CACHE_KEY_FAST &&
+      ctx->cache_key_mode != COAP_CACHE_KEY_FAST) {
+    coap_prng(ctx->cache_key_seed, sizeof(ctx->cache_key_seed));
+  }
+  ctx->cache_key_mode = mode;
+  return 1;
+}
+
+/* Returns the memory used by @p entry to be counted against max_bytes */
+static size_t
+coap_cache_entry_size(const coap_cache_entry_t *entry) {
+  size_t size = sizeof(coap_cache_entry_t) + sizeof(coap_cache_key_t) +
+                entry->key_data_len + entry->app_data_size;
+
+  if (entry->pdu)
+    size += sizeof(coap_pdu_t) + entry->pdu->max_hdr_size +
+            entry->pdu->alloc_size;
+  return size;
+}
+
+static void
+coap_cache_wheel_add(coap_context_t *ctx, coap_cache_entry_t *entry) {
+  entry->wheel_slot = (unsigned int)((entry->expire_ticks /
+                                      COAP_TICKS_PER_SECOND) %
+                                     COAP_CACHE_WHEEL_SLOTS);
+  DL_APPEND2(ctx->cache_wheel[entry->wheel_slot], entry,
+             wheel_prev, wheel_next);
+}
+
+static void
+coap_cache_wheel_remove(coap_context_t *ctx, coap_cache_entry_t *entry) {
+  DL_DELETE2(ctx->cache_wheel[entry->wheel_slot], entry,
+             wheel_prev, wheel_next);
+}
+
+/*
+ * Deletes the least recently used cache-entries until @p entries more
+ * cache-entries using @p bytes more memory fit in the limits.
+ */
+static void
+coap_cache_enforce_limits(coap_context_t *ctx, size_t entries, size_t bytes) {
+  while (ctx->cache_lru &&
+         ((ctx->cache_max_entries &&
+           ctx->cache_stats.entries + entries > ctx->cache_max_entries) ||
+          (ctx->cache_max_bytes &&
+           ctx->cache_stats.bytes + bytes > ctx->cache_max_bytes))) {
+    ctx->cache_stats.evictions++;
+    coap_delete_cache_entry(ctx, ctx->cache_lru);
+  }
+}
+
 coap_cache_entry_t *
 coap_new_cache_entry(coap_session_t *session, const coap_pdu_t *pdu,
                coap_cache_record_pdu_t record_pdu,
                coap_cache_session_based_t session_based,
                unsigned int idle_timeout) {
+  coap_context_t *ctx = session->context;
+  coap_cache_entry_t *old;
   coap_cache_entry_t *entry = coap_malloc_type(COAP_CACHE_ENTRY,
                                                sizeof(coap_cache_entry_t));
   if (!entry) {
@@ -162,7 +448,10 @@ coap_new_cache_entry(coap_session_t *session, const coap_pdu_t *pdu,
   }
 
   memset(entry, 0, sizeof(coap_cache_entry_t));
-  entry->session = session;
+  /* Only session based entries are deleted along with the session */
+  if (session_based == COAP_CACHE_IS_SESSION_BASED)
+    entry->session = session;
+  entry->context = ctx;
   if (record_pdu == COAP_CACHE_RECORD_PDU) {
     entry->pdu = coap_pdu_init(pdu->type, pdu->code, pdu->mid, pdu->alloc_size);
     if (entry->pdu) {
@@ -178,19 +467,80 @@ coap_new_cache_entry(coap_session_t *session, const coap_pdu_t *pdu,
       entry->pdu->data = entry->pdu->token + (pdu->data - pdu->token);
     }
   }
-  entry->cache_key = coap_cache_derive_key(session, pdu, session_based);
-  if (!entry->cache_key) {
-    coap_free_type(COAP_CACHE_ENTRY, entry);
-    return NULL;
+  entry->cache_key = coap_malloc_type(COAP_CACHE_KEY,
+                                      sizeof(coap_cache_key_t));
+  if (!entry->cache_key ||
+      !coap_cache_derive_key_buf(session, pdu, session_based,
+                                 ctx->cache_ignore_options,
+                                 ctx->cache_ignore_count,
+                                 entry->cache_key, &entry->key_data_len)) {
+    goto fail;
   }
+  if (coap_cache_key_fast(session)) {
+    /* Kept to check the requests matching the cache-key against */
+    coap_cache_key_buf_t buf;
+
+    entry->key_data = coap_malloc(entry->key_data_len ?
+                                  entry->key_data_len : 1);
+    if (!entry->key_data)
+      goto fail;
+    buf.data = entry->key_data;
+    buf.left = entry->key_data_len;
+    if (!coap_cache_key_walk(session, pdu, session_based,
+                             ctx->cache_ignore_options,
+                             ctx->cache_ignore_count, 1,
+                             coap_cache_emit_copy, &buf)) {
+      goto fail;
+    }
+  }
+  else {
+    entry->key_data_len = 0;
+  }
+  entry->size = coap_cache_entry_size(entry);
+  if (ctx->cache_max_bytes && entry->size > ctx->cache_max_bytes)
+    goto fail;
+  /* Replace any entry with the same cache-key */
+  HASH_FIND(hh, ctx->cache, entry->cache_key, sizeof(coap_cache_key_t), old);
+  if (old)
+    coap_delete_cache_entry(ctx, old);
+  coap_cache_enforce_limits(ctx, 1, entry->size);
+
   entry->idle_timeout = idle_timeout;
   if (idle_timeout > 0) {
     coap_ticks(&entry->expire_ticks);
     entry->expire_ticks += idle_timeout * COAP_TICKS_PER_SECOND;
+    coap_cache_wheel_add(ctx, entry);
   }
 
-  HASH_ADD(hh, session->context->cache, cache_key[0], sizeof(coap_cache_key_t), entry);
+  HASH_ADD(hh, ctx->cache, cache_key[0], sizeof(coap_cache_key_t), entry);
+  DL_APPEND2(ctx->cache_lru, entry, lru_prev, lru_next);
+  ctx->cache_stats.entries++;
+  ctx->cache_stats.bytes += entry->size;
   return entry;
+
+fail:
+  coap_delete_pdu(entry->pdu);
+  coap_delete_cache_key(entry->cache_key);
+  if (entry->key_data)
+    coap_free(entry->key_data);
+  coap_free_type(COAP_CACHE_ENTRY, entry);
+  return NULL;
+}
+
+/* Counts a hit, and makes @p cache_entry the most recently used */
+static void
+coap_cache_touch(coap_context_t *ctx, coap_cache_entry_t *cache_entry) {
+  ctx->cache_stats.hits++;
+  /* Now the most recently used */
+  if (cache_entry->lru_next) {
+    DL_DELETE2(ctx->cache_lru, cache_entry, lru_prev, lru_next);
+    DL_APPEND2(ctx->cache_lru, cache_entry, lru_prev, lru_next);
+  }
+  if (cache_entry->idle_timeout > 0) {
+    /* Left on its wheel slot, to be moved on when that slot is checked */
+    coap_ticks(&cache_entry->expire_ticks);
+    cache_entry->expire_ticks += cache_entry->idle_timeout * COAP_TICKS_PER_SECOND;
+  }
 }
 
 coap_cache_entry_t *
@@ -201,29 +551,123 @@ coap_cache_get_by_key(coap_context_t *ctx, const coap_cache_key_t *cache_key) {
   if (cache_key) {
     HASH_FIND(hh, ctx->cache, cache_key, sizeof(coap_cache_key_t), cache_entry);
   }
-  if (cache_entry && cache_entry->idle_timeout > 0) {
-    coap_ticks(&cache_entry->expire_ticks);
-    cache_entry->expire_ticks += cache_entry->idle_timeout * COAP_TICKS_PER_SECOND;
+  if (!cache_entry) {
+    ctx->cache_stats.misses++;
+    return NULL;
   }
+  coap_cache_touch(ctx, cache_entry);
   return cache_entry;
 }
 
+/* The most cache-key option bytes that are copied to the stack to look up
+ * a COAP_CACHE_KEY_FAST cache-entry in a single walk of the options */
+#define COAP_CACHE_KEY_DATA_STACK 256
+
+/*
+ * Looks up the COAP_CACHE_KEY_FAST cache-entry for @p request, copying the
+ * cache-key option bytes in a single walk of the options so that they can
+ * be both hashed and compared against those kept by the cache-entry.
+ *
+ * Returns 1 if the lookup was done, with any match in @p cache_entry, else
+ * 0 if the cache-key option bytes do not fit on the stack.
+ */
+static int
+coap_cache_find_fast(coap_session_t *session,
+                     const coap_pdu_t *request,
+                     coap_cache_session_based_t session_based,
+                     coap_cache_entry_t **cache_entry) {
+  coap_context_t *ctx = session->context;
+  uint8_t key_data[COAP_CACHE_KEY_DATA_STACK];
+  coap_cache_key_buf_t buf;
+  coap_cache_key_t cache_key;
+  coap_siphash_t hash;
+  size_t key_data_len;
+
+  buf.data = key_data;
+  buf.left = sizeof(key_data);
+  if (!coap_cache_key_walk(session, request, session_based,
+                           ctx->cache_ignore_options,
+                           ctx->cache_ignore_count, 1,
+                           coap_cache_emit_copy, &buf)) {
+    return 0;
+  }
+  key_data_len = sizeof(key_data) - buf.left;
+  coap_siphash_init(&hash, ctx->cache_key_seed);
+  coap_siphash_update(&hash, key_data, key_data_len);
+  memset(&cache_key, 0, sizeof(cache_key));
+  coap_siphash_final(&hash, cache_key.key);
+
+  HASH_FIND(hh, ctx->cache, &cache_key, sizeof(coap_cache_key_t),
+            *cache_entry);
+  /* Make sure that it is not a different request with the same hash */
+  if (*cache_entry &&
+      ((*cache_entry)->key_data_len != key_data_len ||
+       memcmp((*cache_entry)->key_data, key_data, key_data_len) != 0)) {
+    coap_log(LOG_DEBUG, "cache-key hash collision\n");
+    *cache_entry = NULL;
+  }
+  return 1;
+}
+
+/*
+ * Looks up the cache-entry for @p request by its cache-key, checking the
+ * cache-key option bytes kept by a COAP_CACHE_KEY_FAST cache-entry in a
+ * second walk of the options.
+ *
+ * Returns 1 if the lookup was done, with any match in @p cache_entry, else
+ * 0 if the cache-key could not be derived.
+ */
+static int
+coap_cache_find_walk(coap_session_t *session,
+                     const coap_pdu_t *request,
+                     coap_cache_session_based_t session_based,
+                     coap_cache_entry_t **cache_entry) {
+  coap_context_t *ctx = session->context;
+  coap_cache_key_t cache_key;
+
+  if (!coap_cache_derive_key_buf(session, request, session_based,
+                                 ctx->cache_ignore_options,
+                                 ctx->cache_ignore_count, &cache_key, NULL))
+    return 0;
+
+  HASH_FIND(hh, ctx->cache, &cache_key, sizeof(coap_cache_key_t),
+            *cache_entry);
+  if (*cache_entry && (*cache_entry)->key_data) {
+    /* Make sure that it is not a different request with the same hash */
+    coap_cache_key_buf_t buf;
+
+    buf.data = (*cache_entry)->key_data;
+    buf.left = (*cache_entry)->key_data_len;
+    if (!coap_cache_key_walk(session, request, session_based,
+                             ctx->cache_ignore_options,
+                             ctx->cache_ignore_count, 1,
+                             coap_cache_emit_compare, &buf) ||
+        buf.left != 0) {
+      coap_log(LOG_DEBUG, "cache-key hash collision\n");
+      *cache_entry = NULL;
+    }
+  }
+  return 1;
+}
+
 coap_cache_entry_t *
 coap_cache_get_by_pdu(coap_session_t *session,
                       const coap_pdu_t *request,
                       coap_cache_session_based_t session_based) {
-  coap_cache_key_t *cache_key = coap_cache_derive_key(session, request, session_based);
-  coap_cache_entry_t *cache_entry;
+  coap_context_t *ctx = session->context;
+  coap_cache_entry_t *cache_entry = NULL;
 
-  if (!cache_key)
+  if (!(coap_cache_key_fast(session) &&
+        coap_cache_find_fast(session, request, session_based,
+                             &cache_entry)) &&
+      !coap_cache_find_walk(session, request, session_based, &cache_entry))
     return NULL;
 
-  cache_entry = coap_cache_get_by_key(session->context, cache_key);
-  coap_delete_cache_key(cache_key);
-  if (cache_entry && cache_entry->idle_timeout > 0) {
-    coap_ticks(&cache_entry->expire_ticks);
-    cache_entry->expire_ticks += cache_entry->idle_timeout * COAP_TICKS_PER_SECOND;
+  if (!cache_entry) {
+    ctx->cache_stats.misses++;
+    return NULL;
   }
+  coap_cache_touch(ctx, cache_entry);
   return cache_entry;
 }
 
@@ -231,14 +675,22 @@ void
 coap_delete_cache_entry(coap_context_t *ctx, coap_cache_entry_t *cache_entry) {
 
   assert(cache_entry);
+  if (!cache_entry)
+    return;
 
-  if (cache_entry) {
-    HASH_DELETE(hh, ctx->cache, cache_entry);
+  HASH_DELETE(hh, ctx->cache, cache_entry);
+  DL_DELETE2(ctx->cache_lru, cache_entry, lru_prev, lru_next);
+  if (cache_entry->idle_timeout > 0) {
+    coap_cache_wheel_remove(ctx, cache_entry);
   }
+  ctx->cache_stats.entries--;
+  ctx->cache_stats.bytes -= cache_entry->size;
   if (cache_entry->pdu) {
     coap_delete_pdu(cache_entry->pdu);
   }
   coap_delete_cache_key(cache_entry->cache_key);
+  if (cache_entry->key_data)
+    coap_free(cache_entry->key_data);
   if (cache_entry->callback && cache_entry->app_data) {
     cache_entry->callback(cache_entry->app_data);
   }
@@ -263,18 +715,72 @@ coap_cache_get_app_data(const coap_cache_entry_t *cache_entry) {
   return cache_entry->app_data;
 }
 
+void
+coap_cache_set_app_data_size(coap_cache_entry_t *cache_entry, size_t size) {
+  coap_context_t *ctx = cache_entry->context;
+
+  ctx->cache_stats.bytes -= cache_entry->size;
+  cache_entry->app_data_size = size;
+  cache_entry->size = coap_cache_entry_size(cache_entry);
+  ctx->cache_stats.bytes += cache_entry->size;
+}
+
+void
+coap_cache_set_limits(coap_context_t *ctx, size_t max_entries,
+                      size_t max_bytes) {
+  ctx->cache_max_entries = max_entries;
+  ctx->cache_max_bytes = max_bytes;
+  coap_cache_enforce_limits(ctx, 0, 0);
+}
+
+void
+coap_cache_get_stats(coap_context_t *ctx, coap_cache_stats_t *stats) {
+  *stats = ctx->cache_stats;
+}
+
+/*
+ * Deletes the expired entries of a wheel slot, and moves on the ones that
+ * have been used since being put there (or are more than a wheel turn away).
+ */
+static void
+coap_cache_check_slot(coap_context_t *ctx, unsigned int slot,
+                      coap_tick_t now) {
+  coap_cache_entry_t *cp, *ctmp;
+
+  DL_FOREACH_SAFE2(ctx->cache_wheel[slot], cp, ctmp, wheel_next) {
+    if (cp->expire_ticks <= now) {
+      ctx->cache_stats.expirations++;
+      coap_delete_cache_entry(ctx, cp);
+    }
+    else if ((cp->expire_ticks / COAP_TICKS_PER_SECOND) %
+             COAP_CACHE_WHEEL_SLOTS != slot) {
+      coap_cache_wheel_remove(ctx, cp);
+      coap_cache_wheel_add(ctx, cp);
+    }
+  }
+}
+
 void
 coap_expire_cache_entries(coap_context_t *ctx) {
   coap_tick_t now;
-  coap_cache_entry_t *cp, *ctmp;
+  coap_tick_t now_secs;
+  unsigned int slot;
 
   coap_ticks(&now);
-  HASH_ITER(hh, ctx->cache, cp, ctmp) {
-    if (cp->idle_timeout > 0) {
-      if (cp->expire_ticks <= now) {
-        coap_delete_cache_entry(ctx, cp);
-      }
+  now_secs = now / COAP_TICKS_PER_SECOND;
+  if (now_secs > ctx->cache_wheel_next + COAP_CACHE_WHEEL_SLOTS) {
+    /* A full turn (or more) of the wheel has gone by */
+    for (slot = 0; slot < COAP_CACHE_WHEEL_SLOTS; slot++) {
+      coap_cache_check_slot(ctx, slot, now);
     }
+    ctx->cache_wheel_next = now_secs;
+    return;
+  }
+  /* Only the seconds that have completely passed */
+  while (ctx->cache_wheel_next < now_secs) {
+    slot = (unsigned int)(ctx->cache_wheel_next % COAP_CACHE_WHEEL_SLOTS);
+    coap_cache_check_slot(ctx, slot, now);
+    ctx->cache_wheel_next++;
   }
 }
 
@@ -323,7 +323,7 @@ msg_code_string(uint16_t c) {
                                    "FETCH", "PATCH", "iPATCH" };
   static const char *signals[] = { "7.00", "CSM", "Ping", "Pong", "Release",
                                    "Abort" };
-  static char buf[5];
+  static COAP_THREAD_LOCAL char buf[5];
 
   if (c < sizeof(methods)/sizeof(const char *)) {
     return methods[c];
@@ -357,10 +357,12 @@ msg_option_string(uint8_t code, uint16_t option_type) {
     { COAP_OPTION_URI_QUERY, "Uri-Query" },
     { COAP_OPTION_HOP_LIMIT, "Hop-Limit" },
     { COAP_OPTION_ACCEPT, "Accept" },
+    { COAP_OPTION_Q_BLOCK1, "Q-Block1" },
     { COAP_OPTION_LOCATION_QUERY, "Location-Query" },
     { COAP_OPTION_BLOCK2, "Block2" },
     { COAP_OPTION_BLOCK1, "Block1" },
     { COAP_OPTION_SIZE2, "Size2" },
+    { COAP_OPTION_Q_BLOCK2, "Q-Block2" },
     { COAP_OPTION_PROXY_URI, "Proxy-Uri" },
     { COAP_OPTION_PROXY_SCHEME, "Proxy-Scheme" },
     { COAP_OPTION_SIZE1, "Size1" },
@@ -387,7 +389,7 @@ msg_option_string(uint8_t code, uint16_t option_type) {
     { COAP_SIGNALING_OPTION_BAD_CSM_OPTION, "Bad-CSM-Option" }
   };
 
-  static char buf[6];
+  static COAP_THREAD_LOCAL char buf[6];
   size_t i;
 
   if (code == COAP_SIGNALING_CSM) {
@@ -463,6 +465,7 @@ print_content_format(unsigned int format_type,
     { COAP_MEDIATYPE_APPLICATION_SENSML_XML, "application/sensml+xml" },
     { COAP_MEDIATYPE_APPLICATION_COAP_GROUP_JSON, "application/coap-group+json" },
     { COAP_MEDIATYPE_APPLICATION_DOTS_CBOR, "application/dots+cbor" },
+    { COAP_MEDIATYPE_APPLICATION_MB_CBOR_SEQ, "application/missing-blocks+cbor-seq" },
     { 75, "application/dcaf+cbor" }
   };
 
@@ -622,6 +625,8 @@ coap_show_pdu(coap_log_t level, const coap_pdu_t *pdu) {
 
     case COAP_OPTION_BLOCK1:
     case COAP_OPTION_BLOCK2:
+    case COAP_OPTION_Q_BLOCK1:
+    case COAP_OPTION_Q_BLOCK2:
       /* split block option into number/more/size where more is the
        * letter M if set, the _ otherwise */
       if (COAP_OPT_BLOCK_SZX(option) == 7) {
@@ -1029,9 +1034,10 @@ int coap_debug_set_packet_loss(const char *loss_level) {
 }
 
 int coap_debug_send_packet(void) {
-  ++send_packet_count;
   if (num_packet_loss_intervals > 0) {
     int i;
+    /* Only counted when needed, as it is shared by all the threads */
+    ++send_packet_count;
     for (i = 0; i < num_packet_loss_intervals; i++) {
       if (send_packet_count >= packet_loss_intervals[i].start
         && send_packet_count <= packet_loss_intervals[i].end) {
@@ -85,7 +85,6 @@ typedef struct coap_ssl_t {
   const uint8_t *pdu;
   unsigned pdu_len;
   unsigned peekmode;
-  gnutls_datum_t cookie_key;
 } coap_ssl_t;
 
 /*
@@ -134,6 +133,8 @@ typedef struct coap_gnutls_context_t {
   char *root_ca_file;
   char *root_ca_path;
   gnutls_priority_t priority_cache;
+  gnutls_datum_t ticket_key;    /* Set if server is resuming sessions */
+  gnutls_datum_t cookie_key;    /* Keys the DTLS HelloVerifyRequest cookies */
 } coap_gnutls_context_t;
 
 typedef enum coap_free_bye_t {
@@ -244,6 +245,31 @@ coap_gnutls_log_func(int level, const char* text)
   coap_log(LOG_DEBUG + level - 2, "%s", text);
 }
 
+#if COAP_SERVER_SUPPORT
+/*
+ * Generates the key that session tickets are protected with, once for the
+ * context.
+ *
+ * return 0 failed
+ *        1 passed
+ */
+static int
+setup_ticket_key(coap_gnutls_context_t *g_context) {
+  int ret;
+
+  if (g_context->ticket_key.data)
+    return 1;
+  ret = gnutls_session_ticket_key_generate(&g_context->ticket_key);
+  if (ret != GNUTLS_E_SUCCESS) {
+    coap_log(LOG_WARNING, "gnutls_session_ticket_key_generate: %s\n",
+             gnutls_strerror(ret));
+    g_context->ticket_key.data = NULL;
+    return 0;
+  }
+  return 1;
+}
+#endif /* COAP_SERVER_SUPPORT */
+
 /*
  * return 0 failed
  *        1 passed
@@ -251,7 +277,7 @@ coap_gnutls_log_func(int level, const char* text)
 int
 coap_dtls_context_set_pki(coap_context_t *c_context,
                           const coap_dtls_pki_t* setup_data,
-                          const coap_dtls_role_t role COAP_UNUSED)
+                          const coap_dtls_role_t role)
 {
   coap_gnutls_context_t *g_context =
                          ((coap_gnutls_context_t *)c_context->dtls_context);
@@ -288,6 +314,13 @@ coap_dtls_context_set_pki(coap_context_t *c_context,
       g_context->setup_data.allow_short_rsa_length = 1;
     }
   }
+#if COAP_SERVER_SUPPORT
+  if (role == COAP_DTLS_ROLE_SERVER && setup_data->session_resumption &&
+      !setup_ticket_key(g_context))
+    return 0;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)role;
+#endif /* ! COAP_SERVER_SUPPORT */
   g_context->psk_pki_enabled |= IS_PKI;
   return 1;
 }
@@ -352,6 +385,8 @@ coap_dtls_context_set_spsk(coap_context_t *c_context,
   if (!g_context || !setup_data)
     return 0;
 
+  if (setup_data->session_resumption && !setup_ticket_key(g_context))
+    return 0;
   g_context->psk_pki_enabled |= IS_PSK;
   return 1;
 }
@@ -473,6 +508,9 @@ coap_dtls_new_context(coap_context_t *c_context COAP_UNUSED) {
                  "gnutls_priority_init: %s\n", gnutls_strerror(ret));
       goto fail;
     }
+    G_CHECK(gnutls_key_generate(&g_context->cookie_key,
+                                GNUTLS_COOKIE_KEY_SIZE),
+            "gnutls_key_generate");
   }
   return g_context;
 
@@ -508,6 +546,14 @@ coap_dtls_free_context(void *handle) {
     gnutls_free(g_context->psk_sni_entry_list);
 
   gnutls_priority_deinit(g_context->priority_cache);
+  if (g_context->ticket_key.data) {
+    gnutls_memset(g_context->ticket_key.data, 0, g_context->ticket_key.size);
+    gnutls_free(g_context->ticket_key.data);
+  }
+  if (g_context->cookie_key.data) {
+    gnutls_memset(g_context->cookie_key.data, 0, g_context->cookie_key.size);
+    gnutls_free(g_context->cookie_key.data);
+  }
 
   gnutls_global_deinit();
   gnutls_free(g_context);
@@ -1769,6 +1815,15 @@ setup_client_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
               "gnutls_server_name_set");
     }
   }
+  if (c_session->dtls_resume) {
+    const coap_bin_const_t *state = coap_dtls_resume_find(c_session);
+
+    /* A full handshake is done if the session cannot be resumed */
+    if (state && gnutls_session_set_data(g_env->g_session, state->s,
+                                         state->length) < 0)
+      coap_log(LOG_DEBUG, "*  %s: cannot resume session\n",
+               coap_session_str(c_session));
+  }
   return GNUTLS_E_SUCCESS;
 
 fail:
@@ -1888,6 +1943,18 @@ setup_server_ssl_session(coap_session_t *c_session, coap_gnutls_env_t *g_env)
                                    g_env->pki_credentials),
             "gnutls_credentials_set\n");
   }
+  if (g_context->ticket_key.data) {
+    /*
+     * Sessions are resumed with tickets, which the server does not need to
+     * keep.  The keys that encrypt them are derived from ticket_key and
+     * rotated as they expire.
+     */
+    G_CHECK(gnutls_session_ticket_enable_server(g_env->g_session,
+                                                &g_context->ticket_key),
+            "gnutls_session_ticket_enable_server");
+    gnutls_db_set_cache_expiration(g_env->g_session,
+                                   COAP_DTLS_SESSION_LIFETIME);
+  }
   return GNUTLS_E_SUCCESS;
 
 fail:
@@ -1952,6 +2019,13 @@ coap_dgram_write(gnutls_transport_ptr_t context, const void *send_buffer,
   coap_session_t *c_session = (coap_session_t *)context;
 
   if (c_session) {
+#if COAP_SERVER_SUPPORT
+    if (c_session->endpoint && c_session == c_session->endpoint->hello)
+      /* A HelloVerifyRequest from coap_dtls_hello_filter() */
+      result = coap_socket_send(&c_session->endpoint->sock, c_session,
+                                send_buffer, send_buffer_length);
+    else
+#endif /* COAP_SERVER_SUPPORT */
     result = coap_session_send(c_session, send_buffer, send_buffer_length);
     if (result != (int)send_buffer_length) {
       coap_log(LOG_WARNING, "coap_network_send failed\n");
@@ -2099,7 +2173,6 @@ coap_dtls_free_gnutls_env(coap_gnutls_context_t *g_context,
       gnutls_certificate_free_credentials(g_env->pki_credentials);
       g_env->pki_credentials = NULL;
     }
-    gnutls_free(g_env->coap_ssl_data.cookie_key.data);
     gnutls_free(g_env);
   }
 }
@@ -2115,6 +2188,24 @@ void *coap_dtls_new_server_session(coap_session_t *c_session) {
 }
 #endif /* COAP_SERVER_SUPPORT */
 
+#if COAP_CLIENT_SUPPORT
+/*
+ * Keeps the session state of an established client session, so that the
+ * next session to the same server can resume it.
+ */
+static void
+save_client_session(coap_session_t *c_session, coap_gnutls_env_t *g_env) {
+  gnutls_datum_t data;
+
+  if (c_session->type != COAP_SESSION_TYPE_CLIENT || !c_session->dtls_resume)
+    return;
+  if (gnutls_session_get_data2(g_env->g_session, &data) == GNUTLS_E_SUCCESS) {
+    coap_dtls_resume_save(c_session, data.data, data.size);
+    gnutls_free(data.data);
+  }
+}
+#endif /* COAP_CLIENT_SUPPORT */
+
 static void log_last_alert(coap_session_t *c_session,
                            gnutls_session_t g_session) {
   int last_alert = gnutls_alert_get(g_session);
@@ -2142,8 +2233,14 @@ do_gnutls_handshake(coap_session_t *c_session, coap_gnutls_env_t *g_env) {
   switch (ret) {
   case GNUTLS_E_SUCCESS:
     g_env->established = 1;
-    coap_log(LOG_DEBUG, "*  %s: GnuTLS established\n",
-                                            coap_session_str(c_session));
+    c_session->dtls_resumed = gnutls_session_is_resumed(g_env->g_session) ?
+                              1 : 0;
+    coap_log(LOG_DEBUG, "*  %s: GnuTLS established%s\n",
+                        coap_session_str(c_session),
+                        c_session->dtls_resumed ? " (resumed)" : "");
+#if COAP_CLIENT_SUPPORT
+    save_client_session(c_session, g_env);
+#endif /* COAP_CLIENT_SUPPORT */
     ret = 1;
     break;
   case GNUTLS_E_INTERRUPTED:
@@ -2259,6 +2356,11 @@ void *coap_dtls_new_client_session(coap_session_t *c_session) {
 
 void coap_dtls_free_session(coap_session_t *c_session) {
   if (c_session && c_session->context && c_session->tls) {
+#if COAP_CLIENT_SUPPORT
+    /* A TLS1.3 ticket may only have arrived after the handshake */
+    if (((coap_gnutls_env_t *)c_session->tls)->established)
+      save_client_session(c_session, c_session->tls);
+#endif /* COAP_CLIENT_SUPPORT */
     coap_dtls_free_gnutls_env(c_session->context->dtls_context,
                 c_session->tls,
                 COAP_PROTO_NOT_RELIABLE(c_session->proto) ?
@@ -2509,6 +2611,8 @@ coap_dtls_hello(coap_session_t *c_session,
   size_t data_len
 ) {
   coap_gnutls_env_t *g_env = (coap_gnutls_env_t *)c_session->tls;
+  coap_gnutls_context_t *g_context =
+                   (coap_gnutls_context_t *)c_session->context->dtls_context;
   coap_ssl_t *ssl_data;
   int ret;
 
@@ -2516,8 +2620,6 @@ coap_dtls_hello(coap_session_t *c_session,
     g_env = coap_dtls_new_gnutls_env(c_session, GNUTLS_SERVER);
     if (g_env) {
       c_session->tls = g_env;
-      gnutls_key_generate(&g_env->coap_ssl_data.cookie_key,
-                          GNUTLS_COOKIE_KEY_SIZE);
     }
     else {
       /* error should have already been reported */
@@ -2531,14 +2633,14 @@ coap_dtls_hello(coap_session_t *c_session,
     memset(&prestate, 0, sizeof(prestate));
     /* Need to do this to not get a compiler warning about const parameters */
     memcpy (&data_rw, &data, sizeof(data_rw));
-    ret = gnutls_dtls_cookie_verify(&g_env->coap_ssl_data.cookie_key,
+    ret = gnutls_dtls_cookie_verify(&g_context->cookie_key,
                                      &c_session->addr_info,
                                      sizeof(c_session->addr_info),
                                      data_rw, data_len,
                                      &prestate);
     if (ret < 0) {  /* cookie not valid */
       coap_log(LOG_DEBUG, "Invalid Cookie - sending Hello Verify\n");
-      gnutls_dtls_cookie_send(&g_env->coap_ssl_data.cookie_key,
+      gnutls_dtls_cookie_send(&g_context->cookie_key,
                               &c_session->addr_info,
                               sizeof(c_session->addr_info),
                               &prestate,
@@ -2579,6 +2681,45 @@ coap_dtls_hello(coap_session_t *c_session,
   }
   return ret;
 }
+
+int
+coap_dtls_hello_filter(coap_endpoint_t *endpoint,
+                       const coap_addr_tuple_t *addr_info,
+                       int ifindex,
+                       const uint8_t *data,
+                       size_t data_len) {
+  coap_gnutls_context_t *g_context =
+                   (coap_gnutls_context_t *)endpoint->context->dtls_context;
+  gnutls_dtls_prestate_st prestate;
+  coap_session_t *hello;
+  uint8_t *data_rw;
+
+  if (!g_context)
+    return 1;
+  /*
+   * The cookie key is shared by the context, so the cookie is checked
+   * without keeping any state.  The HelloVerifyRequest is sent through a
+   * session that is only used for that, so that no session is made for the
+   * peer until it has shown that it can receive at its address.  The client
+   * id is the session's addr_info, which is the same as the HELLO session
+   * that coap_dtls_hello() checks the cookie on again.
+   */
+  hello = coap_endpoint_hello_session(endpoint, addr_info, ifindex);
+  if (!hello)
+    return 1;
+  memset(&prestate, 0, sizeof(prestate));
+  /* Need to do this to not get a compiler warning about const parameters */
+  memcpy (&data_rw, &data, sizeof(data_rw));
+  if (gnutls_dtls_cookie_verify(&g_context->cookie_key,
+                                &hello->addr_info, sizeof(hello->addr_info),
+                                data_rw, data_len, &prestate) >= 0)
+    return 1;
+  coap_log(LOG_DEBUG, "Invalid Cookie - sending Hello Verify\n");
+  gnutls_dtls_cookie_send(&g_context->cookie_key,
+                          &hello->addr_info, sizeof(hello->addr_info),
+                          &prestate, hello, coap_dgram_write);
+  return 0;
+}
 #endif /* COAP_SERVER_SUPPORT */
 
 unsigned int coap_dtls_get_overhead(coap_session_t *c_session COAP_UNUSED) {
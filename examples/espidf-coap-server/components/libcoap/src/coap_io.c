@@ -46,6 +46,9 @@
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif
+#ifdef __linux__
+# include <netinet/udp.h>
+#endif
 #include <errno.h>
 #ifdef COAP_EPOLL_SUPPORT
 #include <sys/epoll.h>
@@ -190,6 +193,18 @@ coap_socket_bind_udp(coap_socket_t *sock,
     coap_log(LOG_WARNING,
              "coap_socket_bind_udp: setsockopt SO_REUSEADDR: %s\n",
               coap_socket_strerror());
+  if (sock->flags & COAP_SOCKET_REUSE_PORT) {
+#ifdef SO_REUSEPORT
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, OPTVAL_T(&on),
+                   sizeof(on)) == COAP_SOCKET_ERROR)
+      coap_log(LOG_WARNING,
+               "coap_socket_bind_udp: setsockopt SO_REUSEPORT: %s\n",
+               coap_socket_strerror());
+#else /* ! SO_REUSEPORT */
+    coap_log(LOG_WARNING,
+             "coap_socket_bind_udp: SO_REUSEPORT not supported\n");
+#endif /* ! SO_REUSEPORT */
+  }
 #endif /* RIOT_VERSION */
 
   switch (listen_addr->addr.sa.sa_family) {
@@ -626,6 +641,313 @@ static __declspec(thread) LPFN_WSARECVMSG lpWSARecvMsg = NULL;
 #endif
 
 #ifndef RIOT_VERSION
+#ifdef HAVE_STRUCT_CMSGHDR
+/*
+ * Append the ancillary data needed to send from @p local on @p ifindex to
+ * @p mhdr, using @p buf (which must be large enough to also hold any
+ * ancillary data already in @p mhdr) as the control buffer.
+ *
+ * Returns 0 on success, -1 if the address family of @p local is not
+ * supported.
+ */
+static int
+coap_msghdr_add_pktinfo(struct msghdr *mhdr, char *buf,
+                        const coap_address_t *local, int ifindex) {
+  mhdr->msg_control = buf;
+  if (!coap_address_isany(local) &&
+      !coap_is_mcast(local))
+  switch (local->addr.sa.sa_family) {
+  case AF_INET6:
+  {
+    struct cmsghdr *cmsg;
+
+    if (IN6_IS_ADDR_V4MAPPED(&local->addr.sin6.sin6_addr)) {
+#if defined(IP_PKTINFO)
+      struct in_pktinfo *pktinfo;
+      cmsg = (struct cmsghdr *)(buf + mhdr->msg_controllen);
+      mhdr->msg_controllen += CMSG_SPACE(sizeof(struct in_pktinfo));
+      cmsg->cmsg_level = SOL_IP;
+      cmsg->cmsg_type = IP_PKTINFO;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+
+      pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
+
+      pktinfo->ipi_ifindex = ifindex;
+      memcpy(&pktinfo->ipi_spec_dst,
+             local->addr.sin6.sin6_addr.s6_addr + 12,
+             sizeof(pktinfo->ipi_spec_dst));
+#elif defined(IP_SENDSRCADDR)
+      cmsg = (struct cmsghdr *)(buf + mhdr->msg_controllen);
+      mhdr->msg_controllen += CMSG_SPACE(sizeof(struct in_addr));
+      cmsg->cmsg_level = IPPROTO_IP;
+      cmsg->cmsg_type = IP_SENDSRCADDR;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
+
+      memcpy(CMSG_DATA(cmsg),
+             local->addr.sin6.sin6_addr.s6_addr + 12,
+             sizeof(struct in_addr));
+#endif /* IP_PKTINFO */
+    } else {
+      struct in6_pktinfo *pktinfo;
+      cmsg = (struct cmsghdr *)(buf + mhdr->msg_controllen);
+      mhdr->msg_controllen += CMSG_SPACE(sizeof(struct in6_pktinfo));
+      cmsg->cmsg_level = IPPROTO_IPV6;
+      cmsg->cmsg_type = IPV6_PKTINFO;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+
+      pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
+
+      pktinfo->ipi6_ifindex = ifindex;
+      memcpy(&pktinfo->ipi6_addr,
+             &local->addr.sin6.sin6_addr,
+             sizeof(pktinfo->ipi6_addr));
+    }
+    break;
+  }
+  case AF_INET:
+  {
+#if defined(IP_PKTINFO)
+    struct cmsghdr *cmsg;
+    struct in_pktinfo *pktinfo;
+
+    cmsg = (struct cmsghdr *)(buf + mhdr->msg_controllen);
+    mhdr->msg_controllen += CMSG_SPACE(sizeof(struct in_pktinfo));
+    cmsg->cmsg_level = SOL_IP;
+    cmsg->cmsg_type = IP_PKTINFO;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+
+    pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
+
+    pktinfo->ipi_ifindex = ifindex;
+    memcpy(&pktinfo->ipi_spec_dst,
+           &local->addr.sin.sin_addr,
+           sizeof(pktinfo->ipi_spec_dst));
+#elif defined(IP_SENDSRCADDR)
+    struct cmsghdr *cmsg;
+    cmsg = (struct cmsghdr *)(buf + mhdr->msg_controllen);
+    mhdr->msg_controllen += CMSG_SPACE(sizeof(struct in_addr));
+    cmsg->cmsg_level = IPPROTO_IP;
+    cmsg->cmsg_type = IP_SENDSRCADDR;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
+
+    memcpy(CMSG_DATA(cmsg),
+           &local->addr.sin.sin_addr,
+           sizeof(struct in_addr));
+#endif /* IP_PKTINFO */
+    break;
+  }
+  default:
+    /* error */
+    coap_log(LOG_WARNING, "protocol not supported\n");
+    return -1;
+  }
+  return 0;
+}
+#endif /* HAVE_STRUCT_CMSGHDR */
+
+#if COAP_SEND_BATCH_SUPPORT
+/* The maximum number of UDP GSO segments and bytes in one sendmsg() */
+#define COAP_MAX_GSO_SEGMENTS 64
+#define COAP_MAX_GSO_SIZE 65000
+
+/*
+ * Send the datagram in @p mhdr built for UDP GSO as individual datagrams,
+ * the segments of which were queued as @p entry onwards.
+ * The UDP_SEGMENT ancillary data is always the first in the control buffer.
+ */
+static void
+coap_send_batch_unsegment(coap_socket_t *sock, const struct msghdr *mhdr,
+                          coap_send_entry_t *entry) {
+  struct msghdr single = *mhdr;
+  size_t gso_len = CMSG_SPACE(sizeof(uint16_t));
+  size_t j;
+
+  single.msg_control = (char *)mhdr->msg_control + gso_len;
+  single.msg_controllen = mhdr->msg_controllen - gso_len;
+  if (single.msg_controllen == 0)
+    single.msg_control = NULL;
+  single.msg_iovlen = 1;
+  for (j = 0; j < (size_t)mhdr->msg_iovlen; j++) {
+    single.msg_iov = &mhdr->msg_iov[j];
+    if (sendmsg(sock->fd, &single, 0) < 0) {
+      entry[j].session->send_error = errno;
+      coap_log(LOG_CRIT, "coap_network_send: %s\n", coap_socket_strerror());
+    }
+  }
+}
+
+/*
+ * Send the @p count datagrams in @p mmsg, the first segment of each of
+ * which was queued as the matching @p entries.  The error of a datagram
+ * that cannot be sent is kept on the session that queued it.
+ */
+static void
+coap_send_batch_send(coap_context_t *context, coap_socket_t *sock,
+                     struct mmsghdr *mmsg, coap_send_entry_t **entries,
+                     unsigned int count) {
+  unsigned int done = 0;
+
+  while (done < count) {
+    int r = sendmmsg(sock->fd, &mmsg[done], count - done, 0);
+
+    if (r > 0) {
+      done += (unsigned int)r;
+      continue;
+    }
+    /* mmsg[done] could not be sent */
+    if (mmsg[done].msg_hdr.msg_iovlen > 1 && (errno == EIO || errno == EINVAL)) {
+      /* Outgoing interface cannot do UDP GSO, so stop trying to use it */
+      coap_log(LOG_DEBUG, "coap_send_batch_flush: UDP GSO disabled: %s\n",
+               coap_socket_strerror());
+      context->send_batch_no_gso = 1;
+      coap_send_batch_unsegment(sock, &mmsg[done].msg_hdr, entries[done]);
+    } else {
+      entries[done]->session->send_error = errno;
+      coap_log(LOG_CRIT, "coap_network_send: %s\n", coap_socket_strerror());
+    }
+    done++;
+  }
+}
+
+void
+coap_send_batch_flush(coap_context_t *context) {
+  /* Enough space for UDP_SEGMENT as well as all packet info types */
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(uint16_t)) +
+             CMSG_SPACE(sizeof(struct in6_pktinfo))];
+  } ctrl[COAP_MAX_SEND_BATCH];
+  struct mmsghdr mmsg[COAP_MAX_SEND_BATCH];
+  struct iovec iov[COAP_MAX_SEND_BATCH];
+  coap_send_entry_t *entries[COAP_MAX_SEND_BATCH];
+  unsigned int count = context->send_batch_count;
+  unsigned int i = 0;
+  unsigned int m = 0;
+
+  /* Make sure that any re-entrant calls do not see the entries */
+  context->send_batch_count = 0;
+
+  while (i < count) {
+    coap_send_entry_t *entry = &context->send_batch[i];
+    struct msghdr *mhdr = &mmsg[m].msg_hdr;
+    unsigned int segs = 1;
+
+    iov[i].iov_base = entry->data;
+    iov[i].iov_len = entry->length;
+#ifdef UDP_SEGMENT
+    if (!context->send_batch_no_gso) {
+      size_t total = entry->length;
+
+      /*
+       * Coalesce the following datagrams to the same peer into one GSO
+       * datagram. All segments must be the same size, other than the last
+       * one which may be shorter.
+       */
+      while (i + segs < count && segs < COAP_MAX_GSO_SEGMENTS) {
+        coap_send_entry_t *next = &context->send_batch[i + segs];
+
+        if (next->sock != entry->sock || next->ifindex != entry->ifindex ||
+            next->length > entry->length ||
+            total + next->length > COAP_MAX_GSO_SIZE ||
+            !coap_address_equals(&next->addr_info.remote,
+                                 &entry->addr_info.remote) ||
+            !coap_address_equals(&next->addr_info.local,
+                                 &entry->addr_info.local))
+          break;
+        iov[i + segs].iov_base = next->data;
+        iov[i + segs].iov_len = next->length;
+        total += next->length;
+        segs++;
+        if (next->length < entry->length)
+          break;
+      }
+    }
+#endif /* UDP_SEGMENT */
+
+    memset(mhdr, 0, sizeof(*mhdr));
+    mhdr->msg_name = &entry->addr_info.remote.addr;
+    mhdr->msg_namelen = entry->addr_info.remote.size;
+    mhdr->msg_iov = &iov[i];
+    mhdr->msg_iovlen = segs;
+#ifdef UDP_SEGMENT
+    if (segs > 1) {
+      struct cmsghdr *cmsg = &ctrl[m].align;
+      uint16_t gso_size = (uint16_t)entry->length;
+
+      mhdr->msg_control = ctrl[m].buf;
+      mhdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    }
+#endif /* UDP_SEGMENT */
+    /* Cannot fail, as coap_send_batch_add() checked the address family */
+    (void)coap_msghdr_add_pktinfo(mhdr, ctrl[m].buf, &entry->addr_info.local,
+                                  entry->ifindex);
+    if (mhdr->msg_controllen == 0)
+      mhdr->msg_control = NULL;
+    entries[m] = entry;
+    m++;
+    i += segs;
+
+    /* sendmmsg() works on a single socket */
+    if (i == count || context->send_batch[i].sock != entry->sock) {
+      coap_send_batch_send(context, entry->sock, mmsg, entries, m);
+      m = 0;
+    }
+  }
+}
+
+/*
+ * Queue up the datagram for sending by coap_send_batch_flush() if batching
+ * is enabled for the session's context. Datagrams that need the packet info
+ * of an unsupported address family are not queued, so that sending them
+ * fails straight away.
+ *
+ * Returns 1 if queued, 0 if the datagram is to be sent immediately.
+ */
+static int
+coap_send_batch_add(coap_socket_t *sock, const coap_session_t *session,
+                    const uint8_t *data, size_t datalen) {
+  coap_context_t *context = session->context;
+  coap_send_entry_t *entry;
+
+  if (context->max_send_batch <= 1)
+    return 0;
+  if (!coap_address_isany(&session->addr_info.local) &&
+      !coap_is_mcast(&session->addr_info.local) &&
+      session->addr_info.local.addr.sa.sa_family != AF_INET &&
+      session->addr_info.local.addr.sa.sa_family != AF_INET6)
+    return 0;
+  if (datalen > sizeof(entry->data)) {
+    /* Keep the order of datagrams */
+    coap_send_batch_flush(context);
+    return 0;
+  }
+  if (!context->send_batch) {
+    context->send_batch = coap_malloc_type(COAP_PACKET,
+                         context->max_send_batch * sizeof(coap_send_entry_t));
+    if (!context->send_batch)
+      return 0;
+    context->send_batch_size = context->max_send_batch;
+    context->send_batch_count = 0;
+  }
+  if (context->send_batch_count == context->send_batch_size)
+    coap_send_batch_flush(context);
+
+  entry = &context->send_batch[context->send_batch_count++];
+  entry->sock = sock;
+  /* Any error is reported by the next send for the session */
+  memcpy(&entry->session, &session, sizeof(entry->session));
+  entry->ifindex = session->ifindex;
+  memcpy(&entry->addr_info, &session->addr_info, sizeof(entry->addr_info));
+  entry->length = datalen;
+  memcpy(entry->data, data, datalen);
+  return 1;
+}
+#endif /* COAP_SEND_BATCH_SUPPORT */
+
 ssize_t
 coap_network_send(coap_socket_t *sock, const coap_session_t *session, const uint8_t *data, size_t datalen) {
   ssize_t bytes_written = 0;
@@ -640,6 +962,10 @@ coap_network_send(coap_socket_t *sock, const coap_session_t *session, const uint
     bytes_written = send(sock->fd, data, datalen, 0);
 #endif
 #endif
+#if COAP_SEND_BATCH_SUPPORT
+  } else if (coap_send_batch_add(sock, session, data, datalen)) {
+    bytes_written = (ssize_t)datalen;
+#endif /* COAP_SEND_BATCH_SUPPORT */
   } else {
 #ifdef _WIN32
     DWORD dwNumberOfBytesSent = 0;
@@ -666,103 +992,9 @@ coap_network_send(coap_socket_t *sock, const coap_session_t *session, const uint
     mhdr.msg_iov = iov;
     mhdr.msg_iovlen = 1;
 
-    if (!coap_address_isany(&session->addr_info.local) &&
-        !coap_is_mcast(&session->addr_info.local))
-    switch (session->addr_info.local.addr.sa.sa_family) {
-    case AF_INET6:
-    {
-      struct cmsghdr *cmsg;
-
-      if (IN6_IS_ADDR_V4MAPPED(&session->addr_info.local.addr.sin6.sin6_addr)) {
-#if defined(IP_PKTINFO)
-        struct in_pktinfo *pktinfo;
-        mhdr.msg_control = buf;
-        mhdr.msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
-
-        cmsg = CMSG_FIRSTHDR(&mhdr);
-        cmsg->cmsg_level = SOL_IP;
-        cmsg->cmsg_type = IP_PKTINFO;
-        cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-
-        pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-
-        pktinfo->ipi_ifindex = session->ifindex;
-        memcpy(&pktinfo->ipi_spec_dst,
-               session->addr_info.local.addr.sin6.sin6_addr.s6_addr + 12,
-               sizeof(pktinfo->ipi_spec_dst));
-#elif defined(IP_SENDSRCADDR)
-        mhdr.msg_control = buf;
-        mhdr.msg_controllen = CMSG_SPACE(sizeof(struct in_addr));
-
-        cmsg = CMSG_FIRSTHDR(&mhdr);
-        cmsg->cmsg_level = IPPROTO_IP;
-        cmsg->cmsg_type = IP_SENDSRCADDR;
-        cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
-
-        memcpy(CMSG_DATA(cmsg),
-               session->addr_info.local.addr.sin6.sin6_addr.s6_addr + 12,
-               sizeof(struct in_addr));
-#endif /* IP_PKTINFO */
-      } else {
-        struct in6_pktinfo *pktinfo;
-        mhdr.msg_control = buf;
-        mhdr.msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
-
-        cmsg = CMSG_FIRSTHDR(&mhdr);
-        cmsg->cmsg_level = IPPROTO_IPV6;
-        cmsg->cmsg_type = IPV6_PKTINFO;
-        cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-
-        pktinfo = (struct in6_pktinfo *)CMSG_DATA(cmsg);
-
-        pktinfo->ipi6_ifindex = session->ifindex;
-        memcpy(&pktinfo->ipi6_addr,
-               &session->addr_info.local.addr.sin6.sin6_addr,
-               sizeof(pktinfo->ipi6_addr));
-      }
-      break;
-    }
-    case AF_INET:
-    {
-#if defined(IP_PKTINFO)
-      struct cmsghdr *cmsg;
-      struct in_pktinfo *pktinfo;
-
-      mhdr.msg_control = buf;
-      mhdr.msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
-
-      cmsg = CMSG_FIRSTHDR(&mhdr);
-      cmsg->cmsg_level = SOL_IP;
-      cmsg->cmsg_type = IP_PKTINFO;
-      cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
-
-      pktinfo = (struct in_pktinfo *)CMSG_DATA(cmsg);
-
-      pktinfo->ipi_ifindex = session->ifindex;
-      memcpy(&pktinfo->ipi_spec_dst,
-             &session->addr_info.local.addr.sin.sin_addr,
-             sizeof(pktinfo->ipi_spec_dst));
-#elif defined(IP_SENDSRCADDR)
-      struct cmsghdr *cmsg;
-      mhdr.msg_control = buf;
-      mhdr.msg_controllen = CMSG_SPACE(sizeof(struct in_addr));
-
-      cmsg = CMSG_FIRSTHDR(&mhdr);
-      cmsg->cmsg_level = IPPROTO_IP;
-      cmsg->cmsg_type = IP_SENDSRCADDR;
-      cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
-
-      memcpy(CMSG_DATA(cmsg),
-             &session->addr_info.local.addr.sin.sin_addr,
-             sizeof(struct in_addr));
-#endif /* IP_PKTINFO */
-      break;
-    }
-    default:
-      /* error */
-      coap_log(LOG_WARNING, "protocol not supported\n");
-      bytes_written = -1;
-    }
+    if (coap_msghdr_add_pktinfo(&mhdr, buf, &session->addr_info.local,
+                                session->ifindex) < 0)
+      return -1;
 #endif /* HAVE_STRUCT_CMSGHDR */
 
 #ifdef _WIN32
@@ -807,6 +1039,88 @@ coap_packet_get_memmapped(coap_packet_t *packet, unsigned char **address, size_t
 }
 
 #ifndef RIOT_VERSION
+#if !defined(WITH_CONTIKI) && defined(HAVE_STRUCT_CMSGHDR)
+/*
+ * Fill in the local address and interface index of @p packet from the
+ * ancillary data returned by recvmsg() / recvmmsg() in @p mhdr.
+ */
+static void
+coap_packet_set_pktinfo(coap_socket_t *sock, coap_packet_t *packet,
+                        struct msghdr *mhdr) {
+  struct cmsghdr *cmsg;
+  int dst_found = 0;
+
+  /* Walk through ancillary data records until the local interface
+   * is found where the data was received. */
+  for (cmsg = CMSG_FIRSTHDR(mhdr); cmsg; cmsg = CMSG_NXTHDR(mhdr, cmsg)) {
+
+    /* get the local interface for IPv6 */
+    if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+      union {
+        uint8_t *c;
+        struct in6_pktinfo *p;
+      } u;
+      u.c = CMSG_DATA(cmsg);
+      packet->ifindex = (int)(u.p->ipi6_ifindex);
+      memcpy(&packet->addr_info.local.addr.sin6.sin6_addr,
+             &u.p->ipi6_addr, sizeof(struct in6_addr));
+      dst_found = 1;
+      break;
+    }
+
+    /* local interface for IPv4 */
+#if defined(IP_PKTINFO)
+    if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_PKTINFO) {
+      union {
+        uint8_t *c;
+        struct in_pktinfo *p;
+      } u;
+      u.c = CMSG_DATA(cmsg);
+      packet->ifindex = u.p->ipi_ifindex;
+      if (packet->addr_info.local.addr.sa.sa_family == AF_INET6) {
+        memset(packet->addr_info.local.addr.sin6.sin6_addr.s6_addr, 0, 10);
+        packet->addr_info.local.addr.sin6.sin6_addr.s6_addr[10] = 0xff;
+        packet->addr_info.local.addr.sin6.sin6_addr.s6_addr[11] = 0xff;
+        memcpy(packet->addr_info.local.addr.sin6.sin6_addr.s6_addr + 12,
+               &u.p->ipi_addr, sizeof(struct in_addr));
+      } else {
+        memcpy(&packet->addr_info.local.addr.sin.sin_addr,
+               &u.p->ipi_addr, sizeof(struct in_addr));
+      }
+      dst_found = 1;
+      break;
+    }
+#elif defined(IP_RECVDSTADDR)
+    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
+      packet->ifindex = sock->fd;
+      memcpy(&packet->addr_info.local.addr.sin.sin_addr,
+             CMSG_DATA(cmsg), sizeof(struct in_addr));
+      dst_found = 1;
+      break;
+    }
+#endif /* IP_PKTINFO */
+    if (!dst_found) {
+      /* cmsg_level / cmsg_type combination we do not understand
+         (ignore preset case for bad recvmsg() not updating cmsg) */
+      if (cmsg->cmsg_level != -1 && cmsg->cmsg_type != -1) {
+        coap_log(LOG_DEBUG,
+                 "cmsg_level = %d and cmsg_type = %d not supported - fix\n",
+                 cmsg->cmsg_level, cmsg->cmsg_type);
+      }
+    }
+  }
+  if (!dst_found) {
+    /* Not expected, but cmsg_level and cmsg_type don't match above and
+       may need a new case */
+    packet->ifindex = (int)sock->fd;
+    if (getsockname(sock->fd, &packet->addr_info.local.addr.sa,
+        &packet->addr_info.local.size) < 0) {
+      coap_log(LOG_DEBUG, "Cannot determine local port\n");
+    }
+  }
+}
+#endif /* ! WITH_CONTIKI && HAVE_STRUCT_CMSGHDR */
+
 ssize_t
 coap_network_read(coap_socket_t *sock, coap_packet_t *packet) {
   ssize_t len = -1;
@@ -919,79 +1233,9 @@ coap_network_read(coap_socket_t *sock, coap_packet_t *packet) {
       goto error;
     } else {
 #ifdef HAVE_STRUCT_CMSGHDR
-      int dst_found = 0;
-
       packet->addr_info.remote.size = mhdr.msg_namelen;
       packet->length = (size_t)len;
-
-      /* Walk through ancillary data records until the local interface
-       * is found where the data was received. */
-      for (cmsg = CMSG_FIRSTHDR(&mhdr); cmsg; cmsg = CMSG_NXTHDR(&mhdr, cmsg)) {
-
-        /* get the local interface for IPv6 */
-        if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
-          union {
-            uint8_t *c;
-            struct in6_pktinfo *p;
-          } u;
-          u.c = CMSG_DATA(cmsg);
-          packet->ifindex = (int)(u.p->ipi6_ifindex);
-          memcpy(&packet->addr_info.local.addr.sin6.sin6_addr,
-                 &u.p->ipi6_addr, sizeof(struct in6_addr));
-          dst_found = 1;
-          break;
-        }
-
-        /* local interface for IPv4 */
-#if defined(IP_PKTINFO)
-        if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_PKTINFO) {
-          union {
-            uint8_t *c;
-            struct in_pktinfo *p;
-          } u;
-          u.c = CMSG_DATA(cmsg);
-          packet->ifindex = u.p->ipi_ifindex;
-          if (packet->addr_info.local.addr.sa.sa_family == AF_INET6) {
-            memset(packet->addr_info.local.addr.sin6.sin6_addr.s6_addr, 0, 10);
-            packet->addr_info.local.addr.sin6.sin6_addr.s6_addr[10] = 0xff;
-            packet->addr_info.local.addr.sin6.sin6_addr.s6_addr[11] = 0xff;
-            memcpy(packet->addr_info.local.addr.sin6.sin6_addr.s6_addr + 12,
-                   &u.p->ipi_addr, sizeof(struct in_addr));
-          } else {
-            memcpy(&packet->addr_info.local.addr.sin.sin_addr,
-                   &u.p->ipi_addr, sizeof(struct in_addr));
-          }
-          dst_found = 1;
-          break;
-        }
-#elif defined(IP_RECVDSTADDR)
-        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVDSTADDR) {
-          packet->ifindex = sock->fd;
-          memcpy(&packet->addr_info.local.addr.sin.sin_addr,
-                 CMSG_DATA(cmsg), sizeof(struct in_addr));
-          dst_found = 1;
-          break;
-        }
-#endif /* IP_PKTINFO */
-        if (!dst_found) {
-          /* cmsg_level / cmsg_type combination we do not understand
-             (ignore preset case for bad recvmsg() not updating cmsg) */
-          if (cmsg->cmsg_level != -1 && cmsg->cmsg_type != -1) {
-            coap_log(LOG_DEBUG,
-                     "cmsg_level = %d and cmsg_type = %d not supported - fix\n",
-                     cmsg->cmsg_level, cmsg->cmsg_type);
-          }
-        }
-      }
-      if (!dst_found) {
-        /* Not expected, but cmsg_level and cmsg_type don't match above and
-           may need a new case */
-        packet->ifindex = (int)sock->fd;
-        if (getsockname(sock->fd, &packet->addr_info.local.addr.sa,
-            &packet->addr_info.local.size) < 0) {
-          coap_log(LOG_DEBUG, "Cannot determine local port\n");
-        }
-      }
+      coap_packet_set_pktinfo(sock, packet, &mhdr);
 #else /* ! HAVE_STRUCT_CMSGHDR */
       packet->length = (size_t)len;
       packet->ifindex = 0;
@@ -1065,6 +1309,84 @@ error:
 #endif
   return -1;
 }
+
+#if COAP_READ_BATCH_SUPPORT
+int
+coap_network_read_batch(coap_socket_t *sock, coap_packet_t *packets,
+                        size_t count) {
+#if defined(HAVE_RECVMMSG) && defined(HAVE_STRUCT_CMSGHDR)
+  /* a buffer large enough to hold all packet info types, ipv6 is the largest */
+  char buf[COAP_MAX_READ_BATCH][CMSG_SPACE(sizeof(struct in6_pktinfo))];
+  struct mmsghdr mmsg[COAP_MAX_READ_BATCH];
+  struct iovec iov[COAP_MAX_READ_BATCH];
+  size_t i;
+  int r;
+
+  assert(sock);
+  assert(packets);
+
+  if (count > COAP_MAX_READ_BATCH)
+    count = COAP_MAX_READ_BATCH;
+  if (count <= 1 || (sock->flags & COAP_SOCKET_CONNECTED)) {
+    /* Nothing to be gained, use the single datagram path */
+    ssize_t len = coap_network_read(sock, &packets[0]);
+
+    return len < 0 ? -1 : len > 0 ? 1 : 0;
+  }
+
+  if ((sock->flags & COAP_SOCKET_CAN_READ) == 0) {
+    return -1;
+  } else {
+    /* clear has-data flag */
+    sock->flags &= ~COAP_SOCKET_CAN_READ;
+  }
+
+  memset(mmsg, 0, count * sizeof(mmsg[0]));
+  for (i = 0; i < count; i++) {
+    struct cmsghdr *cmsg;
+
+    iov[i].iov_base = packets[i].payload;
+    iov[i].iov_len = (iov_len_t)COAP_RXBUFFER_SIZE;
+
+    mmsg[i].msg_hdr.msg_name = (struct sockaddr*)&packets[i].addr_info.remote.addr;
+    mmsg[i].msg_hdr.msg_namelen = sizeof(packets[i].addr_info.remote.addr);
+    mmsg[i].msg_hdr.msg_iov = &iov[i];
+    mmsg[i].msg_hdr.msg_iovlen = 1;
+    mmsg[i].msg_hdr.msg_control = buf[i];
+    mmsg[i].msg_hdr.msg_controllen = sizeof(buf[i]);
+    /* preset the first cmsg with bad data as for coap_network_read() */
+    cmsg = (struct cmsghdr *)buf[i];
+    cmsg->cmsg_len = CMSG_LEN(sizeof(buf[i]));
+    cmsg->cmsg_level = -1;
+    cmsg->cmsg_type = -1;
+  }
+
+  r = recvmmsg(sock->fd, mmsg, (unsigned int)count, MSG_DONTWAIT, NULL);
+  if (r < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) {
+      /* Nothing (left) to read, or server-side ICMP destination unreachable */
+      return 0;
+    }
+    coap_log(LOG_WARNING, "coap_network_read_batch: %s\n",
+             coap_socket_strerror());
+    return -1;
+  }
+
+  for (i = 0; i < (size_t)r; i++) {
+    packets[i].addr_info.remote.size = mmsg[i].msg_hdr.msg_namelen;
+    packets[i].length = (size_t)mmsg[i].msg_len;
+    coap_packet_set_pktinfo(sock, &packets[i], &mmsg[i].msg_hdr);
+  }
+  return r;
+#else /* ! HAVE_RECVMMSG || ! HAVE_STRUCT_CMSGHDR */
+  ssize_t len;
+
+  (void)count;
+  len = coap_network_read(sock, &packets[0]);
+  return len < 0 ? -1 : len > 0 ? 1 : 0;
+#endif /* ! HAVE_RECVMMSG || ! HAVE_STRUCT_CMSGHDR */
+}
+#endif /* COAP_READ_BATCH_SUPPORT */
 #endif /* RIOT_VERSION */
 
 #if !defined(WITH_CONTIKI)
@@ -1117,6 +1439,81 @@ coap_io_prepare_epoll(coap_context_t *ctx, coap_tick_t now) {
 #endif /* COAP_EPOLL_SUPPORT */
 }
 
+#if COAP_SERVER_SUPPORT
+/*
+ * Checks the idle, (D)TLS handshake and large body timeouts of server
+ * session @p s.
+ *
+ * return 1 if the session has been freed, else 0 with @p deadline set to
+ *          when the session next needs checking (0 if nothing is pending)
+ */
+static int
+coap_check_server_session(coap_context_t *ctx, coap_session_t *s,
+                          coap_tick_t now, coap_tick_t session_timeout,
+                          int check_dtls_timeouts, coap_tick_t *deadline) {
+  coap_tick_t s_timeout;
+  coap_tick_t next = 0;
+
+  /* Check whether an idle server session should be released */
+  if (s->type == COAP_SESSION_TYPE_SERVER && s->ref == 0 &&
+      s->delayqueue == NULL) {
+    if (s->last_rx_tx + session_timeout <= now ||
+        s->state == COAP_SESSION_STATE_NONE) {
+      coap_handle_event(ctx, COAP_EVENT_SERVER_SESSION_DEL, s);
+      coap_session_free(s);
+      return 1;
+    }
+    next = s->last_rx_tx + session_timeout;
+  }
+  /* Make sure the session object is not deleted in any callbacks */
+  coap_session_reference(s);
+  /* Check any DTLS timeouts and expire if appropriate */
+  if (check_dtls_timeouts && s->state == COAP_SESSION_STATE_HANDSHAKE &&
+      s->proto == COAP_PROTO_DTLS && s->tls) {
+    coap_tick_t tls_timeout = coap_dtls_get_timeout(s, now);
+    while (tls_timeout > 0 && tls_timeout <= now) {
+      coap_log(LOG_DEBUG, "** %s: DTLS retransmit timeout\n",
+               coap_session_str(s));
+      if (coap_dtls_handle_timeout(s)) {
+        /* Have another look once the session has been released */
+        next = now + 1;
+        goto release;
+      }
+
+      if (s->tls)
+        tls_timeout = coap_dtls_get_timeout(s, now);
+      else {
+        tls_timeout = 0;
+        next = now + 1;
+      }
+    }
+    if (tls_timeout > 0 && (next == 0 || tls_timeout < next))
+      next = tls_timeout;
+  }
+  /* Check if any server large receives have timed out */
+  if (s->lg_srcv) {
+    if (coap_block_check_lg_srcv_timeouts(s, now, &s_timeout)) {
+      if (next == 0 || now + s_timeout < next)
+        next = now + s_timeout;
+    }
+  }
+  /* Check if any server large sending have timed out */
+  if (s->lg_xmit) {
+    if (coap_block_check_lg_xmit_timeouts(s, now, &s_timeout)) {
+      if (next == 0 || now + s_timeout < next)
+        next = now + s_timeout;
+    }
+  }
+release:
+  coap_session_release(s);
+  /* Never schedule the session for a time that has already passed */
+  if (next != 0 && next <= now)
+    next = now + 1;
+  *deadline = next;
+  return 0;
+}
+#endif /* COAP_SERVER_SUPPORT */
+
 /*
  * return  0 No i/o pending
  *       +ve millisecs to next i/o activity
@@ -1129,7 +1526,10 @@ coap_io_prepare_io(coap_context_t *ctx,
            coap_tick_t now)
 {
   coap_queue_t *nextpdu;
-  coap_session_t *s, *rtmp;
+  coap_session_t *s;
+#if COAP_CLIENT_SUPPORT || !defined(COAP_EPOLL_SUPPORT)
+  coap_session_t *rtmp;
+#endif /* COAP_CLIENT_SUPPORT || ! COAP_EPOLL_SUPPORT */
   coap_tick_t timeout = 0;
   coap_tick_t s_timeout;
 #if COAP_SERVER_SUPPORT
@@ -1182,7 +1582,6 @@ coap_io_prepare_io(coap_context_t *ctx,
     }
   }
 #if COAP_SERVER_SUPPORT
-  coap_endpoint_t *ep;
   coap_tick_t session_timeout;
 
   if (ctx->session_timeout > 0)
@@ -1190,75 +1589,41 @@ coap_io_prepare_io(coap_context_t *ctx,
   else
     session_timeout = COAP_DEFAULT_SESSION_TIMEOUT * COAP_TICKS_PER_SECOND;
 
-  LL_FOREACH(ctx->endpoint, ep) {
+  /* Only the server sessions that are due need to be looked at */
+  while ((s = coap_session_next_deadline(ctx)) != NULL && s->deadline <= now) {
+    coap_tick_t deadline;
+
+    if (coap_check_server_session(ctx, s, now, session_timeout,
+                                  check_dtls_timeouts, &deadline))
+      continue;
+    /* Must be done after the final release, which reschedules the session */
+    coap_session_set_deadline(s, deadline);
+  }
+  if (s) {
+    s_timeout = s->deadline - now;
+    if (timeout == 0 || s_timeout < timeout)
+      timeout = s_timeout;
+  }
+
 #ifndef COAP_EPOLL_SUPPORT
+  coap_endpoint_t *ep;
+
+  LL_FOREACH(ctx->endpoint, ep) {
     if (ep->sock.flags & (COAP_SOCKET_WANT_READ | COAP_SOCKET_WANT_WRITE | COAP_SOCKET_WANT_ACCEPT)) {
       if (*num_sockets < max_sockets)
         sockets[(*num_sockets)++] = &ep->sock;
     }
-#endif /* ! COAP_EPOLL_SUPPORT */
-    SESSIONS_ITER_SAFE(ep->sessions, s, rtmp) {
-      /* Check whether any idle server sessions should be released */
-      if (s->type == COAP_SESSION_TYPE_SERVER && s->ref == 0 &&
-          s->delayqueue == NULL &&
-          (s->last_rx_tx + session_timeout <= now ||
-           s->state == COAP_SESSION_STATE_NONE)) {
-        coap_handle_event(ctx, COAP_EVENT_SERVER_SESSION_DEL, s);
-        coap_session_free(s);
-      } else {
-        if (s->type == COAP_SESSION_TYPE_SERVER && s->ref == 0 &&
-            s->delayqueue == NULL) {
-          s_timeout = (s->last_rx_tx + session_timeout) - now;
-          if (timeout == 0 || s_timeout < timeout)
-            timeout = s_timeout;
-        }
-        /* Make sure the session object is not deleted in any callbacks */
-        coap_session_reference(s);
-        /* Check any DTLS timeouts and expire if appropriate */
-        if (check_dtls_timeouts && s->state == COAP_SESSION_STATE_HANDSHAKE &&
-            s->proto == COAP_PROTO_DTLS && s->tls) {
-          coap_tick_t tls_timeout = coap_dtls_get_timeout(s, now);
-          while (tls_timeout > 0 && tls_timeout <= now) {
-            coap_log(LOG_DEBUG, "** %s: DTLS retransmit timeout\n",
-                     coap_session_str(s));
-            if (coap_dtls_handle_timeout(s))
-              goto release_1;
-
-            if (s->tls)
-              tls_timeout = coap_dtls_get_timeout(s, now);
-            else {
-              tls_timeout = 0;
-              timeout = 1;
-            }
-          }
-          if (tls_timeout > 0 && (timeout == 0 || tls_timeout - now < timeout))
-            timeout = tls_timeout - now;
-        }
-        /* Check if any server large receives have timed out */
-        if (s->lg_srcv) {
-          if (coap_block_check_lg_srcv_timeouts(s, now, &s_timeout)) {
-            if (timeout == 0 || s_timeout < timeout)
-              timeout = s_timeout;
-          }
-        }
-        /* Check if any server large sending have timed out */
-        if (s->lg_xmit) {
-          if (coap_block_check_lg_xmit_timeouts(s, now, &s_timeout)) {
-            if (timeout == 0 || s_timeout < timeout)
-              timeout = s_timeout;
-          }
-        }
-#ifndef COAP_EPOLL_SUPPORT
-        if (s->sock.flags & (COAP_SOCKET_WANT_READ|COAP_SOCKET_WANT_WRITE)) {
-          if (*num_sockets < max_sockets)
-            sockets[(*num_sockets)++] = &s->sock;
-        }
-#endif /* ! COAP_EPOLL_SUPPORT */
-release_1:
-        coap_session_release(s);
+    /* Datagram server sessions all share the endpoint socket */
+    if (COAP_PROTO_NOT_RELIABLE(ep->proto))
+      continue;
+    SESSIONS_ITER(ep->sessions, s, rtmp) {
+      if (s->sock.flags & (COAP_SOCKET_WANT_READ|COAP_SOCKET_WANT_WRITE)) {
+        if (*num_sockets < max_sockets)
+          sockets[(*num_sockets)++] = &s->sock;
       }
     }
   }
+#endif /* ! COAP_EPOLL_SUPPORT */
 #endif /* COAP_SERVER_SUPPORT */
 #if COAP_CLIENT_SUPPORT
   SESSIONS_ITER_SAFE(ctx->sessions, s, rtmp) {
@@ -1352,6 +1717,9 @@ release_2:
   }
 #endif /* COAP_CLIENT_SUPPORT */
 
+  /* Send off anything queued up by the above */
+  coap_send_batch_flush(ctx);
+
   return (unsigned int)((timeout * 1000 + COAP_TICKS_PER_SECOND - 1) / COAP_TICKS_PER_SECOND);
 }
 
@@ -1609,6 +1977,14 @@ const char *coap_socket_strerror(void) {
 ssize_t
 coap_socket_send(coap_socket_t *sock, coap_session_t *session,
   const uint8_t *data, size_t data_len) {
+#if COAP_SEND_BATCH_SUPPORT
+  if (session->send_error) {
+    /* A datagram queued earlier for this session could not be sent */
+    errno = session->send_error;
+    session->send_error = 0;
+    return -1;
+  }
+#endif /* COAP_SEND_BATCH_SUPPORT */
   return session->context->network_send(sock, session, data, data_len);
 }
 
@@ -66,6 +66,9 @@
 #include <mbedtls/oid.h>
 #include <mbedtls/debug.h>
 #include <mbedtls/sha256.h>
+#if defined(MBEDTLS_SSL_CACHE_C)
+#include <mbedtls/ssl_cache.h>
+#endif /* MBEDTLS_SSL_CACHE_C */
 #if defined(ESPIDF_VERSION) && defined(CONFIG_MBEDTLS_DEBUG)
 #include <mbedtls/esp_debug.h>
 #endif /* ESPIDF_VERSION && CONFIG_MBEDTLS_DEBUG */
@@ -96,6 +99,11 @@
 #undef MBEDTLS_SSL_CLI_C
 #endif /* ! COAP_CLIENT_SUPPORT */
 
+/* mbedtls_ssl_session_save() and mbedtls_ssl_session_load() */
+#if defined(MBEDTLS_SSL_CLI_C) && MBEDTLS_VERSION_NUMBER >= 0x02130000
+#define COAP_MBEDTLS_RESUME_CLIENT 1
+#endif /* MBEDTLS_SSL_CLI_C && MBEDTLS_VERSION_NUMBER >= 0x02130000 */
+
 #ifdef _WIN32
 #define strcasecmp _stricmp
 #endif
@@ -133,6 +141,9 @@ typedef struct coap_mbedtls_env_t {
   coap_tick_t last_timeout;
   unsigned int retry_scalar;
   coap_ssl_t coap_ssl_data;
+#ifdef COAP_MBEDTLS_RESUME_CLIENT
+  coap_bin_const_t *resume_state; /* Session offered to be resumed */
+#endif /* COAP_MBEDTLS_RESUME_CLIENT */
 } coap_mbedtls_env_t;
 
 typedef struct pki_sni_entry {
@@ -157,6 +168,10 @@ typedef struct coap_mbedtls_context_t {
   char *root_ca_file;
   char *root_ca_path;
   int psk_pki_enabled;
+#if defined(MBEDTLS_SSL_CACHE_C)
+  mbedtls_ssl_cache_context cache;  /* Sessions a server can resume */
+  int cache_enabled;
+#endif /* MBEDTLS_SSL_CACHE_C */
 } coap_mbedtls_context_t;
 
 typedef enum coap_enc_method_t {
@@ -1021,6 +1036,13 @@ static int setup_server_ssl_session(coap_session_t *c_session,
     goto fail;
   }
 
+#if defined(MBEDTLS_SSL_CACHE_C)
+  if (m_context->cache_enabled)
+    mbedtls_ssl_conf_session_cache(&m_env->conf, &m_context->cache,
+                                   mbedtls_ssl_cache_get,
+                                   mbedtls_ssl_cache_set);
+#endif /* MBEDTLS_SSL_CACHE_C */
+
 #if defined(MBEDTLS_SSL_PROTO_DTLS)
   mbedtls_ssl_conf_dtls_cookies(&m_env->conf, mbedtls_ssl_cookie_write,
                                 mbedtls_ssl_cookie_check,
@@ -1250,7 +1272,60 @@ static void mbedtls_cleanup(coap_mbedtls_env_t *m_env)
   mbedtls_ctr_drbg_free(&m_env->ctr_drbg);
   mbedtls_ssl_free(&m_env->ssl);
   mbedtls_ssl_cookie_free(&m_env->cookie_ctx);
+#ifdef COAP_MBEDTLS_RESUME_CLIENT
+  coap_delete_bin_const(m_env->resume_state);
+  m_env->resume_state = NULL;
+#endif /* COAP_MBEDTLS_RESUME_CLIENT */
+}
+
+#ifdef COAP_MBEDTLS_RESUME_CLIENT
+/*
+ * Offers the session that was kept for the server, if any, to be resumed.
+ * A full handshake is done if the server does not resume it.
+ */
+static void
+resume_client_session(coap_session_t *c_session, coap_mbedtls_env_t *m_env) {
+  const coap_bin_const_t *state = coap_dtls_resume_find(c_session);
+  mbedtls_ssl_session session;
+
+  if (!state)
+    return;
+  mbedtls_ssl_session_init(&session);
+  if (mbedtls_ssl_session_load(&session, state->s, state->length) == 0 &&
+      mbedtls_ssl_set_session(&m_env->ssl, &session) == 0)
+    m_env->resume_state = coap_new_bin_const(state->s, state->length);
+  mbedtls_ssl_session_free(&session);
+}
+
+/*
+ * Keeps the session of an established client session, so that the next
+ * session to the same server can resume it.  Mbed TLS does not say whether a
+ * session was resumed, but one that was is the same as the one offered.
+ */
+static void
+save_client_session(coap_session_t *c_session, coap_mbedtls_env_t *m_env) {
+  mbedtls_ssl_session session;
+  unsigned char *buf = NULL;
+  size_t len = 0;
+
+  mbedtls_ssl_session_init(&session);
+  if (mbedtls_ssl_get_session(&m_env->ssl, &session) != 0)
+    goto done;
+  if (mbedtls_ssl_session_save(&session, NULL, 0, &len) !=
+      MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL)
+    goto done;
+  buf = mbedtls_malloc(len);
+  if (!buf || mbedtls_ssl_session_save(&session, buf, len, &len) != 0)
+    goto done;
+  c_session->dtls_resumed = m_env->resume_state &&
+                            m_env->resume_state->length == len &&
+                            memcmp(m_env->resume_state->s, buf, len) == 0;
+  coap_dtls_resume_save(c_session, buf, len);
+done:
+  mbedtls_free(buf);
+  mbedtls_ssl_session_free(&session);
 }
+#endif /* COAP_MBEDTLS_RESUME_CLIENT */
 
 static void
 coap_dtls_free_mbedtls_env(coap_mbedtls_env_t *m_env) {
@@ -1290,8 +1365,13 @@ static int do_mbedtls_handshake(coap_session_t *c_session,
   switch (ret) {
   case 0:
     m_env->established = 1;
-    coap_log(LOG_DEBUG, "*  %s: Mbed TLS established\n",
-                                            coap_session_str(c_session));
+#ifdef COAP_MBEDTLS_RESUME_CLIENT
+    if (c_session->type == COAP_SESSION_TYPE_CLIENT && c_session->dtls_resume)
+      save_client_session(c_session, m_env);
+#endif /* COAP_MBEDTLS_RESUME_CLIENT */
+    coap_log(LOG_DEBUG, "*  %s: Mbed TLS established%s\n",
+                        coap_session_str(c_session),
+                        c_session->dtls_resumed ? " (resumed)" : "");
     ret = 1;
     break;
   case MBEDTLS_ERR_SSL_WANT_READ:
@@ -1567,6 +1647,10 @@ static coap_mbedtls_env_t *coap_dtls_new_mbedtls_env(coap_session_t *c_session,
   if ((ret = mbedtls_ssl_setup(&m_env->ssl, &m_env->conf)) != 0) {
     goto fail;
   }
+#ifdef COAP_MBEDTLS_RESUME_CLIENT
+  if (role == COAP_DTLS_ROLE_CLIENT && c_session->dtls_resume)
+    resume_client_session(c_session, m_env);
+#endif /* COAP_MBEDTLS_RESUME_CLIENT */
   if (proto == COAP_PROTO_DTLS) {
     mbedtls_ssl_set_bio(&m_env->ssl, c_session, coap_dgram_write,
                         coap_dgram_read, NULL);
@@ -1629,6 +1713,27 @@ void *coap_dtls_new_context(coap_context_t *c_context)
 }
 
 #if COAP_SERVER_SUPPORT
+/*
+ * Sets up the cache of sessions that clients can resume, which holds up to
+ * COAP_DTLS_SESSION_CACHE_SIZE sessions and drops the oldest first.
+ */
+static void
+setup_session_cache(coap_mbedtls_context_t *m_context) {
+#if defined(MBEDTLS_SSL_CACHE_C)
+  if (!m_context->cache_enabled) {
+    mbedtls_ssl_cache_init(&m_context->cache);
+    mbedtls_ssl_cache_set_max_entries(&m_context->cache,
+                                      COAP_DTLS_SESSION_CACHE_SIZE);
+    mbedtls_ssl_cache_set_timeout(&m_context->cache,
+                                  COAP_DTLS_SESSION_LIFETIME);
+    m_context->cache_enabled = 1;
+  }
+#else /* ! MBEDTLS_SSL_CACHE_C */
+  (void)m_context;
+  coap_log(LOG_WARNING, "Session resumption needs MBEDTLS_SSL_CACHE_C\n");
+#endif /* ! MBEDTLS_SSL_CACHE_C */
+}
+
 /*
  * return 0 failed
  *        1 passed
@@ -1649,6 +1754,8 @@ coap_dtls_context_set_spsk(coap_context_t *c_context,
   if (!m_context || !setup_data)
     return 0;
 
+  if (setup_data->session_resumption)
+    setup_session_cache(m_context);
   m_context->psk_pki_enabled |= IS_PSK;
   return 1;
 }
@@ -1687,7 +1794,7 @@ coap_dtls_context_set_cpsk(coap_context_t *c_context,
 
 int coap_dtls_context_set_pki(coap_context_t *c_context,
                               const coap_dtls_pki_t *setup_data,
-                              const coap_dtls_role_t role COAP_UNUSED)
+                              const coap_dtls_role_t role)
 {
   coap_mbedtls_context_t *m_context =
              ((coap_mbedtls_context_t *)c_context->dtls_context);
@@ -1707,6 +1814,12 @@ int coap_dtls_context_set_pki(coap_context_t *c_context,
     m_context->setup_data.allow_bad_md_hash = 1;
     m_context->setup_data.allow_short_rsa_length = 1;
   }
+#if COAP_SERVER_SUPPORT
+  if (role == COAP_DTLS_ROLE_SERVER && setup_data->session_resumption)
+    setup_session_cache(m_context);
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)role;
+#endif /* ! COAP_SERVER_SUPPORT */
   m_context->psk_pki_enabled |= IS_PKI;
   return 1;
 }
@@ -1785,6 +1898,10 @@ void coap_dtls_free_context(void *dtls_context)
     mbedtls_free(m_context->root_ca_path);
   if (m_context->root_ca_file)
     mbedtls_free(m_context->root_ca_file);
+#if defined(MBEDTLS_SSL_CACHE_C)
+  if (m_context->cache_enabled)
+    mbedtls_ssl_cache_free(&m_context->cache);
+#endif /* MBEDTLS_SSL_CACHE_C */
 
   mbedtls_free(m_context);
 }
@@ -2182,6 +2299,19 @@ int coap_dtls_hello(coap_session_t *c_session,
   return ret;
 #endif /* MBEDTLS_SSL_PROTO_DTLS && MBEDTLS_SSL_SRV_C */
 }
+
+int
+coap_dtls_hello_filter(coap_endpoint_t *endpoint COAP_UNUSED,
+                       const coap_addr_tuple_t *addr_info COAP_UNUSED,
+                       int ifindex COAP_UNUSED,
+                       const uint8_t *data COAP_UNUSED,
+                       size_t data_len COAP_UNUSED) {
+  /*
+   * Mbed TLS only checks the cookie within a handshake, so this is left to
+   * coap_dtls_hello() on a HELLO session
+   */
+  return 1;
+}
 #endif /* COAP_SERVER_SUPPORT */
 
 unsigned int coap_dtls_get_overhead(coap_session_t *c_session)
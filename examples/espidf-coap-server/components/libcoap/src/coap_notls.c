@@ -176,6 +176,15 @@ coap_dtls_hello(coap_session_t *session COAP_UNUSED,
 ) {
   return 0;
 }
+
+int
+coap_dtls_hello_filter(coap_endpoint_t *endpoint COAP_UNUSED,
+                       const coap_addr_tuple_t *addr_info COAP_UNUSED,
+                       int ifindex COAP_UNUSED,
+                       const uint8_t *data COAP_UNUSED,
+                       size_t data_len COAP_UNUSED) {
+  return 1;
+}
 #endif /* COAP_SERVER_SUPPORT */
 
 unsigned int coap_dtls_get_overhead(coap_session_t *session COAP_UNUSED) {
@@ -119,6 +119,8 @@ typedef struct coap_tls_context_t {
 
 #define IS_PSK 0x1
 #define IS_PKI 0x2
+#define IS_CLIENT 0x4
+#define IS_SERVER 0x8
 
 typedef struct sni_entry {
   char *sni;
@@ -148,6 +150,7 @@ typedef struct coap_openssl_context_t {
   sni_entry *sni_entry_list;
   size_t psk_sni_count;
   psk_sni_entry *psk_sni_entry_list;
+  int session_resume;  /**< IS_SERVER and/or IS_CLIENT resuming sessions */
 } coap_openssl_context_t;
 
 #if COAP_SERVER_SUPPORT
@@ -312,6 +315,13 @@ static int coap_dgram_write(BIO *a, const char *in, int inl) {
       BIO_clear_retry_flags(a);
       return -1;
     }
+    if (data->session->endpoint &&
+        data->session == data->session->endpoint->hello) {
+      /* A HelloVerifyRequest from coap_dtls_hello_filter() */
+      ret = (int)coap_socket_send(&data->session->endpoint->sock,
+                                  data->session, (const uint8_t *)in,
+                                  (size_t)inl);
+    } else
 #endif /* COAP_SERVER_SUPPORT */
     ret = (int)coap_session_send(data->session, (const uint8_t *)in, (size_t)inl);
     BIO_clear_retry_flags(a);
@@ -622,6 +632,74 @@ static void coap_dtls_info_callback(const SSL *ssl, int where, int ret) {
 
   if (where == SSL_CB_HANDSHAKE_START && SSL_get_state(ssl) == TLS_ST_OK)
     session->dtls_event = COAP_EVENT_DTLS_RENEGOTIATE;
+  else if (where == SSL_CB_HANDSHAKE_DONE && session) {
+    session->dtls_resumed = SSL_session_reused((SSL *)ssl) ? 1 : 0;
+    if (session->dtls_resumed && dtls_log_level >= LOG_DEBUG)
+      coap_log(LOG_DEBUG, "*  %s: session resumed\n",
+               coap_session_str(session));
+  }
+}
+
+#if COAP_CLIENT_SUPPORT
+/*
+ * Called with each new session that a client has negotiated, which is kept
+ * so that the next session to the same server can resume it.
+ */
+static int
+coap_openssl_new_session(SSL *ssl, SSL_SESSION *ssl_session) {
+  coap_session_t *session = (coap_session_t *)SSL_get_app_data(ssl);
+  unsigned char *buf;
+  unsigned char *p;
+  int len;
+
+  if (!session || session->type != COAP_SESSION_TYPE_CLIENT ||
+      !session->dtls_resume)
+    return 0;
+  len = i2d_SSL_SESSION(ssl_session, NULL);
+  if (len <= 0)
+    return 0;
+  buf = OPENSSL_malloc(len);
+  if (!buf)
+    return 0;
+  p = buf;
+  if (i2d_SSL_SESSION(ssl_session, &p) == len)
+    coap_dtls_resume_save(session, buf, (size_t)len);
+  OPENSSL_free(buf);
+  /* The session has not been kept by reference */
+  return 0;
+}
+#endif /* COAP_CLIENT_SUPPORT */
+
+/*
+ * Sets up session resumption for a server or client role.  A server keeps
+ * up to COAP_DTLS_SESSION_CACHE_SIZE sessions by session ID rather than
+ * issuing stateless tickets, so that the sessions that can be resumed are
+ * bounded and dropped oldest first.  A client has each new session passed
+ * to coap_openssl_new_session(), and only keeps them in its own cache if it
+ * also is a server that resumes sessions.
+ */
+static void
+setup_session_cache(coap_openssl_context_t *context, SSL_CTX *ctx, int role) {
+  static const unsigned char sid_ctx[] = "libcoap";
+  long mode = SSL_CTX_get_session_cache_mode(ctx);
+
+  if (role == IS_SERVER) {
+    mode = (mode & ~SSL_SESS_CACHE_NO_INTERNAL_STORE) | SSL_SESS_CACHE_SERVER;
+    SSL_CTX_sess_set_cache_size(ctx, COAP_DTLS_SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, COAP_DTLS_SESSION_LIFETIME);
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+  }
+#if COAP_CLIENT_SUPPORT
+  else {
+    mode |= SSL_SESS_CACHE_CLIENT;
+    if (!(context->session_resume & IS_SERVER))
+      mode |= SSL_SESS_CACHE_NO_INTERNAL_STORE;
+    SSL_CTX_sess_set_new_cb(ctx, coap_openssl_new_session);
+  }
+#endif /* COAP_CLIENT_SUPPORT */
+  SSL_CTX_set_session_cache_mode(ctx, mode);
+  context->session_resume |= role;
 }
 
 #if !COAP_DISABLE_TCP
@@ -854,6 +932,12 @@ coap_dtls_context_set_spsk(coap_context_t *c_context,
 #endif /* !COAP_DISABLE_TCP */
 #endif /* OPENSSL_VERSION_NUMBER >= 0x10101000L */
   }
+  if (setup_data->session_resumption) {
+    setup_session_cache(o_context, o_context->dtls.ctx, IS_SERVER);
+#if !COAP_DISABLE_TCP
+    setup_session_cache(o_context, o_context->tls.ctx, IS_SERVER);
+#endif /* !COAP_DISABLE_TCP */
+  }
 
   if (!o_context->dtls.ssl) {
     /* This is set up to handle new incoming sessions to a server */
@@ -2675,6 +2759,12 @@ coap_dtls_context_set_pki(coap_context_t *ctx,
       SSL_CTX_set_alpn_select_cb(context->tls.ctx, server_alpn_callback, NULL);
     }
 #endif /* !COAP_DISABLE_TCP */
+    if (setup_data->session_resumption) {
+      setup_session_cache(context, context->dtls.ctx, IS_SERVER);
+#if !COAP_DISABLE_TCP
+      setup_session_cache(context, context->tls.ctx, IS_SERVER);
+#endif /* !COAP_DISABLE_TCP */
+    }
   }
 #else /* ! COAP_SERVER_SUPPORT */
   (void)role;
@@ -2912,6 +3002,21 @@ setup_client_ssl_session(coap_session_t *session, SSL *ssl
       SSL_set_verify_depth(ssl, setup_data->cert_chain_verify_depth + 1);
 
   }
+  if (session->dtls_resume) {
+    const coap_bin_const_t *state = coap_dtls_resume_find(session);
+
+    setup_session_cache(context, SSL_get_SSL_CTX(ssl), IS_CLIENT);
+    if (state) {
+      const unsigned char *p = state->s;
+      SSL_SESSION *ssl_session = d2i_SSL_SESSION(NULL, &p,
+                                                 (long)state->length);
+
+      if (ssl_session) {
+        SSL_set_session(ssl, ssl_session);
+        SSL_SESSION_free(ssl_session);
+      }
+    }
+  }
   return 1;
 }
 
@@ -3090,6 +3195,45 @@ int coap_dtls_hello(coap_session_t *session,
    */
   return r;
 }
+
+int
+coap_dtls_hello_filter(coap_endpoint_t *endpoint,
+                       const coap_addr_tuple_t *addr_info,
+                       int ifindex,
+                       const uint8_t *data,
+                       size_t data_len) {
+  coap_openssl_context_t *o_context =
+                 (coap_openssl_context_t *)endpoint->context->dtls_context;
+  coap_dtls_context_t *dtls;
+  coap_session_t *hello;
+  coap_ssl_data *ssl_data;
+  int r;
+
+  if (!o_context || !o_context->dtls.ssl)
+    return 1;
+  dtls = &o_context->dtls;
+  /*
+   * The cookie is a HMAC of the addresses, so DTLSv1_listen() checks it
+   * without keeping any state.  The HelloVerifyRequest is sent through a
+   * session that is only used for that, so that no session is made for the
+   * peer until it has shown that it can receive at its address.  A valid
+   * ClientHello is checked again by coap_dtls_hello() on its HELLO session.
+   */
+  hello = coap_endpoint_hello_session(endpoint, addr_info, ifindex);
+  if (!hello)
+    return 1;
+  SSL_set_mtu(dtls->ssl, (long)hello->mtu);
+  ssl_data = (coap_ssl_data*)BIO_get_data(SSL_get_rbio(dtls->ssl));
+  assert(ssl_data != NULL);
+  ssl_data->session = hello;
+  ssl_data->pdu = data;
+  ssl_data->pdu_len = (unsigned)data_len;
+  r = DTLSv1_listen(dtls->ssl, dtls->bio_addr);
+  ssl_data->session = NULL;
+  ssl_data->pdu = NULL;
+  ssl_data->pdu_len = 0;
+  return r > 0;
+}
 #endif /* COAP_SERVER_SUPPORT */
 
 int coap_dtls_receive(coap_session_t *session,
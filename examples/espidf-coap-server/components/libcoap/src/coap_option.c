@@ -206,6 +206,33 @@ coap_check_option(const coap_pdu_t *pdu, coap_option_num_t number,
   coap_option_filter_clear(&f);
   coap_option_filter_set(&f, number);
 
+  if (pdu->opt_index_state != COAP_PDU_OPT_INDEX_NONE &&
+      pdu->opt_index_count) {
+    const coap_opt_index_t *entry = pdu->opt_index;
+    const coap_opt_index_t *last = &pdu->opt_index[pdu->opt_index_count - 1];
+
+    while (entry < last && entry->number < number)
+      entry++;
+    if (entry->number < number &&
+        pdu->opt_index_state == COAP_PDU_OPT_INDEX_PARTIAL) {
+      /* Not indexed, so walk on from the last indexed option */
+    } else if (entry->number != number) {
+      coap_option_iterator_init(pdu, oi, &f);
+      oi->bad = 1;
+      return NULL;
+    }
+    /*
+     * Start the iteration at the option as if all the ones before it had
+     * been stepped over, so coap_option_next() can carry on from there.
+     */
+    if (!coap_option_iterator_init(pdu, oi, &f))
+      return NULL;
+    oi->next_option = pdu->token + entry->offset;
+    oi->length = pdu->used_size - entry->offset;
+    oi->number = entry == pdu->opt_index ? 0 : entry[-1].number;
+    return coap_option_next(oi);
+  }
+
   coap_option_iterator_init(pdu, oi, &f);
 
   return coap_option_next(oi);
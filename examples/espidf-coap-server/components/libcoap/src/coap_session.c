@@ -33,6 +33,200 @@
 #define PRIu32 "u"
 #endif /* ! HAVE_INTTYPES_H */
 
+#if COAP_SERVER_SUPPORT
+/* Melds the session deadline heaps @p a and @p b, returning the new root. */
+static coap_session_t *
+coap_deadline_meld(coap_session_t *a, coap_session_t *b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+  if (b->deadline < a->deadline) {
+    coap_session_t *tmp = a;
+
+    a = b;
+    b = tmp;
+  }
+  /* b becomes the leftmost child of a */
+  b->deadline_prev = a;
+  b->deadline_sibling = a->deadline_child;
+  if (a->deadline_child)
+    a->deadline_child->deadline_prev = b;
+  a->deadline_child = b;
+  return a;
+}
+
+/* Combines the sibling chain starting at @p first into a single heap. */
+static coap_session_t *
+coap_deadline_merge_pairs(coap_session_t *first) {
+  coap_session_t *pairs = NULL;
+  coap_session_t *result = NULL;
+  coap_session_t *a, *b;
+
+  /* Meld the siblings in pairs, keeping a (reversed) list of the results */
+  while (first) {
+    a = first;
+    b = a->deadline_sibling;
+    first = b ? b->deadline_sibling : NULL;
+    a->deadline_sibling = a->deadline_prev = NULL;
+    if (b) {
+      b->deadline_sibling = b->deadline_prev = NULL;
+      a = coap_deadline_meld(a, b);
+    }
+    a->deadline_sibling = pairs;
+    pairs = a;
+  }
+  /* And then meld them all together, last first */
+  while (pairs) {
+    a = pairs;
+    pairs = a->deadline_sibling;
+    a->deadline_sibling = NULL;
+    result = coap_deadline_meld(result, a);
+  }
+  return result;
+}
+
+static int
+coap_deadline_is_queued(const coap_session_t *session) {
+  return session->deadline_prev != NULL ||
+         session->context->session_deadlines == session;
+}
+
+/* Cuts @p session (and its children) out of the heap, leaving it detached. */
+static void
+coap_deadline_cut(coap_session_t *session) {
+  coap_context_t *context = session->context;
+
+  if (context->session_deadlines == session) {
+    context->session_deadlines = NULL;
+    return;
+  }
+  if (session->deadline_prev->deadline_child == session)
+    session->deadline_prev->deadline_child = session->deadline_sibling;
+  else
+    session->deadline_prev->deadline_sibling = session->deadline_sibling;
+  if (session->deadline_sibling)
+    session->deadline_sibling->deadline_prev = session->deadline_prev;
+  session->deadline_sibling = session->deadline_prev = NULL;
+}
+
+static void
+coap_deadline_remove(coap_session_t *session) {
+  coap_context_t *context = session->context;
+  coap_session_t *children;
+
+  coap_deadline_cut(session);
+  children = coap_deadline_merge_pairs(session->deadline_child);
+  session->deadline_child = NULL;
+  context->session_deadlines = coap_deadline_meld(context->session_deadlines,
+                                                  children);
+}
+
+void
+coap_session_schedule(coap_session_t *session, coap_tick_t when) {
+  if (!session->endpoint)
+    return;
+  if (coap_deadline_is_queued(session)) {
+    if (session->deadline <= when)
+      return;
+    /* Decrease key: the subtree below session stays a valid heap */
+    coap_deadline_cut(session);
+  }
+  session->deadline = when;
+  session->context->session_deadlines =
+      coap_deadline_meld(session->context->session_deadlines, session);
+}
+
+void
+coap_session_set_deadline(coap_session_t *session, coap_tick_t deadline) {
+  if (coap_deadline_is_queued(session))
+    coap_deadline_remove(session);
+  if (deadline) {
+    session->deadline = deadline;
+    session->context->session_deadlines =
+        coap_deadline_meld(session->context->session_deadlines, session);
+  }
+}
+
+coap_session_t *
+coap_session_next_deadline(const coap_context_t *context) {
+  return context->session_deadlines;
+}
+
+/* Returns whether @p session belongs on the endpoint LRU list @p list. */
+static int
+coap_session_lru_wanted(const coap_session_t *session, int list) {
+  if (session->ref != 0 || session->delayqueue != NULL)
+    return 0;
+  if (list == COAP_SESSION_LRU_IDLE)
+    return session->type == COAP_SESSION_TYPE_SERVER;
+  return session->type == COAP_SESSION_TYPE_HELLO ||
+         (session->type == COAP_SESSION_TYPE_SERVER &&
+          session->state == COAP_SESSION_STATE_HANDSHAKE);
+}
+
+/*
+ * Files @p session on LRU list @p list by its current last_rx_tx.  The walk
+ * starts at the tail, so this is O(1) for a recently active session.
+ */
+static void
+coap_session_lru_insert(coap_session_t *session, int list) {
+  coap_endpoint_t *ep = session->endpoint;
+  coap_session_t *p = ep->lru[list] ? ep->lru[list]->lru[list].prev : NULL;
+
+  session->lru[list].last_rx_tx = session->last_rx_tx;
+  while (p && p->lru[list].last_rx_tx > session->last_rx_tx)
+    p = p == ep->lru[list] ? NULL : p->lru[list].prev;
+  /* Goes to the head if p is NULL */
+  DL_APPEND_ELEM2(ep->lru[list], p, session, lru[list].prev, lru[list].next);
+  ep->lru_count[list]++;
+}
+
+static void
+coap_session_lru_remove(coap_session_t *session, int list) {
+  coap_endpoint_t *ep = session->endpoint;
+
+  DL_DELETE2(ep->lru[list], session, lru[list].prev, lru[list].next);
+  session->lru[list].prev = session->lru[list].next = NULL;
+  ep->lru_count[list]--;
+}
+
+/*
+ * Returns the least recently active session on LRU list @p list.  Sessions
+ * that have seen traffic since they were filed are re-filed on the way.
+ */
+static coap_session_t *
+coap_session_lru_oldest(coap_endpoint_t *ep, int list) {
+  coap_session_t *session;
+
+  while ((session = ep->lru[list]) != NULL &&
+         session->lru[list].last_rx_tx != session->last_rx_tx) {
+    DL_DELETE2(ep->lru[list], session, lru[list].prev, lru[list].next);
+    ep->lru_count[list]--;
+    coap_session_lru_insert(session, list);
+  }
+  return session;
+}
+
+void
+coap_session_update_lru(coap_session_t *session) {
+  int list;
+
+  if (!session->endpoint || COAP_PROTO_RELIABLE(session->endpoint->proto))
+    return;
+  for (list = 0; list < COAP_SESSION_LRU_MAX; list++) {
+    int listed = session->lru[list].prev != NULL;
+
+    if (coap_session_lru_wanted(session, list)) {
+      if (!listed)
+        coap_session_lru_insert(session, list);
+    } else if (listed) {
+      coap_session_lru_remove(session, list);
+    }
+  }
+}
+#endif /* COAP_SERVER_SUPPORT */
+
 void
 coap_session_set_ack_timeout(coap_session_t *session, coap_fixed_point_t value) {
   if (value.integer_part > 0 && value.fractional_part < 1000) {
@@ -92,6 +286,49 @@ coap_session_set_probing_rate(coap_session_t *session, uint32_t value) {
   }
 }
 
+void
+coap_session_set_max_payloads(coap_session_t *session, uint16_t value) {
+  if (value > 0 && value <= COAP_MAX_PAYLOADS_LIMIT) {
+    session->max_payloads = value;
+    coap_log(LOG_DEBUG, "***%s: session max_payloads set to %u\n",
+           coap_session_str(session), session->max_payloads);
+  }
+}
+
+void
+coap_session_set_non_timeout(coap_session_t *session,
+                             coap_fixed_point_t value) {
+  if ((value.integer_part > 0 || value.fractional_part > 0) &&
+      value.fractional_part < 1000) {
+    session->non_timeout = value;
+    coap_log(LOG_DEBUG, "***%s: session non_timeout set to %u.%03u\n",
+           coap_session_str(session), session->non_timeout.integer_part,
+           session->non_timeout.fractional_part);
+  }
+}
+
+void
+coap_session_set_non_receive_timeout(coap_session_t *session,
+                                     coap_fixed_point_t value) {
+  if ((value.integer_part > 0 || value.fractional_part > 0) &&
+      value.fractional_part < 1000) {
+    session->non_receive_timeout = value;
+    coap_log(LOG_DEBUG,
+             "***%s: session non_receive_timeout set to %u.%03u\n",
+           coap_session_str(session), session->non_receive_timeout.integer_part,
+           session->non_receive_timeout.fractional_part);
+  }
+}
+
+void
+coap_session_set_non_max_retransmit(coap_session_t *session, uint16_t value) {
+  if (value > 0) {
+    session->non_max_retransmit = value;
+    coap_log(LOG_DEBUG, "***%s: session non_max_retransmit set to %u\n",
+           coap_session_str(session), session->non_max_retransmit);
+  }
+}
+
 coap_fixed_point_t
 coap_session_get_ack_timeout(const coap_session_t *session) {
   return session->ack_timeout;
@@ -122,9 +359,30 @@ coap_session_get_probing_rate(const coap_session_t *session) {
   return session->probing_rate;
 }
 
+uint16_t
+coap_session_get_max_payloads(const coap_session_t *session) {
+  return session->max_payloads;
+}
+
+coap_fixed_point_t
+coap_session_get_non_timeout(const coap_session_t *session) {
+  return session->non_timeout;
+}
+
+coap_fixed_point_t
+coap_session_get_non_receive_timeout(const coap_session_t *session) {
+  return session->non_receive_timeout;
+}
+
+uint16_t
+coap_session_get_non_max_retransmit(const coap_session_t *session) {
+  return session->non_max_retransmit;
+}
+
 coap_session_t *
 coap_session_reference(coap_session_t *session) {
-  ++session->ref;
+  if (++session->ref == 1)
+    coap_session_update_lru(session);
   return session;
 }
 
@@ -137,6 +395,11 @@ coap_session_release(coap_session_t *session) {
       --session->ref;
     if (session->ref == 0 && session->type == COAP_SESSION_TYPE_CLIENT)
       coap_session_free(session);
+    else if (session->ref == 0) {
+      /* An idle server session may now have to be timed out or evicted */
+      coap_session_update_lru(session);
+      coap_session_schedule(session, 0);
+    }
 #else /* __COVERITY__ */
     /* Coverity scan is fooled by the reference counter leading to
      * false positives for USE_AFTER_FREE. */
@@ -213,6 +476,10 @@ coap_make_session(coap_proto_t proto, coap_session_type_t type,
   session->nstart = COAP_DEFAULT_NSTART;
   session->default_leisure = COAP_DEFAULT_DEFAULT_LEISURE;
   session->probing_rate = COAP_DEFAULT_PROBING_RATE;
+  session->max_payloads = COAP_DEFAULT_MAX_PAYLOADS;
+  session->non_timeout = COAP_DEFAULT_NON_TIMEOUT;
+  session->non_receive_timeout = COAP_DEFAULT_NON_RECEIVE_TIMEOUT;
+  session->non_max_retransmit = COAP_DEFAULT_NON_MAX_RETRANSMIT;
   session->dtls_event = -1;
   session->last_ping_mid = COAP_INVALID_MID;
   session->last_ack_mid = COAP_INVALID_MID;
@@ -238,15 +505,8 @@ void coap_session_mfree(coap_session_t *session) {
       /* Need to close down observe */
       if (coap_cancel_observe(session, cq->app_token, COAP_MESSAGE_NON)) {
         /* Need to delete node we set up for NON */
-        coap_queue_t *queue = session->context->sendqueue;
-
-        while (queue) {
-          if (queue->session == session) {
-            coap_delete_node(queue);
-            break;
-          }
-          queue = queue->next;
-        }
+        if (session->sendqueue)
+          coap_delete_node(session->sendqueue);
       }
     }
     LL_DELETE(session->lg_crcv, cq);
@@ -254,14 +514,15 @@ void coap_session_mfree(coap_session_t *session) {
   }
 #endif /* COAP_CLIENT_SUPPORT */
 
-  if (session->partial_pdu)
-    coap_delete_pdu(session->partial_pdu);
+  coap_free_type(COAP_STRING, session->rx_buf);
   if (session->proto == COAP_PROTO_DTLS)
     coap_dtls_free_session(session);
 #if !COAP_DISABLE_TCP
   else if (session->proto == COAP_PROTO_TLS)
     coap_tls_free_session(session);
 #endif /* !COAP_DISABLE_TCP */
+  /* Datagrams may still be queued up for this session */
+  coap_send_batch_flush(session->context);
   if (session->sock.flags != COAP_SOCKET_EMPTY)
     coap_socket_close(&session->sock);
   if (session->psk_identity)
@@ -296,6 +557,7 @@ void coap_session_mfree(coap_session_t *session) {
     LL_DELETE(session->lg_srcv, sq);
     coap_block_delete_lg_srcv(session, sq);
   }
+  coap_session_dedup_free(session);
 #endif /* COAP_SERVER_SUPPORT */
 }
 
@@ -308,6 +570,13 @@ void coap_session_free(coap_session_t *session) {
   coap_session_mfree(session);
 #if COAP_SERVER_SUPPORT
   if (session->endpoint) {
+    int list;
+
+    coap_session_set_deadline(session, 0);
+    for (list = 0; list < COAP_SESSION_LRU_MAX; list++) {
+      if (session->lru[list].prev)
+        coap_session_lru_remove(session, list);
+    }
     if (session->endpoint->sessions)
       SESSIONS_DELETE(session->endpoint->sessions, session);
   } else
@@ -319,6 +588,7 @@ void coap_session_free(coap_session_t *session) {
   }
 #endif /* COAP_CLIENT_SUPPORT */
   coap_delete_bin_const(session->last_token);
+  coap_delete_bin_const(session->q_block_probe);
   coap_log(LOG_DEBUG, "***%s: session %p: closed\n", coap_session_str(session),
            (void *)session);
 
@@ -412,6 +682,7 @@ ssize_t coap_session_send(coap_session_t *session, const uint8_t *data, size_t d
   bytes_written = coap_socket_send(sock, session, data, datalen);
   if (bytes_written == (ssize_t)datalen) {
     coap_ticks(&session->last_rx_tx);
+    coap_session_schedule(session, 0);
     coap_log(LOG_DEBUG, "*  %s: sent %zd bytes\n",
              coap_session_str(session), datalen);
   } else {
@@ -425,6 +696,7 @@ ssize_t coap_session_write(coap_session_t *session, const uint8_t *data, size_t
   ssize_t bytes_written = coap_socket_write(&session->sock, data, datalen);
   if (bytes_written > 0) {
     coap_ticks(&session->last_rx_tx);
+    coap_session_schedule(session, 0);
     coap_log(LOG_DEBUG, "*  %s: sent %zd bytes\n",
              coap_session_str(session), bytes_written);
   } else if (bytes_written < 0) {
@@ -470,6 +742,7 @@ coap_session_delay_pdu(coap_session_t *session, coap_pdu_t *pdu,
     }
   }
   LL_APPEND(session->delayqueue, node);
+  coap_session_update_lru(session);
   coap_log(LOG_DEBUG, "** %s: mid=0x%x: delayed\n",
            coap_session_str(session), node->id);
   return COAP_PDU_DELAYED;
@@ -588,6 +861,7 @@ void coap_session_connected(coap_session_t *session) {
       }
     }
   }
+  coap_session_update_lru(session);
 }
 
 void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reason) {
@@ -601,6 +875,13 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
   coap_delete_observers( session->context, session );
 #endif /* COAP_SERVER_SUPPORT */
 
+#if COAP_CLIENT_SUPPORT
+  /* The server may no longer know the session that was to be resumed */
+  if (session->type == COAP_SESSION_TYPE_CLIENT && session->dtls_resume &&
+      session->state == COAP_SESSION_STATE_HANDSHAKE)
+    coap_dtls_resume_forget(session);
+#endif /* COAP_CLIENT_SUPPORT */
+
   if ( session->tls) {
     if (session->proto == COAP_PROTO_DTLS)
       coap_dtls_free_session(session);
@@ -615,14 +896,15 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
     session->state = COAP_SESSION_STATE_ESTABLISHED;
   else
     session->state = COAP_SESSION_STATE_NONE;
+  coap_session_schedule(session, 0);
 
   session->con_active = 0;
 
-  if (session->partial_pdu) {
-    coap_delete_pdu(session->partial_pdu);
-    session->partial_pdu = NULL;
-  }
-  session->partial_read = 0;
+  /*
+   * The receive buffer is kept, as a PDU in it may still be being handled
+   * when this is called from coap_dispatch().
+   */
+  session->rx_len = 0;
 
   while (session->delayqueue) {
     coap_queue_t *q = session->delayqueue;
@@ -654,12 +936,10 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
     coap_cancel_session_messages(session->context, session, reason);
   }
   else if (session->context->nack_handler) {
-    coap_queue_t *q = session->context->sendqueue;
-    while (q) {
-      if (q->session == session) {
-        session->context->nack_handler(session, q->pdu, reason, q->id);
-      }
-      q = q->next;
+    coap_queue_t *q, *tmp;
+
+    HASH_ITER(hh, session->sendqueue, q, tmp) {
+      session->context->nack_handler(session, q->pdu, reason, q->id);
     }
   }
 
@@ -680,6 +960,7 @@ void coap_session_disconnected(coap_session_t *session, coap_nack_reason_t reaso
       session->doing_first = 0;
   }
 #endif /* !COAP_DISABLE_TCP */
+  coap_session_update_lru(session);
 }
 
 #if COAP_SERVER_SUPPORT
@@ -692,15 +973,37 @@ coap_make_addr_hash(coap_addr_hash_t *addr_hash, coap_proto_t proto,
   addr_hash->proto = proto;
 }
 
+coap_session_t *
+coap_endpoint_hello_session(coap_endpoint_t *endpoint,
+                            const coap_addr_tuple_t *addr_info, int ifindex) {
+  coap_session_t *hello = endpoint->hello;
+
+  if (!hello) {
+    hello = coap_malloc_type(COAP_SESSION, sizeof(coap_session_t));
+    if (!hello)
+      return NULL;
+    endpoint->hello = hello;
+  }
+  /* Clears anything left from the last peer, such as a send error */
+  memset(hello, 0, sizeof(coap_session_t));
+  hello->proto = endpoint->proto;
+  hello->type = COAP_SESSION_TYPE_HELLO;
+  hello->context = endpoint->context;
+  hello->endpoint = endpoint;
+  hello->mtu = endpoint->default_mtu;
+  coap_address_copy(&hello->addr_info.local, &addr_info->local);
+  coap_address_copy(&hello->addr_info.remote, &addr_info->remote);
+  hello->ifindex = ifindex;
+  return hello;
+}
+
 coap_session_t *
 coap_endpoint_get_session(coap_endpoint_t *endpoint,
   const coap_packet_t *packet, coap_tick_t now) {
   coap_session_t *session;
-  coap_session_t *rtmp;
-  unsigned int num_idle = 0;
-  unsigned int num_hs = 0;
-  coap_session_t *oldest = NULL;
-  coap_session_t *oldest_hs = NULL;
+  unsigned int num_idle;
+  unsigned int num_hs;
+  coap_session_t *oldest;
   coap_addr_hash_t addr_hash;
 
   coap_make_addr_hash(&addr_hash, endpoint->proto, &packet->addr_info);
@@ -710,62 +1013,10 @@ coap_endpoint_get_session(coap_endpoint_t *endpoint,
     coap_address_copy(&session->addr_info.local, &packet->addr_info.local);
     session->ifindex = packet->ifindex;
     session->last_rx_tx = now;
+    coap_session_schedule(session, 0);
     return session;
   }
 
-  SESSIONS_ITER(endpoint->sessions, session, rtmp) {
-    if (session->ref == 0 && session->delayqueue == NULL) {
-      if (session->type == COAP_SESSION_TYPE_SERVER) {
-        ++num_idle;
-        if (oldest==NULL || session->last_rx_tx < oldest->last_rx_tx)
-          oldest = session;
-
-        if (session->state == COAP_SESSION_STATE_HANDSHAKE) {
-          ++num_hs;
-          /* See if this is a partial (D)TLS session set up
-             which needs to be cleared down to prevent DOS */
-          if ((session->last_rx_tx + COAP_PARTIAL_SESSION_TIMEOUT_TICKS) < now) {
-            if (oldest_hs == NULL ||
-                session->last_rx_tx < oldest_hs->last_rx_tx)
-              oldest_hs = session;
-          }
-        }
-      }
-      else if (session->type == COAP_SESSION_TYPE_HELLO) {
-        ++num_hs;
-        /* See if this is a partial (D)TLS session set up for Client Hello
-           which needs to be cleared down to prevent DOS */
-        if ((session->last_rx_tx + COAP_PARTIAL_SESSION_TIMEOUT_TICKS) < now) {
-          if (oldest_hs == NULL ||
-              session->last_rx_tx < oldest_hs->last_rx_tx)
-            oldest_hs = session;
-        }
-      }
-    }
-  }
-
-  if (endpoint->context->max_idle_sessions > 0 &&
-      num_idle >= endpoint->context->max_idle_sessions) {
-    coap_handle_event(oldest->context, COAP_EVENT_SERVER_SESSION_DEL, oldest);
-    coap_session_free(oldest);
-  }
-  else if (oldest_hs) {
-    coap_log(LOG_WARNING, "***%s: Incomplete session timed out\n",
-             coap_session_str(oldest_hs));
-    coap_handle_event(oldest_hs->context, COAP_EVENT_SERVER_SESSION_DEL, oldest_hs);
-    coap_session_free(oldest_hs);
-  }
-
-  if (num_hs > (endpoint->context->max_handshake_sessions ?
-              endpoint->context->max_handshake_sessions :
-              COAP_DEFAULT_MAX_HANDSHAKE_SESSIONS)) {
-    /* Maxed out on number of sessions in (D)TLS negotiation state */
-    coap_log(LOG_DEBUG,
-             "Oustanding sessions in COAP_SESSION_STATE_HANDSHAKE too "
-             "large.  New request ignored\n");
-    return NULL;
-  }
-
   if (endpoint->proto == COAP_PROTO_DTLS) {
     /*
      * Need to check that this actually is a Client Hello before wasting
@@ -812,6 +1063,46 @@ coap_endpoint_get_session(coap_endpoint_t *endpoint,
          payload[OFF_CONTENT_TYPE], payload[OFF_HANDSHAKE_TYPE]);
       return NULL;
     }
+
+    /*
+     * Answer a Client Hello without a valid cookie before anything is
+     * allocated or evicted for it, so that a flood of them from spoofed
+     * addresses costs no sessions.
+     */
+    if (!coap_dtls_hello_filter(endpoint, &packet->addr_info,
+                                packet->ifindex, payload, length))
+      return NULL;
+  }
+
+  /* The unused sessions are counted on the endpoint's LRU lists */
+  num_idle = endpoint->lru_count[COAP_SESSION_LRU_IDLE];
+  num_hs = endpoint->lru_count[COAP_SESSION_LRU_HS];
+
+  if (endpoint->context->max_idle_sessions > 0 &&
+      num_idle >= endpoint->context->max_idle_sessions) {
+    oldest = coap_session_lru_oldest(endpoint, COAP_SESSION_LRU_IDLE);
+    coap_handle_event(oldest->context, COAP_EVENT_SERVER_SESSION_DEL, oldest);
+    coap_session_free(oldest);
+  }
+  else if ((oldest = coap_session_lru_oldest(endpoint,
+                                             COAP_SESSION_LRU_HS)) != NULL &&
+           (oldest->last_rx_tx + COAP_PARTIAL_SESSION_TIMEOUT_TICKS) < now) {
+    /* A partial (D)TLS session set up which needs to be cleared down to
+       prevent DOS */
+    coap_log(LOG_WARNING, "***%s: Incomplete session timed out\n",
+             coap_session_str(oldest));
+    coap_handle_event(oldest->context, COAP_EVENT_SERVER_SESSION_DEL, oldest);
+    coap_session_free(oldest);
+  }
+
+  if (num_hs > (endpoint->context->max_handshake_sessions ?
+              endpoint->context->max_handshake_sessions :
+              COAP_DEFAULT_MAX_HANDSHAKE_SESSIONS)) {
+    /* Maxed out on number of sessions in (D)TLS negotiation state */
+    coap_log(LOG_DEBUG,
+             "Oustanding sessions in COAP_SESSION_STATE_HANDSHAKE too "
+             "large.  New request ignored\n");
+    return NULL;
   }
 
   session = coap_make_session(endpoint->proto, COAP_SESSION_TYPE_SERVER,
@@ -826,6 +1117,8 @@ coap_endpoint_get_session(coap_endpoint_t *endpoint,
       session->type = COAP_SESSION_TYPE_HELLO;
     }
     SESSIONS_ADD(endpoint->sessions, session);
+    coap_session_update_lru(session);
+    coap_session_schedule(session, 0);
     coap_log(LOG_DEBUG, "***%s: session %p: new incoming session\n",
              coap_session_str(session), (void *)session);
     coap_handle_event(session->context, COAP_EVENT_SERVER_SESSION_NEW, session);
@@ -842,6 +1135,8 @@ coap_session_new_dtls_session(coap_session_t *session,
     session->tls = coap_dtls_new_server_session(session);
     if (session->tls) {
       session->state = COAP_SESSION_STATE_HANDSHAKE;
+      coap_session_update_lru(session);
+      coap_session_schedule(session, 0);
     } else {
       coap_session_free(session);
       session = NULL;
@@ -1138,6 +1433,8 @@ coap_session_t *coap_new_client_session_psk2(
     return NULL;
 
   session->cpsk_setup_data = *setup_data;
+  session->dtls_resume = setup_data->session_resumption;
+  coap_dtls_resume_setup_psk(session, setup_data);
   if (setup_data->psk_info.identity.s) {
     session->psk_identity =
                       coap_new_bin_const(setup_data->psk_info.identity.s,
@@ -1332,6 +1629,8 @@ coap_session_t *coap_new_client_session_pki(
       coap_session_release(session);
       return NULL;
     }
+    session->dtls_resume = setup_data->session_resumption;
+    coap_dtls_resume_setup_pki(session, setup_data);
   }
   coap_log(LOG_DEBUG, "***%s: new outgoing session\n",
            coap_session_str(session));
@@ -1389,6 +1688,125 @@ error:
   }
   return NULL;
 }
+
+void
+coap_session_dedup_free(coap_session_t *session) {
+  uint16_t i;
+
+  if (!session->dedup)
+    return;
+  for (i = 0; i < session->dedup_size; i++)
+    coap_delete_pdu(session->dedup[i].response);
+  coap_free_type(COAP_STRING, session->dedup);
+  session->dedup = NULL;
+  session->dedup_size = 0;
+  session->dedup_next = 0;
+}
+
+static void
+coap_session_dedup_resend(coap_session_t *session, coap_pdu_t *pdu) {
+#ifdef WITH_LWIP
+  coap_socket_t *sock = &session->sock;
+
+  if (sock->flags == COAP_SOCKET_EMPTY) {
+    assert(session->endpoint != NULL);
+    sock = &session->endpoint->sock;
+  }
+  coap_socket_send_pdu(sock, session, pdu);
+#else /* ! WITH_LWIP */
+  coap_session_send_pdu(session, pdu);
+#endif /* ! WITH_LWIP */
+}
+
+int
+coap_session_dedup_check(coap_session_t *session, const coap_pdu_t *pdu) {
+  coap_context_t *context = session->context;
+  coap_dedup_entry_t *entry = NULL;
+  coap_tick_t now;
+  uint16_t i;
+
+  if (!COAP_PROTO_NOT_RELIABLE(session->proto) ||
+      pdu->token_length > sizeof(entry->token))
+    return 0;
+  if (session->dedup_size != context->max_dedup_entries) {
+    /* Not yet set up, or the size has been changed */
+    coap_session_dedup_free(session);
+    if (context->max_dedup_entries == 0)
+      return 0;
+    session->dedup = coap_malloc_type(COAP_STRING,
+                      context->max_dedup_entries * sizeof(coap_dedup_entry_t));
+    if (!session->dedup)
+      return 0;
+    memset(session->dedup, 0,
+           context->max_dedup_entries * sizeof(coap_dedup_entry_t));
+    session->dedup_size = (uint16_t)context->max_dedup_entries;
+  }
+  if (!session->dedup)
+    return 0;
+
+  coap_ticks(&now);
+  for (i = 0; i < session->dedup_size; i++) {
+    if (session->dedup[i].expires == 0 || session->dedup[i].mid != pdu->mid)
+      continue;
+    entry = &session->dedup[i];
+    if (entry->expires > now && entry->token_length == pdu->token_length &&
+        memcmp(entry->token, pdu->token, pdu->token_length) == 0) {
+      if (entry->response) {
+        coap_log(LOG_DEBUG,
+                 "***%s: mid=0x%x: duplicate request, response resent\n",
+                 coap_session_str(session), pdu->mid);
+        coap_session_dedup_resend(session, entry->response);
+        context->dedup_stats.replayed++;
+      } else {
+        coap_log(LOG_DEBUG,
+                 "***%s: mid=0x%x: duplicate request, no response to resend\n",
+                 coap_session_str(session), pdu->mid);
+        context->dedup_stats.dropped++;
+      }
+      return 1;
+    }
+    /* Expired, or the message id has been reused for a new request */
+    break;
+  }
+
+  if (!entry) {
+    entry = &session->dedup[session->dedup_next];
+    if (++session->dedup_next == session->dedup_size)
+      session->dedup_next = 0;
+    /* Only counted if a retransmission of it could still arrive */
+    if (entry->span_ends > now)
+      context->dedup_stats.evicted++;
+  }
+  coap_delete_pdu(entry->response);
+  entry->response = NULL;
+  entry->expires = now + COAP_EXCHANGE_LIFETIME(session) * COAP_TICKS_PER_SECOND;
+  entry->span_ends = now +
+                     COAP_MAX_TRANSMIT_SPAN(session) * COAP_TICKS_PER_SECOND;
+  entry->mid = pdu->mid;
+  entry->token_length = (uint8_t)pdu->token_length;
+  memcpy(entry->token, pdu->token, pdu->token_length);
+  return 0;
+}
+
+int
+coap_session_dedup_keep(coap_session_t *session, coap_pdu_t *pdu) {
+  uint16_t i;
+
+  if (!session->dedup ||
+      (pdu->type != COAP_MESSAGE_ACK && pdu->type != COAP_MESSAGE_RST))
+    return 0;
+  for (i = 0; i < session->dedup_size; i++) {
+    coap_dedup_entry_t *entry = &session->dedup[i];
+
+    if (entry->expires != 0 && entry->mid == pdu->mid) {
+      if (entry->response)
+        return 0;
+      entry->response = pdu;
+      return 1;
+    }
+  }
+  return 0;
+}
 #endif /* COAP_SERVER_SUPPORT */
 
 void
@@ -1522,6 +1940,8 @@ coap_new_endpoint(coap_context_t *context, const coap_address_t *listen_addr, co
   memset(ep, 0, sizeof(coap_endpoint_t));
   ep->context = context;
   ep->proto = proto;
+  if (context->reuse_port)
+    ep->sock.flags = COAP_SOCKET_REUSE_PORT;
 
   if (proto==COAP_PROTO_UDP || proto==COAP_PROTO_DTLS) {
     if (!coap_socket_bind_udp(&ep->sock, listen_addr, &ep->bind_addr))
@@ -1601,8 +2021,12 @@ coap_free_endpoint(coap_endpoint_t *ep) {
 #ifdef COAP_EPOLL_SUPPORT
        assert(ep->sock.session == NULL);
 #endif /* COAP_EPOLL_SUPPORT */
+      if (ep->context)
+        coap_send_batch_flush(ep->context);
       coap_socket_close(&ep->sock);
     }
+    if (ep->hello)
+      coap_free_type(COAP_SESSION, ep->hello);
 
     if (ep->context && ep->context->endpoint) {
       LL_DELETE(ep->context->endpoint, ep);
@@ -1640,7 +2064,7 @@ coap_session_get_by_peer(const coap_context_t *ctx,
 }
 
 const char *coap_session_str(const coap_session_t *session) {
-  static char szSession[2 * (INET6_ADDRSTRLEN + 8) + 24];
+  static COAP_THREAD_LOCAL char szSession[2 * (INET6_ADDRSTRLEN + 8) + 24];
   char *p = szSession, *end = szSession + sizeof(szSession);
   if (coap_print_addr(&session->addr_info.local,
                       (unsigned char*)p, end - p) > 0)
@@ -1680,7 +2104,7 @@ const char *coap_session_str(const coap_session_t *session) {
 
 #if COAP_SERVER_SUPPORT
 const char *coap_endpoint_str(const coap_endpoint_t *endpoint) {
-  static char szEndpoint[128];
+  static COAP_THREAD_LOCAL char szEndpoint[128];
   char *p = szEndpoint, *end = szEndpoint + sizeof(szEndpoint);
   if (coap_print_addr(&endpoint->bind_addr, (unsigned char*)p, end - p) > 0)
     p += strlen(p);
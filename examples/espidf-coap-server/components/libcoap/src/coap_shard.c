@@ -0,0 +1,486 @@
+/* coap_shard.c -- multi-threaded servers sharded with SO_REUSEPORT
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/**
+ * @file coap_shard.c
+ * @brief Multi-threaded servers sharded with SO_REUSEPORT
+ */
+
+#include "coap3/coap_internal.h"
+
+#if COAP_SERVER_SUPPORT && COAP_THREAD_LOCAL_SUPPORT && \
+    defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_MUTEX_LOCK) && \
+    !defined(_WIN32) && !defined(WITH_LWIP) && !defined(WITH_CONTIKI) && \
+    !defined(RIOT_VERSION) && !defined(ESP_PLATFORM)
+#define COAP_SHARD_SUPPORT 1
+#else
+#define COAP_SHARD_SUPPORT 0
+#endif
+
+#if COAP_SHARD_SUPPORT
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef COAP_EPOLL_SUPPORT
+#include <sys/epoll.h>
+#endif /* COAP_EPOLL_SUPPORT */
+
+/* A request queued for a shard's thread */
+typedef struct coap_shard_msg_t {
+  coap_shard_handler_t handler;   /* NULL for a notification */
+  void *arg;
+  size_t path_len;
+  uint8_t path[COAP_SHARD_MAX_PATH];
+} coap_shard_msg_t;
+
+typedef struct coap_shard_t {
+  coap_context_t *context;
+  unsigned int number;
+  int running;                    /* thread has been created */
+  pthread_t thread;
+  int wake[2];                    /* pipe written to wake up the thread */
+  pthread_mutex_t mutex;          /* protects the fields below */
+  int stop;                       /* thread is to return */
+  int woken;                      /* wake has been written to */
+  int notify_all;                 /* queue overflowed with notifications */
+  unsigned int head;
+  unsigned int count;
+  coap_shard_msg_t queue[COAP_SHARD_QUEUE_SIZE];
+} coap_shard_t;
+
+struct coap_shard_group_t {
+  unsigned int count;             /* number of shards initialized */
+  int started;
+  coap_shard_t *shards;
+};
+
+int
+coap_shard_is_supported(void) {
+  return 1;
+}
+
+/* Must be called with shard->mutex locked */
+static void
+coap_shard_wake(coap_shard_t *shard) {
+  if (!shard->woken) {
+    shard->woken = 1;
+    if (write(shard->wake[1], "", 1) != 1)
+      coap_log(LOG_WARNING, "coap_shard_wake: write: %s\n",
+               coap_socket_strerror());
+  }
+}
+
+/* Must be called with shard->mutex locked */
+static coap_shard_msg_t *
+coap_shard_queue_tail(coap_shard_t *shard) {
+  coap_shard_msg_t *msg;
+
+  if (shard->count == COAP_SHARD_QUEUE_SIZE)
+    return NULL;
+  msg = &shard->queue[(shard->head + shard->count) % COAP_SHARD_QUEUE_SIZE];
+  shard->count++;
+  return msg;
+}
+
+static void
+coap_shard_notify_all(coap_context_t *context) {
+  RESOURCES_ITER(context->resources, r) {
+    if (r->observable)
+      coap_resource_notify_observers(r, NULL);
+  }
+}
+
+static void
+coap_shard_handle(coap_shard_t *shard, const coap_shard_msg_t *msg) {
+  if (msg->handler) {
+    msg->handler(shard->context, shard->number, msg->arg);
+  } else {
+    coap_str_const_t uri_path = { msg->path_len, msg->path };
+    coap_resource_t *r = coap_get_resource_from_uri_path(shard->context,
+                                                         &uri_path);
+
+    if (r)
+      coap_resource_notify_observers(r, NULL);
+  }
+}
+
+/*
+ * Handles everything that has been queued for the shard.  Returns 1 if the
+ * thread is to stop.
+ */
+static int
+coap_shard_process_queue(coap_shard_t *shard) {
+  coap_shard_msg_t msg;
+  int notify_all;
+  int stop;
+
+  pthread_mutex_lock(&shard->mutex);
+  if (shard->woken) {
+    char buf[16];
+
+    while (read(shard->wake[0], buf, sizeof(buf)) > 0)
+      ;
+    shard->woken = 0;
+  }
+  notify_all = shard->notify_all;
+  shard->notify_all = 0;
+  while (shard->count) {
+    msg = shard->queue[shard->head];
+    shard->head = (shard->head + 1) % COAP_SHARD_QUEUE_SIZE;
+    shard->count--;
+    pthread_mutex_unlock(&shard->mutex);
+    coap_shard_handle(shard, &msg);
+    pthread_mutex_lock(&shard->mutex);
+  }
+  stop = shard->stop;
+  pthread_mutex_unlock(&shard->mutex);
+
+  if (notify_all)
+    coap_shard_notify_all(shard->context);
+  return stop;
+}
+
+static void *
+coap_shard_run(void *arg) {
+  coap_shard_t *shard = (coap_shard_t *)arg;
+
+  while (!coap_shard_process_queue(shard)) {
+#ifdef COAP_EPOLL_SUPPORT
+    /* shard->wake[0] has been added to the context's epoll set */
+    coap_io_process(shard->context, COAP_IO_WAIT);
+#else /* ! COAP_EPOLL_SUPPORT */
+    fd_set readfds;
+
+    FD_ZERO(&readfds);
+    FD_SET(shard->wake[0], &readfds);
+    coap_io_process_with_fds(shard->context, COAP_IO_WAIT,
+                             shard->wake[0] + 1, &readfds, NULL, NULL);
+#endif /* ! COAP_EPOLL_SUPPORT */
+  }
+  /* The memory kept by this thread would otherwise be lost */
+  coap_memory_release_cached();
+  return NULL;
+}
+
+/*
+ * Returns 0 if the mutex cannot be initialized.  Otherwise shard->context is
+ * left NULL if anything else fails.
+ */
+static int
+coap_shard_init(coap_shard_t *shard, unsigned int number) {
+#ifdef COAP_EPOLL_SUPPORT
+  struct epoll_event event;
+#endif /* COAP_EPOLL_SUPPORT */
+
+  shard->number = number;
+  shard->wake[0] = shard->wake[1] = -1;
+  if (pthread_mutex_init(&shard->mutex, NULL) != 0)
+    return 0;
+  if (pipe(shard->wake) == -1) {
+    coap_log(LOG_WARNING, "coap_new_shard_group: pipe: %s\n",
+             coap_socket_strerror());
+    shard->wake[0] = shard->wake[1] = -1;
+    return 1;
+  }
+  if (fcntl(shard->wake[0], F_SETFL, O_NONBLOCK) == -1 ||
+      fcntl(shard->wake[1], F_SETFL, O_NONBLOCK) == -1) {
+    coap_log(LOG_WARNING, "coap_new_shard_group: fcntl: %s\n",
+             coap_socket_strerror());
+    return 1;
+  }
+  shard->context = coap_new_context(NULL);
+  if (!shard->context)
+    return 1;
+  coap_context_set_reuse_port(shard->context, 1);
+#ifdef COAP_EPOLL_SUPPORT
+  /* A NULL data.ptr is ignored by coap_io_do_epoll() */
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (epoll_ctl(shard->context->epfd, EPOLL_CTL_ADD, shard->wake[0],
+                &event) == -1) {
+    coap_log(LOG_WARNING, "coap_new_shard_group: epoll_ctl ADD failed: %s\n",
+             coap_socket_strerror());
+    coap_free_context(shard->context);
+    shard->context = NULL;
+  }
+#endif /* COAP_EPOLL_SUPPORT */
+  return 1;
+}
+
+coap_shard_group_t *
+coap_new_shard_group(unsigned int shards, coap_shard_handler_t setup,
+                     void *arg) {
+  coap_shard_group_t *group;
+  unsigned int i;
+
+  if (shards == 0 || shards > COAP_MAX_SHARDS) {
+    coap_log(LOG_WARNING, "coap_new_shard_group: %u shards not supported\n",
+             shards);
+    return NULL;
+  }
+  group = coap_malloc_type(COAP_STRING, sizeof(coap_shard_group_t));
+  if (!group)
+    return NULL;
+  memset(group, 0, sizeof(coap_shard_group_t));
+  group->shards = coap_malloc_type(COAP_STRING, shards * sizeof(coap_shard_t));
+  if (!group->shards)
+    goto error;
+  memset(group->shards, 0, shards * sizeof(coap_shard_t));
+
+  for (i = 0; i < shards; i++) {
+    coap_shard_t *shard = &group->shards[i];
+
+    if (!coap_shard_init(shard, i))
+      goto error;
+    /* The mutex is now initialized, and so is destroyed by
+       coap_free_shard_group() */
+    group->count++;
+    if (!shard->context)
+      goto error;
+  }
+  if (setup) {
+    for (i = 0; i < shards; i++)
+      setup(group->shards[i].context, i, arg);
+  }
+  return group;
+
+error:
+  coap_free_shard_group(group);
+  return NULL;
+}
+
+/* Stops and joins the threads that are running */
+static void
+coap_shard_group_stop(coap_shard_group_t *group) {
+  unsigned int i;
+
+  for (i = 0; i < group->count; i++) {
+    coap_shard_t *shard = &group->shards[i];
+
+    if (shard->running) {
+      pthread_mutex_lock(&shard->mutex);
+      shard->stop = 1;
+      coap_shard_wake(shard);
+      pthread_mutex_unlock(&shard->mutex);
+    }
+  }
+  for (i = 0; i < group->count; i++) {
+    coap_shard_t *shard = &group->shards[i];
+
+    if (shard->running) {
+      pthread_join(shard->thread, NULL);
+      shard->running = 0;
+    }
+  }
+  group->started = 0;
+}
+
+int
+coap_shard_group_start(coap_shard_group_t *group) {
+  unsigned int i;
+
+  if (group->started)
+    return 1;
+  for (i = 0; i < group->count; i++) {
+    coap_shard_t *shard = &group->shards[i];
+    int ret;
+
+    shard->stop = 0;
+    ret = pthread_create(&shard->thread, NULL, coap_shard_run, shard);
+    if (ret != 0) {
+      coap_log(LOG_WARNING, "coap_shard_group_start: pthread_create: %s\n",
+               coap_socket_format_errno(ret));
+      coap_shard_group_stop(group);
+      return 0;
+    }
+    shard->running = 1;
+  }
+  group->started = 1;
+  return 1;
+}
+
+void
+coap_free_shard_group(coap_shard_group_t *group) {
+  unsigned int i;
+
+  if (!group)
+    return;
+  if (group->shards) {
+    coap_shard_group_stop(group);
+    for (i = 0; i < group->count; i++) {
+      coap_shard_t *shard = &group->shards[i];
+
+      coap_free_context(shard->context);
+      if (shard->wake[0] != -1)
+        close(shard->wake[0]);
+      if (shard->wake[1] != -1)
+        close(shard->wake[1]);
+      pthread_mutex_destroy(&shard->mutex);
+    }
+    coap_free_type(COAP_STRING, group->shards);
+  }
+  coap_free_type(COAP_STRING, group);
+}
+
+unsigned int
+coap_shard_group_count(const coap_shard_group_t *group) {
+  return group->count;
+}
+
+coap_context_t *
+coap_shard_group_get_context(const coap_shard_group_t *group,
+                             unsigned int shard) {
+  if (shard >= group->count)
+    return NULL;
+  return group->shards[shard].context;
+}
+
+int
+coap_shard_group_notify(coap_shard_group_t *group,
+                        const coap_str_const_t *uri_path) {
+  unsigned int i;
+
+  if (uri_path->length > COAP_SHARD_MAX_PATH) {
+    coap_log(LOG_WARNING, "coap_shard_group_notify: Uri-Path too long\n");
+    return 0;
+  }
+  for (i = 0; i < group->count; i++) {
+    coap_shard_t *shard = &group->shards[i];
+    coap_shard_msg_t *msg;
+    unsigned int j;
+
+    if (!group->started) {
+      coap_str_const_t path = *uri_path;
+      coap_resource_t *r = coap_get_resource_from_uri_path(shard->context,
+                                                           &path);
+      if (r)
+        coap_resource_notify_observers(r, NULL);
+      continue;
+    }
+    pthread_mutex_lock(&shard->mutex);
+    for (j = 0; j < shard->count; j++) {
+      msg = &shard->queue[(shard->head + j) % COAP_SHARD_QUEUE_SIZE];
+      if (!msg->handler && msg->path_len == uri_path->length &&
+          memcmp(msg->path, uri_path->s, uri_path->length) == 0)
+        break;
+    }
+    if (j == shard->count && !shard->notify_all) {
+      msg = coap_shard_queue_tail(shard);
+      if (msg) {
+        msg->handler = NULL;
+        msg->arg = NULL;
+        msg->path_len = uri_path->length;
+        memcpy(msg->path, uri_path->s, uri_path->length);
+      } else {
+        shard->notify_all = 1;
+      }
+      coap_shard_wake(shard);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+  }
+  return 1;
+}
+
+int
+coap_shard_group_call(coap_shard_group_t *group,
+                      coap_shard_handler_t handler, void *arg) {
+  unsigned int i;
+  int ret = 1;
+
+  if (!group->started) {
+    for (i = 0; i < group->count; i++)
+      handler(group->shards[i].context, i, arg);
+    return 1;
+  }
+  /* Either all the shards or none of them are to call handler */
+  for (i = 0; i < group->count; i++) {
+    pthread_mutex_lock(&group->shards[i].mutex);
+    if (group->shards[i].count == COAP_SHARD_QUEUE_SIZE)
+      ret = 0;
+  }
+  for (i = 0; i < group->count; i++) {
+    coap_shard_t *shard = &group->shards[i];
+
+    if (ret) {
+      coap_shard_msg_t *msg = coap_shard_queue_tail(shard);
+
+      msg->handler = handler;
+      msg->arg = arg;
+      msg->path_len = 0;
+      coap_shard_wake(shard);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+  }
+  if (!ret)
+    coap_log(LOG_WARNING, "coap_shard_group_call: queue full\n");
+  return ret;
+}
+
+#else /* ! COAP_SHARD_SUPPORT */
+
+int
+coap_shard_is_supported(void) {
+  return 0;
+}
+
+coap_shard_group_t *
+coap_new_shard_group(unsigned int shards, coap_shard_handler_t setup,
+                     void *arg) {
+  (void)shards;
+  (void)setup;
+  (void)arg;
+  coap_log(LOG_WARNING, "coap_new_shard_group: not supported\n");
+  return NULL;
+}
+
+int
+coap_shard_group_start(coap_shard_group_t *group) {
+  (void)group;
+  return 0;
+}
+
+void
+coap_free_shard_group(coap_shard_group_t *group) {
+  (void)group;
+}
+
+unsigned int
+coap_shard_group_count(const coap_shard_group_t *group) {
+  (void)group;
+  return 0;
+}
+
+coap_context_t *
+coap_shard_group_get_context(const coap_shard_group_t *group,
+                             unsigned int shard) {
+  (void)group;
+  (void)shard;
+  return NULL;
+}
+
+int
+coap_shard_group_notify(coap_shard_group_t *group,
+                        const coap_str_const_t *uri_path) {
+  (void)group;
+  (void)uri_path;
+  return 0;
+}
+
+int
+coap_shard_group_call(coap_shard_group_t *group,
+                      coap_shard_handler_t handler, void *arg) {
+  (void)group;
+  (void)handler;
+  (void)arg;
+  return 0;
+}
+
+#endif /* ! COAP_SHARD_SUPPORT */
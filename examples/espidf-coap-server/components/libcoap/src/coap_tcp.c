@@ -236,6 +236,18 @@ coap_socket_bind_tcp(coap_socket_t *sock,
     coap_log(LOG_WARNING,
              "coap_socket_bind_tcp: setsockopt SO_REUSEADDR: %s\n",
              coap_socket_strerror());
+  if (sock->flags & COAP_SOCKET_REUSE_PORT) {
+#ifdef SO_REUSEPORT
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, OPTVAL_T(&on),
+                   sizeof(on)) == COAP_SOCKET_ERROR)
+      coap_log(LOG_WARNING,
+               "coap_socket_bind_tcp: setsockopt SO_REUSEPORT: %s\n",
+               coap_socket_strerror());
+#else /* ! SO_REUSEPORT */
+    coap_log(LOG_WARNING,
+             "coap_socket_bind_tcp: SO_REUSEPORT not supported\n");
+#endif /* ! SO_REUSEPORT */
+  }
 
   switch (listen_addr->addr.sa.sa_family) {
   case AF_INET:
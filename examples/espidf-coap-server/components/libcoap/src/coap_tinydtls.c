@@ -39,6 +39,12 @@ typedef struct coap_tiny_context_t {
   coap_binary_t *priv_key;
   coap_binary_t *pub_key;
 #endif /* DTLS_ECC */
+#if COAP_SERVER_SUPPORT
+  coap_session_t *hello;        /**< the endpoint's session that replies
+                                     from coap_dtls_hello_filter() are
+                                     sent from */
+  int in_hello_filter;          /**< set while in coap_dtls_hello_filter() */
+#endif /* COAP_SERVER_SUPPORT */
 } coap_tiny_context_t;
 
 static dtls_tick_t dtls_tick_0 = 0;
@@ -129,6 +135,14 @@ dtls_send_to_peer(struct dtls_context_t *dtls_context,
   coap_address_t remote_addr;
 
   assert(coap_context);
+#if COAP_SERVER_SUPPORT
+  if (t_context->in_hello_filter) {
+    /* A HelloVerifyRequest to a peer that has no session */
+    coap_session = t_context->hello;
+    return (int)coap_socket_send(&coap_session->endpoint->sock, coap_session,
+                                 data, len);
+  }
+#endif /* COAP_SERVER_SUPPORT */
   get_session_addr(dtls_session, &remote_addr);
   coap_session = coap_session_get_by_peer(coap_context, &remote_addr, dtls_session->ifindex);
   if (!coap_session) {
@@ -725,6 +739,44 @@ coap_dtls_hello(coap_session_t *session,
   }
   return res;
 }
+
+int
+coap_dtls_hello_filter(coap_endpoint_t *endpoint,
+                       const coap_addr_tuple_t *addr_info,
+                       int ifindex,
+                       const uint8_t *data,
+                       size_t data_len) {
+  coap_tiny_context_t *t_context =
+                  (coap_tiny_context_t *)endpoint->context->dtls_context;
+  dtls_context_t *dtls_context = t_context ? t_context->dtls_context : NULL;
+  coap_session_t *hello;
+  session_t dtls_session;
+  uint8_t *data_rw;
+  int res;
+
+  if (!dtls_context)
+    return 1;
+  /*
+   * tinydtls checks the cookie without keeping any state.  A reply is sent
+   * through a session that is only used for that, so that no session is made
+   * for the peer until it has shown that it can receive at its address.
+   */
+  hello = coap_endpoint_hello_session(endpoint, addr_info, ifindex);
+  if (!hello)
+    return 1;
+  t_context->hello = hello;
+
+  dtls_session_init(&dtls_session);
+  put_session_addr(&addr_info->remote, &dtls_session);
+  dtls_session.ifindex = ifindex;
+  /* Need to do this to not get a compiler warning about const parameters */
+  memcpy (&data_rw, &data, sizeof(data_rw));
+  t_context->in_hello_filter = 1;
+  res = dtls_verify_client_hello(dtls_context, &dtls_session,
+                                 data_rw, (int)data_len);
+  t_context->in_hello_filter = 0;
+  return res;
+}
 #endif /* COAP_SERVER_SUPPORT */
 
 unsigned int coap_dtls_get_overhead(coap_session_t *session) {
@@ -1045,6 +1097,9 @@ coap_dtls_context_set_pki(coap_context_t *ctx,
     coap_log(LOG_WARNING, "Only RPK, not full PKI is supported\n");
     return 0;
   }
+  if (setup_data->session_resumption) {
+    coap_log(LOG_INFO, "TinyDTLS does not support session resumption\n");
+  }
   if (!ctx)
     return 0;
   t_context = (coap_tiny_context_t *)ctx->dtls_context;
@@ -1203,6 +1258,10 @@ coap_dtls_context_set_cpsk(coap_context_t *coap_context COAP_UNUSED,
   if (!setup_data)
     return 0;
 
+  if (setup_data->session_resumption) {
+    coap_log(LOG_INFO,
+        "CoAP Client with TinyDTLS does not support session resumption\n");
+  }
   return 1;
 }
 #endif /* COAP_CLIENT_SUPPORT */
@@ -1219,6 +1278,10 @@ coap_dtls_context_set_spsk(coap_context_t *coap_context COAP_UNUSED,
     coap_log(LOG_WARNING,
         "CoAP Server with TinyDTLS does not support SNI selection\n");
   }
+  if (setup_data->session_resumption) {
+    coap_log(LOG_INFO,
+        "CoAP Server with TinyDTLS does not support session resumption\n");
+  }
 
   return 1;
 }
@@ -330,33 +330,312 @@ coap_free_type(coap_memory_tag_t type, void *object) {
   if (object != NULL)
     memarray_free(get_container(type), object);
 }
+
+int
+coap_memory_get_stats(coap_memory_tag_t type, coap_memory_stats_t *stats) {
+  (void)type;
+  (void)stats;
+  return 0;
+}
+
+void
+coap_memory_release_cached(void) {
+}
 #else /* ! RIOT_VERSION */
 
 #ifdef HAVE_MALLOC
 #include <stdlib.h>
 
+/**
+ * Set to 1 (ENABLE_MEMORY_POOL with CMake, --enable-memory-pool with
+ * configure) to keep the objects of the types listed in coap_mem_slab_size()
+ * and the COAP_PDU_BUF buffers for reuse on free lists.  These are per
+ * thread, and so in effect per context when each context is run by its own
+ * thread.  Otherwise every coap_malloc_type() calls malloc() and every
+ * coap_free_type() calls free().
+ */
+#ifndef COAP_MEMORY_POOL
+#define COAP_MEMORY_POOL 0
+#endif /* COAP_MEMORY_POOL */
+
+/**
+ * The most bytes of each object type or buffer size class that a thread
+ * keeps on a free list.  Anything freed beyond this is given back with
+ * free().
+ */
+#ifndef COAP_MEMORY_POOL_LIST_BYTES
+#define COAP_MEMORY_POOL_LIST_BYTES (32U * 1024)
+#endif /* COAP_MEMORY_POOL_LIST_BYTES */
+
+#if !COAP_THREAD_LOCAL_SUPPORT
+/* The free lists cannot be safely shared between threads */
+#undef COAP_MEMORY_POOL
+#define COAP_MEMORY_POOL 0
+#endif /* ! COAP_THREAD_LOCAL_SUPPORT */
+
+/* One more than the highest coap_memory_tag_t */
+#define COAP_MEM_TAG_COUNT (COAP_LG_SRCV + 1)
+
+static COAP_THREAD_LOCAL coap_memory_stats_t coap_mem_stats[COAP_MEM_TAG_COUNT];
+
+#if COAP_MEMORY_POOL
+/* The sizes of the COAP_PDU_BUF buffer classes, beyond which malloc() is
+ * used directly */
+static const size_t coap_mem_buf_class[] = {
+  64, 128, 256, 512, 1024, 2048, 4096
+};
+#define COAP_MEM_BUF_CLASSES \
+  (sizeof(coap_mem_buf_class) / sizeof(coap_mem_buf_class[0]))
+#define COAP_MEM_BUF_LARGE COAP_MEM_BUF_CLASSES
+
+/* Precedes each COAP_PDU_BUF buffer to say how big it is */
+typedef union coap_mem_buf_hdr_t {
+  struct {
+    size_t buf_class;     /* index into coap_mem_buf_class, or
+                             COAP_MEM_BUF_LARGE */
+    size_t size;          /* requested size of a COAP_MEM_BUF_LARGE buffer */
+  } h;
+  double align_d;
+  long long align_ll;
+  void *align_p;
+} coap_mem_buf_hdr_t;
+
+typedef struct coap_mem_free_t {
+  struct coap_mem_free_t *next;
+} coap_mem_free_t;
+
+typedef struct coap_mem_list_t {
+  coap_mem_free_t *head;
+  size_t count;
+} coap_mem_list_t;
+
+static COAP_THREAD_LOCAL coap_mem_list_t coap_mem_slab[COAP_MEM_TAG_COUNT];
+static COAP_THREAD_LOCAL coap_mem_list_t coap_mem_buf[COAP_MEM_BUF_CLASSES];
+
+/*
+ * Returns the size of the objects of type that are kept on a free list, or
+ * 0 if they are not.  Objects of these types are always allocated with this
+ * size.
+ */
+static size_t
+coap_mem_slab_size(coap_memory_tag_t type) {
+  switch (type) {
+  case COAP_NODE:        return sizeof(coap_queue_t);
+  case COAP_PDU:         return sizeof(coap_pdu_t);
+  case COAP_LG_XMIT:     return sizeof(coap_lg_xmit_t);
+#if COAP_CLIENT_SUPPORT
+  case COAP_LG_CRCV:     return sizeof(coap_lg_crcv_t);
+#endif /* COAP_CLIENT_SUPPORT */
+#if COAP_SERVER_SUPPORT
+  case COAP_CACHE_KEY:   return sizeof(coap_cache_key_t);
+  case COAP_CACHE_ENTRY: return sizeof(coap_cache_entry_t);
+  case COAP_LG_SRCV:     return sizeof(coap_lg_srcv_t);
+#endif /* COAP_SERVER_SUPPORT */
+  default:               return 0;
+  }
+}
+
+static void *
+coap_mem_list_get(coap_mem_list_t *list) {
+  coap_mem_free_t *block = list->head;
+
+  if (block) {
+    list->head = block->next;
+    list->count--;
+  }
+  return block;
+}
+
+/* Returns 0 if the list is full and block needs to be freed */
+static int
+coap_mem_list_put(coap_mem_list_t *list, void *block, size_t size) {
+  if ((list->count + 1) * size > COAP_MEMORY_POOL_LIST_BYTES)
+    return 0;
+  ((coap_mem_free_t *)block)->next = list->head;
+  list->head = block;
+  list->count++;
+  return 1;
+}
+
+static void
+coap_mem_list_release(coap_mem_list_t *list, size_t offset) {
+  uint8_t *block;
+
+  while ((block = coap_mem_list_get(list)) != NULL)
+    free(block - offset);
+}
+
+/*
+ * The buffers on the free lists are linked through their contents, so the
+ * header still says which class they are.
+ */
+static void *
+coap_mem_buf_alloc(size_t size, int *reused) {
+  coap_mem_buf_hdr_t *hdr;
+  size_t buf_class;
+
+  for (buf_class = 0; buf_class < COAP_MEM_BUF_CLASSES; buf_class++) {
+    if (size <= coap_mem_buf_class[buf_class])
+      break;
+  }
+  if (buf_class < COAP_MEM_BUF_CLASSES) {
+    void *p = coap_mem_list_get(&coap_mem_buf[buf_class]);
+
+    if (p) {
+      *reused = 1;
+      return p;
+    }
+    size = coap_mem_buf_class[buf_class];
+  }
+  hdr = malloc(sizeof(coap_mem_buf_hdr_t) + size);
+  if (!hdr)
+    return NULL;
+  hdr->h.buf_class = buf_class;
+  hdr->h.size = size;
+  return hdr + 1;
+}
+
+static void
+coap_mem_buf_free(void *p) {
+  coap_mem_buf_hdr_t *hdr = (coap_mem_buf_hdr_t *)p - 1;
+  size_t buf_class = hdr->h.buf_class;
+
+  if (buf_class < COAP_MEM_BUF_CLASSES &&
+      coap_mem_list_put(&coap_mem_buf[buf_class], p,
+                        sizeof(coap_mem_buf_hdr_t) +
+                        coap_mem_buf_class[buf_class]))
+    return;
+  free(hdr);
+}
+
+static void *
+coap_mem_buf_realloc(void *p, size_t size) {
+  coap_mem_buf_hdr_t *hdr = (coap_mem_buf_hdr_t *)p - 1;
+  size_t buf_class = hdr->h.buf_class;
+  size_t old_size;
+  void *new_p;
+  int reused;
+
+  if (buf_class < COAP_MEM_BUF_CLASSES) {
+    old_size = coap_mem_buf_class[buf_class];
+    if (size <= old_size)
+      return p;
+  } else {
+    old_size = hdr->h.size;
+    if (size > coap_mem_buf_class[COAP_MEM_BUF_CLASSES - 1]) {
+      hdr = realloc(hdr, sizeof(coap_mem_buf_hdr_t) + size);
+      if (!hdr)
+        return NULL;
+      hdr->h.size = size;
+      return hdr + 1;
+    }
+  }
+  new_p = coap_mem_buf_alloc(size, &reused);
+  if (!new_p)
+    return NULL;
+  memcpy(new_p, p, old_size < size ? old_size : size);
+  coap_mem_buf_free(p);
+  return new_p;
+}
+#endif /* COAP_MEMORY_POOL */
+
 void
 coap_memory_init(void) {
 }
 
 void *
 coap_malloc_type(coap_memory_tag_t type, size_t size) {
-  (void)type;
-  return malloc(size);
+  coap_memory_stats_t *stats = &coap_mem_stats[type];
+  void *p;
+  int reused = 0;
+#if COAP_MEMORY_POOL
+  size_t slab_size;
+
+  if (type == COAP_PDU_BUF) {
+    p = coap_mem_buf_alloc(size, &reused);
+  } else if ((slab_size = coap_mem_slab_size(type)) != 0) {
+    if (size > slab_size) {
+      coap_log(LOG_WARNING,
+               "coap_malloc_type: Requested memory exceeds maximum object "
+               "size (type %d, size %zu, max %zu)\n",
+               type, size, slab_size);
+      return NULL;
+    }
+    p = coap_mem_list_get(&coap_mem_slab[type]);
+    if (p)
+      reused = 1;
+    else
+      p = malloc(slab_size);
+  } else
+#endif /* COAP_MEMORY_POOL */
+  {
+    p = malloc(size);
+  }
+  if (p) {
+    stats->allocs++;
+    stats->reused += reused;
+    if (++stats->in_use > stats->high_water)
+      stats->high_water = stats->in_use;
+  }
+  return p;
 }
 
 void *
 coap_realloc_type(coap_memory_tag_t type, void* p, size_t size) {
-  (void)type;
+  if (p == NULL)
+    return coap_malloc_type(type, size);
+#if COAP_MEMORY_POOL
+  if (type == COAP_PDU_BUF)
+    return coap_mem_buf_realloc(p, size);
+  assert(coap_mem_slab_size(type) == 0);
+#endif /* COAP_MEMORY_POOL */
   return realloc(p, size);
 }
 
 void
 coap_free_type(coap_memory_tag_t type, void *p) {
-  (void)type;
+  coap_memory_stats_t *stats = &coap_mem_stats[type];
+#if COAP_MEMORY_POOL
+  size_t slab_size;
+#endif /* COAP_MEMORY_POOL */
+
+  if (p == NULL)
+    return;
+  /* Freed by a different thread to the one that allocated it */
+  if (stats->in_use)
+    stats->in_use--;
+#if COAP_MEMORY_POOL
+  if (type == COAP_PDU_BUF) {
+    coap_mem_buf_free(p);
+    return;
+  }
+  slab_size = coap_mem_slab_size(type);
+  if (slab_size && coap_mem_list_put(&coap_mem_slab[type], p, slab_size))
+    return;
+#endif /* COAP_MEMORY_POOL */
   free(p);
 }
 
+int
+coap_memory_get_stats(coap_memory_tag_t type, coap_memory_stats_t *stats) {
+  if ((unsigned int)type >= COAP_MEM_TAG_COUNT)
+    return 0;
+  *stats = coap_mem_stats[type];
+  return 1;
+}
+
+void
+coap_memory_release_cached(void) {
+#if COAP_MEMORY_POOL
+  size_t i;
+
+  for (i = 0; i < COAP_MEM_TAG_COUNT; i++)
+    coap_mem_list_release(&coap_mem_slab[i], 0);
+  for (i = 0; i < COAP_MEM_BUF_CLASSES; i++)
+    coap_mem_list_release(&coap_mem_buf[i], sizeof(coap_mem_buf_hdr_t));
+#endif /* COAP_MEMORY_POOL */
+}
+
 #else /* ! HAVE_MALLOC */
 
 #ifdef WITH_CONTIKI
@@ -470,6 +749,17 @@ void
 coap_free_type(coap_memory_tag_t type, void *object) {
   memb_free(get_container(type), object);
 }
+
+int
+coap_memory_get_stats(coap_memory_tag_t type, coap_memory_stats_t *stats) {
+  (void)type;
+  (void)stats;
+  return 0;
+}
+
+void
+coap_memory_release_cached(void) {
+}
 #endif /* WITH_CONTIKI */
 
 #endif /* ! HAVE_MALLOC */
@@ -31,6 +31,9 @@
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
@@ -158,34 +161,122 @@ coap_free_node(coap_queue_t *node) {
 }
 #endif /* WITH_CONTIKI */
 
+/*
+ * The sendqueue is a pairing heap ordered by t.  The leftmost child of a
+ * node is held in child, and the other children are chained from it through
+ * sibling.  prev points back to the parent for the leftmost child, or to the
+ * previous sibling otherwise, and is NULL for the root.
+ */
+
+/* Links the heaps @p a and @p b together, returning the new root. */
+static coap_queue_t *
+coap_queue_meld(coap_queue_t *a, coap_queue_t *b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+  if (b->t < a->t) {
+    coap_queue_t *tmp = a;
+
+    a = b;
+    b = tmp;
+  }
+  /* b becomes the leftmost child of a */
+  b->prev = a;
+  b->sibling = a->child;
+  if (a->child)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Combines the sibling chain starting at @p first into a single heap. */
+static coap_queue_t *
+coap_queue_merge_pairs(coap_queue_t *first) {
+  coap_queue_t *pairs = NULL;
+  coap_queue_t *result = NULL;
+  coap_queue_t *a, *b;
+
+  /* Meld the siblings in pairs, keeping a (reversed) list of the results */
+  while (first) {
+    a = first;
+    b = a->sibling;
+    first = b ? b->sibling : NULL;
+    a->sibling = a->prev = NULL;
+    if (b) {
+      b->sibling = b->prev = NULL;
+      a = coap_queue_meld(a, b);
+    }
+    a->sibling = pairs;
+    pairs = a;
+  }
+  /* And then meld them all together, last first */
+  while (pairs) {
+    a = pairs;
+    pairs = a->sibling;
+    a->sibling = NULL;
+    result = coap_queue_meld(result, a);
+  }
+  return result;
+}
+
+/* Removes @p node from @p queue and from its session's hash. */
+static void
+coap_queue_remove(coap_queue_t **queue, coap_queue_t *node) {
+  coap_queue_t *children = coap_queue_merge_pairs(node->child);
+
+  if (node == *queue) {
+    *queue = children;
+  } else {
+    if (node->prev->child == node)
+      node->prev->child = node->sibling;
+    else
+      node->prev->sibling = node->sibling;
+    if (node->sibling)
+      node->sibling->prev = node->prev;
+    *queue = coap_queue_meld(*queue, children);
+  }
+  node->child = node->sibling = node->prev = NULL;
+  if (node->session)
+    HASH_DELETE(hh, node->session->sendqueue, node);
+}
+
+/* Returns the node following @p node in a walk of the whole queue. */
+static coap_queue_t *
+coap_queue_walk_next(coap_queue_t *node) {
+  if (node->child)
+    return node->child;
+  while (node) {
+    if (node->sibling)
+      return node->sibling;
+    /* Go back up to the parent */
+    while (node->prev && node->prev->child != node)
+      node = node->prev;
+    node = node->prev;
+  }
+  return NULL;
+}
+
 unsigned int
 coap_adjust_basetime(coap_context_t *ctx, coap_tick_t now) {
   unsigned int result = 0;
   coap_tick_diff_t delta = now - ctx->sendqueue_basetime;
+  coap_queue_t *q;
 
-  if (ctx->sendqueue) {
+  /*
+   * All elements are relative to sendqueue_basetime and so need adjusting.
+   * Any element that has timed out is set to zero, which does not change
+   * the heap ordering.
+   */
+  for (q = ctx->sendqueue; q; q = coap_queue_walk_next(q)) {
     /* delta < 0 means that the new time stamp is before the old. */
     if (delta <= 0) {
-      ctx->sendqueue->t -= delta;
+      q->t -= delta;
+    } else if (q->t < (coap_tick_t)delta) {
+      q->t = 0;
+      result++;
     } else {
-      /* This case is more complex: The time must be advanced forward,
-       * thus possibly leading to timed out elements at the queue's
-       * start. For every element that has timed out, its relative
-       * time is set to zero and the result counter is increased. */
-
-      coap_queue_t *q = ctx->sendqueue;
-      coap_tick_t t = 0;
-      while (q && (t + q->t < (coap_tick_t)delta)) {
-        t += q->t;
-        q->t = 0;
-        result++;
-        q = q->next;
-      }
-
-      /* finally adjust the first element that has not expired */
-      if (q) {
-        q->t = (coap_tick_t)delta - t;
-      }
+      q->t -= delta;
     }
   }
 
@@ -197,38 +288,13 @@ coap_adjust_basetime(coap_context_t *ctx, coap_tick_t now) {
 
 int
 coap_insert_node(coap_queue_t **queue, coap_queue_t *node) {
-  coap_queue_t *p, *q;
   if (!queue || !node)
     return 0;
 
-  /* set queue head if empty */
-  if (!*queue) {
-    *queue = node;
-    return 1;
-  }
-
-  /* replace queue head if PDU's time is less than head's time */
-  q = *queue;
-  if (node->t < q->t) {
-    node->next = q;
-    *queue = node;
-    q->t -= node->t;                /* make q->t relative to node->t */
-    return 1;
-  }
-
-  /* search for right place to insert */
-  do {
-    node->t -= q->t;                /* make node-> relative to q->t */
-    p = q;
-    q = q->next;
-  } while (q && q->t <= node->t);
-
-  /* insert new item */
-  if (q) {
-    q->t -= node->t;                /* make q->t relative to node->t */
-  }
-  node->next = q;
-  p->next = node;
+  node->child = node->sibling = node->prev = NULL;
+  *queue = coap_queue_meld(*queue, node);
+  if (node->session)
+    HASH_ADD(hh, node->session->sendqueue, id, sizeof(node->id), node);
   return 1;
 }
 
@@ -239,11 +305,13 @@ coap_delete_node(coap_queue_t *node) {
 
   coap_delete_pdu(node->pdu);
   if ( node->session ) {
+    coap_context_t *context = node->session->context;
+
     /*
      * Need to remove out of context->sendqueue as added in by coap_wait_ack()
      */
-    if (node->session->context->sendqueue) {
-      LL_DELETE(node->session->context->sendqueue, node);
+    if (node->prev || context->sendqueue == node) {
+      coap_queue_remove(&context->sendqueue, node);
     }
     coap_session_release(node->session);
   }
@@ -254,11 +322,32 @@ coap_delete_node(coap_queue_t *node) {
 
 void
 coap_delete_all(coap_queue_t *queue) {
+  coap_queue_t *node;
+
   if (!queue)
     return;
 
-  coap_delete_all(queue->next);
-  coap_delete_node(queue);
+  if (queue->session && queue->session->context->sendqueue == queue)
+    queue->session->context->sendqueue = NULL;
+
+  /*
+   * Use sibling as a work list to walk the heap, deleting each node after
+   * all of its children.
+   */
+  while (queue) {
+    node = queue;
+    if (node->child) {
+      queue = node->child;
+      node->child = queue->sibling;
+      queue->sibling = node;
+    } else {
+      queue = node->sibling;
+      node->sibling = node->prev = NULL;
+      if (node->session)
+        HASH_DELETE(hh, node->session->sendqueue, node);
+      coap_delete_node(node);
+    }
+  }
 }
 
 coap_queue_t *
@@ -291,10 +380,7 @@ coap_pop_next(coap_context_t *context) {
     return NULL;
 
   next = context->sendqueue;
-  context->sendqueue = context->sendqueue->next;
-  if (context->sendqueue) {
-    context->sendqueue->t += next->t;
-  }
+  coap_queue_remove(&context->sendqueue, next);
   next->next = NULL;
   return next;
 }
@@ -327,6 +413,231 @@ coap_get_session_client_psk_identity(const coap_session_t *session) {
   return NULL;
 }
 
+#if COAP_CLIENT_SUPPORT
+/* 64 bit FNV-1a, with the length first so that fields cannot run together */
+static uint64_t
+coap_dtls_resume_hash(uint64_t hash, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t l = len;
+  size_t i;
+
+  for (i = 0; i < sizeof(l); i++) {
+    hash ^= (uint8_t)(l >> (8 * i));
+    hash *= 0x100000001b3ULL;
+  }
+  for (i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t
+coap_dtls_resume_hash_str(uint64_t hash, const char *str) {
+  /* NULL and "" hash differently */
+  return coap_dtls_resume_hash(hash, str, str ? strlen(str) + 1 : 0);
+}
+
+/*
+ * Hashes the name of a PEM file along with its size and modification time,
+ * so that a file rewritten in place with new credentials hashes differently.
+ */
+static uint64_t
+coap_dtls_resume_hash_file(uint64_t hash, const char *file) {
+#ifdef HAVE_SYS_STAT_H
+  struct stat st;
+#endif /* HAVE_SYS_STAT_H */
+
+  hash = coap_dtls_resume_hash_str(hash, file);
+#ifdef HAVE_SYS_STAT_H
+  if (file && stat(file, &st) == 0) {
+    uint64_t id[4];
+
+    id[0] = (uint64_t)st.st_dev;
+    id[1] = (uint64_t)st.st_ino;
+    id[2] = (uint64_t)st.st_size;
+    id[3] = (uint64_t)st.st_mtime;
+    hash = coap_dtls_resume_hash(hash, id, sizeof(id));
+  }
+#endif /* HAVE_SYS_STAT_H */
+  return hash;
+}
+
+#define COAP_DTLS_RESUME_HASH_INIT 0xcbf29ce484222325ULL
+
+void
+coap_dtls_resume_setup_pki(coap_session_t *session,
+                           const coap_dtls_pki_t *setup_data) {
+  const coap_dtls_key_t *key = &setup_data->pki_key;
+  uint64_t hash = COAP_DTLS_RESUME_HASH_INIT;
+  uint8_t key_type = (uint8_t)key->key_type;
+
+  hash = coap_dtls_resume_hash_str(hash, setup_data->client_sni);
+  hash = coap_dtls_resume_hash(hash, &setup_data->is_rpk_not_cert, 1);
+  hash = coap_dtls_resume_hash(hash, &key_type, 1);
+  switch (key->key_type) {
+  case COAP_PKI_KEY_PEM:
+    hash = coap_dtls_resume_hash_file(hash, key->key.pem.ca_file);
+    hash = coap_dtls_resume_hash_file(hash, key->key.pem.public_cert);
+    hash = coap_dtls_resume_hash_file(hash, key->key.pem.private_key);
+    break;
+  case COAP_PKI_KEY_PEM_BUF:
+    hash = coap_dtls_resume_hash(hash, key->key.pem_buf.ca_cert,
+                                 key->key.pem_buf.ca_cert_len);
+    hash = coap_dtls_resume_hash(hash, key->key.pem_buf.public_cert,
+                                 key->key.pem_buf.public_cert_len);
+    hash = coap_dtls_resume_hash(hash, key->key.pem_buf.private_key,
+                                 key->key.pem_buf.private_key_len);
+    break;
+  case COAP_PKI_KEY_ASN1:
+    hash = coap_dtls_resume_hash(hash, key->key.asn1.ca_cert,
+                                 key->key.asn1.ca_cert_len);
+    hash = coap_dtls_resume_hash(hash, key->key.asn1.public_cert,
+                                 key->key.asn1.public_cert_len);
+    hash = coap_dtls_resume_hash(hash, key->key.asn1.private_key,
+                                 key->key.asn1.private_key_len);
+    break;
+  case COAP_PKI_KEY_PKCS11:
+    hash = coap_dtls_resume_hash_str(hash, key->key.pkcs11.ca);
+    hash = coap_dtls_resume_hash_str(hash, key->key.pkcs11.public_cert);
+    hash = coap_dtls_resume_hash_str(hash, key->key.pkcs11.private_key);
+    break;
+  default:
+    break;
+  }
+  session->dtls_resume_setup = hash;
+}
+
+void
+coap_dtls_resume_setup_psk(coap_session_t *session,
+                           const coap_dtls_cpsk_t *setup_data) {
+  uint64_t hash = COAP_DTLS_RESUME_HASH_INIT;
+
+  hash = coap_dtls_resume_hash_str(hash, setup_data->client_sni);
+  hash = coap_dtls_resume_hash(hash, setup_data->psk_info.key.s,
+                               setup_data->psk_info.key.length);
+  session->dtls_resume_setup = hash;
+}
+
+/*
+ * The (D)TLS session state is kept by server, by the PSK identity and by the
+ * SNI and credentials that were set up, as a session set up with another
+ * identity, certificate or key, or for another SNI, is not to be resumed.
+ */
+static coap_dtls_resume_t **
+coap_dtls_resume_lookup(coap_session_t *session) {
+  const coap_bin_const_t *identity =
+                              coap_get_session_client_psk_identity(session);
+  coap_dtls_resume_t **rp;
+
+  for (rp = &session->context->dtls_resume; *rp; rp = &(*rp)->next) {
+    coap_dtls_resume_t *r = *rp;
+
+    if (r->proto == session->proto &&
+        r->setup == session->dtls_resume_setup &&
+        coap_address_equals(&r->remote, &session->addr_info.remote) &&
+        (identity ? r->identity && coap_binary_equal(r->identity, identity) :
+                    r->identity == NULL))
+      return rp;
+  }
+  return NULL;
+}
+
+static void
+coap_dtls_resume_delete(coap_dtls_resume_t *r) {
+  coap_delete_bin_const(r->identity);
+  coap_delete_bin_const(r->state);
+  coap_free(r);
+}
+
+void
+coap_dtls_resume_save(coap_session_t *session,
+                      const uint8_t *data, size_t len) {
+  coap_dtls_resume_t **rp;
+  coap_dtls_resume_t *r;
+  const coap_bin_const_t *identity;
+  coap_bin_const_t *state;
+  unsigned int count = 0;
+
+  if (!session->dtls_resume || !data || !len)
+    return;
+  state = coap_new_bin_const(data, len);
+  if (!state)
+    return;
+  rp = coap_dtls_resume_lookup(session);
+  if (rp) {
+    r = *rp;
+    *rp = r->next;
+    coap_delete_bin_const(r->state);
+  }
+  else {
+    r = coap_malloc(sizeof(coap_dtls_resume_t));
+    if (!r) {
+      coap_delete_bin_const(state);
+      return;
+    }
+    memset(r, 0, sizeof(coap_dtls_resume_t));
+    r->remote = session->addr_info.remote;
+    r->proto = session->proto;
+    r->setup = session->dtls_resume_setup;
+    identity = coap_get_session_client_psk_identity(session);
+    if (identity) {
+      r->identity = coap_new_bin_const(identity->s, identity->length);
+      if (!r->identity) {
+        coap_delete_bin_const(state);
+        coap_free(r);
+        return;
+      }
+    }
+  }
+  r->state = state;
+  LL_PREPEND(session->context->dtls_resume, r);
+
+  /* Drop the servers least recently connected to */
+  for (rp = &session->context->dtls_resume; *rp; rp = &(*rp)->next) {
+    if (++count == COAP_DTLS_RESUME_CLIENT_MAX) {
+      while ((r = (*rp)->next) != NULL) {
+        (*rp)->next = r->next;
+        coap_dtls_resume_delete(r);
+      }
+      break;
+    }
+  }
+}
+
+const coap_bin_const_t *
+coap_dtls_resume_find(coap_session_t *session) {
+  coap_dtls_resume_t **rp;
+
+  if (!session->dtls_resume)
+    return NULL;
+  rp = coap_dtls_resume_lookup(session);
+  return rp ? (*rp)->state : NULL;
+}
+
+void
+coap_dtls_resume_forget(coap_session_t *session) {
+  coap_dtls_resume_t **rp = coap_dtls_resume_lookup(session);
+
+  if (rp) {
+    coap_dtls_resume_t *r = *rp;
+
+    *rp = r->next;
+    coap_dtls_resume_delete(r);
+  }
+}
+
+void
+coap_dtls_resume_free_all(coap_context_t *context) {
+  coap_dtls_resume_t *r, *rtmp;
+
+  LL_FOREACH_SAFE(context->dtls_resume, r, rtmp) {
+    coap_dtls_resume_delete(r);
+  }
+  context->dtls_resume = NULL;
+}
+#endif /* COAP_CLIENT_SUPPORT */
+
 #if COAP_SERVER_SUPPORT
 const coap_bin_const_t *
 coap_get_session_server_psk_key(const coap_session_t *session) {
@@ -459,10 +770,149 @@ coap_context_get_csm_max_message_size(const coap_context_t *context) {
   return context->csm_max_message_size;
 }
 
+void
+coap_context_set_max_read_batch(coap_context_t *context,
+                                unsigned int max_read_batch) {
+#if COAP_SERVER_SUPPORT
+  if (max_read_batch > COAP_MAX_READ_BATCH)
+    max_read_batch = COAP_MAX_READ_BATCH;
+  if (context->read_batch && context->read_batch_size != max_read_batch) {
+    /* Will get re-allocated to the new size on next use */
+    coap_free_type(COAP_PACKET, context->read_batch);
+    context->read_batch = NULL;
+    context->read_batch_size = 0;
+  }
+  context->max_read_batch = max_read_batch;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  (void)max_read_batch;
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
+unsigned int
+coap_context_get_max_read_batch(const coap_context_t *context) {
+#if COAP_SERVER_SUPPORT
+  return context->max_read_batch;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  return 0;
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
+void
+coap_context_set_max_send_batch(coap_context_t *context,
+                                unsigned int max_send_batch) {
+#if COAP_SEND_BATCH_SUPPORT
+  if (max_send_batch > COAP_MAX_SEND_BATCH)
+    max_send_batch = COAP_MAX_SEND_BATCH;
+  if (context->send_batch && context->send_batch_size != max_send_batch) {
+    /* Will get re-allocated to the new size on next use */
+    coap_send_batch_flush(context);
+    coap_free_type(COAP_PACKET, context->send_batch);
+    context->send_batch = NULL;
+    context->send_batch_size = 0;
+  }
+  context->max_send_batch = max_send_batch;
+#else /* ! COAP_SEND_BATCH_SUPPORT */
+  (void)context;
+  (void)max_send_batch;
+#endif /* ! COAP_SEND_BATCH_SUPPORT */
+}
+
+unsigned int
+coap_context_get_max_send_batch(const coap_context_t *context) {
+#if COAP_SEND_BATCH_SUPPORT
+  return context->max_send_batch;
+#else /* ! COAP_SEND_BATCH_SUPPORT */
+  (void)context;
+  return 0;
+#endif /* ! COAP_SEND_BATCH_SUPPORT */
+}
+
+void
+coap_context_get_read_batch_histogram(const coap_context_t *context,
+                             uint64_t histogram[COAP_READ_BATCH_HIST_BUCKETS]) {
+#if COAP_SERVER_SUPPORT
+  memcpy(histogram, context->read_batch_hist,
+         sizeof(context->read_batch_hist));
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  memset(histogram, 0, COAP_READ_BATCH_HIST_BUCKETS * sizeof(histogram[0]));
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
+void
+coap_context_set_max_dedup_entries(coap_context_t *context,
+                                   unsigned int max_entries) {
+#if COAP_SERVER_SUPPORT
+  if (max_entries > COAP_MAX_DEDUP_ENTRIES)
+    max_entries = COAP_MAX_DEDUP_ENTRIES;
+  /* Sessions pick up the new size the next time a request arrives */
+  context->max_dedup_entries = max_entries;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  (void)max_entries;
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
+unsigned int
+coap_context_get_max_dedup_entries(const coap_context_t *context) {
+#if COAP_SERVER_SUPPORT
+  return context->max_dedup_entries;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  return 0;
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
+void
+coap_context_get_dedup_stats(const coap_context_t *context,
+                             coap_dedup_stats_t *stats) {
+#if COAP_SERVER_SUPPORT
+  *stats = context->dedup_stats;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  memset(stats, 0, sizeof(*stats));
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
+void
+coap_context_set_reuse_port(coap_context_t *context, int reuse_port) {
+#if COAP_SERVER_SUPPORT
+  context->reuse_port = reuse_port ? 1 : 0;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  (void)reuse_port;
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
+int
+coap_context_get_reuse_port(const coap_context_t *context) {
+#if COAP_SERVER_SUPPORT
+  return context->reuse_port;
+#else /* ! COAP_SERVER_SUPPORT */
+  (void)context;
+  return 0;
+#endif /* ! COAP_SERVER_SUPPORT */
+}
+
 void
 coap_context_set_session_timeout(coap_context_t *context,
                                  unsigned int session_timeout) {
+#if COAP_SERVER_SUPPORT
+  coap_endpoint_t *ep;
+  coap_session_t *s, *rtmp;
+#endif /* COAP_SERVER_SUPPORT */
+
   context->session_timeout = session_timeout;
+#if COAP_SERVER_SUPPORT
+  /* The idle session deadlines may have moved forward */
+  LL_FOREACH(context->endpoint, ep) {
+    SESSIONS_ITER(ep->sessions, s, rtmp) {
+      coap_session_schedule(s, 0);
+    }
+  }
+#endif /* COAP_SERVER_SUPPORT */
 }
 
 unsigned int
@@ -561,6 +1011,9 @@ coap_new_context(
   /* set default CSM values */
   c->csm_timeout = 30;
   c->csm_max_message_size = COAP_DEFAULT_MAX_PDU_RX_SIZE;
+#if COAP_SERVER_SUPPORT
+  c->max_dedup_entries = COAP_DEFAULT_MAX_DEDUP_ENTRIES;
+#endif /* COAP_SERVER_SUPPORT */
 
 #if COAP_SERVER_SUPPORT
   if (listen_addr) {
@@ -636,6 +1089,7 @@ coap_free_context(coap_context_t *context) {
   if (context->cache_ignore_count) {
     coap_free(context->cache_ignore_options);
   }
+  coap_free_type(COAP_PACKET, context->read_batch);
 
   coap_endpoint_t *ep, *tmp;
 
@@ -652,8 +1106,18 @@ coap_free_context(coap_context_t *context) {
   }
 #endif /* COAP_CLIENT_SUPPORT */
 
+#if COAP_SEND_BATCH_SUPPORT
+  coap_send_batch_flush(context);
+  coap_free_type(COAP_PACKET, context->send_batch);
+  context->send_batch = NULL;
+  context->max_send_batch = 0;
+#endif /* COAP_SEND_BATCH_SUPPORT */
+
   if (context->dtls_context)
     coap_dtls_free_context(context->dtls_context);
+#if COAP_CLIENT_SUPPORT
+  coap_dtls_resume_free_all(context);
+#endif /* COAP_CLIENT_SUPPORT */
 #ifdef COAP_EPOLL_SUPPORT
   if (context->eptimerfd != -1) {
     int ret;
@@ -682,6 +1146,8 @@ coap_free_context(coap_context_t *context) {
   memset(&the_coap_context, 0, sizeof(coap_context_t));
   initialized = 0;
 #endif /* WITH_CONTIKI */
+  /* Give back the memory kept for reuse, as this thread may be ending */
+  coap_memory_release_cached();
 }
 
 int
@@ -718,6 +1184,13 @@ coap_option_check_critical(coap_session_t *session,
       case COAP_OPTION_BLOCK2:
       case COAP_OPTION_BLOCK1:
         break;
+      case COAP_OPTION_Q_BLOCK1:
+      case COAP_OPTION_Q_BLOCK2:
+        /* Only understood over UDP or DTLS if set up to use them */
+        if ((session->block_mode & COAP_BLOCK_TRY_Q_BLOCK) &&
+            COAP_PROTO_NOT_RELIABLE(session->proto))
+          break;
+        /* fall through */
       default:
         if (coap_option_filter_get(&ctx->known_options, opt_iter.number) <= 0) {
 #if COAP_SERVER_SUPPORT
@@ -820,6 +1293,7 @@ coap_send_pdu(coap_session_t *session, coap_pdu_t *pdu, coap_queue_t *node) {
     coap_show_pdu(LOG_DEBUG, pdu);
   }
   coap_ticks(&session->last_rx_tx);
+  coap_session_schedule(session, 0);
 
 #else
 
@@ -1123,6 +1597,7 @@ coap_send(coap_session_t *session, coap_pdu_t *pdu) {
   }
 #if COAP_CLIENT_SUPPORT
   coap_lg_crcv_t *lg_crcv = NULL;
+  coap_lg_xmit_t *lg_xmit = NULL;
   coap_opt_iterator_t opt_iter;
   coap_block_b_t block;
   int observe_action = -1;
@@ -1144,6 +1619,23 @@ coap_send(coap_session_t *session, coap_pdu_t *pdu) {
     if (coap_get_block_b(session, pdu, COAP_OPTION_BLOCK1, &block) &&
         (block.m == 1 || block.bert == 1))
       have_block1 = 1;
+    if (coap_block_check_q_block_probe(session) &&
+        pdu->type == COAP_MESSAGE_NON) {
+      if (coap_get_block_b(session, pdu, COAP_OPTION_Q_BLOCK1, &block) &&
+          block.m == 1)
+        have_block1 = 1;
+      if (pdu->code == COAP_REQUEST_CODE_GET && observe_action == -1 &&
+          !coap_check_option(pdu, COAP_OPTION_BLOCK2, &opt_iter) &&
+          !coap_check_option(pdu, COAP_OPTION_Q_BLOCK2, &opt_iter)) {
+        uint8_t buf[4];
+
+        /* Let the server send any large body back in bursts */
+        coap_insert_option(pdu, COAP_OPTION_Q_BLOCK2,
+                           coap_encode_var_safe(buf, sizeof(buf),
+                                          coap_block_q_block2_szx(session)),
+                           buf);
+      }
+    }
     if (observe_action != COAP_OBSERVE_CANCEL) {
       /* Warn about re-use of tokens */
       coap_bin_const_t token = coap_pdu_get_token(pdu);
@@ -1167,8 +1659,6 @@ coap_send(coap_session_t *session, coap_pdu_t *pdu) {
   if (observe_action != -1 || have_block1 ||
       ((pdu->type == COAP_MESSAGE_NON || COAP_PROTO_RELIABLE(session->proto)) &&
        COAP_PDU_IS_REQUEST(pdu) && pdu->code != COAP_REQUEST_CODE_DELETE)) {
-    coap_lg_xmit_t *lg_xmit = NULL;
-
     if (!session->lg_xmit) {
       coap_log(LOG_DEBUG, "PDU presented by app\n");
       coap_show_pdu(LOG_DEBUG, pdu);
@@ -1234,6 +1724,11 @@ send_it:
       coap_block_delete_lg_crcv(session, lg_crcv);
     }
   }
+  if (lg_xmit && lg_xmit->option == COAP_OPTION_Q_BLOCK1 &&
+      mid != COAP_INVALID_MID) {
+    /* Send the rest of the first burst of blocks */
+    coap_block_send_q_set(session, lg_xmit);
+  }
 #endif /* COAP_CLIENT_SUPPORT */
   return mid;
 }
@@ -1422,7 +1917,11 @@ coap_send_internal(coap_session_t *session, coap_pdu_t *pdu) {
   if (pdu->type != COAP_MESSAGE_CON
       || COAP_PROTO_RELIABLE(session->proto)) {
     coap_mid_t id = pdu->mid;
-    coap_delete_pdu(pdu);
+#if COAP_SERVER_SUPPORT
+    /* Keep any ACK for a request in case the request is retransmitted */
+    if (!coap_session_dedup_keep(session, pdu))
+#endif /* COAP_SERVER_SUPPORT */
+      coap_delete_pdu(pdu);
     return id;
   }
 
@@ -1532,6 +2031,13 @@ coap_retransmit(coap_context_t *context, coap_queue_t *node) {
  }
 
   /* And finally delete the node */
+#if COAP_CLIENT_SUPPORT
+  /* No answer to a Q-Block probe means falling back to Block1/Block2 */
+  if (coap_block_q_block_probe_done(node->session, node->pdu, 0)) {
+    coap_delete_node(node);
+    return COAP_INVALID_MID;
+  }
+#endif /* COAP_CLIENT_SUPPORT */
   if (node->pdu->type == COAP_MESSAGE_CON && context->nack_handler)
     context->nack_handler(node->session, node->pdu, COAP_NACK_TOO_MANY_RETRIES, node->id);
   coap_delete_node(node);
@@ -1644,8 +2150,10 @@ coap_write_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now
         bytes_written = -1;
         break;
     }
-    if (bytes_written > 0)
+    if (bytes_written > 0) {
       session->last_rx_tx = now;
+      coap_session_schedule(session, 0);
+    }
     if (bytes_written <= 0 || (size_t)bytes_written < q->pdu->used_size + q->pdu->hdr_size - session->partial_write) {
       if (bytes_written > 0)
         session->partial_write += (size_t)bytes_written;
@@ -1657,6 +2165,44 @@ coap_write_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now
   }
 }
 
+#if !COAP_DISABLE_TCP
+/*
+ * Grows the receive buffer of a reliable session to hold at least need bytes.
+ * The size is at least doubled each time, so a large PDU that arrives over
+ * several reads is not copied more than a few times, but is not taken beyond
+ * the largest PDU that can be received unless need is larger.  The data is
+ * preceded by COAP_PDU_MAX_TCP_HEADER_SIZE bytes so that a PDU framed at the
+ * start of the buffer has the header space that every PDU has in front of
+ * its token.
+ */
+static int
+coap_session_rx_reserve(coap_session_t *session, size_t need) {
+  size_t size;
+  size_t limit;
+  uint8_t *buf;
+
+  if (need <= session->rx_size)
+    return 1;
+  limit = min(coap_session_max_pdu_rcv_size(session),
+              COAP_DEFAULT_MAX_PDU_RX_SIZE) + COAP_PDU_MAX_TCP_HEADER_SIZE;
+  size = session->rx_size ? session->rx_size * 2 : COAP_RXBUFFER_SIZE;
+  if (size > limit)
+    size = limit;
+  if (size < need)
+    size = need;
+  buf = coap_realloc_type(COAP_STRING, session->rx_buf,
+                          size + COAP_PDU_MAX_TCP_HEADER_SIZE);
+  if (buf == NULL) {
+    coap_log(LOG_WARNING, "*  %s: unable to grow receive buffer to %zu\n",
+             coap_session_str(session), size);
+    return 0;
+  }
+  session->rx_buf = buf;
+  session->rx_size = size;
+  return 1;
+}
+#endif /* !COAP_DISABLE_TCP */
+
 static void
 coap_read_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now) {
 #if COAP_CONSTRAINED_STACK
@@ -1687,6 +2233,7 @@ coap_read_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now)
                  coap_session_str(session));
     } else if (bytes_read > 0) {
       session->last_rx_tx = now;
+      coap_session_schedule(session, 0);
       memcpy(&session->addr_info, &packet->addr_info,
              sizeof(session->addr_info));
       coap_log(LOG_DEBUG, "*  %s: received %zd bytes\n",
@@ -1696,114 +2243,105 @@ coap_read_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now)
 #if !COAP_DISABLE_TCP
   } else {
     ssize_t bytes_read = 0;
-    const uint8_t *p;
-    int retry;
-    /* adjust for LWIP */
-    uint8_t *buf = packet->payload;
-    size_t buf_len = sizeof(packet->payload);
+    int retry = 0;
 
     do {
+      uint8_t *buf;
+      size_t space;
+      size_t len;
+      size_t off = 0;
+      size_t need = 0;
+
+      if (!coap_session_rx_reserve(session, session->rx_len + 1)) {
+        bytes_read = -1;
+        break;
+      }
+      buf = session->rx_buf + COAP_PDU_MAX_TCP_HEADER_SIZE;
+      space = session->rx_size - session->rx_len;
       if (session->proto == COAP_PROTO_TCP)
-        bytes_read = coap_socket_read(&session->sock, buf, buf_len);
+        bytes_read = coap_socket_read(&session->sock, buf + session->rx_len,
+                                      space);
       else if (session->proto == COAP_PROTO_TLS)
-        bytes_read = coap_tls_read(session, buf, buf_len);
-      if (bytes_read > 0) {
-        coap_log(LOG_DEBUG, "*  %s: received %zd bytes\n",
-                 coap_session_str(session), bytes_read);
-        session->last_rx_tx = now;
-      }
-      p = buf;
-      retry = bytes_read == (ssize_t)buf_len;
-      while (bytes_read > 0) {
-        if (session->partial_pdu) {
-          size_t len = session->partial_pdu->used_size
-                     + session->partial_pdu->hdr_size
-                     - session->partial_read;
-          size_t n = min(len, (size_t)bytes_read);
-          memcpy(session->partial_pdu->token - session->partial_pdu->hdr_size
-                 + session->partial_read, p, n);
-          p += n;
-          bytes_read -= n;
-          if (n == len) {
-            if (coap_pdu_parse_header(session->partial_pdu, session->proto)
-              && coap_pdu_parse_opt(session->partial_pdu)) {
-#if COAP_CONSTRAINED_STACK
-              coap_mutex_unlock(&s_static_mutex);
-#endif /* COAP_CONSTRAINED_STACK */
-              coap_dispatch(ctx, session, session->partial_pdu);
-#if COAP_CONSTRAINED_STACK
-              coap_mutex_lock(&s_static_mutex);
-#endif /* COAP_CONSTRAINED_STACK */
-            }
-            coap_delete_pdu(session->partial_pdu);
-            session->partial_pdu = NULL;
-            session->partial_read = 0;
-          } else {
-            session->partial_read += n;
-          }
-        } else if (session->partial_read > 0) {
-          size_t hdr_size = coap_pdu_parse_header_size(session->proto,
-            session->read_header);
-          size_t len = hdr_size - session->partial_read;
-          size_t n = min(len, (size_t)bytes_read);
-          memcpy(session->read_header + session->partial_read, p, n);
-          p += n;
-          bytes_read -= n;
-          if (n == len) {
-            size_t size = coap_pdu_parse_size(session->proto, session->read_header,
-              hdr_size);
-            if (size > COAP_DEFAULT_MAX_PDU_RX_SIZE) {
-              coap_log(LOG_WARNING,
-                       "** %s: incoming PDU length too large (%zu > %lu)\n",
-                       coap_session_str(session),
-                       size, COAP_DEFAULT_MAX_PDU_RX_SIZE);
-              bytes_read = -1;
-              break;
-            }
-            /* Need max space incase PDU is updated with updated token etc. */
-            session->partial_pdu = coap_pdu_init(0, 0, 0,
-                                           coap_session_max_pdu_rcv_size(session));
-            if (session->partial_pdu == NULL) {
-              bytes_read = -1;
-              break;
-            }
-            if (session->partial_pdu->alloc_size < size && !coap_pdu_resize(session->partial_pdu, size)) {
-              bytes_read = -1;
-              break;
-            }
-            session->partial_pdu->hdr_size = (uint8_t)hdr_size;
-            session->partial_pdu->used_size = size;
-            memcpy(session->partial_pdu->token - hdr_size, session->read_header, hdr_size);
-            session->partial_read = hdr_size;
-            if (size == 0) {
-              if (coap_pdu_parse_header(session->partial_pdu, session->proto)) {
+        bytes_read = coap_tls_read(session, buf + session->rx_len, space);
+      if (bytes_read <= 0)
+        break;
+      coap_log(LOG_DEBUG, "*  %s: received %zd bytes\n",
+               coap_session_str(session), bytes_read);
+      session->last_rx_tx = now;
+      coap_session_schedule(session, 0);
+      retry = bytes_read == (ssize_t)space;
+      len = session->rx_len + (size_t)bytes_read;
+      session->rx_len = len;
+
+      /* Dispatch each complete PDU from where it lies in the buffer */
+      while (off < len) {
+        uint8_t *hdr = buf + off;
+        size_t hdr_size = coap_pdu_parse_header_size(session->proto, hdr);
+        size_t size;
+        size_t max_size;
+        coap_pdu_t *pdu;
+
+        if (len - off < hdr_size) {
+          need = hdr_size;
+          break;
+        }
+        size = coap_pdu_parse_size(session->proto, hdr, hdr_size);
+        max_size = min(coap_session_max_pdu_rcv_size(session),
+                       COAP_DEFAULT_MAX_PDU_RX_SIZE);
+        if (size > max_size) {
+          coap_log(LOG_WARNING,
+                   "** %s: incoming PDU length too large (%zu > %zu)\n",
+                   coap_session_str(session), size, max_size);
+          bytes_read = -1;
+          break;
+        }
+        if (len - off < hdr_size + size) {
+          need = hdr_size + size;
+          break;
+        }
+        off += hdr_size + size;
+        pdu = coap_pdu_init_in_place(hdr, hdr_size, size, max_size);
+        if (pdu == NULL) {
+          bytes_read = -1;
+          break;
+        }
+        if (coap_pdu_parse_header(pdu, session->proto)
+            && coap_pdu_parse_opt(pdu)) {
 #if COAP_CONSTRAINED_STACK
-                coap_mutex_unlock(&s_static_mutex);
+          coap_mutex_unlock(&s_static_mutex);
 #endif /* COAP_CONSTRAINED_STACK */
-                coap_dispatch(ctx, session, session->partial_pdu);
+          coap_dispatch(ctx, session, pdu);
 #if COAP_CONSTRAINED_STACK
-                coap_mutex_lock(&s_static_mutex);
+          coap_mutex_lock(&s_static_mutex);
 #endif /* COAP_CONSTRAINED_STACK */
-              }
-              coap_delete_pdu(session->partial_pdu);
-              session->partial_pdu = NULL;
-              session->partial_read = 0;
-            }
-          } else {
-            session->partial_read += bytes_read;
-          }
-        } else {
-          session->read_header[0] = *p++;
-          bytes_read -= 1;
-          if (!coap_pdu_parse_header_size(session->proto,
-                                          session->read_header)) {
-            bytes_read = -1;
-            break;
-          }
-          session->partial_read = 1;
+        }
+        coap_delete_pdu(pdu);
+        if (session->rx_len != len) {
+          /* The session has been disconnected while handling the PDU */
+          off = len = 0;
+          retry = 0;
+          break;
         }
       }
-    } while (bytes_read == 0 && retry);
+      if (bytes_read < 0)
+        break;
+
+      /* Keep any partial PDU at the start of the buffer */
+      if (off > 0 && off < len)
+        memmove(buf, buf + off, len - off);
+      session->rx_len = len - off;
+      if (need > session->rx_size) {
+        if (!coap_session_rx_reserve(session, need)) {
+          bytes_read = -1;
+          break;
+        }
+      } else if (session->rx_len == 0 &&
+                 session->rx_size > COAP_RXBUFFER_KEEP_SIZE) {
+        coap_free_type(COAP_STRING, session->rx_buf);
+        session->rx_buf = NULL;
+        session->rx_size = 0;
+      }
+    } while (retry);
     if (bytes_read < 0)
       coap_session_disconnected(session, COAP_NACK_NOT_DELIVERABLE);
 #endif /* !COAP_DISABLE_TCP */
@@ -1814,6 +2352,81 @@ coap_read_session(coap_context_t *ctx, coap_session_t *session, coap_tick_t now)
 }
 
 #if COAP_SERVER_SUPPORT
+static void
+coap_read_batch_record(coap_context_t *ctx, unsigned int count) {
+  unsigned int bucket = 0;
+
+  while (count > 1 && bucket < COAP_READ_BATCH_HIST_BUCKETS - 1) {
+    count >>= 1;
+    bucket++;
+  }
+  ctx->read_batch_hist[bucket]++;
+}
+
+static void
+coap_packet_preset_endpoint(coap_packet_t *packet,
+                            const coap_endpoint_t *endpoint) {
+  /* Need to do this as there may be holes in addr_info */
+  memset(&packet->addr_info, 0, sizeof(packet->addr_info));
+  coap_address_init(&packet->addr_info.remote);
+  coap_address_copy(&packet->addr_info.local, &endpoint->bind_addr);
+}
+
+static int
+coap_handle_endpoint_packet(coap_context_t *ctx, coap_endpoint_t *endpoint,
+                            coap_packet_t *packet, coap_tick_t now) {
+  int result = -1;
+  coap_session_t *session = coap_endpoint_get_session(endpoint, packet, now);
+
+  if (session) {
+    coap_log(LOG_DEBUG, "*  %s: received %zu bytes\n",
+             coap_session_str(session), packet->length);
+    result = coap_handle_dgram_for_proto(ctx, session, packet);
+    if (endpoint->proto == COAP_PROTO_DTLS && session->type == COAP_SESSION_TYPE_HELLO && result == 1)
+      coap_session_new_dtls_session(session, now);
+  }
+  return result;
+}
+
+#if COAP_READ_BATCH_SUPPORT
+static int
+coap_read_endpoint_batch(coap_context_t *ctx, coap_endpoint_t *endpoint,
+                         coap_tick_t now) {
+  int result = -1;
+  int count;
+  int i;
+
+  if (!ctx->read_batch) {
+    ctx->read_batch = coap_malloc_type(COAP_PACKET,
+                                 ctx->max_read_batch * sizeof(coap_packet_t));
+    if (!ctx->read_batch) {
+      coap_log(LOG_WARNING, "*  %s: unable to allocate read batch\n",
+               coap_endpoint_str(endpoint));
+      return -1;
+    }
+    ctx->read_batch_size = ctx->max_read_batch;
+  }
+
+  for (i = 0; i < (int)ctx->read_batch_size; i++)
+    coap_packet_preset_endpoint(&ctx->read_batch[i], endpoint);
+  count = coap_network_read_batch(&endpoint->sock, ctx->read_batch,
+                                  ctx->read_batch_size);
+
+  if (count < 0) {
+    coap_log(LOG_WARNING, "*  %s: read failed\n", coap_endpoint_str(endpoint));
+    return -1;
+  }
+  if (count > 0)
+    coap_read_batch_record(ctx, (unsigned int)count);
+  for (i = 0; i < count; i++) {
+    if (ctx->read_batch[i].length > 0)
+      result = coap_handle_endpoint_packet(ctx, endpoint,
+                                           &ctx->read_batch[i], now);
+  }
+  return result;
+}
+#endif /* COAP_READ_BATCH_SUPPORT */
+
 static int
 coap_read_endpoint(coap_context_t *ctx, coap_endpoint_t *endpoint, coap_tick_t now) {
   ssize_t bytes_read = -1;
@@ -1829,27 +2442,24 @@ coap_read_endpoint(coap_context_t *ctx, coap_endpoint_t *endpoint, coap_tick_t n
   assert(COAP_PROTO_NOT_RELIABLE(endpoint->proto));
   assert(endpoint->sock.flags & COAP_SOCKET_BOUND);
 
+#if COAP_READ_BATCH_SUPPORT
+  /* Batching only applies to the default read function */
+  if (ctx->max_read_batch > 1 && ctx->network_read == coap_network_read)
+    return coap_read_endpoint_batch(ctx, endpoint, now);
+#endif /* COAP_READ_BATCH_SUPPORT */
+
 #if COAP_CONSTRAINED_STACK
   coap_mutex_lock(&e_static_mutex);
 #endif /* COAP_CONSTRAINED_STACK */
 
-  /* Need to do this as there may be holes in addr_info */
-  memset(&packet->addr_info, 0, sizeof(packet->addr_info));
-  coap_address_init(&packet->addr_info.remote);
-  coap_address_copy(&packet->addr_info.local, &endpoint->bind_addr);
+  coap_packet_preset_endpoint(packet, endpoint);
   bytes_read = ctx->network_read(&endpoint->sock, packet);
 
   if (bytes_read < 0) {
     coap_log(LOG_WARNING, "*  %s: read failed\n", coap_endpoint_str(endpoint));
   } else if (bytes_read > 0) {
-    coap_session_t *session = coap_endpoint_get_session(endpoint, packet, now);
-    if (session) {
-      coap_log(LOG_DEBUG, "*  %s: received %zd bytes\n",
-               coap_session_str(session), bytes_read);
-      result = coap_handle_dgram_for_proto(ctx, session, packet);
-      if (endpoint->proto == COAP_PROTO_DTLS && session->type == COAP_SESSION_TYPE_HELLO && result == 1)
-        coap_session_new_dtls_session(session, now);
-    }
+    coap_read_batch_record(ctx, 1);
+    result = coap_handle_endpoint_packet(ctx, endpoint, packet, now);
   }
 #if COAP_CONSTRAINED_STACK
   coap_mutex_unlock(&e_static_mutex);
@@ -1869,8 +2479,10 @@ static int
 coap_accept_endpoint(coap_context_t *ctx, coap_endpoint_t *endpoint,
   coap_tick_t now) {
   coap_session_t *session = coap_new_server_session(ctx, endpoint);
-  if (session)
+  if (session) {
     session->last_rx_tx = now;
+    coap_session_schedule(session, 0);
+  }
   return session != NULL;
 }
 #endif /* COAP_SERVER_SUPPORT */
@@ -1924,6 +2536,8 @@ coap_io_do_io(coap_context_t *ctx, coap_tick_t now) {
     coap_session_release( s );
   }
 #endif /* COAP_CLIENT_SUPPORT */
+  /* Send off any responses queued up by the above */
+  coap_send_batch_flush(ctx);
 #endif /* ! COAP_EPOLL_SUPPORT */
 }
 
@@ -2075,83 +2689,37 @@ error:
 
 int
 coap_remove_from_queue(coap_queue_t **queue, coap_session_t *session, coap_mid_t id, coap_queue_t **node) {
-  coap_queue_t *p, *q;
+  coap_queue_t *q;
 
-  if (!queue || !*queue)
+  if (!queue || !*queue || !session)
     return 0;
 
-  /* replace queue head if PDU's time is less than head's time */
-
-  if (session == (*queue)->session && id == (*queue)->id) { /* found message id */
-    *node = *queue;
-    *queue = (*queue)->next;
-    if (*queue) {          /* adjust relative time of new queue head */
-      (*queue)->t += (*node)->t;
-    }
-    (*node)->next = NULL;
-    coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed 1\n",
-             coap_session_str(session), id);
-    return 1;
-  }
-
-  /* search message id queue to remove (only first occurence will be removed) */
-  q = *queue;
-  do {
-    p = q;
-    q = q->next;
-  } while (q && (session != q->session || id != q->id));
-
-  if (q) {                        /* found message id */
-    p->next = q->next;
-    if (p->next) {                /* must update relative time of p->next */
-      p->next->t += q->t;
-    }
-    q->next = NULL;
-    *node = q;
-    coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed 2\n",
-             coap_session_str(session), id);
-    return 1;
-  }
-
-  return 0;
+  /* only the first occurence will be removed */
+  HASH_FIND(hh, session->sendqueue, &id, sizeof(id), q);
+  if (!q)
+    return 0;
 
+  coap_queue_remove(queue, q);
+  q->next = NULL;
+  *node = q;
+  coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed 1\n",
+           coap_session_str(session), id);
+  return 1;
 }
 
 void
 coap_cancel_session_messages(coap_context_t *context, coap_session_t *session,
   coap_nack_reason_t reason) {
-  coap_queue_t *p, *q;
+  coap_queue_t *q, *tmp;
 
-  while (context->sendqueue && context->sendqueue->session == session) {
-    q = context->sendqueue;
-    context->sendqueue = q->next;
+  HASH_ITER(hh, session->sendqueue, q, tmp) {
+    coap_queue_remove(&context->sendqueue, q);
     coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed 3\n",
              coap_session_str(session), q->id);
     if (q->pdu->type == COAP_MESSAGE_CON && context->nack_handler)
       context->nack_handler(session, q->pdu, reason, q->id);
     coap_delete_node(q);
   }
-
-  if (!context->sendqueue)
-    return;
-
-  p = context->sendqueue;
-  q = p->next;
-
-  while (q) {
-    if (q->session == session) {
-      p->next = q->next;
-      coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed 4\n",
-               coap_session_str(session), q->id);
-      if (q->pdu->type == COAP_MESSAGE_CON && context->nack_handler)
-        context->nack_handler(session, q->pdu, reason, q->id);
-      coap_delete_node(q);
-      q = p->next;
-    } else {
-      p = q;
-      q = q->next;
-    }
-  }
 }
 
 void
@@ -2159,19 +2727,12 @@ coap_cancel_all_messages(coap_context_t *context, coap_session_t *session,
   const uint8_t *token, size_t token_length) {
   /* cancel all messages in sendqueue that belong to session
    * and use the specified token */
-  coap_queue_t **p, *q;
-
-  if (!context->sendqueue)
-    return;
-
-  p = &context->sendqueue;
-  q = *p;
+  coap_queue_t *q, *tmp;
 
-  while (q) {
-    if (q->session == session &&
-      token_match(token, token_length,
+  HASH_ITER(hh, session->sendqueue, q, tmp) {
+    if (token_match(token, token_length,
         q->pdu->token, q->pdu->token_length)) {
-      *p = q->next;
+      coap_queue_remove(&context->sendqueue, q);
       coap_log(LOG_DEBUG, "** %s: mid=0x%x: removed 6\n",
                coap_session_str(session), q->id);
       if (q->pdu->type == COAP_MESSAGE_CON && session->con_active) {
@@ -2181,10 +2742,7 @@ coap_cancel_all_messages(coap_context_t *context, coap_session_t *session,
           coap_session_connected(session);
       }
       coap_delete_node(q);
-    } else {
-      p = &(q->next);
     }
-    q = *p;
   }
 }
 
@@ -2603,6 +3161,10 @@ handle_request(coap_context_t *context, coap_session_t *session, coap_pdu_t *pdu
   coap_string_t *query = NULL;
   coap_opt_t *observe = NULL;
   coap_string_t *uri_path = NULL;
+  uint8_t query_data[COAP_URI_BUF_SIZE];
+  uint8_t uri_path_data[COAP_URI_BUF_SIZE];
+  coap_string_t query_buf = { 0, query_data };
+  coap_string_t uri_path_buf = { 0, uri_path_data };
   int added_block = 0;
 #ifndef WITHOUT_ASYNC
   coap_bin_const_t tokenc = { pdu->token_length, pdu->token };
@@ -2739,7 +3301,7 @@ handle_request(coap_context_t *context, coap_session_t *session, coap_pdu_t *pdu
     }
   }
 
-  uri_path = coap_get_uri_path(pdu);
+  uri_path = coap_get_uri_path_buf(pdu, &uri_path_buf, sizeof(uri_path_data));
   if (!uri_path)
     return;
 
@@ -2858,7 +3420,7 @@ handle_request(coap_context_t *context, coap_session_t *session, coap_pdu_t *pdu
       int observe_action = COAP_OBSERVE_CANCEL;
       coap_block_b_t block;
 
-      query = coap_get_query(pdu);
+      query = coap_get_query_buf(pdu, &query_buf, sizeof(query_data));
       /* check for Observe option RFC7641 and RFC8132 */
       if (resource->observable &&
           (pdu->code == COAP_REQUEST_CODE_GET ||
@@ -3024,7 +3586,7 @@ drop_it_no_debug:
         coap_delete_pdu(response);
       }
 clean_up:
-      if (query)
+      if (query && query != &query_buf)
         coap_delete_string(query);
     } else {
       coap_log(LOG_WARNING, "cannot generate response\r\n");
@@ -3035,7 +3597,8 @@ clean_up:
     goto fail_response;
   }
 
-  coap_delete_string(uri_path);
+  if (uri_path != &uri_path_buf)
+    coap_delete_string(uri_path);
   return;
 
 fail_response:
@@ -3044,7 +3607,8 @@ fail_response:
        &opt_filter);
   if (response)
     goto skip_handler;
-  coap_delete_string(uri_path);
+  if (uri_path != &uri_path_buf)
+    coap_delete_string(uri_path);
 }
 #endif /* COAP_SERVER_SUPPORT */
 
@@ -3076,6 +3640,13 @@ handle_response(coap_context_t *context, coap_session_t *session,
     }
   }
 
+  /* A 4.02 (Bad Option) answer to a Q-Block probe means no Q-Block support */
+  if (coap_block_q_block_probe_done(session, rcvd,
+                                    rcvd->code != COAP_RESPONSE_CODE(402))) {
+    coap_send_ack(session, rcvd);
+    return;
+  }
+
   if (session->block_mode & COAP_BLOCK_USE_LIBCOAP) {
     /* See if need to send next block to server */
     if (coap_handle_response_send_block(session, sent, rcvd)) {
@@ -3236,6 +3807,11 @@ coap_dispatch(coap_context_t *context, coap_session_t *session,
         coap_cancel(context, sent);
 
         if (!is_ping_rst) {
+#if COAP_CLIENT_SUPPORT
+          /* A Q-Block probe that is rejected is not of interest to the app */
+          if (coap_block_q_block_probe_done(session, sent->pdu, 0))
+            goto cleanup;
+#endif /* COAP_CLIENT_SUPPORT */
           if(sent->pdu->type==COAP_MESSAGE_CON && context->nack_handler)
             context->nack_handler(sent->session, sent->pdu,
                                   COAP_NACK_RST, sent->id);
@@ -3276,7 +3852,13 @@ coap_dispatch(coap_context_t *context, coap_session_t *session,
       }
       break;
 
-    case COAP_MESSAGE_CON:        /* check for unknown critical options */
+    case COAP_MESSAGE_CON:
+#if COAP_SERVER_SUPPORT
+      /* RFC 7252 4.5 answer a retransmitted request as the original was */
+      if (COAP_PDU_IS_REQUEST(pdu) && coap_session_dedup_check(session, pdu))
+        goto cleanup;
+#endif /* COAP_SERVER_SUPPORT */
+      /* check for unknown critical options */
       if (coap_option_check_critical(session, pdu, &opt_filter) == 0) {
 
         if (COAP_PDU_IS_REQUEST(pdu)) {
@@ -3447,6 +4029,7 @@ void coap_cleanup(void) {
   WSACleanup();
 #endif
   coap_dtls_shutdown();
+  coap_memory_release_cached();
 }
 
 void
@@ -3833,19 +4416,11 @@ static void coap_retransmittimer_execute(void *arg) {
   elapsed = now - ctx->sendqueue_basetime; /* that's positive for sure, and unless we haven't been called for a complete wrapping cycle, did not wrap */
 
   nextinqueue = coap_peek_next(ctx);
-  while (nextinqueue != NULL) {
-    if (nextinqueue->t > elapsed) {
-      nextinqueue->t -= elapsed;
-      break;
-    } else {
-      elapsed -= nextinqueue->t;
-      coap_retransmit(ctx, coap_pop_next(ctx));
-      nextinqueue = coap_peek_next(ctx);
-    }
+  while (nextinqueue != NULL && nextinqueue->t <= elapsed) {
+    coap_retransmit(ctx, coap_pop_next(ctx));
+    nextinqueue = coap_peek_next(ctx);
   }
 
-  ctx->sendqueue_basetime = now;
-
   coap_retransmittimer_restart(ctx);
 }
 
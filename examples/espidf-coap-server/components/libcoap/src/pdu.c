@@ -66,6 +66,8 @@ coap_pdu_clear(coap_pdu_t *pdu, size_t size) {
   pdu->body_offset = 0;
   pdu->body_total = 0;
   pdu->lg_xmit = NULL;
+  pdu->opt_index_state = COAP_PDU_OPT_INDEX_NONE;
+  pdu->opt_index_count = 0;
 }
 
 #ifdef WITH_LWIP
@@ -86,6 +88,7 @@ coap_pdu_from_pbuf( struct pbuf *pbuf )
   }
 
   pdu->max_hdr_size = COAP_PDU_MAX_UDP_HEADER_SIZE;
+  pdu->borrowed_buf = 0;
   pdu->pbuf = pbuf;
   pdu->token = (uint8_t *)pbuf->payload + pdu->max_hdr_size;
   pdu->alloc_size = pbuf->tot_len - pdu->max_hdr_size;
@@ -133,6 +136,7 @@ coap_pdu_init(coap_pdu_type_t type, coap_pdu_code_t code, coap_mid_t mid,
   }
   pdu->token = buf + pdu->max_hdr_size;
 #endif /* WITH_LWIP */
+  pdu->borrowed_buf = 0;
   coap_pdu_clear(pdu, size);
   pdu->mid = mid;
   pdu->type = type;
@@ -140,6 +144,28 @@ coap_pdu_init(coap_pdu_type_t type, coap_pdu_code_t code, coap_mid_t mid,
   return pdu;
 }
 
+#if !COAP_DISABLE_TCP
+coap_pdu_t *
+coap_pdu_init_in_place(uint8_t *hdr, size_t hdr_size, size_t size,
+                       size_t max_size) {
+  coap_pdu_t *pdu;
+
+  assert(hdr_size <= COAP_PDU_MAX_TCP_HEADER_SIZE);
+  pdu = coap_malloc_type(COAP_PDU, sizeof(coap_pdu_t));
+  if (!pdu)
+    return NULL;
+
+  pdu->max_hdr_size = COAP_PDU_MAX_TCP_HEADER_SIZE;
+  pdu->borrowed_buf = 1;
+  pdu->token = hdr + hdr_size;
+  pdu->alloc_size = size;
+  coap_pdu_clear(pdu, max_size > size ? max_size : size);
+  pdu->hdr_size = (uint8_t)hdr_size;
+  pdu->used_size = size;
+  return pdu;
+}
+#endif /* !COAP_DISABLE_TCP */
+
 coap_pdu_t *
 coap_new_pdu(coap_pdu_type_t type, coap_pdu_code_t code,
              coap_session_t *session) {
@@ -156,7 +182,7 @@ coap_delete_pdu(coap_pdu_t *pdu) {
 #ifdef WITH_LWIP
     pbuf_free(pdu->pbuf);
 #else
-    if (pdu->token != NULL)
+    if (pdu->token != NULL && !pdu->borrowed_buf)
       coap_free_type(COAP_PDU_BUF, pdu->token - pdu->max_hdr_size);
 #endif
     coap_free_type(COAP_PDU, pdu);
@@ -237,8 +263,20 @@ coap_pdu_resize(coap_pdu_t *pdu, size_t new_size) {
     } else {
       offset = 0;
     }
-    new_hdr = (uint8_t*)realloc(pdu->token - pdu->max_hdr_size,
-                                new_size + pdu->max_hdr_size);
+    if (pdu->borrowed_buf) {
+      /* Move out of the buffer that the PDU was framed in */
+      new_hdr = (uint8_t*)coap_malloc_type(COAP_PDU_BUF,
+                                           new_size + pdu->max_hdr_size);
+      if (new_hdr != NULL) {
+        memcpy(new_hdr, pdu->token - pdu->max_hdr_size,
+               pdu->alloc_size + pdu->max_hdr_size);
+        pdu->borrowed_buf = 0;
+      }
+    } else {
+      new_hdr = (uint8_t*)coap_realloc_type(COAP_PDU_BUF,
+                                            pdu->token - pdu->max_hdr_size,
+                                            new_size + pdu->max_hdr_size);
+    }
     if (new_hdr == NULL) {
       coap_log(LOG_WARNING, "coap_pdu_resize: realloc failed\n");
       return 0;
@@ -304,6 +342,8 @@ coap_update_token(coap_pdu_t *pdu, size_t len, const uint8_t *data) {
   if (pdu->used_size == 0) {
     return coap_add_token(pdu, len, data);
   }
+  /* Any option index is now out of step */
+  pdu->opt_index_state = COAP_PDU_OPT_INDEX_NONE;
   if (len == pdu->token_length) {
     /* Easy case - just data has changed */
   }
@@ -338,6 +378,7 @@ coap_remove_option(coap_pdu_t *pdu, coap_option_num_t number) {
   coap_option_t decode_this;
   coap_option_t decode_next;
 
+  pdu->opt_index_state = COAP_PDU_OPT_INDEX_NONE;
   /* Need to locate where in current options to remove this one */
   coap_option_iterator_init(pdu, &opt_iter, COAP_OPT_ALL);
   while ((option = coap_option_next(&opt_iter))) {
@@ -454,6 +495,7 @@ check_repeatable(coap_option_num_t number) {
   case COAP_OPTION_ACCEPT:
   case COAP_OPTION_BLOCK2:
   case COAP_OPTION_BLOCK1:
+  case COAP_OPTION_Q_BLOCK1:
   case COAP_OPTION_SIZE2:
   case COAP_OPTION_PROXY_URI:
   case COAP_OPTION_PROXY_SCHEME:
@@ -487,6 +529,7 @@ coap_insert_option(coap_pdu_t *pdu, coap_option_num_t number, size_t len,
   if (number >= pdu->max_opt)
     return coap_add_option_internal(pdu, number, len, data);
 
+  pdu->opt_index_state = COAP_PDU_OPT_INDEX_NONE;
   /* Need to locate where in current options to insert this one */
   coap_option_iterator_init(pdu, &opt_iter, COAP_OPT_ALL);
   while ((option = coap_option_next(&opt_iter))) {
@@ -573,6 +616,7 @@ coap_update_option(coap_pdu_t *pdu, coap_option_num_t number, size_t len,
   option = coap_check_option(pdu, number, &opt_iter);
   if (!option)
     return coap_insert_option(pdu, number, len, data);
+  pdu->opt_index_state = COAP_PDU_OPT_INDEX_NONE;
 
   old_length = coap_opt_parse(option, (size_t)-1, &decode);
   if (old_length == 0)
@@ -650,6 +694,8 @@ coap_add_option_internal(coap_pdu_t *pdu, coap_option_num_t number, size_t len,
   if (!coap_pdu_check_resize(pdu,
       pdu->used_size + optsize))
     return 0;
+  /* The new option is not in any option index */
+  pdu->opt_index_state = COAP_PDU_OPT_INDEX_NONE;
 
   if (pdu->data) {
     /* include option delimiter */
@@ -985,10 +1031,12 @@ coap_pdu_parse_opt_base(coap_pdu_t *pdu, uint16_t len) {
   case COAP_OPTION_URI_QUERY:     if (len < 1 || len > 255) res = 0;  break;
   case COAP_OPTION_HOP_LIMIT:     if (len != 1) res = 0;              break;
   case COAP_OPTION_ACCEPT:        if (len > 2) res = 0;               break;
+  case COAP_OPTION_Q_BLOCK1:      if (len > 3) res = 0;               break;
   case COAP_OPTION_LOCATION_QUERY:if (len > 255) res = 0;             break;
   case COAP_OPTION_BLOCK2:        if (len > 3) res = 0;               break;
   case COAP_OPTION_BLOCK1:        if (len > 3) res = 0;               break;
   case COAP_OPTION_SIZE2:         if (len > 4) res = 0;               break;
+  case COAP_OPTION_Q_BLOCK2:      if (len > 3) res = 0;               break;
   case COAP_OPTION_PROXY_URI:     if (len < 1 || len > 1034) res = 0; break;
   case COAP_OPTION_PROXY_SCHEME:  if (len < 1 || len > 255) res = 0;  break;
   case COAP_OPTION_SIZE1:         if (len > 4) res = 0;               break;
@@ -1052,6 +1100,8 @@ coap_pdu_parse_opt(coap_pdu_t *pdu) {
   }
 
   pdu->max_opt = 0;
+  pdu->opt_index_state = COAP_PDU_OPT_INDEX_NONE;
+  pdu->opt_index_count = 0;
   if (pdu->code == 0) {
     /* empty packet */
     pdu->used_size = 0;
@@ -1061,8 +1111,11 @@ coap_pdu_parse_opt(coap_pdu_t *pdu) {
     coap_opt_t *opt = pdu->token + pdu->token_length;
     size_t length = pdu->used_size - pdu->token_length;
 
+    int index_full = 1;
+
     while (length > 0 && *opt != COAP_PAYLOAD_START) {
       coap_opt_t *opt_last = opt;
+      uint16_t last_number = pdu->max_opt;
       size_t optsize = next_option_safe(&opt, &length, &pdu->max_opt);
       const uint32_t len =
         optsize ? coap_opt_length((const uint8_t *)opt - optsize) : 0;
@@ -1074,6 +1127,19 @@ coap_pdu_parse_opt(coap_pdu_t *pdu) {
         good = 0;
         break;
       }
+      /* Note where the first of each option number is */
+      if (index_full &&
+          (pdu->opt_index_count == 0 || pdu->max_opt != last_number)) {
+        if (pdu->opt_index_count < COAP_PDU_OPT_INDEX_SIZE &&
+            opt_last - pdu->token <= UINT16_MAX) {
+          coap_opt_index_t *entry = &pdu->opt_index[pdu->opt_index_count++];
+
+          entry->number = pdu->max_opt;
+          entry->offset = (uint16_t)(opt_last - pdu->token);
+        } else {
+          index_full = 0;
+        }
+      }
       if (COAP_PDU_IS_SIGNALING(pdu) ?
            !coap_pdu_parse_opt_csm(pdu, len) :
            !coap_pdu_parse_opt_base(pdu, len)) {
@@ -1154,6 +1220,9 @@ coap_pdu_parse_opt(coap_pdu_t *pdu) {
       pdu->data = (uint8_t*)opt;
     else
       pdu->data = NULL;
+    if (good)
+      pdu->opt_index_state = index_full ? COAP_PDU_OPT_INDEX_FULL :
+                                          COAP_PDU_OPT_INDEX_PARTIAL;
   }
 
   return good;
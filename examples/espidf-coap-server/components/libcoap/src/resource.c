@@ -511,6 +511,28 @@ typedef enum coap_deleting_resource_t {
 static void coap_notify_observers(coap_context_t *context, coap_resource_t *r,
                                   coap_deleting_resource_t deleting);
 
+/*
+ * Puts @p r on the list of resources to be looked at by the next
+ * coap_check_notify(), unless it is waiting on one of the lists already.
+ */
+static void
+coap_resource_queue_dirty(coap_context_t *context, coap_resource_t *r) {
+  context->observe_pending = 1;
+  if (r->queued == COAP_RESOURCE_NOT_QUEUED) {
+    DL_APPEND2(context->dirty_resources, r, dirty_prev, dirty_next);
+    r->queued = COAP_RESOURCE_QUEUED_DIRTY;
+  }
+}
+
+static void
+coap_resource_unqueue(coap_context_t *context, coap_resource_t *r) {
+  if (r->queued == COAP_RESOURCE_QUEUED_DIRTY)
+    DL_DELETE2(context->dirty_resources, r, dirty_prev, dirty_next);
+  else if (r->queued == COAP_RESOURCE_QUEUED_NOTIFY)
+    DL_DELETE2(context->notify_resources, r, dirty_prev, dirty_next);
+  r->queued = COAP_RESOURCE_NOT_QUEUED;
+}
+
 static void
 coap_free_resource(coap_resource_t *resource) {
   coap_attr_t *attr, *tmp;
@@ -537,6 +559,8 @@ coap_free_resource(coap_resource_t *resource) {
     coap_delete_cache_key(obs->cache_key);
     COAP_FREE_TYPE( subscription, obs );
   }
+  coap_delete_pdu(resource->notify_body);
+  coap_resource_unqueue(resource->context, resource);
   if (resource->proxy_name_count && resource->proxy_name_list) {
     size_t i;
 
@@ -895,6 +919,44 @@ coap_delete_observers(coap_context_t *context, coap_session_t *session) {
   }
 }
 
+/*
+ * Appends the options and payload of @p body to @p pdu, which must not have
+ * anything beyond its token yet, and takes over the response code.
+ *
+ * return 1 on success, 0 if @p pdu cannot be made large enough
+ */
+static int
+coap_notify_copy_body(coap_pdu_t *pdu, const coap_pdu_t *body) {
+  size_t length = body->used_size - body->token_length;
+  const uint8_t *from = body->token + body->token_length;
+  uint8_t *to;
+
+  if (!coap_pdu_resize(pdu, pdu->used_size + length))
+    return 0;
+  to = pdu->token + pdu->used_size;
+  memcpy(to, from, length);
+  pdu->data = body->data ? to + (body->data - from) : NULL;
+  pdu->used_size += length;
+  pdu->max_opt = body->max_opt;
+  pdu->code = body->code;
+  return 1;
+}
+
+/* Keeps the options and payload of @p response for the other observers */
+static void
+coap_notify_save_body(coap_resource_t *r, const coap_pdu_t *response) {
+  coap_pdu_t *body = coap_pdu_init(COAP_MESSAGE_NON, 0, 0,
+                                   response->used_size - response->token_length);
+
+  if (body && !coap_notify_copy_body(body, response)) {
+    coap_delete_pdu(body);
+    body = NULL;
+  }
+  coap_delete_pdu(r->notify_body);
+  r->notify_body = body;
+  r->notify_body_observe = r->observe;
+}
+
 static void
 coap_notify_observers(coap_context_t *context, coap_resource_t *r,
                       coap_deleting_resource_t deleting) {
@@ -905,6 +967,9 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
   uint8_t buf[4];
   coap_string_t *query;
   coap_block_b_t block;
+  coap_opt_iterator_t opt_iter;
+  int has_block2;
+  int shared;
   coap_tick_t now;
 
   if (r->observable && (r->dirty || r->partiallydirty)) {
@@ -916,7 +981,7 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
          * running this resource due to partiallydirty, but this observation's
          * notification was already enqueued
          */
-        context->observe_pending = 1;
+        coap_resource_queue_dirty(context, r);
         continue;
       }
       if (obs->session->con_active >= COAP_NSTART(obs->session) &&
@@ -925,7 +990,7 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
         /* Waiting for the previous unsolicited response to finish */
         r->partiallydirty = 1;
         obs->dirty = 1;
-        context->observe_pending = 1;
+        coap_resource_queue_dirty(context, r);
         continue;
       }
       coap_ticks(&now);
@@ -935,7 +1000,7 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
         /* Waiting for the previous blocked unsolicited response to finish */
         r->partiallydirty = 1;
         obs->dirty = 1;
-        context->observe_pending = 1;
+        coap_resource_queue_dirty(context, r);
         continue;
       }
 
@@ -946,7 +1011,7 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
       if (!response) {
         obs->dirty = 1;
         r->partiallydirty = 1;
-        context->observe_pending = 1;
+        coap_resource_queue_dirty(context, r);
         coap_log(LOG_DEBUG,
                  "coap_check_notify: pdu init failed, resource stays "
                  "partially dirty\n");
@@ -956,7 +1021,7 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
       if (!coap_add_token(response, obs->pdu->token_length, obs->pdu->token)) {
         obs->dirty = 1;
         r->partiallydirty = 1;
-        context->observe_pending = 1;
+        coap_resource_queue_dirty(context, r);
         coap_log(LOG_DEBUG,
                  "coap_check_notify: cannot add token, resource stays "
                  "partially dirty\n");
@@ -977,13 +1042,25 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
       }
       switch (deleting) {
       case COAP_NOT_DELETING_RESOURCE:
+        has_block2 = coap_get_block_b(obs->session, obs->pdu,
+                                      COAP_OPTION_BLOCK2, &block);
+        shared = (r->flags & COAP_RESOURCE_FLAGS_NOTIFY_SHARED) &&
+                 obs->pdu->code == COAP_REQUEST_CODE_GET && !has_block2;
+        if (shared && r->notify_body &&
+            r->notify_body_observe == r->observe &&
+            coap_notify_copy_body(response, r->notify_body)) {
+          /* Already rendered for another observer */
+          coap_log(LOG_DEBUG, "shared notification for resource '%*.*s'\n",
+                   (int)r->uri_path->length, (int)r->uri_path->length,
+                   r->uri_path->s);
+          break;
+        }
         /* fill with observer-specific data */
         coap_add_option_internal(response, COAP_OPTION_OBSERVE,
                                  coap_encode_var_safe(buf, sizeof (buf),
                                                       r->observe),
                                  buf);
-        if (coap_get_block_b(obs->session, obs->pdu, COAP_OPTION_BLOCK2,
-                             &block)) {
+        if (has_block2) {
           /* Will get updated later (e.g. M bit) if appropriate */
           coap_add_option_internal(response, COAP_OPTION_BLOCK2,
                                    coap_encode_var_safe(buf, sizeof(buf),
@@ -1007,6 +1084,10 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
         coap_check_code_lg_xmit(obs->session, response, r, query,
                                 obs->pdu->code);
         coap_delete_string(query);
+        /* Keep a copy for the other observers if it fits in one PDU */
+        if (shared && COAP_RESPONSE_CLASS(response->code) == 2 &&
+            !coap_check_option(response, COAP_OPTION_BLOCK2, &opt_iter))
+          coap_notify_save_body(r, response);
         if (COAP_RESPONSE_CLASS(response->code) != 2) {
           coap_remove_option(response, COAP_OPTION_OBSERVE);
         }
@@ -1044,9 +1125,14 @@ coap_notify_observers(coap_context_t *context, coap_resource_t *r,
           }
         }
         r->partiallydirty = 1;
-        context->observe_pending = 1;
+        coap_resource_queue_dirty(context, r);
       }
     }
+    if (!r->partiallydirty && r->notify_body) {
+      /* Every observer has been sent this change */
+      coap_delete_pdu(r->notify_body);
+      r->notify_body = NULL;
+    }
   }
   r->dirty = 0;
 }
@@ -1069,7 +1155,7 @@ coap_resource_notify_observers(coap_resource_t *r,
   r->observe = (r->observe + 1) & 0xFFFFFF;
 
   assert(r->context);
-  r->context->observe_pending = 1;
+  coap_resource_queue_dirty(r->context, r);
 #ifdef COAP_EPOLL_SUPPORT
   coap_update_epoll_timer(r->context, 0);
 #endif /* COAP_EPOLL_SUPPORT */
@@ -1113,10 +1199,23 @@ coap_resource_get_uri_path(coap_resource_t *resource) {
 
 void
 coap_check_notify(coap_context_t *context) {
+  coap_resource_t *r;
 
-  if (context->observe_pending) {
+  /* Not when called from a handler while already notifying */
+  if (context->observe_pending && context->notify_resources == NULL) {
     context->observe_pending = 0;
-    RESOURCES_ITER(context->resources, r) {
+    /*
+     * Take over the resources queued so far.  Any queued again while
+     * notifying (e.g. as still partially dirty) are left for the next call.
+     */
+    context->notify_resources = context->dirty_resources;
+    context->dirty_resources = NULL;
+    DL_FOREACH2(context->notify_resources, r, dirty_next) {
+      r->queued = COAP_RESOURCE_QUEUED_NOTIFY;
+    }
+    while ((r = context->notify_resources) != NULL) {
+      DL_DELETE2(context->notify_resources, r, dirty_prev, dirty_next);
+      r->queued = COAP_RESOURCE_NOT_QUEUED;
       coap_notify_observers(context, r, COAP_NOT_DELETING_RESOURCE);
     }
   }
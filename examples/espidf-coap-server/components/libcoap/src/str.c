@@ -61,8 +61,8 @@ void coap_delete_str_const(coap_str_const_t *s) {
 
 coap_str_const_t *coap_make_str_const(const char *string)
 {
-  static int ofs = 0;
-  static coap_str_const_t var[COAP_MAX_STR_CONST_FUNC];
+  static COAP_THREAD_LOCAL int ofs = 0;
+  static COAP_THREAD_LOCAL coap_str_const_t var[COAP_MAX_STR_CONST_FUNC];
   if (++ofs == COAP_MAX_STR_CONST_FUNC) ofs = 0;
   var[ofs].length = strlen(string);
   var[ofs].s = (const uint8_t *)string;
@@ -558,18 +558,32 @@ is_unescaped_in_query(const uint8_t c) {
   return is_unescaped_in_path(c) || c=='/' || c=='?';
 }
 
-coap_string_t *coap_get_query(const coap_pdu_t *request) {
+/*
+ * Returns @p buf set up to hold a string of @p length if there is space for
+ * it and the terminating zero in the @p size bytes at buf->s, otherwise a
+ * new coap_string_t.
+ */
+static coap_string_t *
+coap_string_in_buf(coap_string_t *buf, size_t size, size_t length) {
+  if (buf && length < size) {
+    buf->length = length;
+    buf->s[length] = '\000';
+    return buf;
+  }
+  return coap_new_string(length);
+}
+
+coap_string_t *
+coap_get_query_buf(const coap_pdu_t *request, coap_string_t *buf,
+                   size_t size) {
   coap_opt_iterator_t opt_iter;
-  coap_opt_filter_t f;
   coap_opt_t *q;
   coap_string_t *query = NULL;
   size_t length = 0;
   static const uint8_t hex[] = "0123456789ABCDEF";
 
-  coap_option_filter_clear(&f);
-  coap_option_filter_set(&f, COAP_OPTION_URI_QUERY);
-  coap_option_iterator_init(request, &opt_iter, &f);
-  while ((q = coap_option_next(&opt_iter))) {
+  q = coap_check_option(request, COAP_OPTION_URI_QUERY, &opt_iter);
+  while (q) {
     uint16_t seg_len = coap_opt_length(q), i;
     const uint8_t *seg= coap_opt_value(q);
     for (i = 0; i < seg_len; i++) {
@@ -579,16 +593,16 @@ coap_string_t *coap_get_query(const coap_pdu_t *request) {
         length += 3;
     }
     length += 1;
+    q = coap_option_next(&opt_iter);
   }
   if (length > 0)
     length -= 1;
   if (length > 0) {
-    query = coap_new_string(length);
+    query = coap_string_in_buf(buf, size, length);
     if (query) {
-      query->length = length;
       unsigned char *s = query->s;
-      coap_option_iterator_init(request, &opt_iter, &f);
-      while ((q = coap_option_next(&opt_iter))) {
+      q = coap_check_option(request, COAP_OPTION_URI_QUERY, &opt_iter);
+      while (q) {
         if (s != query->s)
           *s++ = '&';
         uint16_t seg_len = coap_opt_length(q), i;
@@ -602,15 +616,21 @@ coap_string_t *coap_get_query(const coap_pdu_t *request) {
             *s++ = hex[seg[i]&0x0F];
           }
         }
+        q = coap_option_next(&opt_iter);
       }
     }
   }
   return query;
 }
 
-coap_string_t *coap_get_uri_path(const coap_pdu_t *request) {
+coap_string_t *coap_get_query(const coap_pdu_t *request) {
+  return coap_get_query_buf(request, NULL, 0);
+}
+
+coap_string_t *
+coap_get_uri_path_buf(const coap_pdu_t *request, coap_string_t *buf,
+                      size_t size) {
   coap_opt_iterator_t opt_iter;
-  coap_opt_filter_t f;
   coap_opt_t *q;
   coap_string_t *uri_path = NULL;
   size_t length = 0;
@@ -624,17 +644,15 @@ coap_string_t *coap_get_uri_path(const coap_pdu_t *request) {
                              coap_opt_length(q), &uri) < 0) {
       return NULL;
     }
-    uri_path = coap_new_string(uri.path.length);
+    uri_path = coap_string_in_buf(buf, size, uri.path.length);
     if (uri_path) {
       memcpy(uri_path->s, uri.path.s, uri.path.length);
     }
     return uri_path;
   }
 
-  coap_option_filter_clear(&f);
-  coap_option_filter_set(&f, COAP_OPTION_URI_PATH);
-  coap_option_iterator_init(request, &opt_iter, &f);
-  while ((q = coap_option_next(&opt_iter))) {
+  q = coap_check_option(request, COAP_OPTION_URI_PATH, &opt_iter);
+  while (q) {
     uint16_t seg_len = coap_opt_length(q), i;
     const uint8_t *seg= coap_opt_value(q);
     for (i = 0; i < seg_len; i++) {
@@ -645,19 +663,19 @@ coap_string_t *coap_get_uri_path(const coap_pdu_t *request) {
     }
     /* bump for the leading "/" */
     length += 1;
+    q = coap_option_next(&opt_iter);
   }
   /* The first entry does not have a leading "/" */
   if (length > 0)
     length -= 1;
 
   /* if 0, either no URI_PATH Option, or the first one was empty */
-  uri_path = coap_new_string(length);
+  uri_path = coap_string_in_buf(buf, size, length);
   if (uri_path) {
-    uri_path->length = length;
     unsigned char *s = uri_path->s;
     int n = 0;
-    coap_option_iterator_init(request, &opt_iter, &f);
-    while ((q = coap_option_next(&opt_iter))) {
+    q = coap_check_option(request, COAP_OPTION_URI_PATH, &opt_iter);
+    while (q) {
       if (n++) {
         *s++ = '/';
       }
@@ -672,8 +690,13 @@ coap_string_t *coap_get_uri_path(const coap_pdu_t *request) {
           *s++ = hex[seg[i]&0x0F];
         }
       }
+      q = coap_option_next(&opt_iter);
     }
   }
   return uri_path;
 }
 
+coap_string_t *coap_get_uri_path(const coap_pdu_t *request) {
+  return coap_get_uri_path_buf(request, NULL, 0);
+}
+
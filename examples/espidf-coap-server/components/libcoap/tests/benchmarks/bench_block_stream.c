@@ -0,0 +1,272 @@
+/* libcoap benchmark for receiving large bodies from many clients
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Has a number of loopback clients all uploading a firmware image at the
+ * same time using Block1, and reports the blocks received per second and
+ * the heap in use half way through the uploads.  This is done with the body
+ * re-assembled for the request handler (COAP_BLOCK_SINGLE_BODY), and with
+ * the body streamed to a block data handler.  Each pair of blocks after the
+ * first can be sent the wrong way round, to exercise the holding back of
+ * blocks that arrive early.  Every byte of the bodies is checked.
+ *
+ * Usage: bench_block_stream [clients [image-kbytes [reorder]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#define BLOCK_SZX 6
+#define BLOCK_SIZE (1 << (BLOCK_SZX + 4))
+
+static size_t image_size;
+static uint64_t bodies_done;
+static uint64_t bad_bytes;
+
+static uint8_t
+pattern(size_t offset) {
+  return (uint8_t)(offset * 7 + (offset >> 12));
+}
+
+static void
+check_data(size_t offset, const uint8_t *data, size_t length) {
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    if (data[i] != pattern(offset + i))
+      bad_bytes++;
+  }
+}
+
+static int
+stream_data(coap_session_t *session COAP_UNUSED,
+            const coap_pdu_t *pdu COAP_UNUSED,
+            size_t offset, const uint8_t *data, size_t length,
+            size_t total COAP_UNUSED) {
+  check_data(offset, data, length);
+  return 1;
+}
+
+static void
+hnd_put(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  size_t length, offset, total;
+  const uint8_t *data;
+
+  /* The whole body, unless it has been streamed */
+  if (coap_get_data_large(request, &length, &data, &offset, &total))
+    check_data(offset, data, length);
+  bodies_done++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+/* Builds a CON PUT /fw carrying block num of the image */
+static size_t
+build_request(uint8_t *buf, size_t len, uint32_t client, uint32_t num) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT,
+                                  (coap_mid_t)(num & 0xffff), len);
+  size_t blocks = image_size / BLOCK_SIZE;
+  uint8_t token[4];
+  uint8_t opt[4];
+  uint8_t *data;
+  size_t size = 0;
+  size_t i;
+
+  if (!pdu)
+    return 0;
+  token[0] = (uint8_t)(client >> 24);
+  token[1] = (uint8_t)(client >> 16);
+  token[2] = (uint8_t)(client >> 8);
+  token[3] = (uint8_t)client;
+  coap_add_token(pdu, sizeof(token), token);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 2, (const uint8_t *)"fw");
+  coap_add_option(pdu, COAP_OPTION_BLOCK1,
+                  coap_encode_var_safe(opt, sizeof(opt),
+                                       (num << 4) |
+                                       (num + 1 < blocks ? 0x08 : 0) |
+                                       BLOCK_SZX), opt);
+  coap_add_option(pdu, COAP_OPTION_SIZE1,
+                  coap_encode_var_safe(opt, sizeof(opt),
+                                       (unsigned int)image_size), opt);
+  data = coap_add_data_after(pdu, BLOCK_SIZE);
+  if (data && coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    for (i = 0; i < BLOCK_SIZE; i++)
+      data[i] = pattern((size_t)num * BLOCK_SIZE + i);
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+/*
+ * Returns the block to send in place of block b, swapping each pair of
+ * blocks after the first, but not the last block
+ */
+static uint32_t
+send_order(unsigned long b, unsigned long blocks) {
+  if (b % 2 == 1 && b + 1 < blocks - 1)
+    return (uint32_t)b + 1;
+  if (b && b % 2 == 0 && b < blocks - 1)
+    return (uint32_t)b - 1;
+  return (uint32_t)b;
+}
+
+/* Reads the responses queued on the client sockets, checking the codes */
+static uint64_t
+drain(const int *fds, unsigned long nfds, uint64_t *bad) {
+  uint64_t count = 0;
+  unsigned long i;
+  uint8_t buf[COAP_RXBUFFER_SIZE];
+  ssize_t len;
+
+  for (i = 0; i < nfds; i++) {
+    while ((len = recv(fds[i], buf, sizeof(buf), 0)) > 0) {
+      count++;
+      if (len < 2 || (buf[1] != COAP_RESPONSE_CODE(231) &&
+                      buf[1] != COAP_RESPONSE_CODE_CHANGED))
+        (*bad)++;
+    }
+  }
+  return count;
+}
+
+static size_t
+heap_in_use(void) {
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 mi = mallinfo2();
+
+  return mi.uordblks + mi.hblkhd;
+#else /* ! HAVE_MALLINFO2 */
+  return 0;
+#endif /* ! HAVE_MALLINFO2 */
+}
+
+static void
+run(int stream, const char *name, unsigned long clients, int reorder) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  int *fds = malloc(clients * sizeof(int));
+  unsigned long blocks = (unsigned long)(image_size / BLOCK_SIZE);
+  uint64_t start, elapsed, received = 0, bad = 0;
+  size_t heap_before = heap_in_use();
+  size_t heap_half = 0;
+  unsigned long i, b;
+  char label[80];
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep || !fds) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  if (stream) {
+    coap_context_set_block_mode(ctx, COAP_BLOCK_USE_LIBCOAP);
+    coap_register_block_data_handler(ctx, stream_data);
+  }
+  else {
+    coap_context_set_block_mode(ctx, COAP_BLOCK_USE_LIBCOAP |
+                                     COAP_BLOCK_SINGLE_BODY);
+  }
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  r = coap_resource_init(coap_make_str_const("fw"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put);
+  coap_add_resource(ctx, r);
+
+  bench_client_sockets(ep, fds, clients);
+
+  bodies_done = 0;
+  bad_bytes = 0;
+  start = bench_now_ns();
+  for (b = 0; b < blocks; b++) {
+    uint32_t num = reorder ? send_order(b, blocks) : (uint32_t)b;
+
+    for (i = 0; i < clients; i++) {
+      uint8_t buf[BLOCK_SIZE + 64];
+      size_t len = build_request(buf, sizeof(buf), (uint32_t)i, num);
+
+      if (send(fds[i], buf, len, 0) < 0) {
+        perror("send");
+        exit(1);
+      }
+      if (i % 64 == 63 || i + 1 == clients) {
+        coap_io_process(ctx, COAP_IO_NO_WAIT);
+        coap_io_process(ctx, COAP_IO_NO_WAIT);
+        received += drain(fds, clients, &bad);
+      }
+    }
+    if (b == blocks / 2)
+      heap_half = heap_in_use();
+  }
+  elapsed = bench_now_ns() - start;
+
+  snprintf(label, sizeof(label), "%lu clients, %s", clients, name);
+  bench_report(label, received, elapsed);
+  printf("  heap half way %.1f MB, %llu of %lu bodies done, "
+         "%llu bad bytes, %llu of %lu blocks bad or missing\n",
+         (double)(heap_half - heap_before) / (1024 * 1024),
+         (unsigned long long)bodies_done, clients,
+         (unsigned long long)bad_bytes,
+         (unsigned long long)(bad + clients * blocks - received),
+         clients * blocks);
+
+  for (i = 0; i < clients; i++)
+    close(fds[i]);
+  free(fds);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long clients = bench_arg(argc, argv, 1, 100);
+  unsigned long kbytes = bench_arg(argc, argv, 2, 2048);
+  int reorder = (int)bench_arg(argc, argv, 3, 1);
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  image_size = kbytes * 1024;
+  if (image_size < 2 * BLOCK_SIZE)
+    image_size = 2 * BLOCK_SIZE;
+  image_size -= image_size % BLOCK_SIZE;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  printf("%lu KB image, %lu clients, blocks of %d bytes%s\n",
+         (unsigned long)(image_size / 1024), clients, BLOCK_SIZE,
+         reorder ? ", pairs of blocks swapped" : "");
+
+  run(0, "body re-assembled", clients, reorder);
+  run(1, "body streamed", clients, reorder);
+
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,119 @@
+/* libcoap benchmark for the cache-entry handling
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Fills the cache of a context with idle expiring cache-entries, as a proxy
+ * would, and reports how many coap_expire_cache_entries() calls (made once
+ * per coap_io_process()) can be made per second, the lookup rate, and the
+ * rate at which new cache-entries can be added when the cache is at its
+ * max_entries limit.
+ *
+ * Usage: bench_cache [entries [calls]]
+ */
+
+#include "bench_common.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static coap_pdu_t *
+make_request(unsigned long id) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  0, 128);
+  char uri[64];
+
+  if (!pdu)
+    return NULL;
+  snprintf(uri, sizeof(uri), "coap://device-%lu.example.com/sensor", id);
+  coap_add_option(pdu, COAP_OPTION_PROXY_URI, strlen(uri),
+                  (const uint8_t *)uri);
+  return pdu;
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long nentries = bench_arg(argc, argv, 1, 100000);
+  unsigned long calls = bench_arg(argc, argv, 2, 1000);
+  coap_context_t *ctx;
+  coap_session_t *session;
+  coap_address_t addr;
+  coap_pdu_t **requests;
+  coap_cache_stats_t stats;
+  uint64_t start;
+  unsigned long i;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  ctx = coap_new_context(NULL);
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = htons(COAP_DEFAULT_PORT);
+  addr.size = sizeof(struct sockaddr_in);
+
+  session = ctx ? coap_new_client_session(ctx, NULL, &addr,
+                                          COAP_PROTO_UDP) : NULL;
+  requests = malloc(2 * nentries * sizeof(coap_pdu_t *));
+  if (!session || !requests) {
+    fprintf(stderr, "cannot create session\n");
+    return 1;
+  }
+  for (i = 0; i < 2 * nentries; i++) {
+    requests[i] = make_request(i);
+    if (!requests[i]) {
+      fprintf(stderr, "cannot create request\n");
+      return 1;
+    }
+  }
+  printf("%lu cache-entries\n", nentries);
+
+  start = bench_now_ns();
+  for (i = 0; i < nentries; i++) {
+    /* Max-Age between a minute and ten minutes */
+    coap_new_cache_entry(session, requests[i], COAP_CACHE_NOT_RECORD_PDU,
+                         COAP_CACHE_NOT_SESSION_BASED,
+                         60 + (unsigned int)(i % 540));
+  }
+  bench_report("coap_new_cache_entry()", nentries, bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (i = 0; i < calls; i++)
+    coap_expire_cache_entries(ctx);
+  bench_report("coap_expire_cache_entries()", calls, bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (i = 0; i < nentries; i++)
+    coap_cache_get_by_pdu(session, requests[(i * 7919) % nentries],
+                          COAP_CACHE_NOT_SESSION_BASED);
+  bench_report("coap_cache_get_by_pdu()", nentries, bench_now_ns() - start);
+
+  coap_cache_set_limits(ctx, nentries, 0);
+  start = bench_now_ns();
+  for (i = nentries; i < 2 * nentries; i++) {
+    coap_new_cache_entry(session, requests[i], COAP_CACHE_NOT_RECORD_PDU,
+                         COAP_CACHE_NOT_SESSION_BASED, 60);
+  }
+  bench_report("coap_new_cache_entry() with eviction", nentries,
+               bench_now_ns() - start);
+
+  coap_cache_get_stats(ctx, &stats);
+  printf("  %lu entries, %lu bytes, %llu hits, %llu misses, %llu evicted\n",
+         (unsigned long)stats.entries, (unsigned long)stats.bytes,
+         (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+         (unsigned long long)stats.evictions);
+
+  for (i = 0; i < 2 * nentries; i++)
+    coap_delete_pdu(requests[i]);
+  free(requests);
+  coap_free_context(ctx);
+  coap_cleanup();
+  return 0;
+}
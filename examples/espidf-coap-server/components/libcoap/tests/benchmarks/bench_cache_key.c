@@ -0,0 +1,142 @@
+/* libcoap benchmark for deriving cache-keys
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Reports how many cache-keys can be derived per second from a typical
+ * proxied request, and how many coap_cache_get_by_pdu() lookups hitting a
+ * cache-entry can be made per second, for COAP_CACHE_KEY_DIGEST and
+ * COAP_CACHE_KEY_FAST.
+ *
+ * Usage: bench_cache_key [keys [entries]]
+ */
+
+#include "bench_common.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static coap_pdu_t *
+make_request(unsigned long id) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  0, 256);
+  uint8_t buf[4];
+  char query[32];
+
+  if (!pdu)
+    return NULL;
+  coap_add_option(pdu, COAP_OPTION_OBSERVE, 0, NULL);
+  coap_add_option(pdu, COAP_OPTION_URI_HOST, 19,
+                  (const uint8_t *)"sensors.example.com");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 8, (const uint8_t *)"building");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 5, (const uint8_t *)"floor");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 11,
+                  (const uint8_t *)"temperature");
+  snprintf(query, sizeof(query), "room=%lu", id);
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, strlen(query),
+                  (const uint8_t *)query);
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, 6, (const uint8_t *)"unit=C");
+  coap_add_option(pdu, COAP_OPTION_ACCEPT,
+                  coap_encode_var_safe(buf, sizeof(buf),
+                                       COAP_MEDIATYPE_APPLICATION_CBOR), buf);
+  return pdu;
+}
+
+static void
+run(coap_session_t *session, coap_cache_key_mode_t mode,
+    coap_pdu_t **requests, unsigned long nkeys, unsigned long nentries) {
+  coap_context_t *ctx = coap_session_get_context(session);
+  const char *name = mode == COAP_CACHE_KEY_FAST ? "fast" : "digest";
+  coap_cache_entry_t *cp, *ctmp;
+  unsigned long i, found = 0;
+  uint64_t start;
+  char label[64];
+
+  coap_cache_set_key_mode(ctx, mode);
+
+  start = bench_now_ns();
+  for (i = 0; i < nkeys; i++) {
+    coap_cache_key_t *cache_key;
+
+    cache_key = coap_cache_derive_key(session, requests[i % nentries],
+                                      COAP_CACHE_NOT_SESSION_BASED);
+    coap_delete_cache_key(cache_key);
+  }
+  snprintf(label, sizeof(label), "coap_cache_derive_key() %s", name);
+  bench_report(label, nkeys, bench_now_ns() - start);
+
+  for (i = 0; i < nentries; i++) {
+    coap_new_cache_entry(session, requests[i], COAP_CACHE_NOT_RECORD_PDU,
+                         COAP_CACHE_NOT_SESSION_BASED, 0);
+  }
+  start = bench_now_ns();
+  for (i = 0; i < nkeys; i++) {
+    if (coap_cache_get_by_pdu(session, requests[(i * 7919) % nentries],
+                              COAP_CACHE_NOT_SESSION_BASED))
+      found++;
+  }
+  snprintf(label, sizeof(label), "coap_cache_get_by_pdu() %s", name);
+  bench_report(label, nkeys, bench_now_ns() - start);
+  if (found != nkeys)
+    printf("  only %lu of %lu found\n", found, nkeys);
+
+  HASH_ITER(hh, ctx->cache, cp, ctmp) {
+    coap_delete_cache_entry(ctx, cp);
+  }
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long nkeys = bench_arg(argc, argv, 1, 1000000);
+  unsigned long nentries = bench_arg(argc, argv, 2, 10000);
+  coap_context_t *ctx;
+  coap_session_t *session;
+  coap_address_t addr;
+  coap_pdu_t **requests;
+  unsigned long i;
+
+  if (nentries == 0)
+    nentries = 1;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  ctx = coap_new_context(NULL);
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = htons(COAP_DEFAULT_PORT);
+  addr.size = sizeof(struct sockaddr_in);
+
+  session = ctx ? coap_new_client_session(ctx, NULL, &addr,
+                                          COAP_PROTO_UDP) : NULL;
+  requests = malloc(nentries * sizeof(coap_pdu_t *));
+  if (!session || !requests) {
+    fprintf(stderr, "cannot create session\n");
+    return 1;
+  }
+  for (i = 0; i < nentries; i++) {
+    requests[i] = make_request(i);
+    if (!requests[i]) {
+      fprintf(stderr, "cannot create request\n");
+      return 1;
+    }
+  }
+  printf("%lu keys, %lu cache-entries\n", nkeys, nentries);
+
+  run(session, COAP_CACHE_KEY_DIGEST, requests, nkeys, nentries);
+  run(session, COAP_CACHE_KEY_FAST, requests, nkeys, nentries);
+
+  for (i = 0; i < nentries; i++)
+    coap_delete_pdu(requests[i]);
+  free(requests);
+  coap_free_context(ctx);
+  coap_cleanup();
+  return 0;
+}
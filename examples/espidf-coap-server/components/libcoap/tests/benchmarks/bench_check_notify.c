@@ -0,0 +1,164 @@
+/* libcoap benchmark for finding the resources with observers to notify
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Registers a large number of resources (as in one per device shadow), some
+ * of them with a loopback observer, and reports how many coap_check_notify()
+ * calls can be made per second with a few of the observed resources changing
+ * between the calls.
+ *
+ * Usage: bench_check_notify [resources [observed [calls [changed-per-call]]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define NUM_SOCKETS 16
+
+static void
+hnd_get(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request COAP_UNUSED,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data(response, 4, (const uint8_t *)"21.5");
+}
+
+/* Builds a NON GET /dNNNNNN with Observe: 0 and a 4 byte token */
+static size_t
+build_register(uint8_t *buf, size_t len, uint32_t id) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_NON, COAP_REQUEST_CODE_GET,
+                                  (coap_mid_t)(id & 0xffff), len);
+  uint8_t token[4];
+  char path[16];
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  token[0] = (uint8_t)(id >> 24);
+  token[1] = (uint8_t)(id >> 16);
+  token[2] = (uint8_t)(id >> 8);
+  token[3] = (uint8_t)id;
+  coap_add_token(pdu, sizeof(token), token);
+  coap_add_option(pdu, COAP_OPTION_OBSERVE, 0, NULL);
+  snprintf(path, sizeof(path), "d%06u", id);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, strlen(path),
+                  (const uint8_t *)path);
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long nresources = bench_arg(argc, argv, 1, 50000);
+  unsigned long observed = bench_arg(argc, argv, 2, 1000);
+  unsigned long calls = bench_arg(argc, argv, 3, 10000);
+  unsigned long changed = bench_arg(argc, argv, 4, 1);
+  coap_resource_t **resources;
+  coap_context_t *ctx;
+  coap_endpoint_t *ep;
+  coap_address_t addr;
+  int fds[NUM_SOCKETS];
+  uint64_t start, elapsed = 0, received = 0;
+  unsigned long i, j, next = 0;
+
+  if (observed > nresources)
+    observed = nresources;
+  if (observed == 0)
+    observed = 1;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  ctx = coap_new_context(NULL);
+  resources = malloc(nresources * sizeof(coap_resource_t *));
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep || !resources) {
+    fprintf(stderr, "cannot create endpoint\n");
+    return 1;
+  }
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  printf("%lu resources, %lu observed, %lu changed per call\n",
+         nresources, observed, changed);
+
+  for (i = 0; i < nresources; i++) {
+    char path[24];
+    coap_resource_t *r;
+
+    snprintf(path, sizeof(path), "d%06lu", i);
+    r = coap_resource_init(coap_new_str_const((const uint8_t *)path,
+                                              strlen(path)),
+                           COAP_RESOURCE_FLAGS_RELEASE_URI |
+                           COAP_RESOURCE_FLAGS_NOTIFY_NON_ALWAYS);
+    coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+    coap_resource_set_get_observable(r, 1);
+    coap_add_resource(ctx, r);
+    resources[i] = r;
+  }
+
+  bench_client_sockets(ep, fds, NUM_SOCKETS);
+  /* Observe every (nresources / observed)th resource */
+  for (i = 0; i < observed; i++) {
+    uint8_t buf[64];
+    size_t len = build_register(buf, sizeof(buf),
+                                (uint32_t)(i * (nresources / observed)));
+
+    if (send(fds[i % NUM_SOCKETS], buf, len, 0) < 0) {
+      perror("send");
+      return 1;
+    }
+    if (i % 64 == 63 || i + 1 == observed)
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+  }
+  coap_io_process(ctx, COAP_IO_NO_WAIT);
+  bench_drain(fds, NUM_SOCKETS);
+
+  for (i = 0; i < calls; i++) {
+    for (j = 0; j < changed; j++) {
+      coap_resource_notify_observers(
+                        resources[next * (nresources / observed)], NULL);
+      next = (next + 1) % observed;
+    }
+    start = bench_now_ns();
+    coap_check_notify(ctx);
+    elapsed += bench_now_ns() - start;
+    /* Send anything held back for a batched send */
+    coap_io_process(ctx, COAP_IO_NO_WAIT);
+    received += bench_drain(fds, NUM_SOCKETS);
+  }
+  bench_report("coap_check_notify()", calls, elapsed);
+  printf("  %llu notifications received\n", (unsigned long long)received);
+
+  start = bench_now_ns();
+  for (i = 0; i < calls; i++)
+    coap_check_notify(ctx);
+  bench_report("coap_check_notify() nothing changed", calls,
+               bench_now_ns() - start);
+
+  coap_free_context(ctx);
+  free(resources);
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,83 @@
+/* libcoap benchmarks common include
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#ifndef BENCH_COMMON_H_
+#define BENCH_COMMON_H_
+
+#include "../test_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+
+/* Returns a monotonic timestamp in nanoseconds. */
+static inline uint64_t
+bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Prints a single result line of the form "label: count in secs (rate/s)". */
+static void
+bench_report(const char *label, uint64_t count, uint64_t elapsed_ns) {
+  double secs = (double)elapsed_ns / 1e9;
+
+  printf("%-40s %10llu in %8.3f s  %12.0f /s\n", label,
+         (unsigned long long)count, secs, secs > 0 ? (double)count / secs : 0.0);
+}
+
+/* Returns argv[idx] as a number, or def if it is not present. */
+static inline unsigned long
+bench_arg(int argc, char **argv, int idx, unsigned long def) {
+  return argc > idx ? strtoul(argv[idx], NULL, 0) : def;
+}
+
+/*
+ * Opens n non-blocking UDP sockets connected to ep, as the clients of a
+ * benchmark, exiting if that fails.
+ */
+static inline void
+bench_client_sockets(const coap_endpoint_t *ep, int *fds, unsigned long n) {
+  unsigned long i;
+
+  for (i = 0; i < n; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[i] < 0 ||
+        connect(fds[i], &ep->bind_addr.addr.sa, ep->bind_addr.size) < 0) {
+      perror("client socket");
+      exit(1);
+    }
+    fcntl(fds[i], F_SETFL, O_NONBLOCK);
+  }
+}
+
+/*
+ * Reads and discards everything queued on the client sockets.  Only the
+ * datagrams are counted, and recv() drops what does not fit in buf.
+ */
+static inline uint64_t
+bench_drain(const int *fds, unsigned long nfds) {
+  uint64_t count = 0;
+  unsigned long i;
+  uint8_t buf[4];
+
+  for (i = 0; i < nfds; i++) {
+    while (recv(fds[i], buf, sizeof(buf), 0) > 0)
+      count++;
+  }
+  return count;
+}
+
+#endif /* BENCH_COMMON_H_ */
@@ -0,0 +1,179 @@
+/* libcoap benchmark for the detection of duplicate requests
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Sends CON POST requests over loopback to a server with a non-idempotent
+ * handler, retransmitting one in every retransmit-interval of them as if
+ * its ACK had been lost.  Reports the requests handled per second, how
+ * many times the handler was called and how many of the retransmissions
+ * were answered by resending the original ACK, with duplicate detection
+ * enabled and disabled.  The first run has no retransmissions, to show the
+ * cost of remembering the requests.  Each client sends far faster than one
+ * waiting for its ACKs would, so nearly every request is forgotten while its
+ * client could still retransmit it, and counted as evicted.
+ *
+ * Usage: bench_dedup [requests [retransmit-interval]]
+ */
+
+#include "bench_common.h"
+
+/* The number of requests remembered per session when dedup is on */
+#define DEDUP_ENTRIES 8
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define NUM_SOCKETS 16
+
+static unsigned long handled;
+
+static void
+hnd_post(coap_resource_t *resource COAP_UNUSED,
+         coap_session_t *session COAP_UNUSED,
+         const coap_pdu_t *request COAP_UNUSED,
+         const coap_string_t *query COAP_UNUSED,
+         coap_pdu_t *response) {
+  uint8_t buf[4];
+
+  handled++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+  coap_add_data(response,
+                coap_encode_var_safe(buf, sizeof(buf), (unsigned)handled),
+                buf);
+}
+
+/*
+ * Builds a CON POST /counter with a 4 byte token, which is at offset 4
+ * after the message id.
+ */
+static size_t
+build_request(uint8_t *buf, size_t len) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_POST,
+                                  0, len);
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  coap_add_token(pdu, 4, (const uint8_t *)"tokn");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 7, (const uint8_t *)"counter");
+  coap_add_data(pdu, 3, (const uint8_t *)"inc");
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+static void
+run(unsigned long requests, unsigned long interval, unsigned int entries) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_dedup_stats_t stats;
+  int fds[NUM_SOCKETS];
+  uint8_t buf[64];
+  size_t len = build_request(buf, sizeof(buf));
+  uint64_t start, elapsed, received = 0;
+  unsigned long i, sent = 0;
+  char label[80];
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep || !len) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  coap_context_set_max_dedup_entries(ctx, entries);
+  r = coap_resource_init(coap_make_str_const("counter"), 0);
+  coap_register_handler(r, COAP_REQUEST_POST, hnd_post);
+  coap_add_resource(ctx, r);
+
+  bench_client_sockets(ep, fds, NUM_SOCKETS);
+
+  handled = 0;
+  start = bench_now_ns();
+  for (i = 0; i < requests; i++) {
+    int fd = fds[i % NUM_SOCKETS];
+
+    /* A new message id and token for each request */
+    buf[2] = (uint8_t)(i >> 8);
+    buf[3] = (uint8_t)i;
+    buf[4] = (uint8_t)(i >> 24);
+    buf[5] = (uint8_t)(i >> 16);
+    buf[6] = (uint8_t)(i >> 8);
+    buf[7] = (uint8_t)i;
+    if (send(fd, buf, len, 0) < 0) {
+      perror("send");
+      exit(1);
+    }
+    sent++;
+    if (interval && i % interval == interval - 1) {
+      /* The retransmission of a request whose ACK was lost */
+      if (send(fd, buf, len, 0) < 0) {
+        perror("send");
+        exit(1);
+      }
+      sent++;
+    }
+    if (i % 64 == 63 || i + 1 == requests) {
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+      /* Send anything held back for a batched send */
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+      received += bench_drain(fds, NUM_SOCKETS);
+    }
+  }
+  elapsed = bench_now_ns() - start;
+  coap_context_get_dedup_stats(ctx, &stats);
+
+  snprintf(label, sizeof(label), "requests, 1 in %lu retransmitted, %s",
+           interval, entries ? "dedup on" : "dedup off");
+  if (!interval)
+    snprintf(label, sizeof(label), "requests, none retransmitted, %s",
+             entries ? "dedup on" : "dedup off");
+  bench_report(label, sent, elapsed);
+  printf("  %lu of %lu requests handled, %llu replayed, %llu dropped, "
+         "%llu evicted within MAX_TRANSMIT_SPAN, "
+         "%llu responses received\n",
+         handled, sent, (unsigned long long)stats.replayed,
+         (unsigned long long)stats.dropped,
+         (unsigned long long)stats.evicted, (unsigned long long)received);
+
+  for (i = 0; i < NUM_SOCKETS; i++)
+    close(fds[i]);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long requests = bench_arg(argc, argv, 1, 200000);
+  unsigned long interval = bench_arg(argc, argv, 2, 4);
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  printf("%lu requests, 1 in %lu retransmitted\n", requests, interval);
+
+  run(requests, 0, 0);
+  run(requests, 0, DEDUP_ENTRIES);
+  run(requests, interval, 0);
+  run(requests, interval, DEDUP_ENTRIES);
+
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,209 @@
+/* libcoap benchmark for dispatching options-heavy requests
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Builds a request with the options a proxied, observed, block-wise GET
+ * carries and reports how many times per second it can be parsed, how many
+ * coap_check_option() lookups of the options a server looks for can be made
+ * per second on the parsed request, how many times per second its uri_path
+ * and query can be extracted, and how many of the requests can be sent over
+ * loopback to a server and dispatched to the handler of the resource per
+ * second.
+ *
+ * Usage: bench_dispatch [requests [lookups]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define NUM_SOCKETS 16
+
+/* The options looked for by a server handling a request, most missing */
+static const coap_option_num_t lookups[] = {
+  COAP_OPTION_PROXY_SCHEME, COAP_OPTION_PROXY_URI, COAP_OPTION_URI_HOST,
+  COAP_OPTION_HOP_LIMIT, COAP_OPTION_OSCORE, COAP_OPTION_OBSERVE,
+  COAP_OPTION_BLOCK1, COAP_OPTION_BLOCK2, COAP_OPTION_SIZE1,
+  COAP_OPTION_SIZE2, COAP_OPTION_ACCEPT, COAP_OPTION_ECHO,
+  COAP_OPTION_RTAG, COAP_OPTION_NORESPONSE, COAP_OPTION_IF_MATCH,
+  COAP_OPTION_ETAG
+};
+
+static unsigned long handled;
+
+static void
+hnd_get(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request COAP_UNUSED,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  handled++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data(response, 4, (const uint8_t *)"21.5");
+}
+
+/* Builds a NON GET for /building/floor-3/room-12/temperature with a query */
+static size_t
+build_request(uint8_t *buf, size_t len, uint32_t id) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_NON, COAP_REQUEST_CODE_GET,
+                                  (coap_mid_t)(id & 0xffff), len);
+  uint8_t token[4];
+  uint8_t opt[4];
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  token[0] = (uint8_t)(id >> 24);
+  token[1] = (uint8_t)(id >> 16);
+  token[2] = (uint8_t)(id >> 8);
+  token[3] = (uint8_t)id;
+  coap_add_token(pdu, sizeof(token), token);
+  coap_add_option(pdu, COAP_OPTION_ETAG, 4, (const uint8_t *)"v123");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 8, (const uint8_t *)"building");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 7, (const uint8_t *)"floor-3");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 7, (const uint8_t *)"room-12");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 11,
+                  (const uint8_t *)"temperature");
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, 6, (const uint8_t *)"unit=C");
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, 9,
+                  (const uint8_t *)"precise=1");
+  coap_add_option(pdu, COAP_OPTION_ACCEPT,
+                  coap_encode_var_safe(opt, sizeof(opt),
+                                       COAP_MEDIATYPE_TEXT_PLAIN), opt);
+  coap_add_option(pdu, COAP_OPTION_BLOCK2,
+                  coap_encode_var_safe(opt, sizeof(opt), 6), opt);
+  coap_add_option(pdu, COAP_OPTION_SIZE2, 0, NULL);
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+static void
+run_parse(unsigned long nlookups) {
+  coap_pdu_t *pdu = coap_pdu_init(0, 0, 0, COAP_DEFAULT_MAX_PDU_RX_SIZE);
+  uint8_t buf[128];
+  size_t len = build_request(buf, sizeof(buf), 1);
+  coap_opt_iterator_t opt_iter;
+  unsigned long i, found = 0;
+  uint64_t start;
+
+  if (!pdu || !len) {
+    fprintf(stderr, "cannot create request\n");
+    exit(1);
+  }
+
+  start = bench_now_ns();
+  for (i = 0; i < nlookups / 16; i++)
+    coap_pdu_parse(COAP_PROTO_UDP, buf, len, pdu);
+  bench_report("coap_pdu_parse()", nlookups / 16, bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (i = 0; i < nlookups; i++) {
+    if (coap_check_option(pdu,
+                          lookups[i % (sizeof(lookups) / sizeof(lookups[0]))],
+                          &opt_iter))
+      found++;
+  }
+  bench_report("coap_check_option()", nlookups, bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (i = 0; i < nlookups / 16; i++) {
+    coap_string_t *uri_path = coap_get_uri_path(pdu);
+    coap_string_t *query = coap_get_query(pdu);
+
+    if (uri_path && query)
+      found++;
+    coap_delete_string(uri_path);
+    coap_delete_string(query);
+  }
+  bench_report("coap_get_uri_path() + coap_get_query()", nlookups / 16,
+               bench_now_ns() - start);
+  if (found == 0)
+    printf("  nothing found\n");
+
+  coap_delete_pdu(pdu);
+}
+
+static void
+run_dispatch(unsigned long requests) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  int fds[NUM_SOCKETS];
+  uint8_t buf[128];
+  uint64_t start, received = 0;
+  unsigned long i;
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  r = coap_resource_init(
+         coap_make_str_const("building/floor-3/room-12/temperature"), 0);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+  coap_add_resource(ctx, r);
+
+  bench_client_sockets(ep, fds, NUM_SOCKETS);
+
+  handled = 0;
+  start = bench_now_ns();
+  for (i = 0; i < requests; i++) {
+    size_t len = build_request(buf, sizeof(buf), (uint32_t)i);
+
+    if (send(fds[i % NUM_SOCKETS], buf, len, 0) < 0) {
+      perror("send");
+      exit(1);
+    }
+    if (i % 64 == 63 || i + 1 == requests) {
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+      /* Send anything held back for a batched send */
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+      received += bench_drain(fds, NUM_SOCKETS);
+    }
+  }
+  bench_report("requests dispatched", handled, bench_now_ns() - start);
+  printf("  %lu of %lu requests handled, %llu responses received\n",
+         handled, requests, (unsigned long long)received);
+
+  for (i = 0; i < NUM_SOCKETS; i++)
+    close(fds[i]);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long requests = bench_arg(argc, argv, 1, 200000);
+  unsigned long nlookups = bench_arg(argc, argv, 2, 10000000);
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  printf("%lu requests, %lu option lookups\n", requests, nlookups);
+
+  run_parse(nlookups);
+  run_dispatch(requests);
+
+  coap_cleanup();
+  return 0;
+}
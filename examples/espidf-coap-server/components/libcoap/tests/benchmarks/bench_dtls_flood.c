@@ -0,0 +1,244 @@
+/* libcoap benchmark for DTLS handshakes under a ClientHello flood
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Has a loopback client set up DTLS PSK sessions to a server one after the
+ * other for 2 seconds (unless given), while ClientHellos without a cookie
+ * are sent to the server from 256 other addresses, as a flood from spoofed
+ * addresses would.  The flood sends 0, 16 and 64 ClientHellos (unless given)
+ * each time the server and the client have been run.  Reports the
+ * legitimate handshakes completed, the ClientHellos of the flood sent, and
+ * the server sessions that were made.  Cookies are checked before a server
+ * session is made with TinyDTLS, OpenSSL and GnuTLS, but not with Mbed TLS,
+ * whose runs are labelled as such.
+ *
+ * Usage: bench_dtls_flood [seconds [hellos-per-round]]
+ */
+
+#include "bench_common.h"
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define FLOOD_SOURCES 256
+
+static unsigned long sessions_made;
+
+static int
+event_handler(coap_session_t *session COAP_UNUSED, const coap_event_t event) {
+  if (event == COAP_EVENT_SERVER_SESSION_NEW)
+    sessions_made++;
+  return 0;
+}
+
+/* A ClientHello of epoch 0 with no cookie, offering TLS_PSK_WITH_AES_128_CCM_8 */
+static const uint8_t client_hello[] = {
+  /* record header: handshake, DTLS 1.0, epoch 0, sequence number, length */
+  0x16, 0xfe, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x36,
+  /* handshake header: ClientHello, length, message_seq, fragment */
+  0x01, 0x00, 0x00, 0x2a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x2a,
+  /* client_version DTLS 1.2 */
+  0xfe, 0xfd,
+  /* random, overwritten for each ClientHello */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  /* session_id, cookie */
+  0x00, 0x00,
+  /* cipher_suites */
+  0x00, 0x02, 0xc0, 0xa8,
+  /* compression_methods */
+  0x01, 0x00
+};
+
+#define OFF_RANDOM 27
+
+typedef struct {
+  int fd[FLOOD_SOURCES];
+  unsigned long sent;
+  uint8_t hello[sizeof(client_hello)];
+} flood_t;
+
+/* Binds each source to its own address in 127.0.0.0/8 */
+static void
+flood_open(flood_t *flood) {
+  struct sockaddr_in sin;
+  int i;
+
+  memset(flood, 0, sizeof(*flood));
+  memcpy(flood->hello, client_hello, sizeof(client_hello));
+  for (i = 0; i < FLOOD_SOURCES; i++) {
+    flood->fd[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (flood->fd[i] < 0) {
+      perror("socket");
+      exit(1);
+    }
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i);
+    if (bind(flood->fd[i], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+      perror("bind");
+      exit(1);
+    }
+  }
+}
+
+static void
+flood_close(flood_t *flood) {
+  int i;
+
+  for (i = 0; i < FLOOD_SOURCES; i++)
+    close(flood->fd[i]);
+}
+
+/* Sends count ClientHellos, each from the next source and with a new random */
+static void
+flood_send(flood_t *flood, const coap_address_t *addr, unsigned long count) {
+  uint8_t discard[512];
+  unsigned long i;
+
+  for (i = 0; i < count; i++) {
+    int fd = flood->fd[flood->sent % FLOOD_SOURCES];
+
+    memcpy(flood->hello + OFF_RANDOM, &flood->sent, sizeof(flood->sent));
+    if (sendto(fd, flood->hello, sizeof(flood->hello), 0,
+               &addr->addr.sa, addr->size) == (ssize_t)sizeof(flood->hello))
+      flood->sent++;
+    /* HelloVerifyRequests, if any, are thrown away */
+    while (recv(fd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+      ;
+  }
+}
+
+static void
+run(unsigned long per_round, uint64_t duration) {
+  coap_context_t *server = coap_new_context(NULL);
+  coap_context_t *client = coap_new_context(NULL);
+  coap_dtls_spsk_t spsk;
+  coap_address_t addr;
+  coap_endpoint_t *ep = NULL;
+  flood_t flood;
+  uint64_t start, elapsed;
+  unsigned long done = 0, failed = 0;
+  char label[80];
+
+  if (server && client) {
+    memset(&spsk, 0, sizeof(spsk));
+    spsk.version = COAP_DTLS_SPSK_SETUP_VERSION;
+    spsk.psk_info.key.s = (const uint8_t *)"bench-secret";
+    spsk.psk_info.key.length = 12;
+    coap_context_set_psk2(server, &spsk);
+    coap_register_event_handler(server, event_handler);
+    /* so that the server can keep up with the flood */
+    coap_context_set_max_read_batch(server, 64);
+    coap_address_init(&addr);
+    addr.addr.sin.sin_family = AF_INET;
+    addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.size = sizeof(struct sockaddr_in);
+    ep = coap_new_endpoint(server, &addr, COAP_PROTO_DTLS);
+  }
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  flood_open(&flood);
+  sessions_made = 0;
+
+  start = bench_now_ns();
+  while (bench_now_ns() - start < duration) {
+    coap_dtls_cpsk_t cpsk;
+    coap_session_t *session;
+
+    memset(&cpsk, 0, sizeof(cpsk));
+    cpsk.version = COAP_DTLS_CPSK_SETUP_VERSION;
+    cpsk.psk_info.identity.s = (const uint8_t *)"bench";
+    cpsk.psk_info.identity.length = 5;
+    cpsk.psk_info.key.s = (const uint8_t *)"bench-secret";
+    cpsk.psk_info.key.length = 12;
+    session = coap_new_client_session_psk2(client, NULL, &ep->bind_addr,
+                                           COAP_PROTO_DTLS, &cpsk);
+    if (!session)
+      break;
+    while (session->state == COAP_SESSION_STATE_HANDSHAKE &&
+           bench_now_ns() - start < duration) {
+      flood_send(&flood, &ep->bind_addr, per_round);
+      coap_io_process(server, COAP_IO_NO_WAIT);
+      coap_io_process(client, COAP_IO_NO_WAIT);
+    }
+    if (session->state == COAP_SESSION_STATE_ESTABLISHED)
+      done++;
+    else
+      failed++;
+    coap_session_release(session);
+    coap_io_process(server, COAP_IO_NO_WAIT);
+  }
+  elapsed = bench_now_ns() - start;
+
+  snprintf(label, sizeof(label), "handshakes, %lu flood hellos/round",
+           per_round);
+  bench_report(label, done, elapsed);
+  snprintf(label, sizeof(label), "  flood hellos sent");
+  bench_report(label, flood.sent, elapsed);
+  printf("  %lu unfinished, %lu server sessions made\n", failed,
+         sessions_made);
+
+  flood_close(&flood);
+  coap_free_context(client);
+  coap_free_context(server);
+}
+
+static const char *
+tls_library(coap_tls_library_t type) {
+  switch (type) {
+  case COAP_TLS_LIBRARY_TINYDTLS: return "TinyDTLS";
+  case COAP_TLS_LIBRARY_OPENSSL:  return "OpenSSL";
+  case COAP_TLS_LIBRARY_GNUTLS:   return "GnuTLS";
+  case COAP_TLS_LIBRARY_MBEDTLS:  return "Mbed TLS";
+  case COAP_TLS_LIBRARY_NOTLS:
+  default:                        return "no TLS";
+  }
+}
+
+int
+main(int argc, char **argv) {
+  coap_tls_library_t type = coap_get_tls_library_version()->type;
+  uint64_t duration = bench_arg(argc, argv, 1, 2) * 1000000000ULL;
+  unsigned long per_round = bench_arg(argc, argv, 2, 0);
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  coap_dtls_set_log_level(LOG_ERR);
+  if (!coap_dtls_is_supported()) {
+    fprintf(stderr, "libcoap was built without DTLS support\n");
+    coap_cleanup();
+    return 1;
+  }
+  printf("DTLS PSK handshakes over loopback with %s for %llu s each\n",
+         tls_library(type), (unsigned long long)(duration / 1000000000ULL));
+  if (type == COAP_TLS_LIBRARY_MBEDTLS)
+    printf("  %s checks cookies only once a session has been made, "
+           "so is not protected\n", tls_library(type));
+
+  if (per_round) {
+    run(per_round, duration);
+  }
+  else {
+    run(0, duration);
+    run(16, duration);
+    run(64, duration);
+  }
+
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,278 @@
+/* libcoap benchmark for serving a large body to many clients
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Serves a firmware image held in a file to a number of loopback clients
+ * all downloading it at the same time using Block2, and reports the blocks
+ * served per second and the heap in use once all the transfers have
+ * started.  This is done with the handler reading the image into memory for
+ * coap_add_data_large_response(), and with the image read a block at a time
+ * by coap_add_data_large_response_cb().  Every block received is checked.
+ *
+ * Usage: bench_large_body [clients [blocks-per-client [image-kbytes]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#define BLOCK_SZX 6
+#define BLOCK_SIZE (1 << (BLOCK_SZX + 4))
+
+static int image_fd = -1;
+static size_t image_size;
+static uint64_t read_bytes;
+
+static uint8_t
+pattern(size_t offset) {
+  return (uint8_t)(offset * 7 + (offset >> 12));
+}
+
+static void
+release_buffer(coap_session_t *session COAP_UNUSED, void *app_ptr) {
+  free(app_ptr);
+}
+
+static int
+get_block(coap_session_t *session COAP_UNUSED, size_t offset, size_t length,
+          uint8_t *data, void *app_ptr COAP_UNUSED) {
+  read_bytes += length;
+  return pread(image_fd, data, length, (off_t)offset) == (ssize_t)length;
+}
+
+static void
+hnd_get_buffer(coap_resource_t *resource, coap_session_t *session,
+               const coap_pdu_t *request, const coap_string_t *query,
+               coap_pdu_t *response) {
+  uint8_t *image = malloc(image_size);
+
+  if (!image ||
+      pread(image_fd, image, image_size, 0) != (ssize_t)image_size) {
+    free(image);
+    coap_pdu_set_code(response, COAP_RESPONSE_CODE_INTERNAL_ERROR);
+    return;
+  }
+  read_bytes += image_size;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data_large_response(resource, session, request, response, query,
+                               COAP_MEDIATYPE_APPLICATION_OCTET_STREAM, -1,
+                               0, image_size, image, release_buffer, image);
+}
+
+static void
+hnd_get_cb(coap_resource_t *resource, coap_session_t *session,
+           const coap_pdu_t *request, const coap_string_t *query,
+           coap_pdu_t *response) {
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data_large_response_cb(resource, session, request, response,
+                                  query,
+                                  COAP_MEDIATYPE_APPLICATION_OCTET_STREAM, -1,
+                                  0, image_size, get_block, NULL, NULL);
+}
+
+/* Builds a CON GET /fw with Block2 for block num */
+static size_t
+build_request(uint8_t *buf, size_t len, uint32_t client, uint32_t num) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  (coap_mid_t)(num & 0xffff), len);
+  uint8_t token[4];
+  uint8_t opt[4];
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  token[0] = (uint8_t)(client >> 24);
+  token[1] = (uint8_t)(client >> 16);
+  token[2] = (uint8_t)(client >> 8);
+  token[3] = (uint8_t)client;
+  coap_add_token(pdu, sizeof(token), token);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 2, (const uint8_t *)"fw");
+  coap_add_option(pdu, COAP_OPTION_BLOCK2,
+                  coap_encode_var_safe(opt, sizeof(opt),
+                                       (num << 4) | BLOCK_SZX), opt);
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+/* Reads the responses queued on the client sockets, checking the blocks */
+static uint64_t
+drain(const int *fds, unsigned long nfds, uint64_t *bad) {
+  uint64_t count = 0;
+  unsigned long i;
+  uint8_t buf[COAP_RXBUFFER_SIZE];
+  coap_pdu_t *pdu = coap_pdu_init(0, 0, 0, COAP_DEFAULT_MAX_PDU_RX_SIZE);
+  ssize_t len;
+
+  for (i = 0; i < nfds; i++) {
+    while ((len = recv(fds[i], buf, sizeof(buf), 0)) > 0) {
+      coap_block_t block;
+      const uint8_t *data;
+      size_t data_len, j;
+      size_t offset;
+
+      count++;
+      if (!coap_pdu_parse(COAP_PROTO_UDP, buf, (size_t)len, pdu) ||
+          coap_pdu_get_code(pdu) != COAP_RESPONSE_CODE_CONTENT ||
+          !coap_get_block(pdu, COAP_OPTION_BLOCK2, &block) ||
+          !coap_get_data(pdu, &data_len, &data)) {
+        (*bad)++;
+        continue;
+      }
+      offset = (size_t)block.num << (block.szx + 4);
+      for (j = 0; j < data_len; j++) {
+        if (data[j] != pattern(offset + j)) {
+          (*bad)++;
+          break;
+        }
+      }
+    }
+  }
+  coap_delete_pdu(pdu);
+  return count;
+}
+
+static size_t
+heap_in_use(void) {
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 mi = mallinfo2();
+
+  return mi.uordblks + mi.hblkhd;
+#else /* ! HAVE_MALLINFO2 */
+  return 0;
+#endif /* ! HAVE_MALLINFO2 */
+}
+
+static void
+run(coap_method_handler_t handler, const char *name, unsigned long clients,
+    unsigned long blocks) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  int *fds = malloc(clients * sizeof(int));
+  uint64_t start, elapsed, received = 0, bad = 0;
+  size_t heap_before = heap_in_use();
+  size_t heap_started = 0;
+  unsigned long i, b;
+  char label[80];
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep || !fds) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  coap_context_set_block_mode(ctx, COAP_BLOCK_USE_LIBCOAP);
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  r = coap_resource_init(coap_make_str_const("fw"), 0);
+  coap_register_handler(r, COAP_REQUEST_GET, handler);
+  coap_add_resource(ctx, r);
+
+  bench_client_sockets(ep, fds, clients);
+
+  read_bytes = 0;
+  start = bench_now_ns();
+  for (b = 0; b < blocks; b++) {
+    for (i = 0; i < clients; i++) {
+      uint8_t buf[64];
+      size_t len = build_request(buf, sizeof(buf), (uint32_t)i, (uint32_t)b);
+
+      if (send(fds[i], buf, len, 0) < 0) {
+        perror("send");
+        exit(1);
+      }
+      if (i % 64 == 63 || i + 1 == clients) {
+        coap_io_process(ctx, COAP_IO_NO_WAIT);
+        coap_io_process(ctx, COAP_IO_NO_WAIT);
+        received += drain(fds, clients, &bad);
+      }
+    }
+    if (b == 0)
+      heap_started = heap_in_use();
+  }
+  elapsed = bench_now_ns() - start;
+
+  snprintf(label, sizeof(label), "%lu clients, %s", clients, name);
+  bench_report(label, received, elapsed);
+  printf("  heap once started %.1f MB, %.1f MB read from the image, "
+         "%llu of %lu blocks bad or missing\n",
+         (double)(heap_started - heap_before) / (1024 * 1024),
+         (double)read_bytes / (1024 * 1024),
+         (unsigned long long)(bad + clients * blocks - received),
+         clients * blocks);
+
+  for (i = 0; i < clients; i++)
+    close(fds[i]);
+  free(fds);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long clients = bench_arg(argc, argv, 1, 100);
+  unsigned long blocks = bench_arg(argc, argv, 2, 64);
+  unsigned long kbytes = bench_arg(argc, argv, 3, 4096);
+  char path[] = "/tmp/bench_large_bodyXXXXXX";
+  uint8_t buf[BLOCK_SIZE];
+  struct rlimit rl;
+  size_t offset, i;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  image_size = kbytes * 1024;
+  if (blocks > image_size / BLOCK_SIZE)
+    blocks = image_size / BLOCK_SIZE;
+
+  image_fd = mkstemp(path);
+  if (image_fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  unlink(path);
+  for (offset = 0; offset < image_size; offset += sizeof(buf)) {
+    for (i = 0; i < sizeof(buf); i++)
+      buf[i] = pattern(offset + i);
+    if (write(image_fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+      perror("write");
+      return 1;
+    }
+  }
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  printf("%lu KB image, %lu clients, %lu blocks of %d bytes each\n",
+         kbytes, clients, blocks, BLOCK_SIZE);
+
+  run(hnd_get_buffer, "image in memory", clients, blocks);
+  run(hnd_get_cb, "block read on demand", clients, blocks);
+
+  close(image_fd);
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,93 @@
+/* libcoap benchmark for new peer admission on a server endpoint
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Fills a UDP endpoint up to max_idle_sessions, and then reports how many
+ * datagrams from new peers (as in a flood of spoofed source addresses) can
+ * be turned into sessions per second, each one evicting the least recently
+ * active idle session.
+ *
+ * Usage: bench_new_session [max-idle-sessions [new-peers]]
+ */
+
+#include "bench_common.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static void
+make_packet(coap_packet_t *packet, const coap_endpoint_t *ep,
+            unsigned long id) {
+  memset(packet, 0, sizeof(*packet));
+  coap_address_init(&packet->addr_info.remote);
+  packet->addr_info.remote.addr.sin.sin_family = AF_INET;
+  packet->addr_info.remote.addr.sin.sin_addr.s_addr =
+      htonl(0x0a000000 | (uint32_t)(id >> 8));
+  packet->addr_info.remote.addr.sin.sin_port =
+      htons((uint16_t)(40000 + (id & 0xff)));
+  packet->addr_info.remote.size = sizeof(struct sockaddr_in);
+  coap_address_copy(&packet->addr_info.local, &ep->bind_addr);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long max_idle = bench_arg(argc, argv, 1, 10000);
+  unsigned long peers = bench_arg(argc, argv, 2, 100000);
+  coap_context_t *ctx;
+  coap_endpoint_t *ep;
+  coap_address_t addr;
+  coap_packet_t packet;
+  coap_tick_t now;
+  uint64_t start;
+  unsigned long i;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  ctx = coap_new_context(NULL);
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint\n");
+    return 1;
+  }
+  coap_context_set_max_idle_sessions(ctx, (unsigned int)max_idle);
+  printf("max_idle_sessions %lu, %lu new peers\n", max_idle, peers);
+
+  coap_ticks(&now);
+  start = bench_now_ns();
+  for (i = 0; i < max_idle; i++) {
+    make_packet(&packet, ep, i);
+    if (!coap_endpoint_get_session(ep, &packet, now + i)) {
+      fprintf(stderr, "cannot create session\n");
+      return 1;
+    }
+  }
+  bench_report("fill endpoint", max_idle, bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (i = 0; i < peers; i++) {
+    make_packet(&packet, ep, max_idle + i);
+    if (!coap_endpoint_get_session(ep, &packet, now + max_idle + i)) {
+      fprintf(stderr, "cannot create session\n");
+      return 1;
+    }
+  }
+  bench_report("new peer with eviction", peers, bench_now_ns() - start);
+
+  coap_free_context(ctx);
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,193 @@
+/* libcoap benchmark for Observe notification fan-out
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Registers a number of loopback observers on a sensor resource and reports
+ * the time taken from a change of the resource until the notifications for
+ * all the observers have been sent, with the GET handler called for every
+ * observer and with COAP_RESOURCE_FLAGS_NOTIFY_SHARED.  Without arguments,
+ * this is done for 1k and 10k observers.  Larger counts (e.g. 100000) can be
+ * given, but registration takes minutes as every new observer is checked
+ * against all the existing ones.
+ *
+ * Usage: bench_notify [observers [rounds [observers-per-socket]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static uint64_t handled;
+static unsigned int reading;
+
+static void
+hnd_get(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request COAP_UNUSED,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  char payload[96];
+  uint8_t buf[4];
+  int len;
+
+  handled++;
+  len = snprintf(payload, sizeof(payload),
+                 "{\"sensor\":\"temp-1\",\"value\":%u.%u,\"unit\":\"Cel\"}",
+                 reading / 10, reading % 10);
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_option(response, COAP_OPTION_CONTENT_FORMAT,
+                  coap_encode_var_safe(buf, sizeof(buf),
+                                       COAP_MEDIATYPE_APPLICATION_JSON), buf);
+  coap_add_option(response, COAP_OPTION_MAXAGE,
+                  coap_encode_var_safe(buf, sizeof(buf), 30), buf);
+  coap_add_data(response, (size_t)len, (const uint8_t *)payload);
+}
+
+/* Builds a CON GET /sensor?o=id with Observe: 0 and a 4 byte token */
+static size_t
+build_register(uint8_t *buf, size_t len, uint32_t id) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  (coap_mid_t)(id & 0xffff), len);
+  uint8_t token[4];
+  char query[16];
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  token[0] = (uint8_t)(id >> 24);
+  token[1] = (uint8_t)(id >> 16);
+  token[2] = (uint8_t)(id >> 8);
+  token[3] = (uint8_t)id;
+  coap_add_token(pdu, sizeof(token), token);
+  coap_add_option(pdu, COAP_OPTION_OBSERVE, 0, NULL);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 6, (const uint8_t *)"sensor");
+  /* A peer cannot have two observations with the same query */
+  snprintf(query, sizeof(query), "o=%08x", id);
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, strlen(query),
+                  (const uint8_t *)query);
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+static void
+run(int flags, unsigned long observers, unsigned long rounds,
+    unsigned long per_socket) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  unsigned long nfds = (observers + per_socket - 1) / per_socket;
+  int *fds = malloc(nfds * sizeof(int));
+  uint64_t start, elapsed = 0, worst = 0, received = 0;
+  char label[64];
+  unsigned long i;
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep || !fds) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  r = coap_resource_init(coap_make_str_const("sensor"),
+                         COAP_RESOURCE_FLAGS_NOTIFY_NON_ALWAYS | flags);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+  coap_resource_set_get_observable(r, 1);
+  coap_add_resource(ctx, r);
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  coap_context_set_max_send_batch(ctx, COAP_MAX_SEND_BATCH);
+
+  /* Register the observers, processing them in chunks to avoid drops */
+  bench_client_sockets(ep, fds, nfds);
+  for (i = 0; i < observers; i++) {
+    uint8_t buf[64];
+    size_t len = build_register(buf, sizeof(buf), (uint32_t)i);
+
+    if (send(fds[i / per_socket], buf, len, 0) < 0) {
+      perror("send");
+      exit(1);
+    }
+    if (i % 64 == 63 || i + 1 == observers)
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+  }
+  coap_io_process(ctx, COAP_IO_NO_WAIT);
+  bench_drain(fds, nfds);
+
+  handled = 0;
+  for (i = 0; i < rounds; i++) {
+    uint64_t took;
+
+    reading++;
+    start = bench_now_ns();
+    coap_resource_notify_observers(r, NULL);
+    coap_io_process(ctx, COAP_IO_NO_WAIT);
+    took = bench_now_ns() - start;
+    elapsed += took;
+    if (took > worst)
+      worst = took;
+    /* Keep the socket buffers from overflowing, outside of the timing */
+    received += bench_drain(fds, nfds);
+  }
+  snprintf(label, sizeof(label), "%lu observers, %s", observers,
+           flags ? "shared body" : "handler per observer");
+  bench_report(label, received, elapsed);
+  printf("  mean latency %.3f ms, worst %.3f ms, handler calls %llu\n",
+         (double)elapsed / rounds / 1e6, (double)worst / 1e6,
+         (unsigned long long)handled);
+
+  for (i = 0; i < nfds; i++)
+    close(fds[i]);
+  free(fds);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  static const unsigned long sizes[] = { 1000, 10000 };
+  unsigned long observers = bench_arg(argc, argv, 1, 0);
+  unsigned long rounds = bench_arg(argc, argv, 2, 10);
+  unsigned long per_socket = bench_arg(argc, argv, 3, 100);
+  struct rlimit rl;
+  size_t i;
+
+  if (per_socket == 0)
+    per_socket = 1;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    unsigned long count = observers ? observers : sizes[i];
+
+    run(0, count, rounds, per_socket);
+    run(COAP_RESOURCE_FLAGS_NOTIFY_SHARED, count, rounds, per_socket);
+    if (observers)
+      break;
+  }
+
+  coap_cleanup();
+  return 0;
+}
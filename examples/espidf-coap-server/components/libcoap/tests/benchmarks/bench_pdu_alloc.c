@@ -0,0 +1,218 @@
+/* libcoap benchmark for the memory allocation of PDUs
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Reports how many PDUs can be created, built up with options and a
+ * payload, and deleted per second, and how many requests sent over loopback
+ * can be handled per second.  For the requests, the number of
+ * coap_malloc_type() calls made per request, and how many of these had to
+ * call malloc(), are given from coap_memory_get_stats(), along with the
+ * high-water marks of the PDUs and PDU buffers in use.
+ *
+ * Build libcoap with and without ENABLE_MEMORY_POOL to compare the free
+ * lists with every allocation calling malloc().
+ *
+ * Usage: bench_pdu_alloc [requests [pdus]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#define NUM_SOCKETS 16
+
+static const coap_memory_tag_t tags[] = {
+  COAP_STRING, COAP_ATTRIBUTE_NAME, COAP_ATTRIBUTE_VALUE, COAP_PACKET,
+  COAP_NODE, COAP_CONTEXT, COAP_ENDPOINT, COAP_PDU, COAP_PDU_BUF,
+  COAP_RESOURCE, COAP_RESOURCEATTR, COAP_SESSION, COAP_OPTLIST,
+  COAP_CACHE_KEY, COAP_CACHE_ENTRY, COAP_LG_XMIT, COAP_LG_CRCV, COAP_LG_SRCV
+};
+
+static void
+hnd_get(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request COAP_UNUSED,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  uint8_t buf[4];
+
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_option(response, COAP_OPTION_CONTENT_FORMAT,
+                  coap_encode_var_safe(buf, sizeof(buf),
+                                       COAP_MEDIATYPE_TEXT_PLAIN), buf);
+  coap_add_option(response, COAP_OPTION_MAXAGE,
+                  coap_encode_var_safe(buf, sizeof(buf), 30), buf);
+  coap_add_data(response, 4, (const uint8_t *)"21.5");
+}
+
+/*
+ * Builds a CON GET /sensors/temp?unit=C with a 4 byte token, which is at
+ * offset 4 after the message id.
+ */
+static size_t
+build_request(uint8_t *buf, size_t len) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  0, len);
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  coap_add_token(pdu, 4, (const uint8_t *)"tokn");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 7, (const uint8_t *)"sensors");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 4, (const uint8_t *)"temp");
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, 6, (const uint8_t *)"unit=C");
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+/* Sums the allocations made and those that reused memory over all types */
+static void
+total_allocs(uint64_t *allocs, uint64_t *reused) {
+  coap_memory_stats_t stats;
+  size_t i;
+
+  *allocs = 0;
+  *reused = 0;
+  for (i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+    if (coap_memory_get_stats(tags[i], &stats)) {
+      *allocs += stats.allocs;
+      *reused += stats.reused;
+    }
+  }
+}
+
+static void
+run_pdus(unsigned long npdus) {
+  uint8_t payload[600];
+  uint64_t start;
+  unsigned long i;
+
+  memset(payload, 'x', sizeof(payload));
+  start = bench_now_ns();
+  for (i = 0; i < npdus; i++) {
+    coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON,
+                                    COAP_RESPONSE_CODE_CONTENT,
+                                    (coap_mid_t)(i & 0xffff), 1152);
+    uint8_t buf[4];
+
+    if (!pdu) {
+      fprintf(stderr, "cannot create PDU\n");
+      exit(1);
+    }
+    coap_add_token(pdu, 4, (const uint8_t *)"tokn");
+    coap_add_option(pdu, COAP_OPTION_ETAG, 4, (const uint8_t *)"v123");
+    coap_add_option(pdu, COAP_OPTION_CONTENT_FORMAT,
+                    coap_encode_var_safe(buf, sizeof(buf),
+                                         COAP_MEDIATYPE_TEXT_PLAIN), buf);
+    /* Every other one needs the PDU buffer to grow */
+    coap_add_data(pdu, i % 2 ? sizeof(payload) : 64, payload);
+    coap_delete_pdu(pdu);
+  }
+  bench_report("coap_pdu_init() + build + delete", npdus,
+               bench_now_ns() - start);
+}
+
+static void
+run_requests(unsigned long requests) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_memory_stats_t pdu_stats, buf_stats;
+  int fds[NUM_SOCKETS];
+  uint8_t buf[64];
+  size_t len = build_request(buf, sizeof(buf));
+  uint64_t start, elapsed, received = 0;
+  uint64_t allocs_before, reused_before, allocs, reused;
+  unsigned long i;
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep || !len) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  r = coap_resource_init(coap_make_str_const("sensors/temp"), 0);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+  coap_add_resource(ctx, r);
+
+  bench_client_sockets(ep, fds, NUM_SOCKETS);
+
+  total_allocs(&allocs_before, &reused_before);
+  start = bench_now_ns();
+  for (i = 0; i < requests; i++) {
+    /* A new message id and token for each request */
+    buf[2] = (uint8_t)(i >> 8);
+    buf[3] = (uint8_t)i;
+    buf[4] = (uint8_t)(i >> 24);
+    buf[5] = (uint8_t)(i >> 16);
+    buf[6] = (uint8_t)(i >> 8);
+    buf[7] = (uint8_t)i;
+    if (send(fds[i % NUM_SOCKETS], buf, len, 0) < 0) {
+      perror("send");
+      exit(1);
+    }
+    if (i % 64 == 63 || i + 1 == requests) {
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+      /* Send anything held back for a batched send */
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+      received += bench_drain(fds, NUM_SOCKETS);
+    }
+  }
+  elapsed = bench_now_ns() - start;
+  total_allocs(&allocs, &reused);
+  allocs -= allocs_before;
+  reused -= reused_before;
+
+  bench_report("requests handled", received, elapsed);
+  if (requests) {
+    printf("  %.2f allocations per request, %.2f of them by malloc()\n",
+           (double)allocs / requests,
+           (double)(allocs > reused ? allocs - reused : 0) / requests);
+  }
+  coap_memory_get_stats(COAP_PDU, &pdu_stats);
+  coap_memory_get_stats(COAP_PDU_BUF, &buf_stats);
+  printf("  high-water: %lu PDUs, %lu PDU buffers\n",
+         (unsigned long)pdu_stats.high_water,
+         (unsigned long)buf_stats.high_water);
+
+  for (i = 0; i < NUM_SOCKETS; i++)
+    close(fds[i]);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long requests = bench_arg(argc, argv, 1, 200000);
+  unsigned long npdus = bench_arg(argc, argv, 2, 2000000);
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  printf("%lu requests, %lu PDUs\n", requests, npdus);
+
+  run_pdus(npdus);
+  run_requests(requests);
+
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,134 @@
+/* libcoap benchmark for the server session timeout checks
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Creates a number of idle UDP server sessions on an endpoint and reports
+ * how many coap_io_prepare_io() calls can be made per second, both with all
+ * the sessions idle and with a few of them seeing traffic between the
+ * calls.  Finally the clock is moved past the session timeout and the time
+ * taken to expire all the sessions is reported.
+ *
+ * Usage: bench_prepare_io [sessions [calls [active-per-call]]]
+ */
+
+#include "bench_common.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static void
+make_packet(coap_packet_t *packet, const coap_endpoint_t *ep,
+            unsigned long id) {
+  memset(packet, 0, sizeof(*packet));
+  coap_address_init(&packet->addr_info.remote);
+  packet->addr_info.remote.addr.sin.sin_family = AF_INET;
+  packet->addr_info.remote.addr.sin.sin_addr.s_addr =
+      htonl(0x7f000000 | (uint32_t)(id >> 8));
+  packet->addr_info.remote.addr.sin.sin_port =
+      htons((uint16_t)(40000 + (id & 0xff)));
+  packet->addr_info.remote.size = sizeof(struct sockaddr_in);
+  coap_address_copy(&packet->addr_info.local, &ep->bind_addr);
+}
+
+static unsigned long
+count_sessions(const coap_endpoint_t *ep) {
+  coap_session_t *s, *rtmp;
+  unsigned long count = 0;
+
+  SESSIONS_ITER(ep->sessions, s, rtmp) {
+    count++;
+  }
+  return count;
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long nsessions = bench_arg(argc, argv, 1, 20000);
+  unsigned long calls = bench_arg(argc, argv, 2, 10000);
+  unsigned long active = bench_arg(argc, argv, 3, 10);
+  coap_context_t *ctx;
+  coap_endpoint_t *ep;
+  coap_address_t addr;
+  coap_packet_t packet;
+  coap_socket_t *sockets[64];
+  unsigned int num_sockets;
+  coap_tick_t now;
+  uint64_t start;
+  unsigned long i, j, next = 0;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  ctx = coap_new_context(NULL);
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP) : NULL;
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint\n");
+    return 1;
+  }
+  coap_context_set_session_timeout(ctx, 300);
+  printf("%lu idle UDP server sessions, %lu active per call\n",
+         nsessions, active);
+
+  coap_ticks(&now);
+  start = bench_now_ns();
+  for (i = 0; i < nsessions; i++) {
+    make_packet(&packet, ep, i);
+    if (!coap_endpoint_get_session(ep, &packet, now)) {
+      fprintf(stderr, "cannot create session\n");
+      return 1;
+    }
+  }
+  bench_report("create sessions", nsessions, bench_now_ns() - start);
+
+  /* The first call after creation has a look at every session */
+  start = bench_now_ns();
+  coap_io_prepare_io(ctx, sockets, sizeof(sockets) / sizeof(sockets[0]),
+                     &num_sockets, now);
+  bench_report("first coap_io_prepare_io()", 1, bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (i = 0; i < calls; i++) {
+    coap_io_prepare_io(ctx, sockets, sizeof(sockets) / sizeof(sockets[0]),
+                       &num_sockets, now + i);
+  }
+  bench_report("coap_io_prepare_io() all idle", calls, bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (i = 0; i < calls; i++) {
+    /* Traffic on a few sessions, as if a datagram had been received */
+    for (j = 0; j < active; j++) {
+      make_packet(&packet, ep, next);
+      coap_endpoint_get_session(ep, &packet, now + calls + i);
+      next = (next + 1) % nsessions;
+    }
+    coap_io_prepare_io(ctx, sockets, sizeof(sockets) / sizeof(sockets[0]),
+                       &num_sockets, now + calls + i);
+  }
+  bench_report("coap_io_prepare_io() with traffic", calls,
+               bench_now_ns() - start);
+
+  now += 2 * calls + 301 * COAP_TICKS_PER_SECOND;
+  start = bench_now_ns();
+  coap_io_prepare_io(ctx, sockets, sizeof(sockets) / sizeof(sockets[0]),
+                     &num_sockets, now);
+  bench_report("expire all sessions", nsessions, bench_now_ns() - start);
+  if (count_sessions(ep) != 0)
+    fprintf(stderr, "%lu sessions not expired\n", count_sessions(ep));
+
+  coap_free_context(ctx);
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,316 @@
+/* libcoap benchmark for large bodies over a lossy link
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Has a loopback client PUT and then GET a body of 32 KB (unless given)
+ * through a link that holds back every datagram for a delay and loses a
+ * share of them.  This is done with Block1/Block2 and CON requests, which
+ * send one block per round trip and recover a lost block after ACK_TIMEOUT,
+ * and with Q-Block1/Q-Block2 (COAP_BLOCK_TRY_Q_BLOCK) and NON requests, which
+ * send MAX_PAYLOADS blocks per round trip and ask for the lost ones again,
+ * once the probe for Q-Block support has been answered.
+ * ACK_TIMEOUT and NON_TIMEOUT are both set to the given timeout, and
+ * NON_RECEIVE_TIMEOUT to twice that.  Reports the KB moved per second, and
+ * the datagrams sent and lost.  Every byte of the bodies is checked.
+ *
+ * Usage: bench_qblock [kbytes [delay-ms [loss-percent [timeout-ms [repeats]]]]]
+ */
+
+#include "bench_common.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define LINK_MAX_QUEUED 1024
+
+typedef struct link_dgram_t {
+  coap_tick_t due;
+  coap_socket_t *sock;
+  const coap_session_t *session;
+  size_t length;
+  uint8_t data[COAP_RXBUFFER_SIZE];
+} link_dgram_t;
+
+static link_dgram_t link_queue[LINK_MAX_QUEUED];
+static unsigned int link_count;
+static uint64_t link_sent;
+static uint64_t link_dropped;
+static unsigned long link_loss;
+static coap_tick_t link_delay;
+static uint32_t link_rng = 2463534242U;
+
+static uint8_t *body;
+static size_t body_size;
+static int got_response;
+static int body_good;
+
+static ssize_t
+link_send(coap_socket_t *sock, const coap_session_t *session,
+          const uint8_t *data, size_t datalen) {
+  link_dgram_t *d;
+
+  link_sent++;
+  link_rng ^= link_rng << 13;
+  link_rng ^= link_rng >> 17;
+  link_rng ^= link_rng << 5;
+  if (link_rng % 100 < link_loss ||
+      link_count == LINK_MAX_QUEUED || datalen > sizeof(d->data)) {
+    link_dropped++;
+    return (ssize_t)datalen;
+  }
+  d = &link_queue[link_count++];
+  coap_ticks(&d->due);
+  d->due += link_delay;
+  d->sock = sock;
+  d->session = session;
+  d->length = datalen;
+  memcpy(d->data, data, datalen);
+  return (ssize_t)datalen;
+}
+
+/* Sends the datagrams that are due, or drops all of them if flush is set */
+static void
+link_deliver(int flush) {
+  coap_tick_t now;
+  unsigned int i;
+
+  coap_ticks(&now);
+  for (i = 0; i < link_count && (flush || link_queue[i].due <= now); i++) {
+    link_dgram_t *d = &link_queue[i];
+
+    if (!flush)
+      coap_network_send(d->sock, d->session, d->data, d->length);
+  }
+  link_count -= i;
+  memmove(link_queue, &link_queue[i], link_count * sizeof(link_queue[0]));
+}
+
+static void
+tune_session(coap_session_t *session, coap_fixed_point_t timeout) {
+  coap_fixed_point_t receive_timeout;
+  unsigned int ms = timeout.integer_part * 1000 + timeout.fractional_part;
+
+  receive_timeout.integer_part = (uint16_t)(2 * ms / 1000);
+  receive_timeout.fractional_part = (uint16_t)(2 * ms % 1000);
+  coap_session_set_ack_timeout(session, timeout);
+  coap_session_set_non_timeout(session, timeout);
+  coap_session_set_non_receive_timeout(session, receive_timeout);
+}
+
+static int
+check_body(const coap_pdu_t *pdu) {
+  size_t len, offset, total;
+  const uint8_t *data;
+
+  return coap_get_data_large(pdu, &len, &data, &offset, &total) &&
+         offset == 0 && len == body_size && total == len &&
+         memcmp(data, body, len) == 0;
+}
+
+static void
+hnd_put(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  body_good = check_body(request);
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+static void
+hnd_get(coap_resource_t *resource,
+        coap_session_t *session,
+        const coap_pdu_t *request,
+        const coap_string_t *query,
+        coap_pdu_t *response) {
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data_large_response(resource, session, request, response, query,
+                               COAP_MEDIATYPE_APPLICATION_OCTET_STREAM, -1, 0,
+                               body_size, body, NULL, NULL);
+}
+
+static coap_response_t
+response_handler(coap_session_t *session COAP_UNUSED,
+                 const coap_pdu_t *sent COAP_UNUSED,
+                 const coap_pdu_t *received,
+                 const coap_mid_t mid COAP_UNUSED) {
+  got_response = 1;
+  if (coap_pdu_get_code(received) == COAP_RESPONSE_CODE_CONTENT)
+    body_good = check_body(received);
+  else if (coap_pdu_get_code(received) != COAP_RESPONSE_CODE_CHANGED)
+    body_good = 0;
+  return COAP_RESPONSE_OK;
+}
+
+static int
+event_handler(coap_session_t *session COAP_UNUSED, const coap_event_t event) {
+  /* The client has given up on sending a body */
+  if (event == COAP_EVENT_XMIT_BLOCK_FAIL)
+    got_response = 1;
+  return 0;
+}
+
+/* Sends a PUT or GET of /q, and runs both sides until it is answered */
+static int
+transfer(coap_context_t *server, coap_context_t *client, coap_endpoint_t *ep,
+         coap_session_t *session, coap_pdu_code_t code, coap_pdu_type_t type,
+         coap_fixed_point_t timeout) {
+  coap_pdu_t *pdu = coap_new_pdu(type, code, session);
+  uint8_t token[8];
+  size_t len;
+  uint64_t start = bench_now_ns();
+
+  if (!pdu)
+    return 0;
+  coap_session_new_token(session, &len, token);
+  coap_add_token(pdu, len, token);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 1, (const uint8_t *)"q");
+  if (code == COAP_REQUEST_CODE_PUT &&
+      !coap_add_data_large_request(session, pdu, body_size, body, NULL,
+                                   NULL)) {
+    coap_delete_pdu(pdu);
+    return 0;
+  }
+  got_response = 0;
+  body_good = 0;
+  if (coap_send(session, pdu) == COAP_INVALID_MID)
+    return 0;
+  while (!got_response && bench_now_ns() - start < 120 * 1000000000ULL) {
+    coap_session_t *sp, *rtmp;
+
+    link_deliver(0);
+    coap_io_process(server, COAP_IO_NO_WAIT);
+    /* Server sessions only exist once the client has been heard from */
+    SESSIONS_ITER(ep->sessions, sp, rtmp) {
+      tune_session(sp, timeout);
+    }
+    coap_io_process(client, 1);
+  }
+  return got_response && body_good;
+}
+
+static void
+run(int q_block, unsigned long delay, unsigned long loss,
+    coap_fixed_point_t timeout, unsigned long repeats) {
+  coap_context_t *server = coap_new_context(NULL);
+  coap_context_t *client = coap_new_context(NULL);
+  coap_pdu_type_t type = q_block ? COAP_MESSAGE_NON : COAP_MESSAGE_CON;
+  uint8_t mode = COAP_BLOCK_USE_LIBCOAP | COAP_BLOCK_SINGLE_BODY |
+                 (q_block ? COAP_BLOCK_TRY_Q_BLOCK : 0);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *session;
+  uint64_t start, elapsed;
+  unsigned long i, failed = 0;
+  char label[80];
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.size = sizeof(struct sockaddr_in);
+  ep = server && client ? coap_new_endpoint(server, &addr, COAP_PROTO_UDP) :
+                          NULL;
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  r = coap_resource_init(coap_make_str_const("q"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+  coap_add_resource(server, r);
+  coap_context_set_block_mode(server, mode);
+  coap_context_set_block_mode(client, mode);
+  coap_register_response_handler(client, response_handler);
+  coap_register_event_handler(client, event_handler);
+  session = coap_new_client_session(client, NULL, &ep->bind_addr,
+                                    COAP_PROTO_UDP);
+  if (!session) {
+    fprintf(stderr, "cannot create session\n");
+    exit(1);
+  }
+  tune_session(session, timeout);
+  server->network_send = link_send;
+  client->network_send = link_send;
+  link_delay = delay * COAP_TICKS_PER_SECOND / 1000;
+  link_loss = loss;
+  if (q_block) {
+    /* The first request is held back until the Q-Block probe is answered */
+    transfer(server, client, ep, session, COAP_REQUEST_CODE_DELETE,
+             COAP_MESSAGE_CON, timeout);
+  }
+  link_sent = 0;
+  link_dropped = 0;
+
+  start = bench_now_ns();
+  for (i = 0; i < repeats; i++) {
+    if (!transfer(server, client, ep, session, COAP_REQUEST_CODE_PUT, type,
+                  timeout))
+      failed++;
+    if (!transfer(server, client, ep, session, COAP_REQUEST_CODE_GET, type,
+                  timeout))
+      failed++;
+  }
+  elapsed = bench_now_ns() - start;
+
+  snprintf(label, sizeof(label), "KB moved, %s",
+           q_block ? "Q-Block1/Q-Block2 NON" : "Block1/Block2 CON");
+  bench_report(label, (uint64_t)(2 * repeats * body_size / 1024), elapsed);
+  printf("  %.0f datagrams sent, %.0f lost per transfer, "
+         "%lu of %lu transfers failed\n",
+         (double)link_sent / (double)(2 * repeats),
+         (double)link_dropped / (double)(2 * repeats), failed, 2 * repeats);
+
+  link_deliver(1);
+  coap_session_release(session);
+  coap_free_context(client);
+  coap_free_context(server);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long kbytes = bench_arg(argc, argv, 1, 32);
+  unsigned long delay = bench_arg(argc, argv, 2, 20);
+  unsigned long loss = bench_arg(argc, argv, 3, 5);
+  unsigned long timeout_ms = bench_arg(argc, argv, 4, 250);
+  unsigned long repeats = bench_arg(argc, argv, 5, 2);
+  coap_fixed_point_t timeout;
+  size_t i;
+
+  if (loss > 50)
+    loss = 50;
+  if (timeout_ms < 10 || timeout_ms > 30000)
+    timeout_ms = 250;
+  if (kbytes < 1)
+    kbytes = 1;
+  timeout.integer_part = (uint16_t)(timeout_ms / 1000);
+  timeout.fractional_part = (uint16_t)(timeout_ms % 1000);
+  body_size = kbytes * 1024;
+  body = malloc(body_size);
+  if (!body) {
+    fprintf(stderr, "no memory\n");
+    exit(1);
+  }
+  for (i = 0; i < body_size; i++)
+    body[i] = (uint8_t)(i * 7 + (i >> 10));
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  printf("%lu KB bodies, %lu ms each way, %lu%% lost, timeouts %lu ms, "
+         "%lu PUTs and GETs\n",
+         kbytes, delay, loss, timeout_ms, repeats);
+
+  run(0, delay, loss, timeout, repeats);
+  run(1, delay, loss, timeout, repeats);
+
+  free(body);
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,299 @@
+/* libcoap benchmark for tracking the blocks of a large body received
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Replays the receipt of a body of 10000 blocks (unless given) that are sent
+ * in bursts, with the blocks of each burst reordered and some of them lost.
+ * After each burst, the receiver asks for the blocks missing before the
+ * highest it has, which are sent again ahead of any new blocks.  The blocks
+ * are tracked with coap_rblock_add() and, for comparison, with the list of up
+ * to 4 ranges that was used before, which has to discard blocks once there
+ * are more gaps than it can track.  Reports the blocks tracked per second,
+ * the bursts and blocks sent, and the largest bitmap used.
+ *
+ * Usage: bench_rblock [blocks [loss-percent [burst [repeats]]]]
+ */
+
+#include "bench_common.h"
+
+#define LEGACY_RANGES 4
+
+typedef struct legacy_rblock_t {
+  uint32_t used;
+  struct {
+    uint32_t begin;
+    uint32_t end;
+  } range[LEGACY_RANGES];
+} legacy_rblock_t;
+
+typedef struct tracker_t {
+  const char *name;
+  void (*clear)(void *rb);
+  int (*add)(void *rb, uint32_t block_num);
+  uint32_t (*next_missing)(void *rb, uint32_t block_num);
+  uint32_t (*words)(void *rb);
+} tracker_t;
+
+static uint32_t rng_state = 2463534242U;
+
+static uint32_t
+rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+/* The list of ranges as it was in update_received_blocks() */
+static int
+legacy_add(void *arg, uint32_t block_num) {
+  legacy_rblock_t *rb = (legacy_rblock_t *)arg;
+  uint32_t i;
+
+  for (i = 0; i < rb->used; i++) {
+    if (block_num >= rb->range[i].begin && block_num <= rb->range[i].end)
+      break;
+    if (block_num < rb->range[i].begin) {
+      if (block_num + 1 == rb->range[i].begin) {
+        rb->range[i].begin = block_num;
+      }
+      else {
+        if (rb->used == LEGACY_RANGES - 1)
+          return 0;
+        memmove(&rb->range[i + 1], &rb->range[i],
+                (rb->used - i) * sizeof(rb->range[0]));
+        rb->range[i].begin = rb->range[i].end = block_num;
+        rb->used++;
+      }
+      break;
+    }
+    if (block_num == rb->range[i].end + 1) {
+      rb->range[i].end = block_num;
+      if (i + 1 < rb->used && rb->range[i + 1].begin == block_num + 1) {
+        rb->range[i].end = rb->range[i + 1].end;
+        if (i + 2 < rb->used)
+          memmove(&rb->range[i + 1], &rb->range[i + 2],
+                  (rb->used - (i + 2)) * sizeof(rb->range[0]));
+        rb->used--;
+      }
+      break;
+    }
+  }
+  if (i == rb->used) {
+    if (rb->used == LEGACY_RANGES - 1)
+      return 0;
+    rb->range[i].begin = rb->range[i].end = block_num;
+    rb->used++;
+  }
+  return 1;
+}
+
+static uint32_t
+legacy_next_missing(void *arg, uint32_t block_num) {
+  legacy_rblock_t *rb = (legacy_rblock_t *)arg;
+  uint32_t i;
+
+  for (i = 0; i < rb->used; i++) {
+    if (block_num < rb->range[i].begin)
+      break;
+    if (block_num <= rb->range[i].end)
+      block_num = rb->range[i].end + 1;
+  }
+  return block_num;
+}
+
+static void
+legacy_clear(void *arg) {
+  memset(arg, 0, sizeof(legacy_rblock_t));
+}
+
+static uint32_t
+legacy_words(void *arg COAP_UNUSED) {
+  return 0;
+}
+
+static int
+bitmap_add(void *rb, uint32_t block_num) {
+  return coap_rblock_add((coap_rblock_t *)rb, block_num);
+}
+
+static uint32_t
+bitmap_next_missing(void *rb, uint32_t block_num) {
+  return coap_rblock_next_missing((coap_rblock_t *)rb, block_num);
+}
+
+static void
+bitmap_clear(void *rb) {
+  coap_rblock_clear((coap_rblock_t *)rb);
+}
+
+static uint32_t
+bitmap_words(void *rb) {
+  return ((coap_rblock_t *)rb)->size;
+}
+
+typedef struct result_t {
+  uint64_t adds;
+  uint64_t sent;
+  uint64_t discarded;
+  uint64_t bursts;
+  uint32_t words;
+} result_t;
+
+/*
+ * Runs one transfer of blocks, returning 0 if it has not completed within
+ * max_bursts.  After each burst, the receiver asks again for the blocks it
+ * is missing before the highest one it has, which are sent before any new
+ * blocks.  Once all the blocks have been sent, it asks for any it is still
+ * missing.
+ */
+static int
+transfer(const tracker_t *t, void *rb, uint32_t *todo, uint8_t *asked,
+         uint32_t blocks, unsigned long loss, unsigned long burst,
+         uint64_t max_bursts, result_t *res) {
+  uint32_t head = 0, tail = 0;
+  uint32_t next = 0;
+  uint32_t highest = 0;
+  uint32_t send[256];
+  uint32_t n, j, b;
+  uint64_t bursts = 0;
+
+  t->clear(rb);
+  memset(asked, 0, blocks);
+  for (;;) {
+    /* Ask for what is missing */
+    for (b = t->next_missing(rb, 0); b < highest;
+         b = t->next_missing(rb, b + 1)) {
+      if (!asked[b]) {
+        asked[b] = 1;
+        todo[tail++ % blocks] = b;
+      }
+    }
+    if (head == tail && next == blocks) {
+      if (highest == blocks)
+        break;
+      highest = blocks;
+      continue;
+    }
+    if (bursts++ == max_bursts) {
+      res->bursts += bursts;
+      return 0;
+    }
+    for (n = 0; n < burst && n < sizeof(send) / sizeof(send[0]); n++) {
+      if (head != tail) {
+        send[n] = todo[head++ % blocks];
+        asked[send[n]] = 0;
+      }
+      else if (next < blocks) {
+        send[n] = next++;
+      }
+      else {
+        break;
+      }
+    }
+    /* The network reorders each burst */
+    for (j = n; j > 1; j--) {
+      uint32_t k = rng() % j;
+      uint32_t tmp = send[j - 1];
+
+      send[j - 1] = send[k];
+      send[k] = tmp;
+    }
+    for (j = 0; j < n; j++) {
+      res->sent++;
+      if (rng() % 100 < loss)
+        continue;
+      res->adds++;
+      if (!t->add(rb, send[j]))
+        res->discarded++;
+      else if (send[j] >= highest)
+        highest = send[j] + 1;
+    }
+    if (t->words(rb) > res->words)
+      res->words = t->words(rb);
+  }
+  res->bursts += bursts;
+  return 1;
+}
+
+static void
+run(const tracker_t *t, void *rb, uint32_t blocks, unsigned long loss,
+    unsigned long burst, unsigned long repeats) {
+  uint32_t *todo = malloc(blocks * sizeof(uint32_t));
+  uint8_t *asked = malloc(blocks);
+  result_t res;
+  uint64_t start, elapsed;
+  unsigned long r;
+  unsigned long failed = 0;
+  char label[80];
+
+  if (!todo || !asked) {
+    fprintf(stderr, "no memory\n");
+    exit(1);
+  }
+  memset(&res, 0, sizeof(res));
+  rng_state = 2463534242U;
+  start = bench_now_ns();
+  for (r = 0; r < repeats; r++) {
+    if (!transfer(t, rb, todo, asked, blocks, loss, burst,
+                  (uint64_t)blocks * 10, &res))
+      failed++;
+  }
+  elapsed = bench_now_ns() - start;
+  t->clear(rb);
+
+  snprintf(label, sizeof(label), "blocks tracked, %s", t->name);
+  bench_report(label, res.adds, elapsed);
+  printf("  %.0f bursts, %.0f blocks sent, %.0f discarded per transfer, "
+         "%lu not completed, largest bitmap %u bytes\n",
+         (double)res.bursts / (double)repeats,
+         (double)res.sent / (double)repeats,
+         (double)res.discarded / (double)repeats, failed,
+         (unsigned int)(res.words * sizeof(uint32_t)));
+  free(todo);
+  free(asked);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long blocks = bench_arg(argc, argv, 1, 10000);
+  unsigned long loss = bench_arg(argc, argv, 2, 5);
+  unsigned long burst = bench_arg(argc, argv, 3, 64);
+  unsigned long repeats = bench_arg(argc, argv, 4, 20);
+  static const tracker_t bitmap = {
+    "bitmap", bitmap_clear, bitmap_add, bitmap_next_missing,
+    bitmap_words
+  };
+  static const tracker_t legacy = {
+    "4 ranges", legacy_clear, legacy_add, legacy_next_missing,
+    legacy_words
+  };
+  coap_rblock_t rblock;
+  legacy_rblock_t lblock;
+
+  if (burst < 1 || burst > 256)
+    burst = 64;
+  if (loss > 99)
+    loss = 99;
+  memset(&rblock, 0, sizeof(rblock));
+  memset(&lblock, 0, sizeof(lblock));
+  coap_startup();
+  printf("%lu blocks, %lu%% lost, bursts of %lu reordered, %lu transfers\n",
+         blocks, loss, burst, repeats);
+
+  run(&bitmap, &rblock, (uint32_t)blocks, loss, burst, repeats);
+  run(&legacy, &lblock, (uint32_t)blocks, loss, burst, repeats);
+
+  printf("In order, nothing lost\n");
+  run(&bitmap, &rblock, (uint32_t)blocks, 0, 1, repeats);
+
+  coap_cleanup();
+  return 0;
+}
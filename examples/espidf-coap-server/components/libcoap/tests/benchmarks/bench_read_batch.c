@@ -0,0 +1,140 @@
+/* libcoap benchmark for batched endpoint reads
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Sends bursts of small NON requests over loopback to a server endpoint and
+ * reports the number of requests handled per second with one datagram per
+ * read and with coap_context_set_max_read_batch().
+ *
+ * Usage: bench_read_batch [requests [burst [batch]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static uint64_t handled;
+
+static void
+hnd_get(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request COAP_UNUSED,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  handled++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+}
+
+/* Builds a NON GET /s with No-Response: 2.xx so that no response is sent */
+static size_t
+build_request(uint8_t *buf, size_t len, coap_mid_t mid) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_NON, COAP_REQUEST_CODE_GET,
+                                  mid, len);
+  uint8_t nr = 2;
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 1, (const uint8_t *)"s");
+  coap_add_option(pdu, COAP_OPTION_NORESPONSE, 1, &nr);
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+static void
+run(const char *label, unsigned int batch, unsigned long requests,
+    unsigned long burst) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  uint64_t hist[COAP_READ_BATCH_HIST_BUCKETS];
+  uint64_t start;
+  unsigned long sent = 0;
+  int fd;
+  unsigned int i;
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP);
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  r = coap_resource_init(coap_make_str_const("s"), 0);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+  coap_add_resource(ctx, r);
+  coap_context_set_max_read_batch(ctx, batch);
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0 ||
+      connect(fd, &ep->bind_addr.addr.sa, ep->bind_addr.size) < 0) {
+    perror("client socket");
+    exit(1);
+  }
+
+  handled = 0;
+  start = bench_now_ns();
+  while (sent < requests) {
+    uint8_t buf[64];
+    unsigned long n;
+
+    for (n = 0; n < burst && sent < requests; n++, sent++) {
+      size_t len = build_request(buf, sizeof(buf), (coap_mid_t)(sent & 0xffff));
+      if (send(fd, buf, len, 0) < 0)
+        break;
+    }
+    /* Drain what has been sent, giving up if datagrams were dropped */
+    while (handled < sent) {
+      uint64_t before = handled;
+
+      coap_io_process(ctx, 10);
+      if (handled == before)
+        break;
+    }
+  }
+  bench_report(label, handled, bench_now_ns() - start);
+
+  coap_context_get_read_batch_histogram(ctx, hist);
+  printf("  datagrams per read:");
+  for (i = 0; i < COAP_READ_BATCH_HIST_BUCKETS; i++)
+    printf(" %u+:%llu", 1U << i, (unsigned long long)hist[i]);
+  printf("\n");
+
+  close(fd);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long requests = bench_arg(argc, argv, 1, 200000);
+  unsigned long burst = bench_arg(argc, argv, 2, 128);
+  unsigned int batch = (unsigned int)bench_arg(argc, argv, 3, 32);
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+
+  run("unbatched (1 datagram per read)", 1, requests, burst);
+  run("batched (recvmmsg)", batch, requests, burst);
+
+  coap_cleanup();
+  return 0;
+}
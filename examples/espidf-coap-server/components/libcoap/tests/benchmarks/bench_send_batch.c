@@ -0,0 +1,169 @@
+/* libcoap benchmark for batched datagram sends
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Registers a number of loopback observers on a single resource and reports
+ * the NON notifications sent per second with one sendmsg() per datagram and
+ * with coap_context_set_max_send_batch().  With more than one observer per
+ * client socket, the notifications to the same peer can also be coalesced
+ * using UDP GSO where the kernel supports it.
+ *
+ * Usage: bench_send_batch [observers [rounds [observers-per-socket [batch]]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static uint64_t notified;
+
+static void
+hnd_get(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request COAP_UNUSED,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  static const uint8_t payload[] = "21.5 C";
+
+  notified++;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data(response, sizeof(payload) - 1, payload);
+}
+
+/* Builds a CON GET /obs?o=id with Observe: 0 and a 4 byte token */
+static size_t
+build_register(uint8_t *buf, size_t len, uint32_t id) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  (coap_mid_t)(id & 0xffff), len);
+  uint8_t token[4];
+  char query[16];
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  token[0] = (uint8_t)(id >> 24);
+  token[1] = (uint8_t)(id >> 16);
+  token[2] = (uint8_t)(id >> 8);
+  token[3] = (uint8_t)id;
+  coap_add_token(pdu, sizeof(token), token);
+  coap_add_option(pdu, COAP_OPTION_OBSERVE, 0, NULL);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 3, (const uint8_t *)"obs");
+  /* A peer cannot have two observations with the same query */
+  snprintf(query, sizeof(query), "o=%08x", id);
+  coap_add_option(pdu, COAP_OPTION_URI_QUERY, strlen(query),
+                  (const uint8_t *)query);
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+static void
+run(const char *label, unsigned int batch, unsigned long observers,
+    unsigned long rounds, unsigned long per_socket) {
+  coap_context_t *ctx = coap_new_context(NULL);
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  unsigned long nfds = (observers + per_socket - 1) / per_socket;
+  int *fds = malloc(nfds * sizeof(int));
+  uint64_t start, elapsed = 0, sent = 0, received = 0;
+  unsigned long i;
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = 0;
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP);
+  if (!ep || !fds) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  r = coap_resource_init(coap_make_str_const("obs"),
+                         COAP_RESOURCE_FLAGS_NOTIFY_NON_ALWAYS);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+  coap_resource_set_get_observable(r, 1);
+  coap_add_resource(ctx, r);
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  coap_context_set_max_send_batch(ctx, batch);
+
+  /* Register the observers, processing them in chunks to avoid drops */
+  bench_client_sockets(ep, fds, nfds);
+  for (i = 0; i < observers; i++) {
+    uint8_t buf[64];
+    size_t len = build_register(buf, sizeof(buf), (uint32_t)i);
+
+    if (send(fds[i / per_socket], buf, len, 0) < 0) {
+      perror("send");
+      exit(1);
+    }
+    if (i % 64 == 63 || i + 1 == observers)
+      coap_io_process(ctx, COAP_IO_NO_WAIT);
+  }
+  coap_io_process(ctx, COAP_IO_NO_WAIT);
+  bench_drain(fds, nfds);
+
+  notified = 0;
+  for (i = 0; i < rounds; i++) {
+    uint64_t before = notified;
+
+    coap_resource_notify_observers(r, NULL);
+    start = bench_now_ns();
+    coap_io_process(ctx, COAP_IO_NO_WAIT);
+    elapsed += bench_now_ns() - start;
+    sent += notified - before;
+    /* Keep the socket buffers from overflowing, outside of the timing */
+    received += bench_drain(fds, nfds);
+  }
+  bench_report(label, sent, elapsed);
+  printf("  notifications received: %llu\n", (unsigned long long)received);
+
+  for (i = 0; i < nfds; i++)
+    close(fds[i]);
+  free(fds);
+  coap_free_context(ctx);
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long observers = bench_arg(argc, argv, 1, 10000);
+  unsigned long rounds = bench_arg(argc, argv, 2, 20);
+  unsigned long per_socket = bench_arg(argc, argv, 3, 1);
+  unsigned int batch = (unsigned int)bench_arg(argc, argv, 4,
+                                               COAP_MAX_SEND_BATCH);
+  struct rlimit rl;
+
+  if (per_socket == 0)
+    per_socket = 1;
+  /* One client socket per observer needs a lot of file descriptors */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+
+  printf("%lu observers, %lu per client socket, %lu rounds\n",
+         observers, per_socket, rounds);
+  run("unbatched (1 sendmsg per datagram)", 1, observers, rounds, per_socket);
+  run("batched (sendmmsg/GSO)", batch, observers, rounds, per_socket);
+
+  coap_cleanup();
+  return 0;
+}
@@ -0,0 +1,152 @@
+/* libcoap benchmark for the retransmission queue
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Inserts a number of retransmission timers into the context sendqueue,
+ * spread over a number of sessions, and then cancels them all in a random
+ * order as if their ACKs had arrived.  The timers are then inserted again
+ * and popped in the order they expire.
+ *
+ * Usage: bench_sendqueue [timers [sessions]]
+ */
+
+#include "bench_common.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static uint32_t seed = 12345;
+
+static uint32_t
+bench_rand(void) {
+  /* xorshift32 */
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void
+insert_all(coap_context_t *ctx, coap_queue_t **nodes, unsigned long count) {
+  unsigned long i;
+
+  for (i = 0; i < count; i++) {
+    /* Sent 100 per tick, with a randomized ACK_TIMEOUT of 2-3 secs */
+    nodes[i]->t = i / 100 + 2000 + bench_rand() % 1000;
+    coap_insert_node(&ctx->sendqueue, nodes[i]);
+  }
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long count = bench_arg(argc, argv, 1, 1000000);
+  unsigned long nsessions = bench_arg(argc, argv, 2, 64);
+  coap_context_t *ctx;
+  coap_session_t **sessions;
+  coap_queue_t **nodes;
+  unsigned long *order;
+  coap_queue_t *node;
+  coap_address_t addr;
+  coap_tick_t last = 0;
+  uint64_t start;
+  unsigned long i, n;
+
+  if (nsessions == 0)
+    nsessions = 1;
+  if (count / nsessions > 0xffff) {
+    fprintf(stderr, "need at least %lu sessions for unique message ids\n",
+            count / 0xffff + 1);
+    return 1;
+  }
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  ctx = coap_new_context(NULL);
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = htons(COAP_DEFAULT_PORT);
+  addr.size = sizeof(struct sockaddr_in);
+
+  sessions = malloc(nsessions * sizeof(sessions[0]));
+  nodes = malloc(count * sizeof(nodes[0]));
+  order = malloc(count * sizeof(order[0]));
+  if (!ctx || !sessions || !nodes || !order) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for (i = 0; i < nsessions; i++) {
+    sessions[i] = coap_new_client_session(ctx, NULL, &addr, COAP_PROTO_UDP);
+    if (!sessions[i]) {
+      fprintf(stderr, "cannot create session\n");
+      return 1;
+    }
+  }
+  for (i = 0; i < count; i++) {
+    nodes[i] = coap_new_node();
+    if (!nodes[i]) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    nodes[i]->session = coap_session_reference(sessions[i % nsessions]);
+    nodes[i]->id = (coap_mid_t)(i / nsessions);
+    order[i] = i;
+  }
+  /* Shuffle the order in which the timers are cancelled */
+  for (i = count; i > 1; i--) {
+    unsigned long j = bench_rand() % i;
+    unsigned long tmp = order[i - 1];
+
+    order[i - 1] = order[j];
+    order[j] = tmp;
+  }
+
+  printf("%lu timers over %lu sessions\n", count, nsessions);
+
+  start = bench_now_ns();
+  insert_all(ctx, nodes, count);
+  bench_report("insert", count, bench_now_ns() - start);
+
+  n = 0;
+  start = bench_now_ns();
+  for (i = 0; i < count; i++) {
+    coap_queue_t *removed;
+
+    if (coap_remove_from_queue(&ctx->sendqueue, nodes[order[i]]->session,
+                               nodes[order[i]]->id, &removed))
+      n++;
+  }
+  bench_report("cancel (random order)", n, bench_now_ns() - start);
+  if (n != count || ctx->sendqueue)
+    fprintf(stderr, "cancel failed: %lu of %lu removed\n", n, count);
+
+  insert_all(ctx, nodes, count);
+  n = 0;
+  start = bench_now_ns();
+  while ((node = coap_pop_next(ctx)) != NULL) {
+    if (node->t < last)
+      fprintf(stderr, "out of order\n");
+    last = node->t;
+    n++;
+  }
+  bench_report("expire (pop in order)", n, bench_now_ns() - start);
+
+  for (i = 0; i < count; i++)
+    coap_delete_node(nodes[i]);
+  for (i = 0; i < nsessions; i++)
+    coap_session_release(sessions[i]);
+  free(order);
+  free(nodes);
+  free(sessions);
+  coap_free_context(ctx);
+  coap_cleanup();
+  return 0;
+}
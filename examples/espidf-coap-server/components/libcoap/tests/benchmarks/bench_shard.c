@@ -0,0 +1,301 @@
+/* libcoap benchmark for sharded multi-threaded servers
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Runs a UDP server as a group of 1, 2, 4, 8 and 16 shards bound to the same
+ * loopback port with SO_REUSEPORT, and reports the CON GET requests answered
+ * per second by each.  The load comes from client threads that each keep a
+ * window of requests outstanding on each of their sockets, so that there are
+ * many peers for the kernel to spread over the shards.  The handler can be
+ * given some work to do per request, to show the scaling of a server that
+ * is limited by its handlers rather than by the kernel.
+ *
+ * The scaling is bounded by the number of CPUs, which are shared by the
+ * client threads and the shards.
+ *
+ * After each run, a number of sockets register as observers of the resource,
+ * so that they are spread over the shards, and coap_shard_group_notify() is
+ * checked to reach all of them.
+ *
+ * Usage: bench_shard [seconds [max-shards [client-threads [handler-work]]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define SOCKETS_PER_CLIENT 16
+#define WINDOW 4
+#define MAX_CLIENTS 64
+#define OBSERVERS 16
+
+static unsigned long handler_work;
+
+typedef struct setup_t {
+  uint16_t port;            /* port bound by the first shard */
+} setup_t;
+
+typedef struct client_t {
+  pthread_t thread;
+  uint16_t port;
+  int *stop;
+  uint64_t sent;
+  uint64_t answered;
+} client_t;
+
+static void
+hnd_get(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request COAP_UNUSED,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  volatile uint32_t x = 2166136261u;
+  unsigned long i;
+
+  for (i = 0; i < handler_work; i++)
+    x = (x ^ (uint32_t)i) * 16777619u;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data(response, 2, (const uint8_t *)"ok");
+}
+
+static void
+setup_shard(coap_context_t *ctx, unsigned int shard, void *arg) {
+  setup_t *setup = (setup_t *)arg;
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.addr.sin.sin_port = htons(setup->port);
+  addr.size = sizeof(struct sockaddr_in);
+
+  ep = coap_new_endpoint(ctx, &addr, COAP_PROTO_UDP);
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint for shard %u\n", shard);
+    exit(1);
+  }
+  if (shard == 0)
+    setup->port = ntohs(ep->bind_addr.addr.sin.sin_port);
+  coap_context_set_max_read_batch(ctx, COAP_MAX_READ_BATCH);
+  r = coap_resource_init(coap_make_str_const("work"), 0);
+  coap_resource_set_get_observable(r, 1);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get);
+  coap_add_resource(ctx, r);
+}
+
+/* Builds a CON GET /work with a 4 byte token, to observe it if asked */
+static size_t
+build_request(uint8_t *buf, size_t len, int observe) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                  0, len);
+  size_t size = 0;
+
+  if (!pdu)
+    return 0;
+  coap_add_token(pdu, 4, (const uint8_t *)"tokn");
+  if (observe)
+    coap_add_option(pdu, COAP_OPTION_OBSERVE, 0, NULL);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 4, (const uint8_t *)"work");
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_UDP)) {
+    size = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, size);
+  }
+  coap_delete_pdu(pdu);
+  return size;
+}
+
+static void *
+run_client(void *arg) {
+  client_t *client = (client_t *)arg;
+  struct sockaddr_in sin;
+  struct timeval tv = { 0, 10000 };
+  int fds[SOCKETS_PER_CLIENT];
+  uint8_t buf[64];
+  uint8_t rbuf[COAP_RXBUFFER_SIZE];
+  size_t len = build_request(buf, sizeof(buf), 0);
+  uint16_t mid = 0;
+  unsigned int i, j;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port = htons(client->port);
+  for (i = 0; i < SOCKETS_PER_CLIENT; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[i] < 0 ||
+        connect(fds[i], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+      perror("client socket");
+      exit(1);
+    }
+    setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+
+  while (!__atomic_load_n(client->stop, __ATOMIC_RELAXED)) {
+    for (i = 0; i < SOCKETS_PER_CLIENT; i++) {
+      for (j = 0; j < WINDOW; j++) {
+        mid++;
+        buf[2] = (uint8_t)(mid >> 8);
+        buf[3] = (uint8_t)mid;
+        buf[7] = (uint8_t)mid;
+        if (send(fds[i], buf, len, 0) > 0)
+          client->sent++;
+      }
+    }
+    for (i = 0; i < SOCKETS_PER_CLIENT; i++) {
+      for (j = 0; j < WINDOW; j++) {
+        if (recv(fds[i], rbuf, sizeof(rbuf), 0) <= 0)
+          break;
+        /* Only count the responses received in the timed period */
+        if (!__atomic_load_n(client->stop, __ATOMIC_RELAXED))
+          client->answered++;
+      }
+    }
+  }
+
+  for (i = 0; i < SOCKETS_PER_CLIENT; i++)
+    close(fds[i]);
+  return NULL;
+}
+
+/*
+ * Registers OBSERVERS sockets as observers, then has the group notify them.
+ * Returns the number of observers that got the notification.
+ */
+static unsigned int
+check_notify(coap_shard_group_t *group, uint16_t port) {
+  struct sockaddr_in sin;
+  struct timeval tv = { 1, 0 };
+  int fds[OBSERVERS];
+  uint8_t buf[64];
+  uint8_t rbuf[COAP_RXBUFFER_SIZE];
+  size_t len = build_request(buf, sizeof(buf), 1);
+  unsigned int i, registered = 0, notified = 0;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port = htons(port);
+  for (i = 0; i < OBSERVERS; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[i] < 0 ||
+        connect(fds[i], (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+      perror("observer socket");
+      exit(1);
+    }
+    setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    buf[3] = (uint8_t)i;
+    if (send(fds[i], buf, len, 0) > 0 &&
+        recv(fds[i], rbuf, sizeof(rbuf), 0) > 4 &&
+        rbuf[1] == COAP_RESPONSE_CODE_CONTENT)
+      registered++;
+  }
+
+  if (registered == OBSERVERS &&
+      coap_shard_group_notify(group, coap_make_str_const("work"))) {
+    for (i = 0; i < OBSERVERS; i++) {
+      ssize_t r = recv(fds[i], rbuf, sizeof(rbuf), 0);
+
+      if (r > 8 && rbuf[1] == COAP_RESPONSE_CODE_CONTENT &&
+          memcmp(rbuf + 4, "tokn", 4) == 0)
+        notified++;
+    }
+  }
+  for (i = 0; i < OBSERVERS; i++)
+    close(fds[i]);
+  return notified;
+}
+
+static double
+run(unsigned int shards, unsigned long seconds, unsigned int clients) {
+  setup_t setup = { 0 };
+  coap_shard_group_t *group;
+  client_t client[MAX_CLIENTS];
+  int stop = 0;
+  uint64_t start, elapsed, sent = 0, answered = 0;
+  unsigned int i, notified;
+  char label[80];
+
+  group = coap_new_shard_group(shards, setup_shard, &setup);
+  if (!group || !coap_shard_group_start(group)) {
+    fprintf(stderr, "cannot start %u shards\n", shards);
+    exit(1);
+  }
+
+  memset(client, 0, sizeof(client));
+  start = bench_now_ns();
+  for (i = 0; i < clients; i++) {
+    client[i].port = setup.port;
+    client[i].stop = &stop;
+    if (pthread_create(&client[i].thread, NULL, run_client, &client[i]) != 0) {
+      fprintf(stderr, "cannot start client thread\n");
+      exit(1);
+    }
+  }
+  sleep((unsigned int)seconds);
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  elapsed = bench_now_ns() - start;
+  for (i = 0; i < clients; i++) {
+    pthread_join(client[i].thread, NULL);
+    sent += client[i].sent;
+    answered += client[i].answered;
+  }
+  notified = check_notify(group, setup.port);
+  coap_free_shard_group(group);
+
+  snprintf(label, sizeof(label), "requests answered, %2u shard%s", shards,
+           shards == 1 ? "" : "s");
+  bench_report(label, answered, elapsed);
+  printf("  %llu requests sent, %u of %u observers notified\n",
+         (unsigned long long)sent, notified, OBSERVERS);
+  return (double)answered * 1e9 / (double)elapsed;
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long seconds = bench_arg(argc, argv, 1, 2);
+  unsigned long max_shards = bench_arg(argc, argv, 2, 16);
+  unsigned long clients = bench_arg(argc, argv, 3, 8);
+  double base = 0;
+  unsigned int shards;
+
+  handler_work = bench_arg(argc, argv, 4, 0);
+  if (clients < 1 || clients > MAX_CLIENTS)
+    clients = 8;
+  if (max_shards > COAP_MAX_SHARDS)
+    max_shards = COAP_MAX_SHARDS;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  if (!coap_shard_is_supported()) {
+    printf("sharded servers are not supported\n");
+    coap_cleanup();
+    return 0;
+  }
+  printf("%lu s per run, %lu client threads with %u sockets each, "
+         "handler work %lu, %ld CPUs\n", seconds, clients, SOCKETS_PER_CLIENT,
+         handler_work, sysconf(_SC_NPROCESSORS_ONLN));
+
+  for (shards = 1; shards <= max_shards; shards *= 2) {
+    double rate = run(shards, seconds, (unsigned int)clients);
+
+    if (shards == 1)
+      base = rate;
+    printf("  %.2fx the rate of 1 shard\n", base > 0 ? rate / base : 0.0);
+  }
+
+  coap_cleanup();
+  return 0;
+}
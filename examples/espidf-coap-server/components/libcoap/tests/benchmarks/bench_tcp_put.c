@@ -0,0 +1,250 @@
+/* libcoap benchmark for large PUTs over TCP
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+/*
+ * Runs a TCP server on a loopback port, and reports the PUT requests of
+ * 64 KB (unless given) handled per second and the payload throughput.  The
+ * requests come from a client thread that keeps a window of them in flight
+ * on one connection, so that the server reads both PDUs that are spread over
+ * many reads and several PDUs in one read.  The COAP_PDU_BUF allocations
+ * made by the server per request are reported as well.
+ *
+ * Usage: bench_tcp_put [seconds [kbytes [window]]]
+ */
+
+#include "bench_common.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_WINDOW 64
+
+typedef struct client_t {
+  pthread_t thread;
+  uint16_t port;
+  uint8_t *request;
+  size_t request_len;
+  unsigned int window;
+  int stop;
+  int done;
+  uint64_t answered;
+} client_t;
+
+static uint64_t put_bytes;
+
+static void
+hnd_put(coap_resource_t *resource COAP_UNUSED,
+        coap_session_t *session COAP_UNUSED,
+        const coap_pdu_t *request,
+        const coap_string_t *query COAP_UNUSED,
+        coap_pdu_t *response) {
+  size_t len;
+  const uint8_t *data;
+
+  if (coap_get_data(request, &len, &data))
+    put_bytes += len;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+/* Builds a PUT /put with a 4 byte token and len bytes of payload */
+static uint8_t *
+build_request(size_t len, size_t *size) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT,
+                                  0, len + 16);
+  uint8_t *buf = NULL;
+  uint8_t *data;
+
+  *size = 0;
+  if (!pdu)
+    return NULL;
+  coap_add_token(pdu, 4, (const uint8_t *)"tokn");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 3, (const uint8_t *)"put");
+  data = coap_add_data_after(pdu, len);
+  if (data && coap_pdu_encode_header(pdu, COAP_PROTO_TCP)) {
+    memset(data, 0xa5, len);
+    *size = pdu->used_size + pdu->hdr_size;
+    buf = malloc(*size);
+    if (buf)
+      memcpy(buf, pdu->token - pdu->hdr_size, *size);
+  }
+  coap_delete_pdu(pdu);
+  return buf;
+}
+
+/* Reads from fd until count responses have been framed */
+static int
+read_responses(int fd, unsigned int count) {
+  static uint8_t rbuf[4096];
+  static size_t have;
+
+  while (count) {
+    size_t hdr_size;
+    size_t size;
+    ssize_t n;
+
+    if (have) {
+      hdr_size = coap_pdu_parse_header_size(COAP_PROTO_TCP, rbuf);
+      if (have >= hdr_size) {
+        size = hdr_size + coap_pdu_parse_size(COAP_PROTO_TCP, rbuf, hdr_size);
+        if (have >= size) {
+          /* Skip the server's CSM */
+          if (rbuf[hdr_size - 1] != COAP_SIGNALING_CODE_CSM)
+            count--;
+          memmove(rbuf, rbuf + size, have - size);
+          have -= size;
+          continue;
+        }
+      }
+    }
+#ifdef TCP_QUICKACK
+    {
+      /*
+       * ACK the responses at once, as the server's Nagle algorithm holds
+       * back each response after the first until the previous is ACKed
+       */
+      int on = 1;
+
+      setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    }
+#endif /* TCP_QUICKACK */
+    n = recv(fd, rbuf + have, sizeof(rbuf) - have, 0);
+    if (n <= 0)
+      return 0;
+    have += (size_t)n;
+  }
+  return 1;
+}
+
+static void *
+run_client(void *arg) {
+  client_t *client = (client_t *)arg;
+  struct sockaddr_in sin;
+  static const uint8_t csm[] = { 0x00, COAP_SIGNALING_CODE_CSM };
+  unsigned int i;
+  int on = 1;
+  int fd;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port = htons(client->port);
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+    perror("client socket");
+    exit(1);
+  }
+  /* Do not hold back the tail of each request for the previous one's ACK */
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (send(fd, csm, sizeof(csm), 0) != sizeof(csm))
+    goto done;
+
+  while (!__atomic_load_n(&client->stop, __ATOMIC_RELAXED)) {
+    for (i = 0; i < client->window; i++) {
+      if (send(fd, client->request, client->request_len, 0) !=
+          (ssize_t)client->request_len)
+        goto done;
+    }
+    if (!read_responses(fd, client->window))
+      goto done;
+    /* Only count the responses received in the timed period */
+    if (!__atomic_load_n(&client->stop, __ATOMIC_RELAXED))
+      client->answered += client->window;
+  }
+
+done:
+  close(fd);
+  __atomic_store_n(&client->done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+int
+main(int argc, char **argv) {
+  unsigned long seconds = bench_arg(argc, argv, 1, 2);
+  unsigned long kbytes = bench_arg(argc, argv, 2, 64);
+  unsigned long window = bench_arg(argc, argv, 3, 4);
+  coap_context_t *ctx;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_address_t addr;
+  coap_memory_stats_t before, after;
+  client_t client;
+  uint64_t start, elapsed;
+  char label[80];
+
+  if (window < 1 || window > MAX_WINDOW)
+    window = 4;
+
+  coap_startup();
+  coap_set_log_level(LOG_ERR);
+  if (!coap_tcp_is_supported()) {
+    printf("TCP is not supported\n");
+    coap_cleanup();
+    return 0;
+  }
+
+  ctx = coap_new_context(NULL);
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.size = sizeof(struct sockaddr_in);
+  ep = ctx ? coap_new_endpoint(ctx, &addr, COAP_PROTO_TCP) : NULL;
+  if (!ep) {
+    fprintf(stderr, "cannot create endpoint\n");
+    exit(1);
+  }
+  r = coap_resource_init(coap_make_str_const("put"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put);
+  coap_add_resource(ctx, r);
+
+  memset(&client, 0, sizeof(client));
+  client.port = ntohs(ep->bind_addr.addr.sin.sin_port);
+  client.window = (unsigned int)window;
+  client.request = build_request(kbytes * 1024, &client.request_len);
+  if (!client.request) {
+    fprintf(stderr, "cannot build request\n");
+    exit(1);
+  }
+  printf("%lu s, %lu KB PUTs, window %lu, COAP_RXBUFFER_SIZE %d\n",
+         seconds, kbytes, window, COAP_RXBUFFER_SIZE);
+
+  coap_memory_get_stats(COAP_PDU_BUF, &before);
+  start = bench_now_ns();
+  if (pthread_create(&client.thread, NULL, run_client, &client) != 0) {
+    fprintf(stderr, "cannot start client thread\n");
+    exit(1);
+  }
+  while (bench_now_ns() - start < seconds * 1000000000ULL)
+    coap_io_process(ctx, 100);
+  __atomic_store_n(&client.stop, 1, __ATOMIC_RELAXED);
+  elapsed = bench_now_ns() - start;
+  /* Let the client finish its window */
+  while (!__atomic_load_n(&client.done, __ATOMIC_ACQUIRE))
+    coap_io_process(ctx, 10);
+  pthread_join(client.thread, NULL);
+  coap_memory_get_stats(COAP_PDU_BUF, &after);
+
+  snprintf(label, sizeof(label), "%lu KB PUTs", kbytes);
+  bench_report(label, client.answered, elapsed);
+  printf("  %.1f MB/s of payload\n",
+         (double)client.answered * (double)(kbytes * 1024) * 1e3 /
+         (double)elapsed);
+  printf("  %.2f COAP_PDU_BUF allocations per request\n",
+         put_bytes ? (double)(after.allocs - before.allocs) *
+         (double)(kbytes * 1024) / (double)put_bytes : 0.0);
+
+  free(client.request);
+  coap_free_context(ctx);
+  coap_cleanup();
+  return 0;
+}
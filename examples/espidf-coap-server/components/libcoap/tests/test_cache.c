@@ -0,0 +1,312 @@
+/* libcoap unit tests
+ *
+ * Copyright (C) 2022 Olaf Bergmann <bergmann@tzi.org> and others
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * This file is part of the CoAP library libcoap. Please see
+ * README for terms of use.
+ */
+
+#include "test_common.h"
+#include "test_cache.h"
+
+#if COAP_SERVER_SUPPORT
+#if COAP_CLIENT_SUPPORT
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_PDUS 4
+
+static coap_context_t *ctx;       /* Holds the coap context for all tests */
+static coap_session_t *session;   /* Holds a client session for all tests */
+static coap_pdu_t *pdu[NUM_PDUS]; /* GET requests with different Uri-Paths */
+
+static void
+cache_reset(size_t max_entries, size_t max_bytes) {
+  coap_cache_entry_t *cp, *ctmp;
+
+  HASH_ITER(hh, ctx->cache, cp, ctmp) {
+    coap_delete_cache_entry(ctx, cp);
+  }
+  memset(&ctx->cache_stats, 0, sizeof(ctx->cache_stats));
+  coap_cache_set_limits(ctx, max_entries, max_bytes);
+}
+
+static coap_cache_entry_t *
+cache_add(int i) {
+  return coap_new_cache_entry(session, pdu[i], COAP_CACHE_NOT_RECORD_PDU,
+                              COAP_CACHE_NOT_SESSION_BASED, 0);
+}
+
+static int
+cache_has(int i) {
+  coap_cache_key_t *cache_key;
+  coap_cache_entry_t *cache_entry;
+
+  /* Not counted as a hit or a miss */
+  cache_key = coap_cache_derive_key(session, pdu[i],
+                                    COAP_CACHE_NOT_SESSION_BASED);
+  HASH_FIND(hh, ctx->cache, cache_key, sizeof(coap_cache_key_t),
+            cache_entry);
+  coap_delete_cache_key(cache_key);
+  return cache_entry != NULL;
+}
+
+/* The least recently created entry goes when max_entries is reached */
+static void
+t_cache1(void) {
+  coap_cache_stats_t stats;
+  int i;
+
+  cache_reset(3, 0);
+  for (i = 0; i < NUM_PDUS; i++) {
+    CU_ASSERT_PTR_NOT_NULL(cache_add(i));
+  }
+  CU_ASSERT(!cache_has(0));
+  CU_ASSERT(cache_has(1));
+  CU_ASSERT(cache_has(2));
+  CU_ASSERT(cache_has(3));
+
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.entries == 3);
+  CU_ASSERT(stats.evictions == 1);
+  CU_ASSERT(stats.bytes > 0);
+}
+
+/* A lookup makes an entry the most recently used */
+static void
+t_cache2(void) {
+  coap_cache_stats_t stats;
+
+  cache_reset(3, 0);
+  cache_add(0);
+  cache_add(1);
+  cache_add(2);
+  CU_ASSERT_PTR_NOT_NULL(coap_cache_get_by_pdu(session, pdu[0],
+                                           COAP_CACHE_NOT_SESSION_BASED));
+  cache_add(3);
+  CU_ASSERT(cache_has(0));
+  CU_ASSERT(!cache_has(1));
+  CU_ASSERT_PTR_NULL(coap_cache_get_by_pdu(session, pdu[1],
+                                           COAP_CACHE_NOT_SESSION_BASED));
+
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.hits == 1);
+  CU_ASSERT(stats.misses == 1);
+  CU_ASSERT(stats.evictions == 1);
+}
+
+/* App data sizes count towards max_bytes */
+static void
+t_cache3(void) {
+  coap_cache_stats_t stats;
+  coap_cache_entry_t *cache_entry;
+  size_t entry_bytes;
+
+  cache_reset(0, 0);
+  cache_add(0);
+  coap_cache_get_stats(ctx, &stats);
+  entry_bytes = stats.bytes;
+
+  cache_reset(0, 4 * entry_bytes + 100);
+  cache_entry = cache_add(0);
+  CU_ASSERT_PTR_NOT_NULL(cache_entry);
+  coap_cache_set_app_data_size(cache_entry, 2 * entry_bytes);
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.bytes == 3 * entry_bytes);
+
+  /* Fits */
+  CU_ASSERT_PTR_NOT_NULL(cache_add(1));
+  CU_ASSERT(cache_has(0));
+  /* Does not fit without deleting the first one */
+  CU_ASSERT_PTR_NOT_NULL(cache_add(2));
+  CU_ASSERT(!cache_has(0));
+  CU_ASSERT(cache_has(1));
+  CU_ASSERT(cache_has(2));
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.entries == 2);
+  CU_ASSERT(stats.bytes == 2 * entry_bytes);
+
+  /* Too large on its own */
+  coap_cache_set_limits(ctx, 0, entry_bytes / 2);
+  CU_ASSERT_PTR_NULL(cache_add(3));
+}
+
+/* A new entry replaces one with the same cache-key */
+static void
+t_cache4(void) {
+  coap_cache_stats_t stats;
+  coap_cache_entry_t *cache_entry;
+
+  cache_reset(0, 0);
+  cache_add(0);
+  cache_entry = cache_add(0);
+  CU_ASSERT(coap_cache_get_by_pdu(session, pdu[0],
+                                  COAP_CACHE_NOT_SESSION_BASED) ==
+            cache_entry);
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.entries == 1);
+  CU_ASSERT(stats.evictions == 0);
+}
+
+/* Lowering the limits takes effect immediately */
+static void
+t_cache5(void) {
+  coap_cache_stats_t stats;
+  int i;
+
+  cache_reset(0, 0);
+  for (i = 0; i < NUM_PDUS; i++) {
+    cache_add(i);
+  }
+  coap_cache_set_limits(ctx, 1, 0);
+  CU_ASSERT(cache_has(NUM_PDUS - 1));
+  coap_cache_get_stats(ctx, &stats);
+  CU_ASSERT(stats.entries == 1);
+  CU_ASSERT(stats.evictions == NUM_PDUS - 1);
+}
+
+/* Fast cache-keys find the same entries as digests */
+static void
+t_cache6(void) {
+  coap_cache_entry_t *cache_entry[NUM_PDUS];
+  coap_pdu_t *observe;
+  int i;
+
+  cache_reset(0, 0);
+  CU_ASSERT(coap_cache_set_key_mode(ctx, COAP_CACHE_KEY_FAST) == 1);
+  for (i = 0; i < NUM_PDUS; i++) {
+    cache_entry[i] = cache_add(i);
+    CU_ASSERT_PTR_NOT_NULL(cache_entry[i]);
+  }
+  for (i = 0; i < NUM_PDUS; i++) {
+    CU_ASSERT(coap_cache_get_by_pdu(session, pdu[i],
+                                    COAP_CACHE_NOT_SESSION_BASED) ==
+              cache_entry[i]);
+  }
+  CU_ASSERT_PTR_NULL(coap_cache_get_by_pdu(session, pdu[0],
+                                           COAP_CACHE_IS_SESSION_BASED));
+
+  /* Observe is not part of the cache-key */
+  observe = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET, 0, 64);
+  CU_ASSERT_PTR_NOT_NULL(observe);
+  if (observe) {
+    coap_add_option(observe, COAP_OPTION_OBSERVE, 0, NULL);
+    coap_add_option(observe, COAP_OPTION_URI_PATH, 2,
+                    (const uint8_t *)"p1");
+    CU_ASSERT(coap_cache_get_by_pdu(session, observe,
+                                    COAP_CACHE_NOT_SESSION_BASED) ==
+              cache_entry[1]);
+    coap_delete_pdu(observe);
+  }
+
+  /* Cannot be changed with cache-entries present */
+  CU_ASSERT(coap_cache_set_key_mode(ctx, COAP_CACHE_KEY_DIGEST) == 0);
+  cache_reset(0, 0);
+  CU_ASSERT(coap_cache_set_key_mode(ctx, COAP_CACHE_KEY_DIGEST) == 1);
+}
+
+/* A request with the same fast cache-key but different options misses */
+static void
+t_cache7(void) {
+  coap_cache_stats_t stats;
+  coap_cache_entry_t *cache_entry;
+
+  cache_reset(0, 0);
+  CU_ASSERT(coap_cache_set_key_mode(ctx, COAP_CACHE_KEY_FAST) == 1);
+  cache_entry = cache_add(2);
+  CU_ASSERT_PTR_NOT_NULL(cache_entry);
+  if (cache_entry) {
+    CU_ASSERT_PTR_NOT_NULL(cache_entry->key_data);
+    CU_ASSERT(cache_entry->key_data_len > 2);
+    /* As if Uri-Path p2 hashed to the same cache-key as Uri-Path p3 */
+    CU_ASSERT(cache_entry->key_data[cache_entry->key_data_len - 1] == '2');
+    cache_entry->key_data[cache_entry->key_data_len - 1] = '3';
+    CU_ASSERT_PTR_NULL(coap_cache_get_by_pdu(session, pdu[2],
+                                             COAP_CACHE_NOT_SESSION_BASED));
+    coap_cache_get_stats(ctx, &stats);
+    CU_ASSERT(stats.hits == 0);
+    CU_ASSERT(stats.misses == 1);
+  }
+  cache_reset(0, 0);
+  CU_ASSERT(coap_cache_set_key_mode(ctx, COAP_CACHE_KEY_DIGEST) == 1);
+}
+
+static int
+t_cache_tests_create(void) {
+  coap_address_t addr;
+  int i;
+
+  coap_address_init(&addr);
+  addr.size = sizeof(struct sockaddr_in6);
+  addr.addr.sin6.sin6_family = AF_INET6;
+  addr.addr.sin6.sin6_addr = in6addr_loopback;
+  addr.addr.sin6.sin6_port = htons(COAP_DEFAULT_PORT);
+
+  ctx = coap_new_context(NULL);
+  if (!ctx)
+    return 1;
+  session = coap_new_client_session(ctx, NULL, &addr, COAP_PROTO_UDP);
+  if (!session)
+    return 1;
+
+  for (i = 0; i < NUM_PDUS; i++) {
+    char path[8];
+
+    pdu[i] = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET, 0, 64);
+    if (!pdu[i])
+      return 1;
+    snprintf(path, sizeof(path), "p%d", i);
+    coap_add_option(pdu[i], COAP_OPTION_URI_PATH, strlen(path),
+                    (const uint8_t *)path);
+  }
+  return 0;
+}
+
+static int
+t_cache_tests_remove(void) {
+  int i;
+
+  for (i = 0; i < NUM_PDUS; i++) {
+    coap_delete_pdu(pdu[i]);
+  }
+  coap_session_release(session);
+  coap_free_context(ctx);
+  return 0;
+}
+
+CU_pSuite
+t_init_cache_tests(void) {
+  CU_pSuite suite;
+
+  suite = CU_add_suite("cache", t_cache_tests_create, t_cache_tests_remove);
+  if (!suite) {                        /* signal error */
+    fprintf(stderr, "W: cannot add cache test suite (%s)\n",
+            CU_get_error_msg());
+
+    return NULL;
+  }
+
+#define CACHE_TEST(s,t)                                           \
+  if (!CU_ADD_TEST(s,t)) {                                        \
+    fprintf(stderr, "W: cannot add cache test (%s)\n",            \
+            CU_get_error_msg());                                  \
+  }
+
+  CACHE_TEST(suite, t_cache1);
+  CACHE_TEST(suite, t_cache2);
+  CACHE_TEST(suite, t_cache3);
+  CACHE_TEST(suite, t_cache4);
+  CACHE_TEST(suite, t_cache5);
+  CACHE_TEST(suite, t_cache6);
+  CACHE_TEST(suite, t_cache7);
+
+  return suite;
+}
+#endif /* COAP_CLIENT_SUPPORT */
+#endif /* COAP_SERVER_SUPPORT */
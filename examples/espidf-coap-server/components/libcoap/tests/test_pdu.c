@@ -325,6 +325,146 @@ t_parse_pdu17(void) {
   CU_ASSERT(result == 0);
 }
 
+/* Finds option number by walking all the options of p */
+static coap_opt_t *
+walk_option(const coap_pdu_t *p, coap_option_num_t number) {
+  coap_opt_iterator_t oi;
+  coap_opt_t *option;
+
+  coap_option_iterator_init(p, &oi, COAP_OPT_ALL);
+  while ((option = coap_option_next(&oi))) {
+    if (oi.number == number)
+      return option;
+  }
+  return NULL;
+}
+
+/* Encodes p and parses it back into pdu */
+static int
+reparse_pdu(coap_pdu_t *p, uint8_t *buf, size_t buf_len) {
+  size_t len;
+
+  if (!coap_pdu_encode_header(p, COAP_PROTO_UDP))
+    return 0;
+  len = p->hdr_size + p->used_size;
+  if (len > buf_len)
+    return 0;
+  memcpy(buf, p->token - p->hdr_size, len);
+  return coap_pdu_parse(COAP_PROTO_UDP, buf, len, pdu);
+}
+
+static void
+t_parse_pdu18(void) {
+  uint8_t buf[128];
+  coap_pdu_t *testpdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                      0x1234, 128);
+  coap_opt_iterator_t oi;
+  coap_opt_t *option;
+  coap_option_num_t n;
+  int count;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(testpdu);
+  coap_add_token(testpdu, 2, (const uint8_t *)"tk");
+  coap_add_option(testpdu, COAP_OPTION_IF_MATCH, 1, (const uint8_t *)"a");
+  coap_add_option(testpdu, COAP_OPTION_IF_MATCH, 1, (const uint8_t *)"b");
+  coap_add_option(testpdu, COAP_OPTION_URI_HOST, 4, (const uint8_t *)"host");
+  coap_add_option(testpdu, COAP_OPTION_URI_PATH, 1, (const uint8_t *)"x");
+  coap_add_option(testpdu, COAP_OPTION_URI_PATH, 2, (const uint8_t *)"yy");
+  coap_add_option(testpdu, COAP_OPTION_URI_PATH, 3, (const uint8_t *)"zzz");
+  coap_add_option(testpdu, COAP_OPTION_URI_QUERY, 3, (const uint8_t *)"a=1");
+  coap_add_option(testpdu, COAP_OPTION_SIZE1, 1, (const uint8_t *)"\x40");
+  coap_add_data(testpdu, 4, (const uint8_t *)"data");
+
+  CU_ASSERT_FATAL(reparse_pdu(testpdu, buf, sizeof(buf)) > 0);
+  coap_delete_pdu(testpdu);
+  CU_ASSERT(pdu->opt_index_state == COAP_PDU_OPT_INDEX_FULL);
+  CU_ASSERT(pdu->opt_index_count == 5);
+
+  for (n = 0; n < 100; n++) {
+    option = coap_check_option(pdu, n, &oi);
+    CU_ASSERT(option == walk_option(pdu, n));
+  }
+
+  /* Carry on through the repeated options after the indexed first one */
+  count = 0;
+  option = coap_check_option(pdu, COAP_OPTION_URI_PATH, &oi);
+  while (option) {
+    count++;
+    CU_ASSERT(oi.number == COAP_OPTION_URI_PATH);
+    CU_ASSERT(coap_opt_length(option) == (uint32_t)count);
+    option = coap_option_next(&oi);
+  }
+  CU_ASSERT(count == 3);
+}
+
+static void
+t_parse_pdu19(void) {
+  uint8_t buf[256];
+  coap_pdu_t *testpdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                      0x1234, 256);
+  coap_opt_iterator_t oi;
+  coap_opt_t *option;
+  coap_option_num_t n;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(testpdu);
+  /* More different elective options than can be indexed */
+  for (n = 0; n < COAP_PDU_OPT_INDEX_SIZE + 8; n++) {
+    uint8_t value = (uint8_t)n;
+
+    coap_add_option(testpdu, 2000 + n * 10, 1, &value);
+  }
+  coap_add_option(testpdu, 2000 + n * 10, 1, (const uint8_t *)"x");
+
+  CU_ASSERT_FATAL(reparse_pdu(testpdu, buf, sizeof(buf)) > 0);
+  coap_delete_pdu(testpdu);
+  CU_ASSERT(pdu->opt_index_state == COAP_PDU_OPT_INDEX_PARTIAL);
+  CU_ASSERT(pdu->opt_index_count == COAP_PDU_OPT_INDEX_SIZE);
+
+  for (n = 1990; n < 2000 + (COAP_PDU_OPT_INDEX_SIZE + 12) * 10; n++) {
+    option = coap_check_option(pdu, n, &oi);
+    CU_ASSERT(option == walk_option(pdu, n));
+    if (option && n < 2000 + (COAP_PDU_OPT_INDEX_SIZE + 8) * 10)
+      CU_ASSERT(*coap_opt_value(option) == (n - 2000) / 10);
+  }
+}
+
+static void
+t_parse_pdu20(void) {
+  uint8_t buf[128];
+  coap_pdu_t *testpdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_GET,
+                                      0x1234, 128);
+  coap_opt_iterator_t oi;
+  coap_opt_t *option;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(testpdu);
+  coap_add_option(testpdu, COAP_OPTION_URI_HOST, 4, (const uint8_t *)"host");
+  coap_add_option(testpdu, COAP_OPTION_URI_PATH, 4, (const uint8_t *)"path");
+  coap_add_option(testpdu, COAP_OPTION_URI_QUERY, 3, (const uint8_t *)"a=1");
+
+  CU_ASSERT_FATAL(reparse_pdu(testpdu, buf, sizeof(buf)) > 0);
+  coap_delete_pdu(testpdu);
+  CU_ASSERT(pdu->opt_index_state == COAP_PDU_OPT_INDEX_FULL);
+
+  /* Changing the options must not leave a stale index behind */
+  CU_ASSERT(coap_update_option(pdu, COAP_OPTION_URI_HOST, 11,
+                               (const uint8_t *)"example.com") == 1);
+  option = coap_check_option(pdu, COAP_OPTION_URI_QUERY, &oi);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(option);
+  CU_ASSERT(coap_opt_length(option) == 3);
+  CU_ASSERT(memcmp(coap_opt_value(option), "a=1", 3) == 0);
+
+  CU_ASSERT(coap_remove_option(pdu, COAP_OPTION_URI_PATH) == 1);
+  CU_ASSERT_PTR_NULL(coap_check_option(pdu, COAP_OPTION_URI_PATH, &oi));
+  option = coap_check_option(pdu, COAP_OPTION_URI_QUERY, &oi);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(option);
+  CU_ASSERT(memcmp(coap_opt_value(option), "a=1", 3) == 0);
+
+  CU_ASSERT(coap_update_token(pdu, 8, (const uint8_t *)"longtokn") == 1);
+  option = coap_check_option(pdu, COAP_OPTION_URI_HOST, &oi);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(option);
+  CU_ASSERT(memcmp(coap_opt_value(option), "example.com", 11) == 0);
+}
+
 /************************************************************************
  ** PDU encoder
  ************************************************************************/
@@ -1238,6 +1378,40 @@ t_encode_pdu22(void) {
   }
 }
 
+static void
+t_encode_pdu23(void) {
+  coap_memory_stats_t before, after;
+  coap_pdu_t *testpdu;
+  uint8_t data[20000];
+  size_t len, i;
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = (uint8_t)(i * 31);
+
+  CU_ASSERT(coap_memory_get_stats(COAP_PDU_BUF, &before) == 1);
+  testpdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT, 0x1234, 0);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(testpdu);
+  CU_ASSERT(coap_add_token(testpdu, 4, (const uint8_t *)"tokn") == 1);
+  CU_ASSERT(coap_add_option(testpdu, COAP_OPTION_URI_PATH, 4,
+                            (const uint8_t *)"path") > 0);
+
+  /* Grow the PDU across the buffer sizes, checking nothing is lost */
+  for (len = 10; len <= sizeof(data); len *= 3) {
+    CU_ASSERT_FATAL(coap_pdu_resize(testpdu, len + 16) == 1);
+    CU_ASSERT(memcmp(testpdu->token, "tokn", 4) == 0);
+    memcpy(testpdu->token + 16, data, len);
+  }
+  len /= 3;
+  CU_ASSERT(memcmp(testpdu->token + 16, data, len) == 0);
+  CU_ASSERT(memcmp(testpdu->token + 5, "path", 4) == 0);
+  coap_delete_pdu(testpdu);
+
+  CU_ASSERT(coap_memory_get_stats(COAP_PDU_BUF, &after) == 1);
+  CU_ASSERT(after.in_use == before.in_use);
+  CU_ASSERT(after.allocs > before.allocs);
+  CU_ASSERT(after.high_water > before.in_use);
+}
+
 
 static int
 t_pdu_tests_create(void) {
@@ -1287,6 +1461,9 @@ t_init_pdu_tests(void) {
   PDU_TEST(suite[0], t_parse_pdu15);
   PDU_TEST(suite[0], t_parse_pdu16);
   PDU_TEST(suite[0], t_parse_pdu17);
+  PDU_TEST(suite[0], t_parse_pdu18);
+  PDU_TEST(suite[0], t_parse_pdu19);
+  PDU_TEST(suite[0], t_parse_pdu20);
 
   suite[1] = CU_add_suite("pdu encoder", t_pdu_tests_create, t_pdu_tests_remove);
   if (suite[1]) {
@@ -1317,6 +1494,7 @@ t_init_pdu_tests(void) {
     PDU_ENCODER_TEST(suite[1], t_encode_pdu20);
     PDU_ENCODER_TEST(suite[1], t_encode_pdu21);
     PDU_ENCODER_TEST(suite[1], t_encode_pdu22);
+    PDU_ENCODER_TEST(suite[1], t_encode_pdu23);
 
   } else                         /* signal error */
     fprintf(stderr, "W: cannot add pdu parser test suite (%s)\n",
@@ -28,15 +28,19 @@ static coap_tick_t timestamp[] = {
 /* nodes for testing. node[0] is left empty */
 coap_queue_t *node[5];
 
-static coap_tick_t
-add_timestamps(coap_queue_t *queue, size_t num) {
-  coap_tick_t t = 0;
-  while (queue && num--) {
-    t += queue->t;
-    queue = queue->next;
-  }
-
-  return t;
+/*
+ * Empties the sendqueue into @p order (which must be large enough) in the
+ * order that the nodes are due and then puts them all back again.
+ */
+static size_t
+queue_order(coap_queue_t **order) {
+  size_t i, n = 0;
+
+  while ((order[n] = coap_pop_next(ctx)) != NULL)
+    n++;
+  for (i = 0; i < n; i++)
+    coap_insert_node(&ctx->sendqueue, order[i]);
+  return n;
 }
 
 static void
@@ -57,10 +61,9 @@ t_sendqueue2(void) {
 
   CU_ASSERT(result > 0);
   CU_ASSERT_PTR_EQUAL(ctx->sendqueue, node[1]);
-  CU_ASSERT_PTR_EQUAL(ctx->sendqueue->next, node[2]);
 
   CU_ASSERT(ctx->sendqueue->t == timestamp[1]);
-  CU_ASSERT(node[2]->t == timestamp[2] - timestamp[1]);
+  CU_ASSERT(node[2]->t == timestamp[2]);
 }
 
 /* insert new node as first element in queue */
@@ -74,17 +77,15 @@ t_sendqueue3(void) {
   CU_ASSERT_PTR_EQUAL(ctx->sendqueue, node[3]);
   CU_ASSERT(node[3]->t == timestamp[3]);
 
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next);
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next->next);
-
-  CU_ASSERT(ctx->sendqueue->next->t == timestamp[1] - timestamp[3]);
-  CU_ASSERT(ctx->sendqueue->next->next->t == timestamp[2] - timestamp[1]);
+  CU_ASSERT(node[1]->t == timestamp[1]);
+  CU_ASSERT(node[2]->t == timestamp[2]);
 }
 
 /* insert new node as fourth element in queue */
 static void
 t_sendqueue4(void) {
   int result;
+  coap_queue_t *order[5];
 
   result = coap_insert_node(&ctx->sendqueue, node[4]);
 
@@ -92,20 +93,14 @@ t_sendqueue4(void) {
 
   CU_ASSERT_PTR_EQUAL(ctx->sendqueue, node[3]);
 
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next);
-  CU_ASSERT_PTR_EQUAL(ctx->sendqueue->next, node[1]);
+  CU_ASSERT(queue_order(order) == 4);
+  CU_ASSERT_PTR_EQUAL(order[0], node[3]);
+  CU_ASSERT_PTR_EQUAL(order[1], node[1]);
+  CU_ASSERT_PTR_EQUAL(order[2], node[4]);
+  CU_ASSERT_PTR_EQUAL(order[3], node[2]);
 
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next->next);
-  CU_ASSERT_PTR_EQUAL(ctx->sendqueue->next->next, node[4]);
-
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next->next->next);
-  CU_ASSERT_PTR_EQUAL(ctx->sendqueue->next->next->next, node[2]);
-
-  CU_ASSERT(ctx->sendqueue->next->t == timestamp[1] - timestamp[3]);
-  CU_ASSERT(add_timestamps(ctx->sendqueue, 1) == timestamp[3]);
-  CU_ASSERT(add_timestamps(ctx->sendqueue, 2) == timestamp[1]);
-  CU_ASSERT(add_timestamps(ctx->sendqueue, 3) == timestamp[4]);
-  CU_ASSERT(add_timestamps(ctx->sendqueue, 4) == timestamp[2]);
+  CU_ASSERT_PTR_EQUAL(ctx->sendqueue, node[3]);
+  CU_ASSERT(node[4]->t == timestamp[4]);
 }
 
 static void
@@ -113,18 +108,8 @@ t_sendqueue5(void) {
   const coap_tick_diff_t delta1 = 20, delta2 = 130;
   unsigned int result;
   coap_tick_t now;
-
-  /* space for saving the current node timestamps */
-  static coap_tick_t times[sizeof(timestamp)/sizeof(coap_tick_t)];
-  coap_queue_t *p;
   int i;
 
-  /* save timestamps of nodes in the sendqueue in their actual order */
-  memset(times, 0, sizeof(times));
-  for (p = ctx->sendqueue, i = 0; p; p = p->next, i++) {
-    times[i] = p->t;
-  }
-
   coap_ticks(&now);
   ctx->sendqueue_basetime = now;
 
@@ -135,6 +120,7 @@ t_sendqueue5(void) {
   CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue);
   CU_ASSERT(ctx->sendqueue_basetime == now);
   CU_ASSERT(ctx->sendqueue->t == timestamp[3] + delta1);
+  CU_ASSERT(node[2]->t == timestamp[2] + delta1);
 
   now += delta2;
   result = coap_adjust_basetime(ctx, now);
@@ -143,15 +129,14 @@ t_sendqueue5(void) {
   CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue);
   CU_ASSERT(ctx->sendqueue->t == 0);
 
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next);
-  CU_ASSERT(ctx->sendqueue->next->t == 0);
+  CU_ASSERT(node[1]->t == 0);
+  CU_ASSERT(node[3]->t == 0);
+  CU_ASSERT(node[4]->t == timestamp[4] + delta1 - delta2);
+  CU_ASSERT(node[2]->t == timestamp[2] + delta1 - delta2);
 
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next->next);
-  CU_ASSERT(ctx->sendqueue->next->next->t == delta2 - delta1 - timestamp[1]);
-
-  /* restore timestamps of nodes in the sendqueue */
-  for (p = ctx->sendqueue, i = 0; p; p = p->next, i++) {
-    p->t = times[i];
+  /* restore timestamps of nodes in the sendqueue, keeping their order */
+  for (i = 1; i < 5; i++) {
+    node[i]->t = timestamp[i];
   }
 }
 
@@ -162,17 +147,6 @@ t_sendqueue6(void) {
   const coap_tick_diff_t delta = 20;
   coap_queue_t *tmpqueue = ctx->sendqueue;
 
-  /* space for saving the current node timestamps */
-  static coap_tick_t times[sizeof(timestamp)/sizeof(coap_tick_t)];
-  coap_queue_t *p;
-  int i;
-
-  /* save timestamps of nodes in the sendqueue in their actual order */
-  memset(times, 0, sizeof(times));
-  for (p = ctx->sendqueue, i = 0; p; p = p->next, i++) {
-    times[i] = p->t;
-  }
-
   coap_ticks(&now);
   ctx->sendqueue = NULL;
   ctx->sendqueue_basetime = now;
@@ -194,9 +168,6 @@ t_sendqueue7(void) {
   CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue);
   CU_ASSERT_PTR_EQUAL(ctx->sendqueue, node[3]);
 
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next);
-  CU_ASSERT_PTR_EQUAL(ctx->sendqueue->next, node[1]);
-
   result = coap_remove_from_queue(&ctx->sendqueue, session, 3, &tmp_node);
 
   CU_ASSERT(result == 1);
@@ -213,6 +184,7 @@ static void
 t_sendqueue8(void) {
   int result;
   coap_queue_t *tmp_node;
+  coap_queue_t *order[5];
 
   result = coap_remove_from_queue(&ctx->sendqueue, session, 4, &tmp_node);
 
@@ -220,15 +192,18 @@ t_sendqueue8(void) {
   CU_ASSERT_PTR_NOT_NULL(tmp_node);
   CU_ASSERT_PTR_EQUAL(tmp_node, node[4]);
 
+  /* node[4] is no longer in the queue */
+  result = coap_remove_from_queue(&ctx->sendqueue, session, 4, &tmp_node);
+  CU_ASSERT(result == 0);
+
   CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue);
   CU_ASSERT_PTR_EQUAL(ctx->sendqueue, node[1]);
   CU_ASSERT(ctx->sendqueue->t == timestamp[1]);
 
-  CU_ASSERT_PTR_NOT_NULL(ctx->sendqueue->next);
-  CU_ASSERT_PTR_EQUAL(ctx->sendqueue->next, node[2]);
-  CU_ASSERT(ctx->sendqueue->next->t == timestamp[2] - timestamp[1]);
-
-  CU_ASSERT_PTR_NULL(ctx->sendqueue->next->next);
+  CU_ASSERT(queue_order(order) == 2);
+  CU_ASSERT_PTR_EQUAL(order[0], node[1]);
+  CU_ASSERT_PTR_EQUAL(order[1], node[2]);
+  CU_ASSERT(node[2]->t == timestamp[2]);
 }
 
 static void
@@ -250,8 +225,6 @@ t_sendqueue9(void) {
 
   CU_ASSERT(tmp_node->t == timestamp[1]);
   CU_ASSERT(ctx->sendqueue->t == timestamp[2]);
-
-  CU_ASSERT_PTR_NULL(ctx->sendqueue->next);
 }
 
 static void
@@ -268,6 +241,43 @@ t_sendqueue10(void) {
   CU_ASSERT(tmp_node->t == timestamp[2]);
 }
 
+/* insert many nodes, remove every third one and check the order of the rest */
+static void
+t_sendqueue11(void) {
+  coap_queue_t *nodes[1000];
+  coap_queue_t *tmp_node;
+  coap_tick_t last = 0;
+  size_t n, left = 0;
+  int result;
+
+  for (n = 0; n < sizeof(nodes)/sizeof(nodes[0]); n++) {
+    nodes[n] = coap_new_node();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(nodes[n]);
+    nodes[n]->id = (coap_mid_t)(n + 100);
+    nodes[n]->t = (n * 7919) % 997;
+    nodes[n]->session = coap_session_reference(session);
+    coap_insert_node(&ctx->sendqueue, nodes[n]);
+  }
+
+  for (n = 0; n < sizeof(nodes)/sizeof(nodes[0]); n += 3) {
+    result = coap_remove_from_queue(&ctx->sendqueue, session,
+                                    (coap_mid_t)(n + 100), &tmp_node);
+    CU_ASSERT(result == 1);
+    CU_ASSERT_PTR_EQUAL(tmp_node, nodes[n]);
+    coap_delete_node(tmp_node);
+  }
+
+  while ((tmp_node = coap_pop_next(ctx)) != NULL) {
+    CU_ASSERT(tmp_node->t >= last);
+    CU_ASSERT((tmp_node->id - 100) % 3 != 0);
+    last = tmp_node->t;
+    left++;
+    coap_delete_node(tmp_node);
+  }
+  CU_ASSERT(left == sizeof(nodes)/sizeof(nodes[0]) * 2 / 3);
+  CU_ASSERT_PTR_NULL(session->sendqueue);
+}
+
 /* This function creates a set of nodes for testing. These nodes
  * will exist for all tests and are modified by coap_insert_node()
  * and coap_remove_from_queue().
@@ -360,6 +370,7 @@ t_init_sendqueue_tests(void) {
   SENDQUEUE_TEST(suite, t_sendqueue8);
   SENDQUEUE_TEST(suite, t_sendqueue9);
   SENDQUEUE_TEST(suite, t_sendqueue10);
+  SENDQUEUE_TEST(suite, t_sendqueue11);
 
   return suite;
 }
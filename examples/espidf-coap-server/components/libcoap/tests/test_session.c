@@ -13,6 +13,10 @@
 
 #if COAP_CLIENT_SUPPORT
 #include <stdio.h>
+#include <unistd.h>
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_MUTEX_LOCK)
+#include <pthread.h>
+#endif /* HAVE_PTHREAD_H && HAVE_PTHREAD_MUTEX_LOCK */
 
 /* The error threshold for timeout calculations. The precision of
  * coap_calc_timeout() is assumed to be sufficient if the resulting
@@ -165,6 +169,1052 @@ t_session6(void) {
   coap_session_release(session);
 }
 
+#if COAP_SERVER_SUPPORT
+/* Freed sessions may be reused, so look them up by the peer's port */
+static int
+server_session_exists(coap_endpoint_t *ep, uint16_t port) {
+  coap_session_t *sp, *rtmp;
+
+  SESSIONS_ITER(ep->sessions, sp, rtmp) {
+    if (coap_address_get_port(&sp->addr_info.remote) == port)
+      return 1;
+  }
+  return 0;
+}
+
+/* Gets the server session of ep for a peer at [::1]:port, as if a datagram
+ * had arrived from it at time now */
+static coap_session_t *
+fake_peer(coap_endpoint_t *ep, uint16_t port, coap_tick_t now) {
+  coap_packet_t packet;
+
+  memset(&packet, 0, sizeof(packet));
+  coap_address_copy(&packet.addr_info.local, &ep->bind_addr);
+  coap_address_copy(&packet.addr_info.remote, &ep->bind_addr);
+  packet.addr_info.remote.addr.sin6.sin6_addr = in6addr_loopback;
+  packet.addr_info.remote.addr.sin6.sin6_port = htons(port);
+  return coap_endpoint_get_session(ep, &packet, now);
+}
+
+/* Test 7 checks that max_idle_sessions evicts the least recently active
+ * idle server session, and never one that is in use */
+static void
+t_session7(void) {
+  coap_endpoint_t *ep = ctx->endpoint;
+  coap_session_t *s[6];
+  coap_tick_t now;
+  int i;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  coap_context_set_max_idle_sessions(ctx, 3);
+  coap_ticks(&now);
+
+  for (i = 0; i < 5; i++) {
+    s[i] = fake_peer(ep, (uint16_t)(30000 + i), now + i);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(s[i]);
+    if (i == 0)
+      coap_session_reference(s[0]);
+  }
+  /* s[0] is in use, so s[1] made way for s[4] */
+  CU_ASSERT(ep->lru_count[COAP_SESSION_LRU_IDLE] == 3);
+  CU_ASSERT(server_session_exists(ep, 30000));
+  CU_ASSERT(!server_session_exists(ep, 30001));
+  CU_ASSERT(server_session_exists(ep, 30002));
+
+  /* Traffic from s[2] makes s[3] the least recently active */
+  CU_ASSERT(fake_peer(ep, 30002, now + 5) == s[2]);
+  s[5] = fake_peer(ep, 30005, now + 6);
+  CU_ASSERT_PTR_NOT_NULL(s[5]);
+  CU_ASSERT(ep->lru_count[COAP_SESSION_LRU_IDLE] == 3);
+  CU_ASSERT(server_session_exists(ep, 30002));
+  CU_ASSERT(!server_session_exists(ep, 30003));
+  CU_ASSERT(server_session_exists(ep, 30004));
+
+  /* Once released, s[0] is idle again and the oldest */
+  coap_session_release(s[0]);
+  CU_ASSERT(ep->lru_count[COAP_SESSION_LRU_IDLE] == 4);
+  coap_context_set_max_idle_sessions(ctx, 0);
+}
+
+static int post_count;
+static uint8_t sent_data[64];
+static size_t sent_len;
+
+static ssize_t
+capture_send(coap_socket_t *sock COAP_UNUSED,
+             const coap_session_t *s COAP_UNUSED,
+             const uint8_t *data, size_t datalen) {
+  sent_len = datalen < sizeof(sent_data) ? datalen : sizeof(sent_data);
+  memcpy(sent_data, data, sent_len);
+  return (ssize_t)datalen;
+}
+
+static void
+hnd_post_count(coap_resource_t *resource COAP_UNUSED,
+               coap_session_t *s COAP_UNUSED,
+               const coap_pdu_t *request COAP_UNUSED,
+               const coap_string_t *query COAP_UNUSED,
+               coap_pdu_t *response) {
+  uint8_t count = (uint8_t)++post_count;
+
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+  coap_add_data(response, 1, &count);
+}
+
+/* Sends a CON POST /count with the given message id to the session */
+static void
+receive_post(coap_session_t *s, coap_mid_t mid) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_POST,
+                                  mid, 64);
+  uint8_t buf[64];
+  size_t len;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_add_token(pdu, 2, (const uint8_t *)"ab");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 5, (const uint8_t *)"count");
+  CU_ASSERT_FATAL(coap_pdu_encode_header(pdu, COAP_PROTO_UDP) > 0);
+  len = pdu->used_size + pdu->hdr_size;
+  memcpy(buf, pdu->token - pdu->hdr_size, len);
+  coap_delete_pdu(pdu);
+
+  sent_len = 0;
+  coap_handle_dgram(ctx, s, buf, len);
+}
+
+/* Test 8 checks that a retransmitted CON request is answered with the
+ * response sent for the original, without calling the handler again */
+static void
+t_session8(void) {
+  coap_endpoint_t *ep = ctx->endpoint;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_dedup_stats_t stats;
+  uint8_t first[64];
+  size_t first_len;
+  coap_tick_t now;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  /* Off unless the application turns it on */
+  CU_ASSERT(coap_context_get_max_dedup_entries(ctx) == 0);
+  coap_context_set_max_dedup_entries(ctx, 8);
+  r = coap_resource_init(coap_make_str_const("count"), 0);
+  coap_register_handler(r, COAP_REQUEST_POST, hnd_post_count);
+  coap_add_resource(ctx, r);
+  ctx->network_send = capture_send;
+
+  coap_ticks(&now);
+  s = fake_peer(ep, 30010, now);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  coap_session_reference(s);
+
+  receive_post(s, 0x1234);
+  CU_ASSERT(post_count == 1);
+  CU_ASSERT_FATAL(sent_len > 4);
+  CU_ASSERT(sent_data[0] == 0x62); /* ACK with a 2 byte token */
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE_CHANGED);
+  first_len = sent_len;
+  memcpy(first, sent_data, sent_len);
+
+  /* The retransmission gets the same ACK back */
+  receive_post(s, 0x1234);
+  CU_ASSERT(post_count == 1);
+  CU_ASSERT(sent_len == first_len);
+  CU_ASSERT(memcmp(sent_data, first, first_len) == 0);
+  coap_context_get_dedup_stats(ctx, &stats);
+  CU_ASSERT(stats.replayed == 1);
+  CU_ASSERT(stats.dropped == 0);
+
+  /* A new message id is a new request */
+  receive_post(s, 0x1235);
+  CU_ASSERT(post_count == 2);
+  CU_ASSERT(sent_len == first_len);
+  CU_ASSERT(sent_data[sent_len - 1] == 2);
+
+  /* Only the last few requests are remembered */
+  coap_context_set_max_dedup_entries(ctx, 1);
+  receive_post(s, 0x1236);
+  receive_post(s, 0x1237);
+  CU_ASSERT(post_count == 4);
+  receive_post(s, 0x1236);
+  CU_ASSERT(post_count == 5);
+  receive_post(s, 0x1236);
+  CU_ASSERT(post_count == 5);
+  coap_context_get_dedup_stats(ctx, &stats);
+  CU_ASSERT(stats.replayed == 2);
+  CU_ASSERT(stats.evicted == 2);
+
+  /* Making way for a request that can no longer be retransmitted is not an
+   * eviction */
+  coap_ticks(&now);
+  s->dedup[0].span_ends = now;
+  receive_post(s, 0x1238);
+  CU_ASSERT(post_count == 6);
+  coap_context_get_dedup_stats(ctx, &stats);
+  CU_ASSERT(stats.evicted == 2);
+
+  /* With duplicate detection off, the handler is called every time */
+  coap_context_set_max_dedup_entries(ctx, 0);
+  receive_post(s, 0x1236);
+  CU_ASSERT(post_count == 7);
+  CU_ASSERT_PTR_NULL(s->dedup);
+
+  coap_context_set_max_dedup_entries(ctx, COAP_DEFAULT_MAX_DEDUP_ENTRIES);
+  coap_session_release(s);
+  ctx->network_send = coap_network_send;
+  coap_delete_resource(ctx, r);
+}
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_MUTEX_LOCK)
+static pthread_mutex_t shard_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shard_cond = PTHREAD_COND_INITIALIZER;
+#endif /* HAVE_PTHREAD_H && HAVE_PTHREAD_MUTEX_LOCK */
+static int shard_called[2];
+static int shard_resources[2];
+
+static void
+hnd_get_shard(coap_resource_t *resource COAP_UNUSED,
+              coap_session_t *s COAP_UNUSED,
+              const coap_pdu_t *request COAP_UNUSED,
+              const coap_string_t *query COAP_UNUSED,
+              coap_pdu_t *response) {
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+}
+
+static void
+setup_shard(coap_context_t *c, unsigned int shard, void *arg) {
+  coap_address_t *addr = (coap_address_t *)arg;
+  coap_endpoint_t *ep = coap_new_endpoint(c, addr, COAP_PROTO_UDP);
+  coap_resource_t *r;
+
+  CU_ASSERT_PTR_NOT_NULL(ep);
+  if (!ep)
+    return;
+  /* The other shards bind to the port chosen for the first */
+  if (shard == 0)
+    coap_address_copy(addr, &ep->bind_addr);
+  r = coap_resource_init(coap_make_str_const("shard"), 0);
+  coap_resource_set_get_observable(r, 1);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get_shard);
+  coap_add_resource(c, r);
+}
+
+/* Records the call, and whether the shard's own context was passed */
+static void
+mark_shard(coap_context_t *c, unsigned int shard, void *arg COAP_UNUSED) {
+  if (shard >= 2)
+    return;
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_MUTEX_LOCK)
+  pthread_mutex_lock(&shard_mutex);
+#endif /* HAVE_PTHREAD_H && HAVE_PTHREAD_MUTEX_LOCK */
+  shard_called[shard]++;
+  shard_resources[shard] =
+    coap_get_resource_from_uri_path(c, coap_make_str_const("shard")) != NULL;
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_MUTEX_LOCK)
+  pthread_cond_signal(&shard_cond);
+  pthread_mutex_unlock(&shard_mutex);
+#endif /* HAVE_PTHREAD_H && HAVE_PTHREAD_MUTEX_LOCK */
+}
+
+/* Waits for each shard to have called mark_shard() count times */
+static void
+wait_shards(int count) {
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_MUTEX_LOCK)
+  pthread_mutex_lock(&shard_mutex);
+  while (shard_called[0] < count || shard_called[1] < count)
+    pthread_cond_wait(&shard_cond, &shard_mutex);
+  pthread_mutex_unlock(&shard_mutex);
+#else /* ! HAVE_PTHREAD_H || ! HAVE_PTHREAD_MUTEX_LOCK */
+  (void)count;
+#endif /* ! HAVE_PTHREAD_H || ! HAVE_PTHREAD_MUTEX_LOCK */
+}
+
+/* Test 9 checks that a group of shards share a port, and that calls and
+ * notifications queued for the group are handled by every shard from its
+ * own thread.  The traffic over the shared port is left to bench_shard. */
+static void
+t_session9(void) {
+  coap_shard_group_t *group;
+  coap_context_t *c0, *c1;
+  coap_address_t addr;
+
+  if (!coap_shard_is_supported()) {
+    CU_PASS("sharded servers not supported");
+    return;
+  }
+  coap_address_init(&addr);
+  addr.size = sizeof(struct sockaddr_in);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  group = coap_new_shard_group(2, setup_shard, &addr);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(group);
+  CU_ASSERT(coap_shard_group_count(group) == 2);
+  c0 = coap_shard_group_get_context(group, 0);
+  c1 = coap_shard_group_get_context(group, 1);
+  CU_ASSERT_PTR_NULL(coap_shard_group_get_context(group, 2));
+  CU_ASSERT_FATAL(c0 && c1 && c0->endpoint && c1->endpoint);
+  CU_ASSERT(coap_context_get_reuse_port(c0));
+  CU_ASSERT(coap_address_equals(&c0->endpoint->bind_addr,
+                                &c1->endpoint->bind_addr));
+
+  /* Before the group is started, the handler is called straight away */
+  memset(shard_called, 0, sizeof(shard_called));
+  CU_ASSERT(coap_shard_group_call(group, mark_shard, NULL));
+  CU_ASSERT(shard_called[0] == 1 && shard_called[1] == 1);
+  CU_ASSERT(shard_resources[0] && shard_resources[1]);
+
+  /* Once started, each shard calls it from its own thread */
+  CU_ASSERT_FATAL(coap_shard_group_start(group));
+  memset(shard_resources, 0, sizeof(shard_resources));
+  CU_ASSERT(coap_shard_group_call(group, mark_shard, NULL));
+  wait_shards(2);
+  CU_ASSERT(shard_resources[0] && shard_resources[1]);
+
+  /* A notification is queued for every shard, ahead of the next call */
+  CU_ASSERT(coap_shard_group_notify(group, coap_make_str_const("shard")));
+  CU_ASSERT(coap_shard_group_call(group, mark_shard, NULL));
+  wait_shards(3);
+
+  coap_free_shard_group(group);
+}
+
+static int tcp_put_count;
+static size_t tcp_put_len;
+static int tcp_put_good;
+
+static void
+hnd_put_tcp(coap_resource_t *resource COAP_UNUSED,
+            coap_session_t *s COAP_UNUSED,
+            const coap_pdu_t *request,
+            const coap_string_t *query COAP_UNUSED,
+            coap_pdu_t *response) {
+  size_t len;
+  const uint8_t *data;
+  size_t i;
+
+  tcp_put_count++;
+  tcp_put_good = coap_get_data(request, &len, &data);
+  tcp_put_len = tcp_put_good ? len : 0;
+  for (i = 0; i < tcp_put_len; i++) {
+    if (data[i] != (uint8_t)i)
+      tcp_put_good = 0;
+  }
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+/* Encodes a TCP PUT /tcp with len bytes of data into buf */
+static size_t
+tcp_put_request(uint8_t *buf, size_t size, uint8_t token, size_t len) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT,
+                                  0, len + 16);
+  size_t i;
+  size_t n = 0;
+
+  if (!pdu)
+    return 0;
+  coap_add_token(pdu, 1, &token);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 3, (const uint8_t *)"tcp");
+  if (len) {
+    uint8_t *data = coap_add_data_after(pdu, len);
+
+    for (i = 0; data && i < len; i++)
+      data[i] = (uint8_t)i;
+  }
+  if (coap_pdu_encode_header(pdu, COAP_PROTO_TCP) &&
+      pdu->used_size + pdu->hdr_size <= size) {
+    n = pdu->used_size + pdu->hdr_size;
+    memcpy(buf, pdu->token - pdu->hdr_size, n);
+  }
+  coap_delete_pdu(pdu);
+  return n;
+}
+
+static void
+t_session10_process(coap_context_t *c, int count) {
+  int i;
+
+  for (i = 0; i < 200 && tcp_put_count < count; i++)
+    coap_io_process(c, 10);
+}
+
+/* Test 10 checks that the PDUs read from a TCP stream are framed correctly
+ * when several arrive in one read and when one arrives over many reads */
+static void
+t_session10(void) {
+  coap_context_t *c;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_address_t addr;
+  static uint8_t buf[8192];
+  size_t len = 0;
+  size_t n, off;
+  int fd;
+
+  if (!coap_tcp_is_supported()) {
+    CU_PASS("TCP not supported");
+    return;
+  }
+  c = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(c);
+  coap_address_init(&addr);
+  addr.size = sizeof(struct sockaddr_in);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ep = coap_new_endpoint(c, &addr, COAP_PROTO_TCP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  r = coap_resource_init(coap_make_str_const("tcp"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put_tcp);
+  coap_add_resource(c, r);
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  CU_ASSERT_FATAL(fd >= 0);
+  CU_ASSERT_FATAL(connect(fd, &ep->bind_addr.addr.sa,
+                          ep->bind_addr.size) == 0);
+
+  /* An empty CSM and three requests in one write */
+  buf[len++] = 0x00;
+  buf[len++] = COAP_SIGNALING_CODE_CSM;
+  len += tcp_put_request(buf + len, sizeof(buf) - len, 1, 0);
+  len += tcp_put_request(buf + len, sizeof(buf) - len, 2, 10);
+  len += tcp_put_request(buf + len, sizeof(buf) - len, 3, 300);
+  CU_ASSERT(send(fd, buf, len, 0) == (ssize_t)len);
+  t_session10_process(c, 3);
+  CU_ASSERT(tcp_put_count == 3);
+  CU_ASSERT(tcp_put_good);
+  CU_ASSERT(tcp_put_len == 300);
+
+  /* A request larger than COAP_RXBUFFER_SIZE, a few bytes at a time */
+  n = tcp_put_request(buf, sizeof(buf), 4, 5000);
+  CU_ASSERT_FATAL(n > 5000);
+  for (off = 0; off < n; off += 700) {
+    len = n - off < 700 ? n - off : 700;
+    CU_ASSERT(send(fd, buf + off, len, 0) == (ssize_t)len);
+    coap_io_process(c, COAP_IO_NO_WAIT);
+  }
+  t_session10_process(c, 4);
+  CU_ASSERT(tcp_put_count == 4);
+  CU_ASSERT(tcp_put_good);
+  CU_ASSERT(tcp_put_len == 5000);
+
+  /* A request split just after the first byte of its header */
+  n = tcp_put_request(buf, sizeof(buf), 5, 20);
+  CU_ASSERT(send(fd, buf, 1, 0) == 1);
+  coap_io_process(c, COAP_IO_NO_WAIT);
+  CU_ASSERT(send(fd, buf + 1, n - 1, 0) == (ssize_t)(n - 1));
+  t_session10_process(c, 5);
+  CU_ASSERT(tcp_put_count == 5);
+  CU_ASSERT(tcp_put_good);
+  CU_ASSERT(tcp_put_len == 20);
+
+  close(fd);
+  coap_free_context(c);
+}
+
+#define STREAM_BLOCKS 12
+
+static uint8_t stream_body[STREAM_BLOCKS * 16];
+static size_t stream_next;
+static int stream_good;
+static int stream_fail;
+static int stream_put_count;
+
+static int
+stream_data(coap_session_t *s COAP_UNUSED,
+            const coap_pdu_t *pdu COAP_UNUSED,
+            size_t offset, const uint8_t *data, size_t length,
+            size_t total) {
+  if (stream_fail)
+    return 0;
+  if (offset != stream_next || offset + length > sizeof(stream_body) ||
+      total != sizeof(stream_body))
+    stream_good = 0;
+  else
+    memcpy(stream_body + offset, data, length);
+  stream_next = offset + length;
+  return 1;
+}
+
+static void
+hnd_put_stream(coap_resource_t *resource COAP_UNUSED,
+               coap_session_t *s COAP_UNUSED,
+               const coap_pdu_t *request,
+               const coap_string_t *query COAP_UNUSED,
+               coap_pdu_t *response) {
+  coap_opt_iterator_t opt_iter;
+  size_t len;
+  const uint8_t *data;
+
+  stream_put_count++;
+  /* The data has all been streamed, so is not presented again */
+  if (coap_get_data(request, &len, &data) ||
+      coap_check_option(request, COAP_OPTION_BLOCK1, &opt_iter))
+    stream_good = 0;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+/* Sends a CON PUT /stream carrying 16 byte block num of the body */
+static void
+receive_block1(coap_session_t *s, unsigned int num) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_CODE_PUT,
+                                  0x2000 + num + (stream_fail ? 0x100 : 0),
+                                  64);
+  uint8_t buf[64];
+  uint8_t opt[4];
+  uint8_t *data;
+  size_t len;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_add_token(pdu, 2, (const uint8_t *)"st");
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 6, (const uint8_t *)"stream");
+  coap_add_option(pdu, COAP_OPTION_BLOCK1,
+                  coap_encode_var_safe(opt, sizeof(opt),
+                                       (num << 4) |
+                                       (num + 1 < STREAM_BLOCKS ? 0x08 : 0)),
+                  opt);
+  coap_add_option(pdu, COAP_OPTION_SIZE1,
+                  coap_encode_var_safe(opt, sizeof(opt), sizeof(stream_body)),
+                  opt);
+  data = coap_add_data_after(pdu, 16);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+  for (len = 0; len < 16; len++)
+    data[len] = (uint8_t)(num * 16 + len);
+  CU_ASSERT_FATAL(coap_pdu_encode_header(pdu, COAP_PROTO_UDP) > 0);
+  len = pdu->used_size + pdu->hdr_size;
+  memcpy(buf, pdu->token - pdu->hdr_size, len);
+  coap_delete_pdu(pdu);
+
+  sent_len = 0;
+  coap_handle_dgram(ctx, s, buf, len);
+}
+
+/* Test 11 checks that a Block1 body is streamed in order to the block data
+ * handler, with the blocks that arrive early held back */
+static void
+t_session11(void) {
+  coap_endpoint_t *ep = ctx->endpoint;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_tick_t now;
+  size_t i;
+  unsigned int num;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  coap_context_set_block_mode(ctx, COAP_BLOCK_USE_LIBCOAP);
+  coap_register_block_data_handler(ctx, stream_data);
+  r = coap_resource_init(coap_make_str_const("stream"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put_stream);
+  coap_add_resource(ctx, r);
+  ctx->network_send = capture_send;
+
+  coap_ticks(&now);
+  s = fake_peer(ep, 30011, now);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  coap_session_reference(s);
+  stream_good = 1;
+
+  receive_block1(s, 0);
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE(231));
+  CU_ASSERT(stream_next == 16);
+  /* Block 2 is held back until block 1 arrives */
+  receive_block1(s, 2);
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE(231));
+  CU_ASSERT(stream_next == 16);
+  /* Block 11 is too far ahead to be held back */
+  receive_block1(s, STREAM_BLOCKS - 1);
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE(408));
+  receive_block1(s, 1);
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE(231));
+  CU_ASSERT(stream_next == 48);
+  for (num = 3; num < STREAM_BLOCKS - 1; num++)
+    receive_block1(s, num);
+  CU_ASSERT(stream_put_count == 0);
+  receive_block1(s, STREAM_BLOCKS - 1);
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE_CHANGED);
+  CU_ASSERT(stream_put_count == 1);
+  CU_ASSERT(stream_next == sizeof(stream_body));
+  CU_ASSERT(stream_good);
+  for (i = 0; i < sizeof(stream_body); i++) {
+    if (stream_body[i] != (uint8_t)i)
+      break;
+  }
+  CU_ASSERT(i == sizeof(stream_body));
+  CU_ASSERT_PTR_NULL(s->lg_srcv);
+
+  /* The transfer is abandoned if the handler does not take the data */
+  stream_fail = 1;
+  receive_block1(s, 0);
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE(500));
+  CU_ASSERT_PTR_NULL(s->lg_srcv);
+  CU_ASSERT(stream_put_count == 1);
+  stream_fail = 0;
+
+  coap_session_release(s);
+  ctx->network_send = coap_network_send;
+  coap_delete_resource(ctx, r);
+  coap_register_block_data_handler(ctx, NULL);
+  coap_context_set_block_mode(ctx, 0);
+}
+
+static int body_put_count;
+static int body_good;
+
+static void
+hnd_put_body(coap_resource_t *resource COAP_UNUSED,
+             coap_session_t *s COAP_UNUSED,
+             const coap_pdu_t *request,
+             const coap_string_t *query COAP_UNUSED,
+             coap_pdu_t *response) {
+  size_t len, offset, total, i;
+  const uint8_t *data;
+
+  body_put_count++;
+  body_good = coap_get_data_large(request, &len, &data, &offset, &total) &&
+              offset == 0 && len == sizeof(stream_body) && total == len;
+  for (i = 0; body_good && i < len; i++) {
+    if (data[i] != (uint8_t)i)
+      body_good = 0;
+  }
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+/* Test 12 checks that a Block1 body is re-assembled when every other block
+ * is missing until the rest have arrived */
+static void
+t_session12(void) {
+  coap_endpoint_t *ep = ctx->endpoint;
+  coap_resource_t *r;
+  coap_session_t *s;
+  coap_tick_t now;
+  unsigned int num;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  coap_context_set_block_mode(ctx, COAP_BLOCK_USE_LIBCOAP |
+                                   COAP_BLOCK_SINGLE_BODY);
+  r = coap_resource_init(coap_make_str_const("stream"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put_body);
+  coap_add_resource(ctx, r);
+  ctx->network_send = capture_send;
+
+  coap_ticks(&now);
+  s = fake_peer(ep, 30012, now);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s);
+  coap_session_reference(s);
+
+  /* Leaves more gaps than the old list of ranges could track */
+  for (num = 0; num < STREAM_BLOCKS - 1; num += 2) {
+    receive_block1(s, num);
+    CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE(231));
+  }
+  CU_ASSERT_PTR_NOT_NULL_FATAL(s->lg_srcv);
+  CU_ASSERT(coap_rblock_next_missing(&s->lg_srcv->rec_blocks, 0) == 1);
+  CU_ASSERT(coap_rblock_next_missing(&s->lg_srcv->rec_blocks, 4) == 5);
+  for (num = 1; num < STREAM_BLOCKS - 1; num += 2) {
+    receive_block1(s, num);
+    CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE(231));
+  }
+  CU_ASSERT(coap_rblock_next_missing(&s->lg_srcv->rec_blocks, 0) ==
+            STREAM_BLOCKS - 1);
+  CU_ASSERT(body_put_count == 0);
+  receive_block1(s, STREAM_BLOCKS - 1);
+  CU_ASSERT(sent_data[1] == COAP_RESPONSE_CODE_CHANGED);
+  CU_ASSERT(body_put_count == 1);
+  CU_ASSERT(body_good);
+  CU_ASSERT_PTR_NULL(s->lg_srcv);
+
+  coap_session_release(s);
+  ctx->network_send = coap_network_send;
+  coap_delete_resource(ctx, r);
+  coap_context_set_block_mode(ctx, 0);
+}
+
+/*
+ * A link between two contexts that holds back each datagram for a delay,
+ * and loses a share of them, for the Q-Block tests
+ */
+#define LINK_MAX_QUEUED 256
+
+typedef struct link_dgram_t {
+  coap_tick_t due;
+  coap_socket_t *sock;
+  const coap_session_t *session;
+  size_t length;
+  uint8_t data[COAP_RXBUFFER_SIZE];
+} link_dgram_t;
+
+static link_dgram_t link_queue[LINK_MAX_QUEUED];
+static unsigned int link_count;
+static unsigned int link_dropped;
+static unsigned int link_loss; /* percent */
+static coap_tick_t link_delay;
+static uint32_t link_rng;
+
+static ssize_t
+link_send(coap_socket_t *sock, const coap_session_t *s,
+          const uint8_t *data, size_t datalen) {
+  link_dgram_t *d;
+
+  link_rng = link_rng * 1103515245 + 12345;
+  if ((link_rng >> 16) % 100 < link_loss ||
+      link_count == LINK_MAX_QUEUED || datalen > sizeof(d->data)) {
+    link_dropped++;
+    return (ssize_t)datalen;
+  }
+  d = &link_queue[link_count++];
+  coap_ticks(&d->due);
+  d->due += link_delay;
+  d->sock = sock;
+  d->session = s;
+  d->length = datalen;
+  memcpy(d->data, data, datalen);
+  return (ssize_t)datalen;
+}
+
+static void
+link_setup(coap_context_t *a, coap_context_t *b, unsigned int delay_ms,
+           unsigned int loss, uint32_t seed) {
+  link_count = 0;
+  link_dropped = 0;
+  link_delay = delay_ms * COAP_TICKS_PER_SECOND / 1000;
+  link_loss = loss;
+  link_rng = seed;
+  a->network_send = link_send;
+  b->network_send = link_send;
+}
+
+/* Sends the datagrams that are due, or drops all of them if flush is set */
+static void
+link_deliver(int flush) {
+  coap_tick_t now;
+  unsigned int i;
+
+  coap_ticks(&now);
+  for (i = 0; i < link_count && (flush || link_queue[i].due <= now); i++) {
+    link_dgram_t *d = &link_queue[i];
+
+    if (!flush)
+      coap_network_send(d->sock, d->session, d->data, d->length);
+  }
+  link_count -= i;
+  memmove(link_queue, &link_queue[i], link_count * sizeof(link_queue[0]));
+}
+
+/* Makes the server sessions ask for missing blocks as quickly as the client */
+static void
+link_tune_sessions(coap_endpoint_t *ep, coap_session_t *client) {
+  coap_session_t *sp, *rtmp;
+
+  SESSIONS_ITER(ep->sessions, sp, rtmp) {
+    coap_session_set_non_timeout(sp, coap_session_get_non_timeout(client));
+    coap_session_set_non_receive_timeout(sp,
+                                coap_session_get_non_receive_timeout(client));
+  }
+}
+
+/* Runs both contexts over the link until *done is set or for up to ms */
+static void
+link_run(coap_context_t *server, coap_context_t *client, coap_endpoint_t *ep,
+         coap_session_t *cs, const int *done, unsigned int ms) {
+  coap_tick_t start, now;
+
+  coap_ticks(&start);
+  do {
+    link_deliver(0);
+    coap_io_process(server, COAP_IO_NO_WAIT);
+    link_tune_sessions(ep, cs);
+    coap_io_process(client, 1);
+    coap_ticks(&now);
+  } while (!*done && now - start < ms * COAP_TICKS_PER_SECOND / 1000);
+}
+
+#define Q_BODY_SIZE (24 * 1024)
+
+static uint8_t q_body[Q_BODY_SIZE];
+static int q_put_count;
+static int q_put_good;
+static int q_got_response;
+static coap_pdu_code_t q_code;
+static int q_get_good;
+
+static void
+hnd_put_q(coap_resource_t *resource COAP_UNUSED,
+          coap_session_t *s COAP_UNUSED,
+          const coap_pdu_t *request,
+          const coap_string_t *query COAP_UNUSED,
+          coap_pdu_t *response) {
+  size_t len, offset, total;
+  const uint8_t *data;
+
+  q_put_count++;
+  q_put_good = coap_get_data_large(request, &len, &data, &offset, &total) &&
+               offset == 0 && len == sizeof(q_body) && total == len &&
+               memcmp(data, q_body, len) == 0;
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CHANGED);
+}
+
+static void
+hnd_get_q(coap_resource_t *resource,
+          coap_session_t *s,
+          const coap_pdu_t *request,
+          const coap_string_t *query,
+          coap_pdu_t *response) {
+  coap_pdu_set_code(response, COAP_RESPONSE_CODE_CONTENT);
+  coap_add_data_large_response(resource, s, request, response, query,
+                               COAP_MEDIATYPE_APPLICATION_OCTET_STREAM, -1, 0,
+                               sizeof(q_body), q_body, NULL, NULL);
+}
+
+static coap_response_t
+q_response(coap_session_t *s COAP_UNUSED,
+           const coap_pdu_t *sent COAP_UNUSED,
+           const coap_pdu_t *received,
+           const coap_mid_t mid COAP_UNUSED) {
+  size_t len, offset, total;
+  const uint8_t *data;
+
+  q_got_response = 1;
+  q_code = coap_pdu_get_code(received);
+  if (q_code == COAP_RESPONSE_CODE_CONTENT)
+    q_get_good = coap_get_data_large(received, &len, &data, &offset,
+                                     &total) &&
+                 offset == 0 && len == sizeof(q_body) && total == len &&
+                 memcmp(data, q_body, len) == 0;
+  return COAP_RESPONSE_OK;
+}
+
+static coap_pdu_t *
+q_request(coap_session_t *cs, coap_pdu_code_t code) {
+  coap_pdu_t *pdu = coap_new_pdu(COAP_MESSAGE_NON, code, cs);
+  uint8_t token[8];
+  size_t len;
+
+  if (!pdu)
+    return NULL;
+  coap_session_new_token(cs, &len, token);
+  coap_add_token(pdu, len, token);
+  coap_add_option(pdu, COAP_OPTION_URI_PATH, 1, (const uint8_t *)"q");
+  return pdu;
+}
+
+/* Test 13 checks that Q-Block1 and Q-Block2 bodies get through a link that
+ * delays and loses datagrams */
+static void
+t_session13(void) {
+  coap_context_t *server;
+  coap_context_t *client;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *cs;
+  coap_address_t addr;
+  coap_pdu_t *pdu;
+  coap_fixed_point_t non_timeout = { 0, 50 };
+  coap_fixed_point_t non_receive_timeout = { 0, 100 };
+  coap_fixed_point_t ack_timeout = { 0, 100 };
+  int attempt;
+  size_t i;
+
+  for (i = 0; i < sizeof(q_body); i++)
+    q_body[i] = (uint8_t)(i * 7 + (i >> 10));
+  server = coap_new_context(NULL);
+  client = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(client);
+  coap_address_init(&addr);
+  addr.size = sizeof(struct sockaddr_in);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ep = coap_new_endpoint(server, &addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  r = coap_resource_init(coap_make_str_const("q"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put_q);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get_q);
+  coap_add_resource(server, r);
+  coap_context_set_block_mode(server, COAP_BLOCK_USE_LIBCOAP |
+                                      COAP_BLOCK_SINGLE_BODY |
+                                      COAP_BLOCK_TRY_Q_BLOCK);
+  coap_context_set_block_mode(client, COAP_BLOCK_USE_LIBCOAP |
+                                      COAP_BLOCK_SINGLE_BODY |
+                                      COAP_BLOCK_TRY_Q_BLOCK);
+  coap_register_response_handler(client, q_response);
+  cs = coap_new_client_session(client, NULL, &ep->bind_addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cs);
+  /* Short timeouts keep the whole test well under a second */
+  coap_session_set_non_timeout(cs, non_timeout);
+  coap_session_set_non_receive_timeout(cs, non_receive_timeout);
+  CU_ASSERT(fpeq(coap_session_get_non_timeout(cs), non_timeout));
+  CU_ASSERT(fpeq(coap_session_get_non_receive_timeout(cs),
+                 non_receive_timeout));
+  /* MAX_PAYLOADS is kept within range */
+  coap_session_set_max_payloads(cs, 0);
+  coap_session_set_max_payloads(cs, COAP_MAX_PAYLOADS_LIMIT + 1);
+  CU_ASSERT(coap_session_get_max_payloads(cs) == COAP_DEFAULT_MAX_PAYLOADS);
+  /* The probe for Q-Block support is a CON request */
+  coap_session_set_ack_timeout(cs, ack_timeout);
+  link_setup(server, client, 5, 10, 12345);
+
+  /* The first request waits for the probe that finds Q-Block support */
+  pdu = q_request(cs, COAP_REQUEST_CODE_DELETE);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_pdu_set_type(pdu, COAP_MESSAGE_CON);
+  CU_ASSERT(coap_send(cs, pdu) != COAP_INVALID_MID);
+  CU_ASSERT(cs->block_mode & COAP_BLOCK_PROBE_Q_BLOCK);
+  link_run(server, client, ep, cs, &q_got_response, 2000);
+  CU_ASSERT(q_code == COAP_RESPONSE_CODE(405));
+  CU_ASSERT(cs->block_mode & COAP_BLOCK_HAS_Q_BLOCK);
+  /* 1024 byte blocks fit into a PDU of the default MTU */
+  CU_ASSERT(coap_block_q_block2_szx(cs) == 6);
+  q_got_response = 0;
+
+  /* The body is sent in bursts, with the lost blocks sent again */
+  pdu = q_request(cs, COAP_REQUEST_CODE_PUT);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  CU_ASSERT_FATAL(coap_add_data_large_request(cs, pdu, sizeof(q_body), q_body,
+                                              NULL, NULL));
+  CU_ASSERT(coap_send(cs, pdu) != COAP_INVALID_MID);
+  link_run(server, client, ep, cs, &q_got_response, 2000);
+  CU_ASSERT(q_got_response);
+  CU_ASSERT(q_code == COAP_RESPONSE_CODE_CHANGED);
+  CU_ASSERT(q_put_count == 1);
+  CU_ASSERT(q_put_good);
+
+  /* Asked for in bursts, with the lost blocks asked for again */
+  for (attempt = 0; attempt < 3 && !q_get_good; attempt++) {
+    /* Like an application, try again if the request itself is lost */
+    q_got_response = 0;
+    pdu = q_request(cs, COAP_REQUEST_CODE_GET);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+    CU_ASSERT(coap_send(cs, pdu) != COAP_INVALID_MID);
+    link_run(server, client, ep, cs, &q_got_response, 500);
+  }
+  CU_ASSERT(q_code == COAP_RESPONSE_CODE_CONTENT);
+  CU_ASSERT(q_get_good);
+  CU_ASSERT(link_dropped > 0);
+
+  link_deliver(1);
+  coap_session_release(cs);
+  coap_free_context(client);
+  coap_free_context(server);
+}
+
+/* Test 14 checks that a client falls back to Block1 and Block2 when the
+ * server rejects the Q-Block probe */
+static void
+t_session14(void) {
+  coap_context_t *server;
+  coap_context_t *client;
+  coap_endpoint_t *ep;
+  coap_resource_t *r;
+  coap_session_t *cs;
+  coap_address_t addr;
+  coap_pdu_t *pdu;
+  coap_opt_iterator_t opt_iter;
+
+  q_got_response = 0;
+  q_put_count = 0;
+  q_put_good = 0;
+  q_get_good = 0;
+  server = coap_new_context(NULL);
+  client = coap_new_context(NULL);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(client);
+  coap_address_init(&addr);
+  addr.size = sizeof(struct sockaddr_in);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ep = coap_new_endpoint(server, &addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  r = coap_resource_init(coap_make_str_const("q"), 0);
+  coap_register_handler(r, COAP_REQUEST_PUT, hnd_put_q);
+  coap_register_handler(r, COAP_REQUEST_GET, hnd_get_q);
+  coap_add_resource(server, r);
+  /* An RFC7959 only server */
+  coap_context_set_block_mode(server, COAP_BLOCK_USE_LIBCOAP |
+                                      COAP_BLOCK_SINGLE_BODY);
+  coap_context_set_block_mode(client, COAP_BLOCK_USE_LIBCOAP |
+                                      COAP_BLOCK_SINGLE_BODY |
+                                      COAP_BLOCK_TRY_Q_BLOCK);
+  coap_register_response_handler(client, q_response);
+  cs = coap_new_client_session(client, NULL, &ep->bind_addr, COAP_PROTO_UDP);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(cs);
+  link_setup(server, client, 1, 0, 12345);
+
+  /* The probe gets a 4.02 (Bad Option), which the app does not see */
+  pdu = q_request(cs, COAP_REQUEST_CODE_DELETE);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  coap_pdu_set_type(pdu, COAP_MESSAGE_CON);
+  CU_ASSERT(coap_send(cs, pdu) != COAP_INVALID_MID);
+  link_run(server, client, ep, cs, &q_got_response, 1000);
+  CU_ASSERT(q_code == COAP_RESPONSE_CODE(405));
+  CU_ASSERT((cs->block_mode & (COAP_BLOCK_TRY_Q_BLOCK |
+                               COAP_BLOCK_PROBE_Q_BLOCK |
+                               COAP_BLOCK_HAS_Q_BLOCK)) == 0);
+
+  /* Bodies then go with Block1 and Block2 */
+  q_got_response = 0;
+  pdu = q_request(cs, COAP_REQUEST_CODE_PUT);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  CU_ASSERT_FATAL(coap_add_data_large_request(cs, pdu, sizeof(q_body), q_body,
+                                              NULL, NULL));
+  CU_ASSERT_PTR_NOT_NULL(coap_check_option(pdu, COAP_OPTION_BLOCK1,
+                                           &opt_iter));
+  CU_ASSERT(coap_send(cs, pdu) != COAP_INVALID_MID);
+  link_run(server, client, ep, cs, &q_got_response, 2000);
+  CU_ASSERT(q_code == COAP_RESPONSE_CODE_CHANGED);
+  CU_ASSERT(q_put_good);
+
+  q_got_response = 0;
+  pdu = q_request(cs, COAP_REQUEST_CODE_GET);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(pdu);
+  CU_ASSERT(coap_send(cs, pdu) != COAP_INVALID_MID);
+  link_run(server, client, ep, cs, &q_got_response, 2000);
+  CU_ASSERT(q_code == COAP_RESPONSE_CODE_CONTENT);
+  CU_ASSERT(q_get_good);
+
+  link_deliver(1);
+  coap_session_release(cs);
+  coap_free_context(client);
+  coap_free_context(server);
+}
+
+#if COAP_SEND_BATCH_SUPPORT
+/* Test 15 checks that a queued datagram that cannot be sent fails the next
+ * send for its own session only, not for other peers on the endpoint */
+static void
+t_session15(void) {
+  coap_endpoint_t *ep = ctx->endpoint;
+  coap_session_t *bad, *good;
+  static const uint8_t data[4] = { 0x50, 0x01, 0x00, 0x01 };
+  coap_tick_t now;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+  coap_ticks(&now);
+  /* Nothing can be sent to port 0 */
+  bad = fake_peer(ep, 0, now);
+  good = fake_peer(ep, 30020, now);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(bad);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(good);
+  coap_session_reference(bad);
+  coap_session_reference(good);
+  coap_context_set_max_send_batch(ctx, 4);
+
+  CU_ASSERT(coap_socket_send(&ep->sock, bad, data, sizeof(data)) ==
+            (ssize_t)sizeof(data));
+  CU_ASSERT(coap_socket_send(&ep->sock, good, data, sizeof(data)) ==
+            (ssize_t)sizeof(data));
+  coap_send_batch_flush(ctx);
+  CU_ASSERT(bad->send_error != 0);
+  CU_ASSERT(good->send_error == 0);
+
+  CU_ASSERT(coap_socket_send(&ep->sock, good, data, sizeof(data)) ==
+            (ssize_t)sizeof(data));
+  CU_ASSERT(coap_socket_send(&ep->sock, bad, data, sizeof(data)) == -1);
+  CU_ASSERT(bad->send_error == 0);
+
+  coap_context_set_max_send_batch(ctx, 0);
+  coap_session_release(good);
+  coap_session_release(bad);
+}
+#endif /* COAP_SEND_BATCH_SUPPORT */
+#endif /* COAP_SERVER_SUPPORT */
+
 /* This function creates a set of nodes for testing. These nodes
  * will exist for all tests and are modified by coap_insert_node()
  * and coap_remove_from_queue().
@@ -220,6 +1270,19 @@ t_init_session_tests(void) {
   SESSION_TEST(suite, t_session4);
   SESSION_TEST(suite, t_session5);
   SESSION_TEST(suite, t_session6);
+#if COAP_SERVER_SUPPORT
+  SESSION_TEST(suite, t_session7);
+  SESSION_TEST(suite, t_session8);
+  SESSION_TEST(suite, t_session9);
+  SESSION_TEST(suite, t_session10);
+  SESSION_TEST(suite, t_session11);
+  SESSION_TEST(suite, t_session12);
+  SESSION_TEST(suite, t_session13);
+  SESSION_TEST(suite, t_session14);
+#if COAP_SEND_BATCH_SUPPORT
+  SESSION_TEST(suite, t_session15);
+#endif /* COAP_SEND_BATCH_SUPPORT */
+#endif /* COAP_SERVER_SUPPORT */
 
   return suite;
 }
@@ -11,6 +11,8 @@
 #include "test_common.h"
 #include "test_tls.h"
 
+#include <unistd.h>
+
 #undef HAVE_DTLS
 
 #ifdef HAVE_LIBTINYDTLS
@@ -97,6 +99,119 @@ t_tls2(void) {
   CU_ASSERT(version.type == v->type);
 }
 
+#if defined(HAVE_DTLS) && COAP_SERVER_SUPPORT && COAP_CLIENT_SUPPORT
+/*
+ * Sets up a DTLS session to the server, with SNI @p sni if not NULL, and
+ * closes it again, returning -1 if the handshake did not complete, else
+ * whether it resumed an earlier session.
+ */
+static int
+t_tls3_connect(coap_context_t *server, coap_context_t *client,
+               const coap_address_t *addr, const char *sni) {
+  coap_dtls_cpsk_t cpsk;
+  coap_session_t *session;
+  int resumed = -1;
+  int i;
+
+  memset(&cpsk, 0, sizeof(cpsk));
+  cpsk.version = COAP_DTLS_CPSK_SETUP_VERSION;
+  cpsk.session_resumption = 1;
+  cpsk.client_sni = (char *)sni;
+  cpsk.psk_info.identity.s = (const uint8_t *)"client";
+  cpsk.psk_info.identity.length = 6;
+  cpsk.psk_info.key.s = (const uint8_t *)"secret";
+  cpsk.psk_info.key.length = 6;
+  session = coap_new_client_session_psk2(client, NULL, addr, COAP_PROTO_DTLS,
+                                         &cpsk);
+  if (!session)
+    return -1;
+  for (i = 0; i < 200 && session->state == COAP_SESSION_STATE_HANDSHAKE; i++) {
+    coap_io_process(server, COAP_IO_NO_WAIT);
+    coap_io_process(client, 10);
+  }
+  if (session->state == COAP_SESSION_STATE_ESTABLISHED)
+    resumed = session->dtls_resumed;
+  coap_session_release(session);
+  coap_io_process(server, COAP_IO_NO_WAIT);
+  return resumed;
+}
+
+static void
+t_tls3(void) {
+  coap_context_t *server = coap_new_context(NULL);
+  coap_context_t *client = coap_new_context(NULL);
+  coap_dtls_spsk_t spsk;
+  coap_address_t addr;
+  coap_endpoint_t *ep;
+  int resumed;
+
+  CU_ASSERT_PTR_NOT_NULL_FATAL(server);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(client);
+  memset(&spsk, 0, sizeof(spsk));
+  spsk.version = COAP_DTLS_SPSK_SETUP_VERSION;
+  spsk.session_resumption = 1;
+  spsk.psk_info.key.s = (const uint8_t *)"secret";
+  spsk.psk_info.key.length = 6;
+  CU_ASSERT_FATAL(coap_context_set_psk2(server, &spsk) == 1);
+  coap_address_init(&addr);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.size = sizeof(struct sockaddr_in);
+  ep = coap_new_endpoint(server, &addr, COAP_PROTO_DTLS);
+  CU_ASSERT_PTR_NOT_NULL_FATAL(ep);
+
+  /* A full handshake, and then one that resumes the session */
+  CU_ASSERT(t_tls3_connect(server, client, &ep->bind_addr, "a") == 0);
+  resumed = t_tls3_connect(server, client, &ep->bind_addr, "a");
+#if defined(HAVE_LIBTINYDTLS)
+  CU_ASSERT(resumed == 0);
+#elif defined(HAVE_MBEDTLS)
+  CU_ASSERT(resumed >= 0);
+#else /* HAVE_OPENSSL || HAVE_LIBGNUTLS */
+  CU_ASSERT_PTR_NOT_NULL(client->dtls_resume);
+  CU_ASSERT(resumed == 1);
+#endif /* HAVE_OPENSSL || HAVE_LIBGNUTLS */
+
+  /* A session for another SNI does not resume it */
+  CU_ASSERT(t_tls3_connect(server, client, &ep->bind_addr, "b") == 0);
+
+  coap_free_context(client);
+  coap_free_context(server);
+}
+#endif /* HAVE_DTLS && COAP_SERVER_SUPPORT && COAP_CLIENT_SUPPORT */
+
+#if COAP_CLIENT_SUPPORT && defined(HAVE_SYS_STAT_H)
+/* Test 4 checks that a PEM file rewritten in place changes the credentials
+ * that a client session is resumed by */
+static void
+t_tls4(void) {
+  char name[] = "/tmp/t_tls4_XXXXXX";
+  coap_session_t session;
+  coap_dtls_pki_t pki;
+  uint64_t first;
+  int fd = mkstemp(name);
+
+  CU_ASSERT_FATAL(fd >= 0);
+  CU_ASSERT(write(fd, "a", 1) == 1);
+  memset(&session, 0, sizeof(session));
+  memset(&pki, 0, sizeof(pki));
+  pki.pki_key.key_type = COAP_PKI_KEY_PEM;
+  pki.pki_key.key.pem.public_cert = name;
+  pki.pki_key.key.pem.private_key = name;
+  coap_dtls_resume_setup_pki(&session, &pki);
+  first = session.dtls_resume_setup;
+  coap_dtls_resume_setup_pki(&session, &pki);
+  CU_ASSERT(session.dtls_resume_setup == first);
+
+  CU_ASSERT(write(fd, "b", 1) == 1);
+  coap_dtls_resume_setup_pki(&session, &pki);
+  CU_ASSERT(session.dtls_resume_setup != first);
+
+  close(fd);
+  unlink(name);
+}
+#endif /* COAP_CLIENT_SUPPORT && HAVE_SYS_STAT_H */
+
 static int
 t_tls_tests_create(void) {
   coap_startup();
@@ -123,6 +238,12 @@ t_init_tls_tests(void) {
 
   TLS_TEST(suite, t_tls1);
   TLS_TEST(suite, t_tls2);
+#if defined(HAVE_DTLS) && COAP_SERVER_SUPPORT && COAP_CLIENT_SUPPORT
+  TLS_TEST(suite, t_tls3);
+#endif /* HAVE_DTLS && COAP_SERVER_SUPPORT && COAP_CLIENT_SUPPORT */
+#if COAP_CLIENT_SUPPORT && defined(HAVE_SYS_STAT_H)
+  TLS_TEST(suite, t_tls4);
+#endif /* COAP_CLIENT_SUPPORT && HAVE_SYS_STAT_H */
 
   return suite;
 }
@@ -22,6 +22,7 @@
 #include "test_session.h"
 #include "test_sendqueue.h"
 #include "test_wellknown.h"
+#include "test_cache.h"
 #include "test_tls.h"
 
 int
@@ -46,6 +47,7 @@ main(int argc COAP_UNUSED, char **argv COAP_UNUSED) {
 #endif /* COAP_CLIENT_SUPPORT */
 #if COAP_SERVER_SUPPORT && COAP_CLIENT_SUPPORT
   t_init_wellknown_tests();
+  t_init_cache_tests();
 #endif /* COAP_SERVER_SUPPORT && COAP_CLIENT_SUPPORT */
   t_init_tls_tests();
 
@@ -34,6 +34,7 @@ extern "C" {
 #include "coap3/coap_io.h"
 #include "coap3/coap_option.h"
 #include "coap3/coap_prng.h"
+#include "coap3/coap_shard.h"
 #include "coap3/coap_subscribe.h"
 #include "coap3/coap_time.h"
 #include "coap3/encode.h"
@@ -0,0 +1,225 @@
+# Copyright (c) 2014-present PlatformIO <contact@platformio.org>
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Times the esp32_exception_decoder monitor filter over a recorded panic log.
+
+The log (a panic with a 30 frame backtrace, unless given) is replayed a number
+of times, as in a crash storm.  Each backtrace is decoded with one addr2line
+call per address, as the filter used to do, and with the filter as it is now.
+Reports the time taken to decode, and the longest time that rx() held up the
+monitor for, and checks that both give the same traces, including the last
+ones, which the worker has to write out as no more text comes in.  Addresses
+only resolve against the firmware that printed the log, but each costs a
+lookup either way.
+
+Usage (with the Python that PlatformIO runs on):
+    python bench_exception_decoder.py firmware.elf xtensa-esp32-elf-addr2line \
+        [panic.log [repeats]]
+"""
+
+import os
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from filter_exception_decoder import (  # noqa: E402 pylint: disable=wrong-import-position
+    IS_WINDOWS,
+    Esp32ExceptionDecoder,
+)
+
+PANIC_LOG = """\
+Guru Meditation Error: Core  1 panic'ed (LoadProhibited). Exception was unhandled.
+
+Core  1 register dump:
+PC      : 0x400d2f5a  PS      : 0x00060b30  A0      : 0x800d3a1c  A1      : 0x3ffb1e40
+A2      : 0x00000000  A3      : 0x3ffb1e8c  A4      : 0x00000001  A5      : 0x3ffc1a2c
+EXCVADDR: 0x00000000  LBEG    : 0x4000c2e0  LEND    : 0x4000c2f6  LCOUNT  : 0xffffffff
+
+Backtrace: 0x400d2f57:0x3ffb1e40 0x400d3a19:0x3ffb1e60 0x400d3b6e:0x3ffb1e90 \
+0x400d41c2:0x3ffb1eb0 0x400d4305:0x3ffb1ed0 0x400d4477:0x3ffb1f00 \
+0x400d45e1:0x3ffb1f20 0x400d4720:0x3ffb1f40 0x400d48a3:0x3ffb1f60 \
+0x400d4a12:0x3ffb1f80 0x400d4b9c:0x3ffb1fa0 0x400d4d0e:0x3ffb1fc0 \
+0x400d4e85:0x3ffb1fe0 0x400d5013:0x3ffb2000 0x400d519a:0x3ffb2020 \
+0x400d5321:0x3ffb2040 0x400d54b7:0x3ffb2060 0x400d5640:0x3ffb2080 \
+0x400d57c5:0x3ffb20a0 0x400d5952:0x3ffb20c0 0x400d5ad9:0x3ffb20e0 \
+0x400d5c63:0x3ffb2100 0x400d5df0:0x3ffb2120 0x400d5f74:0x3ffb2140 \
+0x400d6102:0x3ffb2160 0x400d628b:0x3ffb2180 0x400d6415:0x3ffb21a0 \
+0x400d659e:0x3ffb21c0 0x400d6727:0x3ffb21e0 0x4008e2a5:0x3ffb2200
+
+ELF file SHA256: 8c3f8b6f1e2a4d07
+
+Rebooting...
+ets Jun  8 2016 00:22:57
+
+rst:0xc (SW_CPU_RESET),boot:0x13 (SPI_FAST_FLASH_BOOT)
+"""
+
+
+class LegacyDecoder(Esp32ExceptionDecoder):
+    """Decodes as the filter used to, with one addr2line call per address"""
+
+    def build_backtrace(self, line, address_match):
+        addresses = self.filter_addresses(address_match)
+        if not addresses:
+            return ""
+
+        prefix_match = self.PREFIX_RE.match(line)
+        prefix = prefix_match.group(0) if prefix_match is not None else ""
+
+        trace = ""
+        enc = "mbcs" if IS_WINDOWS else "utf-8"
+        args = [self.addr2line_path, u"-fipC", u"-e", self.firmware_path]
+        i = 0
+        for addr in addresses:
+            output = subprocess.check_output(args + [addr]).decode(enc).strip()
+            output = output.replace("\n", "\n     ")
+            if output == "?? ??:0":
+                continue
+            output = self.strip_project_dir(output)
+            trace += "%s  #%-2d %s in %s\n" % (prefix, i, addr, output)
+            i += 1
+        return trace + "\n" if trace else ""
+
+
+def make_decoder(cls, firmware_path, addr2line_path):
+    # miniterm would call __init__() and __call__() with the project config
+    decoder = cls.__new__(cls)
+    decoder.project_dir = os.path.abspath(os.getcwd())
+    decoder.buffer = ""
+    decoder.firmware_path = firmware_path
+    decoder.addr2line_path = addr2line_path
+    decoder.setup_decoding()
+    decoder.enabled = True
+    return decoder
+
+
+def backtrace_lines(log):
+    for line in log.splitlines():
+        m = Esp32ExceptionDecoder.ADDR_PATTERN.search(line)
+        if m is not None:
+            yield line, m.group(1)
+
+
+def decode_all(decoder, log, repeats):
+    """Decodes each line in turn, as rx() used to"""
+    traces = []
+    longest = 0.0
+    start = time.time()
+    for _ in range(repeats):
+        for line, address_match in backtrace_lines(log):
+            line_start = time.time()
+            traces.append(decoder.build_backtrace(line, address_match))
+            longest = max(longest, time.time() - line_start)
+    return time.time() - start, longest, traces
+
+
+def replay_rx(decoder, log, repeats, chunk=64):
+    """Feeds the log to rx() as the serial port would, timing each call"""
+    longest = 0.0
+    output = ""
+    for _ in range(repeats):
+        for i in range(0, len(log), chunk):
+            start = time.time()
+            output += decoder.rx(log[i : i + chunk])
+            longest = max(longest, time.time() - start)
+    return longest, output
+
+
+def wait_flushed(decoder, written, timeout=10.0):
+    """Waits for the worker to write out the last traces with no more rx()"""
+    decoder.pending.join()
+    end = time.time() + timeout
+    while time.time() < end:
+        with decoder.lock:
+            if not decoder.decoded:
+                break
+        time.sleep(decoder.FLUSH_DELAY / 4)
+    return "".join(written)
+
+
+def report(label, seconds, backtraces, longest):
+    print(
+        "%-34s %8.3f s %9.1f lines/s, longest %8.3f ms"
+        % (label, seconds, backtraces / seconds if seconds else 0, longest * 1000)
+    )
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.stderr.write(__doc__)
+        return 1
+    firmware_path, addr2line_path = sys.argv[1:3]
+    log = PANIC_LOG
+    if len(sys.argv) > 3:
+        with open(sys.argv[3]) as fp:
+            log = fp.read()
+    repeats = max(2, int(sys.argv[4])) if len(sys.argv) > 4 else 10
+    per_log = len(list(backtrace_lines(log)))
+    print("%d lines with addresses per log, %d logs" % (per_log, repeats))
+
+    # the longest time a line took to decode was the longest hold up in rx()
+    legacy = make_decoder(LegacyDecoder, firmware_path, addr2line_path)
+    seconds, longest, expected = decode_all(legacy, log, repeats)
+    report("one addr2line call per address", seconds, per_log * repeats,
+           longest)
+
+    decoder = make_decoder(Esp32ExceptionDecoder, firmware_path, addr2line_path)
+    seconds, longest, traces = decode_all(decoder, log, 1)
+    report("addr2line process, cache cold", seconds, per_log, longest)
+    seconds, longest, more = decode_all(decoder, log, repeats - 1)
+    traces += more
+    report("addr2line process, cache warm", seconds, per_log * (repeats - 1),
+           longest)
+
+    # rx() only hands the lines over to the worker, and the board sends
+    # nothing after the last log, so the worker writes out the last traces
+    decoder = make_decoder(Esp32ExceptionDecoder, firmware_path, addr2line_path)
+    written = []
+    decoder.write_console = written.append
+    start = time.time()
+    longest, output = replay_rx(decoder, log, repeats)
+    report("rx(), decoded by the worker", time.time() - start,
+           per_log * repeats, longest)
+    output += wait_flushed(decoder, written)
+
+    if traces != expected:
+        print("MISMATCH: traces differ from one call per address")
+        return 1
+    # each trace is shown after the line it was decoded from
+    lines = [line for line, _ in backtrace_lines(log)] * repeats
+    missing = []
+    pos = 0
+    for line, t in zip(lines, expected):
+        if not t:
+            continue
+        line_pos = output.find(line, pos)
+        trace_pos = output.find(t, line_pos + 1) if line_pos != -1 else -1
+        if trace_pos == -1:
+            missing.append(t)
+        else:
+            pos = line_pos + 1
+    if missing:
+        print("MISMATCH: %d traces not shown after their lines" % len(missing))
+        return 1
+    if written:
+        print("%d traces written out by the worker after the last rx()"
+              % len(written))
+    print("traces match")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -13,9 +13,13 @@
 # limitations under the License.
 
 import os
+import queue
 import re
 import subprocess
 import sys
+import threading
+import time
+from collections import OrderedDict
 
 from platformio.exception import PlatformioException
 from platformio.public import (
@@ -29,6 +33,61 @@ from platformio.public import (
 IS_WINDOWS = sys.platform.startswith("win")
 
 
+class Addr2lineError(Exception):
+    pass
+
+
+class Addr2line(object):
+    """A long-lived addr2line process that resolves batches of addresses.
+
+    The addresses are written to its stdin, followed by SENTINEL, which is
+    not in any ELF, so that the end of the answer for the last real address
+    is known.  addr2line flushes its output after each address when reading
+    from stdin.
+    """
+
+    SENTINEL = "0x00000000"
+    RECORD_RE = re.compile(r"^(0x[0-9a-fA-F]+): ")
+
+    def __init__(self, addr2line_path, firmware_path, encoding):
+        self.encoding = encoding
+        self.proc = subprocess.Popen(
+            [addr2line_path, u"-afipC", u"-e", firmware_path],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+        )
+
+    def resolve(self, addresses):
+        """Returns the "function at file:line" output for each address"""
+        try:
+            self.proc.stdin.write(
+                ("\n".join(addresses + [self.SENTINEL]) + "\n").encode("ascii")
+            )
+            self.proc.stdin.flush()
+            records = []
+            while len(records) <= len(addresses):
+                line = self.proc.stdout.readline()
+                if not line:
+                    raise Addr2lineError("addr2line exited")
+                line = line.decode(self.encoding).rstrip("\r\n")
+                m = self.RECORD_RE.match(line)
+                if m is not None:
+                    records.append(line[m.end() :])
+                elif records:
+                    # newlines happen with inlined methods
+                    records[-1] += "\n" + line
+        except (IOError, OSError, ValueError) as e:
+            raise Addr2lineError(str(e))
+        return records[: len(addresses)]
+
+    def close(self):
+        try:
+            self.proc.stdin.close()
+            self.proc.wait()
+        except (IOError, OSError):
+            pass
+
+
 class Esp32ExceptionDecoder(DeviceMonitorFilterBase):
     NAME = "esp32_exception_decoder"
 
@@ -36,11 +95,19 @@ class Esp32ExceptionDecoder(DeviceMonitorFilterBase):
     ADDR_SPLIT = re.compile(r"[ :]")
     PREFIX_RE = re.compile(r"^ *")
 
+    # Addresses resolved, kept across backtraces for the same firmware
+    CACHE_SIZE = 4096
+
+    # Seconds without rx() after which decoded backtraces are written out by
+    # the worker, as a board that halted after a panic sends nothing more
+    FLUSH_DELAY = 0.2
+
     def __call__(self):
         self.buffer = ""
 
         self.firmware_path = None
         self.addr2line_path = None
+        self.setup_decoding()
         self.enabled = self.setup_paths()
 
         if self.config.get("env:" + self.environment, "build_type") != "debug":
@@ -54,6 +121,19 @@ See https://docs.platformio.org/page/projectconf/build_configurations.html
 
         return self
 
+    def setup_decoding(self):
+        self.addr2line = None
+        self.firmware_mtime = None
+        self.cache = OrderedDict()
+        # Backtraces are decoded by a worker so that rx() never waits on
+        # addr2line.  Decoded ones are shown by the next call to rx(), or
+        # by the worker once rx() has not been called for FLUSH_DELAY
+        self.pending = queue.Queue()
+        self.decoded = []
+        self.lock = threading.Lock()
+        self.last_rx = time.time()
+        self.worker = None
+
     def setup_paths(self):
         self.project_dir = os.path.abspath(self.project_dir)
         try:
@@ -88,30 +168,87 @@ See https://docs.platformio.org/page/projectconf/build_configurations.html
         if not self.enabled:
             return text
 
-        last = 0
-        while True:
-            idx = text.find("\n", last)
-            if idx == -1:
-                if len(self.buffer) < 4096:
-                    self.buffer += text[last:]
-                break
+        with self.lock:
+            self.last_rx = time.time()
+            text = self.insert_decoded(text)
 
-            line = text[last:idx]
-            if self.buffer:
-                line = self.buffer + line
-                self.buffer = ""
-            last = idx + 1
+            last = 0
+            while True:
+                idx = text.find("\n", last)
+                if idx == -1:
+                    if len(self.buffer) < 4096:
+                        self.buffer += text[last:]
+                    break
 
-            m = self.ADDR_PATTERN.search(line)
-            if m is None:
-                continue
+                line = text[last:idx]
+                if self.buffer:
+                    line = self.buffer + line
+                    self.buffer = ""
+                last = idx + 1
 
-            trace = self.build_backtrace(line, m.group(1))
-            if trace:
-                text = text[: idx + 1] + trace + text[idx + 1 :]
-                last += len(trace)
+                m = self.ADDR_PATTERN.search(line)
+                if m is None:
+                    continue
+
+                self.start_worker()
+                self.pending.put((line, m.group(1)))
         return text
 
+    def start_worker(self):
+        if self.worker is None:
+            self.worker = threading.Thread(target=self.decode_loop)
+            self.worker.daemon = True
+            self.worker.start()
+
+    def decode_loop(self):
+        while True:
+            try:
+                line, address_match = self.pending.get(timeout=self.FLUSH_DELAY)
+            except queue.Empty:
+                self.flush_decoded()
+                continue
+            trace = self.build_backtrace(line, address_match)
+            if trace:
+                with self.lock:
+                    self.decoded.append(trace)
+            self.pending.task_done()
+
+    def insert_decoded(self, text):
+        # called with the lock held
+        if not self.decoded:
+            return text
+
+        # keep the traces off a line that has been partly shown
+        idx = 0
+        if self.buffer:
+            idx = text.find("\n") + 1
+            if idx == 0:
+                return text
+        traces = "".join(self.decoded)
+        self.decoded = []
+        return text[:idx] + traces + text[idx:]
+
+    def flush_decoded(self):
+        with self.lock:
+            if not self.decoded or time.time() - self.last_rx < self.FLUSH_DELAY:
+                return
+            traces = "".join(self.decoded)
+            self.decoded = []
+            # end a line that has been partly shown
+            if self.buffer:
+                traces = "\n" + traces
+        self.write_console(traces)
+
+    def write_console(self, text):
+        terminal = None
+        if hasattr(self, "get_running_terminal"):
+            terminal = self.get_running_terminal()
+        if terminal is not None:
+            terminal.console.write(text)
+        else:
+            sys.stdout.write(text)
+            sys.stdout.flush()
+
     def is_address_ignored(self, address):
         return address in ("", "0x00000000")
 
@@ -131,37 +268,91 @@ See https://docs.platformio.org/page/projectconf/build_configurations.html
         prefix = prefix_match.group(0) if prefix_match is not None else ""
 
         trace = ""
-        enc = "mbcs" if IS_WINDOWS else "utf-8"
-        args = [self.addr2line_path, u"-fipC", u"-e", self.firmware_path]
         try:
-            i = 0
-            for addr in addresses:
-                output = (
-                    subprocess.check_output(args + [addr])
-                    .decode(enc)
-                    .strip()
-                )
-
-                # newlines happen with inlined methods
-                output = output.replace(
-                    "\n", "\n     "
-                )
-
-                # throw out addresses not from ELF
-                if output == "?? ??:0":
-                    continue
-
-                output = self.strip_project_dir(output)
-                trace += "%s  #%-2d %s in %s\n" % (prefix, i, addr, output)
-                i += 1
-        except subprocess.CalledProcessError as e:
+            outputs = self.resolve_addresses(addresses)
+        except (Addr2lineError, subprocess.CalledProcessError) as e:
             sys.stderr.write(
                 "%s: failed to call %s: %s\n"
                 % (self.__class__.__name__, self.addr2line_path, e)
             )
+            return ""
+
+        i = 0
+        for addr, output in zip(addresses, outputs):
+            output = output.strip()
+
+            # newlines happen with inlined methods
+            output = output.replace(
+                "\n", "\n     "
+            )
+
+            # throw out addresses not from ELF
+            if output == "?? ??:0":
+                continue
+
+            output = self.strip_project_dir(output)
+            trace += "%s  #%-2d %s in %s\n" % (prefix, i, addr, output)
+            i += 1
 
         return trace + "\n" if trace else ""
 
+    def resolve_addresses(self, addresses):
+        # a rebuilt firmware invalidates the process and everything cached
+        try:
+            mtime = os.path.getmtime(self.firmware_path)
+        except OSError:
+            mtime = None
+        if mtime != self.firmware_mtime:
+            self.firmware_mtime = mtime
+            self.cache.clear()
+            if self.addr2line is not None:
+                self.addr2line.close()
+                self.addr2line = None
+
+        missing = []
+        for addr in addresses:
+            if addr in self.cache:
+                self.cache.move_to_end(addr)
+            elif addr not in missing:
+                missing.append(addr)
+
+        if missing:
+            for addr, output in zip(missing, self.run_addr2line(missing)):
+                self.cache[addr] = output
+                if len(self.cache) > self.CACHE_SIZE:
+                    self.cache.popitem(last=False)
+
+        return [self.cache[addr] for addr in addresses]
+
+    def run_addr2line(self, addresses):
+        enc = "mbcs" if IS_WINDOWS else "utf-8"
+        for _ in range(2):
+            try:
+                if self.addr2line is None:
+                    self.addr2line = Addr2line(
+                        self.addr2line_path, self.firmware_path, enc
+                    )
+                return self.addr2line.resolve(addresses)
+            except (Addr2lineError, OSError):
+                if self.addr2line is not None:
+                    self.addr2line.close()
+                    self.addr2line = None
+
+        # a single call for the whole backtrace if the process keeps failing
+        output = subprocess.check_output(
+            [self.addr2line_path, u"-fipC", u"-e", self.firmware_path]
+            + addresses
+        ).decode(enc)
+        records = []
+        for line in output.splitlines():
+            if line.startswith(" (inlined by)") and records:
+                records[-1] += "\n" + line
+            else:
+                records.append(line)
+        if len(records) != len(addresses):
+            raise Addr2lineError("unexpected output from addr2line")
+        return records
+
     def strip_project_dir(self, trace):
         while True:
             idx = trace.find(self.project_dir)